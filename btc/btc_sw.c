@@ -33,6 +33,14 @@
 #include "btc_tx_buf.h"
 
 
+/**************************************************************************
+ * prototypes
+ **************************************************************************/
+
+static bool sighash_ctx_is_cached(const btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx);
+static bool sighash_ctx_update(btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx);
+
+
 /**************************************************************************
  * public functions
  **************************************************************************/
@@ -102,6 +110,21 @@ bool btc_sw_scriptcode_p2wsh_vin(utl_buf_t *pScriptCode, const btc_vin_t *pVin)
 
 
 bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode)
+{
+    btc_sw_sighash_ctx_t ctx;
+
+    btc_sw_sighash_ctx_init(&ctx);
+    return btc_sw_sighash_ctx(&ctx, pTx, pTxHash, Index, Value, pScriptCode);
+}
+
+
+void btc_sw_sighash_ctx_init(btc_sw_sighash_ctx_t *pCtx)
+{
+    memset(pCtx, 0, sizeof(btc_sw_sighash_ctx_t));
+}
+
+
+bool btc_sw_sighash_ctx(btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode)
 {
     // [transaction version : 4]
     // [hash_prevouts : 32]
@@ -118,18 +141,18 @@ bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint6
 
     bool ret = false;
     btc_buf_w_t buf_w;
-    btc_buf_w_t buf_w_tmp;
-    uint32_t lp;
     uint32_t index;
 
-    btc_tx_valid_t txvalid = btc_tx_is_valid(pTx);
-    if (txvalid != BTC_TXVALID_OK) {
-        LOGE("fail: invalid tx\n");
+    if (!sighash_ctx_is_cached(pCtx, pTx)) {
+        //hash_prevouts, hash_sequence, hash_outputsはvinによらないので、txが変わったときだけ計算する
+        if (!sighash_ctx_update(pCtx, pTx)) return false;
+    }
+    if (Index >= pTx->vin_cnt) {
+        LOGE("fail: invalid index\n");
         return false;
     }
 
     if (!btc_buf_w_init(&buf_w, 0)) return false;
-    if (!btc_buf_w_init(&buf_w_tmp, 0)) return false;
 
     //version
     if (!btc_buf_w_write_u32le(&buf_w, pTx->version)) goto LABEL_EXIT;
@@ -137,40 +160,15 @@ bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint6
     //vin:
     // prev outs:
 
-    //hash_prevouts: HASH256((txid(32) | index(4)) * n)
-    btc_buf_w_truncate(&buf_w_tmp);
-    for (lp = 0; lp < pTx->vin_cnt; lp++) {
-        btc_vin_t *vin = &pTx->vin[lp];
-
-        if (!btc_buf_w_write_data(&buf_w_tmp, vin->txid, BTC_SZ_TXID)) goto LABEL_EXIT;
-        uint32_t index = vin->index;
-#ifdef USE_ELEMENTS
-        if (vin->issuance) index |= BTC_TX_ELE_IDX_ISSUANCE;
-        if (vin->pegin) index |= BTC_TX_ELE_IDX_PEGIN;
-#endif
-        if (!btc_buf_w_write_u32le(&buf_w_tmp, index)) goto LABEL_EXIT;
-    }
-    if (!btc_buf_w_write_hash256(&buf_w, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp))) goto LABEL_EXIT;
+    //hash_prevouts
+    if (!btc_buf_w_write_data(&buf_w, pCtx->hash_prevouts, BTC_SZ_HASH256)) goto LABEL_EXIT;
 
-    //hash_sequence: HASH256(sequence(4) * n)
-    btc_buf_w_truncate(&buf_w_tmp);
-    for (lp = 0; lp < pTx->vin_cnt; lp++) {
-        if (!btc_buf_w_write_u32le(&buf_w_tmp, pTx->vin[lp].sequence)) goto LABEL_EXIT;
-    }
-    if (!btc_buf_w_write_hash256(&buf_w, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp))) goto LABEL_EXIT;
+    //hash_sequence
+    if (!btc_buf_w_write_data(&buf_w, pCtx->hash_sequence, BTC_SZ_HASH256)) goto LABEL_EXIT;
 
 #ifdef USE_ELEMENTS
     //hashIssuance
-    btc_buf_w_truncate(&buf_w_tmp);
-    for (lp = 0; lp < pTx->vin_cnt; lp++) {
-        if (pTx->vin[lp].issuance) {
-            LOGE("NOT UNSUPPORTED\n");
-            assert(false);
-        } else {
-            if (!btc_buf_w_write_byte(&buf_w_tmp, 0x00)) goto LABEL_EXIT;
-        }
-    }
-    if (!btc_buf_w_write_hash256(&buf_w, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp))) goto LABEL_EXIT;
+    if (!btc_buf_w_write_data(&buf_w, pCtx->hash_issuance, BTC_SZ_HASH256)) goto LABEL_EXIT;
 #endif
 
     //outpoint: txid(32) | Index(4)
@@ -207,25 +205,8 @@ bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint6
     //vout:
     // next vins:
 
-    //hash_outputs: HASH256((value(8) | scriptPk) * n)
-    btc_buf_w_truncate(&buf_w_tmp);
-    for (lp = 0; lp < pTx->vout_cnt; lp++) {
-        btc_vout_t *vout = &pTx->vout[lp];
-#if defined(USE_BITCOIN)
-        if (!btc_buf_w_write_u64le(&buf_w_tmp, vout->value)) goto LABEL_EXIT;
-        if (!btc_tx_buf_w_write_varint_len(&buf_w_tmp, vout->script.len)) goto LABEL_EXIT;
-        if (!btc_buf_w_write_data(&buf_w_tmp, vout->script.buf, vout->script.len)) goto LABEL_EXIT;
-#elif defined(USE_ELEMENTS)
-        if (!btc_buf_w_write_byte(&buf_w_tmp, BTC_TX_ELE_VOUT_VER_EXPLICIT)) goto LABEL_EXIT;
-        if (!btc_buf_w_write_data(&buf_w_tmp, vout->asset, BTC_SZ_HASH256)) goto LABEL_EXIT;
-        if (!btc_buf_w_write_byte(&buf_w_tmp, BTC_TX_ELE_VOUT_VER_EXPLICIT)) goto LABEL_EXIT;
-        if (!btc_buf_w_write_u64be(&buf_w_tmp, vout->value)) goto LABEL_EXIT;
-        if (!btc_buf_w_write_byte(&buf_w_tmp, BTC_TX_ELE_VOUT_VER_NULL)) goto LABEL_EXIT;
-        if (!btc_tx_buf_w_write_varint_len(&buf_w_tmp, vout->script.len)) goto LABEL_EXIT;
-        if (!btc_buf_w_write_data(&buf_w_tmp, vout->script.buf, vout->script.len)) goto LABEL_EXIT;
-#endif
-    }
-    if (!btc_buf_w_write_hash256(&buf_w, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp))) goto LABEL_EXIT;
+    //hash_outputs
+    if (!btc_buf_w_write_data(&buf_w, pCtx->hash_outputs, BTC_SZ_HASH256)) goto LABEL_EXIT;
 
     //locktime
     if (!btc_buf_w_write_u32le(&buf_w, pTx->locktime)) goto LABEL_EXIT;
@@ -245,7 +226,6 @@ LABEL_EXIT:
         LOGE("fail: sign\n");
     }
     btc_tx_buf_w_free(&buf_w);
-    btc_tx_buf_w_free(&buf_w_tmp);
 
     return ret;
 }
@@ -268,6 +248,17 @@ bool btc_sw_sighash_p2wsh_wit(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t In
 }
 
 
+bool btc_sw_sighash_p2wsh_wit_ctx(btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pWitScript)
+{
+    utl_buf_t script_code = UTL_BUF_INIT;
+
+    if (!btc_script_p2wsh_create_scriptcode(&script_code, pWitScript)) return false;
+    bool ret = btc_sw_sighash_ctx(pCtx, pTx, pTxHash, Index, Value, &script_code);
+    utl_buf_free(&script_code);
+    return ret;
+}
+
+
 bool btc_sw_set_vin_p2wpkh(btc_tx_t *pTx, uint32_t Index, const utl_buf_t *pSig, const uint8_t *pPubKey)
 {
     btc_vin_t *vin = &(pTx->vin[Index]);
@@ -417,3 +408,115 @@ void btc_sw_wit2prog_p2wsh(uint8_t *pWitProg, const utl_buf_t *pWitScript)
     pWitProg[1] = BTC_SZ_HASH256;
     btc_md_sha256(pWitProg + 2, pWitScript->buf, pWitScript->len);
 }
+
+
+/**************************************************************************
+ * private functions
+ **************************************************************************/
+
+/** キャッシュしたmidstateが使えるかどうか
+ *
+ * @param[in]       pCtx
+ * @param[in]       pTx
+ * @retval  true    pCtxのmidstateはpTxのもの
+ */
+static bool sighash_ctx_is_cached(const btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx)
+{
+    return (pCtx->p_tx == pTx) &&
+        (pCtx->p_vin == pTx->vin) && (pCtx->vin_cnt == pTx->vin_cnt) &&
+        (pCtx->p_vout == pTx->vout) && (pCtx->vout_cnt == pTx->vout_cnt);
+}
+
+
+/** midstate計算
+ *
+ * @param[out]      pCtx
+ * @param[in]       pTx
+ * @retval  false   pTxがトランザクションとして不正
+ */
+static bool sighash_ctx_update(btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx)
+{
+    bool ret = false;
+    btc_buf_w_t buf_w_tmp;
+    uint32_t lp;
+
+    btc_sw_sighash_ctx_init(pCtx);
+
+    btc_tx_valid_t txvalid = btc_tx_is_valid(pTx);
+    if (txvalid != BTC_TXVALID_OK) {
+        LOGE("fail: invalid tx\n");
+        return false;
+    }
+
+    if (!btc_buf_w_init(&buf_w_tmp, 0)) return false;
+
+    //hash_prevouts: HASH256((txid(32) | index(4)) * n)
+    for (lp = 0; lp < pTx->vin_cnt; lp++) {
+        btc_vin_t *vin = &pTx->vin[lp];
+
+        if (!btc_buf_w_write_data(&buf_w_tmp, vin->txid, BTC_SZ_TXID)) goto LABEL_EXIT;
+        uint32_t index = vin->index;
+#ifdef USE_ELEMENTS
+        if (vin->issuance) index |= BTC_TX_ELE_IDX_ISSUANCE;
+        if (vin->pegin) index |= BTC_TX_ELE_IDX_PEGIN;
+#endif
+        if (!btc_buf_w_write_u32le(&buf_w_tmp, index)) goto LABEL_EXIT;
+    }
+    btc_md_hash256(pCtx->hash_prevouts, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp));
+
+    //hash_sequence: HASH256(sequence(4) * n)
+    btc_buf_w_truncate(&buf_w_tmp);
+    for (lp = 0; lp < pTx->vin_cnt; lp++) {
+        if (!btc_buf_w_write_u32le(&buf_w_tmp, pTx->vin[lp].sequence)) goto LABEL_EXIT;
+    }
+    btc_md_hash256(pCtx->hash_sequence, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp));
+
+#ifdef USE_ELEMENTS
+    //hashIssuance
+    btc_buf_w_truncate(&buf_w_tmp);
+    for (lp = 0; lp < pTx->vin_cnt; lp++) {
+        if (pTx->vin[lp].issuance) {
+            LOGE("NOT UNSUPPORTED\n");
+            assert(false);
+        } else {
+            if (!btc_buf_w_write_byte(&buf_w_tmp, 0x00)) goto LABEL_EXIT;
+        }
+    }
+    btc_md_hash256(pCtx->hash_issuance, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp));
+#endif
+
+    //hash_outputs: HASH256((value(8) | scriptPk) * n)
+    btc_buf_w_truncate(&buf_w_tmp);
+    for (lp = 0; lp < pTx->vout_cnt; lp++) {
+        btc_vout_t *vout = &pTx->vout[lp];
+#if defined(USE_BITCOIN)
+        if (!btc_buf_w_write_u64le(&buf_w_tmp, vout->value)) goto LABEL_EXIT;
+        if (!btc_tx_buf_w_write_varint_len(&buf_w_tmp, vout->script.len)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_data(&buf_w_tmp, vout->script.buf, vout->script.len)) goto LABEL_EXIT;
+#elif defined(USE_ELEMENTS)
+        if (!btc_buf_w_write_byte(&buf_w_tmp, BTC_TX_ELE_VOUT_VER_EXPLICIT)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_data(&buf_w_tmp, vout->asset, BTC_SZ_HASH256)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_byte(&buf_w_tmp, BTC_TX_ELE_VOUT_VER_EXPLICIT)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_u64be(&buf_w_tmp, vout->value)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_byte(&buf_w_tmp, BTC_TX_ELE_VOUT_VER_NULL)) goto LABEL_EXIT;
+        if (!btc_tx_buf_w_write_varint_len(&buf_w_tmp, vout->script.len)) goto LABEL_EXIT;
+        if (!btc_buf_w_write_data(&buf_w_tmp, vout->script.buf, vout->script.len)) goto LABEL_EXIT;
+#endif
+    }
+    btc_md_hash256(pCtx->hash_outputs, btc_tx_buf_w_get_data(&buf_w_tmp), btc_tx_buf_w_get_len(&buf_w_tmp));
+
+    pCtx->p_tx = pTx;
+    pCtx->p_vin = pTx->vin;
+    pCtx->vin_cnt = pTx->vin_cnt;
+    pCtx->p_vout = pTx->vout;
+    pCtx->vout_cnt = pTx->vout_cnt;
+    ret = true;
+
+LABEL_EXIT:
+    if (!ret) {
+        LOGE("fail: midstate\n");
+    }
+    btc_tx_buf_w_free(&buf_w_tmp);
+
+    return ret;
+}
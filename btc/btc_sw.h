@@ -57,6 +57,31 @@ extern "C" {
  * typedefs
  **************************************************************************/
 
+/** @struct btc_sw_sighash_ctx_t
+ *  @brief  BIP143 sighash計算のmidstate
+ *
+ * hashPrevouts, hashSequence, hashOutputsは署名するvinによらないため、
+ * 同じトランザクションの複数vinを計算する場合に再利用する。
+ * 対象トランザクションやvin/voutの配列・数が変わると計算し直す。
+ *
+ * @note
+ *      - witnessやscriptSig以外のvin/voutの内容を書き換えた場合は #btc_sw_sighash_ctx_init()を呼ぶこと
+ */
+typedef struct {
+    const btc_tx_t      *p_tx;                              ///< 計算したトランザクション
+    const btc_vin_t     *p_vin;                             ///< 計算時のpTx->vin
+    uint32_t            vin_cnt;                            ///< 計算時のpTx->vin_cnt
+    const btc_vout_t    *p_vout;                            ///< 計算時のpTx->vout
+    uint32_t            vout_cnt;                           ///< 計算時のpTx->vout_cnt
+    uint8_t             hash_prevouts[BTC_SZ_HASH256];      ///< hashPrevouts
+    uint8_t             hash_sequence[BTC_SZ_HASH256];      ///< hashSequence
+#ifdef USE_ELEMENTS
+    uint8_t             hash_issuance[BTC_SZ_HASH256];      ///< hashIssuance
+#endif
+    uint8_t             hash_outputs[BTC_SZ_HASH256];       ///< hashOutputs
+} btc_sw_sighash_ctx_t;
+
+
 /**************************************************************************
  * prototypes
  **************************************************************************/
@@ -126,6 +151,28 @@ bool btc_sw_scriptcode_p2wsh_vin(utl_buf_t *pScriptCode, const btc_vin_t *pVin);
 bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode);
 
 
+/** #btc_sw_sighash_ctx_t 初期化
+ *
+ * @param[out]      pCtx
+ */
+void btc_sw_sighash_ctx_init(btc_sw_sighash_ctx_t *pCtx);
+
+
+/** segwitトランザクション署名用ハッシュ値計算(midstate再利用)
+ *
+ * #btc_sw_sighash()と同じ値になる。
+ *
+ * @param[in,out]   pCtx                #btc_sw_sighash_ctx_init()で初期化したmidstate
+ * @param[in]       pTx                 署名対象のトランザクションデータ
+ * @param[out]      pTxHash             署名に使用するハッシュ値(BTC_SZ_HASH256)
+ * @param[in]       Index               署名するINPUTのindex番号
+ * @param[in]       Value               署名するINPUTのvalue[単位:satoshi]
+ * @param[in]       pScriptCode         Script Code
+ * @retval  false   pTxがトランザクションとして不正
+ */
+bool btc_sw_sighash_ctx(btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pScriptCode);
+
+
 /** P2WSH署名 - Phase1: トランザクションハッシュ作成
  *
  * @param[in]       pTx
@@ -138,6 +185,19 @@ bool btc_sw_sighash(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint6
 bool btc_sw_sighash_p2wsh_wit(const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pWitScript);
 
 
+/** P2WSH署名 - Phase1: トランザクションハッシュ作成(midstate再利用)
+ *
+ * @param[in,out]   pCtx
+ * @param[in]       pTx
+ * @param[out]      pTxHash
+ * @param[in]       Index
+ * @param[in]       Value
+ * @param[in]       pWitScript
+ * @retval  false   pTxがトランザクションとして不正
+ */
+bool btc_sw_sighash_p2wsh_wit_ctx(btc_sw_sighash_ctx_t *pCtx, const btc_tx_t *pTx, uint8_t *pTxHash, uint32_t Index, uint64_t Value, const utl_buf_t *pWitScript);
+
+
 /** P2WPKHのwitness作成
  *
  * @param[in,out]   pTx         対象トランザクション
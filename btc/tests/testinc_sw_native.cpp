@@ -75,3 +75,167 @@ TEST_F(sw_native, init)
 
     btc_tx_free(&tx);
 }
+
+
+//BIP143 Native P2WPKH
+//  https://github.com/bitcoin/bips/blob/master/bip-0143.mediawiki#native-p2wpkh
+TEST_F(sw_native, sighash_ctx_bip143)
+{
+    const char TX[] =
+        "0100000002fff7f7881a8099afa6940d42d1e7f6362bec38171ea3edf433541db4e4ad969f0000000000eeffffff"
+        "ef51e1b804cc89d182d279655c3aa89e815b1b309fe287d9b2b55d57b90ec68a0100000000ffffffff"
+        "02202cb206000000001976a9148280b37df378db99f66f85c95a783a76ac7a6d5988ac"
+        "9093510d000000001976a9143bde42dbee7e4dbe6a21b2d50ce2f0167faa815988ac11000000";
+    const uint8_t PUB[] = {
+        0x02, 0x54, 0x76, 0xc2, 0xe8, 0x31, 0x88, 0x36,
+        0x8d, 0xa1, 0xff, 0x3e, 0x29, 0x2e, 0x7a, 0xca,
+        0xfc, 0xdb, 0x35, 0x66, 0xbb, 0x0a, 0xd2, 0x53,
+        0xf6, 0x2f, 0xc7, 0x0f, 0x07, 0xae, 0xee, 0x63,
+        0x57,
+    };
+    const uint8_t SIGHASH[] = {
+        0xc3, 0x7a, 0xf3, 0x11, 0x16, 0xd1, 0xb2, 0x7c,
+        0xaf, 0x68, 0xaa, 0xe9, 0xe3, 0xac, 0x82, 0xf1,
+        0x47, 0x79, 0x29, 0x01, 0x4d, 0x5b, 0x91, 0x76,
+        0x57, 0xd0, 0xeb, 0x49, 0x47, 0x8c, 0xb6, 0x70,
+    };
+    uint8_t txbin[sizeof(TX) / 2];
+    ASSERT_TRUE(utl_str_str2bin(txbin, sizeof(txbin), TX));
+
+    btc_tx_t tx = BTC_TX_INIT;
+    ASSERT_TRUE(btc_tx_read(&tx, txbin, sizeof(txbin)));
+    utl_buf_t script_code = UTL_BUF_INIT;
+    ASSERT_TRUE(btc_script_p2wpkh_create_scriptcode(&script_code, PUB));
+
+    uint8_t txhash[BTC_SZ_HASH256];
+    ASSERT_TRUE(btc_sw_sighash(&tx, txhash, 1, BTC_BTC2SATOSHI(6), &script_code));
+    ASSERT_EQ(0, memcmp(SIGHASH, txhash, sizeof(SIGHASH)));
+
+    btc_sw_sighash_ctx_t ctx;
+    btc_sw_sighash_ctx_init(&ctx);
+    memset(txhash, 0, sizeof(txhash));
+    ASSERT_TRUE(btc_sw_sighash_ctx(&ctx, &tx, txhash, 1, BTC_BTC2SATOSHI(6), &script_code));
+    ASSERT_EQ(0, memcmp(SIGHASH, txhash, sizeof(SIGHASH)));
+    //2回目はmidstateを使う
+    memset(txhash, 0, sizeof(txhash));
+    ASSERT_TRUE(btc_sw_sighash_ctx(&ctx, &tx, txhash, 1, BTC_BTC2SATOSHI(6), &script_code));
+    ASSERT_EQ(0, memcmp(SIGHASH, txhash, sizeof(SIGHASH)));
+
+    ASSERT_FALSE(btc_sw_sighash_ctx(&ctx, &tx, txhash, 2, BTC_BTC2SATOSHI(6), &script_code));
+
+    utl_buf_free(&script_code);
+    btc_tx_free(&tx);
+}
+
+
+namespace {
+    void sighash_ctx_create_tx(btc_tx_t *pTx, uint32_t VinNum, uint32_t VoutNum)
+    {
+        uint8_t txid[BTC_SZ_TXID];
+        uint8_t pkh[BTC_SZ_HASH160];
+
+        btc_tx_init(pTx);
+        for (uint32_t lp = 0; lp < VinNum; lp++) {
+            memset(txid, (int)lp, sizeof(txid));
+            btc_vin_t *vin = btc_tx_add_vin(pTx, txid, lp);
+            vin->sequence = 0x80000000 | lp;
+        }
+        for (uint32_t lp = 0; lp < VoutNum; lp++) {
+            memset(pkh, (int)lp, sizeof(pkh));
+            btc_sw_add_vout_p2wpkh(pTx, 1000 + lp, pkh);
+        }
+        pTx->locktime = 0x20000000;
+    }
+}
+
+
+TEST_F(sw_native, sighash_ctx_same)
+{
+    const uint8_t PUB[] = {
+        0x02, 0x54, 0x76, 0xc2, 0xe8, 0x31, 0x88, 0x36,
+        0x8d, 0xa1, 0xff, 0x3e, 0x29, 0x2e, 0x7a, 0xca,
+        0xfc, 0xdb, 0x35, 0x66, 0xbb, 0x0a, 0xd2, 0x53,
+        0xf6, 0x2f, 0xc7, 0x0f, 0x07, 0xae, 0xee, 0x63,
+        0x57,
+    };
+    btc_tx_t tx;
+    sighash_ctx_create_tx(&tx, 5, 30);
+
+    utl_buf_t script_code = UTL_BUF_INIT;
+    ASSERT_TRUE(btc_script_p2wpkh_create_scriptcode(&script_code, PUB));
+
+    btc_sw_sighash_ctx_t ctx;
+    btc_sw_sighash_ctx_init(&ctx);
+    uint8_t hash1[BTC_SZ_HASH256];
+    uint8_t hash2[BTC_SZ_HASH256];
+    for (uint32_t lp = 0; lp < tx.vin_cnt; lp++) {
+        ASSERT_TRUE(btc_sw_sighash(&tx, hash1, lp, 5000 + lp, &script_code));
+        ASSERT_TRUE(btc_sw_sighash_ctx(&ctx, &tx, hash2, lp, 5000 + lp, &script_code));
+        ASSERT_EQ(0, memcmp(hash1, hash2, sizeof(hash1)));
+
+        //witnessはsighashに影響しない
+        utl_buf_t sig = { (uint8_t *)PUB, sizeof(PUB) };
+        ASSERT_TRUE(btc_sw_set_vin_p2wpkh(&tx, lp, &sig, PUB));
+    }
+
+    //voutが増えると計算し直す
+    btc_sw_add_vout_p2wpkh_pub(&tx, 1, PUB);
+    ASSERT_TRUE(btc_sw_sighash(&tx, hash1, 0, 5000, &script_code));
+    ASSERT_TRUE(btc_sw_sighash_ctx(&ctx, &tx, hash2, 0, 5000, &script_code));
+    ASSERT_EQ(0, memcmp(hash1, hash2, sizeof(hash1)));
+
+    //別のtx
+    btc_tx_t tx2;
+    sighash_ctx_create_tx(&tx2, 5, 29);
+    ASSERT_TRUE(btc_sw_sighash(&tx2, hash1, 0, 5000, &script_code));
+    ASSERT_TRUE(btc_sw_sighash_ctx(&ctx, &tx2, hash2, 0, 5000, &script_code));
+    ASSERT_EQ(0, memcmp(hash1, hash2, sizeof(hash1)));
+
+    //内容を書き換えた場合はinitし直す
+    tx2.vin[3].sequence = 0;
+    btc_sw_sighash_ctx_init(&ctx);
+    ASSERT_TRUE(btc_sw_sighash(&tx2, hash1, 1, 5000, &script_code));
+    ASSERT_TRUE(btc_sw_sighash_ctx(&ctx, &tx2, hash2, 1, 5000, &script_code));
+    ASSERT_EQ(0, memcmp(hash1, hash2, sizeof(hash1)));
+
+    //P2WSH
+    ASSERT_TRUE(btc_sw_sighash_p2wsh_wit(&tx2, hash1, 2, 5000, &script_code));
+    ASSERT_TRUE(btc_sw_sighash_p2wsh_wit_ctx(&ctx, &tx2, hash2, 2, 5000, &script_code));
+    ASSERT_EQ(0, memcmp(hash1, hash2, sizeof(hash1)));
+
+    utl_buf_free(&script_code);
+    btc_tx_free(&tx2);
+    btc_tx_free(&tx);
+}
+
+
+TEST_F(sw_native, sighash_ctx_all_vin)
+{
+    //多入力sweep + HTLCが多いcommitment txくらいの大きさで、全vinのsighashが一致する
+    const uint32_t VIN_NUM = 100;
+    const uint32_t VOUT_NUM = 483;
+    const uint8_t PUB[] = {
+        0x02, 0x54, 0x76, 0xc2, 0xe8, 0x31, 0x88, 0x36,
+        0x8d, 0xa1, 0xff, 0x3e, 0x29, 0x2e, 0x7a, 0xca,
+        0xfc, 0xdb, 0x35, 0x66, 0xbb, 0x0a, 0xd2, 0x53,
+        0xf6, 0x2f, 0xc7, 0x0f, 0x07, 0xae, 0xee, 0x63,
+        0x57,
+    };
+    btc_tx_t tx;
+    sighash_ctx_create_tx(&tx, VIN_NUM, VOUT_NUM);
+    utl_buf_t script_code = UTL_BUF_INIT;
+    ASSERT_TRUE(btc_script_p2wpkh_create_scriptcode(&script_code, PUB));
+
+    uint8_t hash1[BTC_SZ_HASH256];
+    uint8_t hash2[BTC_SZ_HASH256];
+    btc_sw_sighash_ctx_t ctx;
+    btc_sw_sighash_ctx_init(&ctx);
+    for (uint32_t lp = 0; lp < VIN_NUM; lp++) {
+        ASSERT_TRUE(btc_sw_sighash(&tx, hash1, lp, 5000 + lp, &script_code));
+        ASSERT_TRUE(btc_sw_sighash_ctx(&ctx, &tx, hash2, lp, 5000 + lp, &script_code));
+        ASSERT_EQ(0, memcmp(hash1, hash2, sizeof(hash1)));
+    }
+
+    utl_buf_free(&script_code);
+    btc_tx_free(&tx);
+}
@@ -47,6 +47,7 @@
 #include "ln_local.h"
 #include "ln_setupctl.h"
 #include "ln_anno.h"
+#include "ln_anno_ingest.h"
 
 
 /**************************************************************************
@@ -60,6 +61,14 @@
 
 #define M_SEND_ENCODED_IDS                  (50)
 
+/// reply_channel_range 1メッセージあたりのshort_channel_id最大数
+///     65535 - (type(2) + chain_hash(32) + first_blocknum(4) + number_of_blocks(4) + complete(1) + len(2)) - encoding(1)
+#define M_REPLY_RANGE_IDS_MAX               ((65535 - 45 - 1) / LN_SZ_SHORT_CHANNEL_ID)
+
+#define M_SCID_BLOCK(scid)                  ((scid) >> 40)                  ///< short_channel_id --> block height
+#define M_SCID_FROM_BLOCK(blk)              ((uint64_t)(blk) << 40)         ///< block height --> short_channel_id先頭
+#define M_SCID_BLOCK_MAX                    ((uint64_t)1 << 24)             ///< short_channel_idのblock height上限(24bit)
+
 
 /**************************************************************************
  * prototypes
@@ -68,7 +77,11 @@
 static bool proc_announcement_signatures(ln_channel_t *pChannel);
 static bool create_local_channel_announcement(ln_channel_t *pChannel);
 static bool get_node_id_from_channel_announcement(ln_channel_t *pChannel, uint8_t *pNodeId, uint64_t short_channel_id, uint8_t Dir);
+static bool anno_ingest(ln_channel_t *pChannel, const ln_anno_ingest_param_t *pParam, const uint8_t *pData, uint16_t Len);
 static bool create_channel_update(ln_channel_t *pChannel, ln_msg_channel_update_t *pUpd, utl_buf_t *pCnlUpd, uint32_t TimeStamp, uint8_t Flag);
+static size_t reply_channel_range_chunk(const uint64_t *pShortChannelIds, size_t Num, size_t MaxNum);
+static bool reply_channel_range_send_chunk(ln_channel_t *pChannel, const uint8_t *pChainHash,
+                uint32_t FirstBlocknum, uint32_t NumberOfBlocks, const uint64_t *pShortChannelIds, size_t Num);
 
 
 /**************************************************************************
@@ -194,22 +207,15 @@ static bool channel_announcement_recv(ln_channel_t *pChannel, const uint8_t *pDa
         return true;
     }
 
-    //XXX: check sign
-    //ln_msg_channel_announcement_verify
-
-    utl_buf_t buf = UTL_BUF_INIT;
-    buf.buf = (CONST_CAST uint8_t *)pData;
-    buf.len = Len;
-    if (!ln_db_cnlanno_save(&buf, msg.short_channel_id, ln_remote_node_id(pChannel), msg.p_node_id_1, msg.p_node_id_2)) {
-        LOGE("fail: save\n");
-        return false;
-    }
-    //LOGD("save channel_announcement: %016" PRIx64 "\n", msg.short_channel_id);
-
-    ln_cb_param_notify_annodb_update_t db;
-    db.type = LN_CB_ANNO_TYPE_CNL_ANNO;
-    ln_callback(pChannel, LN_CB_TYPE_NOTIFY_ANNODB_UPDATE, &db);
-    return true;
+    //署名検証してから保存する
+    ln_anno_ingest_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.type = LN_CB_ANNO_TYPE_CNL_ANNO;
+    param.short_channel_id = msg.short_channel_id;
+    memcpy(param.node_id[0], msg.p_node_id_1, BTC_SZ_PUBKEY);
+    memcpy(param.node_id[1], msg.p_node_id_2, BTC_SZ_PUBKEY);
+    memcpy(param.remote_node_id, ln_remote_node_id(pChannel), BTC_SZ_PUBKEY);
+    return anno_ingest(pChannel, &param, pData, Len);
 }
 
 
@@ -231,30 +237,16 @@ static bool node_announcement_recv(ln_channel_t *pChannel, const uint8_t *pData,
         LOGE("fail: read message\n");
         return false;
     }
-#if 0
-    if (!ln_msg_node_announcement_verify(&msg, pData, Len)) {
-        LOGE("fail: verify\n");
-        return false;
-    }
-#endif
 
     //LOGV("node_id:");
     //DUMPV(msg.p_node_id, BTC_SZ_PUBKEY);
 
-    utl_buf_t buf = UTL_BUF_INIT;
-    buf.buf = (CONST_CAST uint8_t *)pData;
-    buf.len = Len;
-    if (!ln_db_nodeanno_save(&buf, &msg, ln_remote_node_id(pChannel))) {
-        LOGE("fail: save\n");
-        return false;
-    }
-    //LOGD("save node_announcement: ");
-    //DUMPD(msg.p_node_id, BTC_SZ_PUBKEY);
-
-    ln_cb_param_notify_annodb_update_t db;
-    db.type = LN_CB_ANNO_TYPE_NODE_ANNO;
-    ln_callback(pChannel, LN_CB_TYPE_NOTIFY_ANNODB_UPDATE, &db);
-    return true;
+    //署名検証してから保存する
+    ln_anno_ingest_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.type = LN_CB_ANNO_TYPE_NODE_ANNO;
+    memcpy(param.remote_node_id, ln_remote_node_id(pChannel), BTC_SZ_PUBKEY);
+    return anno_ingest(pChannel, &param, pData, Len);
 }
 
 
@@ -328,19 +320,23 @@ static bool channel_update_recv(ln_channel_t *pChannel, const uint8_t *pData, ui
 
     //LOGV("recv channel_update: %016" PRIx64 ":%d\n", msg.short_channel_id, dir);
 
-    uint8_t node_id[BTC_SZ_PUBKEY];
-    if (get_node_id_from_channel_announcement(pChannel, node_id, msg.short_channel_id, dir)) {
+    ln_anno_ingest_param_t param;
+    memset(&param, 0, sizeof(param));
+    param.type = LN_CB_ANNO_TYPE_CNL_UPD;
+    param.short_channel_id = msg.short_channel_id;
+    param.dir = (uint8_t)dir;
+    param.timestamp = msg.timestamp;
+    memcpy(param.remote_node_id, ln_remote_node_id(pChannel), BTC_SZ_PUBKEY);
+
+    //検証待ちのchannel_announcementを優先する
+    param.anno_queued = ln_anno_ingest_search_cnlanno(param.node_id[0], msg.short_channel_id, dir);
+    if ( param.anno_queued ||
+         get_node_id_from_channel_announcement(pChannel, param.node_id[0], msg.short_channel_id, dir) ) {
         //found(including own channel)
-        if (!btc_keys_check_pub(node_id)) {
+        if (!btc_keys_check_pub(param.node_id[0])) {
             LOGE("fail: invalid pubkey\n");
             return false;
         }
-#if 0
-        if (!ln_msg_channel_update_verify(node_id, pData, Len)) {
-            LOGE("fail: verify\n");
-            return false;
-        }
-#endif
     } else {
         //not found
         if (msg.short_channel_id == pChannel->short_channel_id) {
@@ -359,19 +355,8 @@ static bool channel_update_recv(ln_channel_t *pChannel, const uint8_t *pData, ui
         return false;
     }
 
-    utl_buf_t buf = UTL_BUF_INIT;
-    buf.buf = (CONST_CAST uint8_t *)pData;
-    buf.len = Len;
-    if (!ln_db_cnlupd_save(&buf, &msg, ln_remote_node_id(pChannel))) {
-        LOGE("fail: save\n");
-        return false;
-    }
-    //LOGD("save channel_update: %016" PRIx64 ":%d\n", msg.short_channel_id, dir);
-
-    ln_cb_param_notify_annodb_update_t db;
-    db.type = LN_CB_ANNO_TYPE_CNL_UPD;
-    ln_callback(pChannel, LN_CB_TYPE_NOTIFY_ANNODB_UPDATE, &db);
-    return true;
+    //署名検証してから保存する
+    return anno_ingest(pChannel, &param, pData, Len);
 }
 
 
@@ -540,67 +525,88 @@ bool HIDDEN ln_query_channel_range_recv(ln_channel_t *pChannel, const uint8_t *p
 
 bool ln_reply_channel_range_send(ln_channel_t *pChannel, const ln_msg_query_channel_range_t *pMsg)
 {
-    bool ret;
+    bool ret = false;
 
     if ((pChannel->init_flag & M_INIT_GOSSIP_QUERY) == 0) {
         LOGE("fail: not gossip_queries\n");
         return false;
     }
 
-    ln_msg_reply_channel_range_t msg;
-    msg.p_chain_hash = pMsg->p_chain_hash;
+    //要求範囲の終わり(reply_channel_rangeでここまで隙間なく返す)
+    uint64_t range_end = (uint64_t)pMsg->first_blocknum + pMsg->number_of_blocks;
+    if (range_end > UINT32_MAX) {
+        range_end = UINT32_MAX;
+    }
+    if (pMsg->first_blocknum >= M_SCID_BLOCK_MAX) {
+        //short_channel_idのblock heightは24bitなので該当なし
+        //  (seekするとkeyが桁あふれして、first_blocknumより前から取得してしまう)
+        LOGD("no short_channel_id: first_blocknum=%" PRIu32 "\n", pMsg->first_blocknum);
+        return reply_channel_range_send_chunk(pChannel, pMsg->p_chain_hash,
+                    pMsg->first_blocknum, (uint32_t)(range_end - pMsg->first_blocknum), NULL, 0);
+    }
 
     //get short_channel_ids from DB
-    //  heightからshort_channel_idを取得する
-    //  "ascending order"という仕様があるので、昇順
-
-    //get all short_channel_id
+    //  first_blocknum以上、first_blocknum+number_of_blocks未満のheightを持つshort_channel_idを取得する
+    //  DBのkeyはbig-endianのshort_channel_idなので、first_blocknumの位置からseekすれば昇順に並ぶ
+    uint64_t block_end = (range_end < M_SCID_BLOCK_MAX) ? range_end : M_SCID_BLOCK_MAX;
     uint64_t short_channel_id = 0;
     void *p_cur_cnl = NULL;         //channel
-    if (!ln_db_anno_transaction()) {
+    if (!ln_db_anno_read_begin()) {
         LOGE("fail\n");
         return false;
     }
     if (!ln_db_anno_cur_open(&p_cur_cnl, LN_DB_CUR_CNLANNO)) {
         LOGE("fail\n");
-        ln_db_anno_commit(false);
+        ln_db_anno_read_end();
         return false;
     }
-    utl_buf_t short_ids;
+    utl_buf_t short_ids = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &short_ids, 0);
     char type;
-    while (ln_db_cnlanno_cur_get(p_cur_cnl, &short_channel_id, &type, NULL, NULL)) {
-        //LOGD("short_channel_id=%016" PRIx64 ", type=%c\n", short_channel_id, type);
+    bool b_get = ln_db_cnlanno_cur_seek(p_cur_cnl, &short_channel_id, &type, NULL, NULL,
+                    M_SCID_FROM_BLOCK(pMsg->first_blocknum));
+    while (b_get) {
+        if (M_SCID_BLOCK(short_channel_id) >= block_end) {
+            break;
+        }
         if (type == LN_DB_CNLANNO_ANNO) {
             //channel_announcementがあるものだけ送信する
             utl_push_data(&push, &short_channel_id, LN_SZ_SHORT_CHANNEL_ID);
         }
+        b_get = ln_db_cnlanno_cur_get(p_cur_cnl, &short_channel_id, &type, NULL, NULL);
     }
     ln_db_anno_cur_close(p_cur_cnl);
-    ln_db_anno_commit(false);
-
-    //encode
-    utl_buf_t encoded_ids = UTL_BUF_INIT;
-    ret = ln_msg_gossip_ids_encode(&encoded_ids, (const uint64_t *)short_ids.buf, short_ids.len / LN_SZ_SHORT_CHANNEL_ID);
-    utl_buf_free(&short_ids);
-    if (!ret) {
-        utl_buf_free(&encoded_ids);
-        return false;
-    }
+    ln_db_anno_read_end();
 
     //send
-    msg.first_blocknum = pMsg->first_blocknum;
-    msg.number_of_blocks = pMsg->number_of_blocks;
-    msg.complete = 1;
-    msg.len = (uint16_t)encoded_ids.len;
-    msg.p_encoded_short_ids = encoded_ids.buf;
-    utl_buf_t buf = UTL_BUF_INIT;
-    if (!ln_msg_reply_channel_range_write(&buf, &msg)) return false;
-    ln_callback(pChannel, LN_CB_TYPE_SEND_MESSAGE, &buf);
-    utl_buf_free(&buf);
-    utl_buf_free(&encoded_ids);
-    return true;
+    //  1メッセージに収まる数ごとに分割し、blockの範囲は隙間なく連続させる
+    //      (受信側はfirst_blocknumが前回の続きであることを要求する)
+    const uint64_t *p_ids = (const uint64_t *)short_ids.buf;
+    size_t num = short_ids.len / LN_SZ_SHORT_CHANNEL_ID;
+    size_t pos = 0;
+    uint32_t first_blocknum = pMsg->first_blocknum;
+    do {
+        size_t cnt = reply_channel_range_chunk(p_ids + pos, num - pos, M_REPLY_RANGE_IDS_MAX);
+        uint32_t next_blocknum;
+        if (pos + cnt < num) {
+            next_blocknum = (uint32_t)M_SCID_BLOCK(p_ids[pos + cnt]);
+        } else {
+            //最後は要求範囲の終わりまで
+            next_blocknum = (uint32_t)range_end;
+        }
+        if (!reply_channel_range_send_chunk(pChannel, pMsg->p_chain_hash,
+                    first_blocknum, next_blocknum - first_blocknum, p_ids + pos, cnt)) {
+            goto LABEL_EXIT;
+        }
+        first_blocknum = next_blocknum;
+        pos += cnt;
+    } while (pos < num);
+    ret = true;
+
+LABEL_EXIT:
+    utl_buf_free(&short_ids);
+    return ret;
 }
 
 
@@ -892,6 +898,33 @@ LABEL_EXIT:
 }
 
 
+/** 受信announcementの署名検証と保存
+ *
+ * #ln_anno_ingest_push()でqueueに入れた場合、保存後の通知は#ln_anno_ingest_start()の通知関数で行う。
+ *
+ * @param[in,out]       pChannel        channel情報
+ * @param[in]           pParam          受信announcement情報
+ * @param[in]           pData           受信メッセージ
+ * @param[in]           Len             pData長
+ * @retval  true    queueに入れた、もしくは検証OKで保存した
+ */
+static bool anno_ingest(ln_channel_t *pChannel, const ln_anno_ingest_param_t *pParam, const uint8_t *pData, uint16_t Len)
+{
+    bool queued;
+    if (!ln_anno_ingest_push(pParam, pData, Len, &queued)) {
+        //queueが一杯の場合もあるため、LOGEにはしない
+        LOGD("fail: verify, save or queue full\n");
+        return false;
+    }
+    if (!queued) {
+        ln_cb_param_notify_annodb_update_t db;
+        db.type = pParam->type;
+        ln_callback(pChannel, LN_CB_TYPE_NOTIFY_ANNODB_UPDATE, &db);
+    }
+    return true;
+}
+
+
 /** channel_update作成
  *
  * @param[in,out]       pChannel        channel情報
@@ -920,3 +953,84 @@ static bool create_channel_update(
     if (!ln_msg_channel_update_write(pCnlUpd, pUpd)) return false;
     return ln_msg_channel_update_sign(pCnlUpd->buf, pCnlUpd->len);
 }
+
+
+/** reply_channel_range 1メッセージ分のshort_channel_id数
+ *
+ * MaxNumを超える場合は、同じblockのshort_channel_idが分かれないように手前で区切る。
+ * 1blockだけでMaxNumを超える場合はMaxNumで区切る(number_of_blocksは0になる)。
+ *
+ * @param[in]   pShortChannelIds    short_channel_id(昇順)
+ * @param[in]   Num                 pShortChannelIds数
+ * @param[in]   MaxNum              1メッセージの最大数
+ * @return  先頭から1メッセージに入れる数
+ */
+static size_t reply_channel_range_chunk(const uint64_t *pShortChannelIds, size_t Num, size_t MaxNum)
+{
+    if (Num <= MaxNum) {
+        return Num;
+    }
+    uint64_t block = M_SCID_BLOCK(pShortChannelIds[MaxNum]);
+    size_t cnt = MaxNum;
+    while ((cnt > 0) && (M_SCID_BLOCK(pShortChannelIds[cnt - 1]) == block)) {
+        cnt--;
+    }
+    if (cnt == 0) {
+        LOGD("too many short_channel_id in block %" PRIu64 "\n", block);
+        cnt = MaxNum;
+    }
+    return cnt;
+}
+
+
+/** reply_channel_range 1メッセージ送信
+ *
+ * 無圧縮で1メッセージに収まる数を渡す。
+ * zlibを使った方が小さくなる場合はzlibで送信する。
+ *
+ * @param[in,out]   pChannel            channel info
+ * @param[in]       pChainHash          chain_hash
+ * @param[in]       FirstBlocknum       first_blocknum
+ * @param[in]       NumberOfBlocks      number_of_blocks
+ * @param[in]       pShortChannelIds    short_channel_id(昇順)
+ * @param[in]       Num                 pShortChannelIds数
+ * @retval  true    成功
+ */
+static bool reply_channel_range_send_chunk(ln_channel_t *pChannel, const uint8_t *pChainHash,
+                uint32_t FirstBlocknum, uint32_t NumberOfBlocks, const uint64_t *pShortChannelIds, size_t Num)
+{
+    utl_buf_t encoded_ids = UTL_BUF_INIT;
+    if (!ln_msg_gossip_ids_encode_type(&encoded_ids, pShortChannelIds, Num, LN_GOSSIPQUERY_ENCODE_NONE)) {
+        LOGE("fail: encode\n");
+        return false;
+    }
+    if (Num > 1) {
+        utl_buf_t encoded_zlib = UTL_BUF_INIT;
+        if (ln_msg_gossip_ids_encode_type(&encoded_zlib, pShortChannelIds, Num, LN_GOSSIPQUERY_ENCODE_ZLIB) &&
+                (encoded_zlib.len < encoded_ids.len)) {
+            utl_buf_free(&encoded_ids);
+            encoded_ids = encoded_zlib;
+        } else {
+            utl_buf_free(&encoded_zlib);
+        }
+    }
+    LOGD("first_blocknum=%" PRIu32 ", number_of_blocks=%" PRIu32 ", ids=%lu, len=%" PRIu32 "(%s)\n",
+        FirstBlocknum, NumberOfBlocks, (unsigned long)Num, encoded_ids.len,
+        (encoded_ids.buf[0] == LN_GOSSIPQUERY_ENCODE_ZLIB) ? "zlib" : "none");
+
+    ln_msg_reply_channel_range_t msg;
+    msg.p_chain_hash = pChainHash;
+    msg.first_blocknum = FirstBlocknum;
+    msg.number_of_blocks = NumberOfBlocks;
+    msg.complete = 1;
+    msg.len = (uint16_t)encoded_ids.len;
+    msg.p_encoded_short_ids = encoded_ids.buf;
+    utl_buf_t buf = UTL_BUF_INIT;
+    bool ret = ln_msg_reply_channel_range_write(&buf, &msg);
+    if (ret) {
+        ln_callback(pChannel, LN_CB_TYPE_SEND_MESSAGE, &buf);
+    }
+    utl_buf_free(&buf);
+    utl_buf_free(&encoded_ids);
+    return ret;
+}
@@ -0,0 +1,537 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_anno_ingest.c
+ *  @brief  受信announcementの署名検証とDB保存
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+#include "utl_common.h"
+#include "utl_dbg.h"
+#include "utl_buf.h"
+#define LOG_TAG "ln_anno_ingest"
+#include "utl_log.h"
+
+#include "ln_db.h"
+#include "ln_msg_anno.h"
+#include "ln_anno_ingest.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_THREAD_MAX            (16)        ///< 検証thread最大数
+#define M_QUEUE_MAX             (4096)      ///< queue最大数(超える場合は破棄する)
+#define M_VERIFY_BATCH          (32)        ///< 検証threadが一度に取り出す数
+
+#define M_USEC_PER_SEC          ((int64_t)1000000)
+
+#define M_STATE_WAIT            (0)         ///< 検証待ち
+#define M_STATE_VERIFY          (1)         ///< 検証中
+#define M_STATE_DONE            (2)         ///< 検証済み(保存待ち)
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+typedef struct ingest_job_t {
+    TAILQ_ENTRY(ingest_job_t)   list;
+    ln_anno_ingest_param_t      param;
+    utl_buf_t                   buf;
+    uint8_t                     state;          ///< M_STATE_xxx
+    bool                        verified;       ///< true:署名OK
+    bool                        saved;          ///< true:DB保存した
+    bool                        coalesced;      ///< true:同じbatch内に新しいchannel_updateがある
+} ingest_job_t;
+
+TAILQ_HEAD(ingest_job_head_t, ingest_job_t);
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static pthread_mutex_t          mMuxIngest = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           mCondVerify = PTHREAD_COND_INITIALIZER;     ///< 検証待ちあり
+static pthread_cond_t           mCondCommit = PTHREAD_COND_INITIALIZER;     ///< 保存待ちあり
+
+static struct ingest_job_head_t mJobHead = TAILQ_HEAD_INITIALIZER(mJobHead);
+static ingest_job_t             *mpNextVerify;      ///< 次に検証するjob(以降はすべてM_STATE_WAIT)
+static uint32_t                 mDepth;
+
+static bool                     mStarted;
+static bool                     mStop;
+static uint32_t                 mThreadNum;
+static pthread_t                mThVerify[M_THREAD_MAX];
+static pthread_t                mThCommit;
+static ln_anno_ingest_notify_t  mpNotify;
+
+static ln_anno_ingest_stat_t    mStat;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static void *thread_verify_start(void *pArg);
+static void *thread_commit_start(void *pArg);
+static bool verify(const ln_anno_ingest_param_t *pParam, const utl_buf_t *pBuf);
+static bool save(const ln_anno_ingest_param_t *pParam, const utl_buf_t *pBuf);
+static void commit_batch(ingest_job_t **ppJobs, int Num);
+static void coalesce(ingest_job_t **ppJobs, int Num);
+static int64_t get_usec(clockid_t ClockId);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+bool ln_anno_ingest_start(uint32_t ThreadNum, ln_anno_ingest_notify_t pNotify)
+{
+    if (mStarted) {
+        LOGE("fail: already started\n");
+        return false;
+    }
+    if (ThreadNum == 0) {
+        ThreadNum = 1;
+    } else if (ThreadNum > M_THREAD_MAX) {
+        ThreadNum = M_THREAD_MAX;
+    }
+
+    mStop = false;
+    mpNotify = pNotify;
+    if (pthread_create(&mThCommit, NULL, &thread_commit_start, NULL) != 0) {
+        LOGE("fail: pthread_create\n");
+        return false;
+    }
+    for (mThreadNum = 0; mThreadNum < ThreadNum; mThreadNum++) {
+        if (pthread_create(&mThVerify[mThreadNum], NULL, &thread_verify_start, NULL) != 0) {
+            LOGE("fail: pthread_create\n");
+            break;
+        }
+    }
+    mStarted = true;
+    if (mThreadNum == 0) {
+        ln_anno_ingest_stop();
+        return false;
+    }
+    LOGD("start: %" PRIu32 " threads\n", mThreadNum);
+    return true;
+}
+
+
+void ln_anno_ingest_stop(void)
+{
+    if (!mStarted) return;
+
+    pthread_mutex_lock(&mMuxIngest);
+    mStop = true;
+    pthread_cond_broadcast(&mCondVerify);
+    pthread_cond_broadcast(&mCondCommit);
+    pthread_mutex_unlock(&mMuxIngest);
+
+    for (uint32_t lp = 0; lp < mThreadNum; lp++) {
+        pthread_join(mThVerify[lp], NULL);
+    }
+    pthread_join(mThCommit, NULL);
+
+    pthread_mutex_lock(&mMuxIngest);
+    mStarted = false;
+    mThreadNum = 0;
+    pthread_mutex_unlock(&mMuxIngest);
+    LOGD("stop\n");
+}
+
+
+bool ln_anno_ingest_push(const ln_anno_ingest_param_t *pParam, const uint8_t *pData, uint16_t Len, bool *pQueued)
+{
+    *pQueued = false;
+
+    pthread_mutex_lock(&mMuxIngest);
+    if (mStarted && !mStop && (mDepth >= M_QUEUE_MAX)) {
+        //受信threadは他peerのevent loopと共有しているため、空きを待たずに破棄する
+        //  (announcementは再送・再要求されうる)
+        mStat.dropped++;
+        pthread_mutex_unlock(&mMuxIngest);
+        LOGD("drop: queue full\n");
+        return false;
+    }
+    if (!mStarted || mStop) {
+        pthread_mutex_unlock(&mMuxIngest);
+
+        //呼び出したthreadで検証・保存する
+        const utl_buf_t buf = { (CONST_CAST uint8_t *)pData, Len };
+        if (!verify(pParam, &buf)) {
+            LOGE("fail: verify\n");
+            return false;
+        }
+        return save(pParam, &buf);
+    }
+
+    ingest_job_t *p_job = (ingest_job_t *)UTL_DBG_MALLOC(sizeof(ingest_job_t));
+    if (!p_job) {
+        pthread_mutex_unlock(&mMuxIngest);
+        LOGE("fail: malloc\n");
+        return false;
+    }
+    p_job->param = *pParam;
+    utl_buf_init(&p_job->buf);
+    if (!utl_buf_alloccopy(&p_job->buf, pData, Len)) {
+        pthread_mutex_unlock(&mMuxIngest);
+        UTL_DBG_FREE(p_job);
+        LOGE("fail: malloc\n");
+        return false;
+    }
+    p_job->state = M_STATE_WAIT;
+    p_job->verified = false;
+    p_job->saved = false;
+    p_job->coalesced = false;
+    TAILQ_INSERT_TAIL(&mJobHead, p_job, list);
+    if (!mpNextVerify) {
+        mpNextVerify = p_job;
+    }
+    mDepth++;
+    mStat.queued++;
+    pthread_cond_signal(&mCondVerify);
+    pthread_mutex_unlock(&mMuxIngest);
+
+    *pQueued = true;
+    return true;
+}
+
+
+bool ln_anno_ingest_search_cnlanno(uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir)
+{
+    bool ret = false;
+
+    pthread_mutex_lock(&mMuxIngest);
+    //保存中のjobもqueueに残っているため、見つからなければDBに保存済み
+    ingest_job_t *p_job;
+    TAILQ_FOREACH_REVERSE(p_job, &mJobHead, ingest_job_head_t, list) {
+        if ( (p_job->param.type == LN_CB_ANNO_TYPE_CNL_ANNO) &&
+             (p_job->param.short_channel_id == ShortChannelId) ) {
+            if ((p_job->state != M_STATE_DONE) || p_job->verified) {
+                memcpy(pNodeId, p_job->param.node_id[Dir ? 1 : 0], BTC_SZ_PUBKEY);
+                ret = true;
+            }
+            break;
+        }
+    }
+    pthread_mutex_unlock(&mMuxIngest);
+    return ret;
+}
+
+
+void ln_anno_ingest_get_stat(ln_anno_ingest_stat_t *pStat)
+{
+    pthread_mutex_lock(&mMuxIngest);
+    *pStat = mStat;
+    pStat->queue_depth = mDepth;
+    pthread_mutex_unlock(&mMuxIngest);
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+/** 検証thread
+ *
+ * 検証待ちjobをM_VERIFY_BATCHずつ取り出して検証する。
+ */
+static void *thread_verify_start(void *pArg)
+{
+    (void)pArg;
+
+    ingest_job_t *p_jobs[M_VERIFY_BATCH];
+
+    pthread_mutex_lock(&mMuxIngest);
+    for (;;) {
+        while (!mpNextVerify && !mStop) {
+            pthread_cond_wait(&mCondVerify, &mMuxIngest);
+        }
+        if (!mpNextVerify) {
+            //停止要求かつ検証待ちなし
+            break;
+        }
+
+        int num = 0;
+        while (mpNextVerify && (num < M_VERIFY_BATCH)) {
+            mpNextVerify->state = M_STATE_VERIFY;
+            p_jobs[num++] = mpNextVerify;
+            mpNextVerify = TAILQ_NEXT(mpNextVerify, list);
+        }
+        if (mpNextVerify) {
+            pthread_cond_signal(&mCondVerify);
+        }
+        pthread_mutex_unlock(&mMuxIngest);
+
+        for (int lp = 0; lp < num; lp++) {
+            p_jobs[lp]->verified = verify(&p_jobs[lp]->param, &p_jobs[lp]->buf);
+        }
+
+        pthread_mutex_lock(&mMuxIngest);
+        for (int lp = 0; lp < num; lp++) {
+            p_jobs[lp]->state = M_STATE_DONE;
+        }
+        pthread_cond_signal(&mCondCommit);
+    }
+    pthread_mutex_unlock(&mMuxIngest);
+    return NULL;
+}
+
+
+/** 保存thread
+ *
+ * 検証済みjobを受信順に取り出し、まとめて保存する。
+ * 取り出す数がLN_ANNO_INGEST_COMMIT_NUMに満たない場合は、
+ * 最初のjobを取り出せるようになってからLN_ANNO_INGEST_COMMIT_MSECまで待つ。
+ * channel_updateの検証にqueue中のchannel_announcementを使うため、保存後にqueueから外す。
+ */
+static void *thread_commit_start(void *pArg)
+{
+    (void)pArg;
+
+    ingest_job_t *p_jobs[LN_ANNO_INGEST_COMMIT_NUM];
+    int64_t deadline = 0;       //保存待ちの期限(CLOCK_REALTIME)
+
+    pthread_mutex_lock(&mMuxIngest);
+    for (;;) {
+        int num = 0;
+        ingest_job_t *p_job;
+        TAILQ_FOREACH(p_job, &mJobHead, list) {
+            if ((p_job->state != M_STATE_DONE) || (num >= LN_ANNO_INGEST_COMMIT_NUM)) break;
+            p_jobs[num++] = p_job;
+        }
+        if (num == 0) {
+            if (mStop && TAILQ_EMPTY(&mJobHead)) break;
+            pthread_cond_wait(&mCondCommit, &mMuxIngest);
+            continue;
+        }
+        if ((num < LN_ANNO_INGEST_COMMIT_NUM) && !mStop) {
+            int64_t now = get_usec(CLOCK_REALTIME);
+            if (deadline == 0) {
+                deadline = now + LN_ANNO_INGEST_COMMIT_MSEC * 1000;
+            }
+            if (now < deadline) {
+                struct timespec ts;
+                ts.tv_sec = (time_t)(deadline / M_USEC_PER_SEC);
+                ts.tv_nsec = (long)(deadline % M_USEC_PER_SEC) * 1000;
+                pthread_cond_timedwait(&mCondCommit, &mMuxIngest, &ts);
+                continue;
+            }
+        }
+        deadline = 0;
+        pthread_mutex_unlock(&mMuxIngest);
+
+        commit_batch(p_jobs, num);
+
+        pthread_mutex_lock(&mMuxIngest);
+        for (int lp = 0; lp < num; lp++) {
+            if (p_jobs[lp]->saved) {
+                mStat.saved++;
+            } else if (p_jobs[lp]->coalesced) {
+                mStat.coalesced++;
+            } else {
+                mStat.rejected++;
+            }
+            TAILQ_REMOVE(&mJobHead, p_jobs[lp], list);
+            utl_buf_free(&p_jobs[lp]->buf);
+            UTL_DBG_FREE(p_jobs[lp]);
+        }
+        mDepth -= num;
+    }
+    pthread_mutex_unlock(&mMuxIngest);
+    return NULL;
+}
+
+
+/** 検証済みjobを1 transactionで保存
+ *
+ * @param[in,out]   ppJobs      受信順のjob
+ * @param[in]       Num         ppJobs数
+ */
+static void commit_batch(ingest_job_t **ppJobs, int Num)
+{
+    coalesce(ppJobs, Num);
+
+    int64_t start = get_usec(CLOCK_MONOTONIC);
+    bool batch = ln_db_anno_batch_begin();
+    if (!batch) {
+        //1つずつ保存する
+        LOGE("fail: batch begin\n");
+    }
+    for (int lp = 0; lp < Num; lp++) {
+        ingest_job_t *p_job = ppJobs[lp];
+        p_job->saved = false;
+        if (p_job->coalesced) continue;
+        if (p_job->verified) {
+            p_job->saved = save(&p_job->param, &p_job->buf);
+        } else {
+            LOGD("reject: type=%d, short_channel_id=%016" PRIx64 "\n", (int)p_job->param.type, p_job->param.short_channel_id);
+        }
+    }
+    if (batch && !ln_db_anno_batch_end(true)) {
+        LOGE("fail: batch commit\n");
+        for (int lp = 0; lp < Num; lp++) {
+            ppJobs[lp]->saved = false;
+        }
+    }
+    uint32_t usec = (uint32_t)(get_usec(CLOCK_MONOTONIC) - start);
+
+    pthread_mutex_lock(&mMuxIngest);
+    mStat.commit_num++;
+    mStat.commit_usec_last = usec;
+    if (mStat.commit_usec_max < usec) {
+        mStat.commit_usec_max = usec;
+    }
+    pthread_mutex_unlock(&mMuxIngest);
+
+    if (mpNotify) {
+        for (int lp = 0; lp < Num; lp++) {
+            if (ppJobs[lp]->saved) {
+                (*mpNotify)(ppJobs[lp]->param.remote_node_id, ppJobs[lp]->param.type);
+            }
+        }
+    }
+}
+
+
+/** 同じshort_channel_id/directionのchannel_updateをまとめる
+ *
+ * 検証OKのchannel_updateのうち、timestampが最新(同じ場合は先に受信した方)以外を保存しないようにする。
+ * 検証NGのchannel_updateで検証OKのものを置き換えないよう、検証後に行う。
+ *
+ * @param[in,out]   ppJobs      受信順のjob
+ * @param[in]       Num         ppJobs数
+ */
+static void coalesce(ingest_job_t **ppJobs, int Num)
+{
+    for (int lp = 0; lp < Num; lp++) {
+        ppJobs[lp]->coalesced = false;
+    }
+    for (int lp = 0; lp < Num; lp++) {
+        ingest_job_t *p_job = ppJobs[lp];
+        if ((p_job->param.type != LN_CB_ANNO_TYPE_CNL_UPD) || !p_job->verified || p_job->coalesced) continue;
+        for (int lp2 = lp + 1; lp2 < Num; lp2++) {
+            ingest_job_t *p_job2 = ppJobs[lp2];
+            if ( (p_job2->param.type != LN_CB_ANNO_TYPE_CNL_UPD) || !p_job2->verified || p_job2->coalesced ||
+                 (p_job2->param.short_channel_id != p_job->param.short_channel_id) ||
+                 (p_job2->param.dir != p_job->param.dir) ) {
+                continue;
+            }
+            if (p_job2->param.timestamp > p_job->param.timestamp) {
+                p_job->coalesced = true;
+                break;
+            }
+            p_job2->coalesced = true;
+        }
+    }
+}
+
+
+/** 現在時刻[usec]
+ *
+ */
+static int64_t get_usec(clockid_t ClockId)
+{
+    struct timespec ts;
+    clock_gettime(ClockId, &ts);
+    return (int64_t)ts.tv_sec * M_USEC_PER_SEC + ts.tv_nsec / 1000;
+}
+
+
+/** 署名検証
+ *
+ * @param[in]   pParam
+ * @param[in]   pBuf        受信メッセージ
+ * @retval  true    署名OK
+ */
+static bool verify(const ln_anno_ingest_param_t *pParam, const utl_buf_t *pBuf)
+{
+    switch (pParam->type) {
+    case LN_CB_ANNO_TYPE_CNL_ANNO:
+        {
+            ln_msg_channel_announcement_t msg;
+            if (!ln_msg_channel_announcement_read(&msg, pBuf->buf, pBuf->len)) return false;
+            return ln_msg_channel_announcement_verify(&msg, pBuf->buf, pBuf->len);
+        }
+    case LN_CB_ANNO_TYPE_NODE_ANNO:
+        {
+            ln_msg_node_announcement_t msg;
+            if (!ln_msg_node_announcement_read(&msg, pBuf->buf, pBuf->len)) return false;
+            return ln_msg_node_announcement_verify(&msg, pBuf->buf, pBuf->len);
+        }
+    case LN_CB_ANNO_TYPE_CNL_UPD:
+        return ln_msg_channel_update_verify(pParam->node_id[0], pBuf->buf, pBuf->len);
+    default:
+        LOGE("fail: unknown type: %d\n", (int)pParam->type);
+        return false;
+    }
+}
+
+
+/** DB保存
+ *
+ * @param[in]   pParam
+ * @param[in]   pBuf        受信メッセージ
+ * @retval  true    保存した
+ */
+static bool save(const ln_anno_ingest_param_t *pParam, const utl_buf_t *pBuf)
+{
+    switch (pParam->type) {
+    case LN_CB_ANNO_TYPE_CNL_ANNO:
+        return ln_db_cnlanno_save(
+            pBuf, pParam->short_channel_id, pParam->remote_node_id, pParam->node_id[0], pParam->node_id[1]);
+    case LN_CB_ANNO_TYPE_NODE_ANNO:
+        {
+            ln_msg_node_announcement_t msg;
+            if (!ln_msg_node_announcement_read(&msg, pBuf->buf, pBuf->len)) return false;
+            return ln_db_nodeanno_save(pBuf, &msg, pParam->remote_node_id);
+        }
+    case LN_CB_ANNO_TYPE_CNL_UPD:
+        {
+            if (pParam->anno_queued) {
+                //channel_announcementが検証NGで保存されなかった
+                utl_buf_t buf = UTL_BUF_INIT;
+                bool ret = ln_db_cnlanno_load(&buf, pParam->short_channel_id);
+                utl_buf_free(&buf);
+                if (!ret) {
+                    LOGD("skip: not found channel_announcement in DB\n");
+                    return false;
+                }
+            }
+            ln_msg_channel_update_t msg;
+            if (!ln_msg_channel_update_read(&msg, pBuf->buf, pBuf->len)) return false;
+            return ln_db_cnlupd_save(pBuf, &msg, pParam->remote_node_id);
+        }
+    default:
+        LOGE("fail: unknown type: %d\n", (int)pParam->type);
+        return false;
+    }
+}
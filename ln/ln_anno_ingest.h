@@ -0,0 +1,154 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_anno_ingest.h
+ *  @brief  受信announcementの署名検証とDB保存
+ *
+ * 受信したchannel_announcement/node_announcement/channel_updateをqueueに入れ、
+ * worker threadで並列に署名検証してから、受信順にannouncement DBへ保存する。
+ *      - 保存はLN_ANNO_INGEST_COMMIT_NUM個ごと、もしくはLN_ANNO_INGEST_COMMIT_MSEC経過ごとに1 transactionで行う
+ *      - 同じtransaction内の同じshort_channel_id/directionのchannel_updateは、timestampが最新のものだけ保存する
+ *      - #ln_anno_ingest_start()していない場合は、呼び出したthreadで検証・保存する
+ *      - queueに入れた場合の保存通知は、#ln_anno_ingest_start()のpNotifyで行う
+ *          (受信したchannelは保存時に切断済みの可能性があるため、node_idで通知する)
+ */
+#ifndef LN_ANNO_INGEST_H__
+#define LN_ANNO_INGEST_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc_keys.h"
+
+#include "ln_cb.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define LN_ANNO_INGEST_COMMIT_NUM       (256)       ///< 1 transactionで保存する最大数
+#define LN_ANNO_INGEST_COMMIT_MSEC      (100)       ///< 保存待ちの最大時間[msec]
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct     ln_anno_ingest_param_t
+ *  @brief      受信announcement情報
+ */
+typedef struct {
+    ln_cb_anno_type_t   type;                           ///< LN_CB_ANNO_TYPE_xxx
+    uint64_t            short_channel_id;               ///< channel_announcement/channel_update
+    uint8_t             node_id[2][BTC_SZ_PUBKEY];      ///< channel_announcement: node_id_1/node_id_2
+                                                        ///< channel_update: [0]署名したnode_id
+    bool                anno_queued;                    ///< channel_update: node_idをqueue中のchannel_announcementから取得した
+    uint8_t             dir;                            ///< channel_update: direction
+    uint32_t            timestamp;                      ///< channel_update: timestamp
+    uint8_t             remote_node_id[BTC_SZ_PUBKEY];  ///< 受信元node_id
+} ln_anno_ingest_param_t;
+
+
+/** @struct     ln_anno_ingest_stat_t
+ *  @brief      統計情報
+ */
+typedef struct {
+    uint32_t    queue_depth;            ///< 未保存数
+    uint64_t    queued;                 ///< queueに入れた数
+    uint64_t    saved;                  ///< 検証OKで保存した数
+    uint64_t    rejected;               ///< 検証NG・保存NGで破棄した数
+    uint64_t    coalesced;              ///< 同じbatch内に新しいchannel_updateがあったため保存しなかった数
+    uint64_t    dropped;                ///< queueが一杯のため破棄した数(queuedに含まない)
+    uint64_t    commit_num;             ///< DB commit回数
+    uint32_t    commit_usec_last;       ///< 最後のDB commitにかかった時間[usec]
+    uint32_t    commit_usec_max;        ///< DB commitにかかった最大時間[usec]
+} ln_anno_ingest_stat_t;
+
+
+/** 保存通知
+ *
+ * @param[in]   pRemoteNodeId   受信元node_id
+ * @param[in]   Type            LN_CB_ANNO_TYPE_xxx
+ */
+typedef void (*ln_anno_ingest_notify_t)(const uint8_t *pRemoteNodeId, ln_cb_anno_type_t Type);
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** 検証threadの開始
+ *
+ * @param[in]   ThreadNum       検証thread数
+ * @param[in]   pNotify         保存通知
+ * @retval  true    成功
+ */
+bool ln_anno_ingest_start(uint32_t ThreadNum, ln_anno_ingest_notify_t pNotify);
+
+
+/** 検証threadの停止
+ *
+ * queueに残っているannouncementは検証・保存してから停止する。
+ */
+void ln_anno_ingest_stop(void);
+
+
+/** 受信announcementの登録
+ *
+ * queueが一杯の場合は待たずに破棄し、falseを返す。
+ *
+ * @param[in]   pParam          受信announcement情報
+ * @param[in]   pData           受信メッセージ
+ * @param[in]   Len             pData長
+ * @param[out]  pQueued         true:queueに入れた, false:検証・保存した
+ * @retval  true    queueに入れた、もしくは検証OKで保存した
+ * @retval  false   検証NG、保存NG、もしくはqueueが一杯
+ */
+bool ln_anno_ingest_push(const ln_anno_ingest_param_t *pParam, const uint8_t *pData, uint16_t Len, bool *pQueued);
+
+
+/** queue中のchannel_announcementからnode_id取得
+ *
+ * @param[out]  pNodeId         node_id
+ * @param[in]   ShortChannelId  short_channel_id
+ * @param[in]   Dir             0:node_id_1, 1:node_id_2
+ * @retval  true    queue中に見つかった
+ */
+bool ln_anno_ingest_search_cnlanno(uint8_t *pNodeId, uint64_t ShortChannelId, uint8_t Dir);
+
+
+/** 統計情報取得
+ *
+ * @param[out]  pStat
+ */
+void ln_anno_ingest_get_stat(ln_anno_ingest_stat_t *pStat);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* LN_ANNO_INGEST_H__ */
@@ -46,6 +46,7 @@
 #include "ln_commit_tx.h"
 #include "ln_commit_tx_util.h"
 #include "ln_htlc_tx.h"
+#include "ln_crypto_pool.h"
 
 
 /**************************************************************************
@@ -62,6 +63,32 @@ typedef struct {
 } preimage_t;
 
 
+/** commit_txのHTLC output 1つ分
+ *
+ */
+typedef struct {
+    uint32_t                        vout_idx;           ///< commit_txのvout index
+    const ln_commit_tx_htlc_info_t  *p_htlc_info;
+    uint64_t                        fee_sat;            ///< HTLC tx FEE
+} htlc_job_t;
+
+
+/** HTLC txの署名作成・検証(#ln_crypto_pool_run()用)
+ *
+ * 結果はjob indexの位置にだけ書く。
+ */
+typedef struct {
+    const ln_commit_info_t          *p_commit_info;
+    const btc_tx_t                  *p_tx_commit;
+    const ln_commit_tx_info_t       *p_commit_tx_info;
+    const htlc_job_t                *p_jobs;
+    const btc_keys_t                *p_htlc_key;        ///< [sign]HTLC key
+    uint8_t                         (*p_sigs)[LN_SZ_SIGNATURE];         ///< [sign]作成した署名
+    const ln_derkey_local_keys_t    *p_keys_local;      ///< [verify]
+    const uint8_t                   (*p_remote_sigs)[LN_SZ_SIGNATURE];  ///< [verify]受信した署名
+} htlc_jobs_t;
+
+
 /********************************************************************
  * prototypes
  ********************************************************************/
@@ -84,6 +111,7 @@ static bool create_htlc_info_and_amount_committed(
 //local
 static bool create_local_set_vin0_and_verify(
     btc_tx_t *pTxCommit,
+    btc_sw_sighash_ctx_t *pSighashCtx,
     const ln_funding_info_t *pFundingInfo,
     const uint8_t *pSigLocal,
     const uint8_t *pSigRemote);
@@ -97,6 +125,8 @@ static bool create_local_verify_htlcs(
     const ln_commit_tx_info_t *pCommitTxInfo,
     const ln_derkey_local_keys_t *pKeysLocal);
 
+static bool create_local_verify_htlc_job(void *pArg, uint32_t Idx);
+
 static bool create_local_verify_htlc(
     btc_tx_t *pTx,
     const uint8_t *pHtlcSig,
@@ -150,6 +180,8 @@ static bool create_remote_sign_htlcs(
     const ln_derkey_local_keys_t *pKeysLocal,
     const ln_derkey_remote_keys_t *pKeysRemote);
 
+static bool create_remote_sign_htlc_job(void *pArg, uint32_t Idx);
+
 static bool create_remote_sign_htlc(
     const ln_commit_info_t *pCommitInfo,
     uint8_t *pHtlcSig,
@@ -184,6 +216,11 @@ static bool create_remote_spend_htlc_output_tx(
     uint32_t FeeratePerKw);
 
 static bool save_vouts_remote(const ln_commit_tx_info_t *pCommitTxInfo);
+static uint32_t get_htlc_jobs(
+    htlc_job_t *pJobs,
+    const btc_tx_t *pTxCommit,
+    const ln_commit_tx_info_t *pCommitTxInfo,
+    char Mark);
 
 
 /********************************************************************
@@ -207,6 +244,9 @@ bool HIDDEN ln_commit_tx_create_local(
 
     uint8_t local_sig[LN_SZ_SIGNATURE];
     btc_tx_t tx_commit = BTC_TX_INIT;
+    btc_sw_sighash_ctx_t sighash_ctx;   //署名とverifyで同じsighashを使う
+
+    btc_sw_sighash_ctx_init(&sighash_ctx);
 
     //check num_htlc_outputs
     if (commit_tx_info.num_htlc_outputs != NumHtlcSigs) {
@@ -219,12 +259,13 @@ bool HIDDEN ln_commit_tx_create_local(
     pCommitInfo->remote_msat = commit_tx_info.remote_msat;
     pCommitInfo->num_htlc_outputs = commit_tx_info.num_htlc_outputs;
     if (!ln_commit_tx_create_rs(&tx_commit, local_sig,
-            &commit_tx_info, pKeysLocal, pCommitInfo->p_funding_info->funding_satoshis)) {
+            &commit_tx_info, pKeysLocal, pCommitInfo->p_funding_info->funding_satoshis, &sighash_ctx)) {
         LOGE("fail\n");
         goto LABEL_EXIT;
     }
     //XXX: separate
-    if (!create_local_set_vin0_and_verify(&tx_commit, pCommitInfo->p_funding_info, local_sig, pCommitInfo->remote_sig)) {
+    if (!create_local_set_vin0_and_verify(
+        &tx_commit, &sighash_ctx, pCommitInfo->p_funding_info, local_sig, pCommitInfo->remote_sig)) {
         LOGE("fail\n");
         goto LABEL_EXIT;
     }
@@ -267,6 +308,9 @@ bool HIDDEN ln_commit_tx_create_local_close(
     uint8_t local_sig[LN_SZ_SIGNATURE];
     btc_tx_t tx_commit = BTC_TX_INIT;
     uint8_t txid[BTC_SZ_TXID];
+    btc_sw_sighash_ctx_t sighash_ctx;   //署名とverifyで同じsighashを使う
+
+    btc_sw_sighash_ctx_init(&sighash_ctx);
 
     //check num_htlc_outputs
     if (commit_tx_info.num_htlc_outputs != pClose->num - LN_CLOSE_IDX_HTLC) {
@@ -282,12 +326,13 @@ bool HIDDEN ln_commit_tx_create_local_close(
         goto LABEL_EXIT;
     }
     if (!ln_commit_tx_create_rs(&tx_commit, local_sig, &commit_tx_info, pKeysLocal,
-            pCommitInfo->p_funding_info->funding_satoshis)) {
+            pCommitInfo->p_funding_info->funding_satoshis, &sighash_ctx)) {
         LOGE("fail\n");
         goto LABEL_EXIT;
     }
     //XXX: separate
-    if (!create_local_set_vin0_and_verify(&tx_commit, pCommitInfo->p_funding_info, local_sig, pCommitInfo->remote_sig)) {
+    if (!create_local_set_vin0_and_verify(
+        &tx_commit, &sighash_ctx, pCommitInfo->p_funding_info, local_sig, pCommitInfo->remote_sig)) {
         LOGE("fail\n");
         goto LABEL_EXIT;
     }
@@ -538,7 +583,7 @@ bool ln_commit_tx_create_remote(
     pCommitInfo->num_htlc_outputs = commit_tx_info.num_htlc_outputs;
 
     if (!ln_commit_tx_create_rs(&tx_commit, pCommitInfo->remote_sig, &commit_tx_info, pKeysLocal,
-            pCommitInfo->p_funding_info->funding_satoshis)) {
+            pCommitInfo->p_funding_info->funding_satoshis, NULL)) {
         goto LABEL_EXIT;
     }
     LOGD("++++++++++++++ remote commit tx: tx_commit\n");
@@ -620,7 +665,7 @@ bool ln_commit_tx_create_remote_close(
     }
     uint8_t remote_sig[LN_SZ_SIGNATURE];    //local (remote's remote) signature
     if (!ln_commit_tx_create_rs(&tx_commit, remote_sig, &commit_tx_info, pKeysLocal,
-            pCommitInfo->p_funding_info->funding_satoshis)) {
+            pCommitInfo->p_funding_info->funding_satoshis, NULL)) {
         goto LABEL_EXIT;
     }
     // XXX: the sigs not match in second last remote unilateral close now
@@ -712,9 +757,8 @@ LABEL_EXIT:
 void HIDDEN ln_commit_tx_rewind_one_commit_remote(
     ln_commit_info_t *pCommitInfo, ln_update_info_t *pUpdateInfo)
 {
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pUpdateInfo, &idx); idx++) {
         ln_update_t *p_update = &pUpdateInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (p_update->state == LN_UPDATE_STATE_OFFERED_CS_SEND) {
             p_update->state = LN_UPDATE_STATE_OFFERED_WAIT_SEND;
             uint64_t amount_msat = 0;
@@ -796,6 +840,7 @@ void HIDDEN ln_commit_tx_rewind_one_commit_remote(
 /** set vin[0] and verify sigs
  *
  * @param[in,out]   pTxCommit   [in]commit_tx(署名無し) / [out]commit_tx(署名あり)
+ * @param[in,out]   pSighashCtx 署名時に使ったmidstate
  * @param[in]       pFundingInfo
  * @param[in]       pSigLocal
  * @param[in]       pSigRemote
@@ -803,6 +848,7 @@ void HIDDEN ln_commit_tx_rewind_one_commit_remote(
  */
 static bool create_local_set_vin0_and_verify(
     btc_tx_t *pTxCommit,
+    btc_sw_sighash_ctx_t *pSighashCtx,
     const ln_funding_info_t *pFundingInfo,
     const uint8_t *pSigLocal,
     const uint8_t *pSigRemote)
@@ -821,7 +867,7 @@ static bool create_local_set_vin0_and_verify(
 
     //verify
     if (!btc_script_p2wsh_create_scriptcode(&script_code, &pFundingInfo->wit_script)) goto LABEL_EXIT;
-    if (!btc_sw_sighash(pTxCommit, sighash, 0, pFundingInfo->funding_satoshis, &script_code)) goto LABEL_EXIT;
+    if (!btc_sw_sighash_ctx(pSighashCtx, pTxCommit, sighash, 0, pFundingInfo->funding_satoshis, &script_code)) goto LABEL_EXIT;
     if (!btc_sw_verify_p2wsh_2of2(pTxCommit, 0, sighash, &pFundingInfo->tx_data.vout[pFundingInfo->txindex].script)) goto LABEL_EXIT;
 
     ret = true;
@@ -967,51 +1013,69 @@ static bool create_local_verify_htlcs(
     const ln_commit_tx_info_t *pCommitTxInfo,
     const ln_derkey_local_keys_t *pKeysLocal)
 {
-    uint16_t htlc_num = 0;
-    for (uint32_t vout_idx = 0; vout_idx < pTxCommit->vout_cnt; vout_idx++) {
-        uint16_t htlc_idx = pTxCommit->vout[vout_idx].opt;
-        if (htlc_idx == LN_COMMIT_TX_OUTPUT_TYPE_TO_LOCAL) {
-            LOGD("+++[%d]to_local\n", vout_idx);
-            continue;
-        }
-        if (htlc_idx == LN_COMMIT_TX_OUTPUT_TYPE_TO_REMOTE) {
-            LOGD("+++[%d]to_remote\n", vout_idx);
-            continue;
+    if (pTxCommit->vout_cnt == 0) return true;
+
+    htlc_job_t *p_jobs = (htlc_job_t *)UTL_DBG_MALLOC(sizeof(htlc_job_t) * pTxCommit->vout_cnt);
+    if (!p_jobs) return false;
+    uint32_t num = get_htlc_jobs(p_jobs, pTxCommit, pCommitTxInfo, '+');
+
+    //HTLC txはそれぞれ独立しているので並列に検証する
+    htlc_jobs_t jobs;
+    memset(&jobs, 0, sizeof(jobs));
+    jobs.p_commit_info = pCommitInfo;
+    jobs.p_tx_commit = pTxCommit;
+    jobs.p_commit_tx_info = pCommitTxInfo;
+    jobs.p_jobs = p_jobs;
+    jobs.p_keys_local = pKeysLocal;
+    jobs.p_remote_sigs = pHtlcSigs;
+    bool ret = ln_crypto_pool_run(create_local_verify_htlc_job, &jobs, num);
+    if (ret) {
+        //XXX: save the commitment_signed message?
+        //OKなら各HTLCに保持
+        //  相手がunilateral closeした後に送信しなかったら、この署名を使う
+        for (uint32_t lp = 0; lp < num; lp++) {
+            memcpy(pUpdateInfo->htlcs[p_jobs[lp].p_htlc_info->htlc_idx].remote_sig, pHtlcSigs[lp], LN_SZ_SIGNATURE);
         }
+    }
+    UTL_DBG_FREE(p_jobs);
+    return ret;
+}
 
-        const ln_commit_tx_htlc_info_t *p_htlc_info = pCommitTxInfo->pp_htlc_info[htlc_idx];
-        uint64_t fee_sat = (p_htlc_info->type == LN_COMMIT_TX_OUTPUT_TYPE_OFFERED) ?
-            pCommitTxInfo->base_fee_info.htlc_timeout_fee :
-            pCommitTxInfo->base_fee_info.htlc_success_fee;
 
-        LOGD("+++[%d]%s HTLC\n", vout_idx, (p_htlc_info->type == LN_COMMIT_TX_OUTPUT_TYPE_OFFERED) ? "offered" : "received");
-        assert(pTxCommit->vout[vout_idx].value >= pCommitTxInfo->base_fee_info.dust_limit_satoshi + fee_sat);
+/** #create_local_verify_htlcs()のHTLC 1つ分
+ *
+ * @param[in]       pArg        htlc_jobs_t
+ * @param[in]       Idx         htlc_num
+ * @retval  true    検証OK
+ */
+static bool create_local_verify_htlc_job(void *pArg, uint32_t Idx)
+{
+    const htlc_jobs_t *p_jobs = (const htlc_jobs_t *)pArg;
+    const btc_tx_t *p_tx_commit = p_jobs->p_tx_commit;
+    const ln_commit_tx_info_t *p_commit_tx_info = p_jobs->p_commit_tx_info;
+    const htlc_job_t *p_job = &p_jobs->p_jobs[Idx];
 
-        btc_tx_t tx = BTC_TX_INIT;
-        if (!ln_htlc_tx_create(
-                &tx, (pTxCommit->vout[vout_idx].value - fee_sat), &pCommitTxInfo->to_local.wit_script,
-                p_htlc_info->type, p_htlc_info->cltv_expiry, pCommitInfo->txid, vout_idx)) {
-            btc_tx_free(&tx);
-            return false;
-        }
+    assert(p_tx_commit->vout[p_job->vout_idx].value >= p_commit_tx_info->base_fee_info.dust_limit_satoshi + p_job->fee_sat);
+
+    btc_tx_t tx = BTC_TX_INIT;
+    if (!ln_htlc_tx_create(
+            &tx, (p_tx_commit->vout[p_job->vout_idx].value - p_job->fee_sat), &p_commit_tx_info->to_local.wit_script,
+            p_job->p_htlc_info->type, p_job->p_htlc_info->cltv_expiry, p_jobs->p_commit_info->txid, p_job->vout_idx)) {
+        btc_tx_free(&tx);
+        return false;
+    }
 #ifdef USE_ELEMENTS
-        btc_tx_add_vout_fee(&tx, fee_sat);
+    btc_tx_add_vout_fee(&tx, p_job->fee_sat);
 #endif
-        LOGD("++++++++++++++ local htlc_tx verify\n");
-        M_DBG_PRINT_TX(&tx);
-        if (!create_local_verify_htlc(
-                &tx, pHtlcSigs[htlc_num], &p_htlc_info->wit_script, pTxCommit->vout[vout_idx].value,
-                pKeysLocal)) {
-            btc_tx_free(&tx);
-            return false;
-        }
-        //XXX: save the commitment_signed message?
-        //OKなら各HTLCに保持
-        //  相手がunilateral closeした後に送信しなかったら、この署名を使う
-        memcpy(pUpdateInfo->htlcs[p_htlc_info->htlc_idx].remote_sig, pHtlcSigs + htlc_num * LN_SZ_SIGNATURE, LN_SZ_SIGNATURE);
+    LOGD("++++++++++++++ local htlc_tx verify\n");
+    M_DBG_PRINT_TX(&tx);
+    if (!create_local_verify_htlc(
+            &tx, p_jobs->p_remote_sigs[Idx], &p_job->p_htlc_info->wit_script, p_tx_commit->vout[p_job->vout_idx].value,
+            p_jobs->p_keys_local)) {
         btc_tx_free(&tx);
-        htlc_num++;
+        return false;
     }
+    btc_tx_free(&tx);
     return true;
 }
 
@@ -1147,10 +1211,9 @@ static bool create_htlc_info_and_amount_pre_committed(
     bool bLocal)
 {
     *pHtlcInfoCnt = 0;
-    for (uint16_t update_idx = 0; update_idx < LN_UPDATE_MAX; update_idx++) {
+    for (uint16_t update_idx = 0; ln_update_info_next_used(pUpdateInfo, &update_idx); update_idx++) {
         const ln_update_t *p_update = &pUpdateInfo->updates[update_idx];
         LOGD("state = 0x%04x\n", p_update->state);
-        if (!LN_UPDATE_USED(p_update)) continue;
 
         if (LN_UPDATE_UNCOMMITTED(p_update, bLocal)) {
             if (LN_UPDATE_SEND_ENABLED(p_update, LN_UPDATE_TYPE_MASK_ALL, bLocal)) {
@@ -1243,10 +1306,9 @@ static bool create_htlc_info_and_amount_committed(
     bool bLocal)
 {
     *pHtlcInfoCnt = 0;
-    for (uint16_t update_idx = 0; update_idx < LN_UPDATE_MAX; update_idx++) {
+    for (uint16_t update_idx = 0; ln_update_info_next_used(pUpdateInfo, &update_idx); update_idx++) {
         const ln_update_t *p_update = &pUpdateInfo->updates[update_idx];
         LOGD("state = 0x%04x\n", p_update->state);
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (LN_UPDATE_UNCOMMITTED(p_update, bLocal)) continue;
         if (!LN_UPDATE_ENABLED(p_update, LN_UPDATE_TYPE_ADD_HTLC, bLocal)) continue;
 
@@ -1355,36 +1417,46 @@ static bool create_remote_sign_htlcs(
     const ln_derkey_local_keys_t *pKeysLocal,
     const ln_derkey_remote_keys_t *pKeysRemote)
 {
-    uint16_t htlc_num = 0;
-
     btc_keys_t htlckey;
     if (!ln_signer_htlc_remotekey(&htlckey, pKeysLocal, pKeysRemote)) return false;
+    if (pTxCommit->vout_cnt == 0) return true;
+
+    htlc_job_t *p_jobs = (htlc_job_t *)UTL_DBG_MALLOC(sizeof(htlc_job_t) * pTxCommit->vout_cnt);
+    if (!p_jobs) return false;
+    uint32_t num = get_htlc_jobs(p_jobs, pTxCommit, pCommitTxInfo, '-');
+
+    //HTLC txはそれぞれ独立しているので並列に署名する(pHtlcSigsはvout順)
+    htlc_jobs_t jobs;
+    memset(&jobs, 0, sizeof(jobs));
+    jobs.p_commit_info = pCommitInfo;
+    jobs.p_tx_commit = pTxCommit;
+    jobs.p_commit_tx_info = pCommitTxInfo;
+    jobs.p_jobs = p_jobs;
+    jobs.p_htlc_key = &htlckey;
+    jobs.p_sigs = pHtlcSigs;
+    bool ret = ln_crypto_pool_run(create_remote_sign_htlc_job, &jobs, num);
+    UTL_DBG_FREE(p_jobs);
+    return ret;
+}
 
-    for (uint32_t vout_idx = 0; vout_idx < pTxCommit->vout_cnt; vout_idx++) {
-        uint16_t htlc_idx = pTxCommit->vout[vout_idx].opt;
-
-        if (htlc_idx == LN_COMMIT_TX_OUTPUT_TYPE_TO_LOCAL) {
-            LOGD("---[%d]to_local\n", vout_idx);
-            continue;
-        }
-        if (htlc_idx == LN_COMMIT_TX_OUTPUT_TYPE_TO_REMOTE) {
-            LOGD("---[%d]to_remote\n", vout_idx);
-            continue;
-        }
-        const ln_commit_tx_htlc_info_t *p_htlc_info = pCommitTxInfo->pp_htlc_info[htlc_idx];
-        uint64_t fee_sat =
-            (p_htlc_info->type == LN_COMMIT_TX_OUTPUT_TYPE_OFFERED) ?
-            pCommitTxInfo->base_fee_info.htlc_timeout_fee :
-            pCommitTxInfo->base_fee_info.htlc_success_fee;
 
-        if (!create_remote_sign_htlc(
-            pCommitInfo, pHtlcSigs[htlc_num], pTxCommit,
-            &pCommitTxInfo->to_local.wit_script, p_htlc_info,
-            &htlckey, fee_sat, vout_idx)) {
-            LOGE("fail: sign vout[%d]\n", vout_idx);
-            return false;
-        }
-        htlc_num++;
+/** #create_remote_sign_htlcs()のHTLC 1つ分
+ *
+ * @param[in,out]   pArg        htlc_jobs_t
+ * @param[in]       Idx         htlc_num
+ * @retval  true    成功
+ */
+static bool create_remote_sign_htlc_job(void *pArg, uint32_t Idx)
+{
+    const htlc_jobs_t *p_jobs = (const htlc_jobs_t *)pArg;
+    const htlc_job_t *p_job = &p_jobs->p_jobs[Idx];
+
+    if (!create_remote_sign_htlc(
+        p_jobs->p_commit_info, p_jobs->p_sigs[Idx], p_jobs->p_tx_commit,
+        &p_jobs->p_commit_tx_info->to_local.wit_script, p_job->p_htlc_info,
+        p_jobs->p_htlc_key, p_job->fee_sat, p_job->vout_idx)) {
+        LOGE("fail: sign vout[%d]\n", p_job->vout_idx);
+        return false;
     }
     return true;
 }
@@ -1542,3 +1614,41 @@ static bool save_vouts_remote(const ln_commit_tx_info_t *pCommitTxInfo)
     return true;
 }
 
+
+/** commit_txのHTLC output一覧
+ *
+ * @param[out]      pJobs           vout順のHTLC output(pTxCommit->vout_cnt個分の領域)
+ * @param[in]       pTxCommit
+ * @param[in]       pCommitTxInfo
+ * @param[in]       Mark            log用('+':local, '-':remote)
+ * @return      HTLC output数
+ */
+static uint32_t get_htlc_jobs(
+    htlc_job_t *pJobs,
+    const btc_tx_t *pTxCommit,
+    const ln_commit_tx_info_t *pCommitTxInfo,
+    char Mark)
+{
+    uint32_t num = 0;
+    for (uint32_t vout_idx = 0; vout_idx < pTxCommit->vout_cnt; vout_idx++) {
+        uint16_t htlc_idx = pTxCommit->vout[vout_idx].opt;
+        if (htlc_idx == LN_COMMIT_TX_OUTPUT_TYPE_TO_LOCAL) {
+            LOGD("%c%c%c[%d]to_local\n", Mark, Mark, Mark, vout_idx);
+            continue;
+        }
+        if (htlc_idx == LN_COMMIT_TX_OUTPUT_TYPE_TO_REMOTE) {
+            LOGD("%c%c%c[%d]to_remote\n", Mark, Mark, Mark, vout_idx);
+            continue;
+        }
+
+        const ln_commit_tx_htlc_info_t *p_htlc_info = pCommitTxInfo->pp_htlc_info[htlc_idx];
+        LOGD("%c%c%c[%d]%s HTLC\n", Mark, Mark, Mark, vout_idx, (p_htlc_info->type == LN_COMMIT_TX_OUTPUT_TYPE_OFFERED) ? "offered" : "received");
+        pJobs[num].vout_idx = vout_idx;
+        pJobs[num].p_htlc_info = p_htlc_info;
+        pJobs[num].fee_sat = (p_htlc_info->type == LN_COMMIT_TX_OUTPUT_TYPE_OFFERED) ?
+            pCommitTxInfo->base_fee_info.htlc_timeout_fee :
+            pCommitTxInfo->base_fee_info.htlc_success_fee;
+        num++;
+    }
+    return num;
+}
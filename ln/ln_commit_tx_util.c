@@ -165,7 +165,7 @@ bool HIDDEN ln_commit_tx_create(
     uint64_t AmountInputs)
 {
     uint8_t sig[LN_SZ_SIGNATURE];
-    if (!ln_commit_tx_create_rs(pTx, sig, pCommitTxInfoTrimmed, pLocalKeys, AmountInputs)) return false;
+    if (!ln_commit_tx_create_rs(pTx, sig, pCommitTxInfoTrimmed, pLocalKeys, AmountInputs, NULL)) return false;
     if (!btc_sig_rs2der(pSig, sig)) return false;
     return true;
 }
@@ -176,7 +176,8 @@ bool HIDDEN ln_commit_tx_create_rs(
     uint8_t *pSig,
     const ln_commit_tx_info_t *pCommitTxInfoTrimmed,
     const ln_derkey_local_keys_t *pLocalKeys,
-    uint64_t AmountInputs)
+    uint64_t AmountInputs,
+    btc_sw_sighash_ctx_t *pSighashCtx)
 {
     assert(pCommitTxInfoTrimmed->b_trimmed);
 
@@ -231,8 +232,13 @@ bool HIDDEN ln_commit_tx_create_rs(
 
     //sign
     uint8_t sighash[BTC_SZ_HASH256];
-    if (!btc_sw_sighash_p2wsh_wit(
-        pTx, sighash, 0, pCommitTxInfoTrimmed->fund.satoshi, pCommitTxInfoTrimmed->fund.p_wit_script)) {
+    btc_sw_sighash_ctx_t sighash_ctx;
+    if (!pSighashCtx) {
+        btc_sw_sighash_ctx_init(&sighash_ctx);
+        pSighashCtx = &sighash_ctx;
+    }
+    if (!btc_sw_sighash_p2wsh_wit_ctx(
+        pSighashCtx, pTx, sighash, 0, pCommitTxInfoTrimmed->fund.satoshi, pCommitTxInfoTrimmed->fund.p_wit_script)) {
         LOGE("fail: calc sighash\n");
         return false;
     }
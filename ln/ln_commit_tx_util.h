@@ -193,12 +193,23 @@ bool HIDDEN ln_commit_tx_create(
     uint64_t AmountInputs);
 
 
+/** Commitment Transaction作成(署名はr|s形式)
+ *
+ * @param[out]      pTx         TX情報
+ * @param[out]      pSig        local署名(#LN_SZ_SIGNATURE)
+ * @param[in]       pCommitTxInfoTrimmed   Commitment Transaction情報
+ * @param[in]       pLocalKeys
+ * @param[in]       AmountInputs    all input amount
+ * @param[in,out]   pSighashCtx     sighash計算のmidstate(NULL時は使い捨て)
+ * @return      true:成功
+ */
 bool HIDDEN ln_commit_tx_create_rs(
     btc_tx_t *pTx,
     uint8_t *pSig,
     const ln_commit_tx_info_t *pCommitTxInfoTrimmed,
     const ln_derkey_local_keys_t *pLocalKeys,
-    uint64_t AmountInputs);
+    uint64_t AmountInputs,
+    btc_sw_sighash_ctx_t *pSighashCtx);
 
 
 void HIDDEN ln_commit_tx_info_sub_fee_and_trim_outputs(ln_commit_tx_info_t *pCommitTxInfo, bool ToLocalIsFounder);
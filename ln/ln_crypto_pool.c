@@ -0,0 +1,255 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_crypto_pool.c
+ *  @brief  署名作成・検証の並列実行
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <sys/queue.h>
+
+#define LOG_TAG "ln_crypto_pool"
+#include "utl_log.h"
+
+#include "ln_crypto_pool.h"
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct pool_batch_t
+ *  @brief  #ln_crypto_pool_run() 1回分の要求
+ */
+typedef struct pool_batch_t {
+    TAILQ_ENTRY(pool_batch_t)   list;           ///< 未着手jobがある間だけqueueに入れる
+    ln_crypto_pool_func_t       p_func;
+    void                        *p_arg;
+    uint32_t                    num;            ///< job数
+    uint32_t                    next;           ///< 次に着手するjob index
+    uint32_t                    done;           ///< 完了したjob数
+    bool                        ret;            ///< false:失敗したjobあり
+    pthread_cond_t              cond;           ///< 全job完了
+} pool_batch_t;
+
+TAILQ_HEAD(pool_batch_head_t, pool_batch_t);
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static pthread_mutex_t          mMuxPool = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           mCondJob = PTHREAD_COND_INITIALIZER;        ///< 未着手jobあり
+
+static struct pool_batch_head_t mBatchHead = TAILQ_HEAD_INITIALIZER(mBatchHead);
+
+static bool                     mStarted;
+static bool                     mStop;
+static uint32_t                 mThreadNum;
+static pthread_t                mThWorker[LN_CRYPTO_POOL_THREAD_MAX];
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static void *thread_worker_start(void *pArg);
+static pool_batch_t *take_job(uint32_t *pIdx);
+static void done_job(pool_batch_t *pBatch, bool Result);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+bool ln_crypto_pool_start(uint32_t ThreadNum)
+{
+    if (mStarted) {
+        LOGE("fail: already started\n");
+        return false;
+    }
+    if (ThreadNum == 0) {
+        ThreadNum = 1;
+    } else if (ThreadNum > LN_CRYPTO_POOL_THREAD_MAX) {
+        ThreadNum = LN_CRYPTO_POOL_THREAD_MAX;
+    }
+
+    mStop = false;
+    for (mThreadNum = 0; mThreadNum < ThreadNum; mThreadNum++) {
+        if (pthread_create(&mThWorker[mThreadNum], NULL, &thread_worker_start, NULL) != 0) {
+            LOGE("fail: pthread_create\n");
+            break;
+        }
+    }
+    mStarted = true;
+    if (mThreadNum == 0) {
+        ln_crypto_pool_stop();
+        return false;
+    }
+    LOGD("start: %" PRIu32 " threads\n", mThreadNum);
+    return true;
+}
+
+
+void ln_crypto_pool_stop(void)
+{
+    if (!mStarted) return;
+
+    pthread_mutex_lock(&mMuxPool);
+    mStop = true;
+    pthread_cond_broadcast(&mCondJob);
+    pthread_mutex_unlock(&mMuxPool);
+
+    for (uint32_t lp = 0; lp < mThreadNum; lp++) {
+        pthread_join(mThWorker[lp], NULL);
+    }
+
+    pthread_mutex_lock(&mMuxPool);
+    mStarted = false;
+    mThreadNum = 0;
+    pthread_mutex_unlock(&mMuxPool);
+    LOGD("stop\n");
+}
+
+
+bool ln_crypto_pool_run(ln_crypto_pool_func_t pFunc, void *pArg, uint32_t Num)
+{
+    pthread_mutex_lock(&mMuxPool);
+    if (!mStarted || mStop || (Num <= 1)) {
+        pthread_mutex_unlock(&mMuxPool);
+
+        //呼び出したthreadで実行する
+        for (uint32_t lp = 0; lp < Num; lp++) {
+            if (!(*pFunc)(pArg, lp)) return false;
+        }
+        return true;
+    }
+
+    pool_batch_t batch;
+    batch.p_func = pFunc;
+    batch.p_arg = pArg;
+    batch.num = Num;
+    batch.next = 0;
+    batch.done = 0;
+    batch.ret = true;
+    pthread_cond_init(&batch.cond, NULL);
+    TAILQ_INSERT_TAIL(&mBatchHead, &batch, list);
+    pthread_cond_broadcast(&mCondJob);
+
+    //呼び出したthreadも自分のjobを処理する
+    while (batch.next < batch.num) {
+        uint32_t idx = batch.next++;
+        if (batch.next == batch.num) {
+            TAILQ_REMOVE(&mBatchHead, &batch, list);
+        }
+        pthread_mutex_unlock(&mMuxPool);
+
+        bool result = (*pFunc)(pArg, idx);
+
+        pthread_mutex_lock(&mMuxPool);
+        done_job(&batch, result);
+    }
+    while (batch.done < batch.num) {
+        pthread_cond_wait(&batch.cond, &mMuxPool);
+    }
+    pthread_mutex_unlock(&mMuxPool);
+
+    pthread_cond_destroy(&batch.cond);
+    return batch.ret;
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+/** worker thread
+ *
+ * queueの先頭の要求から1つずつjobを取り出して実行する。
+ */
+static void *thread_worker_start(void *pArg)
+{
+    (void)pArg;
+
+    pthread_mutex_lock(&mMuxPool);
+    for (;;) {
+        uint32_t idx;
+        pool_batch_t *p_batch = take_job(&idx);
+        if (!p_batch) {
+            if (mStop) break;
+            pthread_cond_wait(&mCondJob, &mMuxPool);
+            continue;
+        }
+        pthread_mutex_unlock(&mMuxPool);
+
+        bool result = (*p_batch->p_func)(p_batch->p_arg, idx);
+
+        pthread_mutex_lock(&mMuxPool);
+        done_job(p_batch, result);
+    }
+    pthread_mutex_unlock(&mMuxPool);
+    return NULL;
+}
+
+
+/** 未着手jobの取り出し
+ *
+ * mMuxPoolをlockして呼び出すこと。
+ *
+ * @param[out]      pIdx        job index
+ * @return      jobの要求(NULL:未着手jobなし)
+ */
+static pool_batch_t *take_job(uint32_t *pIdx)
+{
+    pool_batch_t *p_batch = TAILQ_FIRST(&mBatchHead);
+    if (!p_batch) return NULL;
+
+    *pIdx = p_batch->next++;
+    if (p_batch->next == p_batch->num) {
+        //全job着手済み
+        TAILQ_REMOVE(&mBatchHead, p_batch, list);
+    }
+    return p_batch;
+}
+
+
+/** job完了
+ *
+ * mMuxPoolをlockして呼び出すこと。
+ * 全job完了すると#ln_crypto_pool_run()を起こす。
+ *
+ * @param[in,out]   pBatch
+ * @param[in]       Result      jobの戻り値
+ */
+static void done_job(pool_batch_t *pBatch, bool Result)
+{
+    if (!Result) {
+        pBatch->ret = false;
+    }
+    pBatch->done++;
+    if (pBatch->done == pBatch->num) {
+        pthread_cond_signal(&pBatch->cond);
+    }
+}
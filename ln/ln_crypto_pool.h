@@ -0,0 +1,100 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_crypto_pool.h
+ *  @brief  署名作成・検証の並列実行
+ *
+ * 固定数のworker threadで、1つの要求に含まれる複数の署名作成・検証を並列に実行する。
+ *      - #ln_crypto_pool_run()は全jobの完了を待って戻るため、結果はjob indexの位置に書けば順番通りになる
+ *      - 呼び出したthreadもjobを処理する
+ *      - #ln_crypto_pool_start()していない場合は、呼び出したthreadで順に実行する
+ *      - 複数threadから同時に呼び出してよい
+ */
+#ifndef LN_CRYPTO_POOL_H__
+#define LN_CRYPTO_POOL_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define LN_CRYPTO_POOL_THREAD_MAX       (16)        ///< worker thread最大数
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** job
+ *
+ * worker threadから呼ばれるため、pArgのうちIdx以外の位置には書き込まないこと。
+ *
+ * @param[in,out]   pArg        #ln_crypto_pool_run()のpArg
+ * @param[in]       Idx         job index(0～Num-1)
+ * @retval  true    成功
+ */
+typedef bool (*ln_crypto_pool_func_t)(void *pArg, uint32_t Idx);
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** worker threadの開始
+ *
+ * @param[in]   ThreadNum       worker thread数(0の場合は1、#LN_CRYPTO_POOL_THREAD_MAXを超える場合は#LN_CRYPTO_POOL_THREAD_MAX)
+ * @retval  true    成功
+ */
+bool ln_crypto_pool_start(uint32_t ThreadNum);
+
+
+/** worker threadの停止
+ *
+ * 実行中の#ln_crypto_pool_run()は呼び出し元threadで続きを処理してから戻る。
+ */
+void ln_crypto_pool_stop(void);
+
+
+/** jobの実行
+ *
+ * pFunc(pArg, 0)～pFunc(pArg, Num-1)を実行し、全jobの完了を待って戻る。
+ * worker threadで実行する場合は、失敗したjobがあっても全jobを実行する。
+ *
+ * @param[in]       pFunc       job
+ * @param[in,out]   pArg        pFuncの引数
+ * @param[in]       Num         job数
+ * @retval  true    全jobが成功
+ */
+bool ln_crypto_pool_run(ln_crypto_pool_func_t pFunc, void *pArg, uint32_t Num);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* LN_CRYPTO_POOL_H__ */
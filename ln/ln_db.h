@@ -351,10 +351,54 @@ bool ln_db_anno_transaction(void);
 
 
 /** #ln_db_anno_transaction()で取得したトランザクションのcommit
+ *
+ * transaction中に保存・削除したchannel_announcement/channel_updateは、commitできた場合だけrouting graphに反映する。
  *
  * @param[in]   bCommit         true:トランザクションをcommit
+ * @retval  true    commitした
+ */
+bool ln_db_anno_commit(bool bCommit);
+
+
+/** announcement用DBのbatch開始
+ *
+ * #ln_db_anno_batch_end()までの間、呼び出したthreadの
+ * #ln_db_anno_transaction()は子トランザクションになり、まとめてcommitされる。
+ * 他threadの#ln_db_anno_transaction()はbatch終了まで待たされる。
+ *
+ * @retval  true    成功
  */
-void ln_db_anno_commit(bool bCommit);
+bool ln_db_anno_batch_begin(void);
+
+
+/** announcement用DBのbatch終了
+ *
+ * batch中の保存・削除は、ここでcommitできた場合だけrouting graphに反映する。
+ *
+ * @param[in]   bCommit         true:batch中の保存をcommit
+ * @retval  true    成功
+ */
+bool ln_db_anno_batch_end(bool bCommit);
+
+
+/** announcement用DBのread-only transaction開始
+ *
+ * 開始時点のsnapshotを読む。lockしないため、保存や他threadの読込みと並列に動く。
+ * #ln_db_anno_read_end()までの間、呼び出したthreadの
+ * #ln_db_anno_cur_open()はread-only cursorになり、
+ * #ln_db_cnlanno_load()などの読込みもこのtransactionを使う。
+ *
+ * @retval  true    成功
+ * @attention
+ *      - この間は#ln_db_anno_transaction()および保存APIを呼び出さないこと
+ */
+bool ln_db_anno_read_begin(void);
+
+
+/** announcement用DBのread-only transaction終了
+ *
+ */
+void ln_db_anno_read_end(void);
 
 
 /********************************************************************
@@ -455,6 +499,8 @@ bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcem
  ********************************************************************/
 
 /** announcement用DBオープン
+ *
+ * #ln_db_anno_read_begin()中はread-only cursorになる。
  *
  * @param[out]  pCur
  * @param[in]   Type        オープンするDB(LN_DB_TXN_xx)
@@ -506,6 +552,22 @@ bool ln_db_cnlanno_info_search_node_id(void *pCur, uint64_t ShortChannelId, char
 bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf);
 
 
+/** channel_announcement関連情報の検索開始
+ *
+ * ShortChannelId以上の最初のデータを取得する(MDB_SET_RANGE)。
+ * 以降は#ln_db_cnlanno_cur_get()で続きを取得できる。
+ *
+ * @param[in]       pCur
+ * @param[out]      pShortChannelId         short_channel_id
+ * @param[out]      pType                   LN_DB_CNLANNO_xxx(channel_announcement / channel_update)
+ * @param[out]      pTimeStamp              channel_announcementのtimestamp
+ * @param[out]      pBuf                    取得したデータ(p_typeに応じて内容は変わる)
+ * @param[in]       ShortChannelId          検索開始short_channel_id
+ * @retval  true    成功
+ */
+bool ln_db_cnlanno_cur_seek(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf, uint64_t ShortChannelId);
+
+
 /** channel_announcement関連情報の前方移動
  *
  */
@@ -568,7 +630,7 @@ bool ln_db_channel_owned_save(uint64_t ShortChannelId);
  *
  * @retval  true    自short_channel_id DBに登録あり
  * @attention
- *      #ln_db_anno_transaction()でtransaction取得済みであること
+ *      #ln_db_anno_transaction()または#ln_db_anno_read_begin()でtransaction取得済みであること
  */
 bool ln_db_channel_owned_check(uint64_t ShortChannelId);
 
@@ -679,6 +741,19 @@ bool ln_db_preimage_del(const uint8_t *pPreimage);
 bool ln_db_preimage_search(ln_db_func_preimage_t pFunc, void *pFuncParam);
 
 
+/** preimage取得(payment_hash検索)
+ *
+ * payment_hashのindexから取得する。
+ *
+ * @param[out]      pPreimage   未使用で期限切れの場合、stateは#LN_DB_PREIMAGE_STATE_EXPIRE
+ * @param[in]       pPaymentHash
+ * @retval  true    取得成功
+ * @note
+ *  - DB更新を行わない
+ */
+bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash);
+
+
 /** preimage削除(payment_hash検索)
  *
  * @param[in]       pPaymentHash
@@ -687,6 +762,17 @@ bool ln_db_preimage_search(ln_db_func_preimage_t pFunc, void *pFuncParam);
 bool ln_db_preimage_del_hash(const uint8_t *pPaymentHash);
 
 
+/** 期限切れpreimage削除
+ *
+ * 未使用で、期限(creation_time + expiry)がTimeより前のpreimageを削除する。
+ *
+ * @param[in]       Time        epoch time[sec]
+ * @param[out]      pNum        (nullable)削除数
+ * @retval  true
+ */
+bool ln_db_preimage_del_expired(uint64_t Time, uint32_t *pNum);
+
+
 /** preimage cursorオープン
  *
  * @param[in,out]   ppCur
@@ -875,6 +961,14 @@ bool ln_db_payment_route_save(uint64_t PaymentId, const uint8_t *pData, uint32_t
 bool ln_db_payment_route_load(utl_buf_t *pBuf, uint64_t PaymentId);
 bool ln_db_payment_route_del(uint64_t PaymentId);
 
+/** [payment]retry用route候補
+ *
+ * 初回のroute計算で得た次点以降のrouteを保存しておき、retry時に再計算せずに使用する。
+ */
+bool ln_db_payment_route_cand_save(uint64_t PaymentId, const uint8_t *pData, uint32_t Len);
+bool ln_db_payment_route_cand_load(utl_buf_t *pBuf, uint64_t PaymentId);
+bool ln_db_payment_route_cand_del(uint64_t PaymentId);
+
 //XXX: comment
 bool ln_db_payment_invoice_save(uint64_t PaymentId, const uint8_t *pData, uint32_t Len);
 bool ln_db_payment_invoice_load(utl_buf_t *pBuf, uint64_t PaymentId);
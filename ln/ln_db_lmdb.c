@@ -46,6 +46,7 @@
 #include "btc_sw.h"
 #include "btc_script.h"
 #include "btc_dbg.h"
+#include "btc_buf.h"
 
 #include "ln_local.h"
 #include "ln_msg_anno.h"
@@ -53,6 +54,8 @@
 #include "ln_signer.h"
 #include "ln_db.h"
 #include "ln_db_lmdb.h"
+#include "ln_forward.h"
+#include "ln_routing.h"
 #include "ln_version.h"
 
 
@@ -119,29 +122,44 @@
 #define M_PREF_FORWARD_DEL_HTLC "DL"                        ///< forward del htlc msg
 
 #define M_DBI_CNLANNO           "channel_anno"              ///< 受信したchannel_announcement/channel_update
-#define M_DBI_CNLANNO_INFO      "channel_anno_info"         ///< channel_announcement/channel_updateの受信元・送信先
+#define M_DBI_CNLANNO_INFO      "channel_anno_sent"         ///< channel_announcement/channel_updateの受信元・送信先(peer slot)
 #define M_DBI_NODEANNO          "node_anno"                 ///< 受信したnode_announcement
-#define M_DBI_NODEANNO_INFO     "node_anno_info"            ///< node_announcementの受信元・送信先
+#define M_DBI_NODEANNO_INFO     "node_anno_sent"            ///< node_announcementの受信元・送信先(peer slot)
+#define M_DBI_ANNO_PEER         "anno_peer"                 ///< announcement送受信peerのslot
+#define M_DBI_CNLANNO_INFO_OLD  "channel_anno_info"         ///< [旧形式]channel_announcement/channel_updateの受信元・送信先(node_id配列)
+#define M_DBI_NODEANNO_INFO_OLD "node_anno_info"            ///< [旧形式]node_announcementの受信元・送信先(node_id配列)
 #define M_DBI_CNLANNO_RECV      "channel_anno_recv"         ///< channel_announcementのnode_id
 #define M_DBI_CNL_OWNED         "channel_owned"             ///< 自分の持つchannel
 #define M_DBI_ROUTE_SKIP        LN_DB_DBI_ROUTE_SKIP        ///< 送金失敗short_channel_id
 #define M_DBI_PREIMAGE          "preimage"                  ///< preimage
+#define M_DBI_PREIMAGE_HASH     "preimage_hash"             ///< [preimage]のindex(payment_hash)
+#define M_DBI_PREIMAGE_EXPIRE   "preimage_expire"           ///< [preimage]のindex(未使用preimageの期限)
 #define M_DBI_PAYMENT_HASH      "payment_hash"              ///< revoked transaction close用
 #define M_DBI_WALLET            "wallet"                    ///< wallet
 #define M_DBI_VERSION           "version"                   ///< version
 #define M_DBI_PAYMENT           "payment"                   ///< payment
 #define M_DBI_SHARED_SECRETS    "shared_secrets"            ///< shared secrets
 #define M_DBI_ROUTE             "route"                     ///< route
+#define M_DBI_ROUTE_CAND        "route_cand"                ///< route candidates(retry用)
 #define M_DBI_PAYMENT_INVOICE   "invoice"                   ///< payment invoice
 #define M_DBI_PAYMENT_INFO      "payment_info"              ///< payment info
 
 #define M_SZ_CHANNEL_DB_NAME_STR    (M_SZ_PREF_STR + LN_SZ_CHANNEL_ID * 2)
 #define M_SZ_FORWARD_DB_NAME_STR    (M_SZ_PREF_STR + LN_SZ_SHORT_CHANNEL_ID * 2)
-#define M_SZ_HTLC_IDX_STR           (3)     // "%03d" 0-482
+#define M_SZ_HTLC_IDX_STR           (3)     // "%03d" 0-482(-71: HTLC DB per index)
+#define M_SZ_HTLC_IDX_KEY           (sizeof(uint16_t))
 #define M_SZ_CNLANNO_INFO_KEY       (LN_SZ_SHORT_CHANNEL_ID + sizeof(char))
 #define M_SZ_NODEANNO_INFO_KEY      (BTC_SZ_PUBKEY)
+#define M_SZ_ANNOINFO_SEQ           (sizeof(uint32_t))                  ///< annoinfo: seq
+#define M_SZ_ANNOINFO_ENTRY         (sizeof(uint16_t) * 2)              ///< annoinfo: slot + gen
+
+#define M_KEY_ANNO_PEER_SEQ         "seq"                               ///< "anno_peer": annoinfo.seqの最終値
+#define M_ANNO_SLOT_NUM             (0x10000)                           ///< peer slot数
+#define M_ANNO_GEN_MASK             ((uint16_t)0x7fff)                  ///< annoinfo entry: 世代
+#define M_ANNO_GEN_UNSENT           ((uint16_t)0x8000)                  ///< annoinfo entry: markによらず未送信
 #define M_SZ_FORWARD_KEY            (LN_SZ_SHORT_CHANNEL_ID + sizeof(uint64_t))
 #define M_SZ_PAYMENT_ID_KEY         (sizeof(uint64_t))
+#define M_SZ_PREIMAGE_EXPIRE_KEY    (sizeof(uint64_t) + LN_SZ_PREIMAGE)     ///< [preimage_expire]: 期限(big endian) + preimage
 
 #define M_KEY_PREIMAGE          "preimage"
 #define M_SZ_PREIMAGE           (sizeof(M_KEY_PREIMAGE) - 1)
@@ -152,6 +170,13 @@
 #define M_KEY_PAYMENT_ID        "payment_id"
 #define M_SZ_PAYMENT_ID         (sizeof(M_KEY_PAYMENT_ID) - 1)
 
+#define M_KEY_CHANNEL           "channel"
+#define M_SZ_CHANNEL            (sizeof(M_KEY_CHANNEL) - 1)
+
+#define M_CHANNEL_RECORD_VER    ((uint8_t)1)                ///< channel DB: data version
+#define M_HTLC_RECORD_VER       ((uint8_t)1)                ///< HTLC DB: data version
+#define M_SZ_HTLC_RECORD_FIXED  (1 + 1 + 8 + 8 + 4 + BTC_SZ_HASH256 + LN_SZ_SIGNATURE)
+
 
 /********************************************************************
  * macro functions
@@ -168,6 +193,8 @@
 #define M_BUF_ITEM(idx, member)     { p_variable_items[idx].p_name = #member; p_variable_items[idx].p_buf = \
                                         (CONST_CAST utl_buf_t*)&pChannel->member; }
 
+#define M_TXN_ANNO                  (mpTxnAnnoRead ? mpTxnAnnoRead : mpTxnAnno)     ///< 現threadのanno transaction
+
 #ifndef M_DB_DEBUG
 #define MDB_TXN_BEGIN(a, b, c, d)   my_mdb_txn_begin(a, b, c, d, __LINE__)
 #define MDB_TXN_ABORT(a)            { mdb_txn_abort(a); (a) = NULL; }
@@ -273,12 +300,75 @@ typedef struct {
 } preimage_info_t;
 
 
-/** #ln_db_channel_del_param()用(ln_db_preimage_search)
+/** @typedef    route_skip_item_t
+ *  @brief      [route_skip]のメモリ上コピー
+ */
+typedef struct {
+    uint64_t    short_channel_id;
+    uint8_t     route_skip;         ///< ln_db_route_skip_t
+} route_skip_item_t;
+
+
+/** @typedef    route_skip_cache_t
+ *  @brief      [route_skip]全件をshort_channel_id順に保持する
+ */
+typedef struct {
+    bool                loaded;     ///< true:p_itemsは有効
+    uint32_t            num;
+    route_skip_item_t   *p_items;
+} route_skip_cache_t;
+
+
+/** @typedef    anno_peer_t
+ *  @brief      [anno_peer]に保存するpeer情報
+ *
+ * announcementの送受信済み情報(annoinfo)は、peerのnode_idではなくslot番号で持つ。
+ * genを進めると、そのpeerのannoinfo entryはすべて無効になる。
+ */
+typedef struct {
+    uint16_t    slot;           ///< peer slot
+    uint16_t    gen;            ///< slotの世代(M_ANNO_GEN_MASK)
+    uint32_t    mark;           ///< annoinfo.seqがこれ以下で、有効なentryがなければ送信済みとみなす(0:なし)
+} anno_peer_t;
+
+
+/** @typedef    preimage_db_t
+ *  @brief      [preimage]とindex DB
+ *
+ * - [preimage_hash]    key: payment_hash, data: preimage
+ * - [preimage_expire]  key: #M_SZ_PREIMAGE_EXPIRE_KEY, data: なし
+ *      - 未使用のpreimageだけを登録する
+ */
+typedef struct {
+    ln_lmdb_db_t    db;             ///< [preimage]
+    MDB_dbi         dbi_hash;       ///< [preimage_hash]
+    MDB_dbi         dbi_expire;     ///< [preimage_expire]
+} preimage_db_t;
+
+
+/** @typedef    anno_notify_type_t
+ *  @brief      #anno_notify_t.type
+ */
+typedef enum {
+    ANNO_NOTIFY_CNLANNO_SAVE,       ///< #ln_routing_notify_cnlanno_save()
+    ANNO_NOTIFY_CNLUPD_SAVE,        ///< #ln_routing_notify_cnlupd_save()
+    ANNO_NOTIFY_CNLANNO_DEL,        ///< #ln_routing_notify_cnlanno_del()
+} anno_notify_type_t;
+
+
+/** @typedef    anno_notify_t
+ *  @brief      commit待ちのrouting graph通知
  *
+ * anno DBのtransaction中は溜めておき、commitできた場合だけrouting graphに反映する。
+ * (commitに失敗するとDBに無いchannelがgraphに残るため)
  */
 typedef struct {
-    const ln_htlc_t  *p_htlcs;
-} preimage_close_t;
+    anno_notify_type_t      type;
+    uint64_t                short_channel_id;
+    char                    anno_type;                      ///< [CNLANNO_DEL]
+    uint8_t                 node_id[2][BTC_SZ_PUBKEY];      ///< [CNLANNO_SAVE]
+    ln_msg_channel_update_t upd;                            ///< [CNLUPD_SAVE]p_signature, p_chain_hashはNULL
+} anno_notify_t;
 
 
 /********************************************************************
@@ -304,6 +394,28 @@ static char         mPathPayment[M_DB_PATH_STR_MAX + 1];
 
 static pthread_mutex_t  mMuxAnno;
 static MDB_txn          *mpTxnAnno;
+static MDB_txn          *mpTxnAnnoBatch;            ///< #ln_db_anno_batch_begin()のtransaction
+static __thread bool    mAnnoBatchOwner;            ///< true:mpTxnAnnoBatchを開始したthread
+static __thread MDB_txn *mpTxnAnnoRead;             ///< #ln_db_anno_read_begin()のtransaction(thread毎)
+static anno_notify_t    *mpAnnoNotify;              ///< commit待ちのrouting graph通知(mMuxAnnoで保護)
+static uint32_t         mAnnoNotifyNum;             ///< mpAnnoNotify数
+static uint32_t         mAnnoNotifyMax;             ///< mpAnnoNotify確保数
+static uint32_t         mAnnoNotifyMark;            ///< batch中: 子transaction開始時のmAnnoNotifyNum
+
+/** anno DBのdbi
+ *
+ * #ln_db_init()で開いておき、並列に動くread-only transactionで共有する。
+ * (mdb_dbi_open()は複数のtransactionから同時に呼び出せないため)
+ */
+static const char   *M_ANNO_DBI_NAMES[] = {
+    M_DBI_CNLANNO, M_DBI_CNLANNO_INFO, M_DBI_NODEANNO, M_DBI_NODEANNO_INFO, M_DBI_CNLANNO_RECV, M_DBI_CNL_OWNED,
+    M_DBI_ANNO_PEER,
+};
+static MDB_dbi      mDbiAnno[ARRAY_SIZE(M_ANNO_DBI_NAMES)];
+static bool         mDbiAnnoReady;
+
+static pthread_mutex_t      mMuxRouteSkip;      ///< mRouteSkipCache
+static route_skip_cache_t   mRouteSkipCache;
 
 
 /**
@@ -320,6 +432,10 @@ static const fixed_item_t DBCHANNEL_SECRET[] = {
 /**
  *  @var    DBCHANNEL_VALUES
  *  @brief  ln_channel_tのほぼすべて
+ *  @note
+ *      - DB version -73から、この順番で1つのデータとして保存する(#channel_record_write())
+ *      - 並びを変える場合やサイズを変える場合はDB versionを上げること
+ *          (末尾への追加であれば、古いデータは追加分が無いものとして読み込める)
  */
 static const fixed_item_t DBCHANNEL_VALUES[] = {
     //
@@ -490,6 +606,10 @@ static int channel_db_open(ln_lmdb_db_t *pDb, const char *pDbName, int OptTxn, i
 static int channel_htlc_load(ln_channel_t *pChannel, ln_lmdb_db_t *pDb);
 static int channel_htlc_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb);
 static int channel_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb);
+static int channel_legacy_load(ln_channel_t *pChannel, ln_lmdb_db_t *pDb, utl_buf_t *pFundTx);
+static bool channel_record_write(utl_buf_t *pBuf, const ln_channel_t *pChannel, const utl_buf_t *pFundTx);
+static bool channel_record_read(ln_channel_t *pChannel, const uint8_t *pData, uint32_t Len);
+static uint8_t *channel_record_item(uint8_t *pData, uint32_t Len, const fixed_item_t *pItem);
 static int channel_item_load(ln_channel_t *pChannel, const fixed_item_t *pItems, ln_lmdb_db_t *pDb);
 static int channel_item_save(const ln_channel_t *pChannel, const fixed_item_t *pItems, ln_lmdb_db_t *pDb);
 static int channel_secret_load(ln_channel_t *pChannel, ln_lmdb_db_t *pDb);
@@ -497,12 +617,21 @@ static int channel_secret_restore(ln_channel_t *pChannel);
 static int channel_cursor_open(lmdb_cursor_t *pCur, bool bWritable);
 static void channel_cursor_close(lmdb_cursor_t *pCur, bool bWritable);
 static void channel_htlc_db_name(char *pDbName, int num);
+static int channel_htlc_legacy_load(ln_htlc_t *pHtlc, MDB_txn *pTxn, MDB_dbi Dbi);
+static bool htlc_is_empty(const ln_htlc_t *pHtlc);
+static bool htlc_record_write(utl_buf_t *pBuf, const ln_htlc_t *pHtlc);
+static bool htlc_record_read(ln_htlc_t *pHtlc, const uint8_t *pData, uint32_t Len);
+static int htlc_record_save(MDB_txn *pTxn, MDB_dbi Dbi, uint16_t Idx, const ln_htlc_t *pHtlc);
 static bool channel_cmp_func_channel_del(ln_channel_t *pChannel, void *pDbParam, void *pParam);
 static bool channel_search(ln_db_func_cmp_t pFunc, void *pFuncParam, bool bWritable, bool bRestore, bool bCont);
 static void channel_copy_closed(MDB_txn *pTxn, const char *pChannelStr);
 
 static int node_db_open(ln_lmdb_db_t *pDb, const char *pDbName, int OptTxn, int OptDb);
 
+static bool route_skip_cache_load(route_skip_cache_t *pCache);
+static void route_skip_cache_invalidate(void);
+static int route_skip_cmp_func(const void *pKey, const void *pItem);
+
 static int cnlanno_load(ln_lmdb_db_t *pDb, utl_buf_t *pCnlAnno, uint64_t ShortChannelId);
 static int cnlanno_save(ln_lmdb_db_t *pDb, const utl_buf_t *pCnlAnno, uint64_t ShortChannelId);
 static int cnlupd_load(ln_lmdb_db_t *pDb, utl_buf_t *pCnlUpd, uint32_t *pTimeStamp, uint64_t ShortChannelId, uint8_t Dir);
@@ -511,36 +640,55 @@ static int cnlanno_cur_load(MDB_cursor *pCur, uint64_t *pShortChannelId, char *p
 static int nodeanno_load(ln_lmdb_db_t *pDb, utl_buf_t *pNodeAnno, uint32_t *pTimeStamp, const uint8_t *pNodeId);
 static int nodeanno_save(ln_lmdb_db_t *pDb, const utl_buf_t *pNodeAnno, const uint8_t *pNodeId, uint32_t Timestamp);
 
-static bool annoinfos_trim_node_id(
-    const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo);
+static bool annoinfos_trim_slot(uint16_t Slot, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo);
 static bool annoinfos_trim_node_id_selected(
-    const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
+    const anno_peer_t *pPeer, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
     const uint64_t *pShortChannelIds, size_t Num);
 static bool annoinfos_trim_node_id_timestamp(
-    const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
+    const anno_peer_t *pPeer, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
     uint32_t TimeFirst, uint32_t TimeRange);
 static bool annoinfos_trim_node_id_nodeanno(
-    const uint8_t *pNodeId, uint64_t ShortChannelId, MDB_dbi DbiNodeannoInfo,
+    const anno_peer_t *pPeer, uint64_t ShortChannelId, MDB_dbi DbiNodeannoInfo,
     ln_lmdb_db_t *pDb);
 static bool annoinfos_del_all(MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo);
 
 static void cnlanno_info_set_key(uint8_t *pKeyData, MDB_val *pKey, uint64_t ShortChannelId, char Type);
+static bool anno_dbi_init(void);
+static int anno_dbi_open(const char *pName, unsigned int Flags, MDB_dbi *pDbi);
+static bool anno_load_begin(bool *pReadEnd);
+static void anno_load_end(bool bReadEnd);
+static void anno_notify_cnlanno_save(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2);
+static void anno_notify_cnlupd_save(const ln_msg_channel_update_t *pUpd);
+static void anno_notify_cnlanno_del(uint64_t ShortChannelId, char Type);
+static void anno_notify_push(const anno_notify_t *pNotify);
+static void anno_notify_apply(void);
+static void anno_notify_drop(uint32_t Num);
 static bool cnlanno_info_parse_key(MDB_val *pKey, uint64_t *pShortChannelId, char *pType);
 static void nodeanno_info_set_key(uint8_t *pKeyData, MDB_val *pKey, const uint8_t *pNodeId);
 //static bool nodeanno_info_parse_key(MDB_val *pKey, uint8_t *pNodeId);
 
-static bool annoinfo_add_node_id(MDB_val *pData, const uint8_t *pNodeId);
-static bool annoinfo_add(ln_lmdb_db_t *pDb, MDB_val *pMdbKey, MDB_val *pMdbData, const uint8_t *pNodeId);
-static bool annoinfo_search_node_id(MDB_val *pMdbData, const uint8_t *pNodeId);
-static bool annoinfo_cur_trim_node_id(MDB_cursor *pCursor, const uint8_t *pNodeId);
-static bool annoinfo_trim_node_id(MDB_val *pData, const uint8_t *pNodeId);
-static void annoinfo_cur_add(MDB_cursor *pCursor, const uint8_t *pNodeId);
+static int annopeer_load(anno_peer_t *pPeer, const uint8_t *pNodeId);
+static int annopeer_save(const anno_peer_t *pPeer, const uint8_t *pNodeId);
+static int annopeer_get(anno_peer_t *pPeer, const uint8_t *pNodeId);
+static int annopeer_gen_next(
+    anno_peer_t *pPeer, const uint8_t *pNodeId, uint32_t Mark,
+    MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo);
+static int annoinfo_seq_load(uint32_t *pSeq);
+static int annoinfo_seq_reset(uint32_t *pSeq);
+static int annoinfo_seq_next(uint32_t *pSeq);
+static bool annoinfo_is_sent(const MDB_val *pData, const anno_peer_t *pPeer);
+static int annoinfo_set(MDB_dbi Dbi, MDB_val *pKey, const anno_peer_t *pPeer, bool bSent, bool bClear);
+static int annoinfo_set_exist(MDB_dbi Dbi, MDB_val *pKey, const anno_peer_t *pPeer, bool bSent);
+static bool annoinfo_cur_trim_slot(MDB_cursor *pCursor, uint16_t Slot);
 static void anno_del_prune(void);
 
-static bool preimage_open(ln_lmdb_db_t *pDb, MDB_txn *pTxn);
-static void preimage_close(ln_lmdb_db_t *pDb, bool bCommit);
-static bool preimage_cmp_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam);
-static bool preimage_cmp_all_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam);
+static bool preimage_open(preimage_db_t *pDb, MDB_txn *pTxn);
+static void preimage_close(preimage_db_t *pDb, bool bCommit);
+static int preimage_del(preimage_db_t *pDb, const uint8_t *pPreimage);
+static int preimage_index_put(preimage_db_t *pDb, const uint8_t *pPreimage, const preimage_info_t *pInfo);
+static int preimage_index_del(preimage_db_t *pDb, const uint8_t *pPreimage, const preimage_info_t *pInfo);
+static void preimage_expire_key(uint8_t *pKeyData, MDB_val *pKey, const uint8_t *pPreimage, const preimage_info_t *pInfo);
+static void preimage_info_get(ln_db_preimage_t *pPreimage, const uint8_t *pKey, const preimage_info_t *pInfo);
 static bool preimage_search(ln_db_func_preimage_t pFunc, bool bCommit, void *pFuncParam);
 
 static int wallet_db_open(ln_lmdb_db_t *pDb, const char *pDbName, int OptTxn, int OptDb);
@@ -587,6 +735,7 @@ static bool payment_cur_del(void *pCur);
 
 static int fixed_items_load(void *pData, ln_lmdb_db_t *pDb, const fixed_item_t *pItems, size_t Num);
 static int fixed_items_save(const void *pData, ln_lmdb_db_t *pDb, const fixed_item_t *pItems, size_t Num);
+static int put_if_changed(MDB_txn *pTxn, MDB_dbi Dbi, MDB_val *pKey, MDB_val *pData);
 
 static int init_db_env(const init_param_t  *p_param);
 static int rm_files(const char *pPath, const struct stat *pStat, int Type, struct FTW *pFtwb);
@@ -597,6 +746,11 @@ static int lmdb_compaction(const init_param_t  *p_param);
 static bool auto_update_68_to_69(void);
 static bool auto_update_69_to_70(void);
 static bool auto_update_70_to_71(void);
+static bool auto_update_71_to_72(MDB_txn *pTxn);
+static bool auto_update_72_to_73(MDB_txn *pTxn);
+static bool auto_update_73_to_74(void);
+static bool auto_update_74_to_75(void);
+static bool auto_update_channel_db_names(MDB_txn *pTxn, uint8_t **ppNames, size_t *pNum);
 
 #ifndef M_DB_DEBUG
 static inline int my_mdb_txn_begin(MDB_env *pEnv, MDB_txn *pParent, unsigned int Flags, MDB_txn **ppTxn, int Line) {
@@ -928,9 +1082,16 @@ bool ln_db_init(char *pWif, char *pNodeName, uint16_t *pPort, bool bAutoUpdate,
 
     anno_del_prune();           //channel_updateだけの場合でも保持しておく
 
+    if (!anno_dbi_init()) {
+        if (bStdErr) fprintf(stderr, "fail: anno DB\n");
+        retval = -1;
+        goto LABEL_EXIT;
+    }
+
 LABEL_EXIT:
     if (retval == 0) {
         pthread_mutex_init(&mMuxAnno, NULL);
+        pthread_mutex_init(&mMuxRouteSkip, NULL);
     } else {
         //failed
         ln_db_term();
@@ -944,6 +1105,9 @@ void ln_db_term(void)
     if (!mpEnvChannel) return;
 
     pthread_mutex_destroy(&mMuxAnno);
+    mDbiAnnoReady = false;
+    route_skip_cache_invalidate();
+    pthread_mutex_destroy(&mMuxRouteSkip);
 
     mdb_env_close(mpEnvPayment);
     mpEnvPayment = NULL;
@@ -973,13 +1137,8 @@ int ln_lmdb_channel_load(ln_channel_t *pChannel, MDB_txn *pTxn, MDB_dbi Dbi, boo
     MDB_val         key, data;
     ln_lmdb_db_t    db;
 
-    //fixed size data
     db.p_txn = pTxn;
     db.dbi = Dbi;
-    retval = fixed_items_load(pChannel, &db, DBCHANNEL_VALUES, ARRAY_SIZE(DBCHANNEL_VALUES));
-    if (retval) {
-        goto LABEL_EXIT;
-    }
 
     for (uint16_t idx = 0; idx < LN_HTLC_MAX; idx++) {
         utl_buf_init(&pChannel->update_info.htlcs[idx].buf_preimage);
@@ -987,34 +1146,31 @@ int ln_lmdb_channel_load(ln_channel_t *pChannel, MDB_txn *pTxn, MDB_dbi Dbi, boo
         utl_buf_init(&pChannel->update_info.htlcs[idx].buf_shared_secret);
     }
 
-    //variable size data
-    utl_buf_t buf_fund_tx = UTL_BUF_INIT;
-    variable_item_t *p_variable_items = (variable_item_t *)UTL_DBG_MALLOC(sizeof(variable_item_t) * M_NUM_CHANNEL_BUFS);
-    if (!p_variable_items) goto LABEL_EXIT;
-    int index = 0;
-    p_variable_items[index].p_name = "buf_fund_tx";
-    p_variable_items[index].p_buf = &buf_fund_tx;
-    index++;
-    M_BUF_ITEM(index, shutdown_scriptpk_local);
-    index++;
-    M_BUF_ITEM(index, shutdown_scriptpk_remote);
-    //index++;
-
-    for (size_t lp = 0; lp < M_NUM_CHANNEL_BUFS; lp++) {
-        key.mv_size = strlen(p_variable_items[lp].p_name);
-        key.mv_data = (CONST_CAST char*)p_variable_items[lp].p_name;
-        retval = mdb_get(pTxn, Dbi, &key, &data);
+    key.mv_size = M_SZ_CHANNEL;
+    key.mv_data = M_KEY_CHANNEL;
+    retval = mdb_get(pTxn, Dbi, &key, &data);
+    if (retval == 0) {
+        if (!channel_record_read(pChannel, data.mv_data, data.mv_size)) {
+            LOGE("fail: channel record\n");
+            retval = -1;
+            goto LABEL_EXIT;
+        }
+    } else if (retval == MDB_NOTFOUND) {
+        //旧形式(closed env)
+        utl_buf_t buf_fund_tx = UTL_BUF_INIT;
+        retval = channel_legacy_load(pChannel, &db, &buf_fund_tx);
         if (retval == 0) {
-            utl_buf_alloccopy(p_variable_items[lp].p_buf, data.mv_data, data.mv_size);
-        } else {
-            LOGE("fail: %s\n", p_variable_items[lp].p_name);
+            btc_tx_read(&pChannel->funding_info.tx_data, buf_fund_tx.buf, buf_fund_tx.len);
+        }
+        utl_buf_free(&buf_fund_tx);
+        if (retval) {
+            goto LABEL_EXIT;
         }
+    } else {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
     }
 
-    btc_tx_read(&pChannel->funding_info.tx_data, buf_fund_tx.buf, buf_fund_tx.len);
-    utl_buf_free(&buf_fund_tx);
-    UTL_DBG_FREE(p_variable_items);
-
     //htlc
     retval = channel_htlc_load(pChannel, &db);
     if (retval) {
@@ -1040,6 +1196,7 @@ int ln_lmdb_channel_load(ln_channel_t *pChannel, MDB_txn *pTxn, MDB_dbi Dbi, boo
 
 LABEL_EXIT:
     if (retval == 0) {
+        ln_update_info_rebuild_index(&pChannel->update_info);
         LOGD("loaded: short_channel_id=0x%016" PRIx64 "\n", pChannel->short_channel_id);
     }
     return retval;
@@ -1103,7 +1260,7 @@ bool ln_db_channel_del_param(const ln_channel_t *pChannel, void *pDbParam)
 {
     int             retval;
     MDB_dbi         dbi;
-    char            db_name[M_SZ_CHANNEL_DB_NAME_STR + M_SZ_HTLC_IDX_STR + 1];
+    char            db_name[M_SZ_CHANNEL_DB_NAME_STR + 1];
     lmdb_cursor_t   *p_cur = (lmdb_cursor_t *)pDbParam;
     char            chanid_str[LN_SZ_CHANNEL_ID * 2 + 1];
 
@@ -1117,36 +1274,28 @@ bool ln_db_channel_del_param(const ln_channel_t *pChannel, void *pDbParam)
     channel_copy_closed(p_cur->p_txn, chanid_str);
 
     //remove preimages
-    preimage_close_t param;
-    param.p_htlcs = pChannel->update_info.htlcs;
-    ln_db_preimage_search(preimage_cmp_all_func, &param);
+    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+        if (!pChannel->update_info.htlcs[lp].enabled) continue;
+        /*ignore*/ln_db_preimage_del_hash(pChannel->update_info.htlcs[lp].payment_hash);
+    }
 
     //db_name base
     memcpy(db_name + M_SZ_PREF_STR, chanid_str, LN_SZ_CHANNEL_ID * 2);
 
-   //htlcs
-    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
-        memcpy(db_name, M_PREF_HTLC, M_SZ_PREF_STR);
-        channel_htlc_db_name(db_name, lp);
-        //LOGD("[%d]db_name: %s\n", lp, db_name);
-
-        retval = MDB_DBI_OPEN(p_cur->p_txn, db_name, 0, &dbi);
-        if (retval) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-            continue;
-        }
+    db_name[M_SZ_CHANNEL_DB_NAME_STR] = '\0';
 
+    //htlcs
+    memcpy(db_name, M_PREF_HTLC, M_SZ_PREF_STR);
+    retval = MDB_DBI_OPEN(p_cur->p_txn, db_name, 0, &dbi);
+    if (retval == 0) {
         retval = mdb_drop(p_cur->p_txn, dbi, 1);
-        if (retval) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-            continue;
+        if (retval == 0) {
+            LOGD("drop: %s\n", db_name);
+        } else {
+            LOGE("ERR: %s(db_name=%s)\n", mdb_strerror(retval), db_name);
         }
-        LOGD("drop: %s\n", db_name);
     }
 
-    //shorten
-    db_name[M_SZ_CHANNEL_DB_NAME_STR] = '\0';
-
     //revoked transaction
     memcpy(db_name, M_PREF_REVOKED_TX, M_SZ_PREF_STR);
     retval = MDB_DBI_OPEN(p_cur->p_txn, db_name, 0, &dbi);
@@ -1307,19 +1456,13 @@ void ln_db_channel_close(const uint8_t *pChannelId)
         LOGE("ERR: %s\n", mdb_strerror(retval));
     }
 
-    char htlc_name[M_SZ_CHANNEL_DB_NAME_STR + M_SZ_HTLC_IDX_STR + 1];
-    MDB_dbi dbi;
-    memcpy(htlc_name, M_PREF_HTLC, M_SZ_PREF_STR);
-    utl_str_bin2str(htlc_name + M_SZ_PREF_STR, pChannelId, LN_SZ_CHANNEL_ID);
-    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
-        channel_htlc_db_name(htlc_name, lp);
-        retval = MDB_DBI_OPEN(db.p_txn, htlc_name, 0, &dbi);
-        if (retval == 0) {
-            LOGD("close: htlc(%s)\n", htlc_name);
-            MDB_DBI_CLOSE(mpEnvChannel, dbi);
-        } else {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-        }
+    memcpy(db_name, M_PREF_HTLC, M_SZ_PREF_STR);
+    retval = MDB_DBI_OPEN(db.p_txn, db_name, 0, &db.dbi);
+    if (retval == 0) {
+        LOGD("close: htlc(%s)\n", db_name);
+        MDB_DBI_CLOSE(mpEnvChannel, db.dbi);
+    } else {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
     }
 
     LOGD("close: end\n");
@@ -1361,6 +1504,18 @@ bool ln_db_anno_transaction(void)
 {
     int retval;
 
+    if (mpTxnAnnoRead) {
+        //LMDBは1threadで同時に1 transactionまで
+        LOGE("fail: in read transaction\n");
+        return false;
+    }
+    if (mAnnoBatchOwner) {
+        //batch中は子transactionにする(失敗してもbatch内の他の保存に影響しない)
+        retval = MDB_TXN_BEGIN(mpEnvAnno, mpTxnAnnoBatch, 0, &mpTxnAnno);
+        mAnnoNotifyMark = mAnnoNotifyNum;
+        return retval == 0;
+    }
+
     //LOGD("anno_transaction\n");
     pthread_mutex_lock(&mMuxAnno);
     //LOGD("anno_transaction -- in\n");
@@ -1372,18 +1527,110 @@ bool ln_db_anno_transaction(void)
 }
 
 
-void ln_db_anno_commit(bool bCommit)
+bool ln_db_anno_commit(bool bCommit)
 {
+    bool ret = false;
+
     if (mpTxnAnno) {
         if (bCommit) {
-            MDB_TXN_COMMIT(mpTxnAnno);
+            ret = (my_mdb_txn_commit(mpTxnAnno, __LINE__) == 0);
         } else {
             MDB_TXN_ABORT(mpTxnAnno);
         }
         mpTxnAnno = NULL;
     }
+
+    if (mAnnoBatchOwner) {
+        //子transactionのcommitではまだDBに書かれないため、
+        //routing graphへの反映は#ln_db_anno_batch_end()でcommitできるまで待つ
+        if (!ret) {
+            anno_notify_drop(mAnnoNotifyMark);
+        }
+        mpTxnAnno = mpTxnAnnoBatch;
+        return ret;
+    }
+
+    //routing graphにはcommitできた分だけ反映する
+    if (ret) {
+        anno_notify_apply();
+    } else {
+        anno_notify_drop(0);
+    }
     pthread_mutex_unlock(&mMuxAnno);
     //LOGD("anno_transaction -- out\n");
+    return ret;
+}
+
+
+bool ln_db_anno_batch_begin(void)
+{
+    if (mAnnoBatchOwner) {
+        LOGE("fail: already in batch\n");
+        return false;
+    }
+    if (!ln_db_anno_transaction()) {
+        LOGE("ERR: anno transaction\n");
+        return false;
+    }
+    mpTxnAnnoBatch = mpTxnAnno;
+    mAnnoBatchOwner = true;
+    return true;
+}
+
+
+bool ln_db_anno_batch_end(bool bCommit)
+{
+    int retval = 0;
+
+    if (!mAnnoBatchOwner) {
+        LOGE("fail: not in batch\n");
+        return false;
+    }
+    mAnnoBatchOwner = false;
+    if (bCommit) {
+        retval = my_mdb_txn_commit(mpTxnAnnoBatch, __LINE__);
+    } else {
+        MDB_TXN_ABORT(mpTxnAnnoBatch);
+    }
+    mpTxnAnnoBatch = NULL;
+    mpTxnAnno = NULL;
+
+    //batch内の保存はすべてcommitできた場合だけrouting graphに反映する
+    if (bCommit && (retval == 0)) {
+        anno_notify_apply();
+    } else {
+        anno_notify_drop(0);
+    }
+    mAnnoNotifyMark = 0;
+    pthread_mutex_unlock(&mMuxAnno);
+    return retval == 0;
+}
+
+
+bool ln_db_anno_read_begin(void)
+{
+    if (mpTxnAnnoRead) {
+        LOGE("fail: already in read transaction\n");
+        return false;
+    }
+    if (mAnnoBatchOwner) {
+        LOGE("fail: in batch\n");
+        return false;
+    }
+    int retval = MDB_TXN_BEGIN(mpEnvAnno, NULL, MDB_RDONLY, &mpTxnAnnoRead);
+    if (retval) {
+        mpTxnAnnoRead = NULL;
+        return false;
+    }
+    return true;
+}
+
+
+void ln_db_anno_read_end(void)
+{
+    if (mpTxnAnnoRead) {
+        MDB_TXN_ABORT(mpTxnAnnoRead);
+    }
 }
 
 
@@ -1408,14 +1655,16 @@ void ln_db_anno_commit(bool bCommit)
  *                  key[0..7] = (BigEndian)short_channel_id;
  *                  key[8] = 'A' or 'B' or 'C';   ```
  *-------------------------------------------------------------------
- *  dbi: "channel_anno_info" (M_DBI_CNLANNO_INFO, LN_DB_CUR_CNLANNO_INFO)
+ *  dbi: "channel_anno_sent" (M_DBI_CNLANNO_INFO, LN_DB_CUR_CNLANNO_INFO)
  *      key:  [channel_announcement]short_channel_id + 'A'
  *            [channel_update dir0]short_channel_id + 'B'
  *            [channel_update dir1]short_channel_id + 'C'
  *      data:
- *          - node_ids sending to or receiving from(uint8_t[33] * n)
+ *          - seq: uint32_t
+ *          - peers sending to or receiving from((slot: uint16_t + gen: uint16_t) * n)
  *      note:
  *          - `key` same as "channel_anno"
+ *          - see "anno_peer"
  *-------------------------------------------------------------------
  *  dbi: "channal_anno_recv" (M_DBI_CNLANNO_RECV)
  *      key:  node_id(uint8_t[33])
@@ -1430,10 +1679,28 @@ void ln_db_anno_commit(bool bCommit)
  *          - timestamp: uint32_t
  *          - `node_announcement` packet
  *-------------------------------------------------------------------
- *  dbi: "node_anno_info" (M_DBI_NODEANNO_INFO, LN_DB_CUR_NODEANNO_INFO)
+ *  dbi: "node_anno_sent" (M_DBI_NODEANNO_INFO, LN_DB_CUR_NODEANNO_INFO)
+ *      key:  node_id(uint8_t[33])
+ *      data:
+ *          - seq: uint32_t
+ *          - peers sending to or receiving from((slot: uint16_t + gen: uint16_t) * n)
+ *      note:
+ *          - see "anno_peer"
+ *-------------------------------------------------------------------
+ *  dbi: "anno_peer" (M_DBI_ANNO_PEER)
  *      key:  node_id(uint8_t[33])
  *      data:
- *          - node_ids sending to or receiving from(uint8_t[33] * n)
+ *          - anno_peer_t
+ *      key:  "seq"
+ *      data:
+ *          - the last seq: uint32_t
+ *      note:
+ *          - sent(announcement, peer):
+ *              - the entry of peer.slot with peer.gen exists: !(gen & M_ANNO_GEN_UNSENT)
+ *              - else: seq <= peer.mark
+ *          - an updated announcement gets a new seq, and the entries are cleared.
+ *          - increasing peer.gen invalidates all the entries of the peer at once.
+ *          - when seq wraps around, all peer.mark are reset to 0 and all seq to 1 in the same txn.
  *-------------------------------------------------------------------
  */
 
@@ -1444,13 +1711,14 @@ bool ln_db_cnlanno_load(utl_buf_t *pCnlAnno, uint64_t ShortChannelId)
 {
     int         retval;
     ln_lmdb_db_t   db;
+    bool        read_end;
 
-    if (!ln_db_anno_transaction()) {
+    if (!anno_load_begin(&read_end)) {
         LOGE("ERR: anno transaction\n");
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO, 0, &db.dbi);
+    retval = anno_dbi_open(M_DBI_CNLANNO, 0, &db.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         goto LABEL_EXIT;
@@ -1465,7 +1733,7 @@ bool ln_db_cnlanno_load(utl_buf_t *pCnlAnno, uint64_t ShortChannelId)
     }
 
 LABEL_EXIT:
-    ln_db_anno_commit(false);
+    anno_load_end(read_end);
     return retval == 0;
 }
 
@@ -1475,7 +1743,7 @@ LABEL_EXIT:
  *  また、channel_announcementの両端node_idを保存する(node_announcement送信判定用)。
  *
  *  dbi: "channel_anno"
- *  dbi: "channel_anno_info"
+ *  dbi: "channel_anno_sent"
  *  dbi: "channal_anno_recv"
  */
 bool ln_db_cnlanno_save(const utl_buf_t *pCnlAnno, uint64_t ShortChannelId, const uint8_t *pSendId,
@@ -1491,21 +1759,19 @@ bool ln_db_cnlanno_save(const utl_buf_t *pCnlAnno, uint64_t ShortChannelId, cons
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO, MDB_CREATE, &db.dbi);
+    retval = anno_dbi_open(M_DBI_CNLANNO, MDB_CREATE, &db.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
         goto LABEL_EXIT;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, MDB_CREATE, &db_info.dbi);
+    retval = anno_dbi_open(M_DBI_CNLANNO_INFO, MDB_CREATE, &db_info.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
         goto LABEL_EXIT;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_RECV, MDB_CREATE, &db_recv.dbi);
+    retval = anno_dbi_open(M_DBI_CNLANNO_RECV, MDB_CREATE, &db_recv.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         goto LABEL_EXIT;
@@ -1564,7 +1830,10 @@ bool ln_db_cnlanno_save(const utl_buf_t *pCnlAnno, uint64_t ShortChannelId, cons
 
 LABEL_EXIT:
     if (retval == 0) {
-        ln_db_anno_commit(true);
+        anno_notify_cnlanno_save(ShortChannelId, pNodeId1, pNodeId2);
+        if (!ln_db_anno_commit(true)) {
+            retval = -1;
+        }
     } else {
         //failed
         ln_db_anno_commit(false);
@@ -1584,34 +1853,29 @@ bool ln_db_cnlupd_load(utl_buf_t *pCnlUpd, uint32_t *pTimeStamp, uint64_t ShortC
     ln_lmdb_db_t    db;
     ln_lmdb_db_t    *p_db;
 
+    bool            read_end = false;
+
     if (pDbParam) {
         p_db = (ln_lmdb_db_t *)pDbParam;
     } else {
-        if (!ln_db_anno_transaction()) {
+        if (!anno_load_begin(&read_end)) {
             LOGE("ERR: anno transaction\n");
             return false;
         }
-        retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO, 0, &db.dbi);
+        retval = anno_dbi_open(M_DBI_CNLANNO, 0, &db.dbi);
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
-            ln_db_anno_commit(false);
+            anno_load_end(read_end);
             return false;
         }
         p_db = &db;
     }
 
     retval = cnlupd_load(p_db, pCnlUpd, pTimeStamp, ShortChannelId, Dir);
-    if (retval) {
-        if (!pDbParam) {
-            ln_db_anno_commit(false);
-        }
-        return false;
-    }
-
     if (!pDbParam) {
-        ln_db_anno_commit(false);
+        anno_load_end(read_end);
     }
-    return true;
+    return retval == 0;
 }
 
 
@@ -1619,7 +1883,7 @@ bool ln_db_cnlupd_load(utl_buf_t *pCnlUpd, uint32_t *pTimeStamp, uint64_t ShortC
  *  パケット保存と、その送信元node_idの保存を行う。
  *
  *  dbi: "channel_anno"
- *  dbi: "channel_anno_info"
+ *  dbi: "channel_anno_sent"
  */
 bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *pUpd, const uint8_t *pSendId)
 {
@@ -1631,14 +1895,14 @@ bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO, MDB_CREATE, &db.dbi);
+    retval = anno_dbi_open(M_DBI_CNLANNO, MDB_CREATE, &db.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, MDB_CREATE, &db_info.dbi);
+    retval = anno_dbi_open(M_DBI_CNLANNO_INFO, MDB_CREATE, &db_info.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
@@ -1702,8 +1966,10 @@ bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *
         }
     }
 
-    ln_db_anno_commit(true);
-    return true;
+    if (update) {
+        anno_notify_cnlupd_save(pUpd);
+    }
+    return ln_db_anno_commit(true);
 }
 
 
@@ -1721,7 +1987,7 @@ bool ln_db_cnlupd_need_to_prune(uint64_t Now, uint32_t TimesStamp)
  *
  *
  *  dbi: "channel_anno"
- *  dbi: "channel_anno_info"
+ *  dbi: "channel_anno_sent"
  */
 bool ln_db_cnlanno_del(uint64_t ShortChannelId)
 {
@@ -1735,14 +2001,14 @@ bool ln_db_cnlanno_del(uint64_t ShortChannelId)
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO, MDB_CREATE, &dbi);
+    retval = anno_dbi_open(M_DBI_CNLANNO, MDB_CREATE, &dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, MDB_CREATE, &dbi_info);
+    retval = anno_dbi_open(M_DBI_CNLANNO_INFO, MDB_CREATE, &dbi_info);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
@@ -1761,7 +2027,11 @@ bool ln_db_cnlanno_del(uint64_t ShortChannelId)
             LOGE("ERR[%c]: %s\n", SUFFIX[lp], mdb_strerror(retval));
         }
     }
-    ln_db_anno_commit(true);
+    anno_notify_cnlanno_del(ShortChannelId, LN_DB_CNLANNO_ANNO);
+    if (!ln_db_anno_commit(true)) {
+        LOGE("fail: commit\n");
+        return false;
+    }
     LOGD("remove channel_announcement: %016" PRIx64 "\n", ShortChannelId);
     return true;
 }
@@ -1776,32 +2046,28 @@ bool ln_db_nodeanno_load(utl_buf_t *pNodeAnno, uint32_t *pTimeStamp, const uint8
 {
     int             retval;
     ln_lmdb_db_t    db;
+    bool            read_end;
 
-    if (!ln_db_anno_transaction()) {
+    if (!anno_load_begin(&read_end)) {
         LOGE("ERR: anno transaction\n");
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO, 0, &db.dbi);
+    retval = anno_dbi_open(M_DBI_NODEANNO, 0, &db.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
+        anno_load_end(read_end);
         return false;
     }
 
     retval = nodeanno_load(&db, pNodeAnno, pTimeStamp, pNodeId);
-    if (retval) {
-        ln_db_anno_commit(false);
-        return false;
-    }
-
-    ln_db_anno_commit(false);
-    return true;
+    anno_load_end(read_end);
+    return retval == 0;
 }
 
 
 // dbi: "node_anno"
-// dbi: "node_anno_info"
+// dbi: "node_anno_sent"
 bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcement_t *pAnno, const uint8_t *pSendId)
 {
     int             retval;
@@ -1817,14 +2083,14 @@ bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcem
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO, MDB_CREATE, &db.dbi);
+    retval = anno_dbi_open(M_DBI_NODEANNO, MDB_CREATE, &db.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO_INFO, MDB_CREATE, &db_info.dbi);
+    retval = anno_dbi_open(M_DBI_NODEANNO_INFO, MDB_CREATE, &db_info.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
@@ -1836,7 +2102,7 @@ bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcem
         //  * if node_id is NOT previously known from a channel_announcement message, OR if timestamp is NOT greater than the last-received node_announcement from this node_id:
         //    * SHOULD ignore the message.
         //  channel_announcementで受信していないnode_idは無視する
-        retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_RECV, 0, &db_recv.dbi);
+        retval = anno_dbi_open(M_DBI_CNLANNO_RECV, 0, &db_recv.dbi);
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
             ln_db_anno_commit(false);
@@ -1845,7 +2111,7 @@ bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcem
 
         key.mv_size = BTC_SZ_PUBKEY;
         key.mv_data = (CONST_CAST uint8_t *)pAnno->p_node_id;
-        retval = mdb_get(mpTxnAnno, db_recv.dbi, &key, &data);
+        retval = mdb_get(M_TXN_ANNO, db_recv.dbi, &key, &data);
         if (retval) {
             LOGD("skip: not have channel_announcement node_id\n");
             ln_db_anno_commit(false);
@@ -1936,14 +2202,15 @@ bool ln_db_anno_cur_open(void **ppCur, ln_db_cur_t Type)
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, p_name, MDB_CREATE, &dbi);
+    retval = anno_dbi_open(p_name, MDB_CREATE, &dbi);
     if (retval) {
         LOGE("fail: ???\n");
         *ppCur = NULL;
         return false;
     }
 
-    retval = mdb_cursor_open(mpTxnAnno, dbi, &p_cursor);
+    //#ln_db_anno_read_begin()中はread-only cursor
+    retval = mdb_cursor_open(M_TXN_ANNO, dbi, &p_cursor);
     if (retval) {
         LOGE("ERR(%s): %s\n", p_name, mdb_strerror(retval));
         *ppCur = NULL;
@@ -1958,7 +2225,7 @@ bool ln_db_anno_cur_open(void **ppCur, ln_db_cur_t Type)
         return false;
     }
 
-    p_cur->p_txn = (MDB_txn *)p_name;
+    p_cur->p_txn = M_TXN_ANNO;
     p_cur->dbi = dbi;
     p_cur->p_cursor = p_cursor;
     *ppCur = p_cur;
@@ -1982,40 +2249,28 @@ void ln_db_anno_cur_close(void *pCur)
  *
  * #ln_db_cnlanno_info_search_node_id()で、送信不要かどうかをチェックする。
 
- *  dbi: "channel_anno_info"
+ *  dbi: "channel_anno_sent"
+ *  dbi: "anno_peer"
  */
 bool ln_db_cnlanno_info_add_node_id(void *pCur, uint64_t ShortChannelId, char Type, bool bClear, const uint8_t *pNodeId)
 {
     lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
-    MDB_val key, data;
+    MDB_val key;
     uint8_t key_data[M_SZ_CNLANNO_INFO_KEY];
-    bool detect = false;
+    anno_peer_t peer;
 
-    cnlanno_info_set_key(key_data, &key, ShortChannelId, Type);
-    if (bClear) {
-        data.mv_size = 0;
-    } else {
-        int retval = mdb_get(mpTxnAnno, p_cur->dbi, &key, &data);
-        if (retval == 0) {
-            detect = annoinfo_search_node_id(&data, pNodeId);
-        } else {
-            LOGV("new reg[%016" PRIx64 ":%c] ", ShortChannelId, Type);
-            DUMPV(pNodeId, BTC_SZ_PUBKEY);
-            data.mv_size = 0;
-        }
-    }
-    if (!detect) {
-        if (!annoinfo_add((ln_lmdb_db_t *)p_cur, &key, &data, pNodeId)) {
-            return false;
-        }
+    if (pNodeId && (annopeer_get(&peer, pNodeId) != 0)) {
+        return false;
     }
-    return true;
+    cnlanno_info_set_key(key_data, &key, ShortChannelId, Type);
+    return annoinfo_set(p_cur->dbi, &key, (pNodeId) ? &peer : NULL, true, bClear) == 0;
 }
 
 
 /* [channel_announcement / channel_update]search received/sent DB
  *
- *  dbi: "channel_anno_info"
+ *  dbi: "channel_anno_sent"
+ *  dbi: "anno_peer"
  */
 bool ln_db_cnlanno_info_search_node_id(void *pCur, uint64_t ShortChannelId, char Type, const uint8_t *pNodeId)
 {
@@ -2023,18 +2278,19 @@ bool ln_db_cnlanno_info_search_node_id(void *pCur, uint64_t ShortChannelId, char
 
     MDB_val key, data;
     uint8_t key_data[M_SZ_CNLANNO_INFO_KEY];
+    anno_peer_t peer;
 
+    if (annopeer_load(&peer, pNodeId) != 0) {
+        //送受信したことがないpeer
+        return false;
+    }
     cnlanno_info_set_key(key_data, &key, ShortChannelId, Type);
-    int retval = mdb_get(mpTxnAnno, p_cur->dbi, &key, &data);
+    int retval = mdb_get(M_TXN_ANNO, p_cur->dbi, &key, &data);
     if (retval) {
         //LOGE("ERR: %s\n", mdb_strerror(retval));
         return false;
     }
-
-    // LOGD("short_channel_id[%c]= %016" PRIx64 "\n", Type, ShortChannelId);
-    // LOGD("send_id= ");
-    // DUMPD(pSendId, BTC_SZ_PUBKEY);
-    return annoinfo_search_node_id(&data, pNodeId);
+    return annoinfo_is_sent(&data, &peer);
 }
 
 
@@ -2053,6 +2309,26 @@ bool ln_db_cnlanno_cur_get(void *pCur, uint64_t *pShortChannelId, char *pType, u
 }
 
 
+bool ln_db_cnlanno_cur_seek(void *pCur, uint64_t *pShortChannelId, char *pType, uint32_t *pTimeStamp, utl_buf_t *pBuf, uint64_t ShortChannelId)
+{
+    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
+    MDB_val key, data;
+    uint8_t key_data[M_SZ_CNLANNO_INFO_KEY];
+
+    //typeは'A'以降なので、0x00にしておけばShortChannelIdの先頭から見つかる
+    cnlanno_info_set_key(key_data, &key, ShortChannelId, 0x00);
+    int retval = mdb_cursor_get(p_cur->p_cursor, &key, &data, MDB_SET_RANGE);
+    if (retval) {
+        if (retval != MDB_NOTFOUND) {
+            LOGE("fail: mdb_cursor_get(): %s\n", mdb_strerror(retval));
+        }
+        return false;
+    }
+    retval = cnlanno_cur_load(p_cur->p_cursor, pShortChannelId, pType, pTimeStamp, pBuf, MDB_GET_CURRENT);
+    return retval == 0;
+}
+
+
 bool ln_db_cnlanno_cur_back(void *pCur)
 {
     lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
@@ -2073,13 +2349,24 @@ bool ln_db_cnlanno_cur_back(void *pCur)
 bool ln_db_cnlanno_cur_del(void *pCur)
 {
     lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
-    int retval = mdb_cursor_del(p_cur->p_cursor, 0);
+    MDB_val key, data;
+    uint64_t short_channel_id = 0;
+    char type = 0;
+
+    //削除対象をrouting graphに通知するため、先にkeyを取得しておく
+    int retval = mdb_cursor_get(p_cur->p_cursor, &key, &data, MDB_GET_CURRENT);
+    bool notify = (retval == 0) && cnlanno_info_parse_key(&key, &short_channel_id, &type);
+
+    retval = mdb_cursor_del(p_cur->p_cursor, 0);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("fail: mdb_cursor_del(): %s\n", mdb_strerror(retval));
         }
         return false;
     }
+    if (notify) {
+        anno_notify_cnlanno_del(short_channel_id, type);
+    }
     return true;
 }
 
@@ -2109,37 +2396,37 @@ bool ln_db_nodeanno_cur_load(void *pCur, utl_buf_t *pNodeAnno, uint32_t *pTimeSt
 
 /* [node_announcement]
  *
- *  dbi: "node_anno_info"
+ *  dbi: "node_anno_sent"
+ *  dbi: "anno_peer"
  */
 bool ln_db_nodeanno_info_search_node_id(void *pCur, const uint8_t *pNodeId, const uint8_t *pSendId)
 {
-    //LOGD("node_id= ");
-    //DUMPD(pNodeId, BTC_SZ_PUBKEY);
-    //LOGD("send_id= ");
-    //DUMPD(pSendId, BTC_SZ_PUBKEY);
-
     lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pCur;
 
     MDB_val key, data;
     uint8_t key_data[M_SZ_NODEANNO_INFO_KEY];
+    anno_peer_t peer;
 
+    if (annopeer_load(&peer, pSendId) != 0) {
+        //送受信したことがないpeer
+        return false;
+    }
     nodeanno_info_set_key(key_data, &key, pNodeId);
-    int retval = mdb_get(mpTxnAnno, p_cur->dbi, &key, &data);
+    int retval = mdb_get(M_TXN_ANNO, p_cur->dbi, &key, &data);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
         }
         return false;
     }
-
-    //LOGD("search...\n");
-    return annoinfo_search_node_id(&data, pSendId);
+    return annoinfo_is_sent(&data, &peer);
 }
 
 
 /* [node_announcement]
  *
- *  dbi: "node_anno_info"
+ *  dbi: "node_anno_sent"
+ *  dbi: "anno_peer"
  */
 bool ln_db_nodeanno_info_add_node_id(void *pCur, const uint8_t *pNodeId, bool bClear, const uint8_t *pSendId)
 {
@@ -2149,33 +2436,18 @@ bool ln_db_nodeanno_info_add_node_id(void *pCur, const uint8_t *pNodeId, bool bC
     }
 
     lmdb_cursor_t   *p_cur = (lmdb_cursor_t *)pCur;
-    MDB_val         key, data;
+    MDB_val         key;
     uint8_t         key_data[M_SZ_NODEANNO_INFO_KEY];
-    bool            detect = false;
+    anno_peer_t     peer;
 
+    if (pSendId && (annopeer_get(&peer, pSendId) != 0)) {
+        LOGE("fail: anno_peer\n");
+        return false;
+    }
     nodeanno_info_set_key(key_data, &key, pNodeId);
-    if (bClear) {
-        data.mv_size = 0;
-    } else {
-        int retval = mdb_get(mpTxnAnno, p_cur->dbi, &key, &data);
-        if (retval == 0) {
-            detect = annoinfo_search_node_id(&data, pSendId);
-        } else {
-            data.mv_size = 0;
-        }
-    }
-
-    if (!detect) {
-        LOGV("new from ");
-        if (pSendId) {
-            DUMPV(pSendId, BTC_SZ_PUBKEY);
-        } else {
-            LOGV(": only clear\n");
-        }
-        if (!annoinfo_add((ln_lmdb_db_t *)p_cur, &key, &data, pSendId)) {
-            LOGE("fail: ???\n");
-            return false;
-        }
+    if (annoinfo_set(p_cur->dbi, &key, (pSendId) ? &peer : NULL, true, bClear) != 0) {
+        LOGE("fail: ???\n");
+        return false;
     }
     return true;
 }
@@ -2246,7 +2518,7 @@ bool ln_db_channel_owned_save(uint64_t ShortChannelId)
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNL_OWNED, MDB_CREATE, &db.dbi);
+    retval = anno_dbi_open(M_DBI_CNL_OWNED, MDB_CREATE, &db.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
@@ -2278,12 +2550,12 @@ bool ln_db_channel_owned_check(uint64_t ShortChannelId)
     ln_lmdb_db_t    db;
     MDB_val         key, data;
 
-    if (mpTxnAnno == NULL) {
+    if (M_TXN_ANNO == NULL) {
         LOGE("fail: no txn\n");
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNL_OWNED, 0, &db.dbi);
+    retval = anno_dbi_open(M_DBI_CNL_OWNED, 0, &db.dbi);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -2293,7 +2565,7 @@ bool ln_db_channel_owned_check(uint64_t ShortChannelId)
 
     key.mv_size = sizeof(uint64_t);
     key.mv_data = (uint8_t *)&ShortChannelId;
-    retval = mdb_get(mpTxnAnno, db.dbi, &key, &data);
+    retval = mdb_get(M_TXN_ANNO, db.dbi, &key, &data);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -2319,7 +2591,7 @@ bool ln_db_channel_owned_del(uint64_t ShortChannelId)
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNL_OWNED, 0, &db.dbi);
+    retval = anno_dbi_open(M_DBI_CNL_OWNED, 0, &db.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
@@ -2355,7 +2627,7 @@ bool ln_db_annoinfos_del_node_id(const uint8_t *pNodeId, const uint64_t *pShortC
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, 0, &dbi_cnlanno_info);
+    retval = anno_dbi_open(M_DBI_CNLANNO_INFO, 0, &dbi_cnlanno_info);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -2364,7 +2636,7 @@ bool ln_db_annoinfos_del_node_id(const uint8_t *pNodeId, const uint64_t *pShortC
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO_INFO, 0, &dbi_nodeanno_info);
+    retval = anno_dbi_open(M_DBI_NODEANNO_INFO, 0, &dbi_nodeanno_info);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -2374,12 +2646,23 @@ bool ln_db_annoinfos_del_node_id(const uint8_t *pNodeId, const uint64_t *pShortC
     }
 
     if (pNodeId) {
+        anno_peer_t peer;
+        retval = annopeer_get(&peer, pNodeId);
+        if (retval) {
+            LOGE("fail: anno_peer\n");
+            ln_db_anno_commit(false);
+            return false;
+        }
         if ((pShortChannelIds == NULL) && (Num == 0)) {
-            //all trim
-            (void)annoinfos_trim_node_id(pNodeId, dbi_cnlanno_info, dbi_nodeanno_info);
+            //all trim: 世代を進め、peerのentryをまとめて無効にする
+            retval = annopeer_gen_next(&peer, pNodeId, 0, dbi_cnlanno_info, dbi_nodeanno_info);
+            if (retval) {
+                ln_db_anno_commit(false);
+                return false;
+            }
         } else {
             //selected trim
-            (void)annoinfos_trim_node_id_selected(pNodeId, dbi_cnlanno_info, dbi_nodeanno_info, pShortChannelIds, Num);
+            (void)annoinfos_trim_node_id_selected(&peer, dbi_cnlanno_info, dbi_nodeanno_info, pShortChannelIds, Num);
         }
     } else {
         //drop
@@ -2402,21 +2685,22 @@ bool ln_db_annoinfos_add_node_id(const uint8_t *pNodeId)
     int         retval;
     MDB_dbi     dbi_cnl;
     MDB_dbi     dbi_node;
-    MDB_cursor  *p_cursor;
+    anno_peer_t peer;
+    uint32_t    seq;
 
     if (!ln_db_anno_transaction()) {
         LOGE("ERR: anno transaction\n");
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, 0, &dbi_cnl);
+    retval = anno_dbi_open(M_DBI_CNLANNO_INFO, 0, &dbi_cnl);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO_INFO, 0, &dbi_node);
+    retval = anno_dbi_open(M_DBI_NODEANNO_INFO, 0, &dbi_node);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         ln_db_anno_commit(false);
@@ -2426,25 +2710,19 @@ bool ln_db_annoinfos_add_node_id(const uint8_t *pNodeId)
     LOGD("add annoinfo: ");
     DUMPD(pNodeId, BTC_SZ_PUBKEY);
 
-    //cnlanno_info
-    retval = mdb_cursor_open(mpTxnAnno, dbi_cnl, &p_cursor);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        ln_db_anno_commit(false);
-        return false;
+    //現在のannouncementはすべて送信済みとする
+    retval = annopeer_get(&peer, pNodeId);
+    if (retval == 0) {
+        retval = annoinfo_seq_load(&seq);
+    }
+    if (retval == 0) {
+        retval = annopeer_gen_next(&peer, pNodeId, seq, dbi_cnl, dbi_node);
     }
-    annoinfo_cur_add(p_cursor, pNodeId);
-    MDB_CURSOR_CLOSE(p_cursor);
-
-    //nodeanno_info
-    retval = mdb_cursor_open(mpTxnAnno, dbi_node, &p_cursor);
     if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
+        LOGE("fail: anno_peer\n");
         ln_db_anno_commit(false);
         return false;
     }
-    annoinfo_cur_add(p_cursor, pNodeId);
-    MDB_CURSOR_CLOSE(p_cursor);
 
     ln_db_anno_commit(true);
     return true;
@@ -2456,13 +2734,15 @@ bool ln_db_annoinfos_del_timestamp(const uint8_t *pNodeId, uint32_t TimeFirst, u
     int         retval;
     MDB_dbi     dbi_cnlanno_info;
     MDB_dbi     dbi_nodeanno_info;
+    anno_peer_t peer;
+    uint32_t    seq;
 
     if (!ln_db_anno_transaction()) {
         LOGE("ERR: anno transaction\n");
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO_INFO, 0, &dbi_cnlanno_info);
+    retval = anno_dbi_open(M_DBI_CNLANNO_INFO, 0, &dbi_cnlanno_info);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -2471,7 +2751,7 @@ bool ln_db_annoinfos_del_timestamp(const uint8_t *pNodeId, uint32_t TimeFirst, u
         return false;
     }
 
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_NODEANNO_INFO, 0, &dbi_nodeanno_info);
+    retval = anno_dbi_open(M_DBI_NODEANNO_INFO, 0, &dbi_nodeanno_info);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -2480,8 +2760,21 @@ bool ln_db_annoinfos_del_timestamp(const uint8_t *pNodeId, uint32_t TimeFirst, u
         return false;
     }
 
+    //範囲外はすべて送信済みとし、範囲内だけ未送信にする
+    retval = annopeer_get(&peer, pNodeId);
+    if (retval == 0) {
+        retval = annoinfo_seq_load(&seq);
+    }
+    if (retval == 0) {
+        retval = annopeer_gen_next(&peer, pNodeId, seq, dbi_cnlanno_info, dbi_nodeanno_info);
+    }
+    if (retval) {
+        LOGE("fail: anno_peer\n");
+        ln_db_anno_commit(false);
+        return false;
+    }
     (void)annoinfos_trim_node_id_timestamp(
-        pNodeId, dbi_cnlanno_info, dbi_nodeanno_info,
+        &peer, dbi_cnlanno_info, dbi_nodeanno_info,
         TimeFirst, TimeRange);
 
     ln_db_anno_commit(true);
@@ -2533,6 +2826,8 @@ bool ln_db_route_skip_save(uint64_t ShortChannelId, bool bTemp)
     LOGD("add skip[%d]: %016" PRIx64 "\n", bTemp, ShortChannelId);
 
     MDB_TXN_COMMIT(db.p_txn);
+    route_skip_cache_invalidate();
+    ln_routing_notify_route_skip_save(ShortChannelId, bTemp);
     return true;
 }
 
@@ -2592,6 +2887,8 @@ bool ln_db_route_skip_work(bool bWork)
 
     MDB_CURSOR_CLOSE(p_cursor);
     MDB_TXN_COMMIT(db.p_txn);
+    route_skip_cache_invalidate();
+    ln_routing_notify_route_skip_work(bWork);
     return true;
 
 LABEL_ERROR:
@@ -2606,45 +2903,34 @@ LABEL_ERROR:
 }
 
 
-/* open DB cursor(M_DBI_ROUTE_SKIP)
+/* search route_skip
+ *
+ * 検索はchannel数だけ呼ばれるため、DBを1回のread transactionで全件読み込んでおき、
+ * メモリ上で二分探索する。
+ * 読込み結果はln_db_route_skip_save/work/drop()で破棄する。
  *
  *  dbi: "route_skip"
  */
 ln_db_route_skip_t ln_db_route_skip_search(uint64_t ShortChannelId)
 {
-    ln_db_route_skip_t  result = LN_DB_ROUTE_SKIP_NONE;
-    int                 retval;
-    MDB_val             key, data;
-    ln_lmdb_db_t        db;
-
-    db.p_txn = NULL;
-
-    retval = node_db_open(&db, M_DBI_ROUTE_SKIP, 0, 0);
-    if (retval) {
-        LOGE("ERR: %s\n", mdb_strerror(retval));
-        return LN_DB_ROUTE_SKIP_NONE;
-    }
+    ln_db_route_skip_t result = LN_DB_ROUTE_SKIP_NONE;
 
-    key.mv_size = sizeof(ShortChannelId);
-    key.mv_data = &ShortChannelId;
-    retval = mdb_get(db.p_txn, db.dbi, &key, &data);
-    if (retval) {
-        if (retval != MDB_NOTFOUND) {
-            LOGE("fail: %s\n", mdb_strerror(retval));
+    pthread_mutex_lock(&mMuxRouteSkip);
+    if (!mRouteSkipCache.loaded) {
+        if (!route_skip_cache_load(&mRouteSkipCache)) {
+            pthread_mutex_unlock(&mMuxRouteSkip);
+            return LN_DB_ROUTE_SKIP_NONE;
         }
-        MDB_TXN_ABORT(db.p_txn);
-        return LN_DB_ROUTE_SKIP_NONE;
     }
-
-    const uint8_t *p_data = (const uint8_t *)data.mv_data;
-    if (data.mv_size != sizeof(uint8_t)) {
-        LOGE("fail\n");
-        MDB_TXN_ABORT(db.p_txn);
-        return LN_DB_ROUTE_SKIP_NONE;
+    if (mRouteSkipCache.num > 0) {
+        const route_skip_item_t *p_item = (const route_skip_item_t *)bsearch(
+            &ShortChannelId, mRouteSkipCache.p_items, mRouteSkipCache.num,
+            sizeof(route_skip_item_t), route_skip_cmp_func);
+        if (p_item) {
+            result = p_item->route_skip;
+        }
     }
-    result = p_data[0];
-
-    MDB_TXN_ABORT(db.p_txn);
+    pthread_mutex_unlock(&mMuxRouteSkip);
     return result;
 }
 
@@ -2704,6 +2990,8 @@ bool ln_db_route_skip_drop(bool bTemp)
     }
 
     MDB_TXN_COMMIT(db.p_txn);
+    route_skip_cache_invalidate();
+    ln_routing_notify_route_skip_drop(bTemp);
     return true;
 
 LABEL_ERROR:
@@ -2723,7 +3011,7 @@ LABEL_ERROR:
 
 bool ln_db_preimage_save(const ln_db_preimage_t *pPreimage, const char *pBolt11, void *pDb)
 {
-    ln_lmdb_db_t    db;
+    preimage_db_t   db;
     MDB_val         key, data;
     MDB_txn         *p_txn = NULL;
     preimage_info_t *p_info;
@@ -2741,6 +3029,14 @@ bool ln_db_preimage_save(const ln_db_preimage_t *pPreimage, const char *pBolt11,
         invoice_len = strlen(pBolt11);
     }
 
+    //上書きする場合は古いindexを削除しておく
+    int retval = preimage_del(&db, pPreimage->preimage);
+    if ((retval != 0) && (retval != MDB_NOTFOUND)) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        preimage_close(&db, false);
+        return false;
+    }
+
     key.mv_size = LN_SZ_PREIMAGE;
     key.mv_data = (CONST_CAST uint8_t *)pPreimage->preimage;
     data.mv_size = sizeof(preimage_info_t) + invoice_len;
@@ -2754,7 +3050,10 @@ bool ln_db_preimage_save(const ln_db_preimage_t *pPreimage, const char *pBolt11,
         memcpy(p_info->bolt11, pBolt11, invoice_len + 1);   //copy include '\0'
     }
     data.mv_data = p_info;
-    int retval = mdb_put(db.p_txn, db.dbi, &key, &data, 0);
+    retval = mdb_put(db.db.p_txn, db.db.dbi, &key, &data, 0);
+    if (retval == 0) {
+        retval = preimage_index_put(&db, pPreimage->preimage, p_info);
+    }
     UTL_DBG_FREE(p_info);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -2770,7 +3069,7 @@ bool ln_db_preimage_save(const ln_db_preimage_t *pPreimage, const char *pBolt11,
 bool ln_db_preimage_del(const uint8_t *pPreimage)
 {
     int             retval;
-    ln_lmdb_db_t    db;
+    preimage_db_t   db;
 
     if (!preimage_open(&db, NULL)) {
         LOGE("fail: open\n");
@@ -2778,14 +3077,10 @@ bool ln_db_preimage_del(const uint8_t *pPreimage)
     }
 
     if (pPreimage) {
-        MDB_val key;
-
         //LOGD("remove: ");
         //DUMPD(pPreimage, LN_SZ_PREIMAGE);
         LOGD("remove\n");
-        key.mv_size = LN_SZ_PREIMAGE;
-        key.mv_data = (CONST_CAST uint8_t *)pPreimage;
-        retval = mdb_del(db.p_txn, db.dbi, &key, NULL);
+        retval = preimage_del(&db, pPreimage);
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
             preimage_close(&db, false);
@@ -2793,7 +3088,13 @@ bool ln_db_preimage_del(const uint8_t *pPreimage)
         }
     } else {
         LOGD("remove all\n");
-        retval = mdb_drop(db.p_txn, db.dbi, 1);
+        retval = mdb_drop(db.db.p_txn, db.db.dbi, 1);
+        if (retval == 0) {
+            retval = mdb_drop(db.db.p_txn, db.dbi_hash, 1);
+        }
+        if (retval == 0) {
+            retval = mdb_drop(db.db.p_txn, db.dbi_expire, 1);
+        }
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
             preimage_close(&db, false);
@@ -2813,9 +3114,150 @@ bool ln_db_preimage_search(ln_db_func_preimage_t pFunc, void *pFuncParam)
 }
 
 
+bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash)
+{
+    int             retval;
+    MDB_txn         *p_txn = NULL;
+    MDB_dbi         dbi;
+    MDB_dbi         dbi_hash;
+    MDB_val         key, data;
+    uint8_t         preimage[LN_SZ_PREIMAGE];
+
+    retval = MDB_TXN_BEGIN(mpEnvNode, NULL, MDB_RDONLY, &p_txn);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return false;
+    }
+    retval = MDB_DBI_OPEN(p_txn, M_DBI_PREIMAGE_HASH, 0, &dbi_hash);
+    if (retval == 0) {
+        retval = MDB_DBI_OPEN(p_txn, M_DBI_PREIMAGE, 0, &dbi);
+    }
+    if (retval == 0) {
+        key.mv_size = BTC_SZ_HASH256;
+        key.mv_data = (CONST_CAST uint8_t *)pPaymentHash;
+        retval = mdb_get(p_txn, dbi_hash, &key, &data);
+    }
+    if ((retval == 0) && (data.mv_size != LN_SZ_PREIMAGE)) {
+        LOGE("fail: invalid data length: %lu\n", data.mv_size);
+        retval = -1;
+    }
+    if (retval == 0) {
+        memcpy(preimage, data.mv_data, LN_SZ_PREIMAGE);
+        key.mv_size = LN_SZ_PREIMAGE;
+        key.mv_data = preimage;
+        retval = mdb_get(p_txn, dbi, &key, &data);
+    }
+    if ((retval == 0) && (data.mv_size < sizeof(preimage_info_t))) {
+        LOGE("fail: invalid data length: %lu\n", data.mv_size);
+        retval = -1;
+    }
+    if (retval == 0) {
+        preimage_info_get(pPreimage, preimage, (const preimage_info_t *)data.mv_data);
+    } else if (retval != MDB_NOTFOUND) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+    }
+    MDB_TXN_ABORT(p_txn);
+    return retval == 0;
+}
+
+
 bool ln_db_preimage_del_hash(const uint8_t *pPaymentHash)
 {
-    return preimage_search(preimage_cmp_func, true, (CONST_CAST uint8_t *)pPaymentHash);
+    int             retval;
+    preimage_db_t   db;
+    MDB_val         key, data;
+    uint8_t         preimage[LN_SZ_PREIMAGE];
+
+    if (!preimage_open(&db, NULL)) {
+        LOGE("fail: open\n");
+        return false;
+    }
+
+    key.mv_size = BTC_SZ_HASH256;
+    key.mv_data = (CONST_CAST uint8_t *)pPaymentHash;
+    retval = mdb_get(db.db.p_txn, db.dbi_hash, &key, &data);
+    if ((retval == 0) && (data.mv_size != LN_SZ_PREIMAGE)) {
+        LOGE("fail: invalid data length: %lu\n", data.mv_size);
+        retval = -1;
+    }
+    if (retval == 0) {
+        memcpy(preimage, data.mv_data, LN_SZ_PREIMAGE);
+        retval = preimage_del(&db, preimage);
+    }
+    if (retval) {
+        if (retval != MDB_NOTFOUND) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+        } else {
+            LOGD("  not found\n");
+        }
+        preimage_close(&db, false);
+        return false;
+    }
+
+    LOGD("  remove from DB\n");
+    preimage_close(&db, true);
+    return true;
+}
+
+
+bool ln_db_preimage_del_expired(uint64_t Time, uint32_t *pNum)
+{
+    int             retval;
+    preimage_db_t   db;
+    MDB_cursor      *p_cursor = NULL;
+    MDB_val         key, data;
+    uint8_t         key_data[M_SZ_PREIMAGE_EXPIRE_KEY];
+    uint32_t        num = 0;
+
+    if (pNum) {
+        *pNum = 0;
+    }
+    if (!preimage_open(&db, NULL)) {
+        LOGE("fail: open\n");
+        return false;
+    }
+
+    //[preimage_expire]は期限順に並んでいるので、先頭から期限内のものが出るまで削除する
+    for (;;) {
+        retval = mdb_cursor_open(db.db.p_txn, db.dbi_expire, &p_cursor);
+        if (retval) break;
+        retval = mdb_cursor_get(p_cursor, &key, &data, MDB_FIRST);
+        if (retval == 0) {
+            if (key.mv_size != M_SZ_PREIMAGE_EXPIRE_KEY) {
+                LOGE("fail: invalid key length: %lu\n", key.mv_size);
+                retval = -1;
+            } else if (utl_int_pack_u64be((const uint8_t *)key.mv_data) >= Time) {
+                retval = MDB_NOTFOUND;
+            } else {
+                memcpy(key_data, key.mv_data, M_SZ_PREIMAGE_EXPIRE_KEY);
+            }
+        }
+        MDB_CURSOR_CLOSE(p_cursor);
+        if (retval) break;
+
+        retval = preimage_del(&db, key_data + sizeof(uint64_t));
+        if (retval == MDB_NOTFOUND) {
+            //indexだけ残っている
+            key.mv_size = M_SZ_PREIMAGE_EXPIRE_KEY;
+            key.mv_data = key_data;
+            retval = mdb_del(db.db.p_txn, db.dbi_expire, &key, NULL);
+        } else if (retval == 0) {
+            num++;
+        }
+        if (retval) break;
+    }
+    if (retval != MDB_NOTFOUND) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        preimage_close(&db, false);
+        return false;
+    }
+
+    LOGD("remove expired: %" PRIu32 "\n", num);
+    preimage_close(&db, true);
+    if (pNum) {
+        *pNum = num;
+    }
+    return true;
 }
 
 
@@ -2874,7 +3316,6 @@ bool ln_db_preimage_cur_get(void *pCur, bool *pDetect, ln_db_preimage_t *pPreima
     lmdb_cursor_t   *p_cur = (lmdb_cursor_t *)pCur;
     int             retval;
     MDB_val         key, data;
-    uint64_t        now = (uint64_t)utl_time_time();
 
     *pDetect = false;
 
@@ -2888,27 +3329,17 @@ bool ln_db_preimage_cur_get(void *pCur, bool *pDetect, ln_db_preimage_t *pPreima
     LOGD("amount: %" PRIu64"\n", p_info->amount);
     LOGD("time: %lu\n", p_info->creation);
 
-    memcpy(pPreimage->preimage, key.mv_data, key.mv_size);
-    pPreimage->expiry = p_info->expiry;
-    pPreimage->creation_time = p_info->creation;
-    pPreimage->amount_msat = p_info->amount;
+    preimage_info_get(pPreimage, (const uint8_t *)key.mv_data, p_info);
     if (ppBolt11 != NULL) {
         *ppBolt11 = p_info->bolt11;
     }
-    pPreimage->state = (ln_db_preimage_state_t)p_info->state;
-    if (now > p_info->creation + p_info->expiry) {
-        //expired
-        if (pPreimage->state == LN_DB_PREIMAGE_STATE_UNUSED) {
-            pPreimage->state = LN_DB_PREIMAGE_STATE_EXPIRE;
-        }
-    }
     return true;
 }
 
 
 bool ln_db_preimage_used(const uint8_t *pPreimage)
 {
-    ln_lmdb_db_t    db;
+    preimage_db_t   db;
     int             retval;
     MDB_val         key, data;
 
@@ -2921,7 +3352,7 @@ bool ln_db_preimage_used(const uint8_t *pPreimage)
     }
     key.mv_data = (CONST_CAST uint8_t *)pPreimage;
     key.mv_size = LN_SZ_PREIMAGE;
-    retval = mdb_get(db.p_txn, db.dbi, &key, &data);
+    retval = mdb_get(db.db.p_txn, db.db.dbi, &key, &data);
     if (retval != 0) {
         if (retval != MDB_NOTFOUND) {
             LOGE("fail: %s\n", mdb_strerror(retval));
@@ -2938,11 +3369,23 @@ bool ln_db_preimage_used(const uint8_t *pPreimage)
 
     preimage_info_t *p_infonew = (preimage_info_t *)UTL_DBG_MALLOC(data.mv_size);
     memcpy(p_infonew, data.mv_data, data.mv_size);
-    p_infonew->state = LN_DB_PREIMAGE_STATE_USED;
-    data.mv_data = p_infonew;
-    retval = mdb_put(db.p_txn, db.dbi, &key, &data, 0);
+    //使用済みは期限切れ削除の対象外
+    retval = preimage_index_del(&db, pPreimage, p_infonew);
+    if (retval == 0) {
+        p_infonew->state = LN_DB_PREIMAGE_STATE_USED;
+        data.mv_data = p_infonew;
+        retval = mdb_put(db.db.p_txn, db.db.dbi, &key, &data, 0);
+    }
+    if (retval == 0) {
+        retval = preimage_index_put(&db, pPreimage, p_infonew);
+    }
     UTL_DBG_FREE(p_infonew);
     UTL_DBG_FREE(key.mv_data);
+    if (retval) {
+        LOGE("fail: %s\n", mdb_strerror(retval));
+        preimage_close(&db, false);
+        return false;
+    }
 
     preimage_close(&db, true);
     return true;
@@ -2993,15 +3436,13 @@ bool ln_db_payment_hash_search(
     int         retval;
     MDB_txn     *p_txn;
     MDB_dbi     dbi;
-    MDB_cursor  *p_cursor;
     MDB_val     key, data;
-    bool        found = false;
 
     if (pDbParam && (mdb_txn_env(((ln_lmdb_db_t *)pDbParam)->p_txn) == mpEnvNode)) {
         p_txn = ((ln_lmdb_db_t *)pDbParam)->p_txn;
     } else {
         pDbParam = NULL;
-        retval = MDB_TXN_BEGIN(mpEnvNode, NULL, 0, &p_txn);
+        retval = MDB_TXN_BEGIN(mpEnvNode, NULL, MDB_RDONLY, &p_txn);
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
             return false;
@@ -3015,28 +3456,26 @@ bool ln_db_payment_hash_search(
         return false;
     }
 
-    retval = mdb_cursor_open(p_txn, dbi, &p_cursor);
-    if (retval) {
+    //keyはvoutそのもの
+    key.mv_size = BTC_SZ_WITPROG_P2WSH;
+    key.mv_data = (CONST_CAST uint8_t *)pVout;
+    retval = mdb_get(p_txn, dbi, &key, &data);
+    if (retval == 0) {
+        if (data.mv_size == 1 + sizeof(uint32_t) + BTC_SZ_HASH256) {
+            const uint8_t *p = (const uint8_t *)data.mv_data;
+            *pType = (ln_commit_tx_output_type_t)*p;
+            memcpy(pExpiry, p + 1, sizeof(uint32_t));
+            memcpy(pPaymentHash, p + 1 + sizeof(uint32_t), BTC_SZ_HASH256);
+        } else {
+            LOGE("fail: invalid data length: %lu\n", data.mv_size);
+            retval = -1;
+        }
+    } else if (retval != MDB_NOTFOUND) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
-        if (!pDbParam) MDB_TXN_ABORT(p_txn);
-        return false;
-    }
-
-    while (mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT) == 0) {
-        if (key.mv_size != BTC_SZ_WITPROG_P2WSH) continue;
-        if (memcmp(key.mv_data, pVout, BTC_SZ_WITPROG_P2WSH)) continue;
-
-        uint8_t *p = (uint8_t *)data.mv_data;
-        *pType = (ln_commit_tx_output_type_t)*p;
-        memcpy(pExpiry, p + 1, sizeof(uint32_t));
-        memcpy(pPaymentHash, p + 1 + sizeof(uint32_t), BTC_SZ_HASH256);
-        found = true;
-        break;
     }
 
-    MDB_CURSOR_CLOSE(p_cursor);
     if (!pDbParam) MDB_TXN_ABORT(p_txn);
-    return found;
+    return retval == 0;
 }
 
 
@@ -3514,7 +3953,7 @@ bool ln_lmdb_wallet_search(lmdb_cursor_t *pCur, ln_db_func_wallet_t pWalletFunc,
                 }
             }
         }
-        if (data.mv_size >= (size_t)((void *)p_data - data.mv_data + sizeof(uint32_t))) {
+        if (data.mv_size >= (size_t)(p_data - (uint8_t *)data.mv_data + sizeof(uint32_t))) {
             memcpy(&wallet.mined_height, p_data, sizeof(uint32_t));
         } else {
             wallet.mined_height = 0;
@@ -3598,12 +4037,14 @@ bool ln_db_version_check(uint8_t *pMyNodeId, btc_block_chain_t *pBlockChain)
 
     btc_keys_t key;
     bool is_test;
+    btc_block_chain_t type;
+    const btc_block_param_t *p_chain;
     if (!btc_keys_wif2keys(&key, &is_test, wif)) {
         goto LABEL_EXIT;
     }
 
-    btc_block_chain_t type = btc_block_get_chain(genesis);
-    const btc_block_param_t *p_chain = btc_block_get_param_from_chain(type);
+    type = btc_block_get_chain(genesis);
+    p_chain = btc_block_get_param_from_chain(type);
     if ((p_chain != NULL) && (p_chain->is_test == is_test)) {
         //ok
     } else {
@@ -3674,6 +4115,7 @@ ln_lmdb_db_type_t ln_lmdb_get_db_type(const MDB_env *pEnv, const char *pDbName)
         if (strcmp(pDbName, M_DBI_PAYMENT) == 0) return LN_LMDB_DB_TYPE_PAYMENT;
         if (strcmp(pDbName, M_DBI_SHARED_SECRETS) == 0) return LN_LMDB_DB_TYPE_SHARED_SECRETS;
         if (strcmp(pDbName, M_DBI_ROUTE) == 0) return LN_LMDB_DB_TYPE_ROUTE;
+        if (strcmp(pDbName, M_DBI_ROUTE_CAND) == 0) return LN_LMDB_DB_TYPE_ROUTE_CAND;
         if (strcmp(pDbName, M_DBI_PAYMENT_INVOICE) == 0) return LN_LMDB_DB_TYPE_PAYMENT_INVOICE;
         if (strcmp(pDbName, M_DBI_PAYMENT_INFO) == 0) return LN_LMDB_DB_TYPE_PAYMENT_INFO;
     }
@@ -3793,6 +4235,7 @@ void ln_db_copy_channel(ln_channel_t *pOutChannel, const ln_channel_t *pInChanne
     memcpy(
         pOutChannel->update_info.htlcs,  pInChannel->update_info.htlcs,
         M_SIZE(ln_update_info_t, htlcs));
+    ln_update_info_rebuild_index(&pOutChannel->update_info);
 
     //復元データ
     utl_buf_alloccopy(&pOutChannel->funding_info.wit_script, pInChannel->funding_info.wit_script.buf, pInChannel->funding_info.wit_script.len);
@@ -3835,7 +4278,9 @@ bool ln_db_forward_add_htlc_save(const ln_db_forward_t *pForward)
     //LOGD("NextShortChannelId: %016" PRIx64 "\n", pForward->next_short_channel_id);
     //LOGD("PrevShortChannelId: %016" PRIx64 "\n", pForward->prev_short_channel_id);
     //LOGD("PrevHtlcId: %016" PRIx64 "\n", pForward->prev_htlc_id);
-    return forward_save_2(pForward, M_PREF_FORWARD_ADD_HTLC);
+    if (!forward_save_2(pForward, M_PREF_FORWARD_ADD_HTLC)) return false;
+    ln_forward_notify(pForward->next_short_channel_id, LN_FORWARD_ADD_HTLC);
+    return true;
 }
 
 
@@ -3867,7 +4312,9 @@ bool ln_db_forward_del_htlc_save(const ln_db_forward_t* pForward)
     //LOGD("NextShortChannelId: %016" PRIx64 "\n", pForward->next_short_channel_id);
     //LOGD("PrevShortChannelId: %016" PRIx64 "\n", pForward->prev_short_channel_id);
     //LOGD("PrevHtlcId: %016" PRIx64 "\n", pForward->prev_htlc_id);
-    return forward_save_2(pForward, M_PREF_FORWARD_DEL_HTLC);
+    if (!forward_save_2(pForward, M_PREF_FORWARD_DEL_HTLC)) return false;
+    ln_forward_notify(pForward->next_short_channel_id, LN_FORWARD_DEL_HTLC);
+    return true;
 }
 
 
@@ -3881,7 +4328,10 @@ bool ln_db_forward_del_htlc_save_2(const ln_db_forward_t* pForward, void *pDbPar
     assert(p_db);
     MDB_txn         *p_txn = p_db->p_txn;
     assert(p_txn);
-    return forward_save_3(pForward, M_PREF_FORWARD_DEL_HTLC, p_txn);
+    if (!forward_save_3(pForward, M_PREF_FORWARD_DEL_HTLC, p_txn)) return false;
+    //書込みtxnは直列化されるため、commit前に通知しても転送先はcommit後に読み込む
+    ln_forward_notify(pForward->next_short_channel_id, LN_FORWARD_DEL_HTLC);
+    return true;
 }
 
 
@@ -4045,6 +4495,24 @@ bool ln_db_payment_route_del(uint64_t PaymentId)
 }
 
 
+bool ln_db_payment_route_cand_save(uint64_t PaymentId, const uint8_t *pData, uint32_t Len)
+{
+    return payment_save(M_DBI_ROUTE_CAND, PaymentId, pData, Len);
+}
+
+
+bool ln_db_payment_route_cand_load(utl_buf_t *pBuf, uint64_t PaymentId)
+{
+    return payment_load_2(M_DBI_ROUTE_CAND, pBuf, PaymentId);
+}
+
+
+bool ln_db_payment_route_cand_del(uint64_t PaymentId)
+{
+    return payment_del(M_DBI_ROUTE_CAND, PaymentId);
+}
+
+
 bool ln_db_payment_invoice_save(uint64_t PaymentId, const uint8_t *pData, uint32_t Len)
 {
     return payment_save(M_DBI_PAYMENT_INVOICE, PaymentId, pData, Len);
@@ -4107,6 +4575,7 @@ bool ln_db_payment_del_all(uint64_t PaymentId)
 {
     /*ignore*/ln_db_payment_shared_secrets_del(PaymentId);
     /*ignore*/ln_db_payment_route_del(PaymentId);
+    /*ignore*/ln_db_payment_route_cand_del(PaymentId);
     /*ignore*/ln_db_payment_invoice_del(PaymentId);
     return ln_db_payment_info_del(PaymentId);
 }
@@ -4219,179 +4688,104 @@ static int channel_db_open(ln_lmdb_db_t *pDb, const char *pDbName, int OptTxn, i
 
 
 /** channel: htlc読み込み
+ *
+ * "HT" + channel_id のDBから、HTLC indexをkeyとしたデータを読み込む。
+ * DBが無い場合は旧形式(HTLC indexごとのDB)から読み込む(closed env用)。
  *
  * @param[out]      pChannel
  * @param[in]       pDb
- * @retval      true    成功
+ * @retval      0   成功
  */
 static int channel_htlc_load(ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
 {
-    //XXX: Error is not checked
-
-    int         retval = -1;
+    int         retval;
     MDB_dbi     dbi;
     MDB_val     key, data;
     char        db_name[M_SZ_CHANNEL_DB_NAME_STR + M_SZ_HTLC_IDX_STR + 1];
+    uint8_t     key_data[M_SZ_HTLC_IDX_KEY];
 
-    uint8_t *OFFSET =
-        ((uint8_t *)pChannel) + offsetof(ln_channel_t, update_info) + offsetof(ln_update_info_t, htlcs);
-
-    utl_str_bin2str(db_name + M_SZ_PREF_STR, pChannel->channel_id, LN_SZ_CHANNEL_ID);
     memcpy(db_name, M_PREF_HTLC, M_SZ_PREF_STR);
+    utl_str_bin2str(db_name + M_SZ_PREF_STR, pChannel->channel_id, LN_SZ_CHANNEL_ID);
 
-    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
-        channel_htlc_db_name(db_name, lp);
-        //LOGD("[%d]db_name: %s\n", lp, db_name);
-        retval = MDB_DBI_OPEN(pDb->p_txn, db_name, 0, &dbi);
-        if (retval) {
-            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
-            continue; //XXX: ???
-        }
-
-        //fixed
-        for (size_t lp2 = 0; lp2 < ARRAY_SIZE(DBHTLC_VALUES); lp2++) {
-            key.mv_size = strlen(DBHTLC_VALUES[lp2].p_name);
-            key.mv_data = (CONST_CAST char*)DBHTLC_VALUES[lp2].p_name;
-            retval = mdb_get(pDb->p_txn, dbi, &key, &data);
-            if (retval == 0) {
-                //LOGD("[%d]%s: ", lp, DBHTLC_VALUES[lp2].p_name);
-                //DUMPD(data.mv_data, data.mv_size);
-                memcpy(OFFSET + sizeof(ln_htlc_t) * lp + DBHTLC_VALUES[lp2].offset, data.mv_data, DBHTLC_VALUES[lp2].data_len);
-            } else {
-                LOGE("ERR: %s(%s)\n", mdb_strerror(retval), DBHTLC_VALUES[lp2].p_name);
+    retval = MDB_DBI_OPEN(pDb->p_txn, db_name, 0, &dbi);
+    if (retval == MDB_NOTFOUND) {
+        //旧形式
+        for (uint16_t lp = 0; lp < LN_HTLC_MAX; lp++) {
+            channel_htlc_db_name(db_name, lp);
+            retval = MDB_DBI_OPEN(pDb->p_txn, db_name, 0, &dbi);
+            if (retval) {
+                LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
+                retval = 0;
+                continue;
             }
-        }
-
-        //variable
-        key.mv_size = M_SZ_PREIMAGE;
-        key.mv_data = M_KEY_PREIMAGE;
-        retval = mdb_get(pDb->p_txn, dbi, &key, &data);
-        if (retval == 0) {
-            if (!utl_buf_alloccopy(
-                &pChannel->update_info.htlcs[lp].buf_preimage, data.mv_data, data.mv_size)) {
-                LOGE("fail: ???\n");
-                retval = -1;
-                MDB_DBI_CLOSE(mpEnvChannel, dbi);
+            retval = channel_htlc_legacy_load(&pChannel->update_info.htlcs[lp], pDb->p_txn, dbi);
+            MDB_DBI_CLOSE(mpEnvChannel, dbi);
+            if (retval) {
                 break;
             }
-        } else {
-            //LOGE("ERR: %s(preimage)\n", mdb_strerror(retval));
-            retval = 0;     //FALLTHROUGH
         }
+        return retval;
+    } else if (retval) {
+        LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
+        return retval;
+    }
 
-        key.mv_size = M_SZ_ONION_ROUTE;
-        key.mv_data = M_KEY_ONION_ROUTE;
+    for (uint16_t lp = 0; lp < LN_HTLC_MAX; lp++) {
+        utl_int_unpack_u16be(key_data, lp);
+        key.mv_size = sizeof(key_data);
+        key.mv_data = key_data;
         retval = mdb_get(pDb->p_txn, dbi, &key, &data);
-        if (retval == 0) {
-            if (!utl_buf_alloccopy(
-                &pChannel->update_info.htlcs[lp].buf_onion_reason, data.mv_data, data.mv_size)) {
-                LOGE("fail: ???\n");
-                retval = -1;
-                MDB_DBI_CLOSE(mpEnvChannel, dbi);
-                break;
-            }
-        } else {
-            //LOGE("ERR: %s(onion_route)\n", mdb_strerror(retval));
-            retval = 0;     //FALLTHROUGH
+        if (retval == MDB_NOTFOUND) {
+            //empty slot
+            retval = 0;
+            continue;
+        } else if (retval) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+            break;
         }
-
-        key.mv_size = M_SZ_SHARED_SECRET;
-        key.mv_data = M_KEY_SHARED_SECRET;
-        retval = mdb_get(pDb->p_txn, dbi, &key, &data);
-        if (retval == 0) {
-            if (!utl_buf_alloccopy(
-                &pChannel->update_info.htlcs[lp].buf_shared_secret, data.mv_data, data.mv_size)) {
-                LOGE("fail: ???\n");
-                retval = -1;
-                MDB_DBI_CLOSE(mpEnvChannel, dbi);
-                break;
-            }
-        } else {
-            //LOGE("ERR: %s(shared_secret)\n", mdb_strerror(retval));
-            retval = 0;     //FALLTHROUGH
-        }
-
-        MDB_DBI_CLOSE(mpEnvChannel, dbi);
-    }
+        if (!htlc_record_read(&pChannel->update_info.htlcs[lp], data.mv_data, data.mv_size)) {
+            LOGE("fail: htlc[%u]\n", lp);
+            retval = -1;
+            break;
+        }
+    }
+    MDB_DBI_CLOSE(mpEnvChannel, dbi);
 
     return retval;
 }
 
 
 /** channel: htlc書込み
+ *
+ * 内容が変わったHTLCだけ書き込む(空のHTLCは削除する)。
  *
  * @param[in]       pChannel
  * @param[in]       pDb
- * @retval      true    成功
+ * @retval      0   成功
  */
 static int channel_htlc_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
 {
     int         retval;
     MDB_dbi     dbi;
-    MDB_val     key, data;
-    char        db_name[M_SZ_CHANNEL_DB_NAME_STR + M_SZ_HTLC_IDX_STR + 1];
-
-    uint8_t *OFFSET =
-        ((uint8_t *)pChannel) + offsetof(ln_channel_t, update_info) + offsetof(ln_update_info_t, htlcs);
+    char        db_name[M_SZ_CHANNEL_DB_NAME_STR + 1];
 
     memcpy(db_name, M_PREF_HTLC, M_SZ_PREF_STR);
     utl_str_bin2str(db_name + M_SZ_PREF_STR, pChannel->channel_id, LN_SZ_CHANNEL_ID);
 
-    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
-        channel_htlc_db_name(db_name, lp);
-        //LOGD("[%d]db_name: %s\n", lp, db_name);
-        retval = MDB_DBI_OPEN(pDb->p_txn, db_name, MDB_CREATE, &dbi);
-        if (retval) {
-            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
-            goto LABEL_EXIT;
-        }
-
-        //fixed
-        ln_lmdb_db_t db;
-        db.p_txn = pDb->p_txn;
-        db.dbi = dbi;
-        retval = fixed_items_save(OFFSET + sizeof(ln_htlc_t) * lp,
-                        &db, DBHTLC_VALUES, ARRAY_SIZE(DBHTLC_VALUES));
-        if (retval) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-            goto LABEL_EXIT;
-        }
-
-        //variable
-        if (pChannel->update_info.htlcs[lp].buf_preimage.len) {
-            key.mv_size = M_SZ_PREIMAGE;
-            key.mv_data = M_KEY_PREIMAGE;
-            data.mv_size = pChannel->update_info.htlcs[lp].buf_preimage.len;
-            data.mv_data = pChannel->update_info.htlcs[lp].buf_preimage.buf;
-            retval = mdb_put(pDb->p_txn, dbi, &key, &data, 0);
-            if (retval) {
-                LOGE("ERR: %s(preimage)\n", mdb_strerror(retval));
-                goto LABEL_EXIT;
-            }
-        }
-
-        key.mv_size = M_SZ_ONION_ROUTE;
-        key.mv_data = M_KEY_ONION_ROUTE;
-        data.mv_size = pChannel->update_info.htlcs[lp].buf_onion_reason.len;
-        data.mv_data = pChannel->update_info.htlcs[lp].buf_onion_reason.buf;
-        retval = mdb_put(pDb->p_txn, dbi, &key, &data, 0);
-        if (retval) {
-            LOGE("ERR: %s(onion_route)\n", mdb_strerror(retval));
-            goto LABEL_EXIT;
-        }
+    retval = MDB_DBI_OPEN(pDb->p_txn, db_name, MDB_CREATE, &dbi);
+    if (retval) {
+        LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
+        return retval;
+    }
 
-        key.mv_size = M_SZ_SHARED_SECRET;
-        key.mv_data = M_KEY_SHARED_SECRET;
-        data.mv_size = pChannel->update_info.htlcs[lp].buf_shared_secret.len;
-        data.mv_data = pChannel->update_info.htlcs[lp].buf_shared_secret.buf;
-        retval = mdb_put(pDb->p_txn, dbi, &key, &data, 0);
+    for (uint16_t lp = 0; lp < LN_HTLC_MAX; lp++) {
+        retval = htlc_record_save(pDb->p_txn, dbi, lp, &pChannel->update_info.htlcs[lp]);
         if (retval) {
-            LOGE("ERR: %s(shared_secret)\n", mdb_strerror(retval));
-            goto LABEL_EXIT;
+            LOGE("ERR: %s(htlc[%u])\n", mdb_strerror(retval), lp);
+            break;
         }
     }
 
-LABEL_EXIT:
     return retval;
 }
 
@@ -4400,30 +4794,64 @@ LABEL_EXIT:
  *
  * @param[in]       pChannel
  * @param[in,out]   pDb
- * @retval      true    成功
+ * @retval      0   成功
  */
 static int channel_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
 {
+    int     retval;
     MDB_val key, data;
+    utl_buf_t buf_fund_tx = UTL_BUF_INIT;
+    utl_buf_t buf = UTL_BUF_INIT;
+
+    btc_tx_write(&pChannel->funding_info.tx_data, &buf_fund_tx);
+    if (!channel_record_write(&buf, pChannel, &buf_fund_tx)) {
+        LOGE("fail: ???\n");
+        retval = -1;
+        goto LABEL_EXIT;
+    }
+
+    key.mv_size = M_SZ_CHANNEL;
+    key.mv_data = M_KEY_CHANNEL;
+    data.mv_size = buf.len;
+    data.mv_data = buf.buf;
+    retval = put_if_changed(pDb->p_txn, pDb->dbi, &key, &data);
+    if (retval) {
+        LOGE("fail: %s\n", mdb_strerror(retval));
+    }
+
+LABEL_EXIT:
+    utl_buf_free(&buf);
+    utl_buf_free(&buf_fund_tx);
+    return retval;
+}
+
+
+/** channel情報読込み(旧形式)
+ *
+ * DB version -72までの、itemごとにkeyを持つ形式を読み込む。
+ *
+ * @param[out]      pChannel
+ * @param[in]       pDb
+ * @param[out]      pFundTx         funding transaction(raw)
+ * @retval      0   成功
+ */
+static int channel_legacy_load(ln_channel_t *pChannel, ln_lmdb_db_t *pDb, utl_buf_t *pFundTx)
+{
     int     retval;
+    MDB_val key, data;
 
     //fixed size data
-    retval = fixed_items_save(pChannel, pDb, DBCHANNEL_VALUES, ARRAY_SIZE(DBCHANNEL_VALUES));
+    retval = fixed_items_load(pChannel, pDb, DBCHANNEL_VALUES, ARRAY_SIZE(DBCHANNEL_VALUES));
     if (retval) {
         return retval;
     }
 
     //variable size data
-    utl_buf_t buf_fund_tx = UTL_BUF_INIT;
-    btc_tx_write(&pChannel->funding_info.tx_data, &buf_fund_tx);
     variable_item_t *p_variable_items = (variable_item_t *)UTL_DBG_MALLOC(sizeof(variable_item_t) * M_NUM_CHANNEL_BUFS);
-    if (!p_variable_items) {
-        LOGE("fail: ???");
-        goto LABEL_EXIT;
-    }
+    if (!p_variable_items) return -1;
     int index = 0;
     p_variable_items[index].p_name = "buf_fund_tx";
-    p_variable_items[index].p_buf = &buf_fund_tx;
+    p_variable_items[index].p_buf = pFundTx;
     index++;
     M_BUF_ITEM(index, shutdown_scriptpk_local);
     index++;
@@ -4433,19 +4861,151 @@ static int channel_save(const ln_channel_t *pChannel, ln_lmdb_db_t *pDb)
     for (size_t lp = 0; lp < M_NUM_CHANNEL_BUFS; lp++) {
         key.mv_size = strlen(p_variable_items[lp].p_name);
         key.mv_data = (CONST_CAST char*)p_variable_items[lp].p_name;
-        data.mv_size = p_variable_items[lp].p_buf->len;
-        data.mv_data = p_variable_items[lp].p_buf->buf;
-        retval = mdb_put(pDb->p_txn, pDb->dbi, &key, &data, 0);
-        if (retval) {
+        retval = mdb_get(pDb->p_txn, pDb->dbi, &key, &data);
+        if (retval == 0) {
+            utl_buf_free(p_variable_items[lp].p_buf);
+            utl_buf_alloccopy(p_variable_items[lp].p_buf, data.mv_data, data.mv_size);
+        } else {
             LOGE("fail: %s\n", p_variable_items[lp].p_name);
-            goto LABEL_EXIT;
         }
     }
-
-LABEL_EXIT:
-    utl_buf_free(&buf_fund_tx);
     UTL_DBG_FREE(p_variable_items);
-    return retval;
+
+    return 0;
+}
+
+
+/** channel DBデータ作成
+ *
+ * @note
+ *      - [1:version]
+ *      - [2:num] DBCHANNEL_VALUES数
+ *      - num * ([2:len][len:data]) DBCHANNEL_VALUESの順
+ *      - [4:len][len:funding_tx]
+ *      - [2:len][len:shutdown_scriptpk_local]
+ *      - [2:len][len:shutdown_scriptpk_remote]
+ *
+ * @param[out]      pBuf
+ * @param[in]       pChannel
+ * @param[in]       pFundTx         funding transaction(raw)
+ */
+static bool channel_record_write(utl_buf_t *pBuf, const ln_channel_t *pChannel, const utl_buf_t *pFundTx)
+{
+    utl_push_t  push;
+    uint32_t    sz = 1 + 2 + 4 + pFundTx->len +
+                    2 + pChannel->shutdown_scriptpk_local.len +
+                    2 + pChannel->shutdown_scriptpk_remote.len;
+
+    for (size_t lp = 0; lp < ARRAY_SIZE(DBCHANNEL_VALUES); lp++) {
+        sz += 2 + DBCHANNEL_VALUES[lp].data_len;
+    }
+
+    if (!utl_push_init(&push, pBuf, sz)) return false;
+    if (!utl_push_byte(&push, M_CHANNEL_RECORD_VER)) goto LABEL_ERROR;
+    if (!utl_push_u16be(&push, (uint16_t)ARRAY_SIZE(DBCHANNEL_VALUES))) goto LABEL_ERROR;
+    for (size_t lp = 0; lp < ARRAY_SIZE(DBCHANNEL_VALUES); lp++) {
+        if (!utl_push_u16be(&push, (uint16_t)DBCHANNEL_VALUES[lp].data_len)) goto LABEL_ERROR;
+        if (!utl_push_data(&push,
+            (const uint8_t *)pChannel + DBCHANNEL_VALUES[lp].offset, DBCHANNEL_VALUES[lp].data_len)) goto LABEL_ERROR;
+    }
+    if (!utl_push_u32be(&push, pFundTx->len)) goto LABEL_ERROR;
+    if (!utl_push_data(&push, pFundTx->buf, pFundTx->len)) goto LABEL_ERROR;
+    if (!utl_push_u16be(&push, (uint16_t)pChannel->shutdown_scriptpk_local.len)) goto LABEL_ERROR;
+    if (!utl_push_data(&push, pChannel->shutdown_scriptpk_local.buf, pChannel->shutdown_scriptpk_local.len)) goto LABEL_ERROR;
+    if (!utl_push_u16be(&push, (uint16_t)pChannel->shutdown_scriptpk_remote.len)) goto LABEL_ERROR;
+    if (!utl_push_data(&push, pChannel->shutdown_scriptpk_remote.buf, pChannel->shutdown_scriptpk_remote.len)) goto LABEL_ERROR;
+    return true;
+
+LABEL_ERROR:
+    utl_buf_free(pBuf);
+    return false;
+}
+
+
+/** channel DBデータ読込み
+ *
+ * @param[out]      pChannel
+ * @param[in]       pData
+ * @param[in]       Len
+ */
+static bool channel_record_read(ln_channel_t *pChannel, const uint8_t *pData, uint32_t Len)
+{
+    btc_buf_r_t buf_r;
+    uint8_t     ver;
+    uint16_t    num;
+    uint16_t    len;
+    uint32_t    len32;
+    const uint8_t *p;
+
+    btc_buf_r_init(&buf_r, pData, Len);
+    if (!btc_buf_r_read_byte(&buf_r, &ver)) return false;
+    if (ver != M_CHANNEL_RECORD_VER) {
+        LOGE("fail: unknown version(%u)\n", ver);
+        return false;
+    }
+    if (!btc_buf_r_read_u16be(&buf_r, &num)) return false;
+    if (num > ARRAY_SIZE(DBCHANNEL_VALUES)) {
+        LOGE("fail: too many items(%u)\n", num);
+        return false;
+    }
+    for (size_t lp = 0; lp < num; lp++) {
+        if (!btc_buf_r_read_u16be(&buf_r, &len)) return false;
+        if (len != DBCHANNEL_VALUES[lp].data_len) {
+            LOGE("fail: item size mismatch(%s)\n", DBCHANNEL_VALUES[lp].p_name);
+            return false;
+        }
+        if (!btc_buf_r_read(&buf_r, (uint8_t *)pChannel + DBCHANNEL_VALUES[lp].offset, len)) return false;
+    }
+    for (size_t lp = num; lp < ARRAY_SIZE(DBCHANNEL_VALUES); lp++) {
+        LOGE("item \"%s\" not found.\n", DBCHANNEL_VALUES[lp].p_name);
+    }
+
+    if (!btc_buf_r_read_u32be(&buf_r, &len32)) return false;
+    if (!btc_buf_r_get_pos_and_seek(&buf_r, &p, len32)) return false;
+    btc_tx_read(&pChannel->funding_info.tx_data, p, len32);
+
+    utl_buf_t *p_bufs[] = {
+        &pChannel->shutdown_scriptpk_local, &pChannel->shutdown_scriptpk_remote
+    };
+    for (size_t lp = 0; lp < ARRAY_SIZE(p_bufs); lp++) {
+        if (!btc_buf_r_read_u16be(&buf_r, &len)) return false;
+        if (!btc_buf_r_get_pos_and_seek(&buf_r, &p, len)) return false;
+        utl_buf_free(p_bufs[lp]);
+        if (len && !utl_buf_alloccopy(p_bufs[lp], p, len)) return false;
+    }
+    return true;
+}
+
+
+/** channel DBデータ中のitem位置
+ *
+ * @param[in]       pData           #channel_record_write()のデータ
+ * @param[in]       Len
+ * @param[in]       pItem           DBCHANNEL_VALUESのitem
+ * @return      item dataの先頭(NULL:なし)
+ */
+static uint8_t *channel_record_item(uint8_t *pData, uint32_t Len, const fixed_item_t *pItem)
+{
+    btc_buf_r_t buf_r;
+    uint8_t     ver;
+    uint16_t    num;
+    uint16_t    len;
+    const uint8_t *p;
+
+    btc_buf_r_init(&buf_r, pData, Len);
+    if (!btc_buf_r_read_byte(&buf_r, &ver)) return NULL;
+    if (ver != M_CHANNEL_RECORD_VER) return NULL;
+    if (!btc_buf_r_read_u16be(&buf_r, &num)) return NULL;
+    for (size_t lp = 0; (lp < num) && (lp < ARRAY_SIZE(DBCHANNEL_VALUES)); lp++) {
+        if (!btc_buf_r_read_u16be(&buf_r, &len)) return NULL;
+        if (!btc_buf_r_get_pos_and_seek(&buf_r, &p, len)) return NULL;
+        if ( (DBCHANNEL_VALUES[lp].offset == pItem->offset) &&
+             (DBCHANNEL_VALUES[lp].data_len == pItem->data_len) ) {
+            if (len != pItem->data_len) return NULL;
+            return pData + (p - pData);
+        }
+    }
+    return NULL;
 }
 
 
@@ -4454,6 +5014,23 @@ static int channel_item_load(ln_channel_t *pChannel, const fixed_item_t *pItems,
     int     retval;
     MDB_val key, data;
 
+    key.mv_size = M_SZ_CHANNEL;
+    key.mv_data = M_KEY_CHANNEL;
+    retval = mdb_get(pDb->p_txn, pDb->dbi, &key, &data);
+    if (retval == 0) {
+        const uint8_t *p = channel_record_item(data.mv_data, data.mv_size, pItems);
+        if (!p) {
+            LOGE("fail: not found(%s)\n", pItems->p_name);
+            return -1;
+        }
+        memcpy((uint8_t *)pChannel + pItems->offset, p, pItems->data_len);
+        return 0;
+    } else if (retval != MDB_NOTFOUND) {
+        LOGE("fail: %s(%s)\n", mdb_strerror(retval), pItems->p_name);
+        return retval;
+    }
+
+    //旧形式
     key.mv_size = strlen(pItems->p_name);
     key.mv_data = (CONST_CAST char*)pItems->p_name;
     retval = mdb_get(pDb->p_txn, pDb->dbi, &key, &data);
@@ -4473,10 +5050,19 @@ static int channel_item_load(ln_channel_t *pChannel, const fixed_item_t *pItems,
 }
 
 
+/** channel DBデータのitemを1つだけ書き換える
+ *
+ * @param[in]       pChannel
+ * @param[in]       pItems          DBCHANNEL_VALUESのitem
+ * @param[in,out]   pDb             NULL:新規にtransactionを開始する
+ * @retval      0   成功
+ */
 static int channel_item_save(const ln_channel_t *pChannel, const fixed_item_t *pItems, ln_lmdb_db_t *pDb)
 {
     int     retval;
     MDB_val key, data;
+    uint8_t *p_record = NULL;
+    uint8_t *p;
 
     ln_lmdb_db_t *p_bak_db_param = pDb;
     ln_lmdb_db_t db;
@@ -4494,17 +5080,36 @@ static int channel_item_save(const ln_channel_t *pChannel, const fixed_item_t *p
         pDb = &db;
     }
 
-    key.mv_size = strlen(pItems->p_name);
-    key.mv_data = (CONST_CAST char*)pItems->p_name;
-    data.mv_size = pItems->data_len;
-    data.mv_data = (uint8_t *)pChannel + pItems->offset;
-    retval = mdb_put(pDb->p_txn, pDb->dbi, &key, &data, 0);
+    key.mv_size = M_SZ_CHANNEL;
+    key.mv_data = M_KEY_CHANNEL;
+    retval = mdb_get(pDb->p_txn, pDb->dbi, &key, &data);
+    if (retval) {
+        LOGE("fail: %s(%s)\n", mdb_strerror(retval), pItems->p_name);
+        goto LABEL_EXIT;
+    }
+
+    //mdb_get()のデータは書き換えられないのでコピーする
+    if (!my_mdb_val_alloccopy(&data, &data)) {
+        LOGE("fail: ???\n");
+        retval = -1;
+        goto LABEL_EXIT;
+    }
+    p_record = (uint8_t *)data.mv_data;
+    p = channel_record_item(p_record, data.mv_size, pItems);
+    if (!p) {
+        LOGE("fail: not found(%s)\n", pItems->p_name);
+        retval = -1;
+        goto LABEL_EXIT;
+    }
+    memcpy(p, (const uint8_t *)pChannel + pItems->offset, pItems->data_len);
+    retval = put_if_changed(pDb->p_txn, pDb->dbi, &key, &data);
     if (retval) {
         LOGE("fail: %s(%s)\n", mdb_strerror(retval), pItems->p_name);
         goto LABEL_EXIT;
     }
 
 LABEL_EXIT:
+    UTL_DBG_FREE(p_record);
     if (p_bak_db_param == NULL) {
         if (retval == 0) {
             MDB_TXN_COMMIT(db.p_txn);
@@ -4611,11 +5216,12 @@ static void channel_cursor_close(lmdb_cursor_t *pCur, bool bWritable)
 }
 
 
-/** htlc用db名の作成
+/** htlc用db名の作成(旧形式)
  *
  * @note
  *      - "HT" + xxxxxxxx...xx[32*2] + "ddd"
  *        |<-- M_SZ_CHANNEL_DB_NAME_STR  -->|
+ *      - DB version -71まで
  *
  * @attention
  *      - 予め pDbName に M_PREF_HTLC と channel_idはコピーしておくこと
@@ -4627,6 +5233,205 @@ static void channel_htlc_db_name(char *pDbName, int num)
 }
 
 
+/** htlc読み込み(旧形式)
+ *
+ * @param[out]      pHtlc           (buf_xxxは初期化済みであること)
+ * @param[in]       pTxn
+ * @param[in]       Dbi             "HT" + channel_id + "ddd"
+ * @retval      0   成功
+ */
+static int channel_htlc_legacy_load(ln_htlc_t *pHtlc, MDB_txn *pTxn, MDB_dbi Dbi)
+{
+    int         retval;
+    MDB_val     key, data;
+
+    //fixed
+    for (size_t lp = 0; lp < ARRAY_SIZE(DBHTLC_VALUES); lp++) {
+        key.mv_size = strlen(DBHTLC_VALUES[lp].p_name);
+        key.mv_data = (CONST_CAST char*)DBHTLC_VALUES[lp].p_name;
+        retval = mdb_get(pTxn, Dbi, &key, &data);
+        if (retval == 0) {
+            memcpy((uint8_t *)pHtlc + DBHTLC_VALUES[lp].offset, data.mv_data, DBHTLC_VALUES[lp].data_len);
+        } else {
+            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), DBHTLC_VALUES[lp].p_name);
+        }
+    }
+
+    //variable
+    static const struct {
+        const char  *p_name;
+        size_t      offset;
+    } VARIABLES[] = {
+        { M_KEY_PREIMAGE, offsetof(ln_htlc_t, buf_preimage) },
+        { M_KEY_ONION_ROUTE, offsetof(ln_htlc_t, buf_onion_reason) },
+        { M_KEY_SHARED_SECRET, offsetof(ln_htlc_t, buf_shared_secret) },
+    };
+    for (size_t lp = 0; lp < ARRAY_SIZE(VARIABLES); lp++) {
+        key.mv_size = strlen(VARIABLES[lp].p_name);
+        key.mv_data = (CONST_CAST char*)VARIABLES[lp].p_name;
+        retval = mdb_get(pTxn, Dbi, &key, &data);
+        if (retval) {
+            //FALLTHROUGH
+            continue;
+        }
+        utl_buf_t *p_buf = (utl_buf_t *)((uint8_t *)pHtlc + VARIABLES[lp].offset);
+        utl_buf_free(p_buf);
+        if (!utl_buf_alloccopy(p_buf, data.mv_data, data.mv_size)) {
+            LOGE("fail: ???\n");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+
+/** 空のhtlcか
+ *
+ * @param[in]       pHtlc
+ * @retval      true    DB保存不要
+ */
+static bool htlc_is_empty(const ln_htlc_t *pHtlc)
+{
+    return !pHtlc->enabled &&
+        (pHtlc->id == 0) &&
+        (pHtlc->amount_msat == 0) &&
+        (pHtlc->cltv_expiry == 0) &&
+        utl_mem_is_all_zero(pHtlc->payment_hash, BTC_SZ_HASH256) &&
+        utl_mem_is_all_zero(pHtlc->remote_sig, LN_SZ_SIGNATURE) &&
+        (pHtlc->buf_preimage.len == 0) &&
+        (pHtlc->buf_onion_reason.len == 0) &&
+        (pHtlc->buf_shared_secret.len == 0);
+}
+
+
+/** htlc DBデータ作成
+ *
+ * @note
+ *      - [1:version]
+ *      - [1:enabled]
+ *      - [8:id]
+ *      - [8:amount_msat]
+ *      - [4:cltv_expiry]
+ *      - [32:payment_hash]
+ *      - [64:remote_sig]
+ *      - [2:len][len:preimage]
+ *      - [2:len][len:onion_reason]
+ *      - [2:len][len:shared_secret]
+ *
+ * @param[out]      pBuf
+ * @param[in]       pHtlc
+ */
+static bool htlc_record_write(utl_buf_t *pBuf, const ln_htlc_t *pHtlc)
+{
+    utl_push_t push;
+
+    if (!utl_push_init(&push, pBuf,
+        M_SZ_HTLC_RECORD_FIXED + sizeof(uint16_t) * 3 +
+        pHtlc->buf_preimage.len + pHtlc->buf_onion_reason.len + pHtlc->buf_shared_secret.len)) return false;
+    if (!utl_push_byte(&push, M_HTLC_RECORD_VER)) goto LABEL_ERROR;
+    if (!utl_push_byte(&push, pHtlc->enabled ? 1 : 0)) goto LABEL_ERROR;
+    if (!utl_push_u64be(&push, pHtlc->id)) goto LABEL_ERROR;
+    if (!utl_push_u64be(&push, pHtlc->amount_msat)) goto LABEL_ERROR;
+    if (!utl_push_u32be(&push, pHtlc->cltv_expiry)) goto LABEL_ERROR;
+    if (!utl_push_data(&push, pHtlc->payment_hash, BTC_SZ_HASH256)) goto LABEL_ERROR;
+    if (!utl_push_data(&push, pHtlc->remote_sig, LN_SZ_SIGNATURE)) goto LABEL_ERROR;
+    if (!utl_push_u16be(&push, (uint16_t)pHtlc->buf_preimage.len)) goto LABEL_ERROR;
+    if (!utl_push_data(&push, pHtlc->buf_preimage.buf, pHtlc->buf_preimage.len)) goto LABEL_ERROR;
+    if (!utl_push_u16be(&push, (uint16_t)pHtlc->buf_onion_reason.len)) goto LABEL_ERROR;
+    if (!utl_push_data(&push, pHtlc->buf_onion_reason.buf, pHtlc->buf_onion_reason.len)) goto LABEL_ERROR;
+    if (!utl_push_u16be(&push, (uint16_t)pHtlc->buf_shared_secret.len)) goto LABEL_ERROR;
+    if (!utl_push_data(&push, pHtlc->buf_shared_secret.buf, pHtlc->buf_shared_secret.len)) goto LABEL_ERROR;
+    return true;
+
+LABEL_ERROR:
+    utl_buf_free(pBuf);
+    return false;
+}
+
+
+/** htlc DBデータ読込み
+ *
+ * @param[out]      pHtlc           (buf_xxxは初期化済みであること)
+ * @param[in]       pData
+ * @param[in]       Len
+ */
+static bool htlc_record_read(ln_htlc_t *pHtlc, const uint8_t *pData, uint32_t Len)
+{
+    btc_buf_r_t buf_r;
+    uint8_t     byte;
+    uint16_t    len;
+    const uint8_t *p;
+
+    btc_buf_r_init(&buf_r, pData, Len);
+    if (!btc_buf_r_read_byte(&buf_r, &byte)) return false;
+    if (byte != M_HTLC_RECORD_VER) {
+        LOGE("fail: unknown version(%u)\n", byte);
+        return false;
+    }
+    if (!btc_buf_r_read_byte(&buf_r, &byte)) return false;
+    pHtlc->enabled = (byte != 0);
+    if (!btc_buf_r_read_u64be(&buf_r, &pHtlc->id)) return false;
+    if (!btc_buf_r_read_u64be(&buf_r, &pHtlc->amount_msat)) return false;
+    if (!btc_buf_r_read_u32be(&buf_r, &pHtlc->cltv_expiry)) return false;
+    if (!btc_buf_r_read(&buf_r, pHtlc->payment_hash, BTC_SZ_HASH256)) return false;
+    if (!btc_buf_r_read(&buf_r, pHtlc->remote_sig, LN_SZ_SIGNATURE)) return false;
+
+    utl_buf_t *p_bufs[] = {
+        &pHtlc->buf_preimage, &pHtlc->buf_onion_reason, &pHtlc->buf_shared_secret
+    };
+    for (size_t lp = 0; lp < ARRAY_SIZE(p_bufs); lp++) {
+        if (!btc_buf_r_read_u16be(&buf_r, &len)) return false;
+        if (!btc_buf_r_get_pos_and_seek(&buf_r, &p, len)) return false;
+        utl_buf_free(p_bufs[lp]);
+        if (len && !utl_buf_alloccopy(p_bufs[lp], p, len)) return false;
+    }
+    return true;
+}
+
+
+/** htlc書込み
+ *
+ * DBの内容と同じであれば書き込まない。
+ * 空のhtlcはDBから削除する。
+ *
+ * @param[in]       pTxn
+ * @param[in]       Dbi             "HT" + channel_id
+ * @param[in]       Idx             HTLC index
+ * @param[in]       pHtlc
+ * @retval      0   成功
+ */
+static int htlc_record_save(MDB_txn *pTxn, MDB_dbi Dbi, uint16_t Idx, const ln_htlc_t *pHtlc)
+{
+    int         retval;
+    MDB_val     key, data;
+    uint8_t     key_data[M_SZ_HTLC_IDX_KEY];
+
+    utl_int_unpack_u16be(key_data, Idx);
+    key.mv_size = sizeof(key_data);
+    key.mv_data = key_data;
+
+    if (htlc_is_empty(pHtlc)) {
+        retval = mdb_del(pTxn, Dbi, &key, NULL);
+        if (retval == MDB_NOTFOUND) {
+            retval = 0;
+        }
+        return retval;
+    }
+
+    utl_buf_t buf = UTL_BUF_INIT;
+    if (!htlc_record_write(&buf, pHtlc)) {
+        LOGE("fail: ???\n");
+        return -1;
+    }
+    data.mv_size = buf.len;
+    data.mv_data = buf.buf;
+    retval = put_if_changed(pTxn, Dbi, &key, &data);
+    utl_buf_free(&buf);
+    return retval;
+}
+
+
 /** #ln_node_search_channel()処理関数
  *
  * @param[in,out]   pChannel        channel from DB
@@ -4659,6 +5464,7 @@ static bool channel_search(ln_db_func_cmp_t pFunc, void *pFuncParam, bool bWrita
     bool            found = false;
     int             retval;
     lmdb_cursor_t   cur;
+    ln_channel_t    *p_channel = NULL;
 
     LOGD("channl cursor open(writable=%d)\n", bWritable);
     retval = channel_cursor_open(&cur, bWritable);
@@ -4667,7 +5473,7 @@ static bool channel_search(ln_db_func_cmp_t pFunc, void *pFuncParam, bool bWrita
         goto LABEL_EXIT;
     }
 
-    ln_channel_t *p_channel = (ln_channel_t *)UTL_DBG_MALLOC(sizeof(ln_channel_t));
+    p_channel = (ln_channel_t *)UTL_DBG_MALLOC(sizeof(ln_channel_t));
     if (!p_channel) {
         channel_cursor_close(&cur, bWritable);
         LOGE("fail: ???\n");
@@ -4755,7 +5561,7 @@ static void channel_copy_closed(MDB_txn *pTxn, const char *pChannelStr)
         retval = mdb_cursor_open(pTxn, dbi, &p_cursor);
     }
     if (retval == 0) {
-        while (mdb_cursor_get(p_cursor, &key, NULL, MDB_NEXT_NODUP) == 0) {
+        while (mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT_NODUP) == 0) {
             MDB_dbi dbi2;
             MDB_cursor *p_cursor2 = NULL;
             if (memchr(key.mv_data, '\0', key.mv_size)) {
@@ -4847,13 +5653,108 @@ static int node_db_open(ln_lmdb_db_t *pDb, const char *pDbName, int OptTxn, int
 
 
 /********************************************************************
- * private functions: announce
+ * private functions: route_skip
  ********************************************************************/
 
-/** channel_announcement読込み
+/** [route_skip]全件読込み
  *
- * @param[in]       pDb
- * @param[out]      pCnlAnno
+ * @param[out]      pCache
+ * @retval  true    成功(DBが無い場合も含む)
+ * @attention
+ *      - mMuxRouteSkipをlockしていること
+ */
+static bool route_skip_cache_load(route_skip_cache_t *pCache)
+{
+    int             retval;
+    MDB_val         key, data;
+    MDB_cursor      *p_cursor = NULL;
+    ln_lmdb_db_t    db;
+    uint32_t        cap = 0;
+
+    pCache->num = 0;
+    pCache->p_items = NULL;
+
+    retval = node_db_open(&db, M_DBI_ROUTE_SKIP, MDB_RDONLY, 0);
+    if (retval) {
+        if (retval != MDB_NOTFOUND) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+            return false;
+        }
+        //DB無し
+        pCache->loaded = true;
+        return true;
+    }
+
+    retval = mdb_cursor_open(db.p_txn, db.dbi, &p_cursor);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        MDB_TXN_ABORT(db.p_txn);
+        return false;
+    }
+
+    while (mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT) == 0) {
+        if ((key.mv_size != sizeof(uint64_t)) || (data.mv_size != sizeof(uint8_t))) continue;
+
+        if (pCache->num == cap) {
+            cap = (cap) ? cap * 2 : 16;
+            route_skip_item_t *p_items = (route_skip_item_t *)UTL_DBG_REALLOC(pCache->p_items, sizeof(route_skip_item_t) * cap);
+            if (!p_items) {
+                LOGE("fail: realloc\n");
+                MDB_CURSOR_CLOSE(p_cursor);
+                MDB_TXN_ABORT(db.p_txn);
+                UTL_DBG_FREE(pCache->p_items);
+                pCache->num = 0;
+                return false;
+            }
+            pCache->p_items = p_items;
+        }
+        memcpy(&pCache->p_items[pCache->num].short_channel_id, key.mv_data, sizeof(uint64_t));
+        pCache->p_items[pCache->num].route_skip = *(const uint8_t *)data.mv_data;
+        pCache->num++;
+    }
+    MDB_CURSOR_CLOSE(p_cursor);
+    MDB_TXN_ABORT(db.p_txn);
+
+    //keyはhost byte orderのため、DBの並びは数値順とは限らない
+    if (pCache->num > 1) {
+        qsort(pCache->p_items, pCache->num, sizeof(route_skip_item_t), route_skip_cmp_func);
+    }
+    pCache->loaded = true;
+    LOGD("route_skip: %" PRIu32 "\n", pCache->num);
+    return true;
+}
+
+
+static void route_skip_cache_invalidate(void)
+{
+    pthread_mutex_lock(&mMuxRouteSkip);
+    UTL_DBG_FREE(mRouteSkipCache.p_items);
+    mRouteSkipCache.num = 0;
+    mRouteSkipCache.loaded = false;
+    pthread_mutex_unlock(&mMuxRouteSkip);
+}
+
+
+/** qsort/bsearch用比較関数
+ *
+ * 先頭メンバがshort_channel_idのため、keyにuint64_t*も指定できる。
+ */
+static int route_skip_cmp_func(const void *pKey, const void *pItem)
+{
+    uint64_t key = *(const uint64_t *)pKey;
+    uint64_t val = ((const route_skip_item_t *)pItem)->short_channel_id;
+    return (key < val) ? -1 : ((key > val) ? 1 : 0);
+}
+
+
+/********************************************************************
+ * private functions: announce
+ ********************************************************************/
+
+/** channel_announcement読込み
+ *
+ * @param[in]       pDb
+ * @param[out]      pCnlAnno
  * @param[in]       ShortChannelId
  * @retval      true    成功
  */
@@ -4865,7 +5766,7 @@ static int cnlanno_load(ln_lmdb_db_t *pDb, utl_buf_t *pCnlAnno, uint64_t ShortCh
     uint8_t key_data[M_SZ_CNLANNO_INFO_KEY];
 
     cnlanno_info_set_key(key_data, &key, ShortChannelId, LN_DB_CNLANNO_ANNO);
-    int retval = mdb_get(mpTxnAnno, pDb->dbi, &key, &data);
+    int retval = mdb_get(M_TXN_ANNO, pDb->dbi, &key, &data);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -4925,7 +5826,7 @@ static int cnlupd_load(ln_lmdb_db_t *pDb, utl_buf_t *pCnlUpd, uint32_t *pTimeSta
     cnlanno_info_set_key(
         key_data, &key, ShortChannelId,
         Dir ?  LN_DB_CNLANNO_UPD1 : LN_DB_CNLANNO_UPD0);
-    int retval = mdb_get(mpTxnAnno, pDb->dbi, &key, &data);
+    int retval = mdb_get(M_TXN_ANNO, pDb->dbi, &key, &data);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -5049,7 +5950,7 @@ static int nodeanno_load(ln_lmdb_db_t *pDb, utl_buf_t *pNodeAnno, uint32_t *pTim
     uint8_t key_data[M_SZ_NODEANNO_INFO_KEY];
 
     nodeanno_info_set_key(key_data, &key, pNodeId);
-    int retval = mdb_get(mpTxnAnno, pDb->dbi, &key, &data);
+    int retval = mdb_get(M_TXN_ANNO, pDb->dbi, &key, &data);
     if (retval) {
         if (retval != MDB_NOTFOUND) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
@@ -5107,16 +6008,19 @@ static int nodeanno_save(ln_lmdb_db_t *pDb, const utl_buf_t *pNodeAnno, const ui
 }
 
 
-static bool annoinfos_trim_node_id(const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo)
+/** annoinfo(送信済み情報)のchannelとnodeから、指定slotのentryを削除する
+ *
+ * slotの世代が一巡した時だけ行う。
+ */
+static bool annoinfos_trim_slot(uint16_t Slot, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo)
 {
-    LOGD("del annoinfo: ");
-    DUMPD(pNodeId, BTC_SZ_PUBKEY);
+    LOGD("del annoinfo: slot=%u\n", Slot);
     MDB_cursor  *p_cursor;
 
     //cnlanno_info
     int retval1 = mdb_cursor_open(mpTxnAnno, DbiCnlannoInfo, &p_cursor);
     if (retval1 == 0) {
-        if (!annoinfo_cur_trim_node_id(p_cursor, pNodeId)) {
+        if (!annoinfo_cur_trim_slot(p_cursor, Slot)) {
             retval1 = -1;
         }
         MDB_CURSOR_CLOSE(p_cursor);
@@ -5127,7 +6031,7 @@ static bool annoinfos_trim_node_id(const uint8_t *pNodeId, MDB_dbi DbiCnlannoInf
     //nodeanno_info
     int retval2 = mdb_cursor_open(mpTxnAnno, DbiNodeannoInfo, &p_cursor);
     if (retval2 == 0) {
-        if (!annoinfo_cur_trim_node_id(p_cursor, pNodeId)) {
+        if (!annoinfo_cur_trim_slot(p_cursor, Slot)) {
             retval2 = -1;
         }
         MDB_CURSOR_CLOSE(p_cursor);
@@ -5140,38 +6044,37 @@ static bool annoinfos_trim_node_id(const uint8_t *pNodeId, MDB_dbi DbiCnlannoInf
 
 
 /** annoinfo(送信済み情報)のchannelとnodeから、指定されたshort_channel_id[]についてだけ未送信状態にする。
- *  (未送信状態＝node_idを mv_dataから削除する)
+ *  (未送信状態＝peerのentryを未送信にする)
  *
  * 未送信のannouncementは、自動的に送信が行われる。
  * channel_announcementから両端のnode_idもわかるため、それを未送信にする。
  */
 static bool annoinfos_trim_node_id_selected(
-    const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
+    const anno_peer_t *pPeer, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
     const uint64_t *pShortChannelIds, size_t Num)
 {
     int retval;
-    LOGD("del selected annoinfo: ");
-    DUMPD(pNodeId, BTC_SZ_PUBKEY);
+    LOGD("del selected annoinfo: slot=%u\n", pPeer->slot);
 
     //channel_announcement取得用
     ln_lmdb_db_t db;
-    retval = MDB_DBI_OPEN(mpTxnAnno, M_DBI_CNLANNO, 0, &db.dbi);
+    retval = anno_dbi_open(M_DBI_CNLANNO, 0, &db.dbi);
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         return false;
     }
-    db.p_txn = mpTxnAnno;
+    db.p_txn = M_TXN_ANNO;
 
     for(size_t lp = 0; lp < Num; lp++) {
         LOGD(" %d: %016" PRIx64 "\n", lp, pShortChannelIds[lp]);
 
-        MDB_val key, data;
+        MDB_val key;
         uint8_t key_data[M_SZ_CNLANNO_INFO_KEY];
 
         const char TYPES[] = { LN_DB_CNLANNO_ANNO, LN_DB_CNLANNO_UPD0, LN_DB_CNLANNO_UPD1 };
         for (size_t type = 0; type < ARRAY_SIZE(TYPES); type++) {
             cnlanno_info_set_key(key_data, &key, pShortChannelIds[lp], TYPES[type]);
-            int retval = mdb_get(mpTxnAnno, DbiCnlannoInfo, &key, &data);
+            int retval = annoinfo_set_exist(DbiCnlannoInfo, &key, pPeer, false);
             if (retval) {
                 LOGD("nof found: %016" PRIx64 " %c\n", pShortChannelIds[lp], TYPES[type]);
                 continue;
@@ -5181,24 +6084,8 @@ static bool annoinfos_trim_node_id_selected(
 
             if (TYPES[type] == LN_DB_CNLANNO_ANNO) {
                 //trim node_id in  node_announcement
-                annoinfos_trim_node_id_nodeanno(pNodeId, pShortChannelIds[lp], DbiNodeannoInfo, &db);
-            }
-
-            if (!annoinfo_trim_node_id(&data, pNodeId)) {
-                continue;
-            }
-            if (!my_mdb_val_alloccopy(&key, &key)) {
-                LOGE("fail: ???\n");
-                UTL_DBG_FREE(data.mv_data);
-                return false;
+                annoinfos_trim_node_id_nodeanno(pPeer, pShortChannelIds[lp], DbiNodeannoInfo, &db);
             }
-            retval = mdb_put(mpTxnAnno, DbiCnlannoInfo, &key, &data, 0);
-            if (retval) {
-                LOGE("ERR: %s\n", mdb_strerror(retval));
-                //XXX: ???
-            }
-            UTL_DBG_FREE(data.mv_data);
-            UTL_DBG_FREE(key.mv_data);
         }
     }
     //XXX: return true;
@@ -5207,25 +6094,22 @@ static bool annoinfos_trim_node_id_selected(
 }
 
 
-/** annoinfo(送信済み情報)のchannelとnodeから、指定されたshort_channel_id[]についてだけ未送信状態にする。
- *  (未送信状態＝node_idを mv_dataから削除する)
+/** annoinfo(送信済み情報)のchannelとnodeから、timestampが範囲内のものだけ未送信状態にする。
+ *  (未送信状態＝peerのentryを未送信にする)
  *
+ * 範囲外のものは、呼び出し元で#annopeer_gen_next()により送信済みにしておく。
  * 未送信のannouncementは、自動的に送信が行われる。
- * channel_announcementから両端のnode_idもわかるため、それを未送信にする。
  */
 static bool annoinfos_trim_node_id_timestamp(
-    const uint8_t *pNodeId, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
+    const anno_peer_t *pPeer, MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo,
     uint32_t TimeFirst, uint32_t TimeRange)
 {
-    int retval;
     void *p_cur;
-    LOGD("del selected annoinfo: ");
-    DUMPD(pNodeId, BTC_SZ_PUBKEY);
+    LOGD("del selected annoinfo: slot=%u\n", pPeer->slot);
 
     //channel_announcement, channel_update
     if (!ln_db_anno_cur_open(&p_cur, LN_DB_CUR_CNLANNO)) {
         LOGE("fail: cursor open\n");
-        ln_db_anno_commit(false);
         return false;
     }
 
@@ -5237,54 +6121,19 @@ static bool annoinfos_trim_node_id_timestamp(
         utl_buf_free(&buf_cnlanno);
         if ((type != LN_DB_CNLANNO_UPD0) && (type != LN_DB_CNLANNO_UPD1)) continue;
         //LOGD("  short_channel_id=%016" PRIx64 ",  timestamp=%" PRIu32 "\n", short_channel_id, timestamp);
-        bool resend;
-        if ((timestamp < TimeFirst) || (TimeFirst + TimeRange < timestamp)) {
-            resend = false;
-        } else {
-            resend = true;
-        }
+        if ((timestamp < TimeFirst) || (TimeFirst + TimeRange < timestamp)) continue;
 
-        //remove node_id from sent list
+        //resend: channel_announcementとchannel_update
         char SUFFIX[2] = { LN_DB_CNLANNO_ANNO, 0 };
         SUFFIX[1] = type;
         for (size_t lp = 0; lp < ARRAY_SIZE(SUFFIX); lp++) {
             MDB_val     key;
-            MDB_val     data;
             uint8_t     key_data[M_SZ_CNLANNO_INFO_KEY];
 
             cnlanno_info_set_key(key_data, &key, short_channel_id, SUFFIX[lp]);
-            retval = mdb_get(mpTxnAnno, DbiCnlannoInfo, &key, &data);
-            if (retval == 0) {
-                // LOGD("  before=");
-                // DUMPD(data.mv_data, data.mv_size);
-                if (resend) {
-                    if (!annoinfo_trim_node_id(&data, pNodeId)) {
-                        continue;
-                    }
-                } else {
-                    if (!annoinfo_add_node_id(&data, pNodeId)) {
-                        continue;
-                    }
-                }
-                if (!my_mdb_val_alloccopy(&key, &key)) {
-                    LOGE("fail: ???\n");
-                    UTL_DBG_FREE(data.mv_data);
-                    return false;
-                }
-                // LOGD("  after=");
-                // DUMPD(data.mv_data, data.mv_size);
-
-                retval = mdb_put(mpTxnAnno, DbiCnlannoInfo, &key, &data, 0);
-                if (retval) {
-                    LOGE("ERR: %s\n", mdb_strerror(retval));
-                    //XXX: ???
-                }
-                UTL_DBG_FREE(data.mv_data);
-                UTL_DBG_FREE(key.mv_data);
-            } else {
-                if (retval && (retval != MDB_NOTFOUND)) {
-                    LOGE("ERR[%c]: %s\n", SUFFIX[lp], mdb_strerror(retval));
-                }
+            int retval = annoinfo_set_exist(DbiCnlannoInfo, &key, pPeer, false);
+            if (retval && (retval != MDB_NOTFOUND)) {
+                LOGE("ERR[%c]: %s\n", SUFFIX[lp], mdb_strerror(retval));
             }
         }
     }
@@ -5295,7 +6144,6 @@ static bool annoinfos_trim_node_id_timestamp(
     //node_announcement
     if (!ln_db_anno_cur_open(&p_cur, LN_DB_CUR_NODEANNO)) {
         LOGE("fail: cursor open\n");
-        ln_db_anno_commit(false);
         return false;
     }
 
@@ -5303,61 +6151,21 @@ static bool annoinfos_trim_node_id_timestamp(
     uint8_t     node_id[BTC_SZ_PUBKEY];
     while (ln_db_nodeanno_cur_get(p_cur, &buf_nodeanno, &timestamp, node_id)) {
         utl_buf_free(&buf_nodeanno);
-        // LOGD("  node_id=");
-        // DUMPD(node_id, BTC_SZ_PUBKEY);
-        bool resend;
-        if ((timestamp < TimeFirst) || (TimeFirst + TimeRange < timestamp)) {
-            resend = false;
-        } else {
-            resend = true;
-        }
+        if ((timestamp < TimeFirst) || (TimeFirst + TimeRange < timestamp)) continue;
 
-        //remove node_id from sent list
+        //resend
         MDB_val     key;
-        MDB_val     data;
         uint8_t     key_data[M_SZ_NODEANNO_INFO_KEY];
 
         nodeanno_info_set_key(key_data, &key, node_id);
-        retval = mdb_get(mpTxnAnno, DbiNodeannoInfo, &key, &data);
-        if (retval == 0) {
-            // LOGD("  before=");
-            // DUMPD(data.mv_data, data.mv_size);
-            if (resend) {
-                if (!annoinfo_trim_node_id(&data, pNodeId)) {
-                    continue;
-                }
-            } else {
-                if (!annoinfo_add_node_id(&data, pNodeId)) {
-                    continue;
-                }
-            }
-            if (!my_mdb_val_alloccopy(&key, &key)) {
-                LOGE("fail: ???\n");
-                UTL_DBG_FREE(data.mv_data);
-                return false;
-            }
-            // LOGD("  after=");
-            // DUMPD(data.mv_data, data.mv_size);
-
-            retval = mdb_put(mpTxnAnno, DbiNodeannoInfo, &key, &data, 0);
-            if (retval) {
-                LOGE("ERR: %s\n", mdb_strerror(retval));
-                //XXX: ???
-            }
-            UTL_DBG_FREE(data.mv_data);
-            UTL_DBG_FREE(key.mv_data);
-        } else {
-            if (retval && (retval != MDB_NOTFOUND)) {
-                LOGE("ERR: %s\n", mdb_strerror(retval));
-            }
+        int retval = annoinfo_set_exist(DbiNodeannoInfo, &key, pPeer, false);
+        if (retval && (retval != MDB_NOTFOUND)) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
         }
     }
     utl_buf_free(&buf_nodeanno);
     ln_db_anno_cur_close(p_cur);
 
-
-    ln_db_anno_commit(true);
-
     //XXX: return true;
     //  not tested, always return false
     return false;
@@ -5365,7 +6173,7 @@ static bool annoinfos_trim_node_id_timestamp(
 
 
 static bool annoinfos_trim_node_id_nodeanno(
-    const uint8_t *pNodeId, uint64_t ShortChannelId, MDB_dbi DbiNodeannoInfo,
+    const anno_peer_t *pPeer, uint64_t ShortChannelId, MDB_dbi DbiNodeannoInfo,
     ln_lmdb_db_t *pDb)
 {
     ln_msg_channel_announcement_t msg;
@@ -5380,7 +6188,7 @@ static bool annoinfos_trim_node_id_nodeanno(
         utl_buf_free(&buf_cnlanno);
         return true;
     }
-    MDB_val key, data;
+    MDB_val key;
     uint8_t key_data[M_SZ_NODEANNO_INFO_KEY];
 
     const uint8_t *p_node_id[2];
@@ -5388,29 +6196,13 @@ static bool annoinfos_trim_node_id_nodeanno(
     p_node_id[1] = msg.p_node_id_2;
     for (int lp = 0; lp < 2; lp++) {
         nodeanno_info_set_key(key_data, &key, p_node_id[lp]);
-        int retval = mdb_get(mpTxnAnno, DbiNodeannoInfo, &key, &data);
+        int retval = annoinfo_set_exist(DbiNodeannoInfo, &key, pPeer, false);
         if (retval) {
             //XXX: ???
             continue;
         }
         LOGD("found: ");
         DUMPD(p_node_id[lp], BTC_SZ_PUBKEY);
-
-        if (!annoinfo_trim_node_id(&data, pNodeId)) {
-            //XXX: ???
-            continue;
-        }
-        if (!my_mdb_val_alloccopy(&key, &key)) {
-            //XXX: ???
-            UTL_DBG_FREE(data.mv_data);
-            continue;
-        }
-        retval = mdb_put(mpTxnAnno, DbiNodeannoInfo, &key, &data, 0);
-        if (retval) {
-            LOGE("ERR: %s\n", mdb_strerror(retval));
-        }
-        UTL_DBG_FREE(data.mv_data);
-        UTL_DBG_FREE(key.mv_data);
     }
     utl_buf_free(&buf_cnlanno);
     return true;
@@ -5421,20 +6213,226 @@ static bool annoinfos_del_all(MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo)
 {
     LOGD("del annoinfo: ALL\n");
     //cnlanno_info
-    int retval1 = mdb_drop(mpTxnAnno, DbiCnlannoInfo, 1);
+    int retval1 = mdb_drop(mpTxnAnno, DbiCnlannoInfo, 0);   //dbiはread-only transactionと共有しているため閉じない
     if (retval1) {
         LOGE("ERR: %s\n", mdb_strerror(retval1));
         //エラーでも継続
     }
 
     //nodeanno_info
-    int retval2 = mdb_drop(mpTxnAnno, DbiNodeannoInfo, 1);
+    int retval2 = mdb_drop(mpTxnAnno, DbiNodeannoInfo, 0);
     if (retval2) {
         LOGE("ERR: %s\n", mdb_strerror(retval2));
         //エラーでも継続
     }
 
-    return (retval1 == 0) && (retval2 == 0);
+    //anno_peer
+    MDB_dbi dbi_peer;
+    int retval3 = anno_dbi_open(M_DBI_ANNO_PEER, 0, &dbi_peer);
+    if (retval3 == 0) {
+        retval3 = mdb_drop(mpTxnAnno, dbi_peer, 0);
+    }
+    if (retval3) {
+        LOGE("ERR: %s\n", mdb_strerror(retval3));
+        //エラーでも継続
+    }
+
+    return (retval1 == 0) && (retval2 == 0) && (retval3 == 0);
+}
+
+
+/** anno DBのdbiを開いておく
+ *
+ * @retval  true    成功
+ */
+static bool anno_dbi_init(void)
+{
+    MDB_txn *p_txn;
+    int retval = MDB_TXN_BEGIN(mpEnvAnno, NULL, 0, &p_txn);
+    if (retval) return false;
+    for (size_t lp = 0; lp < ARRAY_SIZE(M_ANNO_DBI_NAMES); lp++) {
+        retval = MDB_DBI_OPEN(p_txn, M_ANNO_DBI_NAMES[lp], MDB_CREATE, &mDbiAnno[lp]);
+        if (retval) {
+            LOGE("ERR(%s): %s\n", M_ANNO_DBI_NAMES[lp], mdb_strerror(retval));
+            MDB_TXN_ABORT(p_txn);
+            return false;
+        }
+    }
+    retval = my_mdb_txn_commit(p_txn, __LINE__);
+    mDbiAnnoReady = (retval == 0);
+    return mDbiAnnoReady;
+}
+
+
+/** 現threadのanno transactionでdbiを開く
+ *
+ * #anno_dbi_init()済みであれば、開いておいたdbiを返す。
+ *
+ * @param[in]   pName       dbi名
+ * @param[in]   Flags       mdb_dbi_open()のflags(read-only transactionではMDB_CREATEしない)
+ * @param[out]  pDbi        dbi
+ * @return      LMDB error
+ */
+static int anno_dbi_open(const char *pName, unsigned int Flags, MDB_dbi *pDbi)
+{
+    if (mDbiAnnoReady) {
+        for (size_t lp = 0; lp < ARRAY_SIZE(M_ANNO_DBI_NAMES); lp++) {
+            if (strcmp(pName, M_ANNO_DBI_NAMES[lp]) == 0) {
+                *pDbi = mDbiAnno[lp];
+                return 0;
+            }
+        }
+    }
+    if (mpTxnAnnoRead) {
+        Flags &= ~MDB_CREATE;
+    }
+    return MDB_DBI_OPEN(M_TXN_ANNO, pName, Flags, pDbi);
+}
+
+
+/** anno DB読込み開始
+ *
+ *  - #ln_db_anno_read_begin()中: そのtransactionを使う
+ *  - batch中: 未commitの保存を読めるよう、子transactionを使う
+ *  - それ以外: read-only transactionを開始する(mMuxAnnoは使わない)
+ *
+ * @param[out]  pReadEnd    true:#anno_load_end()でread-only transactionを終了する
+ * @retval  true    成功
+ */
+static bool anno_load_begin(bool *pReadEnd)
+{
+    *pReadEnd = false;
+    if (mpTxnAnnoRead) return true;
+    if (mAnnoBatchOwner) return ln_db_anno_transaction();
+    if (!ln_db_anno_read_begin()) return false;
+    *pReadEnd = true;
+    return true;
+}
+
+
+/** anno DB読込み終了
+ *
+ * @param[in]   bReadEnd    #anno_load_begin()のpReadEnd
+ */
+static void anno_load_end(bool bReadEnd)
+{
+    if (bReadEnd) {
+        ln_db_anno_read_end();
+    } else if (mAnnoBatchOwner) {
+        ln_db_anno_commit(false);
+    }
+}
+
+
+/** [routing graph通知]channel_announcement保存
+ *
+ * mpTxnAnnoのcommit後に#ln_routing_notify_cnlanno_save()する。
+ */
+static void anno_notify_cnlanno_save(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2)
+{
+    anno_notify_t notify;
+    memset(&notify, 0, sizeof(notify));
+    notify.type = ANNO_NOTIFY_CNLANNO_SAVE;
+    notify.short_channel_id = ShortChannelId;
+    memcpy(notify.node_id[0], pNodeId1, BTC_SZ_PUBKEY);
+    memcpy(notify.node_id[1], pNodeId2, BTC_SZ_PUBKEY);
+    anno_notify_push(&notify);
+}
+
+
+/** [routing graph通知]channel_update保存
+ *
+ * mpTxnAnnoのcommit後に#ln_routing_notify_cnlupd_save()する。
+ */
+static void anno_notify_cnlupd_save(const ln_msg_channel_update_t *pUpd)
+{
+    anno_notify_t notify;
+    memset(&notify, 0, sizeof(notify));
+    notify.type = ANNO_NOTIFY_CNLUPD_SAVE;
+    notify.short_channel_id = pUpd->short_channel_id;
+    notify.upd = *pUpd;
+    notify.upd.p_signature = NULL;
+    notify.upd.p_chain_hash = NULL;
+    anno_notify_push(&notify);
+}
+
+
+/** [routing graph通知]channel_announcement/channel_update削除
+ *
+ * mpTxnAnnoのcommit後に#ln_routing_notify_cnlanno_del()する。
+ */
+static void anno_notify_cnlanno_del(uint64_t ShortChannelId, char Type)
+{
+    anno_notify_t notify;
+    memset(&notify, 0, sizeof(notify));
+    notify.type = ANNO_NOTIFY_CNLANNO_DEL;
+    notify.short_channel_id = ShortChannelId;
+    notify.anno_type = Type;
+    anno_notify_push(&notify);
+}
+
+
+/** commit待ちのrouting graph通知を追加
+ *
+ * mMuxAnnoをlockして(anno transaction中に)呼び出すこと。
+ */
+static void anno_notify_push(const anno_notify_t *pNotify)
+{
+    if (mAnnoNotifyNum == mAnnoNotifyMax) {
+        uint32_t max = (mAnnoNotifyMax != 0) ? mAnnoNotifyMax * 2 : 16;
+        anno_notify_t *p = (anno_notify_t *)UTL_DBG_REALLOC(mpAnnoNotify, sizeof(anno_notify_t) * max);
+        if (!p) {
+            //routing graphには次回起動時のDB読込みで反映される
+            LOGE("fail: realloc\n");
+            return;
+        }
+        mpAnnoNotify = p;
+        mAnnoNotifyMax = max;
+    }
+    mpAnnoNotify[mAnnoNotifyNum++] = *pNotify;
+}
+
+
+/** commit待ちのrouting graph通知をすべて反映
+ *
+ * mMuxAnnoをlockして呼び出すこと。
+ */
+static void anno_notify_apply(void)
+{
+    for (uint32_t lp = 0; lp < mAnnoNotifyNum; lp++) {
+        const anno_notify_t *p_notify = &mpAnnoNotify[lp];
+        switch (p_notify->type) {
+        case ANNO_NOTIFY_CNLANNO_SAVE:
+            ln_routing_notify_cnlanno_save(p_notify->short_channel_id, p_notify->node_id[0], p_notify->node_id[1]);
+            break;
+        case ANNO_NOTIFY_CNLUPD_SAVE:
+            ln_routing_notify_cnlupd_save(&p_notify->upd);
+            break;
+        case ANNO_NOTIFY_CNLANNO_DEL:
+            ln_routing_notify_cnlanno_del(p_notify->short_channel_id, p_notify->anno_type);
+            break;
+        default:
+            break;
+        }
+    }
+    anno_notify_drop(0);
+}
+
+
+/** commit待ちのrouting graph通知を破棄
+ *
+ * mMuxAnnoをlockして呼び出すこと。
+ *
+ * @param[in]   Num     残す数(先頭から)
+ */
+static void anno_notify_drop(uint32_t Num)
+{
+    if (Num >= mAnnoNotifyNum) return;
+    mAnnoNotifyNum = Num;
+    if (mAnnoNotifyNum == 0) {
+        UTL_DBG_FREE(mpAnnoNotify);
+        mAnnoNotifyMax = 0;
+    }
 }
 
 
@@ -5477,190 +6475,473 @@ static void nodeanno_info_set_key(uint8_t *pKeyData, MDB_val *pKey, const uint8_
 // }
 
 
-//need free() pData->mv_data
-static bool annoinfo_add_node_id(MDB_val *pData, const uint8_t *pNodeId)
+/** "anno_peer"からpeer情報取得
+ *
+ * @param[out]  pPeer
+ * @param[in]   pNodeId
+ * @return      LMDB error(MDB_NOTFOUND:未登録)
+ */
+static int annopeer_load(anno_peer_t *pPeer, const uint8_t *pNodeId)
 {
-    bool detect = annoinfo_search_node_id(pData, pNodeId);
-    int nums = pData->mv_size / BTC_SZ_PUBKEY;
-    if (!detect) {
-        nums++;
+    MDB_dbi dbi;
+    MDB_val key, data;
+
+    int retval = anno_dbi_open(M_DBI_ANNO_PEER, 0, &dbi);
+    if (retval) {
+        return retval;
     }
-    uint8_t *p_ids = (uint8_t *)UTL_DBG_MALLOC(nums * BTC_SZ_PUBKEY);
-    if (!p_ids) {
-        LOGE("fail: ???");
-        return false;
+    key.mv_size = BTC_SZ_PUBKEY;
+    key.mv_data = (CONST_CAST uint8_t *)pNodeId;
+    retval = mdb_get(M_TXN_ANNO, dbi, &key, &data);
+    if (retval) {
+        return retval;
     }
-    //append
-    memcpy(p_ids, pData->mv_data, pData->mv_size);
-    //search & hit
-    if (!detect) {
-        memcpy(p_ids + pData->mv_size, pNodeId, BTC_SZ_PUBKEY);
-        pData->mv_size += BTC_SZ_PUBKEY;
+    if (data.mv_size != sizeof(anno_peer_t)) {
+        LOGE("fail: invalid anno_peer\n");
+        return -1;
     }
-    pData->mv_data = p_ids;
+    memcpy(pPeer, data.mv_data, sizeof(anno_peer_t));
+    return 0;
+}
 
-    return true;
+
+/** "anno_peer"へpeer情報保存
+ *
+ * @param[in]   pPeer
+ * @param[in]   pNodeId
+ * @return      LMDB error
+ */
+static int annopeer_save(const anno_peer_t *pPeer, const uint8_t *pNodeId)
+{
+    MDB_dbi dbi;
+    MDB_val key, data;
+
+    int retval = anno_dbi_open(M_DBI_ANNO_PEER, MDB_CREATE, &dbi);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return retval;
+    }
+    key.mv_size = BTC_SZ_PUBKEY;
+    key.mv_data = (CONST_CAST uint8_t *)pNodeId;
+    data.mv_size = sizeof(anno_peer_t);
+    data.mv_data = (CONST_CAST anno_peer_t *)pPeer;
+    retval = mdb_put(mpTxnAnno, dbi, &key, &data, 0);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+    }
+    return retval;
 }
 
 
-/** annoinfoにnode_idを追加(channel, node共通)
+/** peer情報取得(未登録であれば空きslotを割り当てる)
  *
- * @param[in,out]   pDb         annoinfo
- * @param[in]       pMdbKey     loadしたchannel_announcement infoのkey
- * @param[in]       pMdbData    loadしたchannel_announcement infoのdata
- * @param[in]       pNodeId     追加するnode_id(NULL時はクリア)
+ * @param[out]  pPeer
+ * @param[in]   pNodeId
+ * @return      LMDB error
  */
-static bool annoinfo_add(ln_lmdb_db_t *pDb, MDB_val *pMdbKey, MDB_val *pMdbData, const uint8_t *pNodeId)
+static int annopeer_get(anno_peer_t *pPeer, const uint8_t *pNodeId)
 {
-    if (pNodeId) {
-        if (!annoinfo_add_node_id(pMdbData, pNodeId)) {
-            return false;
-        }
-    } else {
-        pMdbData->mv_size = 0;
-        pMdbData->mv_data = NULL;
+    MDB_dbi     dbi;
+    MDB_cursor  *p_cursor;
+    MDB_val     key, data;
+
+    int retval = annopeer_load(pPeer, pNodeId);
+    if (retval != MDB_NOTFOUND) {
+        return retval;
     }
 
-    int retval = mdb_put(mpTxnAnno, pDb->dbi, pMdbKey, pMdbData, 0);
+    //使用中のslot
+    retval = anno_dbi_open(M_DBI_ANNO_PEER, MDB_CREATE, &dbi);
+    if (retval == 0) {
+        retval = mdb_cursor_open(mpTxnAnno, dbi, &p_cursor);
+    }
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
+        return retval;
     }
-    UTL_DBG_FREE(pMdbData->mv_data);
-    return retval == 0;
+    uint8_t *p_used = (uint8_t *)UTL_DBG_CALLOC(1, M_ANNO_SLOT_NUM / 8);
+    while (mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT) == 0) {
+        if ((key.mv_size != BTC_SZ_PUBKEY) || (data.mv_size != sizeof(anno_peer_t))) continue;
+        anno_peer_t peer;
+        memcpy(&peer, data.mv_data, sizeof(anno_peer_t));
+        p_used[peer.slot / 8] |= (uint8_t)(1 << (peer.slot % 8));
+    }
+    MDB_CURSOR_CLOSE(p_cursor);
+
+    uint32_t slot;
+    for (slot = 0; slot < M_ANNO_SLOT_NUM; slot++) {
+        if ((p_used[slot / 8] & (1 << (slot % 8))) == 0) break;
+    }
+    UTL_DBG_FREE(p_used);
+    if (slot == M_ANNO_SLOT_NUM) {
+        LOGE("fail: no anno_peer slot\n");
+        return -1;
+    }
+
+    pPeer->slot = (uint16_t)slot;
+    pPeer->gen = 0;
+    pPeer->mark = 0;
+    LOGD("new anno_peer(slot=%u): ", slot);
+    DUMPD(pNodeId, BTC_SZ_PUBKEY);
+    return annopeer_save(pPeer, pNodeId);
 }
 
 
-/** annoinfoからnode_idの有無を検索(channel, node共通)
+/** peerの世代を進める
  *
- * @param[in]   pMdbData
- * @param[in]   pNodeId
- * @retval  true    検出
+ * peerのannoinfo entryはすべて無効になり、送信済みかどうかはMarkで決まる。
+ *
+ * @param[in,out]   pPeer
+ * @param[in]       pNodeId
+ * @param[in]       Mark            annoinfo.seqがMark以下であれば送信済み(0:すべて未送信)
+ * @param[in]       DbiCnlannoInfo
+ * @param[in]       DbiNodeannoInfo
+ * @return      LMDB error
  */
-static bool annoinfo_search_node_id(MDB_val *pMdbData, const uint8_t *pNodeId)
-{
-    int nums = pMdbData->mv_size / BTC_SZ_PUBKEY;
-    //LOGD("nums=%d\n", nums);
-    //LOGD("search id: ");
-    //DUMPD(pNodeId, BTC_SZ_PUBKEY);
-    for (int lp = 0; lp < nums; lp++) {
-        //LOGD("  node_id[%d]= ", lp);
-        //DUMPD(pMdbData->mv_data + BTC_SZ_PUBKEY * lp, BTC_SZ_PUBKEY);
-        if (memcmp((uint8_t *)pMdbData->mv_data + BTC_SZ_PUBKEY * lp, pNodeId, BTC_SZ_PUBKEY)) continue;
-        return true;
+static int annopeer_gen_next(
+    anno_peer_t *pPeer, const uint8_t *pNodeId, uint32_t Mark,
+    MDB_dbi DbiCnlannoInfo, MDB_dbi DbiNodeannoInfo)
+{
+    pPeer->gen = (uint16_t)((pPeer->gen + 1) & M_ANNO_GEN_MASK);
+    pPeer->mark = Mark;
+    if (pPeer->gen == 0) {
+        //世代が一巡したため、同じ世代の古いentryを削除する
+        if (!annoinfos_trim_slot(pPeer->slot, DbiCnlannoInfo, DbiNodeannoInfo)) {
+            LOGE("fail: trim slot\n");
+            return -1;
+        }
     }
-    return false;
+    return annopeer_save(pPeer, pNodeId);
 }
 
 
-/** annoinfoからnode_idを削除(channel, node共通)
+/** annoinfo.seqの最終値取得
  *
- * @param[in]   pCursor
- * @param[in]   pNodeId
+ * @param[out]  pSeq        最終値(未保存時は0)
+ * @return      LMDB error
  */
-static bool annoinfo_cur_trim_node_id(MDB_cursor *pCursor, const uint8_t *pNodeId)
+static int annoinfo_seq_load(uint32_t *pSeq)
 {
-    //XXX: check error code
+    MDB_dbi dbi;
     MDB_val key, data;
 
-    while (mdb_cursor_get(pCursor, &key, &data, MDB_NEXT) == 0) {
-        if (!annoinfo_trim_node_id(&data, pNodeId)) continue;
-        if (!my_mdb_val_alloccopy(&key, &key)) {
-            UTL_DBG_FREE(data.mv_data);
-            LOGE("fail: ???\n");
-            return false;
+    *pSeq = 0;
+    int retval = anno_dbi_open(M_DBI_ANNO_PEER, 0, &dbi);
+    if (retval) {
+        return (retval == MDB_NOTFOUND) ? 0 : retval;
+    }
+    key.mv_size = LN_DB_KEY_LEN(M_KEY_ANNO_PEER_SEQ);
+    key.mv_data = M_KEY_ANNO_PEER_SEQ;
+    retval = mdb_get(M_TXN_ANNO, dbi, &key, &data);
+    if (retval == 0) {
+        if (data.mv_size == sizeof(uint32_t)) {
+            memcpy(pSeq, data.mv_data, sizeof(uint32_t));
+        }
+    } else if (retval == MDB_NOTFOUND) {
+        retval = 0;
+    } else {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+    }
+    return retval;
+}
+
+
+/** annoinfo.seqの振り直し
+ *
+ * seqが一巡すると古いmarkで新しいannouncementまで送信済みと判定されるため、
+ * 同じtransaction内で全peerのmarkを0、全annoinfoのseqを1にする。
+ * peer entryのないannouncementは未送信扱いとなり、再送される。
+ *
+ * @param[out]  pSeq        振り直し後の最終値
+ * @return      LMDB error
+ */
+static int annoinfo_seq_reset(uint32_t *pSeq)
+{
+    MDB_dbi     dbi;
+    MDB_cursor  *p_cursor;
+    MDB_val     key, data;
+
+    LOGD("reset annoinfo.seq\n");
+
+    //anno_peer: mark
+    int retval = anno_dbi_open(M_DBI_ANNO_PEER, MDB_CREATE, &dbi);
+    if (retval == 0) {
+        retval = mdb_cursor_open(mpTxnAnno, dbi, &p_cursor);
+    }
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return retval;
+    }
+    while ((retval = mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT)) == 0) {
+        if ((key.mv_size != BTC_SZ_PUBKEY) || (data.mv_size != sizeof(anno_peer_t))) continue;
+        anno_peer_t peer;
+        memcpy(&peer, data.mv_data, sizeof(anno_peer_t));
+        peer.mark = 0;
+        data.mv_data = &peer;
+        retval = mdb_cursor_put(p_cursor, &key, &data, MDB_CURRENT);
+        if (retval) {
+            break;
+        }
+    }
+    MDB_CURSOR_CLOSE(p_cursor);
+    if (retval != MDB_NOTFOUND) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return retval;
+    }
+
+    //channel_anno_sent, node_anno_sent: seq
+    const char *p_names[] = { M_DBI_CNLANNO_INFO, M_DBI_NODEANNO_INFO };
+    for (size_t lp = 0; lp < ARRAY_SIZE(p_names); lp++) {
+        retval = anno_dbi_open(p_names[lp], 0, &dbi);
+        if (retval == MDB_NOTFOUND) continue;
+        if (retval == 0) {
+            retval = mdb_cursor_open(mpTxnAnno, dbi, &p_cursor);
         }
-        int retval = mdb_cursor_put(pCursor, &key, &data, MDB_CURRENT);
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
+            return retval;
+        }
+        while ((retval = mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT)) == 0) {
+            if (data.mv_size < M_SZ_ANNOINFO_SEQ) continue;
+            uint8_t *p_buf = (uint8_t *)UTL_DBG_MALLOC(data.mv_size);
+            const uint32_t seq = 1;
+            memcpy(p_buf, &seq, sizeof(uint32_t));
+            memcpy(p_buf + M_SZ_ANNOINFO_SEQ,
+                (const uint8_t *)data.mv_data + M_SZ_ANNOINFO_SEQ,
+                data.mv_size - M_SZ_ANNOINFO_SEQ);
+            data.mv_data = p_buf;
+            retval = mdb_cursor_put(p_cursor, &key, &data, MDB_CURRENT);
+            UTL_DBG_FREE(p_buf);
+            if (retval) {
+                break;
+            }
+        }
+        MDB_CURSOR_CLOSE(p_cursor);
+        if (retval != MDB_NOTFOUND) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+            return retval;
         }
-        UTL_DBG_FREE(data.mv_data);
-        UTL_DBG_FREE(key.mv_data);
     }
-    return true; //XXX: ???
+
+    //既存のannoinfoはseq=1のため、次は2から
+    *pSeq = 1;
+    return 0;
 }
 
 
-//need free() pData->mv_data
-static bool annoinfo_trim_node_id(MDB_val *pData, const uint8_t *pNodeId)
+/** annoinfo.seqの次の値を取得・保存
+ *
+ * 最終値が一巡する場合は#annoinfo_seq_reset()で振り直してから進める。
+ *
+ * @param[out]  pSeq
+ * @return      LMDB error
+ */
+static int annoinfo_seq_next(uint32_t *pSeq)
 {
-    int nums = pData->mv_size / BTC_SZ_PUBKEY;
+    MDB_dbi dbi;
+    MDB_val key, data;
 
-    if (!nums) {
-        return false;
+    int retval = annoinfo_seq_load(pSeq);
+    if (retval) {
+        return retval;
     }
-
-    int lp;
-    for (lp = 0; lp < nums; lp++) {
-        if (memcmp((uint8_t *)pData->mv_data + BTC_SZ_PUBKEY * lp, pNodeId, BTC_SZ_PUBKEY)) continue;
-        break;
+    if (*pSeq == UINT32_MAX) {
+        retval = annoinfo_seq_reset(pSeq);
+        if (retval) {
+            return retval;
+        }
+    }
+    (*pSeq)++;
+    retval = anno_dbi_open(M_DBI_ANNO_PEER, MDB_CREATE, &dbi);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return retval;
+    }
+    key.mv_size = LN_DB_KEY_LEN(M_KEY_ANNO_PEER_SEQ);
+    key.mv_data = M_KEY_ANNO_PEER_SEQ;
+    data.mv_size = sizeof(uint32_t);
+    data.mv_data = pSeq;
+    retval = mdb_put(mpTxnAnno, dbi, &key, &data, 0);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
     }
+    return retval;
+}
 
-    if (lp == nums) {
+
+/** annoinfoでpeerへ送信済みかどうか(channel, node共通)
+ *
+ * @param[in]   pData       annoinfo
+ * @param[in]   pPeer
+ * @retval  true    送信済み
+ */
+static bool annoinfo_is_sent(const MDB_val *pData, const anno_peer_t *pPeer)
+{
+    if (pData->mv_size < M_SZ_ANNOINFO_SEQ) {
         return false;
     }
 
-    nums--;
-    if (nums) {
-        uint8_t *p_data = (uint8_t *)UTL_DBG_MALLOC(BTC_SZ_PUBKEY * nums);
-        if (!p_data) {
-            LOGE("fail: ???\n");
-            return false;
+    const uint8_t *p_data = (const uint8_t *)pData->mv_data;
+    for (size_t pos = M_SZ_ANNOINFO_SEQ; pos + M_SZ_ANNOINFO_ENTRY <= pData->mv_size; pos += M_SZ_ANNOINFO_ENTRY) {
+        uint16_t entry[2];      //slot, gen
+        memcpy(entry, p_data + pos, M_SZ_ANNOINFO_ENTRY);
+        if (entry[0] != pPeer->slot) continue;
+        if ((entry[1] & M_ANNO_GEN_MASK) != pPeer->gen) {
+            //古い世代
+            break;
         }
-        memcpy(p_data, (uint8_t *)pData->mv_data, BTC_SZ_PUBKEY * lp);
-        memcpy(p_data + BTC_SZ_PUBKEY * lp,
-            (uint8_t *)pData->mv_data + BTC_SZ_PUBKEY * (lp + 1), BTC_SZ_PUBKEY * (nums - lp));
+        return (entry[1] & M_ANNO_GEN_UNSENT) == 0;
+    }
+
+    uint32_t seq;
+    memcpy(&seq, p_data, sizeof(uint32_t));
+    return (seq != 0) && (seq <= pPeer->mark);
+}
+
+
+/** annoinfoのpeer entry更新(channel, node共通)
+ *
+ * @param[in]   Dbi
+ * @param[in]   pKey
+ * @param[in]   pPeer       更新するpeer(NULL時はbClearのみ)
+ * @param[in]   bSent       true:送信済み, false:未送信
+ * @param[in]   bClear      true:announcementが更新されたため、すべてのpeerを未送信にしてから更新する
+ * @return      LMDB error
+ */
+static int annoinfo_set(MDB_dbi Dbi, MDB_val *pKey, const anno_peer_t *pPeer, bool bSent, bool bClear)
+{
+    MDB_val     data;
+    uint32_t    seq;
 
-        pData->mv_size = BTC_SZ_PUBKEY * nums;
-        pData->mv_data = p_data;
+    int retval = mdb_get(mpTxnAnno, Dbi, pKey, &data);
+    if (retval == MDB_NOTFOUND) {
+        data.mv_size = 0;
+    } else if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return retval;
+    }
+    if (data.mv_size < M_SZ_ANNOINFO_SEQ) {
+        //新規
+        bClear = true;
+    }
+    if (!bClear && pPeer && (annoinfo_is_sent(&data, pPeer) == bSent)) {
+        //変化なし
+        return 0;
+    }
+
+    if (bClear) {
+        //未送信のpeerとするため、seqを更新する
+        retval = annoinfo_seq_next(&seq);
+        if (retval) {
+            return retval;
+        }
     } else {
-        pData->mv_size = 0;
-        pData->mv_data = NULL;
+        memcpy(&seq, data.mv_data, sizeof(uint32_t));
     }
-    return true;
+
+    uint8_t *p_buf = (uint8_t *)UTL_DBG_MALLOC(data.mv_size + M_SZ_ANNOINFO_SEQ + M_SZ_ANNOINFO_ENTRY);
+    size_t len = M_SZ_ANNOINFO_SEQ;
+    memcpy(p_buf, &seq, sizeof(uint32_t));
+    if (!bClear) {
+        const uint8_t *p_data = (const uint8_t *)data.mv_data;
+        for (size_t pos = M_SZ_ANNOINFO_SEQ; pos + M_SZ_ANNOINFO_ENTRY <= data.mv_size; pos += M_SZ_ANNOINFO_ENTRY) {
+            uint16_t slot;
+            memcpy(&slot, p_data + pos, sizeof(uint16_t));
+            if (pPeer && (slot == pPeer->slot)) continue;
+            memcpy(p_buf + len, p_data + pos, M_SZ_ANNOINFO_ENTRY);
+            len += M_SZ_ANNOINFO_ENTRY;
+        }
+    }
+    if (pPeer && !(bClear && !bSent)) {
+        //bClear時は新しいseqのため、未送信entryは不要
+        uint16_t entry[2];
+        entry[0] = pPeer->slot;
+        entry[1] = (uint16_t)(pPeer->gen | ((bSent) ? 0 : M_ANNO_GEN_UNSENT));
+        memcpy(p_buf + len, entry, M_SZ_ANNOINFO_ENTRY);
+        len += M_SZ_ANNOINFO_ENTRY;
+    }
+    data.mv_size = len;
+    data.mv_data = p_buf;
+    retval = mdb_put(mpTxnAnno, Dbi, pKey, &data, 0);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+    }
+    UTL_DBG_FREE(p_buf);
+    return retval;
 }
 
 
-/** annoinfoにnode_idを追加(channel, node共通)
+/** 登録済みannoinfoのpeer entry更新(channel, node共通)
+ *
+ * @return      LMDB error(MDB_NOTFOUND:annoinfoなし)
+ */
+static int annoinfo_set_exist(MDB_dbi Dbi, MDB_val *pKey, const anno_peer_t *pPeer, bool bSent)
+{
+    MDB_val data;
+
+    int retval = mdb_get(mpTxnAnno, Dbi, pKey, &data);
+    if (retval) {
+        return retval;
+    }
+    return annoinfo_set(Dbi, pKey, pPeer, bSent, false);
+}
+
+
+/** annoinfoから指定slotのentryを削除(channel, node共通)
  *
  * @param[in]   pCursor
- * @param[in]   pNodeId
+ * @param[in]   Slot
+ * @retval  true    成功
  */
-static void annoinfo_cur_add(MDB_cursor *pCursor, const uint8_t *pNodeId)
+static bool annoinfo_cur_trim_slot(MDB_cursor *pCursor, uint16_t Slot)
 {
-    //XXX: check error code
-    MDB_val     key, data;
+    MDB_val key, data;
+    int     retval;
 
-    while (mdb_cursor_get(pCursor, &key, &data, MDB_NEXT) == 0) {
-        int nums = data.mv_size / BTC_SZ_PUBKEY;
-        int lp;
-        for (lp = 0; lp < nums; lp++) {
-            if (memcmp((uint8_t *)data.mv_data + BTC_SZ_PUBKEY * lp, pNodeId, BTC_SZ_PUBKEY)) continue;
-            break;
+    while ((retval = mdb_cursor_get(pCursor, &key, &data, MDB_NEXT)) == 0) {
+        if (data.mv_size < M_SZ_ANNOINFO_SEQ) continue;
+
+        const uint8_t *p_data = (const uint8_t *)data.mv_data;
+        uint8_t *p_buf = NULL;
+        size_t len = M_SZ_ANNOINFO_SEQ;
+        for (size_t pos = M_SZ_ANNOINFO_SEQ; pos + M_SZ_ANNOINFO_ENTRY <= data.mv_size; pos += M_SZ_ANNOINFO_ENTRY) {
+            uint16_t slot;
+            memcpy(&slot, p_data + pos, sizeof(uint16_t));
+            if (slot == Slot) {
+                if (!p_buf) {
+                    p_buf = (uint8_t *)UTL_DBG_MALLOC(data.mv_size);
+                    memcpy(p_buf, p_data, pos);
+                    len = pos;
+                }
+                continue;
+            }
+            if (p_buf) {
+                memcpy(p_buf + len, p_data + pos, M_SZ_ANNOINFO_ENTRY);
+            }
+            len += M_SZ_ANNOINFO_ENTRY;
         }
-        if (lp < nums) continue;
+        if (!p_buf) continue;
 
         if (!my_mdb_val_alloccopy(&key, &key)) {
-            LOGE("fail: ???");
-            break;
-        }
-        nums++;
-        uint8_t *p_data = (uint8_t *)UTL_DBG_MALLOC(BTC_SZ_PUBKEY * nums);
-        if (!p_data) {
-            UTL_DBG_FREE(key.mv_data);
-            LOGE("fail: ???");
-            break;
+            UTL_DBG_FREE(p_buf);
+            LOGE("fail: ???\n");
+            return false;
         }
-        memcpy(p_data, data.mv_data, data.mv_size);
-        memcpy(p_data + data.mv_size, pNodeId, BTC_SZ_PUBKEY);
-        data.mv_size = BTC_SZ_PUBKEY * nums;
-        data.mv_data = p_data;
-        int retval = mdb_cursor_put(pCursor, &key, &data, MDB_CURRENT);
+        data.mv_size = len;
+        data.mv_data = p_buf;
+        retval = mdb_cursor_put(pCursor, &key, &data, MDB_CURRENT);
+        UTL_DBG_FREE(p_buf);
+        UTL_DBG_FREE(key.mv_data);
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
+            return false;
         }
-        UTL_DBG_FREE(data.mv_data);
-        UTL_DBG_FREE(key.mv_data);
     }
+    if (retval != MDB_NOTFOUND) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return false;
+    }
+    return true;
 }
 
 
@@ -5715,24 +6996,30 @@ static void anno_del_prune(void)
  * private functions: preimage
  ********************************************************************/
 
-static bool preimage_open(ln_lmdb_db_t *pDb, MDB_txn *pTxn)
+static bool preimage_open(preimage_db_t *pDb, MDB_txn *pTxn)
 {
     int retval;
 
     if (pTxn) {
-        pDb->p_txn = pTxn;
+        pDb->db.p_txn = pTxn;
     } else {
-        retval = MDB_TXN_BEGIN(mpEnvNode, NULL, 0, &pDb->p_txn);
+        retval = MDB_TXN_BEGIN(mpEnvNode, NULL, 0, &pDb->db.p_txn);
         if (retval) {
             LOGE("ERR: %s\n", mdb_strerror(retval));
             return false;
         }
     }
-    retval = MDB_DBI_OPEN(pDb->p_txn, M_DBI_PREIMAGE, MDB_CREATE, &pDb->dbi);
+    retval = MDB_DBI_OPEN(pDb->db.p_txn, M_DBI_PREIMAGE, MDB_CREATE, &pDb->db.dbi);
+    if (retval == 0) {
+        retval = MDB_DBI_OPEN(pDb->db.p_txn, M_DBI_PREIMAGE_HASH, MDB_CREATE, &pDb->dbi_hash);
+    }
+    if (retval == 0) {
+        retval = MDB_DBI_OPEN(pDb->db.p_txn, M_DBI_PREIMAGE_EXPIRE, MDB_CREATE, &pDb->dbi_expire);
+    }
     if (retval) {
         LOGE("ERR: %s\n", mdb_strerror(retval));
         if (!pTxn) {
-            MDB_TXN_ABORT(pDb->p_txn);
+            MDB_TXN_ABORT(pDb->db.p_txn);
         }
         return false;
     }
@@ -5740,68 +7027,151 @@ static bool preimage_open(ln_lmdb_db_t *pDb, MDB_txn *pTxn)
 }
 
 
-static void preimage_close(ln_lmdb_db_t *pDb, bool bCommit)
+static void preimage_close(preimage_db_t *pDb, bool bCommit)
 {
     if (bCommit) {
-        MDB_TXN_COMMIT(pDb->p_txn);
+        MDB_TXN_COMMIT(pDb->db.p_txn);
     } else {
-        MDB_TXN_ABORT(pDb->p_txn);
+        MDB_TXN_ABORT(pDb->db.p_txn);
     }
 }
 
 
-/** #ln_db_preimage_del_hash()用処理関数
+/** preimageとindexの削除
  *
- * SHA256(preimage)がpayment_hashと一致した場合にDBから削除する。
+ * @param[in,out]   pDb
+ * @param[in]       pPreimage
+ * @retval  0               成功
+ * @retval  MDB_NOTFOUND    preimageが無い
  */
-static bool preimage_cmp_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam)
+static int preimage_del(preimage_db_t *pDb, const uint8_t *pPreimage)
 {
-    (void)Amount; (void)Expiry;
+    int             retval;
+    MDB_val         key, data;
+    preimage_info_t info;
 
-    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pDbParam;
-    const uint8_t *hash = (const uint8_t *)pParam;
-    uint8_t preimage_hash[BTC_SZ_HASH256];
+    key.mv_size = LN_SZ_PREIMAGE;
+    key.mv_data = (CONST_CAST uint8_t *)pPreimage;
+    retval = mdb_get(pDb->db.p_txn, pDb->db.dbi, &key, &data);
+    if (retval) {
+        return retval;
+    }
+    if (data.mv_size < sizeof(preimage_info_t)) {
+        LOGE("fail: invalid data length: %lu\n", data.mv_size);
+        return -1;
+    }
+    memcpy(&info, data.mv_data, sizeof(info));      //bolt11は使わない
 
-    //LOGD("compare preimage : ");
-    //DUMPD(pPreimage, LN_SZ_PREIMAGE);
-    LOGD("compare preimage\n");
-    ln_payment_hash_calc(preimage_hash, pPreimage);
+    retval = preimage_index_del(pDb, pPreimage, &info);
+    if (retval == 0) {
+        retval = mdb_del(pDb->db.p_txn, pDb->db.dbi, &key, NULL);
+    }
+    return retval;
+}
 
-    if (memcmp(preimage_hash, hash, BTC_SZ_HASH256)) {
-        LOGD("  not found");
-        return false;
+
+/** index追加
+ *
+ * @param[in,out]   pDb
+ * @param[in]       pPreimage
+ * @param[in]       pInfo       [preimage]に保存するデータ
+ * @retval  0       成功
+ */
+static int preimage_index_put(preimage_db_t *pDb, const uint8_t *pPreimage, const preimage_info_t *pInfo)
+{
+    int         retval;
+    MDB_val     key, data;
+    uint8_t     hash[BTC_SZ_HASH256];
+    uint8_t     key_data[M_SZ_PREIMAGE_EXPIRE_KEY];
+
+    ln_payment_hash_calc(hash, pPreimage);
+    key.mv_size = BTC_SZ_HASH256;
+    key.mv_data = hash;
+    data.mv_size = LN_SZ_PREIMAGE;
+    data.mv_data = (CONST_CAST uint8_t *)pPreimage;
+    retval = mdb_put(pDb->db.p_txn, pDb->dbi_hash, &key, &data, 0);
+    if (retval) {
+        return retval;
     }
 
-    int retval = mdb_cursor_del(p_cur->p_cursor, 0);
-    LOGD("  remove from DB: %s\n", mdb_strerror(retval));
-    return retval == 0;
+    if (pInfo->state == LN_DB_PREIMAGE_STATE_UNUSED) {
+        preimage_expire_key(key_data, &key, pPreimage, pInfo);
+        data.mv_size = 0;
+        data.mv_data = NULL;
+        retval = mdb_put(pDb->db.p_txn, pDb->dbi_expire, &key, &data, 0);
+    }
+    return retval;
+}
+
+
+/** index削除
+ *
+ * indexが無い場合も成功とする。
+ *
+ * @param[in,out]   pDb
+ * @param[in]       pPreimage
+ * @param[in]       pInfo       [preimage]に保存されているデータ
+ * @retval  0       成功
+ */
+static int preimage_index_del(preimage_db_t *pDb, const uint8_t *pPreimage, const preimage_info_t *pInfo)
+{
+    int         retval;
+    MDB_val     key;
+    uint8_t     hash[BTC_SZ_HASH256];
+    uint8_t     key_data[M_SZ_PREIMAGE_EXPIRE_KEY];
+
+    ln_payment_hash_calc(hash, pPreimage);
+    key.mv_size = BTC_SZ_HASH256;
+    key.mv_data = hash;
+    retval = mdb_del(pDb->db.p_txn, pDb->dbi_hash, &key, NULL);
+    if ((retval != 0) && (retval != MDB_NOTFOUND)) {
+        return retval;
+    }
+
+    preimage_expire_key(key_data, &key, pPreimage, pInfo);
+    retval = mdb_del(pDb->db.p_txn, pDb->dbi_expire, &key, NULL);
+    if (retval == MDB_NOTFOUND) {
+        retval = 0;
+    }
+    return retval;
 }
 
 
-/** ln_db_channel_del_param用処理関数
+/** [preimage_expire]のkey作成
  *
- * SHA256(preimage)がpayment_hashと一致した場合、DBから削除する。
+ * @param[out]      pKeyData    #M_SZ_PREIMAGE_EXPIRE_KEY
+ * @param[out]      pKey        pKeyDataを指す
+ * @param[in]       pPreimage
+ * @param[in]       pInfo
  */
-static bool preimage_cmp_all_func(const uint8_t *pPreimage, uint64_t Amount, uint32_t Expiry, void *pDbParam, void *pParam)
+static void preimage_expire_key(uint8_t *pKeyData, MDB_val *pKey, const uint8_t *pPreimage, const preimage_info_t *pInfo)
 {
-    (void)Amount; (void)Expiry;
+    utl_int_unpack_u64be(pKeyData, pInfo->creation + pInfo->expiry);
+    memcpy(pKeyData + sizeof(uint64_t), pPreimage, LN_SZ_PREIMAGE);
+    pKey->mv_size = M_SZ_PREIMAGE_EXPIRE_KEY;
+    pKey->mv_data = pKeyData;
+}
 
-    lmdb_cursor_t *p_cur = (lmdb_cursor_t *)pDbParam;
-    preimage_close_t *param = (preimage_close_t *)pParam;
-    uint8_t preimage_hash[BTC_SZ_HASH256];
 
-    //LOGD("compare preimage : ");
-    //DUMPD(pPreimage, LN_SZ_PREIMAGE);
-    LOGD("compare preimage\n");
-    ln_payment_hash_calc(preimage_hash, pPreimage);
+/** DBのpreimage情報を#ln_db_preimage_tに変換
+ *
+ * 未使用で期限が過ぎていれば#LN_DB_PREIMAGE_STATE_EXPIREにする。
+ */
+static void preimage_info_get(ln_db_preimage_t *pPreimage, const uint8_t *pKey, const preimage_info_t *pInfo)
+{
+    uint64_t now = (uint64_t)utl_time_time();
 
-    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
-        if (memcmp(preimage_hash, param->p_htlcs[lp].payment_hash, BTC_SZ_HASH256)) continue;
-        //match
-        int retval = mdb_cursor_del(p_cur->p_cursor, 0);
-        LOGD("  remove from DB: %s\n", mdb_strerror(retval));
+    memcpy(pPreimage->preimage, pKey, LN_SZ_PREIMAGE);
+    pPreimage->expiry = pInfo->expiry;
+    pPreimage->creation_time = pInfo->creation;
+    pPreimage->amount_msat = pInfo->amount;
+    pPreimage->state = (ln_db_preimage_state_t)pInfo->state;
+    if (now > pInfo->creation + pInfo->expiry) {
+        //expired
+        if (pPreimage->state == LN_DB_PREIMAGE_STATE_UNUSED) {
+            pPreimage->state = LN_DB_PREIMAGE_STATE_EXPIRE;
+        }
     }
-    return false; //continue
 }
 
 
@@ -5946,6 +7316,30 @@ static int version_check(ln_lmdb_db_t *pDb, int32_t *pVer, char *pWif, char *pNo
                     *pVer = -71;
                 }
             }
+            if ((*pVer == -71) && (LN_DB_VERSION <= -72)) {
+                auto_update &= auto_update_71_to_72(pDb->p_txn);
+                if (auto_update) {
+                    *pVer = -72;
+                }
+            }
+            if ((*pVer == -72) && (LN_DB_VERSION <= -73)) {
+                auto_update &= auto_update_72_to_73(pDb->p_txn);
+                if (auto_update) {
+                    *pVer = -73;
+                }
+            }
+            if ((*pVer == -73) && (LN_DB_VERSION <= -74)) {
+                auto_update &= auto_update_73_to_74();
+                if (auto_update) {
+                    *pVer = -74;
+                }
+            }
+            if ((*pVer == -74) && (LN_DB_VERSION <= -75)) {
+                auto_update &= auto_update_74_to_75();
+                if (auto_update) {
+                    *pVer = -75;
+                }
+            }
         }
         if (!auto_update) {
             fprintf(stderr, "FAIL\n\n");
@@ -6664,7 +8058,7 @@ static int fixed_items_save(const void *pData, ln_lmdb_db_t *pDb, const fixed_it
         key.mv_data = (CONST_CAST char *)pItems[lp].p_name;
         data.mv_size = pItems[lp].data_len;
         data.mv_data = (CONST_CAST uint8_t *)pData + pItems[lp].offset;
-        retval = mdb_put(pDb->p_txn, pDb->dbi, &key, &data, 0);
+        retval = put_if_changed(pDb->p_txn, pDb->dbi, &key, &data);
         if (retval) {
             LOGE("fail: %s\n", mdb_strerror(retval));
             LOGE("fail: %s\n", pItems[lp].p_name);
@@ -6676,6 +8070,29 @@ static int fixed_items_save(const void *pData, ln_lmdb_db_t *pDb, const fixed_it
 }
 
 
+/** 値が変わった場合だけmdb_put()する
+ *
+ * LMDBは書込みのたびにpageをコピーするため、同じ値の書込みを省く。
+ *
+ * @param[in]       pTxn
+ * @param[in]       Dbi
+ * @param[in]       pKey
+ * @param[in]       pData
+ * @retval      0   成功
+ */
+static int put_if_changed(MDB_txn *pTxn, MDB_dbi Dbi, MDB_val *pKey, MDB_val *pData)
+{
+    MDB_val data;
+    int retval = mdb_get(pTxn, Dbi, pKey, &data);
+    if ( (retval == 0) &&
+         (data.mv_size == pData->mv_size) &&
+         ((pData->mv_size == 0) || (memcmp(data.mv_data, pData->mv_data, pData->mv_size) == 0)) ) {
+        return 0;
+    }
+    return mdb_put(pTxn, Dbi, pKey, pData, 0);
+}
+
+
 /********************************************************************
  * private functions: initialize
  ********************************************************************/
@@ -6953,3 +8370,377 @@ static bool auto_update_70_to_71(void)
     LOGD("\n");
     return true;
 }
+
+
+/** auto update: -71 ==> -72
+ *
+    -72: HTLC DB: "HT" + channel_id + "ddd"(DB per HTLC index) ==> "HT" + channel_id(key: HTLC index)
+ *
+ * @param[in,out]   pTxn        channel env
+ */
+static bool auto_update_71_to_72(MDB_txn *pTxn)
+{
+    LOGD("\n");
+
+    bool            ret = false;
+    int             retval;
+    uint8_t         *p_chan_ids = NULL;
+    size_t          chan_num = 0;
+    char            db_name[M_SZ_CHANNEL_DB_NAME_STR + M_SZ_HTLC_IDX_STR + 1];
+
+    if (!auto_update_channel_db_names(pTxn, &p_chan_ids, &chan_num)) {
+        goto LABEL_EXIT;
+    }
+
+    for (size_t lp = 0; lp < chan_num; lp++) {
+        MDB_dbi dbi_htlc;
+
+        memcpy(db_name, p_chan_ids + M_SZ_CHANNEL_DB_NAME_STR * lp, M_SZ_CHANNEL_DB_NAME_STR);
+        memcpy(db_name, M_PREF_HTLC, M_SZ_PREF_STR);
+        db_name[M_SZ_CHANNEL_DB_NAME_STR] = '\0';
+        retval = MDB_DBI_OPEN(pTxn, db_name, MDB_CREATE, &dbi_htlc);
+        if (retval) {
+            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
+            goto LABEL_EXIT;
+        }
+        LOGD("convert: %s\n", db_name);
+
+        for (uint16_t idx = 0; idx < LN_HTLC_MAX; idx++) {
+            MDB_dbi dbi_old;
+            ln_htlc_t htlc;
+
+            channel_htlc_db_name(db_name, idx);
+            retval = MDB_DBI_OPEN(pTxn, db_name, 0, &dbi_old);
+            if (retval) {
+                continue;
+            }
+            memset(&htlc, 0, sizeof(htlc));
+            retval = channel_htlc_legacy_load(&htlc, pTxn, dbi_old);
+            if (retval == 0) {
+                retval = htlc_record_save(pTxn, dbi_htlc, idx, &htlc);
+            }
+            utl_buf_free(&htlc.buf_preimage);
+            utl_buf_free(&htlc.buf_onion_reason);
+            utl_buf_free(&htlc.buf_shared_secret);
+            if (retval == 0) {
+                retval = mdb_drop(pTxn, dbi_old, 1);
+            }
+            if (retval) {
+                LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
+                goto LABEL_EXIT;
+            }
+        }
+    }
+    ret = true;
+
+LABEL_EXIT:
+    UTL_DBG_FREE(p_chan_ids);
+    return ret;
+}
+
+
+/** auto update: -72 ==> -73
+ *
+    -73: channel DB: key per item ==> 1 data("channel")
+ *
+ * @param[in,out]   pTxn        channel env
+ */
+static bool auto_update_72_to_73(MDB_txn *pTxn)
+{
+    LOGD("\n");
+
+    bool            ret = false;
+    int             retval;
+    uint8_t         *p_chan_ids = NULL;
+    size_t          chan_num = 0;
+    char            db_name[M_SZ_CHANNEL_DB_NAME_STR + 1];
+    ln_channel_t    *p_channel = NULL;
+    MDB_val         key, data;
+
+    if (!auto_update_channel_db_names(pTxn, &p_chan_ids, &chan_num)) {
+        goto LABEL_EXIT;
+    }
+    p_channel = (ln_channel_t *)UTL_DBG_MALLOC(sizeof(ln_channel_t));
+    if (!p_channel) {
+        LOGE("fail: ???\n");
+        goto LABEL_EXIT;
+    }
+
+    for (size_t lp = 0; lp < chan_num; lp++) {
+        ln_lmdb_db_t    db;
+        utl_buf_t       buf_fund_tx = UTL_BUF_INIT;
+        utl_buf_t       buf = UTL_BUF_INIT;
+
+        memcpy(db_name, p_chan_ids + M_SZ_CHANNEL_DB_NAME_STR * lp, M_SZ_CHANNEL_DB_NAME_STR);
+        db_name[M_SZ_CHANNEL_DB_NAME_STR] = '\0';
+        db.p_txn = pTxn;
+        retval = MDB_DBI_OPEN(pTxn, db_name, 0, &db.dbi);
+        if (retval) {
+            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
+            goto LABEL_EXIT;
+        }
+        key.mv_size = M_SZ_CHANNEL;
+        key.mv_data = M_KEY_CHANNEL;
+        if (mdb_get(pTxn, db.dbi, &key, &data) == 0) {
+            LOGD("already converted: %s\n", db_name);
+            continue;
+        }
+        LOGD("convert: %s\n", db_name);
+
+        memset(p_channel, 0, sizeof(ln_channel_t));
+        retval = channel_legacy_load(p_channel, &db, &buf_fund_tx);
+        if (retval == 0) {
+            if (!channel_record_write(&buf, p_channel, &buf_fund_tx)) {
+                retval = -1;
+            }
+        }
+        utl_buf_free(&buf_fund_tx);
+        utl_buf_free(&p_channel->shutdown_scriptpk_local);
+        utl_buf_free(&p_channel->shutdown_scriptpk_remote);
+        if (retval == 0) {
+            //channel DBは全itemを1つのデータにまとめる
+            retval = mdb_drop(pTxn, db.dbi, 0);
+        }
+        if (retval == 0) {
+            key.mv_size = M_SZ_CHANNEL;
+            key.mv_data = M_KEY_CHANNEL;
+            data.mv_size = buf.len;
+            data.mv_data = buf.buf;
+            retval = mdb_put(pTxn, db.dbi, &key, &data, 0);
+        }
+        utl_buf_free(&buf);
+        if (retval) {
+            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), db_name);
+            goto LABEL_EXIT;
+        }
+    }
+    ret = true;
+
+LABEL_EXIT:
+    UTL_DBG_FREE(p_channel);
+    UTL_DBG_FREE(p_chan_ids);
+    return ret;
+}
+
+
+/** auto update: -73 ==> -74
+ *
+    -74: node/preimage: add index DB [preimage_hash], [preimage_expire]
+ */
+static bool auto_update_73_to_74(void)
+{
+    LOGD("\n");
+
+    bool            ret = false;
+    int             retval;
+    preimage_db_t   db;
+    MDB_cursor      *p_cursor = NULL;
+    MDB_val         key, data;
+    uint8_t         preimage[LN_SZ_PREIMAGE];
+    preimage_info_t info;
+    uint32_t        num = 0;
+
+    if (!preimage_open(&db, NULL)) {
+        return false;
+    }
+    retval = mdb_cursor_open(db.db.p_txn, db.db.dbi, &p_cursor);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    while ((retval = mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT_NODUP)) == 0) {
+        if ((key.mv_size != LN_SZ_PREIMAGE) || (data.mv_size < sizeof(preimage_info_t))) {
+            LOGE("fail: invalid preimage data\n");
+            goto LABEL_EXIT;
+        }
+        memcpy(preimage, key.mv_data, LN_SZ_PREIMAGE);
+        memcpy(&info, data.mv_data, sizeof(info));
+        retval = preimage_index_put(&db, preimage, &info);
+        if (retval) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+            goto LABEL_EXIT;
+        }
+        num++;
+    }
+    if (retval != MDB_NOTFOUND) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    LOGD("preimage index: %" PRIu32 "\n", num);
+    ret = true;
+
+LABEL_EXIT:
+    if (p_cursor) {
+        MDB_CURSOR_CLOSE(p_cursor);
+    }
+    preimage_close(&db, ret);
+    return ret;
+}
+
+
+
+/** auto update: -74 ==> -75
+ *
+    -75: anno DB: "channel_anno_info", "node_anno_info"(node_id配列)
+                    -> "channel_anno_sent", "node_anno_sent"(peer slot) + "anno_peer"
+ */
+static bool auto_update_74_to_75(void)
+{
+    LOGD("\n");
+
+    const char *OLD_NAMES[] = { M_DBI_CNLANNO_INFO_OLD, M_DBI_NODEANNO_INFO_OLD };
+    const char *NEW_NAMES[] = { M_DBI_CNLANNO_INFO, M_DBI_NODEANNO_INFO };
+    bool            ret = false;
+    int             retval;
+    MDB_cursor      *p_cursor = NULL;
+    MDB_val         key, data;
+
+    //ln_db_init()中でmMuxAnnoは未初期化のため、直接transactionを開始する
+    retval = MDB_TXN_BEGIN(mpEnvAnno, NULL, 0, &mpTxnAnno);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        mpTxnAnno = NULL;
+        return false;
+    }
+
+    for (size_t lp = 0; lp < ARRAY_SIZE(OLD_NAMES); lp++) {
+        MDB_dbi     dbi_old;
+        MDB_dbi     dbi_new;
+        uint32_t    num = 0;
+
+        retval = MDB_DBI_OPEN(mpTxnAnno, OLD_NAMES[lp], 0, &dbi_old);
+        if (retval == MDB_NOTFOUND) {
+            //旧DBなし
+            continue;
+        }
+        if (retval == 0) {
+            retval = anno_dbi_open(NEW_NAMES[lp], MDB_CREATE, &dbi_new);
+        }
+        if (retval == 0) {
+            retval = mdb_cursor_open(mpTxnAnno, dbi_old, &p_cursor);
+        }
+        if (retval) {
+            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), OLD_NAMES[lp]);
+            goto LABEL_EXIT;
+        }
+        while ((retval = mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT)) == 0) {
+            //新DBへの書込みで参照先が変わらないよう、コピーしておく
+            MDB_val key_copy, data_copy;
+            if (!my_mdb_val_alloccopy(&key_copy, &key)) {
+                LOGE("fail: alloc\n");
+                goto LABEL_EXIT;
+            }
+            if (!my_mdb_val_alloccopy(&data_copy, &data)) {
+                LOGE("fail: alloc\n");
+                UTL_DBG_FREE(key_copy.mv_data);
+                goto LABEL_EXIT;
+            }
+            for (size_t pos = 0; pos + BTC_SZ_PUBKEY <= data_copy.mv_size; pos += BTC_SZ_PUBKEY) {
+                anno_peer_t peer;
+                const uint8_t *p_node_id = (const uint8_t *)data_copy.mv_data + pos;
+                retval = annopeer_get(&peer, p_node_id);
+                if (retval == 0) {
+                    retval = annoinfo_set(dbi_new, &key_copy, &peer, true, false);
+                }
+                if (retval) {
+                    break;
+                }
+            }
+            UTL_DBG_FREE(data_copy.mv_data);
+            UTL_DBG_FREE(key_copy.mv_data);
+            if (retval) {
+                LOGE("ERR: %s(%s)\n", mdb_strerror(retval), NEW_NAMES[lp]);
+                goto LABEL_EXIT;
+            }
+            num++;
+        }
+        if (retval != MDB_NOTFOUND) {
+            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), OLD_NAMES[lp]);
+            goto LABEL_EXIT;
+        }
+        MDB_CURSOR_CLOSE(p_cursor);
+        p_cursor = NULL;
+
+        retval = mdb_drop(mpTxnAnno, dbi_old, 1);
+        if (retval) {
+            LOGE("ERR: %s(%s)\n", mdb_strerror(retval), OLD_NAMES[lp]);
+            goto LABEL_EXIT;
+        }
+        LOGD("%s: %" PRIu32 "\n", NEW_NAMES[lp], num);
+    }
+    ret = true;
+
+LABEL_EXIT:
+    if (p_cursor) {
+        MDB_CURSOR_CLOSE(p_cursor);
+    }
+    if (ret) {
+        retval = my_mdb_txn_commit(mpTxnAnno, __LINE__);
+        if (retval) {
+            LOGE("ERR: %s\n", mdb_strerror(retval));
+            ret = false;
+        }
+    } else {
+        MDB_TXN_ABORT(mpTxnAnno);
+    }
+    mpTxnAnno = NULL;
+    return ret;
+}
+
+/** auto update: channel DB名("CN" + channel_id)一覧
+ *
+ * DB名の列挙中にDBを作成/削除しないよう、先に集める。
+ *
+ * @param[in]       pTxn            channel env
+ * @param[out]      ppNames         M_SZ_CHANNEL_DB_NAME_STR * (*pNum)(呼び元でUTL_DBG_FREE()する)
+ * @param[out]      pNum
+ */
+static bool auto_update_channel_db_names(MDB_txn *pTxn, uint8_t **ppNames, size_t *pNum)
+{
+    bool            ret = false;
+    int             retval;
+    MDB_dbi         dbi;
+    MDB_cursor      *p_cursor = NULL;
+    MDB_val         key, data;
+
+    *ppNames = NULL;
+    *pNum = 0;
+
+    retval = MDB_DBI_OPEN(pTxn, NULL, 0, &dbi);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return false;
+    }
+    retval = mdb_cursor_open(pTxn, dbi, &p_cursor);
+    if (retval) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        return false;
+    }
+    while ((retval = mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT_NODUP)) == 0) {
+        if ( (key.mv_size != M_SZ_CHANNEL_DB_NAME_STR) ||
+             (memcmp(key.mv_data, M_PREF_CHANNEL, M_SZ_PREF_STR) != 0) ) {
+            continue;
+        }
+        uint8_t *p = (uint8_t *)UTL_DBG_REALLOC(*ppNames, M_SZ_CHANNEL_DB_NAME_STR * (*pNum + 1));
+        if (!p) {
+            LOGE("fail: ???\n");
+            goto LABEL_EXIT;
+        }
+        *ppNames = p;
+        memcpy(*ppNames + M_SZ_CHANNEL_DB_NAME_STR * (*pNum), key.mv_data, M_SZ_CHANNEL_DB_NAME_STR);
+        (*pNum)++;
+    }
+    if (retval != MDB_NOTFOUND) {
+        LOGE("ERR: %s\n", mdb_strerror(retval));
+        goto LABEL_EXIT;
+    }
+    ret = true;
+
+LABEL_EXIT:
+    MDB_CURSOR_CLOSE(p_cursor);
+    if (!ret) {
+        UTL_DBG_FREE(*ppNames);
+        *pNum = 0;
+    }
+    return ret;
+}
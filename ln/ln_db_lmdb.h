@@ -25,8 +25,13 @@
  *      - environment/dbi
  *          -# channel
  *              -# "CN" + channel_id
+ *                  - key: "channel"
+ *                  - data: version + ln_channel_t items(DBCHANNEL_VALUES) + funding_tx + shutdown scriptPubKeys
  *              -# "SE" + channel_id
- *              -# "HT" + channel_id + "ddd"(0 - LN_HTLC_MAX-1)
+ *              -# "HT" + channel_id
+ *                  - key: htlc index(uint16_t big endian, 0 - LN_HTLC_MAX-1)
+ *                  - data: version + ln_htlc_t(except neighbor)
+ *                  - memo: empty htlc is not saved.
  *              -# "RV" + channel_id
  *              -# "cn" + channel_id
  *              -# "version"
@@ -38,19 +43,23 @@
  *                      - SUFFIX='B': channel_update(lower node_id)
  *                      - SUFFIX='C': channel_update(upper node_id)
  *                  - usage: save announcement packet.
- *              -# "channel_anno_info"
+ *              -# "channel_anno_sent"
  *                  - key: short_channel_id + SUFFIX("A" or "B" or "C")
- *                  - data: receiving/sending node_ids
+ *                  - data: seq + receiving/sending peer slots
  *                  - usage: check already sent.
  *              -# "node_anno"
  *                  - key: node_id
  *                  - data: timestamp + node_announcement packet
  *                  - usage: save node_announcement packet(including own node)
  *                  - memo: skip if "channal_anno_recv" not registered.
- *              -# "node_anno_info"
+ *              -# "node_anno_sent"
  *                  - key: node_id
- *                  - data: receiving/sending node_ids
+ *                  - data: seq + receiving/sending peer slots
  *                  - usage: check already sent.
+ *              -# "anno_peer"
+ *                  - key: node_id
+ *                  - data: peer slot + generation + mark
+ *                  - usage: peer slots of "channel_anno_sent" and "node_anno_sent".
  *              -# "channal_anno_recv"
  *                  - key: node_id(channel_announcement's node_id_1 and node_id_2)
  *                  - data: (none)
@@ -176,6 +185,7 @@ typedef enum {
     LN_LMDB_DB_TYPE_ROUTE,
     LN_LMDB_DB_TYPE_PAYMENT_INVOICE,
     LN_LMDB_DB_TYPE_PAYMENT_INFO,
+    LN_LMDB_DB_TYPE_ROUTE_CAND,
 } ln_lmdb_db_type_t;
 
 
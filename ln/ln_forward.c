@@ -0,0 +1,204 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_forward.c
+ *  @brief  HTLC転送通知
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "utl_common.h"
+#include "utl_dbg.h"
+#define LOG_TAG "ln_forward"
+#include "utl_log.h"
+#include "utl_time.h"
+
+#include "ln_forward.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_ENTRY_INIT            (8)         ///< 初期要素数
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+typedef struct {
+    uint64_t                short_channel_id;
+    uint8_t                 pending;            ///< LN_FORWARD_xxx
+    time_t                  checked[2];         ///< 最後に通知ありとした時刻([0]add, [1]del)
+    ln_forward_wakeup_t     p_func;
+    void                    *p_param;
+} forward_entry_t;
+
+
+/**************************************************************************
+ * private variables
+ **************************************************************************/
+
+static pthread_mutex_t  mMuxForward = PTHREAD_MUTEX_INITIALIZER;
+static forward_entry_t  *mpEntry;
+static uint32_t         mEntryNum;
+static uint32_t         mEntryCap;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static forward_entry_t *entry_get(uint64_t ShortChannelId);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+void ln_forward_register(uint64_t ShortChannelId, ln_forward_wakeup_t pFunc, void *pParam)
+{
+    pthread_mutex_lock(&mMuxForward);
+    forward_entry_t *p_entry = entry_get(ShortChannelId);
+    if (p_entry) {
+        p_entry->pending = LN_FORWARD_ALL;
+        p_entry->p_func = pFunc;
+        p_entry->p_param = pParam;
+    }
+    pthread_mutex_unlock(&mMuxForward);
+    LOGD("register: %016" PRIx64 "\n", ShortChannelId);
+}
+
+
+void ln_forward_unregister(uint64_t ShortChannelId)
+{
+    pthread_mutex_lock(&mMuxForward);
+    forward_entry_t *p_entry = entry_get(ShortChannelId);
+    if (p_entry) {
+        p_entry->pending = LN_FORWARD_ALL;
+        p_entry->p_func = NULL;
+        p_entry->p_param = NULL;
+    }
+    pthread_mutex_unlock(&mMuxForward);
+    LOGD("unregister: %016" PRIx64 "\n", ShortChannelId);
+}
+
+
+void ln_forward_notify(uint64_t ShortChannelId, uint8_t Type)
+{
+    pthread_mutex_lock(&mMuxForward);
+    forward_entry_t *p_entry = entry_get(ShortChannelId);
+    if (p_entry) {
+        p_entry->pending |= Type;
+        if (p_entry->p_func) {
+            //解除中に呼ばれないようlock中に呼ぶ
+            (*p_entry->p_func)(p_entry->p_param);
+        }
+    }
+    pthread_mutex_unlock(&mMuxForward);
+}
+
+
+void ln_forward_retry(uint64_t ShortChannelId, uint8_t Type)
+{
+    pthread_mutex_lock(&mMuxForward);
+    forward_entry_t *p_entry = entry_get(ShortChannelId);
+    if (p_entry) {
+        p_entry->pending |= Type;
+    }
+    pthread_mutex_unlock(&mMuxForward);
+}
+
+
+bool ln_forward_pending(uint64_t ShortChannelId, uint8_t Type)
+{
+    bool ret = true;
+
+    pthread_mutex_lock(&mMuxForward);
+    forward_entry_t *p_entry = entry_get(ShortChannelId);
+    if (p_entry) {
+        time_t now = utl_time_time();
+        int idx = (Type & LN_FORWARD_ADD_HTLC) ? 0 : 1;
+        ret = (p_entry->pending & Type) != 0;
+        if (now - p_entry->checked[idx] >= LN_FORWARD_POLL_SEC) {
+            ret = true;
+        }
+        if (ret) {
+            p_entry->checked[idx] = now;
+        }
+        p_entry->pending &= (uint8_t)~Type;
+    }
+    pthread_mutex_unlock(&mMuxForward);
+    return ret;
+}
+
+
+void ln_forward_term(void)
+{
+    pthread_mutex_lock(&mMuxForward);
+    UTL_DBG_FREE(mpEntry);
+    mEntryNum = 0;
+    mEntryCap = 0;
+    pthread_mutex_unlock(&mMuxForward);
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+/** entry取得
+ *
+ * 存在しない場合は通知ありの状態で追加する。
+ *
+ * @param[in]   ShortChannelId
+ * @return  entry(NULL:メモリ不足)
+ */
+static forward_entry_t *entry_get(uint64_t ShortChannelId)
+{
+    for (uint32_t lp = 0; lp < mEntryNum; lp++) {
+        if (mpEntry[lp].short_channel_id == ShortChannelId) {
+            return &mpEntry[lp];
+        }
+    }
+
+    if (mEntryNum == mEntryCap) {
+        uint32_t cap = (mEntryCap) ? mEntryCap * 2 : M_ENTRY_INIT;
+        forward_entry_t *p = (forward_entry_t *)UTL_DBG_REALLOC(mpEntry, sizeof(forward_entry_t) * cap);
+        if (!p) {
+            LOGE("fail: realloc\n");
+            return NULL;
+        }
+        mpEntry = p;
+        mEntryCap = cap;
+    }
+    forward_entry_t *p_entry = &mpEntry[mEntryNum++];
+    p_entry->short_channel_id = ShortChannelId;
+    p_entry->pending = LN_FORWARD_ALL;
+    p_entry->checked[0] = 0;
+    p_entry->checked[1] = 0;
+    p_entry->p_func = NULL;
+    p_entry->p_param = NULL;
+    return p_entry;
+}
@@ -0,0 +1,133 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_forward.h
+ *  @brief  HTLC転送通知
+ *
+ * 転送するHTLCはforward DBに保存し、転送先channelはDBから取り出して処理する。
+ * DBへの保存を転送先channelに通知し、転送先channelは通知があった場合のみDBを読み込む。
+ *      - forward DBは永続化のためのもので、処理の起点は本モジュールの通知
+ *      - 未登録(peerと未接続)のchannel宛ても通知状態は保持する
+ *      - 通知漏れに備え、一定時間(#LN_FORWARD_POLL_SEC)ごとに通知ありとみなす
+ */
+#ifndef LN_FORWARD_H__
+#define LN_FORWARD_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define LN_FORWARD_ADD_HTLC     (0x01)      ///< update_add_htlc転送
+#define LN_FORWARD_DEL_HTLC     (0x02)      ///< update_fulfill_htlc/update_fail_htlc転送
+#define LN_FORWARD_ALL          (LN_FORWARD_ADD_HTLC | LN_FORWARD_DEL_HTLC)
+
+#define LN_FORWARD_POLL_SEC     (10)        ///< 通知がなくてもforward DBを確認する間隔[sec]
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** 転送先channelの起床
+ *
+ * 通知元のthreadから呼ばれるため、転送先channelのlockを取得してはならない。
+ *
+ * @param[in]   pParam          #ln_forward_register()のpParam
+ */
+typedef void (*ln_forward_wakeup_t)(void *pParam);
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** 転送先channel登録
+ *
+ * 登録時は未処理のforward DBがある可能性があるため、通知ありの状態にする。
+ *
+ * @param[in]   ShortChannelId  転送先short_channel_id(0:自ノードからの送金)
+ * @param[in]   pFunc           起床関数
+ * @param[in]   pParam          pFuncに渡すパラメータ
+ */
+void ln_forward_register(uint64_t ShortChannelId, ln_forward_wakeup_t pFunc, void *pParam);
+
+
+/** 転送先channel登録解除
+ *
+ * 解除後は#ln_idle_proc_inactive()でforward DBを処理するため、通知ありの状態にする。
+ *
+ * @param[in]   ShortChannelId
+ */
+void ln_forward_unregister(uint64_t ShortChannelId);
+
+
+/** 転送通知
+ *
+ * forward DBに保存したことを転送先channelに通知する。
+ *
+ * @param[in]   ShortChannelId  転送先short_channel_id
+ * @param[in]   Type            LN_FORWARD_xxx
+ */
+void ln_forward_notify(uint64_t ShortChannelId, uint8_t Type);
+
+
+/** 再処理要求
+ *
+ * 処理できずにforward DBに残したため、次回の確認で再度処理する。
+ * #ln_forward_notify()と異なり、起床関数は呼ばない。
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   Type            LN_FORWARD_xxx
+ */
+void ln_forward_retry(uint64_t ShortChannelId, uint8_t Type);
+
+
+/** 通知確認
+ *
+ * 確認した通知はクリアする。
+ * 処理できずにforward DBに残した場合は、#ln_forward_retry()で再度通知状態にすること。
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   Type            LN_FORWARD_ADD_HTLC or LN_FORWARD_DEL_HTLC
+ * @retval  true    通知あり(未知のchannel、#LN_FORWARD_POLL_SEC経過も含む)
+ */
+bool ln_forward_pending(uint64_t ShortChannelId, uint8_t Type);
+
+
+/** 全解放
+ *
+ */
+void ln_forward_term(void);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* LN_FORWARD_H__ */
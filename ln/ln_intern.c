@@ -0,0 +1,401 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_intern.c
+ *  @brief  node/channel interning table
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utl_common.h"
+#include "utl_dbg.h"
+#define LOG_TAG "ln_intern"
+#include "utl_log.h"
+
+#include "ln_intern.h"
+
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_TBL_SIZE_INIT         (64)        ///< hash table初期要素数(2のべき乗)
+
+#define M_STATE_EMPTY           (0)
+#define M_STATE_USED            (1)
+#define M_STATE_DELETED         (2)
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static uint32_t hash_u64(uint64_t Val);
+static uint32_t hash_node_id(const uint8_t *pNodeId);
+static uint32_t hash_pair(uint32_t NodeIdx1, uint32_t NodeIdx2);
+static bool node_tbl_resize(ln_intern_t *pIntern, uint32_t NewSize);
+static bool cnl_tbl_resize(ln_intern_t *pIntern, uint32_t NewSize);
+static void cnl_tbl_insert(ln_intern_t *pIntern, const ln_intern_channel_t *pChannel);
+static ln_intern_channel_t *cnl_tbl_search(const ln_intern_t *pIntern, uint64_t ShortChannelId);
+static void pair_tbl_del(ln_intern_t *pIntern, const ln_intern_channel_t *pChannel);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+void ln_intern_init(ln_intern_t *pIntern)
+{
+    memset(pIntern, 0, sizeof(ln_intern_t));
+}
+
+
+void ln_intern_term(ln_intern_t *pIntern)
+{
+    UTL_DBG_FREE(pIntern->p_node_ids);
+    UTL_DBG_FREE(pIntern->p_node_tbl);
+    UTL_DBG_FREE(pIntern->p_cnl_tbl);
+    UTL_DBG_FREE(pIntern->p_pair_tbl);
+    ln_intern_init(pIntern);
+}
+
+
+void ln_intern_clear(ln_intern_t *pIntern)
+{
+    pIntern->node_num = 0;
+    if (pIntern->p_node_tbl) {
+        memset(pIntern->p_node_tbl, 0, sizeof(uint32_t) * pIntern->node_tbl_size);
+    }
+    pIntern->cnl_num = 0;
+    pIntern->cnl_used = 0;
+    if (pIntern->p_cnl_tbl) {
+        memset(pIntern->p_cnl_tbl, 0, sizeof(ln_intern_channel_t) * pIntern->cnl_tbl_size);
+        memset(pIntern->p_pair_tbl, 0, sizeof(ln_intern_channel_t) * pIntern->cnl_tbl_size);
+    }
+}
+
+
+bool ln_intern_node_add(ln_intern_t *pIntern, uint32_t *pIdx, const uint8_t *pNodeId)
+{
+    if (ln_intern_node_search(pIntern, pIdx, pNodeId)) {
+        return true;
+    }
+
+    //負荷率3/4を超えないようにする
+    if ((pIntern->node_num + 1) * 4 > pIntern->node_tbl_size * 3) {
+        uint32_t size = (pIntern->node_tbl_size) ? pIntern->node_tbl_size * 2 : M_TBL_SIZE_INIT;
+        if (!node_tbl_resize(pIntern, size)) {
+            return false;
+        }
+    }
+    if (pIntern->node_num == pIntern->node_cap) {
+        uint32_t cap = (pIntern->node_cap) ? pIntern->node_cap * 2 : M_TBL_SIZE_INIT;
+        uint8_t (*p_ids)[BTC_SZ_PUBKEY] = (uint8_t (*)[BTC_SZ_PUBKEY])UTL_DBG_REALLOC(pIntern->p_node_ids, (size_t)cap * BTC_SZ_PUBKEY);
+        if (!p_ids) {
+            LOGE("fail: realloc\n");
+            return false;
+        }
+        pIntern->p_node_ids = p_ids;
+        pIntern->node_cap = cap;
+    }
+
+    uint32_t idx = pIntern->node_num++;
+    memcpy(pIntern->p_node_ids[idx], pNodeId, BTC_SZ_PUBKEY);
+
+    uint32_t mask = pIntern->node_tbl_size - 1;
+    for (uint32_t pos = hash_node_id(pNodeId) & mask; ; pos = (pos + 1) & mask) {
+        if (pIntern->p_node_tbl[pos] == 0) {
+            pIntern->p_node_tbl[pos] = idx + 1;
+            break;
+        }
+    }
+    *pIdx = idx;
+    return true;
+}
+
+
+bool ln_intern_node_search(const ln_intern_t *pIntern, uint32_t *pIdx, const uint8_t *pNodeId)
+{
+    if (pIntern->node_tbl_size == 0) {
+        return false;
+    }
+
+    uint32_t mask = pIntern->node_tbl_size - 1;
+    for (uint32_t pos = hash_node_id(pNodeId) & mask; ; pos = (pos + 1) & mask) {
+        uint32_t val = pIntern->p_node_tbl[pos];
+        if (val == 0) {
+            return false;
+        }
+        if (memcmp(pIntern->p_node_ids[val - 1], pNodeId, BTC_SZ_PUBKEY) == 0) {
+            *pIdx = val - 1;
+            return true;
+        }
+    }
+}
+
+
+const uint8_t *ln_intern_node_id(const ln_intern_t *pIntern, uint32_t Idx)
+{
+    if (Idx >= pIntern->node_num) {
+        return NULL;
+    }
+    return pIntern->p_node_ids[Idx];
+}
+
+
+uint32_t ln_intern_node_num(const ln_intern_t *pIntern)
+{
+    return pIntern->node_num;
+}
+
+
+bool ln_intern_channel_add(ln_intern_t *pIntern, uint64_t ShortChannelId, uint32_t NodeIdx1, uint32_t NodeIdx2)
+{
+    ln_intern_channel_t *p_cnl = cnl_tbl_search(pIntern, ShortChannelId);
+    if (p_cnl) {
+        if ((p_cnl->node_idx[0] == NodeIdx1) && (p_cnl->node_idx[1] == NodeIdx2)) {
+            return true;
+        }
+        //node変更
+        ln_intern_channel_del(pIntern, ShortChannelId);
+    }
+
+    if ((pIntern->cnl_used + 1) * 4 > pIntern->cnl_tbl_size * 3) {
+        //削除済み要素を詰めるだけで足りる場合はサイズを変えない
+        uint32_t size = (pIntern->cnl_tbl_size) ? pIntern->cnl_tbl_size : M_TBL_SIZE_INIT;
+        while ((pIntern->cnl_num + 1) * 2 > size) {
+            size *= 2;
+        }
+        if (!cnl_tbl_resize(pIntern, size)) {
+            return false;
+        }
+    }
+
+    ln_intern_channel_t cnl;
+    cnl.short_channel_id = ShortChannelId;
+    cnl.node_idx[0] = NodeIdx1;
+    cnl.node_idx[1] = NodeIdx2;
+    cnl.state = M_STATE_USED;
+    cnl_tbl_insert(pIntern, &cnl);
+    pIntern->cnl_num++;
+    pIntern->cnl_used++;
+    return true;
+}
+
+
+bool ln_intern_channel_del(ln_intern_t *pIntern, uint64_t ShortChannelId)
+{
+    ln_intern_channel_t *p_cnl = cnl_tbl_search(pIntern, ShortChannelId);
+    if (!p_cnl) {
+        return false;
+    }
+    pair_tbl_del(pIntern, p_cnl);
+    p_cnl->state = M_STATE_DELETED;
+    pIntern->cnl_num--;
+    return true;
+}
+
+
+bool ln_intern_channel_search(const ln_intern_t *pIntern, uint32_t *pNodeIdx1, uint32_t *pNodeIdx2, uint64_t ShortChannelId)
+{
+    const ln_intern_channel_t *p_cnl = cnl_tbl_search(pIntern, ShortChannelId);
+    if (!p_cnl) {
+        return false;
+    }
+    if (pNodeIdx1) {
+        *pNodeIdx1 = p_cnl->node_idx[0];
+    }
+    if (pNodeIdx2) {
+        *pNodeIdx2 = p_cnl->node_idx[1];
+    }
+    return true;
+}
+
+
+bool ln_intern_channel_search_pair(const ln_intern_t *pIntern, uint64_t *pShortChannelId, uint32_t NodeIdx1, uint32_t NodeIdx2)
+{
+    if (pIntern->cnl_tbl_size == 0) {
+        return false;
+    }
+
+    uint32_t mask = pIntern->cnl_tbl_size - 1;
+    for (uint32_t pos = hash_pair(NodeIdx1, NodeIdx2) & mask; ; pos = (pos + 1) & mask) {
+        const ln_intern_channel_t *p_pair = &pIntern->p_pair_tbl[pos];
+        if (p_pair->state == M_STATE_EMPTY) {
+            return false;
+        }
+        if ((p_pair->state == M_STATE_USED) &&
+                (((p_pair->node_idx[0] == NodeIdx1) && (p_pair->node_idx[1] == NodeIdx2)) ||
+                 ((p_pair->node_idx[0] == NodeIdx2) && (p_pair->node_idx[1] == NodeIdx1)))) {
+            *pShortChannelId = p_pair->short_channel_id;
+            return true;
+        }
+    }
+}
+
+
+uint32_t ln_intern_channel_num(const ln_intern_t *pIntern)
+{
+    return pIntern->cnl_num;
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+static uint32_t hash_u64(uint64_t Val)
+{
+    //splitmix64 finalizer
+    Val ^= Val >> 30;
+    Val *= UINT64_C(0xbf58476d1ce4e5b9);
+    Val ^= Val >> 27;
+    Val *= UINT64_C(0x94d049bb133111eb);
+    Val ^= Val >> 31;
+    return (uint32_t)Val;
+}
+
+
+static uint32_t hash_node_id(const uint8_t *pNodeId)
+{
+    //先頭(0x02/0x03)以外は公開鍵のx座標なので偏りは少ない
+    uint64_t val;
+    memcpy(&val, pNodeId + 1, sizeof(val));
+    return hash_u64(val);
+}
+
+
+static uint32_t hash_pair(uint32_t NodeIdx1, uint32_t NodeIdx2)
+{
+    //順序によらず同じ値にする
+    if (NodeIdx1 > NodeIdx2) {
+        uint32_t tmp = NodeIdx1;
+        NodeIdx1 = NodeIdx2;
+        NodeIdx2 = tmp;
+    }
+    return hash_u64(((uint64_t)NodeIdx1 << 32) | NodeIdx2);
+}
+
+
+static bool node_tbl_resize(ln_intern_t *pIntern, uint32_t NewSize)
+{
+    uint32_t *p_tbl = (uint32_t *)UTL_DBG_CALLOC(NewSize, sizeof(uint32_t));
+    if (!p_tbl) {
+        LOGE("fail: calloc\n");
+        return false;
+    }
+    uint32_t mask = NewSize - 1;
+    for (uint32_t idx = 0; idx < pIntern->node_num; idx++) {
+        for (uint32_t pos = hash_node_id(pIntern->p_node_ids[idx]) & mask; ; pos = (pos + 1) & mask) {
+            if (p_tbl[pos] == 0) {
+                p_tbl[pos] = idx + 1;
+                break;
+            }
+        }
+    }
+    UTL_DBG_FREE(pIntern->p_node_tbl);
+    pIntern->p_node_tbl = p_tbl;
+    pIntern->node_tbl_size = NewSize;
+    return true;
+}
+
+
+static bool cnl_tbl_resize(ln_intern_t *pIntern, uint32_t NewSize)
+{
+    ln_intern_channel_t *p_cnl_tbl = (ln_intern_channel_t *)UTL_DBG_CALLOC(NewSize, sizeof(ln_intern_channel_t));
+    ln_intern_channel_t *p_pair_tbl = (ln_intern_channel_t *)UTL_DBG_CALLOC(NewSize, sizeof(ln_intern_channel_t));
+    if (!p_cnl_tbl || !p_pair_tbl) {
+        LOGE("fail: calloc\n");
+        UTL_DBG_FREE(p_cnl_tbl);
+        UTL_DBG_FREE(p_pair_tbl);
+        return false;
+    }
+
+    ln_intern_channel_t *p_old = pIntern->p_cnl_tbl;
+    uint32_t old_size = pIntern->cnl_tbl_size;
+    UTL_DBG_FREE(pIntern->p_pair_tbl);
+    pIntern->p_cnl_tbl = p_cnl_tbl;
+    pIntern->p_pair_tbl = p_pair_tbl;
+    pIntern->cnl_tbl_size = NewSize;
+    pIntern->cnl_used = pIntern->cnl_num;
+    for (uint32_t lp = 0; lp < old_size; lp++) {
+        if (p_old[lp].state == M_STATE_USED) {
+            cnl_tbl_insert(pIntern, &p_old[lp]);
+        }
+    }
+    UTL_DBG_FREE(p_old);
+    return true;
+}
+
+
+static void cnl_tbl_insert(ln_intern_t *pIntern, const ln_intern_channel_t *pChannel)
+{
+    uint32_t mask = pIntern->cnl_tbl_size - 1;
+    uint32_t pos;
+
+    //削除済み要素はcnl_usedに含めたまま再利用しない(resizeで詰める)
+    for (pos = hash_u64(pChannel->short_channel_id) & mask;
+            pIntern->p_cnl_tbl[pos].state != M_STATE_EMPTY; pos = (pos + 1) & mask) {
+    }
+    pIntern->p_cnl_tbl[pos] = *pChannel;
+
+    for (pos = hash_pair(pChannel->node_idx[0], pChannel->node_idx[1]) & mask;
+            pIntern->p_pair_tbl[pos].state != M_STATE_EMPTY; pos = (pos + 1) & mask) {
+    }
+    pIntern->p_pair_tbl[pos] = *pChannel;
+}
+
+
+static ln_intern_channel_t *cnl_tbl_search(const ln_intern_t *pIntern, uint64_t ShortChannelId)
+{
+    if (pIntern->cnl_tbl_size == 0) {
+        return NULL;
+    }
+
+    uint32_t mask = pIntern->cnl_tbl_size - 1;
+    for (uint32_t pos = hash_u64(ShortChannelId) & mask; ; pos = (pos + 1) & mask) {
+        ln_intern_channel_t *p_cnl = &pIntern->p_cnl_tbl[pos];
+        if (p_cnl->state == M_STATE_EMPTY) {
+            return NULL;
+        }
+        if ((p_cnl->state == M_STATE_USED) && (p_cnl->short_channel_id == ShortChannelId)) {
+            return p_cnl;
+        }
+    }
+}
+
+
+static void pair_tbl_del(ln_intern_t *pIntern, const ln_intern_channel_t *pChannel)
+{
+    uint32_t mask = pIntern->cnl_tbl_size - 1;
+    for (uint32_t pos = hash_pair(pChannel->node_idx[0], pChannel->node_idx[1]) & mask; ; pos = (pos + 1) & mask) {
+        ln_intern_channel_t *p_pair = &pIntern->p_pair_tbl[pos];
+        if (p_pair->state == M_STATE_EMPTY) {
+            LOGE("fail: pair not found\n");
+            return;
+        }
+        if ((p_pair->state == M_STATE_USED) && (p_pair->short_channel_id == pChannel->short_channel_id)) {
+            p_pair->state = M_STATE_DELETED;
+            return;
+        }
+    }
+}
@@ -0,0 +1,209 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   ln_intern.h
+ *  @brief  node/channel interning table
+ *
+ * gossipで受信したnode_idに0からの連番(node index)を割り当て、hashで検索できるようにする。
+ * channelはshort_channel_idとnode indexの組で登録し、(node1, node2)からshort_channel_idを検索できる。
+ *      - node indexは#ln_intern_clear()まで変わらない(nodeの削除はない)
+ *      - 排他制御は呼び出し元で行う
+ */
+#ifndef LN_INTERN_H__
+#define LN_INTERN_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "btc_keys.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif //__cplusplus
+
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define LN_INTERN_IDX_INVALID       ((uint32_t)0xffffffff)      ///< 無効なnode index
+
+
+/**************************************************************************
+ * typedefs
+ **************************************************************************/
+
+/** @struct     ln_intern_channel_t
+ *  @brief      channel情報(hash table要素)
+ */
+typedef struct {
+    uint64_t    short_channel_id;
+    uint32_t    node_idx[2];            ///< [0]node_id_1, [1]node_id_2
+    uint8_t     state;                  ///< 内部用
+} ln_intern_channel_t;
+
+
+/** @struct     ln_intern_t
+ *  @brief      node/channel interning table
+ */
+typedef struct {
+    //node
+    uint8_t     (*p_node_ids)[BTC_SZ_PUBKEY];   ///< node index --> node_id
+    uint32_t    node_num;               ///< 登録node数
+    uint32_t    node_cap;               ///< p_node_ids確保数
+    uint32_t    *p_node_tbl;            ///< node_id hash table(node index + 1, 0:空き)
+    uint32_t    node_tbl_size;          ///< p_node_tbl要素数(2のべき乗)
+
+    //channel
+    ln_intern_channel_t *p_cnl_tbl;     ///< short_channel_id hash table
+    ln_intern_channel_t *p_pair_tbl;    ///< (node1, node2) hash table
+    uint32_t    cnl_num;                ///< 登録channel数
+    uint32_t    cnl_used;               ///< 使用済み要素数(削除済みを含む)
+    uint32_t    cnl_tbl_size;           ///< p_cnl_tbl, p_pair_tbl要素数(2のべき乗)
+} ln_intern_t;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** 初期化
+ *
+ * @param[out]      pIntern
+ */
+void ln_intern_init(ln_intern_t *pIntern);
+
+
+/** 解放
+ *
+ * @param[in,out]   pIntern
+ */
+void ln_intern_term(ln_intern_t *pIntern);
+
+
+/** 全削除
+ *
+ * 確保したメモリは解放せずに再利用する。
+ *
+ * @param[in,out]   pIntern
+ */
+void ln_intern_clear(ln_intern_t *pIntern);
+
+
+/** node登録
+ *
+ * 登録済みの場合は既存のnode indexを返す。
+ *
+ * @param[in,out]   pIntern
+ * @param[out]      pIdx            node index
+ * @param[in]       pNodeId         node_id
+ * @retval  true    成功
+ */
+bool ln_intern_node_add(ln_intern_t *pIntern, uint32_t *pIdx, const uint8_t *pNodeId);
+
+
+/** node検索
+ *
+ * @param[in]       pIntern
+ * @param[out]      pIdx            node index
+ * @param[in]       pNodeId         node_id
+ * @retval  true    登録済み
+ */
+bool ln_intern_node_search(const ln_intern_t *pIntern, uint32_t *pIdx, const uint8_t *pNodeId);
+
+
+/** node_id取得
+ *
+ * @param[in]       pIntern
+ * @param[in]       Idx             node index
+ * @return  node_id(未登録の場合はNULL)
+ */
+const uint8_t *ln_intern_node_id(const ln_intern_t *pIntern, uint32_t Idx);
+
+
+/** 登録node数
+ *
+ * @param[in]       pIntern
+ * @return  node数(最大node index + 1)
+ */
+uint32_t ln_intern_node_num(const ln_intern_t *pIntern);
+
+
+/** channel登録
+ *
+ * 登録済みのshort_channel_idの場合はnode indexを更新する。
+ *
+ * @param[in,out]   pIntern
+ * @param[in]       ShortChannelId
+ * @param[in]       NodeIdx1        node_id_1のnode index
+ * @param[in]       NodeIdx2        node_id_2のnode index
+ * @retval  true    成功
+ */
+bool ln_intern_channel_add(ln_intern_t *pIntern, uint64_t ShortChannelId, uint32_t NodeIdx1, uint32_t NodeIdx2);
+
+
+/** channel削除
+ *
+ * @param[in,out]   pIntern
+ * @param[in]       ShortChannelId
+ * @retval  true    削除した
+ */
+bool ln_intern_channel_del(ln_intern_t *pIntern, uint64_t ShortChannelId);
+
+
+/** short_channel_idからchannel検索
+ *
+ * @param[in]       pIntern
+ * @param[out]      pNodeIdx1       node_id_1のnode index(NULL時は返さない)
+ * @param[out]      pNodeIdx2       node_id_2のnode index(NULL時は返さない)
+ * @param[in]       ShortChannelId
+ * @retval  true    登録済み
+ */
+bool ln_intern_channel_search(const ln_intern_t *pIntern, uint32_t *pNodeIdx1, uint32_t *pNodeIdx2, uint64_t ShortChannelId);
+
+
+/** node indexの組からshort_channel_id検索
+ *
+ * node間に複数channelがある場合は、いずれか1つを返す。
+ * NodeIdx1, NodeIdx2の順序は問わない。
+ *
+ * @param[in]       pIntern
+ * @param[out]      pShortChannelId
+ * @param[in]       NodeIdx1
+ * @param[in]       NodeIdx2
+ * @retval  true    登録済み
+ */
+bool ln_intern_channel_search_pair(const ln_intern_t *pIntern, uint64_t *pShortChannelId, uint32_t NodeIdx1, uint32_t NodeIdx2);
+
+
+/** 登録channel数
+ *
+ * @param[in]       pIntern
+ * @return  channel数
+ */
+uint32_t ln_intern_channel_num(const ln_intern_t *pIntern);
+
+
+#ifdef __cplusplus
+}
+#endif //__cplusplus
+
+#endif /* LN_INTERN_H__ */
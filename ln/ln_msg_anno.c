@@ -1058,16 +1058,24 @@ static void gossip_timestamp_filter_print(const ln_msg_gossip_timestamp_filter_t
 
 
 bool ln_msg_gossip_ids_encode(utl_buf_t *pEncodedIds, const uint64_t *pShortChannelIds, size_t Num)
+{
+    uint8_t encode = (sizeof(uint64_t) * Num <= M_ZLIB_CHUNK) ?
+                LN_GOSSIPQUERY_ENCODE_NONE : LN_GOSSIPQUERY_ENCODE_ZLIB;
+    return ln_msg_gossip_ids_encode_type(pEncodedIds, pShortChannelIds, Num, encode);
+}
+
+
+bool ln_msg_gossip_ids_encode_type(utl_buf_t *pEncodedIds, const uint64_t *pShortChannelIds, size_t Num, uint8_t Encode)
 {
     bool ret = true;
     size_t sz_short_ids = sizeof(uint64_t) * Num;
 
-    utl_buf_alloc(pEncodedIds, 1);
-    if (sz_short_ids <= M_ZLIB_CHUNK) {
-        pEncodedIds->buf[0] = LN_GOSSIPQUERY_ENCODE_NONE;
-    } else {
-        pEncodedIds->buf[0] = LN_GOSSIPQUERY_ENCODE_ZLIB;
+    if ((Encode != LN_GOSSIPQUERY_ENCODE_NONE) && (Encode != LN_GOSSIPQUERY_ENCODE_ZLIB)) {
+        LOGE("fail: unknown encode type: %02x\n", Encode);
+        return false;
     }
+    utl_buf_alloc(pEncodedIds, 1);
+    pEncodedIds->buf[0] = Encode;
     if (Num == 0) {
         return true;
     }
@@ -1078,7 +1086,7 @@ bool ln_msg_gossip_ids_encode(utl_buf_t *pEncodedIds, const uint64_t *pShortChan
         utl_int_unpack_u64be(p_short_ids + sizeof(uint64_t) * lp, pShortChannelIds[lp]);
     }
 
-    if (sz_short_ids <= M_ZLIB_CHUNK) {
+    if (Encode == LN_GOSSIPQUERY_ENCODE_NONE) {
         //copy
         utl_buf_realloc(pEncodedIds, 1 + sz_short_ids);
         memcpy(pEncodedIds->buf + 1, p_short_ids, sz_short_ids);
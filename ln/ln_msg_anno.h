@@ -349,7 +349,7 @@ bool HIDDEN ln_msg_channel_announcement_sign(uint8_t *pData, uint16_t Len, const
  * @param[in]       Len     pData長
  * retval   true    成功
  */
-bool HIDDEN ln_msg_channel_announcement_verify(const ln_msg_channel_announcement_t *pMsg, const uint8_t *pData, uint16_t Len); //XXX: not used
+bool HIDDEN ln_msg_channel_announcement_verify(const ln_msg_channel_announcement_t *pMsg, const uint8_t *pData, uint16_t Len);
 
 
 /** print channel_announcement
@@ -541,6 +541,19 @@ bool HIDDEN ln_msg_gossip_timestamp_filter_read(ln_msg_gossip_timestamp_filter_t
 bool HIDDEN ln_msg_gossip_ids_encode(utl_buf_t *pEncodedIds, const uint64_t *pShortChannelIds, size_t Num);
 
 
+/** encode short_channel_ids(encoding type指定)
+ *
+ * @param[out]     pEncodedIds          encoded short_channel_id (utl_buf_free() after used)
+ * @param[in]      pShortChannelIds     short_ids
+ * @param[in]      Num                  num of pShortChannelIds
+ * @param[in]      Encode               LN_GOSSIPQUERY_ENCODE_NONE or LN_GOSSIPQUERY_ENCODE_ZLIB
+ * @retval      true    success
+ * @attention
+ *      - pEncodedIds is allocated by this function.
+ */
+bool HIDDEN ln_msg_gossip_ids_encode_type(utl_buf_t *pEncodedIds, const uint64_t *pShortChannelIds, size_t Num, uint8_t Encode);
+
+
 /** decode encoded_short_ids
  *
  * @param[out]     ppShortChannelIds       decoded short_channel_id (free() after used)
@@ -55,7 +55,8 @@
 #define M_PROLOGUE      "lightning"
 #define M_PROLOGUE_LEN  (9)
 
-#define M_CHACHAPOLY_MAC     (16)
+#define M_CHACHAPOLY_MAC     (LN_SZ_NOISE_MAC)
+#define M_SZ_HEADER          (sizeof(uint16_t) + M_CHACHAPOLY_MAC)      ///< 暗号化したlength + MAC
 
 
 /**************************************************************************
@@ -98,6 +99,12 @@ struct bolt8_t {
  **************************************************************************/
 
 static bool noise_hkdf(uint8_t *ck, uint8_t *k, const uint8_t *pSalt, const uint8_t *pIkm);
+#ifndef M_USE_SODIUM
+static mbedtls_chachapoly_context *noise_cipher_get(ln_noise_ctx_t *pCtx);
+#endif
+static bool noise_encrypt(ln_noise_ctx_t *pCtx, uint8_t *pOut, const uint8_t *pIn, uint16_t Len);
+static bool noise_decrypt(ln_noise_ctx_t *pCtx, uint8_t *pOut, const uint8_t *pIn, uint16_t Len);
+static void noise_nonce_next(ln_noise_ctx_t *pCtx);
 static bool actone_sender(ln_noise_t *pCtx, utl_buf_t *pBuf, const uint8_t *pRS);
 static bool actone_receiver(ln_noise_t *pCtx, utl_buf_t *pBuf);
 static bool acttwo_sender(ln_noise_t *pCtx, utl_buf_t *pBuf, const uint8_t *pRE);
@@ -236,164 +243,83 @@ void ln_noise_handshake_free(ln_noise_t *pCtx)
 
 bool ln_noise_enc(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn)
 {
-    bool ret = false;
-    uint8_t nonce[12];
-    uint16_t l = (pBufIn->len >> 8) | (pBufIn->len << 8);
-    uint8_t *cl = (uint8_t *)UTL_DBG_MALLOC(sizeof(l) + M_CHACHAPOLY_MAC);
-    uint8_t *cm = (uint8_t *)UTL_DBG_MALLOC(pBufIn->len + M_CHACHAPOLY_MAC);
-    int rc;
-
-    memset(nonce, 0, 4);
-    memcpy(nonce + 4, &pCtx->send_ctx.nonce, sizeof(uint64_t));
-#ifdef M_USE_SODIUM
-    unsigned long long cllen;
-    unsigned long long cmlen;
-
-    rc = crypto_aead_chacha20poly1305_ietf_encrypt(
-                    cl, &cllen,
-                    (uint8_t *)&l, sizeof(l),   //message length
-                    NULL, 0,                    //additional data
-                    NULL,                       //combined modeではNULL
-                    nonce, pCtx->send_ctx.key);     //nonce, key
-    if ((rc != 0) || (cllen != sizeof(l) + crypto_aead_chacha20poly1305_IETF_ABYTES)) {
-        LOGE("fail: crypto_aead_chacha20poly1305_ietf_encrypt rc=%d\n", rc);
-        goto LABEL_EXIT;
-    }
-#else
-    mbedtls_chachapoly_context ctx;
-    mbedtls_chachapoly_init(&ctx);
-    rc = mbedtls_chachapoly_setkey(&ctx, pCtx->send_ctx.key);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
+    if (pBufIn->len > UINT16_MAX) {
+        LOGE("fail: too large: %" PRIu32 "\n", pBufIn->len);
+        return false;
     }
-    rc = mbedtls_chachapoly_encrypt_and_tag(&ctx,
-                    sizeof(l),          //in length
-                    nonce,              //12byte
-                    NULL, 0,            //AAD
-                    (const uint8_t *)&l,    //input
-                    cl,                 //output
-                    cl + sizeof(l));    //MAC
-    mbedtls_chachapoly_free(&ctx);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_encrypt_and_tag rc=-%04x\n", -rc);
-        assert(0);
-        goto LABEL_EXIT;
+    utl_buf_alloc(pBufEnc, LN_SZ_NOISE_FRAME(pBufIn->len));
+    if (!ln_noise_enc_frame(pCtx, pBufEnc->buf, pBufIn->buf, (uint16_t)pBufIn->len)) {
+        utl_buf_free(pBufEnc);
+        return false;
     }
-#endif
+    return true;
+}
 
-    if (pCtx->send_ctx.nonce == 0) {
-        dump_key(pCtx->send_ctx.key, cl + sizeof(l));
-    }
 
-    pCtx->send_ctx.nonce++;
-    if (pCtx->send_ctx.nonce == 1000) {
-        LOGE("???: This root shall not in.\n");
-        goto LABEL_EXIT;
-    }
-    memcpy(nonce + 4, &pCtx->send_ctx.nonce, sizeof(uint64_t));
+bool ln_noise_enc_frame(ln_noise_t *pCtx, uint8_t *pFrame, const uint8_t *pData, uint16_t Len)
+{
+    uint8_t l[sizeof(uint16_t)];
 
-#ifdef M_USE_SODIUM
-    rc = crypto_aead_chacha20poly1305_ietf_encrypt(
-                    cm, &cmlen,
-                    pBufIn->buf, pBufIn->len,       //message length
-                    NULL, 0,                    //additional data
-                    NULL,                       //combined modeではNULL
-                    nonce, pCtx->send_ctx.key);     //nonce, key
-    if ((rc != 0) || (cmlen != pBufIn->len + crypto_aead_chacha20poly1305_IETF_ABYTES)) {
-        LOGE("fail: crypto_aead_chacha20poly1305_ietf_encrypt rc=%d\n", rc);
-        goto LABEL_EXIT;
-    }
-#else
-    mbedtls_chachapoly_init(&ctx);
-    rc = mbedtls_chachapoly_setkey(&ctx, pCtx->send_ctx.key);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
+    //length
+    l[0] = (uint8_t)(Len >> 8);
+    l[1] = (uint8_t)Len;
+    if (!noise_encrypt(&pCtx->send_ctx, pFrame, l, sizeof(l))) {
+        return false;
     }
-    rc = mbedtls_chachapoly_encrypt_and_tag(&ctx,
-                    pBufIn->len,        //in length
-                    nonce,              //12byte
-                    NULL, 0,            //AAD
-                    pBufIn->buf,        //input
-                    cm,                 //output
-                    cm + pBufIn->len);  //MAC
-    mbedtls_chachapoly_free(&ctx);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_encrypt_and_tag rc=-%04x\n", -rc);
-        assert(0);
-        goto LABEL_EXIT;
+    if (pCtx->send_ctx.nonce == 0) {
+        dump_key(pCtx->send_ctx.key, pFrame + sizeof(l));
     }
-#endif
-
     pCtx->send_ctx.nonce++;
     if (pCtx->send_ctx.nonce == 1000) {
-        //key rotation
-        //ck', k' = HKDF(ck, k)
-        noise_hkdf(pCtx->send_ctx.ck, pCtx->send_ctx.key, pCtx->send_ctx.ck, pCtx->send_ctx.key);
-        pCtx->send_ctx.nonce = 0;
+        LOGE("???: This root shall not in.\n");
+        return false;
     }
 
-    utl_buf_alloc(pBufEnc, sizeof(l) + pBufIn->len + 2 * M_CHACHAPOLY_MAC);
-    memcpy(pBufEnc->buf, cl, sizeof(l) + M_CHACHAPOLY_MAC);
-    memcpy(pBufEnc->buf + sizeof(l) + M_CHACHAPOLY_MAC, cm, pBufIn->len + M_CHACHAPOLY_MAC);
-    ret = true;
+    //body
+    if (!noise_encrypt(&pCtx->send_ctx, pFrame + M_SZ_HEADER, pData, Len)) {
+        return false;
+    }
+    noise_nonce_next(&pCtx->send_ctx);
+    return true;
+}
 
-LABEL_EXIT:
-    UTL_DBG_FREE(cl);
-    UTL_DBG_FREE(cm);
 
-    return ret;
+bool ln_noise_enc_batch(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn, int Num)
+{
+    //1回のallocで全frame分を確保し、順に暗号化する
+    size_t sz = 0;
+    for (int lp = 0; lp < Num; lp++) {
+        if (pBufIn[lp].len > UINT16_MAX) {
+            LOGE("fail: too large[%d]: %" PRIu32 "\n", lp, pBufIn[lp].len);
+            return false;
+        }
+        sz += LN_SZ_NOISE_FRAME(pBufIn[lp].len);
+    }
+    utl_buf_alloc(pBufEnc, (uint32_t)sz);
+
+    uint8_t *p = pBufEnc->buf;
+    for (int lp = 0; lp < Num; lp++) {
+        if (!ln_noise_enc_frame(pCtx, p, pBufIn[lp].buf, (uint16_t)pBufIn[lp].len)) {
+            utl_buf_free(pBufEnc);
+            return false;
+        }
+        p += LN_SZ_NOISE_FRAME(pBufIn[lp].len);
+    }
+    return true;
 }
 
 
 uint16_t /*HIDDEN*/ ln_noise_dec_len(ln_noise_t *pCtx, const uint8_t *pData, uint16_t Len)
 {
-    uint8_t nonce[12];
     uint8_t pl[sizeof(uint16_t)];
-    uint16_t l = 0;
-    int rc;
 
-    if (Len != LN_SZ_NOISE_HEADER) {
+    if (Len != M_SZ_HEADER) {
         return 0;
     }
-
-    memset(nonce, 0, 4);
-    memcpy(nonce + 4, &pCtx->recv_ctx.nonce, sizeof(uint64_t));
-#ifdef M_USE_SODIUM
-    unsigned long long pllen;
-    rc = crypto_aead_chacha20poly1305_ietf_decrypt(
-                    pl, &pllen,
-                    NULL,                       //combined modeではNULL
-                    pData, LN_SZ_NOISE_HEADER,
-                    NULL, 0,  //additional data
-                    nonce, pCtx->recv_ctx.key);      //nonce, key
-    if ((rc != 0) || (pllen != sizeof(uint16_t))) {
-        LOGE("fail: crypto_aead_chacha20poly1305_ietf_decrypt rc=%d\n", rc);
+    if (!noise_decrypt(&pCtx->recv_ctx, pl, pData, sizeof(pl))) {
         LOGD("sn=%" PRIu64 ", rn=%" PRIu64 "\n", pCtx->send_ctx.nonce, pCtx->recv_ctx.nonce);
-        goto LABEL_EXIT;
-    }
-#else
-    mbedtls_chachapoly_context ctx;
-    mbedtls_chachapoly_init(&ctx);
-    rc = mbedtls_chachapoly_setkey(&ctx, pCtx->recv_ctx.key);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
-    }
-    rc = mbedtls_chachapoly_auth_decrypt(&ctx,
-                    sizeof(pl),             //in length
-                    nonce,                  //12byte
-                    NULL, 0,                //AAD
-                    pData + sizeof(pl),     //MAC
-                    pData,                  //input
-                    pl);                    //output
-    mbedtls_chachapoly_free(&ctx);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_auth_decrypt rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
+        return 0;
     }
-#endif
 
     if (pCtx->recv_ctx.nonce == 0) {
         dump_key(pCtx->recv_ctx.key, pData + sizeof(pl));
@@ -404,85 +330,189 @@ uint16_t /*HIDDEN*/ ln_noise_dec_len(ln_noise_t *pCtx, const uint8_t *pData, uin
         //key rotation
         //ck', k' = HKDF(ck, k)
         LOGE("???: This root shall not in.\n");
-        goto LABEL_EXIT;
+        return 0;
     }
 
     //受信するデータ長
-    l = ((pl[0] << 8) | pl[1]) + M_CHACHAPOLY_MAC;
-
-LABEL_EXIT:
-    return l;
+    return ((pl[0] << 8) | pl[1]) + M_CHACHAPOLY_MAC;
 }
 
 
 bool /*HIDDEN*/ ln_noise_dec_msg(ln_noise_t *pCtx, utl_buf_t *pBuf)
 {
-    bool ret = false;
-    uint16_t l = pBuf->len - M_CHACHAPOLY_MAC;
+    if ((pBuf->len < M_CHACHAPOLY_MAC) || (pBuf->len > UINT16_MAX)) {
+        LOGE("fail: invalid length: %" PRIu32 "\n", pBuf->len);
+        return false;
+    }
+    if (!ln_noise_dec_frame(pCtx, pBuf->buf, (uint16_t)pBuf->len)) {
+        return false;
+    }
+    //復号は同じ領域に行うので、長さだけ変更する
+    pBuf->len -= M_CHACHAPOLY_MAC;
+    return true;
+}
+
+
+bool ln_noise_dec_frame(ln_noise_t *pCtx, uint8_t *pData, uint16_t Len)
+{
+    if (Len < M_CHACHAPOLY_MAC) {
+        LOGE("fail: invalid length: %" PRIu16 "\n", Len);
+        return false;
+    }
+    if (!noise_decrypt(&pCtx->recv_ctx, pData, pData, Len - M_CHACHAPOLY_MAC)) {
+        return false;
+    }
+    noise_nonce_next(&pCtx->recv_ctx);
+    return true;
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+#ifndef M_USE_SODIUM
+/** key設定済みcipher取得
+ *
+ * keyが変わったとき(handshake完了, key rotation)だけkeyを設定し直し、
+ * それ以外はcontextを使い回す。
+ *
+ * @param[in,out]   pCtx        send_ctx or recv_ctx
+ * @return  cipher context(NULL:失敗)
+ */
+static mbedtls_chachapoly_context *noise_cipher_get(ln_noise_ctx_t *pCtx)
+{
+    if (memcmp(pCtx->cipher_key, pCtx->key, BTC_SZ_PRIVKEY) != 0) {
+        mbedtls_chachapoly_init(&pCtx->cipher);
+        int rc = mbedtls_chachapoly_setkey(&pCtx->cipher, pCtx->key);
+        if (rc != 0) {
+            LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
+            return NULL;
+        }
+        memcpy(pCtx->cipher_key, pCtx->key, BTC_SZ_PRIVKEY);
+    }
+    return &pCtx->cipher;
+}
+#endif  //M_USE_SODIUM
+
+
+/** 暗号化(nonceは更新しない)
+ *
+ * @param[in,out]   pCtx        send_ctx
+ * @param[out]      pOut        暗号文(Len) + MAC(16)
+ * @param[in]       pIn         平文
+ * @param[in]       Len         pIn長
+ * @retval  true    成功
+ */
+static bool noise_encrypt(ln_noise_ctx_t *pCtx, uint8_t *pOut, const uint8_t *pIn, uint16_t Len)
+{
+    uint8_t nonce[12];
+    int rc;
+
+    memset(nonce, 0, 4);
+    memcpy(nonce + 4, &pCtx->nonce, sizeof(uint64_t));
+#ifdef M_USE_SODIUM
+    unsigned long long clen;
+    rc = crypto_aead_chacha20poly1305_ietf_encrypt(
+                    pOut, &clen,
+                    pIn, Len,                   //message
+                    NULL, 0,                    //additional data
+                    NULL,                       //combined modeではNULL
+                    nonce, pCtx->key);          //nonce, key
+    if ((rc != 0) || (clen != (unsigned long long)Len + crypto_aead_chacha20poly1305_IETF_ABYTES)) {
+        LOGE("fail: crypto_aead_chacha20poly1305_ietf_encrypt rc=%d\n", rc);
+        return false;
+    }
+#else
+    mbedtls_chachapoly_context *p_cipher = noise_cipher_get(pCtx);
+    if (p_cipher == NULL) {
+        return false;
+    }
+    rc = mbedtls_chachapoly_encrypt_and_tag(p_cipher,
+                    Len,                //in length
+                    nonce,              //12byte
+                    NULL, 0,            //AAD
+                    pIn,                //input
+                    pOut,               //output
+                    pOut + Len);        //MAC
+    if (rc != 0) {
+        LOGE("fail: mbedtls_chachapoly_encrypt_and_tag rc=-%04x\n", -rc);
+        assert(0);
+        return false;
+    }
+#endif
+    return true;
+}
+
+
+/** 復号(nonceは更新しない)
+ *
+ * pOutとpInは同じ領域でもよい。
+ *
+ * @param[in,out]   pCtx        recv_ctx
+ * @param[out]      pOut        平文(Len)
+ * @param[in]       pIn         暗号文(Len) + MAC(16)
+ * @param[in]       Len         平文長
+ * @retval  true    成功
+ */
+static bool noise_decrypt(ln_noise_ctx_t *pCtx, uint8_t *pOut, const uint8_t *pIn, uint16_t Len)
+{
     uint8_t nonce[12];
-    uint8_t *pm = (uint8_t *)UTL_DBG_MALLOC(l);
     int rc;
 
     memset(nonce, 0, 4);
-    memcpy(nonce + 4, &pCtx->recv_ctx.nonce, sizeof(uint64_t));
+    memcpy(nonce + 4, &pCtx->nonce, sizeof(uint64_t));
 #ifdef M_USE_SODIUM
-    unsigned long long pmlen;
+    unsigned long long plen;
     rc = crypto_aead_chacha20poly1305_ietf_decrypt(
-                    pm, &pmlen,
+                    pOut, &plen,
                     NULL,                       //combined modeではNULL
-                    pBuf->buf, pBuf->len,
-                    NULL, 0,  //additional data
-                    nonce, pCtx->recv_ctx.key);      //nonce, key
-    if ((rc != 0) || (pmlen != l)) {
+                    pIn, (unsigned long long)Len + M_CHACHAPOLY_MAC,
+                    NULL, 0,                    //additional data
+                    nonce, pCtx->key);          //nonce, key
+    if ((rc != 0) || (plen != Len)) {
         LOGE("fail: crypto_aead_chacha20poly1305_ietf_decrypt rc=%d\n", rc);
-        goto LABEL_EXIT;
+        return false;
     }
 #else
-    mbedtls_chachapoly_context ctx;
-    mbedtls_chachapoly_init(&ctx);
-    rc = mbedtls_chachapoly_setkey(&ctx, pCtx->recv_ctx.key);
-    if (rc != 0) {
-        LOGE("fail: mbedtls_chachapoly_setkey rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
+    mbedtls_chachapoly_context *p_cipher = noise_cipher_get(pCtx);
+    if (p_cipher == NULL) {
+        return false;
     }
-    rc = mbedtls_chachapoly_auth_decrypt(&ctx,
-                    l,                  //in length
+    rc = mbedtls_chachapoly_auth_decrypt(p_cipher,
+                    Len,                //in length
                     nonce,              //12byte
                     NULL, 0,            //AAD
-                    pBuf->buf + l,      //MAC
-                    pBuf->buf,          //input
-                    pm);                //output
-    mbedtls_chachapoly_free(&ctx);
+                    pIn + Len,          //MAC
+                    pIn,                //input
+                    pOut);              //output
     if (rc != 0) {
         LOGE("fail: mbedtls_chachapoly_auth_decrypt rc=-%04x\n", -rc);
-        goto LABEL_EXIT;
+        return false;
     }
 #endif
+    return true;
+}
 
-    pCtx->recv_ctx.nonce++;
-    if (pCtx->recv_ctx.nonce == 1000) {
+
+/** メッセージ本体処理後のnonce更新
+ *
+ * 1000に達したらkey rotationする。
+ *
+ * @param[in,out]   pCtx        send_ctx or recv_ctx
+ */
+static void noise_nonce_next(ln_noise_ctx_t *pCtx)
+{
+    pCtx->nonce++;
+    if (pCtx->nonce == 1000) {
         //key rotation
         //ck', k' = HKDF(ck, k)
-        noise_hkdf(pCtx->recv_ctx.ck, pCtx->recv_ctx.key, pCtx->recv_ctx.ck, pCtx->recv_ctx.key);
-        pCtx->recv_ctx.nonce = 0;
+        noise_hkdf(pCtx->ck, pCtx->key, pCtx->ck, pCtx->key);
+        pCtx->nonce = 0;
     }
-
-    utl_buf_free(pBuf);
-    utl_buf_alloc(pBuf, l);
-    memcpy(pBuf->buf, pm, l);
-    ret = true;
-
-LABEL_EXIT:
-    UTL_DBG_FREE(pm);
-
-    return ret;
 }
 
 
-/********************************************************************
- * private functions
- ********************************************************************/
-
 //BOLT#8
 //  HKDF(salt,ikm): a function defined in RFC 58693, evaluated with a zero-length info field
 //      All invocations of HKDF implicitly return 64 bytes of cryptographic randomness
@@ -25,9 +25,26 @@
 #ifndef LN_NOISE_H__
 #define LN_NOISE_H__
 
+#include "mbedtls/chachapoly.h"
+
+#include "btc_crypto.h"
 #include "btc_keys.h"
 
 
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define LN_SZ_NOISE_MAC             (16)        ///< (size) chacha20-poly1305 MAC
+
+/// (size) noise packet(暗号化したlength + MAC + 暗号化したmessage + MAC)
+#define LN_SZ_NOISE_FRAME(len)      (sizeof(uint16_t) + LN_SZ_NOISE_MAC + (len) + LN_SZ_NOISE_MAC)
+
+
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
 /** @struct ln_noise_ctx_t
  *  @brief  BOLT#8 protocol
  */
@@ -35,6 +52,8 @@ typedef struct {
     uint8_t         key[BTC_SZ_PRIVKEY];            ///< key
     uint64_t        nonce;                          ///< nonce
     uint8_t         ck[BTC_SZ_HASH256];             ///< chainkey
+    uint8_t         cipher_key[BTC_SZ_PRIVKEY];     ///< cipherに設定済みのkey
+    mbedtls_chachapoly_context  cipher;             ///< key設定済みcipher(keyが変わるまで使い回す)
 } ln_noise_ctx_t;
 
 
@@ -100,22 +119,74 @@ bool ln_noise_handshake_state(ln_noise_t *pCtx);
 void ln_noise_handshake_free(ln_noise_t *pCtx);
 
 
-/**
+/** noise packet作成
  *
+ * @param[in,out]       pCtx        noise情報
+ * @param[out]          pBufEnc     noise packet(#LN_SZ_NOISE_FRAME(pBufIn->len))
+ * @param[in]           pBufIn      送信メッセージ
+ * @retval      true    成功
  */
 bool ln_noise_enc(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn);
 
 
-/**
+/** noise packet作成(呼び出し元のバッファに書込み)
+ *
+ * lengthとmessageを暗号化して、pFrameに直接書き込む。
+ * メモリ確保は行わない。
  *
+ * @param[in,out]       pCtx        noise情報
+ * @param[out]          pFrame      noise packet(#LN_SZ_NOISE_FRAME(Len)以上の領域)
+ * @param[in]           pData       送信メッセージ(pFrame + sizeof(uint16_t) + #LN_SZ_NOISE_MAC でもよい)
+ * @param[in]           Len         pData長
+ * @retval      true    成功
+ */
+bool ln_noise_enc_frame(ln_noise_t *pCtx, uint8_t *pFrame, const uint8_t *pData, uint16_t Len);
+
+
+/** 複数noise packet作成
+ *
+ * pBufInを順に暗号化し、連続した1つのバッファにする。
+ *
+ * @param[in,out]       pCtx        noise情報
+ * @param[out]          pBufEnc     noise packet列
+ * @param[in]           pBufIn      送信メッセージ[Num]
+ * @param[in]           Num         pBufIn数
+ * @retval      true    成功
+ */
+bool ln_noise_enc_batch(ln_noise_t *pCtx, utl_buf_t *pBufEnc, const utl_buf_t *pBufIn, int Num);
+
+
+/** noise packet length復号
+ *
+ * @param[in,out]       pCtx        noise情報
+ * @param[in]           pData       受信データ(暗号化したlength + MAC)
+ * @param[in]           Len         pData長(LN_SZ_NOISE_HEADER)
+ * @return  続けて受信するデータ長(message + MAC), 0:失敗
  */
 uint16_t ln_noise_dec_len(ln_noise_t *pCtx, const uint8_t *pData, uint16_t Len);
 
 
-/**
+/** noise packet message復号
  *
+ * @param[in,out]       pCtx        noise情報
+ * @param[in,out]       pBuf        [in]暗号化したmessage + MAC, [out]message
+ * @retval      true    成功
+ * @note
+ *      - 同じ領域に復号し、pBuf->lenをMAC分短くする
  */
 bool ln_noise_dec_msg(ln_noise_t *pCtx, utl_buf_t *pBuf);
 
 
+/** noise packet message復号(同じ領域に復号)
+ *
+ * メモリ確保は行わない。
+ *
+ * @param[in,out]       pCtx        noise情報
+ * @param[in,out]       pData       [in]暗号化したmessage + MAC, [out]message(Len - #LN_SZ_NOISE_MAC)
+ * @param[in]           Len         pData長(#ln_noise_dec_len()の戻り値)
+ * @retval      true    成功
+ */
+bool ln_noise_dec_frame(ln_noise_t *pCtx, uint8_t *pData, uint16_t Len);
+
+
 #endif /* LN_NOISE_H__ */
@@ -42,6 +42,7 @@
 #include "btc_sw.h"
 
 #include "ln_db.h"
+#include "ln_forward.h"
 #include "ln_signer.h"
 #include "ln_commit_tx.h"
 #include "ln_derkey.h"
@@ -59,6 +60,7 @@
 #include "ln_normalope.h"
 #include "ln_funding_info.h"
 #include "ln_payment.h"
+#include "ln_routing.h"
 
 
 /**************************************************************************
@@ -191,9 +193,9 @@ bool HIDDEN ln_update_fulfill_htlc_recv(ln_channel_t *pChannel, const uint8_t *p
     const ln_update_t *p_update_add_htlc;
     ln_htlc_t *p_htlc = NULL;
     uint16_t update_idx_add_htlc;
-    for (update_idx_add_htlc = 0; update_idx_add_htlc < LN_UPDATE_MAX; update_idx_add_htlc++) {
+    for (update_idx_add_htlc = 0;
+        ln_update_info_next_used(&pChannel->update_info, &update_idx_add_htlc); update_idx_add_htlc++) {
         p_update_add_htlc = &pChannel->update_info.updates[update_idx_add_htlc];
-        if (!LN_UPDATE_USED(p_update_add_htlc)) continue;
         if (!LN_UPDATE_SEND_ENABLED(p_update_add_htlc, LN_UPDATE_TYPE_ADD_HTLC, true)) continue;
         if (!LN_UPDATE_IRREVOCABLY_COMMITTED(p_update_add_htlc)) continue;
         p_htlc = &pChannel->update_info.htlcs[p_update_add_htlc->type_specific_idx];
@@ -264,9 +266,9 @@ bool HIDDEN ln_update_fail_htlc_recv(ln_channel_t *pChannel, const uint8_t *pDat
     const ln_update_t *p_update_add_htlc;
     ln_htlc_t *p_htlc = NULL;
     uint16_t update_idx_add_htlc;
-    for (update_idx_add_htlc = 0; update_idx_add_htlc < LN_UPDATE_MAX; update_idx_add_htlc++) {
+    for (update_idx_add_htlc = 0;
+        ln_update_info_next_used(&pChannel->update_info, &update_idx_add_htlc); update_idx_add_htlc++) {
         p_update_add_htlc = &pChannel->update_info.updates[update_idx_add_htlc];
-        if (!LN_UPDATE_USED(p_update_add_htlc)) continue;
         if (!LN_UPDATE_SEND_ENABLED(p_update_add_htlc, LN_UPDATE_TYPE_ADD_HTLC, true)) continue;
         if (!LN_UPDATE_IRREVOCABLY_COMMITTED(p_update_add_htlc)) continue;
         p_htlc = &pChannel->update_info.htlcs[p_update_add_htlc->type_specific_idx];
@@ -314,9 +316,9 @@ bool HIDDEN ln_update_fail_malformed_htlc_recv(ln_channel_t *pChannel, const uin
     const ln_update_t *p_update_add_htlc;
     ln_htlc_t *p_htlc = NULL;
     uint16_t update_idx_add_htlc;
-    for (update_idx_add_htlc = 0; update_idx_add_htlc < LN_UPDATE_MAX; update_idx_add_htlc++) {
+    for (update_idx_add_htlc = 0;
+        ln_update_info_next_used(&pChannel->update_info, &update_idx_add_htlc); update_idx_add_htlc++) {
         p_update_add_htlc = &pChannel->update_info.updates[update_idx_add_htlc];
-        if (!LN_UPDATE_USED(p_update_add_htlc)) continue;
         if (!LN_UPDATE_SEND_ENABLED(p_update_add_htlc, LN_UPDATE_TYPE_ADD_HTLC, true)) continue;
         if (!LN_UPDATE_IRREVOCABLY_COMMITTED(p_update_add_htlc)) continue;
         p_htlc = &pChannel->update_info.htlcs[p_update_add_htlc->type_specific_idx];
@@ -444,7 +446,7 @@ bool HIDDEN ln_revoke_and_ack_recv(ln_channel_t *pChannel, const uint8_t *pData,
     M_DB_SECRET_SAVE(pChannel);
     M_DB_CHANNEL_SAVE(pChannel);
 
-    for (uint32_t idx = 0; idx < ARRAY_SIZE(pChannel->update_info.updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(&pChannel->update_info, &idx); idx++) {
         ln_update_t *p_update = &pChannel->update_info.updates[idx];
         if (!p_update->new_update) continue;
         if (LN_UPDATE_RECV_ENABLED(p_update, LN_UPDATE_TYPE_ADD_HTLC, true)) {
@@ -673,6 +675,8 @@ bool ln_fail_htlc_set(ln_channel_t *pChannel, uint64_t HtlcId, uint8_t UpdateTyp
 
 static bool poll_update_add_htlc_forward(ln_channel_t *pChannel)
 {
+    if (!ln_forward_pending(pChannel->short_channel_id, LN_FORWARD_ADD_HTLC)) return true;
+
     void* p_cur = NULL;
     if (!ln_db_forward_add_htlc_cur_open(&p_cur, pChannel->short_channel_id)) {
         return true;
@@ -744,6 +748,8 @@ static bool poll_update_add_htlc_forward(ln_channel_t *pChannel)
 
 static bool poll_update_del_htlc_forward(ln_channel_t *pChannel)
 {
+    if (!ln_forward_pending(pChannel->short_channel_id, LN_FORWARD_DEL_HTLC)) return true;
+
     void* p_cur = NULL;
     if (!ln_db_forward_del_htlc_cur_open(&p_cur, pChannel->short_channel_id)) {
         return true;
@@ -768,6 +774,7 @@ static bool poll_update_del_htlc_forward(ln_channel_t *pChannel)
             }
             if (!ln_fulfill_htlc_set(pChannel, prev_htlc_id, msg.p_payment_preimage)) {
                 //XXX: TODO update DB if once the forward is completed?
+                ln_forward_retry(pChannel->short_channel_id, LN_FORWARD_DEL_HTLC);
                 utl_buf_free(&buf);
                 continue;
             }
@@ -786,6 +793,7 @@ static bool poll_update_del_htlc_forward(ln_channel_t *pChannel)
             const utl_buf_t reason = {(CONST_CAST uint8_t *)msg.p_reason, msg.len};
             if (!ln_fail_htlc_set(pChannel, prev_htlc_id, LN_UPDATE_TYPE_FAIL_HTLC, &reason)) {
                 //XXX: TODO update DB if once the forward is completed?
+                ln_forward_retry(pChannel->short_channel_id, LN_FORWARD_DEL_HTLC);
                 utl_buf_free(&buf);
                 continue;
             }
@@ -803,6 +811,8 @@ static bool poll_update_del_htlc_forward(ln_channel_t *pChannel)
 
 static bool poll_update_add_htlc_forward_inactive(ln_channel_t *pChannel)
 {
+    if (!ln_forward_pending(pChannel->short_channel_id, LN_FORWARD_ADD_HTLC)) return true;
+
     void* p_cur = NULL;
     if (!ln_db_forward_add_htlc_cur_open(&p_cur, pChannel->short_channel_id)) {
         return true;
@@ -857,6 +867,8 @@ static bool poll_update_add_htlc_forward_inactive(ln_channel_t *pChannel)
 
 static bool poll_update_add_htlc_forward_closing(ln_channel_t *pChannel)
 {
+    if (!ln_forward_pending(pChannel->short_channel_id, LN_FORWARD_ADD_HTLC)) return true;
+
     void* p_cur = NULL;
     if (!ln_db_forward_add_htlc_cur_open(&p_cur, pChannel->short_channel_id)) {
         return true;
@@ -904,6 +916,8 @@ static bool poll_update_add_htlc_forward_closing(ln_channel_t *pChannel)
 
 static bool poll_update_add_htlc_forward_origin(ln_channel_t *pChannel)
 {
+    if (!ln_forward_pending(0, LN_FORWARD_ADD_HTLC)) return true;
+
     void* p_cur = NULL;
     if (!ln_db_forward_add_htlc_cur_open(&p_cur, 0)) {
         return true;
@@ -961,6 +975,7 @@ static bool poll_update_add_htlc_forward_origin(ln_channel_t *pChannel)
 #ifdef USE_CMD_IMPORTPREIMAGE
             if (fail_continue) {
                 LOGD("importpreimage: continue\n");
+                ln_forward_retry(0, LN_FORWARD_ADD_HTLC);
             } else
 #endif
             if (!ln_update_fail_htlc_forward_2(
@@ -1049,6 +1064,7 @@ static bool update_fail_htlc_forward_origin(
                 break;
             }
         }
+        ln_routing_notify_payment_fail(route.hop_datain, route.num_hops, hop, onion_err.reason);
         ln_db_route_skip_save(short_channel_id, b_temp);
         ln_short_channel_id_string(suggest, short_channel_id);
     }
@@ -1071,6 +1087,8 @@ static bool poll_update_del_htlc_forward_origin(ln_channel_t *pChannel)
 {
     (void)pChannel;
 
+    if (!ln_forward_pending(0, LN_FORWARD_DEL_HTLC)) return true;
+
     void* p_cur = NULL;
     if (!ln_db_forward_del_htlc_cur_open(&p_cur, 0)) {
         return true;
@@ -1096,6 +1114,10 @@ static bool poll_update_del_htlc_forward_origin(ln_channel_t *pChannel)
                 LOGE("fail: ???\n");
                 goto LABEL_SKIP;
             }
+            ln_payment_route_t route;
+            if (ln_payment_route_load(&route, prev_htlc_id)) {
+                ln_routing_notify_payment_success(route.hop_datain, route.num_hops);
+            }
             /*ignore*/ln_payment_end(prev_htlc_id, LN_PAYMENT_STATE_SUCCEEDED, msg.p_payment_preimage);
             /*ignore*/ln_db_route_skip_work(false);
         } else if (type == MSGTYPE_X_UPDATE_FAIL_HTLC) {
@@ -1194,9 +1216,8 @@ void ln_idle_proc(ln_channel_t *pChannel, uint32_t FeeratePerKw)
         /*ignore*/ ln_update_info_set_fee_pre_send(&pChannel->update_info, &update_idx, FeeratePerKw);
     }
 
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(&pChannel->update_info, &idx); idx++) {
         ln_update_t *p_update = &pChannel->update_info.updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_WAIT_SEND(p_update)) continue;
         switch (p_update->type) {
         case LN_UPDATE_TYPE_ADD_HTLC:
@@ -1253,6 +1274,8 @@ void ln_idle_proc_inactive(ln_channel_t *pChannel)
     if (updated) {
         LOGD("updated\n");
         M_DB_CHANNEL_SAVE(pChannel);
+        //clearしたupdateに対応するforward DBを処理し直す
+        ln_forward_retry(pChannel->short_channel_id, LN_FORWARD_ALL);
     }
 
     if (ln_is_shutdowning(pChannel)) {
@@ -1662,7 +1685,6 @@ static bool check_recv_add_htlc_bolt4_final(
     int32_t height = 0;
 
     ln_db_preimage_t preimage;
-    uint8_t preimage_hash[BTC_SZ_HASH256];
 
     utl_push_init(&push_reason, pReason, 0);
 
@@ -1673,33 +1695,8 @@ static bool check_recv_add_htlc_bolt4_final(
         return false;
     }
 
-    preimage.amount_msat = (uint64_t)-1;
-    preimage.expiry = 0;
-    void *p_cur;
-    if (!ln_db_preimage_cur_open(&p_cur)) { //XXX: internal error?
-#ifdef USE_CMD_IMPORTPREIMAGE
-        LOGE("no preimage. but continue\n");
-        *pbContinue = true;
-#else
-        M_SET_ERR(pChannel, LNERR_INV_VALUE, "preimage mismatch");
-        utl_push_u16be(&push_reason, LNONION_INCRR_OR_UNKNOWN_PAY);
-        utl_push_u64be(&push_reason, pForwardParam->amount_msat); //[8:htlc_msat]
-#endif
-        return false;
-    }
-    bool detect = false;
-    for (;;) {
-        detect = false;
-        if (!ln_db_preimage_cur_get(p_cur, &detect, &preimage, NULL)) break;     //from invoice
-        if (!detect) continue;
-        if (preimage.state != LN_DB_PREIMAGE_STATE_UNUSED) continue;
-        memcpy(pPreimage, preimage.preimage, LN_SZ_PREIMAGE);
-        ln_payment_hash_calc(preimage_hash, pPreimage);
-        if (memcmp(preimage_hash, pForwardParam->p_payment_hash, BTC_SZ_HASH256)) continue;
-        break;
-    }
-    ln_db_preimage_cur_close(p_cur, false);
-    if (!detect) {
+    if (!ln_db_preimage_search_hash(&preimage, pForwardParam->p_payment_hash) ||
+        (preimage.state != LN_DB_PREIMAGE_STATE_UNUSED)) {
 #ifdef USE_CMD_IMPORTPREIMAGE
         LOGE("preimage not found. but continue\n");
         *pbContinue = true;
@@ -1715,6 +1712,7 @@ static bool check_recv_add_htlc_bolt4_final(
 #endif
         return false;
     }
+    memcpy(pPreimage, preimage.preimage, LN_SZ_PREIMAGE);
     //LOGD("match preimage: ");
     //DUMPD(pPreimage, LN_SZ_PREIMAGE);
 
@@ -1938,7 +1936,7 @@ static bool revoke_and_ack_send(ln_channel_t *pChannel)
         irrevocably = true;
     }
 
-    for (uint32_t idx = 0; idx < ARRAY_SIZE(pChannel->update_info.updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(&pChannel->update_info, &idx); idx++) {
         ln_update_t *p_update = &pChannel->update_info.updates[idx];
         if (!p_update->new_update) continue;
         if (LN_UPDATE_SEND_ENABLED(p_update, LN_UPDATE_TYPE_FAIL_HTLC, true)) {
@@ -31,6 +31,7 @@
 #include "mbedtls/chacha20.h"
 #endif
 #include "mbedtls/md.h"
+#include "mbedtls/ecp.h"
 
 #include "utl_dbg.h"
 #include "utl_int.h"
@@ -83,8 +84,8 @@ static const uint8_t AMMAG[] = { 'a', 'm', 'm', 'a', 'g' };
  * prototypes
  **************************************************************************/
 
-static void multi_scalar_mul(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactors, int NumHops);
 static bool blind_group_element(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactor);
+static bool blind_scalar(uint8_t *pResult, const uint8_t *pPrivKey, const uint8_t *pBlindingFactor);
 static void compute_blinding_factor(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pSharedSecret);
 static int generate_header_padding(uint8_t *pResult, const uint8_t *pKeyStr, int StrLen, int NumHops, const uint8_t *pSharedSecrets);
 static bool generate_key(uint8_t *pResult, const uint8_t *pKeyStr, int StrLen, const uint8_t *pSharedSecret);
@@ -110,10 +111,12 @@ bool ln_onion_create_packet(uint8_t *pPacket,
         return false;
     }
 
+    bool ret = false;
     int filler_len;
     uint8_t next_hmac[M_SZ_HMAC];
     uint8_t rho_key[M_SZ_KEYLEN];
     uint8_t mu_key[M_SZ_KEYLEN];
+    uint8_t acc_key[BTC_SZ_PRIVKEY];
 
     //メモリ確保
     uint8_t *eph_pubkeys = (uint8_t *)UTL_DBG_MALLOC(BTC_SZ_PUBKEY * NumHops);
@@ -135,20 +138,25 @@ bool ln_onion_create_packet(uint8_t *pPacket,
     //eph_pubkeys[0]とshd_secrets[0]から計算 --> blind_factors[0]
     compute_blinding_factor(blind_factors, eph_pubkeys, shd_secrets);
 
+    //セッション鍵 --> acc_key
+    //  acc_keyにはblind_factorsを掛けていき、eph_pubkeys[lp]の秘密鍵として使う
+    memcpy(acc_key, pSessionKey, BTC_SZ_PRIVKEY);
+
     for (int lp = 1; lp < NumHops; lp++) {
         //eph_pubkeys[lp-1] * blind_factors[lp - 1] --> eph_pubkeys[lp]
         blind_group_element(eph_pubkeys + BTC_SZ_PUBKEY * lp,
                             eph_pubkeys + BTC_SZ_PUBKEY * (lp - 1),
                             blind_factors + M_SZ_BLINDING_FACT * (lp - 1));
 
-        //paymentPath[lp] * セッション鍵 --> yToX(公開鍵)
-        //yToXにblind_factors[0～lp]までを掛けていった結果をSHA256 --> shd_secrets[lp]
-        uint8_t yToX[BTC_SZ_PUBKEY];
-        uint8_t buf[BTC_SZ_PUBKEY];
+        //acc_key * blind_factors[lp - 1] mod n --> acc_key
+        if (!blind_scalar(acc_key, acc_key, blind_factors + M_SZ_BLINDING_FACT * (lp - 1))) {
+            LOGE("fail: blind_scalar\n");
+            goto LABEL_EXIT;
+        }
 
-        blind_group_element(yToX, pHopData[lp].pubkey, pSessionKey);
-        multi_scalar_mul(buf, yToX, blind_factors, lp);
-        btc_md_sha256(shd_secrets + M_SZ_SHARED_SECRET * lp, buf, sizeof(buf));
+        //paymentPath[lp] * acc_key のSHA256 --> shd_secrets[lp]
+        //  paymentPath[lp] * セッション鍵 * blind_factors[0～lp-1] と同じ
+        btc_ecc_shared_secret_sha256(shd_secrets + M_SZ_SHARED_SECRET * lp, pHopData[lp].pubkey, acc_key);
 
         //SHA256(eph_pubkeys[lp] || shd_secrets[lp]) --> blind_factors[lp]
         compute_blinding_factor(blind_factors + M_SZ_BLINDING_FACT * lp,
@@ -231,6 +239,10 @@ bool ln_onion_create_packet(uint8_t *pPacket,
     if (pSecrets) {
         utl_buf_alloccopy(pSecrets, shd_secrets, M_SZ_SHARED_SECRET * NumHops);
     }
+    ret = true;
+
+LABEL_EXIT:
+    memset(acc_key, 0, sizeof(acc_key));
 
     //メモリ解放
     UTL_DBG_FREE(stream_bytes);
@@ -240,7 +252,7 @@ bool ln_onion_create_packet(uint8_t *pPacket,
     UTL_DBG_FREE(shd_secrets);
     UTL_DBG_FREE(eph_pubkeys);
 
-    return true;
+    return ret;
 }
 
 
@@ -614,28 +626,49 @@ char *ln_onion_get_errstr(const ln_onion_err_t *pOnionErr)
  * private functions
  **************************************************************************/
 
-/** loop{ PubKey * BlindingFactor[lp] } --> pOutput
+/** PubKey * BlindingFactor --> pResult
  *
  * @param[out]      pResult         BTC_SZ_PUBKEY
  */
-static void multi_scalar_mul(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactors, int NumHops)
+static bool blind_group_element(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactor)
 {
-    memcpy(pResult, pPubKey, BTC_SZ_PUBKEY);
-    for (int lp = 0; lp < NumHops; lp++) {
-        //前の結果公開鍵 * pBlindingFactors[lp] --> 結果公開鍵
-        blind_group_element(pResult, pResult, pBlindingFactors + M_SZ_BLINDING_FACT * lp);
-    }
+    bool ret = btc_ecc_mul_pubkey(pResult, pPubKey, pBlindingFactor, M_SZ_BLINDING_FACT);
+    return ret;
 }
 
 
-/** PubKey * BlindingFactor --> pResult
+/** PrivKey * BlindingFactor mod n --> pResult
  *
- * @param[out]      pResult         BTC_SZ_PUBKEY
+ * @param[out]      pResult         BTC_SZ_PRIVKEY(pPrivKeyと同じでもよい)
  */
-static bool blind_group_element(uint8_t *pResult, const uint8_t *pPubKey, const uint8_t *pBlindingFactor)
+static bool blind_scalar(uint8_t *pResult, const uint8_t *pPrivKey, const uint8_t *pBlindingFactor)
 {
-    bool ret = btc_ecc_mul_pubkey(pResult, pPubKey, pBlindingFactor, M_SZ_BLINDING_FACT);
-    return ret;
+    int ret;
+    mbedtls_ecp_group grp;
+    mbedtls_mpi k;
+    mbedtls_mpi b;
+
+    mbedtls_ecp_group_init(&grp);
+    mbedtls_mpi_init(&k);
+    mbedtls_mpi_init(&b);
+
+    ret = mbedtls_ecp_group_load(&grp, MBEDTLS_ECP_DP_SECP256K1);
+    if (ret) goto LABEL_EXIT;
+    ret = mbedtls_mpi_read_binary(&k, pPrivKey, BTC_SZ_PRIVKEY);
+    if (ret) goto LABEL_EXIT;
+    ret = mbedtls_mpi_read_binary(&b, pBlindingFactor, M_SZ_BLINDING_FACT);
+    if (ret) goto LABEL_EXIT;
+    ret = mbedtls_mpi_mul_mpi(&k, &k, &b);
+    if (ret) goto LABEL_EXIT;
+    ret = mbedtls_mpi_mod_mpi(&k, &k, &grp.N);
+    if (ret) goto LABEL_EXIT;
+    ret = mbedtls_mpi_write_binary(&k, pResult, BTC_SZ_PRIVKEY);
+
+LABEL_EXIT:
+    mbedtls_mpi_free(&b);
+    mbedtls_mpi_free(&k);
+    mbedtls_ecp_group_free(&grp);
+    return ret == 0;
 }
 
 
@@ -707,13 +740,13 @@ static void generate_cipher_stream(uint8_t *pResult, const uint8_t *pKey, int Le
     crypto_stream_chacha20(pResult, Len, nonce, pKey);
 #else
     uint8_t nonce[12] = {0};
-    uint8_t *dummy = (uint8_t *)UTL_DBG_CALLOC(1, Len);
-    int ret = mbedtls_chacha20_crypt(pKey, nonce, 0, Len, dummy, pResult);
+    //0とのXORがstreamになるので、pResultをその場で暗号化する
+    memset(pResult, 0, Len);
+    int ret = mbedtls_chacha20_crypt(pKey, nonce, 0, Len, pResult, pResult);
     if (ret != 0) {
         LOGE("FATAL: mbedtls_chacha20_crypt\n");
         abort();
     }
-    UTL_DBG_FREE(dummy);
 #endif
 }
 
@@ -35,6 +35,7 @@
 #include "utl_dbg.h"
 #include "utl_time.h"
 #include "utl_int.h"
+#include "utl_push.h"
 
 #include "btc_crypto.h"
 #include "btc_script.h"
@@ -55,18 +56,26 @@
 #include "ln_payment.h"
 
 
+/**************************************************************************
+ * macros
+ **************************************************************************/
+
+#define M_ROUTE_CAND_MAX        (5)         ///< route候補の最大数(先頭のrouteを含む)
+
+
 /**************************************************************************
  * prototypes
  **************************************************************************/
 
 static ln_payment_error_t route_invoice(
-    ln_payment_route_t *pRoute, uint8_t *pPaymentHash,
+    ln_payment_route_t *pRoute, utl_buf_t *pRouteCand, uint8_t *pPaymentHash,
     const char *pInvoice, uint32_t InvoiceLen,
-    uint64_t AdditionalAmountMsat, uint32_t BlockCount);
+    uint64_t AdditionalAmountMsat, uint8_t RetryCount, uint32_t BlockCount);
 static ln_payment_error_t payment_start(
-    uint64_t *pPaymentId, const ln_payment_route_t *pRoute, const uint8_t *pPaymentHash,
-    uint64_t AdditionalAmountMsat, uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount,
-    const char *pInvoice);
+    uint64_t *pPaymentId, const ln_payment_route_t *pRoute, const utl_buf_t *pRouteCand,
+    const uint8_t *pPaymentHash, uint64_t AdditionalAmountMsat, uint8_t RetryCount,
+    bool AutoRemove, uint32_t BlockCount, const char *pInvoice);
+static bool route_cand_pop(ln_payment_route_t *pRoute, uint64_t PaymentId, uint32_t BlockCount);
 static ln_payment_error_t check_route(const ln_payment_route_t *pRoute);
 static void payment_info_init(
     ln_payment_info_t *pInfo, const uint8_t *pPaymentHash, uint64_t AdditionalAmountMsat,
@@ -86,17 +95,21 @@ ln_payment_error_t ln_payment_start_invoice(
 
     ln_payment_error_t  retval = LN_PAYMENT_ERROR;
     uint8_t             payment_hash[BTC_SZ_HASH256];
+    utl_buf_t           route_cand = UTL_BUF_INIT;
 
     retval = route_invoice(
-        pRoute, payment_hash, pInvoice, strlen(pInvoice), AdditionalAmountMsat, BlockCount);
+        pRoute, &route_cand, payment_hash, pInvoice, strlen(pInvoice),
+        AdditionalAmountMsat, RetryCount, BlockCount);
     if (retval != LN_PAYMENT_OK) {
         LOGE("fail: ???\n");
         return retval;
     }
 
-    return payment_start(
-        pPaymentId, pRoute, payment_hash, AdditionalAmountMsat,
+    retval = payment_start(
+        pPaymentId, pRoute, &route_cand, payment_hash, AdditionalAmountMsat,
         RetryCount, AutoRemove, BlockCount, pInvoice);
+    utl_buf_free(&route_cand);
+    return retval;
 }
 
 
@@ -107,7 +120,7 @@ ln_payment_error_t ln_payment_start_test(
     *pPaymentId = LN_PAYMENT_ID_INVALID;
 
     return payment_start(
-        pPaymentId, pRoute, pPaymentHash, 0, 0, true, BlockCount, NULL);
+        pPaymentId, pRoute, NULL, pPaymentHash, 0, 0, true, BlockCount, NULL);
 }
 
 
@@ -115,6 +128,7 @@ ln_payment_error_t ln_payment_retry(uint64_t PaymentId, uint32_t BlockCount)
 {
     ln_payment_error_t  retval = LN_PAYMENT_ERROR;
     utl_buf_t           buf_invoice = UTL_BUF_INIT;
+    utl_buf_t           route_cand = UTL_BUF_INIT;
     ln_payment_route_t  route;
     uint8_t             payment_hash[BTC_SZ_HASH256];
     ln_payment_info_t   info;
@@ -131,20 +145,34 @@ ln_payment_error_t ln_payment_retry(uint64_t PaymentId, uint32_t BlockCount)
         retval = LN_PAYMENT_ERROR;
         goto LABEL_ERROR;
     }
-    if (!ln_db_payment_invoice_load(&buf_invoice, PaymentId)) {
-        LOGE("fail: ???\n");
-        retval = LN_PAYMENT_ERROR;
-        goto LABEL_ERROR;
-    }
     info.retry_count++;
 
-    //routing with invoice
-    retval = route_invoice(
-        &route, payment_hash, (const char *)buf_invoice.buf, buf_invoice.len,
-        info.additional_amount_msat, BlockCount);
-    if (retval != LN_PAYMENT_OK) {
-        LOGE("fail: route_invoice\n");
-        goto LABEL_ERROR;
+    if (route_cand_pop(&route, PaymentId, BlockCount)) {
+        //前回計算したroute候補
+        LOGD("use route candidate\n");
+        memcpy(payment_hash, info.payment_hash, BTC_SZ_HASH256);
+    } else {
+        if (!ln_db_payment_invoice_load(&buf_invoice, PaymentId)) {
+            LOGE("fail: ???\n");
+            retval = LN_PAYMENT_ERROR;
+            goto LABEL_ERROR;
+        }
+
+        //routing with invoice
+        retval = route_invoice(
+            &route, &route_cand, payment_hash, (const char *)buf_invoice.buf, buf_invoice.len,
+            info.additional_amount_msat, info.max_retry_count - info.retry_count, BlockCount);
+        if (retval != LN_PAYMENT_OK) {
+            LOGE("fail: route_invoice\n");
+            goto LABEL_ERROR;
+        }
+        if (route_cand.len) {
+            if (!ln_db_payment_route_cand_save(PaymentId, route_cand.buf, route_cand.len)) {
+                LOGE("fail: ???\n");
+                retval = LN_PAYMENT_ERROR;
+                goto LABEL_ERROR;
+            }
+        }
     }
 
     //update payment data
@@ -166,14 +194,15 @@ ln_payment_error_t ln_payment_retry(uint64_t PaymentId, uint32_t BlockCount)
     }
 
     utl_buf_free(&buf_invoice);
+    utl_buf_free(&route_cand);
     return LN_PAYMENT_OK;
 
 LABEL_ERROR:
+    utl_buf_free(&buf_invoice);
+    utl_buf_free(&route_cand);
     if (retval == LN_PAYMENT_ERROR_RETRY) {
         retval = ln_payment_retry(PaymentId, BlockCount);
     }
-
-    utl_buf_free(&buf_invoice);
     return retval;
 }
 
@@ -190,6 +219,7 @@ bool ln_payment_end(uint64_t PaymentId, ln_payment_state_t State, const uint8_t
     } else {
         /*ignore*/ln_db_payment_shared_secrets_del(PaymentId);
         /*ignore*/ln_db_payment_route_del(PaymentId);
+        /*ignore*/ln_db_payment_route_cand_del(PaymentId);
         info.state = State;
         if (State == LN_PAYMENT_STATE_SUCCEEDED) {
             if (pPreimage) {
@@ -257,12 +287,32 @@ static void payment_info_init(
 }
 
 
+/** invoiceからroute計算
+ *
+ * pRouteCandには、retry用に次点以降のroute候補をRetryCount個まで返す。
+ *      - uint32_t BlockCount(big endian)
+ *      - [uint8_t num_hops][ln_hop_datain_t hop_datain[num_hops]]の繰り返し
+ *
+ * @param[out]  pRoute
+ * @param[out]  pRouteCand      route候補(候補がない場合はlen=0)
+ * @param[out]  pPaymentHash
+ * @param[in]   pInvoice
+ * @param[in]   InvoiceLen
+ * @param[in]   AdditionalAmountMsat
+ * @param[in]   RetryCount      残りretry回数
+ * @param[in]   BlockCount
+ */
 static ln_payment_error_t route_invoice(
-    ln_payment_route_t *pRoute, uint8_t *pPaymentHash,
+    ln_payment_route_t *pRoute, utl_buf_t *pRouteCand, uint8_t *pPaymentHash,
     const char *pInvoice, uint32_t InvoiceLen,
-    uint64_t AdditionalAmountMsat, uint32_t BlockCount)
+    uint64_t AdditionalAmountMsat, uint8_t RetryCount, uint32_t BlockCount)
 {
-    ln_payment_error_t retval = LN_PAYMENT_ERROR;
+    ln_payment_error_t  retval = LN_PAYMENT_ERROR;
+    ln_routing_result_t *p_results = NULL;
+    uint8_t             route_num = 0;
+    uint8_t             route_max = (RetryCount < M_ROUTE_CAND_MAX) ? RetryCount + 1 : M_ROUTE_CAND_MAX;
+
+    utl_buf_init(pRouteCand);
 
     ln_invoice_t *p_invoice_data = NULL;
     if (!ln_invoice_decode_2(&p_invoice_data, pInvoice, InvoiceLen)) {
@@ -289,9 +339,9 @@ static ln_payment_error_t route_invoice(
 
     p_invoice_data->amount_msat += AdditionalAmountMsat;
 
-    ln_routing_result_t route_result;
-    lnerr_route_t err = ln_routing_calculate(
-        &route_result, ln_node_get_id(), p_invoice_data->pubkey,
+    p_results = (ln_routing_result_t *)UTL_DBG_MALLOC(sizeof(ln_routing_result_t) * route_max);
+    lnerr_route_t err = ln_routing_calculate_k(
+        p_results, &route_num, route_max, ln_node_get_id(), p_invoice_data->pubkey,
         BlockCount + p_invoice_data->min_final_cltv_expiry,
         p_invoice_data->amount_msat, p_invoice_data->r_field_num,
         p_invoice_data->r_field);
@@ -317,22 +367,38 @@ static ln_payment_error_t route_invoice(
     }
 
     memcpy(pPaymentHash, p_invoice_data->payment_hash, BTC_SZ_HASH256);
-    pRoute->num_hops = route_result.num_hops;
-    memcpy(pRoute->hop_datain, route_result.hop_datain, sizeof(pRoute->hop_datain));
+    pRoute->num_hops = p_results[0].num_hops;
+    memcpy(pRoute->hop_datain, p_results[0].hop_datain, sizeof(pRoute->hop_datain));
+
+    if (route_num > 1) {
+        utl_push_t push;
+        if (!utl_push_init(&push, pRouteCand, 0)) goto LABEL_ERROR;
+        if (!utl_push_u32be(&push, BlockCount)) goto LABEL_ERROR;
+        for (uint8_t lp = 1; lp < route_num; lp++) {
+            if (!utl_push_byte(&push, p_results[lp].num_hops)) goto LABEL_ERROR;
+            if (!utl_push_data(&push, p_results[lp].hop_datain,
+                sizeof(ln_hop_datain_t) * p_results[lp].num_hops)) goto LABEL_ERROR;
+        }
+        if (!utl_push_trim(&push)) goto LABEL_ERROR;
+    }
+    LOGD("route candidates: %u\n", route_num);
 
+    UTL_DBG_FREE(p_results);
     ln_invoice_decode_free(p_invoice_data);
     return LN_PAYMENT_OK;
 
 LABEL_ERROR:
+    utl_buf_free(pRouteCand);
+    UTL_DBG_FREE(p_results);
     ln_invoice_decode_free(p_invoice_data);
     return retval;
 }
 
 
 static ln_payment_error_t payment_start(
-    uint64_t *pPaymentId, const ln_payment_route_t *pRoute, const uint8_t *pPaymentHash,
-    uint64_t AdditionalAmountMsat, uint8_t RetryCount, bool AutoRemove, uint32_t BlockCount,
-    const char *pInvoice)
+    uint64_t *pPaymentId, const ln_payment_route_t *pRoute, const utl_buf_t *pRouteCand,
+    const uint8_t *pPaymentHash, uint64_t AdditionalAmountMsat, uint8_t RetryCount,
+    bool AutoRemove, uint32_t BlockCount, const char *pInvoice)
 {
     ln_payment_error_t  retval = LN_PAYMENT_ERROR;
     ln_payment_info_t   info;
@@ -365,6 +431,13 @@ static ln_payment_error_t payment_start(
             goto LABEL_ERROR;
         }
     }
+    if (pRouteCand && pRouteCand->len) {
+        if (!ln_db_payment_route_cand_save(*pPaymentId, pRouteCand->buf, pRouteCand->len)) {
+            LOGE("fail: ???\n");
+            retval = LN_PAYMENT_ERROR;
+            goto LABEL_ERROR;
+        }
+    }
 
     //payment
     retval = payment(*pPaymentId, pPaymentHash, pRoute);
@@ -433,6 +506,96 @@ LABEL_ERROR:
 }
 
 
+/** 保存したroute候補から次のrouteを取り出す
+ *
+ * 送金失敗したchannel(route skip DBでTEMP/PERM)を含む候補は捨てる。
+ * 取り出した候補とそれより前の候補はDBから削除する。
+ *
+ * @param[out]  pRoute
+ * @param[in]   PaymentId
+ * @param[in]   BlockCount      現在のblock height(outgoing_cltv_valueを補正する)
+ * @retval  true    取り出した
+ */
+static bool route_cand_pop(ln_payment_route_t *pRoute, uint64_t PaymentId, uint32_t BlockCount)
+{
+    bool            ret = false;
+    utl_buf_t       buf = UTL_BUF_INIT;
+    utl_buf_t       buf_remain = UTL_BUF_INIT;
+    const uint8_t   *p;
+    uint32_t        remain;
+    uint32_t        block_count;
+
+    if (!ln_db_payment_route_cand_load(&buf, PaymentId)) {
+        return false;
+    }
+    if (buf.len < sizeof(uint32_t)) {
+        LOGE("fail: invalid route candidate\n");
+        goto LABEL_EXIT;
+    }
+    block_count = utl_int_pack_u32be(buf.buf);
+    p = buf.buf + sizeof(uint32_t);
+    remain = buf.len - sizeof(uint32_t);
+
+    while (remain > 0) {
+        uint8_t num_hops = p[0];
+        uint32_t len = sizeof(ln_hop_datain_t) * num_hops;
+        if ((num_hops < 2) || (num_hops > 1 + LN_HOP_MAX) || (remain < 1 + len)) {
+            LOGE("fail: invalid route candidate\n");
+            remain = 0;
+            break;
+        }
+        const uint8_t *p_hop = p + 1;
+        p += 1 + len;
+        remain -= 1 + len;
+
+        pRoute->num_hops = num_hops;
+        memcpy(pRoute->hop_datain, p_hop, len);
+
+        bool skip = false;
+        for (uint8_t lp = 0; lp < num_hops - 1; lp++) {
+            ln_db_route_skip_t rskip = ln_db_route_skip_search(pRoute->hop_datain[lp].short_channel_id);
+            if ((rskip != LN_DB_ROUTE_SKIP_NONE) && (rskip != LN_DB_ROUTE_SKIP_WORK)) {
+                LOGD("skip candidate: short_channel_id=%016" PRIx64 "\n",
+                    pRoute->hop_datain[lp].short_channel_id);
+                skip = true;
+                break;
+            }
+        }
+        if (skip) continue;
+
+        //計算時からのblock進行分だけcltvをずらす
+        if (BlockCount > block_count) {
+            for (uint8_t lp = 0; lp < num_hops; lp++) {
+                pRoute->hop_datain[lp].outgoing_cltv_value += BlockCount - block_count;
+            }
+        }
+        ret = true;
+        break;
+    }
+
+    if (ret && (remain > 0)) {
+        //残りの候補を保存
+        if (!utl_buf_alloc(&buf_remain, sizeof(uint32_t) + remain)) {
+            LOGE("fail: ???\n");
+            goto LABEL_EXIT;
+        }
+        memcpy(buf_remain.buf, buf.buf, sizeof(uint32_t));
+        memcpy(buf_remain.buf + sizeof(uint32_t), p, remain);
+        if (!ln_db_payment_route_cand_save(PaymentId, buf_remain.buf, buf_remain.len)) {
+            LOGE("fail: ???\n");
+        }
+        utl_buf_free(&buf_remain);
+        utl_buf_free(&buf);
+        return ret;
+    }
+
+LABEL_EXIT:
+    /*ignore*/ln_db_payment_route_cand_del(PaymentId);
+    utl_buf_free(&buf);
+    return ret;
+}
+
+
 static ln_payment_error_t check_route(const ln_payment_route_t *pRoute)
 {
     for (int lp = 0; lp < pRoute->num_hops - 2; lp++) {
@@ -21,6 +21,9 @@
  */
 /** @file   ln_routing.cpp
  *  @brief  routing計算
+ *
+ * announcement DBから作成したgraphは常駐させ、DB更新時の通知(ln_routing_notify_xxx())で差分更新する。
+ * 送金ごとにはDijkstraのみを行う。
  */
 #include <stdio.h>
 #include <stdlib.h>
@@ -29,22 +32,29 @@
 #include <cinttypes>
 #include <stdbool.h>
 #include <assert.h>
+#include <math.h>
+#include <pthread.h>
 
 #include "ln_local.h"
 #include "ln_db.h"
 #include "ln_db_lmdb.h"
 #include "ln_invoice.h"
+#include "ln_intern.h"
 #include "utl_dbg.h"
+#include "utl_time.h"
 
 #include <iostream>
 #include <fstream>
 #include <deque>
 #include <vector>
+#include <map>
+#include <algorithm>
 
 #include <boost/config.hpp>
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/dijkstra_shortest_paths.hpp>
 #include <boost/graph/graph_traits.hpp>
+#include <boost/graph/filtered_graph.hpp>
 #include <boost/property_map/property_map.hpp>
 #ifdef M_GRAPHVIZ
 #include <boost/graph/graphviz.hpp>
@@ -65,6 +75,17 @@ using namespace boost;
                                                     //  攪乱するためにオフセットとして加算するCLTV
                                                     //  https://github.com/lightningnetwork/lightning-rfc/blob/master/07-routing-gossip.md#recommendations-for-routing
 
+#define M_EVENT_MAX                         (100000)    ///< 未反映のgraph更新通知数上限(超えた場合はDBから再作成)
+
+#define M_LOW_PRIORITY_MULT                 (100)       ///< LN_DB_ROUTE_SKIP_WORKのコスト倍率
+
+//liquidity推定
+#define M_LIQUIDITY_UNKNOWN                 UINT64_MAX  ///< 上限不明
+#define M_LIQUIDITY_HALFLIFE_SEC            (3600)      ///< 推定値の半減期(この時間で推定が半分だけ不明側に戻る)
+#define M_LIQUIDITY_EXPIRE_SEC              (M_LIQUIDITY_HALFLIFE_SEC * 10)     ///< 推定値の破棄
+#define M_LIQUIDITY_PENALTY_BASE_MSAT       (500)       ///< 成功確率ペナルティ(-log2(P)あたり)
+#define M_LIQUIDITY_PENALTY_PPM             (1000)      ///< 成功確率ペナルティ(-log2(P)あたり, 送金額の比率)
+
 #if 1
 #define M_DBGLOG(...)
 #define M_DBGDUMP(...)
@@ -86,32 +107,32 @@ using namespace boost;
  * typedefs
  **************************************************************************/
 
-extern "C" {
-    bool ln_get_ids_cnl_anno(uint64_t *p_short_channel_id, uint8_t *pNodeId1, uint8_t *pNodeId2, const uint8_t *pData, uint16_t Len);
-    bool ln_channel_update_get_params(ln_msg_channel_update_t *pUpd, const uint8_t *pData, uint16_t Len);
-}
-
-struct Node {
-    //std::string name;
-    const uint8_t*  p_node;
-};
-
 struct Fee {
     //std::string name;
     uint64_t    short_channel_id;
     uint32_t    fee_base_msat;
     uint32_t    fee_prop_millionths;
     uint16_t    cltv_expiry_delta;
+    uint8_t     dir;                ///< channel_updateのdirection
+    uint64_t    htlc_minimum_msat;
+    uint64_t    htlc_maximum_msat;  ///< 0:不明
     uint64_t    weight;
-    const uint8_t   *node_id;
+    ln_db_route_skip_t  route_skip;
+    bool        pruned;             ///< true:送金額を流せないため除外(edge_weight_update()で設定)
+    bool        banned;             ///< true:経路探索から除外(path_k_search()用)
 
     Fee() {
         short_channel_id = 0;
         fee_base_msat = 0;
         fee_prop_millionths = 0;
         cltv_expiry_delta = 0;
+        dir = 0;
+        htlc_minimum_msat = 0;
+        htlc_maximum_msat = 0;
         weight = 0;
-        node_id = NULL;
+        route_skip = LN_DB_ROUTE_SKIP_NONE;
+        pruned = false;
+        banned = false;
     }
 };
 
@@ -119,11 +140,40 @@ typedef adjacency_list <
                 listS,
                 vecS,
                 bidirectionalS,
-                Node,
+                no_property,        //vertex index == node index(mIntern)
                 Fee
         > graph_t;
 typedef graph_traits < graph_t >::vertex_descriptor vertex_descriptor;
 typedef graph_traits < graph_t >::vertex_iterator vertex_iterator;
+typedef graph_traits < graph_t >::edge_descriptor edge_descriptor;
+
+typedef std::vector<edge_descriptor> path_t;
+
+struct path_cand_t {
+    path_t      path;
+    uint64_t    cost;               ///< weight合計
+};
+
+//filtered_graph用
+struct edge_ban_t {
+    const graph_t *p_graph;
+    edge_ban_t() : p_graph(NULL) {}
+    edge_ban_t(const graph_t *pGraph) : p_graph(pGraph) {}
+    bool operator()(const edge_descriptor& e) const {
+        return !(*p_graph)[e].banned && !(*p_graph)[e].pruned;
+    }
+};
+
+struct vertex_ban_t {
+    const std::vector<bool> *p_ban;
+    vertex_ban_t() : p_ban(NULL) {}
+    vertex_ban_t(const std::vector<bool> *pBan) : p_ban(pBan) {}
+    bool operator()(const vertex_descriptor& v) const {
+        return !(*p_ban)[v];
+    }
+};
+
+typedef filtered_graph<graph_t, edge_ban_t, vertex_ban_t> graph_filtered_t;
 
 struct nodes_t {
     uint64_t    short_channel_id;
@@ -131,6 +181,7 @@ struct nodes_t {
         uint8_t     node_id[BTC_SZ_PUBKEY];
         uint16_t    cltv_expiry_delta;
         uint64_t    htlc_minimum_msat;
+        uint64_t    htlc_maximum_msat;
         uint32_t    fee_base_msat;
         uint32_t    fee_prop_millionths;
         ln_db_route_skip_t   route_skip;              //ln_db_route_skip_search()
@@ -148,6 +199,114 @@ struct param_channel_t {
 };
 
 
+/** @struct     channel_t
+ *  @brief      常駐graphのchannel情報(announcement DB由来)
+ */
+struct channel_t {
+    bool                announced;          ///< true:channel_announcement反映済み(vtx[]有効)
+    ln_db_route_skip_t  route_skip;         ///< ln_db_route_skip_search()
+    vertex_descriptor   vtx[2];             ///< [0]node_id1, [1]node_id2
+    struct {
+        uint16_t    cltv_expiry_delta;      ///< M_CLTV_INIT:channel_update未受信 or disable
+        uint64_t    htlc_minimum_msat;
+        uint64_t    htlc_maximum_msat;      ///< 0:option_channel_htlc_maxなし
+        uint32_t    fee_base_msat;
+        uint32_t    fee_prop_millionths;
+        bool        has_edge;               ///< true:edge有効
+        edge_descriptor edge;               ///< [0]node_id1-->node_id2, [1]node_id2-->node_id1
+    } ninfo[2];         //[0]channel_updateのdir0, [1]channel_updateのdir1
+
+    channel_t() {
+        announced = false;
+        route_skip = LN_DB_ROUTE_SKIP_NONE;
+        vtx[0] = vtx[1] = 0;
+        for (int lp = 0; lp < 2; lp++) {
+            ninfo[lp].cltv_expiry_delta = M_CLTV_INIT;
+            ninfo[lp].htlc_minimum_msat = 0;
+            ninfo[lp].htlc_maximum_msat = 0;
+            ninfo[lp].fee_base_msat = 0;
+            ninfo[lp].fee_prop_millionths = 0;
+            ninfo[lp].has_edge = false;
+        }
+    }
+};
+
+typedef std::map<uint64_t, channel_t> channel_map_t;
+
+
+/** @struct     liquidity_t
+ *  @brief      channel(方向別)の送金可能額の推定
+ *
+ * 送金結果から学習する。時間経過で不明側に戻す。
+ */
+struct liquidity_t {
+    uint64_t    min_msat;           ///< この額までは送金できた
+    uint64_t    max_msat;           ///< この額を超えると送金できなかった(M_LIQUIDITY_UNKNOWN:不明)
+    uint64_t    update_time;        ///< 最終更新時刻
+
+    liquidity_t() {
+        min_msat = 0;
+        max_msat = M_LIQUIDITY_UNKNOWN;
+        update_time = 0;
+    }
+};
+
+typedef std::pair<uint64_t, uint8_t> liquidity_key_t;      //short_channel_id, direction
+typedef std::map<liquidity_key_t, liquidity_t> liquidity_map_t;
+
+
+/** @enum   event_type_t
+ *  @brief  graph更新通知の種別
+ */
+enum event_type_t {
+    EVENT_CNLANNO,              ///< channel_announcement保存
+    EVENT_CNLUPD,               ///< channel_update保存
+    EVENT_CNLANNO_DEL,          ///< channel_announcement/channel_update削除
+    EVENT_SKIP_SAVE,            ///< route_skip登録
+    EVENT_SKIP_WORK,            ///< route_skip TEMP<-->WORK
+    EVENT_SKIP_DROP,            ///< route_skip削除
+};
+
+
+/** @struct     event_t
+ *  @brief      graph更新通知
+ */
+struct event_t {
+    event_type_t    type;
+    uint64_t        short_channel_id;
+    char            anno_type;                      ///< EVENT_CNLANNO_DEL: LN_DB_CNLANNO_xxx(0:all)
+    bool            flag;                           ///< EVENT_SKIP_xxx: bTemp or bWork
+    uint8_t         node_id[2][BTC_SZ_PUBKEY];      ///< EVENT_CNLANNO
+    uint8_t         dir;                            ///< EVENT_CNLUPD
+    uint8_t         channel_flags;                  ///< EVENT_CNLUPD
+    uint16_t        cltv_expiry_delta;              ///< EVENT_CNLUPD
+    uint64_t        htlc_minimum_msat;              ///< EVENT_CNLUPD
+    uint64_t        htlc_maximum_msat;              ///< EVENT_CNLUPD
+    uint32_t        fee_base_msat;                  ///< EVENT_CNLUPD
+    uint32_t        fee_prop_millionths;            ///< EVENT_CNLUPD
+};
+
+
+/********************************************************************
+ * static variables
+ ********************************************************************/
+
+static pthread_mutex_t      mMuxGraph = PTHREAD_MUTEX_INITIALIZER;  ///< mGraph, mChannels
+static graph_t              mGraph;
+static channel_map_t        mChannels;
+static ln_intern_t          mIntern;                ///< node_id --> vertex, (node1, node2) --> short_channel_id
+
+static pthread_mutex_t      mMuxEvent = PTHREAD_MUTEX_INITIALIZER;  ///< mEvents, mEventEnabled
+static std::vector<event_t> mEvents;
+static bool                 mEventEnabled = false;      ///< true:mGraphはDBと同期している
+
+static pthread_mutex_t      mMuxLiquidity = PTHREAD_MUTEX_INITIALIZER;  ///< mLiquidity
+static liquidity_map_t      mLiquidity;
+
+static ln_routing_cost_func_t   mCostFunc = ln_routing_cost_default;    ///< mMuxGraph
+static void                     *mpCostParam = NULL;
+
+
 /********************************************************************
  * functions
  ********************************************************************/
@@ -178,10 +337,189 @@ static uint64_t edgefee(uint64_t amtmsat, uint32_t fee_base_msat, uint32_t fee_p
 }
 
 
-static void dumpit_chan(nodes_result_t *p_result, char type, const utl_buf_t *p_buf, ln_db_route_skip_t rskip)
+static inline bool is_skip(ln_db_route_skip_t rskip)
+{
+    return (rskip != LN_DB_ROUTE_SKIP_NONE) && (rskip != LN_DB_ROUTE_SKIP_WORK);
+}
+
+
+/** node1-->node2のchannel_update direction
+ *
+ */
+static uint8_t node_dir(const uint8_t *pNodeFrom, const uint8_t *pNodeTo)
+{
+    return (memcmp(pNodeFrom, pNodeTo, BTC_SZ_PUBKEY) < 0) ? 0 : 1;
+}
+
+
+static bool ver_search(graph_t::vertex_descriptor *pVtx, const uint8_t *pNodeId)
+{
+    uint32_t idx;
+    if (!ln_intern_node_search(&mIntern, &idx, pNodeId)) {
+        return false;
+    }
+    *pVtx = static_cast<graph_t::vertex_descriptor>(idx);
+    return true;
+}
+
+
+static bool ver_add(graph_t::vertex_descriptor *pVtx, const uint8_t *pNodeId)
+{
+    uint32_t idx;
+
+    if (!ln_intern_node_add(&mIntern, &idx, pNodeId)) {
+        LOGE("fail: intern\n");
+        return false;
+    }
+    //node indexは0からの連番なので、新規nodeの場合はvertex追加で一致する
+    while (num_vertices(mGraph) <= idx) {
+        add_vertex(mGraph);
+    }
+
+    *pVtx = static_cast<graph_t::vertex_descriptor>(idx);
+    return true;
+}
+
+
+static const uint8_t *ver_node_id(graph_t::vertex_descriptor Vtx)
+{
+    return ln_intern_node_id(&mIntern, static_cast<uint32_t>(Vtx));
+}
+
+
+/** u-->vのedgeのうち、weightが最小のもの
+ *
+ * 同じnode間に複数channelがある場合、boost::edge()はDijkstraが選択したedgeを返すとは限らない。
+ */
+static bool edge_min(graph_t::edge_descriptor *pEdge, graph_t::vertex_descriptor U, graph_t::vertex_descriptor V)
+{
+    bool found = false;
+    graph_traits < graph_t >::out_edge_iterator ei, ei_end;
+    for (boost::tie(ei, ei_end) = out_edges(U, mGraph); ei != ei_end; ++ei) {
+        if ((target(*ei, mGraph) != V) || mGraph[*ei].banned || mGraph[*ei].pruned) {
+            continue;
+        }
+        if (!found || (mGraph[*ei].weight < mGraph[*pEdge].weight)) {
+            *pEdge = *ei;
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+/********************************************************************
+ * graph(announcement)
+ ********************************************************************/
+
+/** channel情報をgraphのedgeに反映する
+ *
+ * channel_announcement/channel_updateの両方があり、disableではなく、skip DBに登録されていないedgeのみ残す。
+ */
+static void graph_chan_apply(uint64_t ShortChannelId, channel_t *pChan)
+{
+    for (int dir = 0; dir < 2; dir++) {
+        bool enable = pChan->announced &&
+                (pChan->vtx[0] != pChan->vtx[1]) &&
+                (pChan->ninfo[dir].cltv_expiry_delta != M_CLTV_INIT) &&
+                !is_skip(pChan->route_skip);
+        if (enable) {
+            if (!pChan->ninfo[dir].has_edge) {
+                bool inserted = false;
+                boost::tie(pChan->ninfo[dir].edge, inserted) =
+                        add_edge(pChan->vtx[dir], pChan->vtx[dir ^ 1], mGraph);
+                pChan->ninfo[dir].has_edge = true;
+            }
+            Fee& fee = mGraph[pChan->ninfo[dir].edge];
+            fee.short_channel_id = ShortChannelId;
+            fee.fee_base_msat = pChan->ninfo[dir].fee_base_msat;
+            fee.fee_prop_millionths = pChan->ninfo[dir].fee_prop_millionths;
+            fee.cltv_expiry_delta = pChan->ninfo[dir].cltv_expiry_delta;
+            fee.dir = (uint8_t)dir;
+            fee.htlc_minimum_msat = pChan->ninfo[dir].htlc_minimum_msat;
+            fee.htlc_maximum_msat = pChan->ninfo[dir].htlc_maximum_msat;
+            fee.route_skip = pChan->route_skip;
+        } else if (pChan->ninfo[dir].has_edge) {
+            remove_edge(pChan->ninfo[dir].edge, mGraph);
+            pChan->ninfo[dir].has_edge = false;
+        }
+    }
+}
+
+
+static void graph_chan_del(uint64_t ShortChannelId)
 {
-    nodes_t *p_nodes;
+    channel_map_t::iterator it = mChannels.find(ShortChannelId);
+    if (it == mChannels.end()) {
+        return;
+    }
+    channel_t& chan = it->second;
+    for (int dir = 0; dir < 2; dir++) {
+        if (chan.ninfo[dir].has_edge) {
+            remove_edge(chan.ninfo[dir].edge, mGraph);
+        }
+    }
+    mChannels.erase(it);
+    ln_intern_channel_del(&mIntern, ShortChannelId);
+}
+
+
+static void graph_cnlanno_set(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2)
+{
+    std::pair<channel_map_t::iterator, bool> ins =
+            mChannels.insert(channel_map_t::value_type(ShortChannelId, channel_t()));
+    channel_t& chan = ins.first->second;
+    if (ins.second) {
+        chan.route_skip = ln_db_route_skip_search(ShortChannelId);
+    }
+    if (!chan.announced) {
+        if (!ver_add(&chan.vtx[0], pNodeId1) || !ver_add(&chan.vtx[1], pNodeId2)) {
+            //このchannelはgraphに入れない
+            LOGE("fail: add node: short_channel_id=%016" PRIx64 "\n", ShortChannelId);
+            if (ins.second) {
+                mChannels.erase(ins.first);
+            }
+            return;
+        }
+        chan.announced = true;
+        ln_intern_channel_add(&mIntern, ShortChannelId,
+                static_cast<uint32_t>(chan.vtx[0]), static_cast<uint32_t>(chan.vtx[1]));
+    }
+    M_DBGLOGV("[cnl]short_channel_id: %016" PRIx64 "\n", ShortChannelId);
+    graph_chan_apply(ShortChannelId, &chan);
+}
+
+
+static void graph_cnlupd_set(
+    uint64_t ShortChannelId, uint8_t Dir, uint8_t ChannelFlags, uint16_t CltvExpiryDelta,
+    uint64_t HtlcMinimumMsat, uint64_t HtlcMaximumMsat, uint32_t FeeBaseMsat, uint32_t FeePropMillionths)
+{
+    std::pair<channel_map_t::iterator, bool> ins =
+            mChannels.insert(channel_map_t::value_type(ShortChannelId, channel_t()));
+    channel_t& chan = ins.first->second;
+    if (ins.second) {
+        chan.route_skip = ln_db_route_skip_search(ShortChannelId);
+    }
+    Dir &= 1;
+    if ((ChannelFlags & LN_CNLUPD_CHFLAGS_DISABLE) == 0) {
+        chan.ninfo[Dir].cltv_expiry_delta = CltvExpiryDelta;
+        chan.ninfo[Dir].htlc_minimum_msat = HtlcMinimumMsat;
+        chan.ninfo[Dir].htlc_maximum_msat = HtlcMaximumMsat;
+        chan.ninfo[Dir].fee_base_msat = FeeBaseMsat;
+        chan.ninfo[Dir].fee_prop_millionths = FeePropMillionths;
+        M_DBGLOGV("[upd]short_channel_id: %016" PRIx64 "\n", ShortChannelId);
+    } else {
+        //disableの場合は、対象外にされるよう初期値にしておく
+        M_DBGLOGV("[upd]short_channel_id: %016" PRIx64 "\n", ShortChannelId);
+        M_DBGLOGV("[upd]skip[%d]\n", Dir);
+        chan.ninfo[Dir].cltv_expiry_delta = M_CLTV_INIT;
+    }
+    graph_chan_apply(ShortChannelId, &chan);
+}
+
 
+static void graph_dumpit_chan(char type, const utl_buf_t *p_buf)
+{
     /*
      * channel_announcementとchannel_updateの存在パターンとして、以下がある。
      *      a) channel_announcementのみ
@@ -190,63 +528,146 @@ static void dumpit_chan(nodes_result_t *p_result, char type, const utl_buf_t *p_
      *
      * 通常、channel_announcementとchannel_updateは両方存在するが、announcement前は相手からchannel_updateだけ送信することがある。
      *      https://lists.linuxfoundation.org/pipermail/lightning-dev/2018-April/001220.html
-     * ただし、channelのnode_idはchannel_announcementが保持しているため、自分が持つshort_chennl_idと一致する場合のみroutingに加える。
+     * ただし、channelのnode_idはchannel_announcementが保持しているため、
+     * channel_announcementを受信するまではedgeを作らない(channel_updateの内容だけ保持しておく)。
      */
 
     switch (type) {
     case LN_DB_CNLANNO_ANNO:
-        p_result->node_num++;
-        p_result->p_nodes = (nodes_t *)UTL_DBG_REALLOC(p_result->p_nodes, sizeof(nodes_t) * p_result->node_num);
-        p_nodes = &p_result->p_nodes[p_result->node_num - 1];
-
-        ln_get_ids_cnl_anno(
-                            &p_nodes->short_channel_id,
-                            p_nodes->ninfo[0].node_id,
-                            p_nodes->ninfo[1].node_id,
-                            p_buf->buf, p_buf->len);
-        p_nodes->ninfo[0].route_skip = rskip;
-        p_nodes->ninfo[1].route_skip = rskip;
-        p_nodes->ninfo[0].cltv_expiry_delta = M_CLTV_INIT;     //未設定判定用
-        p_nodes->ninfo[1].cltv_expiry_delta = M_CLTV_INIT;     //未設定判定用
-
-        M_DBGLOGV("[cnl]nodenum=%d\n", p_result->node_num);
-        M_DBGLOGV("[cnl]short_channel_id: %016" PRIx64 "\n", p_nodes->short_channel_id);
-        M_DBGLOGV("[cnl]node1= ");
-        M_DBGDUMPV(p_nodes->ninfo[0].node_id, BTC_SZ_PUBKEY);
-        M_DBGLOGV("[cnl]node2= ");
-        M_DBGDUMPV(p_nodes->ninfo[1].node_id, BTC_SZ_PUBKEY);
+        {
+            uint64_t short_channel_id;
+            uint8_t node_id1[BTC_SZ_PUBKEY];
+            uint8_t node_id2[BTC_SZ_PUBKEY];
+            if (ln_get_ids_cnl_anno(&short_channel_id, node_id1, node_id2, p_buf->buf, p_buf->len)) {
+                graph_cnlanno_set(short_channel_id, node_id1, node_id2);
+            }
+        }
         break;
     case LN_DB_CNLANNO_UPD0:
     case LN_DB_CNLANNO_UPD1:
-        if (p_result->node_num > 0) {
-            p_nodes = &p_result->p_nodes[p_result->node_num - 1];
-
+        {
             ln_msg_channel_update_t upd;
-            int idx = type - LN_DB_CNLANNO_UPD0;
-            bool bret = ln_channel_update_get_params(&upd, p_buf->buf, p_buf->len);
-            if (bret && ((upd.channel_flags & LN_CNLUPD_CHFLAGS_DISABLE) == 0)) {
-                if (p_nodes->short_channel_id == upd.short_channel_id) {
-                    //disable状態ではない && channel_announcement.short_channel_idと一致
-                    p_nodes->ninfo[idx].cltv_expiry_delta = upd.cltv_expiry_delta;
-                    p_nodes->ninfo[idx].htlc_minimum_msat = upd.htlc_minimum_msat;
-                    p_nodes->ninfo[idx].fee_base_msat = upd.fee_base_msat;
-                    p_nodes->ninfo[idx].fee_prop_millionths = upd.fee_proportional_millionths;
-
-                    M_DBGLOGV("[upd]nodenum=%d\n", p_result->node_num);
-                    M_DBGLOGV("[upd]short_channel_id: %016" PRIx64 "\n", p_nodes->short_channel_id);
-                    M_DBGLOGV("[upd]node1= ");
-                    M_DBGDUMPV(p_nodes->ninfo[0].node_id, BTC_SZ_PUBKEY);
-                    M_DBGLOGV("[upd]node2= ");
-                    M_DBGDUMPV(p_nodes->ninfo[1].node_id, BTC_SZ_PUBKEY);
-                } else {
-                    M_DBGLOG("short_channel_id not match(%016" PRIx64 " !=%016" PRIx64 ")\n", p_nodes->short_channel_id, upd.short_channel_id);
-                }
+            if (ln_channel_update_get_params(&upd, p_buf->buf, p_buf->len)) {
+                graph_cnlupd_set(upd.short_channel_id, (uint8_t)(type - LN_DB_CNLANNO_UPD0), upd.channel_flags,
+                        upd.cltv_expiry_delta, upd.htlc_minimum_msat, upd.htlc_maximum_msat,
+                        upd.fee_base_msat, upd.fee_proportional_millionths);
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+
+static void graph_clear(void)
+{
+    mGraph.clear();
+    mChannels.clear();
+    ln_intern_clear(&mIntern);
+}
+
+
+/** announcement DBからgraph作成
+ *
+ */
+static bool graph_load(void)
+{
+    int ret;
+
+    //以降のDB更新は通知で受け取る。
+    //  load中にDBへ反映済みの更新も通知されるが、再適用しても結果は変わらない。
+    pthread_mutex_lock(&mMuxEvent);
+    mEvents.clear();
+    mEventEnabled = true;
+    pthread_mutex_unlock(&mMuxEvent);
+
+    graph_clear();
+
+    //read-only transactionのため、読込み中もannouncementの保存や他の読込みを止めない
+    ret = ln_db_anno_read_begin();
+    if (!ret) {
+        //channel_announcementを1回も受信せずにDBが存在しない場合もあるため、trueで返す
+        LOGE("fail: no announce DB\n");
+        return true;
+    }
+
+    void *p_cur;
+    ret = ln_db_anno_cur_open(&p_cur, LN_DB_CUR_CNLANNO);
+    if (ret) {
+        uint64_t short_channel_id;
+        char type;
+        utl_buf_t buf_cnl = UTL_BUF_INIT;
+
+        while ((ret = ln_db_cnlanno_cur_get(p_cur, &short_channel_id, &type, NULL, &buf_cnl))) {
+            graph_dumpit_chan(type, &buf_cnl);
+            utl_buf_free(&buf_cnl);
+        }
+        ln_db_anno_cur_close(p_cur);
+    } else {
+        LOGE("fail: open\n");
+    }
+
+    ln_db_anno_read_end();
+
+    LOGD("load announce route: channels=%lu, vertices=%lu, edges=%lu\n",
+            (unsigned long)mChannels.size(), (unsigned long)num_vertices(mGraph), (unsigned long)num_edges(mGraph));
+
+    return true;
+}
+
+
+static void graph_event_apply(const event_t *pEvent)
+{
+    switch (pEvent->type) {
+    case EVENT_CNLANNO:
+        graph_cnlanno_set(pEvent->short_channel_id, pEvent->node_id[0], pEvent->node_id[1]);
+        break;
+    case EVENT_CNLUPD:
+        graph_cnlupd_set(pEvent->short_channel_id, pEvent->dir, pEvent->channel_flags,
+                pEvent->cltv_expiry_delta, pEvent->htlc_minimum_msat, pEvent->htlc_maximum_msat,
+                pEvent->fee_base_msat, pEvent->fee_prop_millionths);
+        break;
+    case EVENT_CNLANNO_DEL:
+        if ((pEvent->anno_type == LN_DB_CNLANNO_UPD0) || (pEvent->anno_type == LN_DB_CNLANNO_UPD1)) {
+            channel_map_t::iterator it = mChannels.find(pEvent->short_channel_id);
+            if (it != mChannels.end()) {
+                it->second.ninfo[pEvent->anno_type - LN_DB_CNLANNO_UPD0].cltv_expiry_delta = M_CLTV_INIT;
+                graph_chan_apply(it->first, &it->second);
+            }
+        } else {
+            graph_chan_del(pEvent->short_channel_id);
+        }
+        break;
+    case EVENT_SKIP_SAVE:
+        {
+            channel_map_t::iterator it = mChannels.find(pEvent->short_channel_id);
+            if (it != mChannels.end()) {
+                it->second.route_skip = (pEvent->flag) ? LN_DB_ROUTE_SKIP_TEMP : LN_DB_ROUTE_SKIP_PERM;
+                graph_chan_apply(it->first, &it->second);
+            }
+        }
+        break;
+    case EVENT_SKIP_WORK:
+        for (channel_map_t::iterator it = mChannels.begin(); it != mChannels.end(); it++) {
+            ln_db_route_skip_t rskip = it->second.route_skip;
+            if (pEvent->flag && (rskip == LN_DB_ROUTE_SKIP_TEMP)) {
+                it->second.route_skip = LN_DB_ROUTE_SKIP_WORK;
+            } else if (!pEvent->flag && (rskip == LN_DB_ROUTE_SKIP_WORK)) {
+                it->second.route_skip = LN_DB_ROUTE_SKIP_TEMP;
             } else {
-                //disableの場合は、対象外にされるよう初期値にしておく
-                M_DBGLOGV("[upd]short_channel_id: %016" PRIx64 "\n", p_nodes->short_channel_id);
-                M_DBGLOGV("[upd]skip[%c]\n", type);
-                p_nodes->ninfo[idx].cltv_expiry_delta = M_CLTV_INIT;
+                continue;
             }
+            graph_chan_apply(it->first, &it->second);
+        }
+        break;
+    case EVENT_SKIP_DROP:
+        for (channel_map_t::iterator it = mChannels.begin(); it != mChannels.end(); it++) {
+            ln_db_route_skip_t rskip = it->second.route_skip;
+            if (rskip == LN_DB_ROUTE_SKIP_NONE) continue;
+            if (pEvent->flag && (rskip != LN_DB_ROUTE_SKIP_TEMP)) continue;
+            it->second.route_skip = LN_DB_ROUTE_SKIP_NONE;
+            graph_chan_apply(it->first, &it->second);
         }
         break;
     default:
@@ -255,6 +676,61 @@ static void dumpit_chan(nodes_result_t *p_result, char type, const utl_buf_t *p_
 }
 
 
+/** 常駐graphをDBと同期させる
+ *
+ * 未読込みまたは通知があふれた場合はDBから作成し直し、それ以外は通知を反映する。
+ *
+ * @attention
+ *      - mMuxGraphをlockしていること
+ */
+static bool graph_sync(void)
+{
+    std::vector<event_t> events;
+
+    pthread_mutex_lock(&mMuxEvent);
+    bool enabled = mEventEnabled;
+    pthread_mutex_unlock(&mMuxEvent);
+    if (!enabled) {
+        if (!graph_load()) {
+            return false;
+        }
+    }
+
+    pthread_mutex_lock(&mMuxEvent);
+    events.swap(mEvents);
+    pthread_mutex_unlock(&mMuxEvent);
+
+    for (size_t lp = 0; lp < events.size(); lp++) {
+        graph_event_apply(&events[lp]);
+    }
+    if (events.size() > 0) {
+        LOGD("apply events: %lu\n", (unsigned long)events.size());
+    }
+    return true;
+}
+
+
+static void event_push(const event_t *pEvent)
+{
+    pthread_mutex_lock(&mMuxEvent);
+    if (mEventEnabled) {
+        if (mEvents.size() < M_EVENT_MAX) {
+            mEvents.push_back(*pEvent);
+        } else {
+            //次回のrouting時にDBから作成し直す
+            LOGD("too many events: reload graph\n");
+            std::vector<event_t>().swap(mEvents);
+            mEventEnabled = false;
+        }
+    }
+    pthread_mutex_unlock(&mMuxEvent);
+}
+
+
+/********************************************************************
+ * local channel / r-field
+ ********************************************************************/
+
 //開設済みで生きている送金元channelは、announcementの有無にかかわらず検索候補に追加する
 static bool comp_func_channel(ln_channel_t *pChannel, void *p_db_param, void *p_param)
 {
@@ -267,7 +743,7 @@ static bool comp_func_channel(ln_channel_t *pChannel, void *p_db_param, void *p_
     if ((pChannel->short_channel_id != 0) && (ln_status_get(pChannel) == LN_STATUS_NORMAL_OPE)) {
         //チャネルは開設している && normal operation
         ln_db_route_skip_t rskip = ln_db_route_skip_search(pChannel->short_channel_id);
-        if ((rskip != LN_DB_ROUTE_SKIP_NONE) && (rskip != LN_DB_ROUTE_SKIP_WORK)) {
+        if (is_skip(rskip)) {
             LOGD("  skip DB: %016" PRIx64 "\n", pChannel->short_channel_id);
             return false;
         }
@@ -289,10 +765,15 @@ static bool comp_func_channel(ln_channel_t *pChannel, void *p_db_param, void *p_
         for (int lp = 0; lp < 2; lp++) {
             p_nodes_result->ninfo[lp].cltv_expiry_delta = 0;
             p_nodes_result->ninfo[lp].htlc_minimum_msat = 0;
+            p_nodes_result->ninfo[lp].htlc_maximum_msat = 0;
             p_nodes_result->ninfo[lp].fee_base_msat = 0;
             p_nodes_result->ninfo[lp].fee_prop_millionths = 0;
             p_nodes_result->ninfo[lp].route_skip = rskip;
         }
+        //自channelは送金可能額がわかっている
+        uint64_t payable = ln_local_payable_msat(pChannel);
+        p_nodes_result->ninfo[node_dir(p_param_channel->p_payer, pChannel->peer_node_id)].htlc_maximum_msat =
+                (payable > 0) ? payable : 1;    //0は不明扱いなので、送金不可は1msatにしておく
 
         M_DBGLOGV("[channel]nodenum=%d\n",  p_param_channel->p_result->node_num);
         LOGD("[channel]short_channel_id: %016" PRIx64 "\n", pChannel->short_channel_id);
@@ -323,7 +804,7 @@ static void add_r_field(
         nodes_t *p_nodes = &p_result->p_nodes[p_result->node_num + count];
 
         ln_db_route_skip_t rskip = ln_db_route_skip_search(pAddRoute[lp].short_channel_id);
-        if ((rskip != LN_DB_ROUTE_SKIP_NONE) && (rskip != LN_DB_ROUTE_SKIP_WORK)) {
+        if (is_skip(rskip)) {
             M_DBGLOG("skip DB: %016" PRIx64 "\n", pAddRoute[lp].short_channel_id);
             continue;
         }
@@ -340,6 +821,7 @@ static void add_r_field(
         p_nodes->ninfo[dir].fee_prop_millionths = pAddRoute[lp].fee_prop_millionths;
         p_nodes->ninfo[dir].cltv_expiry_delta = pAddRoute[lp].cltv_expiry_delta;
         p_nodes->ninfo[dir].htlc_minimum_msat = 0;
+        p_nodes->ninfo[dir].htlc_maximum_msat = 0;
         p_nodes->ninfo[dir].route_skip = rskip;
         count++;
 
@@ -358,291 +840,453 @@ static void add_r_field(
 }
 
 
-/**
+/** 送金ごとに変わるedge(自channel, r-field)を一時的にgraphへ追加する
+ *
+ * @param[out]      pTmpEdges           追加したedge(計算後に削除する)
  * @param[in]       pPayerId            送金元node_id
+ * @param[in]       pPayeeId            送金先node_id
+ * @param[in]       AddNum              追加route数
+ * @param[in]       pAddRoute           追加route
  */
-static bool load_db(nodes_result_t *p_result, const uint8_t *pPayerId)
+static void tmp_edge_add(
+    std::vector<edge_descriptor> *pTmpEdges,
+    const uint8_t *pPayerId, const uint8_t *pPayeeId, uint8_t AddNum, const ln_r_field_t *pAddRoute)
 {
-    int ret;
+    nodes_result_t rt_res;
+    rt_res.node_num = 0;
+    rt_res.p_nodes = NULL;
 
     //channel
     param_channel_t param_channel;
-
-    param_channel.p_result = p_result;
+    param_channel.p_result = &rt_res;
     param_channel.p_payer = pPayerId;
     ln_db_channel_search_readonly_nokey(comp_func_channel, &param_channel);
+    LOGD("added local route: %" PRIu32 "\n", rt_res.node_num);
 
-    LOGD("added local route: %" PRIu32 "\n", p_result->node_num);
-    uint32_t prev_node_num = p_result->node_num;
-
-    //channel_anno
-    void *p_cur;
-
-    ret = ln_db_anno_transaction();
-    if (!ret) {
-        //channel_announcementを1回も受信せずにDBが存在しない場合もあるため、trueで返す
-        LOGE("fail: no announce DB\n");
-        return true;
+    if (AddNum > 0) {
+        add_r_field(&rt_res, pPayeeId, pAddRoute, AddNum);
     }
 
-    ret = ln_db_anno_cur_open(&p_cur, LN_DB_CUR_CNLANNO);
-    if (ret) {
-        uint64_t short_channel_id;
-        char type;
-        utl_buf_t buf_cnl = UTL_BUF_INIT;
-
-        while ((ret = ln_db_cnlanno_cur_get(p_cur, &short_channel_id, &type, NULL, &buf_cnl))) {
-            ln_db_route_skip_t rskip = ln_db_route_skip_search(short_channel_id);
-            if ((rskip != LN_DB_ROUTE_SKIP_NONE) && (rskip != LN_DB_ROUTE_SKIP_WORK)) {
-                LOGE("  skip DB: %016" PRIx64 "\n", short_channel_id);
-                utl_buf_free(&buf_cnl);
+    for (uint32_t lp = 0; lp < rt_res.node_num; lp++) {
+        const nodes_t *p_nodes = &rt_res.p_nodes[lp];
+        graph_t::vertex_descriptor vtx[2];
+        if (!ver_add(&vtx[0], p_nodes->ninfo[0].node_id) || !ver_add(&vtx[1], p_nodes->ninfo[1].node_id)) {
+            LOGE("fail: add node: short_channel_id=%016" PRIx64 "\n", p_nodes->short_channel_id);
+            continue;
+        }
+        if (vtx[0] == vtx[1]) {
+            continue;
+        }
+        for (int dir = 0; dir < 2; dir++) {
+            if (p_nodes->ninfo[dir].cltv_expiry_delta == M_CLTV_INIT) {
                 continue;
             }
-
-            dumpit_chan(p_result, type, &buf_cnl, rskip);
-            utl_buf_free(&buf_cnl);
+            bool inserted = false;
+            edge_descriptor e;
+            boost::tie(e, inserted) = add_edge(vtx[dir], vtx[dir ^ 1], mGraph);
+            mGraph[e].short_channel_id = p_nodes->short_channel_id;
+            mGraph[e].fee_base_msat = p_nodes->ninfo[dir].fee_base_msat;
+            mGraph[e].fee_prop_millionths = p_nodes->ninfo[dir].fee_prop_millionths;
+            mGraph[e].cltv_expiry_delta = p_nodes->ninfo[dir].cltv_expiry_delta;
+            mGraph[e].dir = (uint8_t)dir;
+            mGraph[e].htlc_minimum_msat = p_nodes->ninfo[dir].htlc_minimum_msat;
+            mGraph[e].htlc_maximum_msat = p_nodes->ninfo[dir].htlc_maximum_msat;
+            mGraph[e].route_skip = p_nodes->ninfo[dir].route_skip;
+            pTmpEdges->push_back(e);
         }
-    } else {
-        LOGE("fail: open\n");
     }
 
-    ln_db_anno_commit(true);
+    UTL_DBG_FREE(rt_res.p_nodes);
+}
+
+
+static void tmp_edge_remove(std::vector<edge_descriptor> *pTmpEdges)
+{
+    for (size_t lp = 0; lp < pTmpEdges->size(); lp++) {
+        remove_edge((*pTmpEdges)[lp], mGraph);
+    }
+    pTmpEdges->clear();
+}
+
 
-    LOGD("added announce route: %" PRIu32 "\n", p_result->node_num - prev_node_num);
+/********************************************************************
+ * liquidity
+ ********************************************************************/
 
+/** 経過時間に応じて推定値を不明側に戻す
+ *
+ * @param[in,out]   pLiq
+ * @param[in]       Now
+ * @retval  false   推定値が古いため破棄してよい
+ */
+static bool liquidity_decay(liquidity_t *pLiq, uint64_t Now)
+{
+    if (Now <= pLiq->update_time) {
+        return true;
+    }
+    uint64_t elapsed = Now - pLiq->update_time;
+    if (elapsed >= M_LIQUIDITY_EXPIRE_SEC) {
+        return false;
+    }
+    double factor = pow(2.0, -(double)elapsed / M_LIQUIDITY_HALFLIFE_SEC);
+    pLiq->min_msat = (uint64_t)(pLiq->min_msat * factor);
+    if (pLiq->max_msat != M_LIQUIDITY_UNKNOWN) {
+        double max = pLiq->max_msat / factor;
+        pLiq->max_msat = (max < (double)(M_LIQUIDITY_UNKNOWN / 2)) ? (uint64_t)max : M_LIQUIDITY_UNKNOWN;
+    }
+    pLiq->update_time = Now;
     return true;
 }
 
 
-static graph_t::vertex_descriptor ver_add(graph_t& GRoute, const uint8_t *pNodeId)
+/** 推定値取得
+ *
+ * @attention
+ *      - mMuxLiquidityをlockしていること
+ */
+static void liquidity_get(uint64_t *pMin, uint64_t *pMax, uint64_t ShortChannelId, uint8_t Dir, uint64_t Now)
 {
-    graph_t::vertex_descriptor vtx = static_cast<graph_t::vertex_descriptor>(-1);
-    bool ret = false;
+    *pMin = 0;
+    *pMax = M_LIQUIDITY_UNKNOWN;
 
-    std::pair<graph_t::vertex_iterator, graph_t::vertex_iterator> ver_its = vertices(GRoute);
-    for (graph_t::vertex_iterator st = ver_its.first, et = ver_its.second; st != et; st++) {
-        if (memcmp(GRoute[*st].p_node, pNodeId, BTC_SZ_PUBKEY) == 0) {
-            ret = true;
-            vtx = *st;
-            break;
-        }
+    liquidity_map_t::iterator it = mLiquidity.find(liquidity_key_t(ShortChannelId, Dir));
+    if (it == mLiquidity.end()) {
+        return;
     }
-    if (!ret) {
-        vtx = add_vertex(GRoute);
-        GRoute[vtx].p_node = pNodeId;
+    liquidity_t liq = it->second;
+    if (!liquidity_decay(&liq, Now)) {
+        mLiquidity.erase(it);
+        return;
     }
+    *pMin = liq.min_msat;
+    *pMax = liq.max_msat;
+}
 
-    return vtx;
+
+/** 推定値更新
+ *
+ * @param[in]       ShortChannelId
+ * @param[in]       Dir
+ * @param[in]       AmountMsat
+ * @param[in]       bSuccess        true:AmountMsatを送金できた, false:できなかった
+ * @attention
+ *      - mMuxLiquidityをlockしていること
+ */
+static void liquidity_set(uint64_t ShortChannelId, uint8_t Dir, uint64_t AmountMsat, bool bSuccess)
+{
+    uint64_t now = (uint64_t)utl_time_time();
+    liquidity_t& liq = mLiquidity[liquidity_key_t(ShortChannelId, Dir)];
+    if (!liquidity_decay(&liq, now)) {
+        liq = liquidity_t();
+    }
+    liq.update_time = now;
+    if (bSuccess) {
+        if (liq.min_msat < AmountMsat) {
+            liq.min_msat = AmountMsat;
+        }
+        if (liq.max_msat < liq.min_msat) {
+            //古い推定と矛盾する
+            liq.max_msat = M_LIQUIDITY_UNKNOWN;
+        }
+    } else {
+        uint64_t max = (AmountMsat > 0) ? AmountMsat - 1 : 0;
+        if (max < liq.max_msat) {
+            liq.max_msat = max;
+        }
+        if (liq.max_msat < liq.min_msat) {
+            liq.min_msat = 0;
+        }
+    }
+    M_DBGLOG("liquidity %016" PRIx64 "[%d]: %" PRIu64 " - %" PRIu64 "\n", ShortChannelId, Dir, liq.min_msat, liq.max_msat);
 }
 
 
-lnerr_route_t ln_routing_calculate(
-    ln_routing_result_t *pResult, const uint8_t *pPayerId, const uint8_t *pPayeeId,
-    uint32_t CltvExpiry, uint64_t AmountMsat, uint8_t AddNum, const ln_r_field_t *pAddRoute)
+/** 送金額に応じたedgeの重み付け
+ *
+ * cost modelがfalseを返したedgeは経路探索から除外する。
+ */
+static void edge_weight_update(uint64_t AmountMsat)
 {
-    pResult->num_hops = 0;
+    uint64_t now = (uint64_t)utl_time_time();
+    size_t pruned = 0;
 
-    nodes_result_t rt_res;
-    rt_res.node_num = 0;
-    rt_res.p_nodes = NULL;
+    pthread_mutex_lock(&mMuxLiquidity);
+    graph_traits < graph_t >::edge_iterator ei, ei_end;
+    for (boost::tie(ei, ei_end) = edges(mGraph); ei != ei_end; ++ei) {
+        Fee& fee = mGraph[*ei];
+
+        ln_routing_edge_t edge;
+        edge.short_channel_id = fee.short_channel_id;
+        edge.dir = fee.dir;
+        edge.fee_base_msat = fee.fee_base_msat;
+        edge.fee_prop_millionths = fee.fee_prop_millionths;
+        edge.cltv_expiry_delta = fee.cltv_expiry_delta;
+        edge.htlc_minimum_msat = fee.htlc_minimum_msat;
+        edge.htlc_maximum_msat = fee.htlc_maximum_msat;
+        liquidity_get(&edge.liquidity_min_msat, &edge.liquidity_max_msat, fee.short_channel_id, fee.dir, now);
+        edge.low_priority = (fee.route_skip == LN_DB_ROUTE_SKIP_WORK);
+
+        uint64_t cost = 0;
+        fee.pruned = !(*mCostFunc)(&cost, &edge, AmountMsat, mpCostParam);
+        if (fee.pruned) {
+            M_DBGLOG("PRUNE: %016" PRIx64 "\n", fee.short_channel_id);
+            pruned++;
+            cost = 0;
+        }
+        fee.weight = cost;
+    }
+    pthread_mutex_unlock(&mMuxLiquidity);
+    if (pruned > 0) {
+        LOGD("pruned edges: %lu\n", (unsigned long)pruned);
+    }
+}
 
-    if ((pPayerId == NULL) || (pPayeeId == NULL)) {
-        LOGE("fail: null input\n");
-        return LNROUTE_PARAM;
+
+/** Start-->Goalの最小コスト経路
+ *
+ * Fee::bannedのedge, pVtxBanのvertexは経路に含めない。
+ *
+ * @param[out]      pPath           経路(Startから順)
+ * @param[out]      pCost           経路のweight合計
+ * @param[in]       Start
+ * @param[in]       Goal
+ * @param[in]       VtxBan          true:除外するvertex
+ * @retval  true    経路あり
+ */
+static bool path_search(
+    path_t *pPath, uint64_t *pCost,
+    vertex_descriptor Start, vertex_descriptor Goal, const std::vector<bool>& VtxBan)
+{
+    graph_filtered_t fgraph(mGraph, edge_ban_t(&mGraph), vertex_ban_t(&VtxBan));
+
+    std::vector<vertex_descriptor> pt(num_vertices(mGraph));     //parent
+    std::vector<uint64_t> dist(num_vertices(mGraph));
+    for (size_t lp = 0; lp < pt.size(); lp++) {
+        pt[lp] = lp;
     }
+    dijkstra_shortest_paths(fgraph, Start,
+                weight_map(boost::get(&Fee::weight, mGraph)).
+                    predecessor_map(&pt[0]).
+                        distance_map(&dist[0]));
 
-    bool ret = load_db(&rt_res, pPayerId);
-    if (!ret) {
-        LOGE("fail: load_db\n");
-        return LNROUTE_LOADDB;
+    if (pt[Goal] == Goal) {
+        return false;
     }
 
-    if (AddNum > 0) {
-        add_r_field(&rt_res, pPayeeId, pAddRoute, AddNum);
+    //逆順に入っているので、並べ直す
+    std::deque<edge_descriptor> path;           //std::vectorにはpush_front()がない
+    for (vertex_descriptor vtx = Goal; vtx != Start; vtx = pt[vtx]) {
+        graph_t::edge_descriptor eg;
+        if (!edge_min(&eg, pt[vtx], vtx)) {
+            LOGE("fail: not foooooooooound\n");
+            return false;
+        }
+        path.push_front(eg);
     }
-    LOGD("node_num: %d\n", rt_res.node_num);
+    pPath->assign(path.begin(), path.end());
+    *pCost = dist[Goal];
+    return true;
+}
 
-    LOGD("start node_id : ");
-    DUMPD(pPayerId, BTC_SZ_PUBKEY);
-    LOGD("end node_id   : ");
-    DUMPD(pPayeeId, BTC_SZ_PUBKEY);
 
-    graph_t groute;
+static bool path_contains(const std::vector<path_cand_t>& Paths, const path_t& Path)
+{
+    for (size_t lp = 0; lp < Paths.size(); lp++) {
+        if (Paths[lp].path == Path) {
+            return true;
+        }
+    }
+    return false;
+}
 
-    bool set_start = false;
-    bool set_goal = false;
-    graph_t::vertex_descriptor pnt_start = static_cast<graph_t::vertex_descriptor>(-1);
-    graph_t::vertex_descriptor pnt_goal = static_cast<graph_t::vertex_descriptor>(-1);
 
-    //Edge追加
-    for (uint32_t lp = 0; lp < rt_res.node_num; lp++) {
-        M_DBGLOGV("  short_channel_id=%016" PRIx64 "\n", rt_res.p_nodes[lp].short_channel_id);
-        M_DBGLOGV("    [1]");
-        M_DBGDUMPV(rt_res.p_nodes[lp].ninfo[0].node_id, BTC_SZ_PUBKEY);
-        M_DBGLOGV("    [2]");
-        M_DBGDUMPV(rt_res.p_nodes[lp].ninfo[1].node_id, BTC_SZ_PUBKEY);
-
-        graph_t::vertex_descriptor node1 = ver_add(groute, rt_res.p_nodes[lp].ninfo[0].node_id);
-        graph_t::vertex_descriptor node2 = ver_add(groute, rt_res.p_nodes[lp].ninfo[1].node_id);
-
-        if (!set_start) {
-            if (memcmp(rt_res.p_nodes[lp].ninfo[0].node_id, pPayerId, BTC_SZ_PUBKEY) == 0) {
-                pnt_start = node1;
-                set_start = true;
-            } else if (memcmp(rt_res.p_nodes[lp].ninfo[1].node_id, pPayerId, BTC_SZ_PUBKEY) == 0) {
-                pnt_start = node2;
-                set_start = true;
+/** Start-->Goalのコストが小さい経路をK個まで求める(Yen's algorithm)
+ *
+ * @param[out]      pPaths          経路(コスト順)
+ * @param[in]       Start
+ * @param[in]       Goal
+ * @param[in]       K               最大経路数
+ */
+static void path_k_search(
+    std::vector<path_cand_t> *pPaths, vertex_descriptor Start, vertex_descriptor Goal, size_t K)
+{
+    std::vector<bool> vtx_ban(num_vertices(mGraph), false);
+    std::vector<path_cand_t> cands;     //候補
+
+    path_cand_t first;
+    if (!path_search(&first.path, &first.cost, Start, Goal, vtx_ban)) {
+        return;
+    }
+    pPaths->push_back(first);
+
+    for (size_t k = 1; k < K; k++) {
+        const path_t prev = (*pPaths)[k - 1].path;
+        vertex_descriptor spur = Start;
+        uint64_t root_cost = 0;
+
+        for (size_t i = 0; i < prev.size(); i++) {
+            //rootが同じ経路は、次のedgeを使わせない
+            std::vector<edge_descriptor> banned;
+            for (size_t lp = 0; lp < pPaths->size(); lp++) {
+                const path_t& p = (*pPaths)[lp].path;
+                if ((p.size() > i) && std::equal(prev.begin(), prev.begin() + i, p.begin())) {
+                    mGraph[p[i]].banned = true;
+                    banned.push_back(p[i]);
+                }
+            }
+
+            path_cand_t cand;
+            uint64_t spur_cost;
+            path_t spur_path;
+            if (path_search(&spur_path, &spur_cost, spur, Goal, vtx_ban)) {
+                cand.path.assign(prev.begin(), prev.begin() + i);
+                cand.path.insert(cand.path.end(), spur_path.begin(), spur_path.end());
+                cand.cost = root_cost + spur_cost;
+                if (!path_contains(*pPaths, cand.path) && !path_contains(cands, cand.path)) {
+                    cands.push_back(cand);
+                }
             }
+
+            for (size_t lp = 0; lp < banned.size(); lp++) {
+                mGraph[banned[lp]].banned = false;
+            }
+
+            //rootのvertexは以降のspur pathに含めない
+            vtx_ban[spur] = true;
+            root_cost += mGraph[prev[i]].weight;
+            spur = target(prev[i], mGraph);
         }
-        if (!set_goal) {
-            if (memcmp(rt_res.p_nodes[lp].ninfo[0].node_id, pPayeeId, BTC_SZ_PUBKEY) == 0) {
-                pnt_goal = node1;
-                set_goal = true;
-            } else if (memcmp(rt_res.p_nodes[lp].ninfo[1].node_id, pPayeeId, BTC_SZ_PUBKEY) == 0) {
-                pnt_goal = node2;
-                set_goal = true;
+        std::fill(vtx_ban.begin(), vtx_ban.end(), false);
+
+        if (cands.empty()) {
+            break;
+        }
+        size_t best = 0;
+        for (size_t lp = 1; lp < cands.size(); lp++) {
+            if (cands[lp].cost < cands[best].cost) {
+                best = lp;
             }
         }
+        pPaths->push_back(cands[best]);
+        cands.erase(cands.begin() + best);
+    }
+}
 
-        if (node1 != node2) {
-            if (rt_res.p_nodes[lp].ninfo[0].cltv_expiry_delta != M_CLTV_INIT) {
-                //channel_update1
-                bool inserted = false;
-                graph_t::edge_descriptor e1;
-
-                boost::tie(e1, inserted) = add_edge(node1, node2, groute);
-                groute[e1].short_channel_id = rt_res.p_nodes[lp].short_channel_id;
-                groute[e1].fee_base_msat = rt_res.p_nodes[lp].ninfo[0].fee_base_msat;
-                groute[e1].fee_prop_millionths = rt_res.p_nodes[lp].ninfo[0].fee_prop_millionths;
-                groute[e1].cltv_expiry_delta = rt_res.p_nodes[lp].ninfo[0].cltv_expiry_delta;
-                groute[e1].node_id = rt_res.p_nodes[lp].ninfo[0].node_id;
-
-                groute[e1].weight = edgefee(AmountMsat, groute[e1].fee_base_msat, groute[e1].fee_prop_millionths);
-                if (rt_res.p_nodes[lp].ninfo[0].route_skip == LN_DB_ROUTE_SKIP_WORK) {
-                    M_DBGLOG("HEAVY1: %016" PRIx64 "\n", groute[e1].short_channel_id);
-                    groute[e1].weight *= 100;
-                }
+
+/** 経路から送金情報を作成
+ *
+ * @param[out]      pResult
+ * @param[in]       Path            経路(送金元から順)
+ * @param[in]       Start           送金元vertex
+ * @param[in]       CltvExpiry      送金先のcltv_expiry
+ * @param[in]       AmountMsat      送金先の受取額
+ */
+static lnerr_route_t path_to_result(
+    ln_routing_result_t *pResult, const path_t& Path, vertex_descriptor Start,
+    uint32_t CltvExpiry, uint64_t AmountMsat)
+{
+    pResult->num_hops = 0;
+
+    if (Path.size() + 1 > LN_HOP_MAX + 1) {
+        //先頭に自ノードが入るため+1
+        LOGE("fail: too many hops\n");
+        return LNROUTE_TOOMANYHOP;
+    }
+
+    //送金先から逆順に計算する
+    //ついでに、min_final_cltv_expiryを足す
+    CltvExpiry += M_SHADOW_ROUTE;
+
+    int num_hops = (int)Path.size() + 1;
+    for (int lp = num_hops - 1; lp >= 0; lp--) {
+        ln_hop_datain_t *p_hop = &pResult->hop_datain[lp];
+        vertex_descriptor vtx = (lp == 0) ? Start : target(Path[lp - 1], mGraph);
+
+        if (lp == num_hops - 1) {
+            p_hop->short_channel_id = 0;
+        } else {
+            const Fee& fee = mGraph[Path[lp]];
+            if (fee.short_channel_id == 0) {
+                LOGE("not match!\n");
+                return LNROUTE_NOTFOUND;
             }
-            if (rt_res.p_nodes[lp].ninfo[1].cltv_expiry_delta != M_CLTV_INIT) {
-                //channel_update2
-                bool inserted = false;
-                graph_t::edge_descriptor e2;
-
-                boost::tie(e2, inserted) = add_edge(node2, node1, groute);
-                groute[e2].short_channel_id = rt_res.p_nodes[lp].short_channel_id;
-                groute[e2].fee_base_msat = rt_res.p_nodes[lp].ninfo[1].fee_base_msat;
-                groute[e2].fee_prop_millionths = rt_res.p_nodes[lp].ninfo[1].fee_prop_millionths;
-                groute[e2].cltv_expiry_delta = rt_res.p_nodes[lp].ninfo[1].cltv_expiry_delta;
-                groute[e2].node_id = rt_res.p_nodes[lp].ninfo[1].node_id;
-
-                groute[e2].weight = edgefee(AmountMsat, groute[e2].fee_base_msat, groute[e2].fee_prop_millionths);
-                if (rt_res.p_nodes[lp].ninfo[1].route_skip == LN_DB_ROUTE_SKIP_WORK) {
-                    M_DBGLOG("HEAVY2: %016" PRIx64 "\n", groute[e2].short_channel_id);
-                    groute[e2].weight *= 100;
-                }
+            p_hop->short_channel_id = fee.short_channel_id;
+        }
+        p_hop->amt_to_forward = AmountMsat;
+        p_hop->outgoing_cltv_value = CltvExpiry;
+        memcpy(p_hop->pubkey, ver_node_id(vtx), BTC_SZ_PUBKEY);
+
+        if (lp < num_hops - 1) {
+            const Fee& fee = mGraph[Path[lp]];
+            //枝刈りは送金先の受取額で行っているため、手数料込みの額で確認する
+            if ( (AmountMsat < fee.htlc_minimum_msat) ||
+                 (fee.htlc_maximum_msat && (AmountMsat > fee.htlc_maximum_msat)) ) {
+                LOGD("out of htlc range: %016" PRIx64 "\n", fee.short_channel_id);
+                return LNROUTE_NOTFOUND;
             }
+            AmountMsat = AmountMsat + edgefee(AmountMsat, fee.fee_base_msat, fee.fee_prop_millionths);
+            CltvExpiry += fee.cltv_expiry_delta;
         }
     }
+    pResult->num_hops = (uint8_t)num_hops;
+
+    for (int lp = 0; lp < pResult->num_hops; lp++) {
+        LOGD("  route [%d]", lp);
+        DUMPD(pResult->hop_datain[lp].pubkey, BTC_SZ_PUBKEY);
+    }
+
+    return LNROUTE_OK;
+}
+
+
+/**
+ * @attention
+ *      - mMuxGraphをlockしていること
+ */
+static lnerr_route_t calculate(
+    ln_routing_result_t *pResults, uint8_t *pNum, uint8_t MaxNum,
+    const uint8_t *pPayerId, const uint8_t *pPayeeId,
+    uint32_t CltvExpiry, uint64_t AmountMsat)
+{
+    LOGD("start node_id : ");
+    DUMPD(pPayerId, BTC_SZ_PUBKEY);
+    LOGD("end node_id   : ");
+    DUMPD(pPayeeId, BTC_SZ_PUBKEY);
+
+    graph_t::vertex_descriptor pnt_start = static_cast<graph_t::vertex_descriptor>(-1);
+    graph_t::vertex_descriptor pnt_goal = static_cast<graph_t::vertex_descriptor>(-1);
 
     //LOGD("pnt_start=%d, pnt_goal=%d\n", (int)pnt_start, (int)pnt_goal);
-    if (!set_start) {
+    if (!ver_search(&pnt_start, pPayerId)) {
         LOGE("fail: no start node\n");
         return LNROUTE_NOSTART;
     }
-    if (!set_goal) {
+    if (!ver_search(&pnt_goal, pPayeeId)) {
         LOGE("fail: no goal node\n");
         return LNROUTE_NOGOAL;
     }
 
-    std::vector<vertex_descriptor> pt(num_vertices(groute));     //parent
-    std::vector<uint64_t> dist(num_vertices(groute));
-    dijkstra_shortest_paths(groute, pnt_start,
-                weight_map(boost::get(&Fee::weight, groute)).
-                    predecessor_map(&pt[0]).
-                        distance_map(&dist[0]));
+    edge_weight_update(AmountMsat);
 
-    if (pt[pnt_goal] == pnt_goal) {
+    std::vector<path_cand_t> paths;
+    path_k_search(&paths, pnt_start, pnt_goal, MaxNum);
+    if (paths.empty()) {
         LOGE("fail: cannot find route\n");
-        UTL_DBG_FREE(rt_res.p_nodes);
         return LNROUTE_NOTFOUND;
     }
 
-    //逆順に入っているので、並べ直す
-    //ついでに、min_final_cltv_expiryを足す
-    std::deque<vertex_descriptor> route;        //std::vectorにはpush_front()がない
-    std::deque<uint64_t> msat;
-    std::deque<uint32_t> cltv;
-
-    CltvExpiry += M_SHADOW_ROUTE;
-
-    route.push_front(pnt_goal);
-    msat.push_front(AmountMsat);
-    cltv.push_front(CltvExpiry);
-
-    for (vertex_descriptor vtx = pnt_goal; vtx != pnt_start; vtx = pt[vtx]) {
-        bool found;
-        graph_t::edge_descriptor eg;
-        boost::tie(eg, found) = edge(pt[vtx], vtx, groute);
-        if (!found) {
-            LOGE("fail: not foooooooooound\n");
-            return LNROUTE_NOTFOUND;
-        }
-
-        route.push_front(pt[vtx]);
-        msat.push_front(AmountMsat);
-        cltv.push_front(CltvExpiry);
-
-        AmountMsat = AmountMsat + edgefee(AmountMsat, groute[eg].fee_base_msat, groute[eg].fee_prop_millionths);
-        CltvExpiry += groute[eg].cltv_expiry_delta;
-    }
-
-    if (route.size() > LN_HOP_MAX + 1) {
-        //先頭に自ノードが入るため+1
-        LOGE("fail: too many hops\n");
-        UTL_DBG_FREE(rt_res.p_nodes);
-        return LNROUTE_TOOMANYHOP;
-    }
-
     //戻り値の作成
-    pResult->num_hops = (uint8_t)route.size();
-    const uint8_t *p_next = NULL;
-
-    for (int lp = 0; lp < pResult->num_hops - 1; lp++) {
-        const uint8_t *p_now  = groute[route[lp]].p_node;
-        p_next = groute[route[lp + 1]].p_node;
-
-        const uint8_t *p_node_id1;
-        const uint8_t *p_node_id2;
-        direction(&p_node_id1, &p_node_id2, p_now, p_next);
-        uint64_t sci = 0;
-        for (uint32_t lp3 = 0; lp3 < rt_res.node_num; lp3++) {
-            if ( (memcmp(p_node_id1, rt_res.p_nodes[lp3].ninfo[0].node_id, BTC_SZ_PUBKEY) == 0) &&
-                 (memcmp(p_node_id2, rt_res.p_nodes[lp3].ninfo[1].node_id, BTC_SZ_PUBKEY) == 0) ) {
-                sci = rt_res.p_nodes[lp3].short_channel_id;
-                break;
-            }
-        }
-        if (sci == 0) {
-            LOGE("not match!\n");
-            return LNROUTE_NOTFOUND;
+    lnerr_route_t err = LNROUTE_NOTFOUND;
+    for (size_t lp = 0; lp < paths.size(); lp++) {
+        LOGD("route candidate[%lu]: cost=%" PRIu64 "\n", (unsigned long)lp, paths[lp].cost);
+        lnerr_route_t ret = path_to_result(&pResults[*pNum], paths[lp].path, pnt_start, CltvExpiry, AmountMsat);
+        if (ret == LNROUTE_OK) {
+            (*pNum)++;
+        } else if (lp == 0) {
+            err = ret;
         }
-
-        pResult->hop_datain[lp].short_channel_id = sci;
-        pResult->hop_datain[lp].amt_to_forward = msat[lp];
-        pResult->hop_datain[lp].outgoing_cltv_value = cltv[lp];
-        memcpy(pResult->hop_datain[lp].pubkey, p_now, BTC_SZ_PUBKEY);
-        LOGD("  route [%d]", lp);
-        DUMPD(p_now, BTC_SZ_PUBKEY);
     }
 
-    //最後
-    pResult->hop_datain[pResult->num_hops - 1].short_channel_id = 0;
-    pResult->hop_datain[pResult->num_hops - 1].amt_to_forward = msat[pResult->num_hops - 1];
-    pResult->hop_datain[pResult->num_hops - 1].outgoing_cltv_value = cltv[pResult->num_hops - 1];
-    memcpy(pResult->hop_datain[pResult->num_hops - 1].pubkey, p_next, BTC_SZ_PUBKEY);
-    LOGD("  route [%d]", pResult->num_hops - 1);
-    DUMPD(p_next, BTC_SZ_PUBKEY);
-
 #ifdef M_GRAPHVIZ
     // http://www.boost.org/doc/libs/1_55_0/libs/graph/example/dijkstra-example.cpp
     std::ofstream dot_file("gossip.dot");
@@ -655,6 +1299,7 @@ lnerr_route_t ln_routing_calculate(
              << "  node[style=\"solid,filled\", fillcolor=\"#8080ff\"];\n"
              ;
 
+    graph_t& groute = mGraph;
     graph_traits < graph_t >::edge_iterator ei, ei_end;
     for (boost::tie(ei, ei_end) = edges(groute); ei != ei_end; ++ei) {
         graph_traits < graph_t >::edge_descriptor e = *ei;
@@ -663,8 +1308,8 @@ lnerr_route_t ln_routing_calculate(
         if (u != v) {
             char node1[128] = "\"";
             char node2[128] = "\"";
-            const uint8_t *p_node1 = groute[u].p_node;
-            const uint8_t *p_node2 = groute[v].p_node;
+            const uint8_t *p_node1 = ver_node_id(u);
+            const uint8_t *p_node2 = ver_node_id(v);
             for (int lp = 0; lp < 6; lp++) {
                 char s[3];
                 sprintf(s, "%02x", p_node1[lp]);
@@ -697,9 +1342,102 @@ lnerr_route_t ln_routing_calculate(
     dot_file << "}";
 #endif  //M_GRAPHVIZ
 
-    UTL_DBG_FREE(rt_res.p_nodes);
+    return (*pNum > 0) ? LNROUTE_OK : err;
+}
 
-    return LNROUTE_OK;
+
+lnerr_route_t ln_routing_calculate(
+    ln_routing_result_t *pResult, const uint8_t *pPayerId, const uint8_t *pPayeeId,
+    uint32_t CltvExpiry, uint64_t AmountMsat, uint8_t AddNum, const ln_r_field_t *pAddRoute)
+{
+    uint8_t num;
+    return ln_routing_calculate_k(
+        pResult, &num, 1, pPayerId, pPayeeId, CltvExpiry, AmountMsat, AddNum, pAddRoute);
+}
+
+
+lnerr_route_t ln_routing_calculate_k(
+    ln_routing_result_t *pResults, uint8_t *pNum, uint8_t MaxNum,
+    const uint8_t *pPayerId, const uint8_t *pPayeeId,
+    uint32_t CltvExpiry, uint64_t AmountMsat, uint8_t AddNum, const ln_r_field_t *pAddRoute)
+{
+    *pNum = 0;
+    if (MaxNum > 0) {
+        pResults[0].num_hops = 0;
+    }
+
+    if ((pPayerId == NULL) || (pPayeeId == NULL) || (MaxNum == 0)) {
+        LOGE("fail: invalid input\n");
+        return LNROUTE_PARAM;
+    }
+
+    pthread_mutex_lock(&mMuxGraph);
+
+    bool ret = graph_sync();
+    if (!ret) {
+        LOGE("fail: load_db\n");
+        pthread_mutex_unlock(&mMuxGraph);
+        return LNROUTE_LOADDB;
+    }
+
+    std::vector<edge_descriptor> tmp_edges;
+    tmp_edge_add(&tmp_edges, pPayerId, pPayeeId, AddNum, pAddRoute);
+    LOGD("edge_num: %lu\n", (unsigned long)num_edges(mGraph));
+
+    lnerr_route_t err = calculate(pResults, pNum, MaxNum, pPayerId, pPayeeId, CltvExpiry, AmountMsat);
+
+    tmp_edge_remove(&tmp_edges);
+
+    pthread_mutex_unlock(&mMuxGraph);
+
+    return err;
+}
+
+
+bool ln_routing_cost_default(uint64_t *pCost, const ln_routing_edge_t *pEdge, uint64_t AmountMsat, void *pParam)
+{
+    (void)pParam;
+
+    //流せない額
+    if (AmountMsat < pEdge->htlc_minimum_msat) {
+        return false;
+    }
+    if (pEdge->htlc_maximum_msat && (AmountMsat > pEdge->htlc_maximum_msat)) {
+        return false;
+    }
+    if (AmountMsat > pEdge->liquidity_max_msat) {
+        return false;
+    }
+
+    uint64_t cost = edgefee(AmountMsat, pEdge->fee_base_msat, pEdge->fee_prop_millionths);
+
+    //成功確率: 送金可能額が[min, max]に一様分布するとみなす
+    //  maxが不明な場合はhtlc_maximum_msatを上限とする
+    uint64_t max = pEdge->liquidity_max_msat;
+    if ((max == M_LIQUIDITY_UNKNOWN) && pEdge->htlc_maximum_msat) {
+        max = pEdge->htlc_maximum_msat;
+    }
+    if ((max != M_LIQUIDITY_UNKNOWN) && (AmountMsat > pEdge->liquidity_min_msat) && (max >= pEdge->liquidity_min_msat)) {
+        double prob = (double)(max - AmountMsat + 1) / (double)(max - pEdge->liquidity_min_msat + 1);
+        double penalty = -log2(prob) *
+                ((double)M_LIQUIDITY_PENALTY_BASE_MSAT + (double)AmountMsat * M_LIQUIDITY_PENALTY_PPM / 1000000);
+        cost += (uint64_t)penalty;
+    }
+
+    if (pEdge->low_priority) {
+        cost *= M_LOW_PRIORITY_MULT;
+    }
+    *pCost = cost;
+    return true;
+}
+
+
+void ln_routing_set_cost_func(ln_routing_cost_func_t pFunc, void *pParam)
+{
+    pthread_mutex_lock(&mMuxGraph);
+    mCostFunc = (pFunc != NULL) ? pFunc : ln_routing_cost_default;
+    mpCostParam = (pFunc != NULL) ? pParam : NULL;
+    pthread_mutex_unlock(&mMuxGraph);
 }
 
 
@@ -710,3 +1448,112 @@ void ln_routing_clear_skipdb(void)
     bret = ln_db_route_skip_drop(false);
     LOGD("%s: clear routing skip DB\n", (bret) ? "OK" : "fail");
 }
+
+
+/********************************************************************
+ * notify from DB
+ ********************************************************************/
+
+void ln_routing_notify_cnlanno_save(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2)
+{
+    event_t evt;
+    evt.type = EVENT_CNLANNO;
+    evt.short_channel_id = ShortChannelId;
+    memcpy(evt.node_id[0], pNodeId1, BTC_SZ_PUBKEY);
+    memcpy(evt.node_id[1], pNodeId2, BTC_SZ_PUBKEY);
+    event_push(&evt);
+}
+
+
+void ln_routing_notify_cnlupd_save(const ln_msg_channel_update_t *pUpd)
+{
+    event_t evt;
+    evt.type = EVENT_CNLUPD;
+    evt.short_channel_id = pUpd->short_channel_id;
+    evt.dir = (uint8_t)ln_cnlupd_direction(pUpd);
+    evt.channel_flags = pUpd->channel_flags;
+    evt.cltv_expiry_delta = pUpd->cltv_expiry_delta;
+    evt.htlc_minimum_msat = pUpd->htlc_minimum_msat;
+    evt.htlc_maximum_msat = pUpd->htlc_maximum_msat;
+    evt.fee_base_msat = pUpd->fee_base_msat;
+    evt.fee_prop_millionths = pUpd->fee_proportional_millionths;
+    event_push(&evt);
+}
+
+
+void ln_routing_notify_cnlanno_del(uint64_t ShortChannelId, char Type)
+{
+    event_t evt;
+    evt.type = EVENT_CNLANNO_DEL;
+    evt.short_channel_id = ShortChannelId;
+    evt.anno_type = Type;
+    event_push(&evt);
+}
+
+
+void ln_routing_notify_route_skip_save(uint64_t ShortChannelId, bool bTemp)
+{
+    event_t evt;
+    evt.type = EVENT_SKIP_SAVE;
+    evt.short_channel_id = ShortChannelId;
+    evt.flag = bTemp;
+    event_push(&evt);
+}
+
+
+void ln_routing_notify_route_skip_work(bool bWork)
+{
+    event_t evt;
+    evt.type = EVENT_SKIP_WORK;
+    evt.short_channel_id = 0;
+    evt.flag = bWork;
+    event_push(&evt);
+}
+
+
+void ln_routing_notify_route_skip_drop(bool bTemp)
+{
+    event_t evt;
+    evt.type = EVENT_SKIP_DROP;
+    evt.short_channel_id = 0;
+    evt.flag = bTemp;
+    event_push(&evt);
+}
+
+
+/********************************************************************
+ * notify payment result
+ ********************************************************************/
+
+void ln_routing_notify_payment_success(const ln_hop_datain_t *pHopDatain, uint8_t NumHops)
+{
+    pthread_mutex_lock(&mMuxLiquidity);
+    for (int lp = 0; lp < NumHops - 1; lp++) {
+        liquidity_set(pHopDatain[lp].short_channel_id,
+                node_dir(pHopDatain[lp].pubkey, pHopDatain[lp + 1].pubkey),
+                pHopDatain[lp].amt_to_forward, true);
+    }
+    pthread_mutex_unlock(&mMuxLiquidity);
+}
+
+
+void ln_routing_notify_payment_fail(const ln_hop_datain_t *pHopDatain, uint8_t NumHops, int Hop, uint16_t Reason)
+{
+    pthread_mutex_lock(&mMuxLiquidity);
+    //  hop_datain[lp]: node[lp] --(short_channel_id)--> node[lp + 1]
+    //  Hop: 失敗を返したnode(hop_datain[Hop + 1])
+    for (int lp = 0; (lp <= Hop) && (lp < NumHops - 1); lp++) {
+        //失敗したnodeまでは届いた
+        liquidity_set(pHopDatain[lp].short_channel_id,
+                node_dir(pHopDatain[lp].pubkey, pHopDatain[lp + 1].pubkey),
+                pHopDatain[lp].amt_to_forward, true);
+    }
+    if ((Reason == LNONION_TMP_CHAN_FAIL) && (Hop + 1 >= 0) && (Hop + 1 < NumHops - 1)) {
+        //次のchannelに送金額が足りなかった
+        int lp = Hop + 1;
+        liquidity_set(pHopDatain[lp].short_channel_id,
+                node_dir(pHopDatain[lp].pubkey, pHopDatain[lp + 1].pubkey),
+                pHopDatain[lp].amt_to_forward, false);
+    }
+    pthread_mutex_unlock(&mMuxLiquidity);
+}
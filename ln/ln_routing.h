@@ -31,6 +31,7 @@
 #include "ln_err.h"
 #include "ln_onion.h"
 #include "ln_invoice.h"
+#include "ln_msg_anno.h"
 
 
 #ifdef __cplusplus
@@ -50,6 +51,34 @@ typedef struct {
 } ln_routing_result_t;
 
 
+/** @struct     ln_routing_edge_t
+ *  @brief      cost model入力(channelの方向別)
+ */
+typedef struct {
+    uint64_t    short_channel_id;
+    uint8_t     dir;                        ///< channel_updateのdirection
+    uint32_t    fee_base_msat;
+    uint32_t    fee_prop_millionths;
+    uint16_t    cltv_expiry_delta;
+    uint64_t    htlc_minimum_msat;
+    uint64_t    htlc_maximum_msat;          ///< 0:不明(自channelは送金可能額)
+    uint64_t    liquidity_min_msat;         ///< 推定: この額までは送金できた
+    uint64_t    liquidity_max_msat;         ///< 推定: この額を超えると送金できなかった(UINT64_MAX:不明)
+    bool        low_priority;               ///< true:LN_DB_ROUTE_SKIP_WORK
+} ln_routing_edge_t;
+
+
+/** cost model
+ *
+ * @param[out]  pCost           edgeのコスト(小さいほど優先)
+ * @param[in]   pEdge           edge情報
+ * @param[in]   AmountMsat      送金額(送金先の受取額)
+ * @param[in]   pParam          #ln_routing_set_cost_func()のpParam
+ * @retval  false   AmountMsatを流せないため、経路探索から除外する
+ */
+typedef bool (*ln_routing_cost_func_t)(uint64_t *pCost, const ln_routing_edge_t *pEdge, uint64_t AmountMsat, void *pParam);
+
+
 /********************************************************************
  * prototypes
  ********************************************************************/
@@ -75,6 +104,50 @@ lnerr_route_t ln_routing_calculate(
         const ln_r_field_t *pAddRoute);
 
 
+/** 支払いルート候補作成
+ *
+ * コストの小さい順にMaxNum個までのルートを作成する(Yen's algorithm)。
+ * pResults[0]は#ln_routing_calculate()と同じルートになる。
+ *
+ * @param[out]  pResults        ルート候補[MaxNum]
+ * @param[out]  pNum            作成したルート数
+ * @param[in]   MaxNum          最大ルート数
+ * @param[in]   pPayerId
+ * @param[in]   pPayeeId
+ * @param[in]   CltvExpiry
+ * @param[in]   AmountMsat
+ * @param[in]   AddNum          追加route数(invoiceのr fieldを想定)
+ * @param[in]   pAddRoute       追加route(invoiceのr fieldを想定)
+ * @return  LNERR_ROUTE_xxx(1つでも作成できればLNROUTE_OK)
+ */
+lnerr_route_t ln_routing_calculate_k(
+        ln_routing_result_t *pResults,
+        uint8_t *pNum,
+        uint8_t MaxNum,
+        const uint8_t *pPayerId,
+        const uint8_t *pPayeeId,
+        uint32_t CltvExpiry,
+        uint64_t AmountMsat,
+        uint8_t AddNum,
+        const ln_r_field_t *pAddRoute);
+
+
+/** 標準のcost model
+ *
+ * 手数料に、推定した送金可能額から求めた成功確率のペナルティを加える。
+ * htlc_minimum_msat/htlc_maximum_msat/推定した上限を超える場合は除外する。
+ */
+bool ln_routing_cost_default(uint64_t *pCost, const ln_routing_edge_t *pEdge, uint64_t AmountMsat, void *pParam);
+
+
+/** cost model設定
+ *
+ * @param[in]   pFunc           cost model(NULL:#ln_routing_cost_default())
+ * @param[in]   pParam          pFuncに渡すパラメータ
+ */
+void ln_routing_set_cost_func(ln_routing_cost_func_t pFunc, void *pParam);
+
+
 /** routing skip DB削除
  *
  * routingから除外するchannelリストを削除する。
@@ -82,6 +155,77 @@ lnerr_route_t ln_routing_calculate(
 void ln_routing_clear_skipdb(void);
 
 
+/** [DB通知]channel_announcement保存
+ *
+ * 常駐しているrouting graphに反映する(反映は次回の#ln_routing_calculate()時)。
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   pNodeId1        channel_announcement.node_id_1
+ * @param[in]   pNodeId2        channel_announcement.node_id_2
+ */
+void ln_routing_notify_cnlanno_save(uint64_t ShortChannelId, const uint8_t *pNodeId1, const uint8_t *pNodeId2);
+
+
+/** [DB通知]channel_update保存
+ *
+ * @param[in]   pUpd            保存したchannel_update
+ */
+void ln_routing_notify_cnlupd_save(const ln_msg_channel_update_t *pUpd);
+
+
+/** [DB通知]channel_announcement/channel_update削除
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   Type            LN_DB_CNLANNO_UPD0/UPD1:channel_updateのみ削除, それ以外:channel削除
+ */
+void ln_routing_notify_cnlanno_del(uint64_t ShortChannelId, char Type);
+
+
+/** [DB通知]routing skip DB登録
+ *
+ * @param[in]   ShortChannelId
+ * @param[in]   bTemp           true:LN_DB_ROUTE_SKIP_TEMP, false:LN_DB_ROUTE_SKIP_PERM
+ */
+void ln_routing_notify_route_skip_save(uint64_t ShortChannelId, bool bTemp);
+
+
+/** [DB通知]routing skip DBの一時登録切替
+ *
+ * @param[in]   bWork           true:TEMP-->WORK, false:WORK-->TEMP
+ */
+void ln_routing_notify_route_skip_work(bool bWork);
+
+
+/** [DB通知]routing skip DB削除
+ *
+ * @param[in]   bTemp           true:TEMPのみ削除, false:全削除
+ */
+void ln_routing_notify_route_skip_drop(bool bTemp);
+
+
+/** [送金結果通知]送金成功
+ *
+ * 経路上の各channelの送金可能額の推定に反映する。
+ *
+ * @param[in]   pHopDatain      送金したroute(先頭は自ノード)
+ * @param[in]   NumHops
+ */
+void ln_routing_notify_payment_success(const ln_hop_datain_t *pHopDatain, uint8_t NumHops);
+
+
+/** [送金結果通知]送金失敗(update_fail_htlc)
+ *
+ * 失敗を返したnodeまでのchannelは送金できたとみなし、
+ * temporary_channel_failureの場合は次のchannelは送金額が足りなかったとみなす。
+ *
+ * @param[in]   pHopDatain      送金したroute(先頭は自ノード)
+ * @param[in]   NumHops
+ * @param[in]   Hop             #ln_onion_failure_read()のpHop(-1:自channel)
+ * @param[in]   Reason          onion failure code(LNONION_xxx, 不明時は0)
+ */
+void ln_routing_notify_payment_fail(const ln_hop_datain_t *pHopDatain, uint8_t NumHops, int Hop, uint16_t Reason);
+
+
 #ifdef __cplusplus
 }
 #endif //__cplusplus
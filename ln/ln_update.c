@@ -32,40 +32,12 @@
  * public functions
  **************************************************************************/
 
-ln_update_t *ln_update_get_empty(ln_update_t *pUpdates, uint16_t *pUpdateIdx)
-{
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
-        ln_update_t *p_update = &pUpdates[idx];
-        if (LN_UPDATE_USED(p_update)) continue;
-        if (pUpdateIdx) {
-            *pUpdateIdx = idx;
-        }
-        return p_update;
-    }
-    return NULL;
-}
-
-
 void ln_update_clear(ln_update_t *pUpdate)
 {
     memset(pUpdate, 0x00, sizeof(ln_update_t));
 }
 
 
-ln_htlc_t *ln_htlc_get_empty(ln_htlc_t *pHtlcs, uint16_t *pHtlcIdx)
-{
-    for (uint16_t idx = 0; idx < LN_HTLC_MAX; idx++) {
-        ln_htlc_t *p_htlc = &pHtlcs[idx];
-        if (p_htlc->enabled) continue;
-        if (pHtlcIdx) {
-            *pHtlcIdx = idx;
-        }
-        return p_htlc;
-    }
-    return NULL;
-}
-
-
 ln_fee_update_t *ln_fee_update_get_empty(ln_fee_update_t *pFeeUpdates, uint16_t *pFeeUpdateIdx)
 {
     for (uint16_t idx = 0; idx < LN_FEE_UPDATE_MAX; idx++) {
@@ -34,6 +34,11 @@
  **************************************************************************/
 
 static uint32_t get_last_feerate_per_kw(ln_update_info_t *pInfo);
+static ln_update_t *update_alloc(ln_update_info_t *pInfo, uint16_t *pUpdateIdx);
+static void update_free(ln_update_info_t *pInfo, uint16_t UpdateIdx);
+static ln_htlc_t *htlc_alloc(ln_update_info_t *pInfo, uint16_t *pHtlcIdx);
+static void htlc_free(ln_update_info_t *pInfo, uint16_t HtlcIdx);
+static bool bitmap_alloc(uint64_t *pBits, uint16_t Num, uint16_t *pIdx);
 
 
 /**************************************************************************
@@ -60,17 +65,33 @@ void ln_update_info_free(ln_update_info_t *pInfo) {
 }
 
 
+void ln_update_info_rebuild_index(ln_update_info_t *pInfo)
+{
+    memset(pInfo->used_updates, 0x00, sizeof(pInfo->used_updates));
+    memset(pInfo->used_htlcs, 0x00, sizeof(pInfo->used_htlcs));
+    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+        if (!LN_UPDATE_USED(&pInfo->updates[idx])) continue;
+        pInfo->used_updates[idx / 64] |= (uint64_t)1 << (idx % 64);
+    }
+    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->htlcs); idx++) {
+        if (!pInfo->htlcs[idx].enabled) continue;
+        pInfo->used_htlcs[idx / 64] |= (uint64_t)1 << (idx % 64);
+    }
+}
+
+
 bool ln_update_info_set_add_htlc_send(ln_update_info_t *pInfo, uint16_t *pUpdateIdx)
 {
     uint16_t htlc_idx;
-    ln_htlc_t *p_htlc = ln_htlc_get_empty(pInfo->htlcs, &htlc_idx);
+    ln_htlc_t *p_htlc = htlc_alloc(pInfo, &htlc_idx);
     if (!p_htlc) return false;
     uint16_t update_idx;
-    ln_update_t *p_update = ln_update_get_empty(pInfo->updates, &update_idx);
-    if (!p_update) return false;
+    ln_update_t *p_update = update_alloc(pInfo, &update_idx);
+    if (!p_update) {
+        htlc_free(pInfo, htlc_idx);
+        return false;
+    }
     p_update->type_specific_idx = htlc_idx;
-    p_update->enabled = true;
-    p_htlc->enabled = true;
     p_update->type = LN_UPDATE_TYPE_ADD_HTLC;
     *pUpdateIdx = update_idx;
     return true;
@@ -80,14 +101,15 @@ bool ln_update_info_set_add_htlc_send(ln_update_info_t *pInfo, uint16_t *pUpdate
 bool ln_update_info_set_add_htlc_recv(ln_update_info_t *pInfo, uint16_t *pUpdateIdx)
 {
     uint16_t htlc_idx;
-    ln_htlc_t *p_htlc = ln_htlc_get_empty(pInfo->htlcs, &htlc_idx);
+    ln_htlc_t *p_htlc = htlc_alloc(pInfo, &htlc_idx);
     if (!p_htlc) return false;
     uint16_t update_idx;
-    ln_update_t *p_update = ln_update_get_empty(pInfo->updates, &update_idx);
-    if (!p_update) return false;
+    ln_update_t *p_update = update_alloc(pInfo, &update_idx);
+    if (!p_update) {
+        htlc_free(pInfo, htlc_idx);
+        return false;
+    }
     p_update->type_specific_idx = htlc_idx;
-    p_update->enabled = true;
-    p_htlc->enabled = true;
     p_update->type = LN_UPDATE_TYPE_ADD_HTLC;
     LN_UPDATE_FLAG_SET(p_update, LN_UPDATE_STATE_FLAG_UP_RECV);
     *pUpdateIdx = update_idx;
@@ -104,7 +126,7 @@ bool ln_update_info_clear_htlc(ln_update_info_t *pInfo, uint16_t UpdateIdx)
 
     ln_update_t *p_update = &pInfo->updates[UpdateIdx];
     if (!(p_update->type & LN_UPDATE_TYPE_MASK_HTLC)) {
-        ln_update_clear(p_update);
+        update_free(pInfo, UpdateIdx);
         return true;
     }
 
@@ -118,19 +140,16 @@ bool ln_update_info_clear_htlc(ln_update_info_t *pInfo, uint16_t UpdateIdx)
     if (p_htlc->buf_preimage.len) {
         /*ignore*/ ln_db_preimage_used(p_htlc->buf_preimage.buf); //XXX: delete outside the function
     }
-    utl_buf_free(&p_htlc->buf_preimage);
-    utl_buf_free(&p_htlc->buf_onion_reason);
-    utl_buf_free(&p_htlc->buf_shared_secret);
-    memset(p_htlc, 0x00, sizeof(ln_htlc_t));
+    htlc_free(pInfo, p_update->type_specific_idx);
 
     //clear corresponding update (add -> del, del -> add)
     uint16_t corresponding_update_idx;
     if (ln_update_info_get_corresponding_update(pInfo, &corresponding_update_idx, UpdateIdx)) {
-        ln_update_clear(&pInfo->updates[corresponding_update_idx]);
+        update_free(pInfo, corresponding_update_idx);
     }
 
     //clear update
-    ln_update_clear(p_update);
+    update_free(pInfo, UpdateIdx);
     return true;
 }
 
@@ -143,10 +162,9 @@ bool ln_update_info_get_corresponding_update(
     if (!(p_update->type & LN_UPDATE_TYPE_MASK_HTLC)) {
         return false;
     }
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         if (idx == UpdateIdx) continue; //skip myself
         const ln_update_t *p_update_2 = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update_2)) continue;
         if (!(p_update_2->type & LN_UPDATE_TYPE_MASK_HTLC)) continue;
         if (p_update_2->type_specific_idx != p_update->type_specific_idx) continue;
         *pCorrespondingUpdateIdx = idx;
@@ -180,13 +198,12 @@ bool ln_update_info_set_del_htlc_pre_send(ln_update_info_t *pInfo, uint16_t *pUp
         return false;
     }
 
-    ln_update_t *p_update = ln_update_get_empty(pInfo->updates, &update_idx_del_htlc);
+    ln_update_t *p_update = update_alloc(pInfo, &update_idx_del_htlc);
     if (!p_update) {
         LOGE("fail: ???\n");
         return false;
     }
 
-    p_update->enabled = true;
     p_update->type = Type;
     //p_update->flags.up_send = 1; //NOT set the flag, pre send
     p_update->type_specific_idx = pInfo->updates[update_idx_add_htlc].type_specific_idx;
@@ -219,13 +236,12 @@ bool ln_update_info_set_del_htlc_recv(ln_update_info_t *pInfo, uint16_t *pUpdate
         return false;
     }
 
-    ln_update_t *p_update = ln_update_get_empty(pInfo->updates, &update_idx_del_htlc);
+    ln_update_t *p_update = update_alloc(pInfo, &update_idx_del_htlc);
     if (!p_update) {
         LOGE("fail: ???\n");
         return false;
     }
 
-    p_update->enabled = true;
     p_update->type = Type;
     LN_UPDATE_FLAG_SET(p_update, LN_UPDATE_STATE_FLAG_UP_RECV);
     p_update->type_specific_idx = pInfo->updates[update_idx_add_htlc].type_specific_idx;
@@ -243,11 +259,10 @@ bool ln_update_info_set_fee_pre_send(ln_update_info_t *pInfo, uint16_t *pUpdateI
     if (!p_fee_update) return false;
 
     uint16_t update_idx;
-    ln_update_t *p_update = ln_update_get_empty(pInfo->updates, &update_idx);
+    ln_update_t *p_update = update_alloc(pInfo, &update_idx);
     if (!p_update) return false;
 
     p_update->type_specific_idx = fee_update_idx;
-    p_update->enabled = true;
     p_fee_update->enabled = true;
     p_fee_update->id = pInfo->next_fee_update_id++;
     p_fee_update->feerate_per_kw = FeeratePerKw;
@@ -273,11 +288,10 @@ bool ln_update_info_set_fee_recv(ln_update_info_t *pInfo, uint16_t *pUpdateIdx,
     if (!p_fee_update) return false;
 
     uint16_t update_idx;
-    ln_update_t *p_update = ln_update_get_empty(pInfo->updates, &update_idx);
+    ln_update_t *p_update = update_alloc(pInfo, &update_idx);
     if (!p_update) return false;
 
     p_update->type_specific_idx = fee_update_idx;
-    p_update->enabled = true;
     p_fee_update->enabled = true;
     p_fee_update->id = pInfo->next_fee_update_id++;
     p_fee_update->feerate_per_kw = FeeratePerKw;
@@ -304,7 +318,7 @@ bool ln_update_info_clear_fee(ln_update_info_t *pInfo, uint16_t UpdateIdx)
 
     ln_update_t *p_update = &pInfo->updates[UpdateIdx];
     if (!(p_update->type & LN_UPDATE_TYPE_FEE)) {
-        ln_update_clear(p_update);
+        update_free(pInfo, UpdateIdx);
         return true;
     }
 
@@ -318,7 +332,7 @@ bool ln_update_info_clear_fee(ln_update_info_t *pInfo, uint16_t UpdateIdx)
     memset(p_fee_update, 0x00, sizeof(ln_fee_update_t));
 
     //clear update
-    ln_update_clear(p_update);
+    update_free(pInfo, UpdateIdx);
     return true;
 }
 
@@ -348,9 +362,8 @@ void ln_update_info_prune_fee_updates(ln_update_info_t *pInfo)
         bool need_to_be_pruned;
     } infos[ARRAY_SIZE(pInfo->fee_updates)];
     uint32_t num_infos = 0;
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (p_update->type != LN_UPDATE_TYPE_FEE) continue;
         assert(num_infos < ARRAY_SIZE(pInfo->fee_updates));
         infos[num_infos].update_idx = idx;
@@ -381,9 +394,8 @@ uint32_t ln_update_info_get_feerate_per_kw_pre_committed(const ln_update_info_t
 {
     uint64_t id = 0;
     uint32_t feerate_per_kw = 0;
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         const ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_ENABLED(p_update, LN_UPDATE_TYPE_FEE, bLocal)) continue;
         const ln_fee_update_t *p_fee_update = &pInfo->fee_updates[p_update->type_specific_idx];
         if (p_fee_update->id < id) continue;
@@ -401,9 +413,8 @@ uint32_t ln_update_info_get_feerate_per_kw_committed(const ln_update_info_t *pIn
 {
     uint64_t id = 0;
     uint32_t feerate_per_kw = 0;
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         const ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_ENABLED(p_update, LN_UPDATE_TYPE_FEE, bLocal)) continue;
         if (LN_UPDATE_UNCOMMITTED(p_update, bLocal)) continue;
         const ln_fee_update_t *p_fee_update = &pInfo->fee_updates[p_update->type_specific_idx];
@@ -441,9 +452,8 @@ bool ln_update_info_fee_update_needs(ln_update_info_t *pInfo, uint32_t FeeratePe
 bool ln_update_info_get_update(
     const ln_update_info_t *pInfo, uint16_t *pUpdateIdx, uint8_t Type, uint16_t TypeSpecificIdx)
 {
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         const ln_update_t *p_update = &pInfo->updates[idx];
-        if (!p_update->enabled) continue;
         if (!(p_update->type & Type)) continue;
         if (p_update->type_specific_idx != TypeSpecificIdx) continue;
         *pUpdateIdx = idx;
@@ -456,9 +466,8 @@ bool ln_update_info_get_update(
 bool ln_update_info_get_update_add_htlc_send_enabled(
     const ln_update_info_t *pInfo, uint16_t *pUpdateIdx, uint64_t HtlcId)
 {
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         const ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_SEND_ENABLED(p_update, LN_UPDATE_TYPE_ADD_HTLC, true)) continue;
         if (pInfo->htlcs[p_update->type_specific_idx].id != HtlcId) continue;
         *pUpdateIdx = idx;
@@ -471,9 +480,8 @@ bool ln_update_info_get_update_add_htlc_send_enabled(
 bool ln_update_info_get_update_add_htlc_recv_enabled(
     const ln_update_info_t *pInfo, uint16_t *pUpdateIdx, uint64_t HtlcId)
 {
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         const ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_RECV_ENABLED(p_update, LN_UPDATE_TYPE_ADD_HTLC, true)) continue;
         if (pInfo->htlcs[p_update->type_specific_idx].id != HtlcId) continue;
         *pUpdateIdx = idx;
@@ -486,9 +494,8 @@ bool ln_update_info_get_update_add_htlc_recv_enabled(
 bool ln_update_info_get_update_add_htlc_forwarded_send(
     const ln_update_info_t *pInfo, uint16_t *pUpdateIdx, uint64_t PrevShortChannelId, uint64_t PrevHtlcId)
 {
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         const ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (p_update->type != LN_UPDATE_TYPE_ADD_HTLC) continue;
         if (!LN_UPDATE_OFFERED(p_update)) continue;
         if (pInfo->htlcs[p_update->type_specific_idx].neighbor_short_channel_id != PrevShortChannelId) continue;
@@ -502,9 +509,8 @@ bool ln_update_info_get_update_add_htlc_forwarded_send(
 
 bool ln_update_info_irrevocably_committed_htlcs_exists(ln_update_info_t *pInfo)
 {
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_IRREVOCABLY_COMMITTED(p_update)) continue;
         if (!(p_update->type & LN_UPDATE_TYPE_MASK_DEL_HTLC)) continue;
         return true;
@@ -515,16 +521,14 @@ bool ln_update_info_irrevocably_committed_htlcs_exists(ln_update_info_t *pInfo)
 
 bool ln_update_info_commitment_signed_send_needs(ln_update_info_t *pInfo)
 {
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_REMOTE_COMSIGING(p_update)) continue;
         return false;
     }
 
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_WAIT_SEND_CS(p_update)) continue;
         return true;
     }
@@ -536,9 +540,8 @@ void ln_update_info_clear_irrevocably_committed_updates(ln_update_info_t *pInfo)
 {
     ln_update_info_prune_fee_updates(pInfo);
 
-    for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (!LN_UPDATE_IRREVOCABLY_COMMITTED(p_update)) continue;
         if (p_update->type & LN_UPDATE_TYPE_MASK_DEL_HTLC) {
             /*ignore*/ ln_update_info_clear_htlc(pInfo, idx);
@@ -555,9 +558,8 @@ void ln_update_info_set_state_flag_all(ln_update_info_t *pInfo, uint8_t flag)
 {
     switch (flag) {
     case LN_UPDATE_STATE_FLAG_CS_SEND:
-        for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+        for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
             ln_update_t *p_update = &pInfo->updates[idx];
-            if (!LN_UPDATE_USED(p_update)) continue;
             switch (p_update->state) {
             case LN_UPDATE_STATE_OFFERED_UP_SEND:
             case LN_UPDATE_STATE_RECEIVED_RA_SEND:
@@ -569,9 +571,8 @@ void ln_update_info_set_state_flag_all(ln_update_info_t *pInfo, uint8_t flag)
         }
         break;
     case LN_UPDATE_STATE_FLAG_CS_RECV:
-        for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+        for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
             ln_update_t *p_update = &pInfo->updates[idx];
-            if (!LN_UPDATE_USED(p_update)) continue;
             switch (p_update->state) {
             case LN_UPDATE_STATE_OFFERED_RA_RECV:
             case LN_UPDATE_STATE_RECEIVED_UP_RECV:
@@ -583,9 +584,8 @@ void ln_update_info_set_state_flag_all(ln_update_info_t *pInfo, uint8_t flag)
         }
         break;
     case LN_UPDATE_STATE_FLAG_RA_SEND:
-        for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+        for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
             ln_update_t *p_update = &pInfo->updates[idx];
-            if (!LN_UPDATE_USED(p_update)) continue;
             switch (p_update->state) {
             case LN_UPDATE_STATE_OFFERED_CS_RECV:
             case LN_UPDATE_STATE_RECEIVED_CS_RECV:
@@ -597,9 +597,8 @@ void ln_update_info_set_state_flag_all(ln_update_info_t *pInfo, uint8_t flag)
         }
         break;
     case LN_UPDATE_STATE_FLAG_RA_RECV:
-        for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+        for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
             ln_update_t *p_update = &pInfo->updates[idx];
-            if (!LN_UPDATE_USED(p_update)) continue;
             switch (p_update->state) {
             case LN_UPDATE_STATE_OFFERED_CS_SEND:
             case LN_UPDATE_STATE_RECEIVED_CS_SEND:
@@ -617,7 +616,7 @@ void ln_update_info_set_state_flag_all(ln_update_info_t *pInfo, uint8_t flag)
 
 
 void ln_update_info_reset_new_update(ln_update_info_t *pInfo) {
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
         p_update->new_update = false;
     }
@@ -627,9 +626,8 @@ void ln_update_info_reset_new_update(ln_update_info_t *pInfo) {
 uint64_t ln_update_info_get_htlc_value_in_flight_msat(ln_update_info_t *pInfo, bool bLocal)
 {
     uint64_t value = 0;
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (LN_UPDATE_RECV_ENABLED(p_update, LN_UPDATE_TYPE_ADD_HTLC, bLocal)) {
             value += pInfo->htlcs[p_update->type_specific_idx].amount_msat;
         }
@@ -644,9 +642,8 @@ uint64_t ln_update_info_get_htlc_value_in_flight_msat(ln_update_info_t *pInfo, b
 uint16_t ln_update_info_get_num_received_htlcs(ln_update_info_t *pInfo, bool bLocal)
 {
     uint16_t num = 0;
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (LN_UPDATE_RECV_ENABLED(p_update, LN_UPDATE_TYPE_ADD_HTLC, bLocal)) {
             num++;
         }
@@ -661,9 +658,8 @@ uint16_t ln_update_info_get_num_received_htlcs(ln_update_info_t *pInfo, bool bLo
 void ln_update_info_clear_pending_updates(ln_update_info_t *pInfo, bool *pUpdated)
 {
     *pUpdated = false;
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
+    for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
         ln_update_t *p_update = &pInfo->updates[idx];
-        if (!LN_UPDATE_USED(p_update)) continue;
         if (p_update->state != LN_UPDATE_STATE_OFFERED_WAIT_SEND &&
             p_update->state != LN_UPDATE_STATE_OFFERED_UP_SEND &&
             p_update->state != LN_UPDATE_STATE_RECEIVED_UP_RECV) continue; //check not committed
@@ -679,7 +675,7 @@ void ln_update_info_clear_pending_updates(ln_update_info_t *pInfo, bool *pUpdate
         case LN_UPDATE_TYPE_FAIL_HTLC:
         case LN_UPDATE_TYPE_FAIL_MALFORMED_HTLC:
             LOGD("clear update del htlc update_idx=%u\n", idx);
-            ln_update_clear(p_update);
+            update_free(pInfo, idx);
             break;
         case LN_UPDATE_TYPE_FEE:
             LOGD("clear update fee update_idx=%u\n", idx);
@@ -696,11 +692,11 @@ void ln_update_info_clear_pending_updates(ln_update_info_t *pInfo, bool *pUpdate
 
 bool ln_update_info_is_channel_clean(ln_update_info_t *pInfo)
 {
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->updates); idx++) {
-        if (pInfo->updates[idx].enabled) return false;
+    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->used_updates); idx++) {
+        if (pInfo->used_updates[idx]) return false;
     }
-    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->htlcs); idx++) {
-        if (pInfo->htlcs[idx].enabled) return false;
+    for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->used_htlcs); idx++) {
+        if (pInfo->used_htlcs[idx]) return false;
     }
     for (uint16_t idx = 0; idx < ARRAY_SIZE(pInfo->fee_updates); idx++) {
         if (pInfo->fee_updates[idx].enabled) return false;
@@ -729,3 +725,67 @@ static uint32_t get_last_feerate_per_kw(ln_update_info_t *pInfo)
     }
     return feerate_per_kw;
 }
+
+
+static ln_update_t *update_alloc(ln_update_info_t *pInfo, uint16_t *pUpdateIdx)
+{
+    uint16_t idx;
+    if (!bitmap_alloc(pInfo->used_updates, LN_UPDATE_MAX, &idx)) return NULL;
+    ln_update_t *p_update = &pInfo->updates[idx];
+    assert(LN_UPDATE_EMPTY(p_update));
+    p_update->enabled = true;
+    *pUpdateIdx = idx;
+    return p_update;
+}
+
+
+static void update_free(ln_update_info_t *pInfo, uint16_t UpdateIdx)
+{
+    ln_update_clear(&pInfo->updates[UpdateIdx]);
+    pInfo->used_updates[UpdateIdx / 64] &= ~((uint64_t)1 << (UpdateIdx % 64));
+}
+
+
+static ln_htlc_t *htlc_alloc(ln_update_info_t *pInfo, uint16_t *pHtlcIdx)
+{
+    uint16_t idx;
+    if (!bitmap_alloc(pInfo->used_htlcs, LN_HTLC_MAX, &idx)) return NULL;
+    ln_htlc_t *p_htlc = &pInfo->htlcs[idx];
+    assert(!p_htlc->enabled);
+    p_htlc->enabled = true;
+    *pHtlcIdx = idx;
+    return p_htlc;
+}
+
+
+static void htlc_free(ln_update_info_t *pInfo, uint16_t HtlcIdx)
+{
+    ln_htlc_t *p_htlc = &pInfo->htlcs[HtlcIdx];
+    utl_buf_free(&p_htlc->buf_preimage);
+    utl_buf_free(&p_htlc->buf_onion_reason);
+    utl_buf_free(&p_htlc->buf_shared_secret);
+    memset(p_htlc, 0x00, sizeof(ln_htlc_t));
+    pInfo->used_htlcs[HtlcIdx / 64] &= ~((uint64_t)1 << (HtlcIdx % 64));
+}
+
+
+/** find and set the lowest clear bit
+ *
+ * @param[in,out]   pBits       bitmap
+ * @param[in]       Num         number of valid bits
+ * @param[out]      pIdx        index of the bit
+ * @retval  false   no clear bit
+ */
+static bool bitmap_alloc(uint64_t *pBits, uint16_t Num, uint16_t *pIdx)
+{
+    for (uint16_t word = 0; word < (Num + 63) / 64; word++) {
+        uint64_t free_bits = ~pBits[word];
+        if (!free_bits) continue;
+        uint16_t idx = (uint16_t)(word * 64 + __builtin_ctzll(free_bits));
+        if (idx >= Num) return false;
+        pBits[word] |= (uint64_t)1 << (idx % 64);
+        *pIdx = idx;
+        return true;
+    }
+    return false;
+}
@@ -47,6 +47,9 @@
 //  so it should be a little less.
 #define LN_FEE_UPDATE_MAX               (8)
 
+#define LN_UPDATE_USED_WORDS            ((LN_UPDATE_MAX + 63) / 64)
+#define LN_HTLC_USED_WORDS              ((LN_HTLC_MAX + 63) / 64)
+
 
 /********************************************************************
  * typedefs
@@ -59,15 +62,51 @@ typedef struct {
     ln_fee_update_t             fee_updates[LN_FEE_UPDATE_MAX]; ///< fee update
     uint32_t                    feerate_per_kw_irrevocably_committed;   ///< feerate_per_kw
     uint64_t                    next_fee_update_id;             ///< fee update id
+
+    //index (not saved to DB, rebuilt by `ln_update_info_rebuild_index`)
+    //  Only ln_update_info.c changes `updates[].enabled` and `htlcs[].enabled`,
+    //  so the bitmaps always match them.
+    uint64_t                    used_updates[LN_UPDATE_USED_WORDS]; ///< bitmap of used `updates`
+    uint64_t                    used_htlcs[LN_HTLC_USED_WORDS];     ///< bitmap of used `htlcs`
 } ln_update_info_t;
 
 
+/**************************************************************************
+ * static inline
+ **************************************************************************/
+
+/** find the next used update
+ *
+ * Scan the bitmap from `*pUpdateIdx` so that the cost depends on the number of used updates.
+ *
+ *  for (uint16_t idx = 0; ln_update_info_next_used(pInfo, &idx); idx++) {
+ *      ln_update_t *p_update = &pInfo->updates[idx];
+ *  }
+ *
+ * @param[in]       pInfo
+ * @param[in,out]   pUpdateIdx      [in]start index, [out]found index (LN_UPDATE_MAX if not found)
+ * @retval  true    found
+ */
+static inline bool ln_update_info_next_used(const ln_update_info_t *pInfo, uint16_t *pUpdateIdx)
+{
+    for (uint32_t idx = *pUpdateIdx; idx < LN_UPDATE_MAX; idx = (idx / 64 + 1) * 64) {
+        uint64_t bits = pInfo->used_updates[idx / 64] >> (idx % 64);
+        if (!bits) continue;
+        *pUpdateIdx = (uint16_t)(idx + __builtin_ctzll(bits));
+        return true;
+    }
+    *pUpdateIdx = LN_UPDATE_MAX;
+    return false;
+}
+
+
 /********************************************************************
  * prototypes
  ********************************************************************/
 
 void ln_update_info_init(ln_update_info_t *pInfo);
 void ln_update_info_free(ln_update_info_t *pInfo);
+void ln_update_info_rebuild_index(ln_update_info_t *pInfo);
 
 bool ln_update_info_set_add_htlc_send(ln_update_info_t *pInfo, uint16_t *pUpdateIdx);
 bool ln_update_info_set_add_htlc_recv(ln_update_info_t *pInfo, uint16_t *pUpdateIdx);
@@ -4,7 +4,7 @@
 /** @def    LN_DB_VERSION
  *  @brief  database version
  */
-#define LN_DB_VERSION    ((int32_t)(-71))
+#define LN_DB_VERSION    ((int32_t)(-75))
 /*
     -1 : first
     -2 : ln_update_add_htlc_t変更
@@ -117,6 +117,10 @@
     -69: add `ln_db_preimage_t::status` (auto update: -68 ==> -69)
     -70: add `ln_db_wallet_t::mined_height` (bitcoind auto update: -69 ==> -70)
     -71: add `ln_channel_t::keys_static_remotekey`
+    -72: HTLC DB: "HT" + channel_id + "ddd" -> "HT" + channel_id(key: htlc index) (auto update: -71 ==> -72)
+    -73: channel DB: key per item -> 1 data "channel" (auto update: -72 ==> -73)
+    -74: node DB: add preimage index [preimage_hash], [preimage_expire] (auto update: -73 ==> -74)
+    -75: anno DB: "channel_anno_info", "node_anno_info" -> "channel_anno_sent", "node_anno_sent" + "anno_peer" (auto update: -74 ==> -75)
  */
 
 #endif /* LN_VERSION_H__ */
@@ -51,20 +51,43 @@ FAKE_VALUE_FUNC(bool, ln_msg_reply_channel_range_read, ln_msg_reply_channel_rang
 FAKE_VALUE_FUNC(bool, ln_msg_gossip_timestamp_filter_read, ln_msg_gossip_timestamp_filter_t *, const uint8_t *, uint16_t );
 
 FAKE_VALUE_FUNC(bool, ln_msg_gossip_ids_encode, utl_buf_t *, const uint64_t *, size_t );
+FAKE_VALUE_FUNC(bool, ln_msg_gossip_ids_encode_type, utl_buf_t *, const uint64_t *, size_t, uint8_t );
 FAKE_VALUE_FUNC(bool, ln_msg_gossip_ids_decode, uint64_t **, size_t *, const uint8_t *, size_t );
 
 FAKE_VALUE_FUNC(bool, ln_db_annoinfos_del_node_id, const uint8_t *, const uint64_t *, size_t);
-FAKE_VALUE_FUNC(bool, ln_db_anno_transaction)
-FAKE_VOID_FUNC(ln_db_anno_commit, bool)
+FAKE_VALUE_FUNC(bool, ln_db_anno_read_begin)
+FAKE_VOID_FUNC(ln_db_anno_read_end)
 FAKE_VALUE_FUNC(bool, ln_db_anno_cur_open, void **, ln_db_cur_t);
 FAKE_VOID_FUNC(ln_db_anno_cur_close, void *);
 FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_get, void*, uint64_t*, char *, uint32_t *, utl_buf_t *);
+FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_seek, void*, uint64_t*, char *, uint32_t *, utl_buf_t *, uint64_t);
 FAKE_VALUE_FUNC(bool, ln_db_annoinfos_del_timestamp, const uint8_t *, uint32_t , uint32_t );
 
 ////////////////////////////////////////////////////////////////////////
 
 namespace LN_DUMMY {
+    //DB: short_channel_id昇順
+    struct cnlanno_t {
+        uint64_t    short_channel_id;
+        char        type;
+    };
+    const cnlanno_t *p_db;
+    size_t db_num;
+    size_t db_pos;
 
+    //送信したreply_channel_range
+    struct reply_t {
+        uint32_t    first_blocknum;
+        uint32_t    number_of_blocks;
+        uint16_t    len;
+        uint8_t     encode;
+    };
+    reply_t replies[16];
+    int reply_num;
+    int send_num;
+
+    //zlib: この数より多ければ無圧縮より小さくなったことにする
+    size_t zlib_smaller_num;
 }
 
 
@@ -84,6 +107,13 @@ protected:
         RESET_FAKE(ln_msg_query_channel_range_read)
         RESET_FAKE(ln_msg_reply_channel_range_read)
         RESET_FAKE(ln_msg_gossip_timestamp_filter_read)
+        RESET_FAKE(ln_msg_gossip_ids_encode_type)
+        RESET_FAKE(ln_db_anno_read_begin)
+        RESET_FAKE(ln_db_anno_read_end)
+        RESET_FAKE(ln_db_anno_cur_open)
+        RESET_FAKE(ln_db_anno_cur_close)
+        RESET_FAKE(ln_db_cnlanno_cur_get)
+        RESET_FAKE(ln_db_cnlanno_cur_seek)
 
         utl_dbg_malloc_cnt_reset();
     }
@@ -112,6 +142,91 @@ public:
         }
         return ret;
     }
+
+    static void SetupReplyRange(const LN_DUMMY::cnlanno_t *pDb, size_t Num)
+    {
+        LN_DUMMY::p_db = pDb;
+        LN_DUMMY::db_num = Num;
+        LN_DUMMY::db_pos = Num;
+        LN_DUMMY::reply_num = 0;
+        LN_DUMMY::send_num = 0;
+        LN_DUMMY::zlib_smaller_num = SIZE_MAX;
+        ln_db_anno_read_begin_fake.return_val = true;
+        ln_db_anno_cur_open_fake.return_val = true;
+        ln_db_cnlanno_cur_seek_fake.custom_fake = FakeCurSeek;
+        ln_db_cnlanno_cur_get_fake.custom_fake = FakeCurGet;
+        ln_msg_gossip_ids_encode_type_fake.custom_fake = FakeEncodeType;
+        ln_msg_reply_channel_range_write_fake.custom_fake = FakeReplyWrite;
+    }
+    static bool FakeCurLoad(uint64_t *pShortChannelId, char *pType)
+    {
+        if (LN_DUMMY::db_pos >= LN_DUMMY::db_num) {
+            return false;
+        }
+        *pShortChannelId = LN_DUMMY::p_db[LN_DUMMY::db_pos].short_channel_id;
+        *pType = LN_DUMMY::p_db[LN_DUMMY::db_pos].type;
+        return true;
+    }
+    static bool FakeCurSeek(void *, uint64_t *pShortChannelId, char *pType, uint32_t *, utl_buf_t *, uint64_t ShortChannelId)
+    {
+        for (LN_DUMMY::db_pos = 0; LN_DUMMY::db_pos < LN_DUMMY::db_num; LN_DUMMY::db_pos++) {
+            if (LN_DUMMY::p_db[LN_DUMMY::db_pos].short_channel_id >= ShortChannelId) {
+                break;
+            }
+        }
+        return FakeCurLoad(pShortChannelId, pType);
+    }
+    static bool FakeCurGet(void *, uint64_t *pShortChannelId, char *pType, uint32_t *, utl_buf_t *)
+    {
+        LN_DUMMY::db_pos++;
+        return FakeCurLoad(pShortChannelId, pType);
+    }
+    static bool FakeEncodeType(utl_buf_t *pEncodedIds, const uint64_t *pShortChannelIds, size_t Num, uint8_t Encode)
+    {
+        size_t len;
+        if (Encode == LN_GOSSIPQUERY_ENCODE_NONE) {
+            len = 1 + sizeof(uint64_t) * Num;
+        } else if (Num > LN_DUMMY::zlib_smaller_num) {
+            len = 1 + sizeof(uint64_t) * Num / 2;
+        } else {
+            len = 1 + sizeof(uint64_t) * Num + 10;
+        }
+        utl_buf_alloc(pEncodedIds, len);
+        memset(pEncodedIds->buf, 0, len);
+        pEncodedIds->buf[0] = Encode;
+        //昇順
+        for (size_t lp = 1; lp < Num; lp++) {
+            if (pShortChannelIds[lp - 1] >= pShortChannelIds[lp]) {
+                return false;
+            }
+        }
+        return true;
+    }
+    static bool FakeReplyWrite(utl_buf_t *pBuf, const ln_msg_reply_channel_range_t *pMsg)
+    {
+        if (LN_DUMMY::reply_num >= (int)ARRAY_SIZE(LN_DUMMY::replies)) {
+            return false;
+        }
+        LN_DUMMY::reply_t *p = &LN_DUMMY::replies[LN_DUMMY::reply_num++];
+        p->first_blocknum = pMsg->first_blocknum;
+        p->number_of_blocks = pMsg->number_of_blocks;
+        p->len = pMsg->len;
+        p->encode = pMsg->p_encoded_short_ids[0];
+        utl_buf_alloc(pBuf, 1);
+        return true;
+    }
+    static void FakeCallback(ln_cb_type_t Type, void *, void *)
+    {
+        if (Type == LN_CB_TYPE_SEND_MESSAGE) {
+            LN_DUMMY::send_num++;
+        }
+    }
+    static void InitChannel(ln_channel_t *pChannel)
+    {
+        memset(pChannel, 0, sizeof(ln_channel_t));
+        pChannel->init_flag = M_INIT_GOSSIP_QUERY;
+        pChannel->p_callback = FakeCallback;
+    }
 };
 
 ////////////////////////////////////////////////////////////////////////
@@ -141,3 +256,188 @@ TEST_F(ln, no_gossip_queries)
     ASSERT_FALSE(ln_gossip_timestamp_filter_send(&channel));
     ASSERT_TRUE(ln_gossip_timestamp_filter_recv(&channel, NULL, 0));
 }
+
+
+TEST_F(ln, reply_channel_range_chunk)
+{
+    //block: 100, 101, 101, 101, 102
+    const uint64_t IDS[] = {
+        M_SCID_FROM_BLOCK(100) | 1,
+        M_SCID_FROM_BLOCK(101) | 1,
+        M_SCID_FROM_BLOCK(101) | 2,
+        M_SCID_FROM_BLOCK(101) | 3,
+        M_SCID_FROM_BLOCK(102) | 1,
+    };
+
+    ASSERT_EQ(5, reply_channel_range_chunk(IDS, 5, 5));
+    ASSERT_EQ(0, reply_channel_range_chunk(IDS, 0, 5));
+    //blockの途中では区切らない
+    ASSERT_EQ(4, reply_channel_range_chunk(IDS, 5, 4));
+    ASSERT_EQ(1, reply_channel_range_chunk(IDS, 5, 3));
+    ASSERT_EQ(1, reply_channel_range_chunk(IDS, 5, 2));
+    ASSERT_EQ(1, reply_channel_range_chunk(IDS, 5, 1));
+    //1blockで最大数を超える
+    ASSERT_EQ(2, reply_channel_range_chunk(IDS + 1, 3, 2));
+}
+
+
+TEST_F(ln, reply_channel_range_send_range)
+{
+    const LN_DUMMY::cnlanno_t DB[] = {
+        { M_SCID_FROM_BLOCK(99) | 1, LN_DB_CNLANNO_ANNO },
+        { M_SCID_FROM_BLOCK(100) | 1, LN_DB_CNLANNO_ANNO },
+        { M_SCID_FROM_BLOCK(100) | 1, LN_DB_CNLANNO_UPD0 },
+        { M_SCID_FROM_BLOCK(105) | 1, LN_DB_CNLANNO_ANNO },
+        { M_SCID_FROM_BLOCK(105) | 1, LN_DB_CNLANNO_UPD1 },
+        { M_SCID_FROM_BLOCK(109) | 1, LN_DB_CNLANNO_ANNO },
+        { M_SCID_FROM_BLOCK(110) | 1, LN_DB_CNLANNO_ANNO },
+    };
+    SetupReplyRange(DB, ARRAY_SIZE(DB));
+
+    ln_channel_t channel;
+    InitChannel(&channel);
+    uint8_t chain_hash[BTC_SZ_HASH256] = {0};
+    ln_msg_query_channel_range_t qcr;
+    qcr.p_chain_hash = chain_hash;
+    qcr.first_blocknum = 100;
+    qcr.number_of_blocks = 10;
+
+    ASSERT_TRUE(ln_reply_channel_range_send(&channel, &qcr));
+    ASSERT_EQ(1, ln_db_cnlanno_cur_seek_fake.call_count);
+    ASSERT_EQ(M_SCID_FROM_BLOCK(100), ln_db_cnlanno_cur_seek_fake.arg5_val);
+    ASSERT_EQ(1, ln_db_anno_read_end_fake.call_count);
+    ASSERT_EQ(1, ln_db_anno_cur_close_fake.call_count);
+
+    //block 100, 105, 109のchannel_announcement
+    ASSERT_EQ(1, LN_DUMMY::reply_num);
+    ASSERT_EQ(1, LN_DUMMY::send_num);
+    ASSERT_EQ(100, LN_DUMMY::replies[0].first_blocknum);
+    ASSERT_EQ(10, LN_DUMMY::replies[0].number_of_blocks);
+    ASSERT_EQ(1 + 8 * 3, LN_DUMMY::replies[0].len);
+    ASSERT_EQ(LN_GOSSIPQUERY_ENCODE_NONE, LN_DUMMY::replies[0].encode);
+}
+
+
+TEST_F(ln, reply_channel_range_send_empty)
+{
+    const LN_DUMMY::cnlanno_t DB[] = {
+        { M_SCID_FROM_BLOCK(99) | 1, LN_DB_CNLANNO_ANNO },
+        { M_SCID_FROM_BLOCK(200) | 1, LN_DB_CNLANNO_ANNO },
+    };
+    SetupReplyRange(DB, ARRAY_SIZE(DB));
+
+    ln_channel_t channel;
+    InitChannel(&channel);
+    uint8_t chain_hash[BTC_SZ_HASH256] = {0};
+    ln_msg_query_channel_range_t qcr;
+    qcr.p_chain_hash = chain_hash;
+    qcr.first_blocknum = 100;
+    qcr.number_of_blocks = 100;
+
+    //該当なしでも範囲全体を返す
+    ASSERT_TRUE(ln_reply_channel_range_send(&channel, &qcr));
+    ASSERT_EQ(1, LN_DUMMY::reply_num);
+    ASSERT_EQ(100, LN_DUMMY::replies[0].first_blocknum);
+    ASSERT_EQ(100, LN_DUMMY::replies[0].number_of_blocks);
+    ASSERT_EQ(1, LN_DUMMY::replies[0].len);
+}
+
+
+TEST_F(ln, reply_channel_range_send_over_24bit)
+{
+    const LN_DUMMY::cnlanno_t DB[] = {
+        { M_SCID_FROM_BLOCK(99) | 1, LN_DB_CNLANNO_ANNO },
+        { M_SCID_FROM_BLOCK(100) | 1, LN_DB_CNLANNO_ANNO },
+        { M_SCID_FROM_BLOCK(0xfffffe) | 1, LN_DB_CNLANNO_ANNO },
+    };
+    SetupReplyRange(DB, ARRAY_SIZE(DB));
+
+    ln_channel_t channel;
+    InitChannel(&channel);
+    uint8_t chain_hash[BTC_SZ_HASH256] = {0};
+    ln_msg_query_channel_range_t qcr;
+    qcr.p_chain_hash = chain_hash;
+
+    //block heightは24bitなので、seekせずに範囲全体を空で返す
+    //  (0x01000064 << 40 は block 100 になってしまう)
+    qcr.first_blocknum = 0x01000064;
+    qcr.number_of_blocks = 10;
+    ASSERT_TRUE(ln_reply_channel_range_send(&channel, &qcr));
+    ASSERT_EQ(0, ln_db_cnlanno_cur_seek_fake.call_count);
+    ASSERT_EQ(1, LN_DUMMY::reply_num);
+    ASSERT_EQ(0x01000064, LN_DUMMY::replies[0].first_blocknum);
+    ASSERT_EQ(10, LN_DUMMY::replies[0].number_of_blocks);
+    ASSERT_EQ(1, LN_DUMMY::replies[0].len);
+
+    //要求範囲の終わりがUINT32_MAXを超える
+    LN_DUMMY::reply_num = 0;
+    qcr.first_blocknum = UINT32_MAX - 5;
+    qcr.number_of_blocks = 10;
+    ASSERT_TRUE(ln_reply_channel_range_send(&channel, &qcr));
+    ASSERT_EQ(0, ln_db_cnlanno_cur_seek_fake.call_count);
+    ASSERT_EQ(1, LN_DUMMY::reply_num);
+    ASSERT_EQ(UINT32_MAX - 5, LN_DUMMY::replies[0].first_blocknum);
+    ASSERT_EQ(5, LN_DUMMY::replies[0].number_of_blocks);
+    ASSERT_EQ(1, LN_DUMMY::replies[0].len);
+
+    //24bitをまたぐ範囲は、24bit内だけ検索して範囲全体を返す
+    LN_DUMMY::reply_num = 0;
+    qcr.first_blocknum = 0xfffff0;
+    qcr.number_of_blocks = 0x20;
+    ASSERT_TRUE(ln_reply_channel_range_send(&channel, &qcr));
+    ASSERT_EQ(1, ln_db_cnlanno_cur_seek_fake.call_count);
+    ASSERT_EQ(M_SCID_FROM_BLOCK(0xfffff0), ln_db_cnlanno_cur_seek_fake.arg5_val);
+    ASSERT_EQ(1, LN_DUMMY::reply_num);
+    ASSERT_EQ(0xfffff0, LN_DUMMY::replies[0].first_blocknum);
+    ASSERT_EQ(0x20, LN_DUMMY::replies[0].number_of_blocks);
+    ASSERT_EQ(1 + 8, LN_DUMMY::replies[0].len);
+}
+
+TEST_F(ln, reply_channel_range_send_chunks)
+{
+    //1メッセージに入らない数
+    const size_t NUM = M_REPLY_RANGE_IDS_MAX * 2 + 10;
+    LN_DUMMY::cnlanno_t *p_db = (LN_DUMMY::cnlanno_t *)malloc(sizeof(LN_DUMMY::cnlanno_t) * NUM);
+    for (size_t lp = 0; lp < NUM; lp++) {
+        //1blockに10channel
+        p_db[lp].short_channel_id = M_SCID_FROM_BLOCK(500000 + lp / 10) | (lp % 10);
+        p_db[lp].type = LN_DB_CNLANNO_ANNO;
+    }
+    SetupReplyRange(p_db, NUM);
+    LN_DUMMY::zlib_smaller_num = M_REPLY_RANGE_IDS_MAX / 2;
+
+    ln_channel_t channel;
+    InitChannel(&channel);
+    uint8_t chain_hash[BTC_SZ_HASH256] = {0};
+    ln_msg_query_channel_range_t qcr;
+    qcr.p_chain_hash = chain_hash;
+    qcr.first_blocknum = 0;
+    qcr.number_of_blocks = UINT32_MAX;
+
+    ASSERT_TRUE(ln_reply_channel_range_send(&channel, &qcr));
+    ASSERT_EQ(3, LN_DUMMY::reply_num);
+    ASSERT_EQ(3, LN_DUMMY::send_num);
+
+    //範囲は隙間なく連続し、要求範囲全体になる
+    uint32_t block = 0;
+    size_t ids = 0;
+    for (int lp = 0; lp < LN_DUMMY::reply_num; lp++) {
+        ASSERT_EQ(block, LN_DUMMY::replies[lp].first_blocknum);
+        block += LN_DUMMY::replies[lp].number_of_blocks;
+        ASSERT_TRUE(LN_DUMMY::replies[lp].len <= 1 + 8 * M_REPLY_RANGE_IDS_MAX);
+        if (LN_DUMMY::replies[lp].encode == LN_GOSSIPQUERY_ENCODE_ZLIB) {
+            ids += (LN_DUMMY::replies[lp].len - 1) * 2 / 8;
+        } else {
+            ids += (LN_DUMMY::replies[lp].len - 1) / 8;
+        }
+    }
+    ASSERT_EQ(UINT32_MAX, block);
+    ASSERT_EQ(NUM, ids);
+    //2つ目はblockの途中で区切らない
+    ASSERT_EQ(500000 + M_REPLY_RANGE_IDS_MAX / 10, LN_DUMMY::replies[1].first_blocknum);
+    //小さい方のencodeを使う
+    ASSERT_EQ(LN_GOSSIPQUERY_ENCODE_ZLIB, LN_DUMMY::replies[0].encode);
+    ASSERT_EQ(LN_GOSSIPQUERY_ENCODE_NONE, LN_DUMMY::replies[2].encode);
+
+    free(p_db);
+}
@@ -0,0 +1,334 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include <vector>
+#include <unistd.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+
+#undef LOG_TAG
+#include "ln_anno_ingest.c"
+}
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+//  検証threadから並列に呼ばれるため、fffは使わない
+//  メッセージ: [0]0xff:署名NG, [1..8]short_channel_id, [9..12]timestamp(channel_update)
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+    std::vector<uint64_t>   saved_cnlanno;
+    std::vector<uint64_t>   saved_cnlupd;
+    std::vector<uint32_t>   saved_cnlupd_ts;
+    int                     batch_num;
+    int                     saved_nodeanno;
+    int                     notified;
+    volatile bool           block_verify;       //true:検証threadを止める
+
+    uint64_t get_scid(const uint8_t *pData) {
+        return utl_int_pack_u64be(pData + 1);
+    }
+}
+
+extern "C" {
+bool ln_msg_channel_announcement_read(ln_msg_channel_announcement_t *pMsg, const uint8_t *pData, uint16_t Len) {
+    (void)Len;
+    pMsg->short_channel_id = get_scid(pData);
+    return true;
+}
+bool ln_msg_channel_announcement_verify(const ln_msg_channel_announcement_t *pMsg, const uint8_t *pData, uint16_t Len) {
+    (void)pMsg; (void)Len;
+    while (block_verify) {
+        usleep(1000);
+    }
+    return pData[0] != 0xff;
+}
+bool ln_msg_node_announcement_read(ln_msg_node_announcement_t *pMsg, const uint8_t *pData, uint16_t Len) {
+    (void)pMsg; (void)pData; (void)Len;
+    return true;
+}
+bool ln_msg_node_announcement_verify(const ln_msg_node_announcement_t *pMsg, const uint8_t *pData, uint16_t Len) {
+    (void)pMsg; (void)Len;
+    return pData[0] != 0xff;
+}
+bool ln_msg_channel_update_read(ln_msg_channel_update_t *pMsg, const uint8_t *pData, uint16_t Len) {
+    pMsg->short_channel_id = get_scid(pData);
+    pMsg->timestamp = (Len > 9) ? utl_int_pack_u32be(pData + 9) : 0;
+    return true;
+}
+bool ln_msg_channel_update_verify(const uint8_t *pNodePubKey, const uint8_t *pData, uint16_t Len) {
+    (void)Len;
+    return (pData[0] != 0xff) && (pNodePubKey[0] == 0x02);
+}
+bool ln_db_cnlanno_save(const utl_buf_t *pCnlAnno, uint64_t ShortChannelId, const uint8_t *pSendId, const uint8_t *pNodeId1, const uint8_t *pNodeId2) {
+    (void)pCnlAnno; (void)pSendId; (void)pNodeId1; (void)pNodeId2;
+    saved_cnlanno.push_back(ShortChannelId);
+    return true;
+}
+bool ln_db_cnlanno_load(utl_buf_t *pBuf, uint64_t ShortChannelId) {
+    (void)pBuf;
+    for (size_t lp = 0; lp < saved_cnlanno.size(); lp++) {
+        if (saved_cnlanno[lp] == ShortChannelId) return true;
+    }
+    return false;
+}
+bool ln_db_nodeanno_save(const utl_buf_t *pNodeAnno, const ln_msg_node_announcement_t *pAnno, const uint8_t *pSendId) {
+    (void)pNodeAnno; (void)pAnno; (void)pSendId;
+    saved_nodeanno++;
+    return true;
+}
+bool ln_db_cnlupd_save(const utl_buf_t *pCnlUpd, const ln_msg_channel_update_t *pUpd, const uint8_t *pSendId) {
+    (void)pCnlUpd; (void)pSendId;
+    saved_cnlupd.push_back(pUpd->short_channel_id);
+    saved_cnlupd_ts.push_back(pUpd->timestamp);
+    return true;
+}
+bool ln_db_anno_batch_begin(void) {
+    batch_num++;
+    return true;
+}
+bool ln_db_anno_batch_end(bool bCommit) {
+    (void)bCommit;
+    return true;
+}
+}
+
+class ln_anno_ingest: public testing::Test {
+protected:
+    virtual void SetUp() {
+        utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+        saved_cnlanno.clear();
+        saved_cnlupd.clear();
+        saved_cnlupd_ts.clear();
+        batch_num = 0;
+        saved_nodeanno = 0;
+        notified = 0;
+        block_verify = false;
+        memset(&mStat, 0, sizeof(mStat));
+    }
+
+    virtual void TearDown() {
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    static void Notify(const uint8_t *pRemoteNodeId, ln_cb_anno_type_t Type) {
+        (void)pRemoteNodeId; (void)Type;
+        notified++;     //保存threadからのみ呼ばれる
+    }
+
+    static bool Push(ln_cb_anno_type_t Type, uint64_t ShortChannelId, bool bValid, bool *pQueued) {
+        ln_anno_ingest_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.type = Type;
+        param.short_channel_id = ShortChannelId;
+        param.node_id[0][0] = 0x02;
+        param.node_id[1][0] = 0x03;
+        uint8_t data[1 + sizeof(uint64_t)];
+        data[0] = bValid ? 0x00 : 0xff;
+        utl_int_unpack_u64be(data + 1, ShortChannelId);
+        return ln_anno_ingest_push(&param, data, sizeof(data), pQueued);
+    }
+
+    static bool PushUpd(uint64_t ShortChannelId, bool bValid, bool *pQueued, uint32_t TimeStamp = 0, uint8_t Dir = 0) {
+        ln_anno_ingest_param_t param;
+        memset(&param, 0, sizeof(param));
+        param.type = LN_CB_ANNO_TYPE_CNL_UPD;
+        param.short_channel_id = ShortChannelId;
+        param.dir = Dir;
+        param.timestamp = TimeStamp;
+        param.anno_queued = ln_anno_ingest_search_cnlanno(param.node_id[0], ShortChannelId, 0);
+        if (!param.anno_queued && !ln_db_cnlanno_load(NULL, ShortChannelId)) {
+            return false;
+        }
+        if (!param.anno_queued) {
+            param.node_id[0][0] = 0x02;
+        }
+        uint8_t data[1 + sizeof(uint64_t) + sizeof(uint32_t)];
+        data[0] = bValid ? 0x00 : 0xff;
+        utl_int_unpack_u64be(data + 1, ShortChannelId);
+        utl_int_unpack_u32be(data + 9, TimeStamp);
+        return ln_anno_ingest_push(&param, data, sizeof(data), pQueued);
+    }
+
+    //queueが一杯の場合は破棄されるため、空くまで待つ
+    static void WaitSpace() {
+        ln_anno_ingest_stat_t stat;
+        for (;;) {
+            ln_anno_ingest_get_stat(&stat);
+            if (stat.queue_depth + 1 < M_QUEUE_MAX) break;
+            usleep(1000);
+        }
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(ln_anno_ingest, inline)
+{
+    bool queued;
+
+    //threadを開始していない場合はその場で検証・保存する
+    ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_CNL_ANNO, 1, true, &queued));
+    ASSERT_FALSE(queued);
+    ASSERT_EQ(1, saved_cnlanno.size());
+    ASSERT_FALSE(Push(LN_CB_ANNO_TYPE_CNL_ANNO, 2, false, &queued));
+    ASSERT_FALSE(queued);
+    ASSERT_EQ(1, saved_cnlanno.size());
+
+    ASSERT_TRUE(PushUpd(1, true, &queued));
+    ASSERT_FALSE(queued);
+    ASSERT_FALSE(PushUpd(1, false, &queued));
+    ASSERT_FALSE(PushUpd(2, true, &queued));
+    ASSERT_EQ(1, saved_cnlupd.size());
+
+    ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_NODE_ANNO, 0, true, &queued));
+    ASSERT_FALSE(Push(LN_CB_ANNO_TYPE_NODE_ANNO, 0, false, &queued));
+    ASSERT_EQ(1, saved_nodeanno);
+    ASSERT_EQ(0, notified);
+}
+
+
+TEST_F(ln_anno_ingest, pool)
+{
+    const uint64_t NUM = 3000;
+    bool queued;
+
+    ASSERT_TRUE(ln_anno_ingest_start(4, Notify));
+
+    //channel_announcement --> channel_updateの順で受信
+    //  3の倍数は署名NG
+    for (uint64_t lp = 1; lp <= NUM; lp++) {
+        WaitSpace();
+        ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_CNL_ANNO, lp, (lp % 3) != 0, &queued));
+        ASSERT_TRUE(queued);
+        //channel_announcementが保存前でもqueueから検証用のnode_idが得られる
+        bool ret = PushUpd(lp, true, &queued);
+        if (ret) {
+            ASSERT_TRUE(queued);
+        }
+    }
+    ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_NODE_ANNO, 0, true, &queued));
+    ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_NODE_ANNO, 0, false, &queued));
+
+    ln_anno_ingest_stop();
+
+    //受信順に保存されている
+    ASSERT_EQ(NUM - NUM / 3, saved_cnlanno.size());
+    ASSERT_EQ(NUM - NUM / 3, saved_cnlupd.size());
+    uint64_t prev = 0;
+    for (size_t lp = 0; lp < saved_cnlanno.size(); lp++) {
+        ASSERT_NE(0, saved_cnlanno[lp] % 3);
+        ASSERT_LT(prev, saved_cnlanno[lp]);
+        ASSERT_EQ(saved_cnlanno[lp], saved_cnlupd[lp]);
+        prev = saved_cnlanno[lp];
+    }
+    ASSERT_EQ(1, saved_nodeanno);
+    ASSERT_EQ((int)(saved_cnlanno.size() + saved_cnlupd.size() + 1), notified);
+
+    ln_anno_ingest_stat_t stat;
+    ln_anno_ingest_get_stat(&stat);
+    ASSERT_EQ(0, stat.queue_depth);
+    ASSERT_EQ(stat.queued, stat.saved + stat.rejected + stat.coalesced);
+    ASSERT_EQ(0, stat.coalesced);
+    ASSERT_EQ(stat.commit_num, batch_num);
+    ASSERT_GT(stat.queued / 2, stat.commit_num);
+    ASSERT_EQ(saved_cnlanno.size() + saved_cnlupd.size() + 1, stat.saved);
+    //channel_announcementがNGのchannel_updateは、queueに残っていた場合だけ保存時に破棄される
+    ASSERT_LE(NUM / 3 + 1, stat.rejected);
+
+    //停止後はその場で保存する
+    ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_CNL_ANNO, NUM + 1, true, &queued));
+    ASSERT_FALSE(queued);
+}
+
+
+TEST_F(ln_anno_ingest, coalesce)
+{
+    bool queued;
+
+    ASSERT_TRUE(ln_anno_ingest_start(2, Notify));
+
+    ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_CNL_ANNO, 1, true, &queued));
+    ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_CNL_ANNO, 2, true, &queued));
+    //dir0: 200が最新、同じtimestampは先に受信した方、署名NGは対象外
+    ASSERT_TRUE(PushUpd(1, true, &queued, 100, 0));
+    ASSERT_TRUE(PushUpd(1, true, &queued, 200, 0));
+    ASSERT_TRUE(PushUpd(1, true, &queued, 150, 0));
+    ASSERT_TRUE(PushUpd(1, false, &queued, 300, 0));
+    ASSERT_TRUE(PushUpd(1, true, &queued, 200, 0));
+    //dir1, 別channelはまとめない
+    ASSERT_TRUE(PushUpd(1, true, &queued, 50, 1));
+    ASSERT_TRUE(PushUpd(2, true, &queued, 10, 0));
+
+    //LN_ANNO_INGEST_COMMIT_MSEC経過で保存される
+    ln_anno_ingest_stat_t stat;
+    for (int lp = 0; lp < 100; lp++) {
+        ln_anno_ingest_get_stat(&stat);
+        if (stat.queue_depth == 0) break;
+        usleep(LN_ANNO_INGEST_COMMIT_MSEC * 1000 / 10);
+    }
+    ASSERT_EQ(0, stat.queue_depth);
+    ln_anno_ingest_stop();
+
+    //LN_ANNO_INGEST_COMMIT_MSEC以内に受信したので1 transaction
+    ASSERT_EQ(1, batch_num);
+    ASSERT_EQ(3, saved_cnlupd.size());
+    ASSERT_EQ(1, saved_cnlupd[0]);
+    ASSERT_EQ(200, saved_cnlupd_ts[0]);
+    ASSERT_EQ(1, saved_cnlupd[1]);
+    ASSERT_EQ(50, saved_cnlupd_ts[1]);
+    ASSERT_EQ(2, saved_cnlupd[2]);
+
+    ln_anno_ingest_get_stat(&stat);
+    ASSERT_EQ(9, stat.queued);
+    ASSERT_EQ(5, stat.saved);
+    ASSERT_EQ(1, stat.rejected);
+    ASSERT_EQ(3, stat.coalesced);
+    ASSERT_EQ(1, stat.commit_num);
+}
+
+
+TEST_F(ln_anno_ingest, queue_full)
+{
+    bool queued;
+
+    block_verify = true;
+    ASSERT_TRUE(ln_anno_ingest_start(2, Notify));
+
+    //検証が止まっている間にqueueを一杯にする
+    for (uint64_t lp = 1; lp <= M_QUEUE_MAX; lp++) {
+        ASSERT_TRUE(Push(LN_CB_ANNO_TYPE_CNL_ANNO, lp, true, &queued));
+        ASSERT_TRUE(queued);
+    }
+
+    //空きを待たずに破棄する
+    ASSERT_FALSE(Push(LN_CB_ANNO_TYPE_CNL_ANNO, M_QUEUE_MAX + 1, true, &queued));
+    ASSERT_FALSE(queued);
+    ln_anno_ingest_stat_t stat;
+    ln_anno_ingest_get_stat(&stat);
+    ASSERT_EQ(M_QUEUE_MAX, stat.queue_depth);
+    ASSERT_EQ(M_QUEUE_MAX, stat.queued);
+    ASSERT_EQ(1, stat.dropped);
+
+    block_verify = false;
+    ln_anno_ingest_stop();
+
+    //破棄した分は保存されない
+    ASSERT_EQ(M_QUEUE_MAX, saved_cnlanno.size());
+    ASSERT_EQ(M_QUEUE_MAX, saved_cnlanno.back());
+    ln_anno_ingest_get_stat(&stat);
+    ASSERT_EQ(0, stat.queue_depth);
+    ASSERT_EQ(M_QUEUE_MAX, stat.saved);
+    ASSERT_EQ(1, stat.dropped);
+}
@@ -50,6 +50,8 @@ extern "C" {
 #include "ln_noise.c"
 #include "ln_signer.c"
 #include "ln_invoice.c"
+#undef LOG_TAG
+#include "ln_crypto_pool.c"
 }
 
 ////////////////////////////////////////////////////////////////////////
@@ -0,0 +1,361 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include <inttypes.h>
+#include <time.h>
+#include <pthread.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+//評価対象本体
+#undef LOG_TAG
+#include "../../utl/utl_thread.c"
+#undef LOG_TAG
+#include "../../utl/utl_log.c"
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_push.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_mem.c"
+#include "../../utl/utl_str.c"
+#undef LOG_TAG
+#include "../../btc/btc.c"
+#include "../../btc/btc_block.c"
+#include "../../btc/btc_buf.c"
+#include "../../btc/btc_extkey.c"
+#include "../../btc/btc_keys.c"
+#include "../../btc/btc_sw.c"
+#include "../../btc/btc_sig.c"
+#include "../../btc/btc_script.c"
+#include "../../btc/btc_tx.c"
+#include "../../btc/btc_tx_buf.c"
+#include "../../btc/btc_crypto.c"
+#include "../../btc/segwit_addr.c"
+#include "../../btc/btc_segwit_addr.c"
+#include "../../btc/btc_test_util.c"
+#undef LOG_TAG
+#include "ln.c"
+#include "ln_derkey.c"
+#include "ln_derkey_ex.c"
+#include "ln_msg_anno.c"
+#include "ln_msg_close.c"
+#include "ln_msg_establish.c"
+#include "ln_msg_normalope.c"
+#include "ln_msg_setupctl.c"
+#include "ln_node.c"
+#include "ln_onion.c"
+#include "ln_script.c"
+#include "ln_commit_tx.c"
+#include "ln_commit_tx_util.c"
+#include "ln_htlc_tx.c"
+#include "ln_noise.c"
+#include "ln_signer.c"
+#include "ln_invoice.c"
+#undef LOG_TAG
+#include "ln_crypto_pool.c"
+}
+
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+    //job: pArg[Idx] = Idx * 2 + 1、Idx == fail_idxなら失敗
+    struct job_t {
+        uint32_t    *p_out;
+        uint32_t    fail_idx;
+        pthread_t   *p_th;
+    };
+
+    bool job_func(void *pArg, uint32_t Idx) {
+        job_t *p = (job_t *)pArg;
+        p->p_out[Idx] = Idx * 2 + 1;
+        if (p->p_th) {
+            p->p_th[Idx] = pthread_self();
+        }
+        return Idx != p->fail_idx;
+    }
+
+    //複数threadから同時にln_crypto_pool_run()する
+    struct caller_t {
+        uint32_t    out[200];
+        bool        ret;
+    };
+
+    void *thread_caller(void *pArg) {
+        caller_t *p = (caller_t *)pArg;
+        job_t job = { p->out, UINT32_MAX, NULL };
+        p->ret = ln_crypto_pool_run(job_func, &job, ARRAY_SIZE(p->out));
+        return NULL;
+    }
+
+    uint64_t now_usec(void) {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+    }
+}
+
+
+class ln_crypto_pool: public testing::Test {
+protected:
+    virtual void SetUp() {
+        //utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+        btc_init(BTC_BLOCK_CHAIN_BTCTEST, true);
+    }
+
+    virtual void TearDown() {
+        ln_crypto_pool_stop();
+        btc_term();
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    static const uint32_t HTLC_NUM = 483;       //BOLT#2 max_accepted_htlcs上限
+
+    //HTLC_NUM個のHTLC outputを持つcommit_tx
+    struct commit_t {
+        ln_commit_info_t            commit_info;
+        ln_commit_tx_info_t         commit_tx_info;
+        ln_commit_tx_htlc_info_t    htlc_info[HTLC_NUM];
+        ln_commit_tx_htlc_info_t    *p_htlc_info[HTLC_NUM];
+        btc_tx_t                    tx;
+        ln_derkey_local_keys_t      keys_local;
+        ln_derkey_remote_keys_t     keys_remote;
+    };
+
+    static void CommitInit(commit_t *pCommit) {
+        memset(pCommit, 0, sizeof(commit_t));
+
+        //HTLC basepoint secret / remote per_commitment_point
+        memset(pCommit->keys_local.secrets[LN_BASEPOINT_IDX_HTLC], 0x11, BTC_SZ_PRIVKEY);
+        ASSERT_TRUE(btc_keys_priv2pub(
+            pCommit->keys_local.basepoints[LN_BASEPOINT_IDX_HTLC], pCommit->keys_local.secrets[LN_BASEPOINT_IDX_HTLC]));
+        uint8_t priv[BTC_SZ_PRIVKEY];
+        memset(priv, 0x22, sizeof(priv));
+        ASSERT_TRUE(btc_keys_priv2pub(pCommit->keys_remote.per_commitment_point, priv));
+
+        //受信したHTLC署名の検証に使う相手のHTLC key(ここでは自分の署名を検証する)
+        btc_keys_t htlckey;
+        ASSERT_TRUE(ln_signer_htlc_remotekey(&htlckey, &pCommit->keys_local, &pCommit->keys_remote));
+        memcpy(pCommit->keys_local.script_pubkeys[LN_SCRIPT_IDX_REMOTE_HTLCKEY], htlckey.pub, BTC_SZ_PUBKEY);
+
+        for (uint32_t lp = 0; lp < BTC_SZ_TXID; lp++) {
+            pCommit->commit_info.txid[lp] = (uint8_t)lp;
+        }
+
+        ln_commit_tx_info_t *p_info = &pCommit->commit_tx_info;
+        const uint8_t TO_LOCAL[] = { 0x63, 0x21 };
+        ASSERT_TRUE(utl_buf_alloccopy(&p_info->to_local.wit_script, TO_LOCAL, sizeof(TO_LOCAL)));
+        p_info->base_fee_info.dust_limit_satoshi = 546;
+        p_info->base_fee_info.htlc_timeout_fee = 663;
+        p_info->base_fee_info.htlc_success_fee = 703;
+        p_info->pp_htlc_info = pCommit->p_htlc_info;
+        p_info->num_htlc_infos = HTLC_NUM;
+        p_info->num_htlc_outputs = HTLC_NUM;
+
+        //to_local, to_remote, HTLC x HTLC_NUM
+        btc_tx_init(&pCommit->tx);
+        btc_vout_t *p_vout = btc_tx_add_vout(&pCommit->tx, 100000);
+        p_vout->opt = LN_COMMIT_TX_OUTPUT_TYPE_TO_LOCAL;
+        p_vout = btc_tx_add_vout(&pCommit->tx, 100000);
+        p_vout->opt = LN_COMMIT_TX_OUTPUT_TYPE_TO_REMOTE;
+        for (uint32_t lp = 0; lp < HTLC_NUM; lp++) {
+            ln_commit_tx_htlc_info_t *p_htlc = &pCommit->htlc_info[lp];
+            p_htlc->type = (lp & 1) ? LN_COMMIT_TX_OUTPUT_TYPE_RECEIVED : LN_COMMIT_TX_OUTPUT_TYPE_OFFERED;
+            p_htlc->htlc_idx = (uint16_t)(lp % LN_HTLC_MAX);    //update_info.htlcs[]を超えないように
+            p_htlc->cltv_expiry = 500000 + lp;
+            p_htlc->amount_msat = (uint64_t)(10000 + lp) * 1000;
+            const uint8_t script[] = { 0x76, 0xa9, (uint8_t)lp, (uint8_t)(lp >> 8) };
+            ASSERT_TRUE(utl_buf_alloccopy(&p_htlc->wit_script, script, sizeof(script)));
+            pCommit->p_htlc_info[lp] = p_htlc;
+
+            p_vout = btc_tx_add_vout(&pCommit->tx, 10000 + lp);
+            p_vout->opt = (uint16_t)lp;
+        }
+    }
+
+    static void CommitFree(commit_t *pCommit) {
+        for (uint32_t lp = 0; lp < HTLC_NUM; lp++) {
+            utl_buf_free(&pCommit->htlc_info[lp].wit_script);
+        }
+        utl_buf_free(&pCommit->commit_tx_info.to_local.wit_script);
+        btc_tx_free(&pCommit->tx);
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(ln_crypto_pool, start_stop)
+{
+    ASSERT_TRUE(ln_crypto_pool_start(2));
+    ASSERT_EQ(2, mThreadNum);
+    ASSERT_FALSE(ln_crypto_pool_start(2));      //開始済み
+    ln_crypto_pool_stop();
+    ln_crypto_pool_stop();                      //停止済みでもよい
+
+    ASSERT_TRUE(ln_crypto_pool_start(0));
+    ASSERT_EQ(1, mThreadNum);
+    ln_crypto_pool_stop();
+
+    ASSERT_TRUE(ln_crypto_pool_start(LN_CRYPTO_POOL_THREAD_MAX + 1));
+    ASSERT_EQ(LN_CRYPTO_POOL_THREAD_MAX, mThreadNum);
+    ln_crypto_pool_stop();
+}
+
+
+TEST_F(ln_crypto_pool, run_not_started)
+{
+    uint32_t out[10];
+    pthread_t th[10];
+    job_t job = { out, UINT32_MAX, th };
+
+    //呼び出し元threadで順に実行する
+    memset(out, 0, sizeof(out));
+    ASSERT_TRUE(ln_crypto_pool_run(job_func, &job, ARRAY_SIZE(out)));
+    for (uint32_t lp = 0; lp < ARRAY_SIZE(out); lp++) {
+        ASSERT_EQ(lp * 2 + 1, out[lp]);
+        ASSERT_TRUE(pthread_equal(pthread_self(), th[lp]));
+    }
+
+    //失敗したjobで止まる
+    memset(out, 0, sizeof(out));
+    job.fail_idx = 3;
+    ASSERT_FALSE(ln_crypto_pool_run(job_func, &job, ARRAY_SIZE(out)));
+    ASSERT_EQ(7, out[3]);
+    ASSERT_EQ(0, out[4]);
+
+    ASSERT_TRUE(ln_crypto_pool_run(job_func, &job, 0));
+}
+
+
+TEST_F(ln_crypto_pool, run)
+{
+    ASSERT_TRUE(ln_crypto_pool_start(4));
+
+    uint32_t out[1000];
+    job_t job = { out, UINT32_MAX, NULL };
+
+    //結果はindexの位置に書かれる
+    memset(out, 0, sizeof(out));
+    ASSERT_TRUE(ln_crypto_pool_run(job_func, &job, ARRAY_SIZE(out)));
+    for (uint32_t lp = 0; lp < ARRAY_SIZE(out); lp++) {
+        ASSERT_EQ(lp * 2 + 1, out[lp]);
+    }
+
+    //失敗したjobがあっても全jobを実行する
+    memset(out, 0, sizeof(out));
+    job.fail_idx = 10;
+    ASSERT_FALSE(ln_crypto_pool_run(job_func, &job, ARRAY_SIZE(out)));
+    for (uint32_t lp = 0; lp < ARRAY_SIZE(out); lp++) {
+        ASSERT_EQ(lp * 2 + 1, out[lp]);
+    }
+}
+
+
+TEST_F(ln_crypto_pool, run_multi_caller)
+{
+    ASSERT_TRUE(ln_crypto_pool_start(3));
+
+    caller_t callers[5];
+    pthread_t th[ARRAY_SIZE(callers)];
+    memset(callers, 0, sizeof(callers));
+    for (uint32_t lp = 0; lp < ARRAY_SIZE(callers); lp++) {
+        pthread_create(&th[lp], NULL, thread_caller, &callers[lp]);
+    }
+    for (uint32_t lp = 0; lp < ARRAY_SIZE(callers); lp++) {
+        pthread_join(th[lp], NULL);
+        ASSERT_TRUE(callers[lp].ret);
+        for (uint32_t lp2 = 0; lp2 < ARRAY_SIZE(callers[lp].out); lp2++) {
+            ASSERT_EQ(lp2 * 2 + 1, callers[lp].out[lp2]);
+        }
+    }
+}
+
+
+TEST_F(ln_crypto_pool, commit_tx_htlcs)
+{
+    commit_t *p_commit = new commit_t;
+    CommitInit(p_commit);
+
+    uint8_t (*p_sigs_serial)[LN_SZ_SIGNATURE] = new uint8_t[HTLC_NUM][LN_SZ_SIGNATURE];
+    uint8_t (*p_sigs_pool)[LN_SZ_SIGNATURE] = new uint8_t[HTLC_NUM][LN_SZ_SIGNATURE];
+    memset(p_sigs_serial, 0, HTLC_NUM * LN_SZ_SIGNATURE);
+    memset(p_sigs_pool, 0, HTLC_NUM * LN_SZ_SIGNATURE);
+
+    //sign: 直列と並列で同じ署名がvout順に並ぶ
+    ASSERT_TRUE(create_remote_sign_htlcs(
+        &p_commit->commit_info, p_sigs_serial, &p_commit->tx, &p_commit->commit_tx_info,
+        &p_commit->keys_local, &p_commit->keys_remote));
+    ASSERT_TRUE(ln_crypto_pool_start(4));
+    ASSERT_TRUE(create_remote_sign_htlcs(
+        &p_commit->commit_info, p_sigs_pool, &p_commit->tx, &p_commit->commit_tx_info,
+        &p_commit->keys_local, &p_commit->keys_remote));
+    ASSERT_EQ(0, memcmp(p_sigs_serial, p_sigs_pool, HTLC_NUM * LN_SZ_SIGNATURE));
+
+    //verify: OKなら各HTLCのremote_sigに保持する
+    ln_update_info_t *p_update_info = new ln_update_info_t;
+    memset(p_update_info, 0, sizeof(ln_update_info_t));
+    ASSERT_TRUE(create_local_verify_htlcs(
+        &p_commit->commit_info, p_update_info, p_sigs_pool, &p_commit->tx, &p_commit->commit_tx_info,
+        &p_commit->keys_local));
+    for (uint32_t lp = HTLC_NUM - LN_HTLC_MAX; lp < HTLC_NUM; lp++) {
+        ASSERT_EQ(0, memcmp(p_sigs_pool[lp], p_update_info->htlcs[lp % LN_HTLC_MAX].remote_sig, LN_SZ_SIGNATURE));
+    }
+
+    //verify: 1つでもNGなら失敗し、remote_sigは更新しない
+    memset(p_update_info, 0, sizeof(ln_update_info_t));
+    p_sigs_pool[HTLC_NUM / 2][10] ^= 0x01;
+    ASSERT_FALSE(create_local_verify_htlcs(
+        &p_commit->commit_info, p_update_info, p_sigs_pool, &p_commit->tx, &p_commit->commit_tx_info,
+        &p_commit->keys_local));
+    for (uint32_t lp = 0; lp < LN_HTLC_MAX; lp++) {
+        ASSERT_TRUE(utl_mem_is_all_zero(p_update_info->htlcs[lp].remote_sig, LN_SZ_SIGNATURE));
+    }
+
+    delete p_update_info;
+    delete[] p_sigs_pool;
+    delete[] p_sigs_serial;
+    CommitFree(p_commit);
+    delete p_commit;
+}
+
+
+TEST_F(ln_crypto_pool, DISABLED_commit_tx_htlcs_bench)
+{
+    commit_t *p_commit = new commit_t;
+    CommitInit(p_commit);
+
+    uint8_t (*p_sigs)[LN_SZ_SIGNATURE] = new uint8_t[HTLC_NUM][LN_SZ_SIGNATURE];
+    ln_update_info_t *p_update_info = new ln_update_info_t;
+    memset(p_update_info, 0, sizeof(ln_update_info_t));
+
+    uint64_t usec[2][2];
+    for (int pool = 0; pool < 2; pool++) {
+        if (pool) {
+            ASSERT_TRUE(ln_crypto_pool_start(4));
+        }
+        uint64_t start = now_usec();
+        ASSERT_TRUE(create_remote_sign_htlcs(
+            &p_commit->commit_info, p_sigs, &p_commit->tx, &p_commit->commit_tx_info,
+            &p_commit->keys_local, &p_commit->keys_remote));
+        uint64_t mid = now_usec();
+        ASSERT_TRUE(create_local_verify_htlcs(
+            &p_commit->commit_info, p_update_info, p_sigs, &p_commit->tx, &p_commit->commit_tx_info,
+            &p_commit->keys_local));
+        uint64_t end = now_usec();
+        usec[pool][0] = mid - start;
+        usec[pool][1] = end - mid;
+    }
+    printf("[bench] %" PRIu32 " HTLCs sign:   serial=%" PRIu64 " us, pool(4)=%" PRIu64 " us\n",
+        HTLC_NUM, usec[0][0], usec[1][0]);
+    printf("[bench] %" PRIu32 " HTLCs verify: serial=%" PRIu64 " us, pool(4)=%" PRIu64 " us\n",
+        HTLC_NUM, usec[0][1], usec[1][1]);
+
+    delete p_update_info;
+    delete[] p_sigs;
+    CommitFree(p_commit);
+    delete p_commit;
+}
@@ -0,0 +1,419 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_push.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+#include "../../utl/utl_mem.c"
+
+#undef LOG_TAG
+#include "../../btc/btc.c"
+#include "../../btc/btc_buf.c"
+#include "../../btc/btc_crypto.c"
+
+#undef LOG_TAG
+#include "ln_db_lmdb.c"
+}
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+extern "C" {
+void ln_payment_hash_calc(uint8_t *pHash, const uint8_t *pPreimage)
+{
+    btc_md_sha256(pHash, pPreimage, LN_SZ_PREIMAGE);
+}
+}
+
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+    char    db_dir[] = "/tmp/test_ln_db_lmdb_XXXXXX";
+
+    int rm_entry(const char *pPath, const struct stat *pStat, int Flag, struct FTW *pFtw)
+    {
+        (void)pStat; (void)Flag; (void)pFtw;
+        return remove(pPath);
+    }
+
+    uint64_t elapsed_ns(const struct timespec *pStart, const struct timespec *pEnd)
+    {
+        return (uint64_t)(pEnd->tv_sec - pStart->tv_sec) * 1000000000ULL + (pEnd->tv_nsec - pStart->tv_nsec);
+    }
+}
+
+class ln_db_lmdb: public testing::Test {
+protected:
+    virtual void SetUp() {
+        utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+
+        //node DBだけを一時directoryに作る
+        strcpy(db_dir, "/tmp/test_ln_db_lmdb_XXXXXX");
+        ASSERT_TRUE(mkdtemp(db_dir) != NULL);
+        ASSERT_EQ(0, mdb_env_create(&mpEnvNode));
+        ASSERT_EQ(0, mdb_env_set_maxdbs(mpEnvNode, 10));
+        ASSERT_EQ(0, mdb_env_set_mapsize(mpEnvNode, (size_t)1024 * 1024 * 1024));
+        ASSERT_EQ(0, mdb_env_open(mpEnvNode, db_dir, MDB_NOSYNC, 0664));
+    }
+
+    virtual void TearDown() {
+        if (mpEnvAnno) {
+            mdb_env_close(mpEnvAnno);
+            mpEnvAnno = NULL;
+        }
+        mdb_env_close(mpEnvNode);
+        mpEnvNode = NULL;
+        nftw(db_dir, rm_entry, 8, FTW_DEPTH | FTW_PHYS);
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    //変更前の#ln_db_payment_hash_search(): cursorで全件を比較する
+    static bool payment_hash_search_scan(
+        uint8_t *pPaymentHash, ln_commit_tx_output_type_t *pType, uint32_t *pExpiry, const uint8_t *pVout)
+    {
+        MDB_txn     *p_txn;
+        MDB_dbi     dbi;
+        MDB_cursor  *p_cursor;
+        MDB_val     key, data;
+        bool        found = false;
+
+        if (mdb_txn_begin(mpEnvNode, NULL, MDB_RDONLY, &p_txn) != 0) return false;
+        if (mdb_dbi_open(p_txn, M_DBI_PAYMENT_HASH, 0, &dbi) != 0) {
+            mdb_txn_abort(p_txn);
+            return false;
+        }
+        if (mdb_cursor_open(p_txn, dbi, &p_cursor) != 0) {
+            mdb_txn_abort(p_txn);
+            return false;
+        }
+        while (mdb_cursor_get(p_cursor, &key, &data, MDB_NEXT) == 0) {
+            if (key.mv_size != BTC_SZ_WITPROG_P2WSH) continue;
+            if (memcmp(key.mv_data, pVout, BTC_SZ_WITPROG_P2WSH)) continue;
+
+            uint8_t *p = (uint8_t *)data.mv_data;
+            *pType = (ln_commit_tx_output_type_t)*p;
+            memcpy(pExpiry, p + 1, sizeof(uint32_t));
+            memcpy(pPaymentHash, p + 1 + sizeof(uint32_t), BTC_SZ_HASH256);
+            found = true;
+            break;
+        }
+        mdb_cursor_close(p_cursor);
+        mdb_txn_abort(p_txn);
+        return found;
+    }
+
+    //変更前のupdate_add_htlc受信時の検索: 全preimageのhashを計算して比較する
+    static bool preimage_search_scan(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash)
+    {
+        void *p_cur;
+        bool detect = false;
+        uint8_t hash[BTC_SZ_HASH256];
+
+        if (!ln_db_preimage_cur_open(&p_cur)) return false;
+        for (;;) {
+            detect = false;
+            if (!ln_db_preimage_cur_get(p_cur, &detect, pPreimage, NULL)) break;
+            if (!detect) continue;
+            ln_payment_hash_calc(hash, pPreimage->preimage);
+            if (memcmp(hash, pPaymentHash, BTC_SZ_HASH256)) continue;
+            break;
+        }
+        ln_db_preimage_cur_close(p_cur, false);
+        return detect;
+    }
+
+    static void make_preimage(ln_db_preimage_t *pPreimage, uint32_t Index)
+    {
+        uint8_t data[sizeof(uint32_t)];
+        utl_int_unpack_u32be(data, Index);
+        btc_md_sha256(pPreimage->preimage, data, sizeof(data));
+        pPreimage->amount_msat = 1000 + Index;
+        pPreimage->creation_time = 1500000000 + Index;
+        pPreimage->expiry = 3600;
+        pPreimage->state = LN_DB_PREIMAGE_STATE_UNUSED;
+    }
+
+    static void make_vout(uint8_t *pVout, uint32_t Index)
+    {
+        //P2WSH witness program: 0x00 0x20 [32]
+        memset(pVout, 0, BTC_SZ_WITPROG_P2WSH);
+        pVout[1] = BTC_SZ_HASH256;
+        utl_int_unpack_u32be(pVout + 2, Index);
+        pVout[BTC_SZ_WITPROG_P2WSH - 1] = (uint8_t)(0xa5 ^ Index);
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(ln_db_lmdb, payment_hash_search)
+{
+    const uint32_t NUM = 16;
+    uint8_t vout[BTC_SZ_WITPROG_P2WSH];
+    uint8_t hash[BTC_SZ_HASH256];
+
+    //DBがまだ無い
+    make_vout(vout, 0);
+    ln_commit_tx_output_type_t type;
+    uint32_t expiry;
+    ASSERT_FALSE(ln_db_payment_hash_search(hash, &type, &expiry, vout, NULL));
+
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        make_vout(vout, lp);
+        memset(hash, (uint8_t)lp, sizeof(hash));
+        ln_commit_tx_output_type_t save_type = (lp & 1) ? LN_COMMIT_TX_OUTPUT_TYPE_RECEIVED : LN_COMMIT_TX_OUTPUT_TYPE_OFFERED;
+        ASSERT_TRUE(ln_db_payment_hash_save(hash, vout, save_type, 500000 + lp));
+    }
+    //同じvoutは上書き
+    make_vout(vout, 3);
+    memset(hash, 0x33, sizeof(hash));
+    ASSERT_TRUE(ln_db_payment_hash_save(hash, vout, LN_COMMIT_TX_OUTPUT_TYPE_OFFERED, 600003));
+
+    //lookupとscanの結果が一致する(最後はmiss)
+    for (uint32_t lp = 0; lp <= NUM; lp++) {
+        uint8_t hash_scan[BTC_SZ_HASH256];
+        uint8_t hash_get[BTC_SZ_HASH256];
+        ln_commit_tx_output_type_t type_scan = LN_COMMIT_TX_OUTPUT_TYPE_NONE;
+        ln_commit_tx_output_type_t type_get = LN_COMMIT_TX_OUTPUT_TYPE_NONE;
+        uint32_t expiry_scan = 0;
+        uint32_t expiry_get = 0;
+
+        make_vout(vout, lp);
+        bool ret_scan = payment_hash_search_scan(hash_scan, &type_scan, &expiry_scan, vout);
+        bool ret_get = ln_db_payment_hash_search(hash_get, &type_get, &expiry_get, vout, NULL);
+        ASSERT_EQ(ret_scan, ret_get);
+        ASSERT_EQ(lp < NUM, ret_get);
+        if (!ret_get) continue;
+        ASSERT_EQ(type_scan, type_get);
+        ASSERT_EQ(expiry_scan, expiry_get);
+        ASSERT_EQ(0, memcmp(hash_scan, hash_get, BTC_SZ_HASH256));
+    }
+    make_vout(vout, 3);
+    ASSERT_TRUE(ln_db_payment_hash_search(hash, &type, &expiry, vout, NULL));
+    ASSERT_EQ(LN_COMMIT_TX_OUTPUT_TYPE_OFFERED, type);
+    ASSERT_EQ(600003, expiry);
+    ASSERT_EQ(0x33, hash[0]);
+
+    //最後の1byteだけ異なるvoutはmiss
+    make_vout(vout, 5);
+    vout[BTC_SZ_WITPROG_P2WSH - 1] ^= 0xff;
+    ASSERT_FALSE(payment_hash_search_scan(hash, &type, &expiry, vout));
+    ASSERT_FALSE(ln_db_payment_hash_search(hash, &type, &expiry, vout, NULL));
+}
+
+
+TEST_F(ln_db_lmdb, preimage_search_hash)
+{
+    const uint32_t NUM = 16;
+    ln_db_preimage_t preimage;
+    ln_db_preimage_t preimage_scan;
+    ln_db_preimage_t preimage_get;
+    uint8_t hash[BTC_SZ_HASH256];
+
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        make_preimage(&preimage, lp);
+        ASSERT_TRUE(ln_db_preimage_save(&preimage, NULL, NULL));
+    }
+
+    //indexとscanの結果が一致する(最後はmiss)
+    for (uint32_t lp = 0; lp <= NUM; lp++) {
+        make_preimage(&preimage, lp);
+        ln_payment_hash_calc(hash, preimage.preimage);
+        bool ret_scan = preimage_search_scan(&preimage_scan, hash);
+        bool ret_get = ln_db_preimage_search_hash(&preimage_get, hash);
+        ASSERT_EQ(ret_scan, ret_get);
+        ASSERT_EQ(lp < NUM, ret_get);
+        if (!ret_get) continue;
+        ASSERT_EQ(0, memcmp(preimage.preimage, preimage_get.preimage, LN_SZ_PREIMAGE));
+        ASSERT_EQ(preimage_scan.amount_msat, preimage_get.amount_msat);
+        ASSERT_EQ(preimage_scan.creation_time, preimage_get.creation_time);
+        ASSERT_EQ(preimage_scan.expiry, preimage_get.expiry);
+        ASSERT_EQ(preimage_scan.state, preimage_get.state);
+    }
+
+    //長さが不正なindexは使わない
+    MDB_txn *p_txn;
+    MDB_dbi dbi;
+    MDB_val key, data;
+    uint8_t bad_data[LN_SZ_PREIMAGE / 2];
+    memset(bad_data, 0, sizeof(bad_data));
+    make_preimage(&preimage, 2);
+    ln_payment_hash_calc(hash, preimage.preimage);
+    ASSERT_EQ(0, mdb_txn_begin(mpEnvNode, NULL, 0, &p_txn));
+    ASSERT_EQ(0, mdb_dbi_open(p_txn, M_DBI_PREIMAGE_HASH, 0, &dbi));
+    key.mv_size = BTC_SZ_HASH256;
+    key.mv_data = hash;
+    data.mv_size = sizeof(bad_data);
+    data.mv_data = bad_data;
+    ASSERT_EQ(0, mdb_put(p_txn, dbi, &key, &data, 0));
+    ASSERT_EQ(0, mdb_txn_commit(p_txn));
+    ASSERT_FALSE(ln_db_preimage_search_hash(&preimage_get, hash));
+    ASSERT_FALSE(ln_db_preimage_del_hash(hash));
+
+    //削除
+    make_preimage(&preimage, 5);
+    ln_payment_hash_calc(hash, preimage.preimage);
+    ASSERT_TRUE(ln_db_preimage_del_hash(hash));
+    ASSERT_FALSE(ln_db_preimage_search_hash(&preimage_get, hash));
+    ASSERT_FALSE(preimage_search_scan(&preimage_scan, hash));
+    ASSERT_FALSE(ln_db_preimage_del_hash(hash));
+}
+
+
+TEST_F(ln_db_lmdb, preimage_del_expired)
+{
+    const uint32_t NUM = 16;
+    const uint32_t EXPIRED = 5;
+    ln_db_preimage_t preimage;
+    ln_db_preimage_t preimage_get;
+    uint8_t hash[BTC_SZ_HASH256];
+    uint32_t num;
+
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        make_preimage(&preimage, lp);
+        ASSERT_TRUE(ln_db_preimage_save(&preimage, NULL, NULL));
+    }
+
+    //期限(creation_time + expiry)がTimeより前のものだけ削除される
+    ASSERT_TRUE(ln_db_preimage_del_expired(1500000000 + 3600 + EXPIRED, &num));
+    ASSERT_EQ(EXPIRED, num);
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        make_preimage(&preimage, lp);
+        ln_payment_hash_calc(hash, preimage.preimage);
+        ASSERT_EQ(lp >= EXPIRED, ln_db_preimage_search_hash(&preimage_get, hash));
+        ASSERT_EQ(lp >= EXPIRED, preimage_search_scan(&preimage_get, hash));
+    }
+
+    //削除済みのものは再度数えない
+    ASSERT_TRUE(ln_db_preimage_del_expired(1500000000 + 3600 + EXPIRED, &num));
+    ASSERT_EQ(0, num);
+}
+
+TEST_F(ln_db_lmdb, DISABLED_preimage_search_hash_bench)
+{
+    //invoice数ごとの、update_add_htlc受信時のpreimage検索時間
+    const uint32_t NUMS[] = { 1000, 10000, 100000, 1000000 };
+    const int INDEX_NUM = 1000;
+    ln_db_preimage_t preimage;
+    ln_db_preimage_t preimage_get;
+    uint8_t hash[BTC_SZ_HASH256];
+    struct timespec ts_start, ts_end;
+    uint32_t saved = 0;
+
+    printf("[bench] preimage search on update_add_htlc receive\n");
+    for (size_t lp = 0; lp < ARRAY_SIZE(NUMS); lp++) {
+        const uint32_t num = NUMS[lp];
+        for (; saved < num; saved++) {
+            make_preimage(&preimage, saved);
+            ASSERT_TRUE(ln_db_preimage_save(&preimage, NULL, NULL));
+        }
+
+        //scanは件数に比例するため、多い時は回数を減らす
+        const int scan_num = (num >= 100000) ? 3 : 30;
+        clock_gettime(CLOCK_MONOTONIC, &ts_start);
+        for (int cnt = 0; cnt < scan_num; cnt++) {
+            make_preimage(&preimage, (uint32_t)(cnt * 7919) % num);
+            ln_payment_hash_calc(hash, preimage.preimage);
+            ASSERT_TRUE(preimage_search_scan(&preimage_get, hash));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts_end);
+        uint64_t scan_ns = elapsed_ns(&ts_start, &ts_end) / scan_num;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts_start);
+        for (int cnt = 0; cnt < INDEX_NUM; cnt++) {
+            make_preimage(&preimage, (uint32_t)(cnt * 7919) % num);
+            ln_payment_hash_calc(hash, preimage.preimage);
+            ASSERT_TRUE(ln_db_preimage_search_hash(&preimage_get, hash));
+        }
+        clock_gettime(CLOCK_MONOTONIC, &ts_end);
+        uint64_t index_ns = elapsed_ns(&ts_start, &ts_end) / INDEX_NUM;
+
+        printf("[bench]   invoices=%7" PRIu32 ": scan=%8" PRIu64 " us, index=%4" PRIu64 " us\n",
+            num, scan_ns / 1000, index_ns / 1000);
+    }
+}
+
+
+TEST_F(ln_db_lmdb, anno_auto_update_74_to_75)
+{
+    char anno_dir[sizeof(db_dir) + 8];
+    uint8_t node_id[2][BTC_SZ_PUBKEY];
+    uint8_t old_ids[BTC_SZ_PUBKEY * 2];
+    uint8_t cnl_key[sizeof(uint64_t) + 1] = { 0, 0, 0, 1, 0, 0, 2, 3, LN_DB_CNLANNO_ANNO };
+    MDB_dbi dbi;
+    MDB_val key, data;
+
+    sprintf(anno_dir, "%s/anno", db_dir);
+    ASSERT_EQ(0, mkdir(anno_dir, 0755));
+    ASSERT_EQ(0, mdb_env_create(&mpEnvAnno));
+    ASSERT_EQ(0, mdb_env_set_maxdbs(mpEnvAnno, 10));
+    ASSERT_EQ(0, mdb_env_open(mpEnvAnno, anno_dir, MDB_NOSYNC, 0664));
+
+    //旧形式: node_id配列
+    for (int lp = 0; lp < 2; lp++) {
+        memset(node_id[lp], 0x11 * (lp + 1), BTC_SZ_PUBKEY);
+        node_id[lp][0] = 0x02;
+        memcpy(old_ids + BTC_SZ_PUBKEY * lp, node_id[lp], BTC_SZ_PUBKEY);
+    }
+    ASSERT_EQ(0, mdb_txn_begin(mpEnvAnno, NULL, 0, &mpTxnAnno));
+    ASSERT_EQ(0, mdb_dbi_open(mpTxnAnno, M_DBI_CNLANNO_INFO_OLD, MDB_CREATE, &dbi));
+    key.mv_size = sizeof(cnl_key);
+    key.mv_data = cnl_key;
+    data.mv_size = sizeof(old_ids);
+    data.mv_data = old_ids;
+    ASSERT_EQ(0, mdb_put(mpTxnAnno, dbi, &key, &data, 0));
+    ASSERT_EQ(0, mdb_dbi_open(mpTxnAnno, M_DBI_NODEANNO_INFO_OLD, MDB_CREATE, &dbi));
+    key.mv_size = BTC_SZ_PUBKEY;
+    key.mv_data = node_id[0];
+    data.mv_size = BTC_SZ_PUBKEY;
+    data.mv_data = node_id[1];
+    ASSERT_EQ(0, mdb_put(mpTxnAnno, dbi, &key, &data, 0));
+    ASSERT_EQ(0, mdb_txn_commit(mpTxnAnno));
+    mpTxnAnno = NULL;
+
+    ASSERT_TRUE(auto_update_74_to_75());
+    ASSERT_TRUE(mpTxnAnno == NULL);
+
+    //旧DBは削除され、送信済みとしてpeer slot形式に移行されている
+    anno_peer_t peer[2];
+    ASSERT_EQ(0, mdb_txn_begin(mpEnvAnno, NULL, MDB_RDONLY, &mpTxnAnno));
+    ASSERT_EQ(MDB_NOTFOUND, mdb_dbi_open(mpTxnAnno, M_DBI_CNLANNO_INFO_OLD, 0, &dbi));
+    ASSERT_EQ(MDB_NOTFOUND, mdb_dbi_open(mpTxnAnno, M_DBI_NODEANNO_INFO_OLD, 0, &dbi));
+    ASSERT_EQ(0, annopeer_load(&peer[0], node_id[0]));
+    ASSERT_EQ(0, annopeer_load(&peer[1], node_id[1]));
+    ASSERT_NE(peer[0].slot, peer[1].slot);
+
+    ASSERT_EQ(0, mdb_dbi_open(mpTxnAnno, M_DBI_CNLANNO_INFO, 0, &dbi));
+    key.mv_size = sizeof(cnl_key);
+    key.mv_data = cnl_key;
+    ASSERT_EQ(0, mdb_get(mpTxnAnno, dbi, &key, &data));
+    ASSERT_TRUE(annoinfo_is_sent(&data, &peer[0]));
+    ASSERT_TRUE(annoinfo_is_sent(&data, &peer[1]));
+
+    ASSERT_EQ(0, mdb_dbi_open(mpTxnAnno, M_DBI_NODEANNO_INFO, 0, &dbi));
+    key.mv_size = BTC_SZ_PUBKEY;
+    key.mv_data = node_id[0];
+    ASSERT_EQ(0, mdb_get(mpTxnAnno, dbi, &key, &data));
+    ASSERT_FALSE(annoinfo_is_sent(&data, &peer[0]));
+    ASSERT_TRUE(annoinfo_is_sent(&data, &peer[1]));
+    mdb_txn_abort(mpTxnAnno);
+    mpTxnAnno = NULL;
+
+    //旧DBが無ければ何もしない
+    ASSERT_TRUE(auto_update_74_to_75());
+}
@@ -0,0 +1,110 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+
+#undef LOG_TAG
+#include "ln_forward.c"
+}
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+////////////////////////////////////////////////////////////////////////
+
+class ln_forward: public testing::Test {
+protected:
+    virtual void SetUp() {
+        utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+        mWakeupCnt = 0;
+    }
+
+    virtual void TearDown() {
+        ln_forward_term();
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    static int mWakeupCnt;
+
+    static void Wakeup(void *pParam)
+    {
+        (void)pParam;
+        mWakeupCnt++;
+    }
+};
+int ln_forward::mWakeupCnt;
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(ln_forward, notify)
+{
+    const uint64_t SCID = 0x123456;
+
+    //未知のchannelは通知あり
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_ADD_HTLC));
+    ASSERT_FALSE(ln_forward_pending(SCID, LN_FORWARD_ADD_HTLC));
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_DEL_HTLC));
+    ASSERT_FALSE(ln_forward_pending(SCID, LN_FORWARD_DEL_HTLC));
+
+    //未登録: 通知状態のみ
+    ln_forward_notify(SCID, LN_FORWARD_ADD_HTLC);
+    ASSERT_EQ(0, mWakeupCnt);
+    ASSERT_FALSE(ln_forward_pending(SCID, LN_FORWARD_DEL_HTLC));
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_ADD_HTLC));
+    ASSERT_FALSE(ln_forward_pending(SCID, LN_FORWARD_ADD_HTLC));
+
+    //登録時は通知あり
+    ln_forward_register(SCID, Wakeup, NULL);
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_ADD_HTLC));
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_DEL_HTLC));
+
+    ln_forward_notify(SCID, LN_FORWARD_DEL_HTLC);
+    ASSERT_EQ(1, mWakeupCnt);
+    ln_forward_notify(SCID + 1, LN_FORWARD_DEL_HTLC);
+    ASSERT_EQ(1, mWakeupCnt);
+    ASSERT_FALSE(ln_forward_pending(SCID, LN_FORWARD_ADD_HTLC));
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_DEL_HTLC));
+    ASSERT_TRUE(ln_forward_pending(SCID + 1, LN_FORWARD_DEL_HTLC));
+
+    //retryは起床しない
+    ln_forward_retry(SCID, LN_FORWARD_DEL_HTLC);
+    ASSERT_EQ(1, mWakeupCnt);
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_DEL_HTLC));
+    ASSERT_FALSE(ln_forward_pending(SCID, LN_FORWARD_DEL_HTLC));
+
+    //解除時は通知あり、以降は起床しない
+    ln_forward_unregister(SCID);
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_ADD_HTLC));
+    ln_forward_notify(SCID, LN_FORWARD_ADD_HTLC);
+    ASSERT_EQ(1, mWakeupCnt);
+    ASSERT_TRUE(ln_forward_pending(SCID, LN_FORWARD_ADD_HTLC));
+}
+
+
+TEST_F(ln_forward, many)
+{
+    const uint64_t NUM = 100;
+    for (uint64_t lp = 0; lp < NUM; lp++) {
+        ln_forward_register(lp, Wakeup, NULL);
+        ASSERT_TRUE(ln_forward_pending(lp, LN_FORWARD_ADD_HTLC));
+    }
+    for (uint64_t lp = 0; lp < NUM; lp++) {
+        ASSERT_FALSE(ln_forward_pending(lp, LN_FORWARD_ADD_HTLC));
+        ln_forward_notify(lp, LN_FORWARD_ADD_HTLC);
+    }
+    ASSERT_EQ(NUM, mWakeupCnt);
+    for (uint64_t lp = 0; lp < NUM; lp++) {
+        ASSERT_TRUE(ln_forward_pending(lp, LN_FORWARD_ADD_HTLC));
+    }
+}
@@ -0,0 +1,163 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+
+#undef LOG_TAG
+#include "ln_intern.c"
+}
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+////////////////////////////////////////////////////////////////////////
+
+class ln_intern: public testing::Test {
+protected:
+    virtual void SetUp() {
+        utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+    }
+
+    virtual void TearDown() {
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    static void MakeNodeId(uint8_t *pNodeId, uint32_t Num)
+    {
+        memset(pNodeId, 0, BTC_SZ_PUBKEY);
+        pNodeId[0] = 0x02;
+        //hashが衝突しやすいよう、下位だけ変える
+        pNodeId[1] = (uint8_t)(Num & 0xff);
+        pNodeId[BTC_SZ_PUBKEY - 4] = (uint8_t)(Num >> 24);
+        pNodeId[BTC_SZ_PUBKEY - 3] = (uint8_t)(Num >> 16);
+        pNodeId[BTC_SZ_PUBKEY - 2] = (uint8_t)(Num >> 8);
+        pNodeId[BTC_SZ_PUBKEY - 1] = (uint8_t)Num;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(ln_intern, node)
+{
+    ln_intern_t intern;
+    ln_intern_init(&intern);
+
+    uint8_t node_id[BTC_SZ_PUBKEY];
+    uint32_t idx;
+
+    MakeNodeId(node_id, 1);
+    ASSERT_FALSE(ln_intern_node_search(&intern, &idx, node_id));
+    ASSERT_TRUE(NULL == ln_intern_node_id(&intern, 0));
+
+    const uint32_t NUM = 10000;
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        MakeNodeId(node_id, lp);
+        ASSERT_TRUE(ln_intern_node_add(&intern, &idx, node_id));
+        ASSERT_EQ(lp, idx);
+    }
+    ASSERT_EQ(NUM, ln_intern_node_num(&intern));
+
+    //登録済み
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        MakeNodeId(node_id, lp);
+        ASSERT_TRUE(ln_intern_node_add(&intern, &idx, node_id));
+        ASSERT_EQ(lp, idx);
+        ASSERT_TRUE(ln_intern_node_search(&intern, &idx, node_id));
+        ASSERT_EQ(lp, idx);
+        ASSERT_EQ(0, memcmp(node_id, ln_intern_node_id(&intern, idx), BTC_SZ_PUBKEY));
+    }
+    ASSERT_EQ(NUM, ln_intern_node_num(&intern));
+
+    MakeNodeId(node_id, NUM);
+    ASSERT_FALSE(ln_intern_node_search(&intern, &idx, node_id));
+
+    ln_intern_clear(&intern);
+    ASSERT_EQ(0, ln_intern_node_num(&intern));
+    MakeNodeId(node_id, 1);
+    ASSERT_FALSE(ln_intern_node_search(&intern, &idx, node_id));
+    ASSERT_TRUE(ln_intern_node_add(&intern, &idx, node_id));
+    ASSERT_EQ(0, idx);
+
+    ln_intern_term(&intern);
+}
+
+
+TEST_F(ln_intern, channel)
+{
+    ln_intern_t intern;
+    ln_intern_init(&intern);
+
+    uint64_t scid;
+    uint32_t idx1;
+    uint32_t idx2;
+
+    ASSERT_FALSE(ln_intern_channel_search(&intern, &idx1, &idx2, 1));
+    ASSERT_FALSE(ln_intern_channel_search_pair(&intern, &scid, 0, 1));
+
+    //channel n: node n --> node n+1
+    const uint32_t NUM = 10000;
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        ASSERT_TRUE(ln_intern_channel_add(&intern, 0x1000 + lp, lp, lp + 1));
+    }
+    ASSERT_EQ(NUM, ln_intern_channel_num(&intern));
+    for (uint32_t lp = 0; lp < NUM; lp++) {
+        ASSERT_TRUE(ln_intern_channel_search(&intern, &idx1, &idx2, 0x1000 + lp));
+        ASSERT_EQ(lp, idx1);
+        ASSERT_EQ(lp + 1, idx2);
+        ASSERT_TRUE(ln_intern_channel_search_pair(&intern, &scid, lp, lp + 1));
+        ASSERT_EQ(0x1000 + lp, scid);
+        ASSERT_TRUE(ln_intern_channel_search_pair(&intern, &scid, lp + 1, lp));
+        ASSERT_EQ(0x1000 + lp, scid);
+    }
+    ASSERT_FALSE(ln_intern_channel_search_pair(&intern, &scid, 0, 2));
+
+    //同じnode間に2つ目のchannel
+    ASSERT_TRUE(ln_intern_channel_add(&intern, 0x10, 0, 1));
+    ASSERT_TRUE(ln_intern_channel_del(&intern, 0x1000));
+    ASSERT_FALSE(ln_intern_channel_del(&intern, 0x1000));
+    ASSERT_FALSE(ln_intern_channel_search(&intern, NULL, NULL, 0x1000));
+    ASSERT_TRUE(ln_intern_channel_search_pair(&intern, &scid, 0, 1));
+    ASSERT_EQ(0x10, scid);
+    ASSERT_TRUE(ln_intern_channel_del(&intern, 0x10));
+    ASSERT_FALSE(ln_intern_channel_search_pair(&intern, &scid, 0, 1));
+    ASSERT_EQ(NUM - 1, ln_intern_channel_num(&intern));
+
+    //node変更
+    ASSERT_TRUE(ln_intern_channel_add(&intern, 0x1001, 5, 6));
+    ASSERT_TRUE(ln_intern_channel_search(&intern, &idx1, &idx2, 0x1001));
+    ASSERT_EQ(5, idx1);
+    ASSERT_EQ(6, idx2);
+    ASSERT_FALSE(ln_intern_channel_search_pair(&intern, &scid, 1, 2));
+    ASSERT_EQ(NUM - 1, ln_intern_channel_num(&intern));
+
+    //削除と追加の繰り返し(削除済み要素の再利用)
+    for (uint32_t loop = 0; loop < 10; loop++) {
+        for (uint32_t lp = 0; lp < NUM; lp++) {
+            ln_intern_channel_del(&intern, 0x1000 + lp);
+        }
+        ASSERT_EQ(0, ln_intern_channel_num(&intern));
+        for (uint32_t lp = 0; lp < NUM; lp++) {
+            ASSERT_TRUE(ln_intern_channel_add(&intern, 0x1000 + lp, lp, lp + 1));
+        }
+        ASSERT_EQ(NUM, ln_intern_channel_num(&intern));
+    }
+    ASSERT_TRUE(ln_intern_channel_search_pair(&intern, &scid, NUM - 1, NUM));
+    ASSERT_EQ(0x1000 + NUM - 1, scid);
+
+    ln_intern_clear(&intern);
+    ASSERT_EQ(0, ln_intern_channel_num(&intern));
+    ASSERT_FALSE(ln_intern_channel_search(&intern, NULL, NULL, 0x1001));
+
+    ln_intern_term(&intern);
+}
@@ -8780,3 +8780,45 @@ TEST_F(ln, gossip_encoded_short_ids2)
     ASSERT_EQ(0, memcmp(DECODED_IDS, p_short_ids, sizeof(DECODED_IDS)));
     UTL_DBG_FREE(p_short_ids);
 }
+
+
+TEST_F(ln, gossip_encoded_short_ids_type)
+{
+    const uint64_t DECODED_IDS[] = {
+        0x13a7b50000660000,
+        0x13a8030001040000,
+        0x13a8080000550001,
+    };
+    const size_t NUM = sizeof(DECODED_IDS) / sizeof(uint64_t);
+
+    bool ret;
+    utl_buf_t enc = UTL_BUF_INIT;
+
+    //無圧縮
+    ret = ln_msg_gossip_ids_encode_type(&enc, DECODED_IDS, NUM, LN_GOSSIPQUERY_ENCODE_NONE);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(1 + sizeof(DECODED_IDS), enc.len);
+    ASSERT_EQ(LN_GOSSIPQUERY_ENCODE_NONE, enc.buf[0]);
+    ASSERT_EQ(0x13, enc.buf[1]);
+    ASSERT_EQ(0x01, enc.buf[sizeof(DECODED_IDS)]);
+    utl_buf_free(&enc);
+
+    //M_ZLIB_CHUNK以下でもzlib指定できる
+    ret = ln_msg_gossip_ids_encode_type(&enc, DECODED_IDS, NUM, LN_GOSSIPQUERY_ENCODE_ZLIB);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(LN_GOSSIPQUERY_ENCODE_ZLIB, enc.buf[0]);
+    uint64_t *p_short_ids = NULL;
+    size_t num = 0;
+    ret = ln_msg_gossip_ids_decode(&p_short_ids, &num, enc.buf, enc.len);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(NUM, num);
+    ASSERT_EQ(0, memcmp(DECODED_IDS, p_short_ids, sizeof(DECODED_IDS)));
+    UTL_DBG_FREE(p_short_ids);
+    utl_buf_free(&enc);
+
+    //不明なencoding
+    ret = ln_msg_gossip_ids_encode_type(&enc, DECODED_IDS, NUM, 0x02);
+    ASSERT_FALSE(ret);
+    ASSERT_EQ(0, enc.len);
+}
+
@@ -64,6 +64,7 @@ FAKE_VALUE_FUNC(bool, ln_db_cnlupd_load, utl_buf_t *, uint32_t *, uint64_t, uint
 FAKE_VALUE_FUNC(bool, ln_db_preimage_del, const uint8_t *);
 FAKE_VALUE_FUNC(bool, ln_db_preimage_cur_open, void **);
 FAKE_VALUE_FUNC(bool, ln_db_preimage_cur_get, void *, bool *, ln_db_preimage_t *, const char**);
+FAKE_VALUE_FUNC(bool, ln_db_preimage_search_hash, ln_db_preimage_t *, const uint8_t *);
 FAKE_VALUE_FUNC(bool, ln_db_preimage_used, const uint8_t *);
 FAKE_VALUE_FUNC(bool, ln_db_channel_search, ln_db_func_cmp_t, void *);
 FAKE_VALUE_FUNC(bool, ln_db_channel_search_readonly, ln_db_func_cmp_t, void *);
@@ -96,6 +97,7 @@ protected:
         RESET_FAKE(ln_db_preimage_del)
         RESET_FAKE(ln_db_preimage_cur_open)
         RESET_FAKE(ln_db_preimage_cur_get)
+        RESET_FAKE(ln_db_preimage_search_hash)
         RESET_FAKE(ln_db_preimage_used)
         RESET_FAKE(ln_db_channel_search)
         RESET_FAKE(ln_db_channel_search_readonly)
@@ -432,18 +434,12 @@ TEST_F(ln, update_add_htlc_recv1)
 {
     class dummy {
     public:
-        static bool ln_db_preimage_cur_open(void **ppCur) {
-            return true;
-        }
-        static bool ln_db_preimage_cur_get(void *pCur, bool *pDetect, ln_db_preimage_t *pPreimage, const char**ppBolt11) {
-            *pDetect = true;
+        static bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash) {
             pPreimage->amount_msat = LN_UPDATE_ADD_HTLC_A::AMOUNT_MSAT;
             memcpy(pPreimage->preimage, LN_UPDATE_ADD_HTLC_A::PREIMAGE, LN_SZ_PREIMAGE);
             pPreimage->creation_time = 1538375408;
             pPreimage->expiry = LN_UPDATE_ADD_HTLC_A::CLTV_EXPIRY;
-            if (ppBolt11) {
-                *ppBolt11 = "";
-            }
+            pPreimage->state = LN_DB_PREIMAGE_STATE_UNUSED;
             return true;
         }
         static void callback(ln_cb_type_t Type, void *pCommonParam, void *pTypeSpecificParam) {
@@ -454,8 +450,7 @@ TEST_F(ln, update_add_htlc_recv1)
             }
         }
     };
-    ln_db_preimage_cur_open_fake.custom_fake = dummy::ln_db_preimage_cur_open;
-    ln_db_preimage_cur_get_fake.custom_fake = dummy::ln_db_preimage_cur_get;
+    ln_db_preimage_search_hash_fake.custom_fake = dummy::ln_db_preimage_search_hash;
 
 
     ln_channel_t channel;
@@ -505,18 +500,12 @@ TEST_F(ln, update_add_htlc_recv2)
 {
     class dummy {
     public:
-        static bool ln_db_preimage_cur_open(void **ppCur) {
-            return true;
-        }
-        static bool ln_db_preimage_cur_get(void *pCur, bool *pDetect, ln_db_preimage_t *pPreimage, const char **ppBolt11) {
-            *pDetect = true;
+        static bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash) {
             pPreimage->amount_msat = LN_UPDATE_ADD_HTLC_A::AMOUNT_MSAT;
             memcpy(pPreimage->preimage, LN_UPDATE_ADD_HTLC_A::PREIMAGE, LN_SZ_PREIMAGE);
             pPreimage->creation_time = 1538375408;
             pPreimage->expiry = LN_UPDATE_ADD_HTLC_A::CLTV_EXPIRY;
-            if (ppBolt11) {
-                *ppBolt11 = "";
-            }
+            pPreimage->state = LN_DB_PREIMAGE_STATE_UNUSED;
             return true;
         }
         static void callback(ln_cb_type_t Type, void *pCommonParam, void *pTypeSpecificParam) {
@@ -528,8 +517,7 @@ TEST_F(ln, update_add_htlc_recv2)
             }
         }
     };
-    ln_db_preimage_cur_open_fake.custom_fake = dummy::ln_db_preimage_cur_open;
-    ln_db_preimage_cur_get_fake.custom_fake = dummy::ln_db_preimage_cur_get;
+    ln_db_preimage_search_hash_fake.custom_fake = dummy::ln_db_preimage_search_hash;
 
 
     ln_channel_t channel;
@@ -579,11 +567,11 @@ TEST_F(ln, update_add_htlc_recv3)
 {
     class dummy {
     public:
-        static bool ln_db_preimage_cur_open(void **ppCur) {
+        static bool ln_db_preimage_search_hash(ln_db_preimage_t *pPreimage, const uint8_t *pPaymentHash) {
             return false;
         }
     };
-    ln_db_preimage_cur_open_fake.custom_fake = dummy::ln_db_preimage_cur_open;
+    ln_db_preimage_search_hash_fake.custom_fake = dummy::ln_db_preimage_search_hash;
 
 
     ln_channel_t channel;
@@ -40,6 +40,8 @@ extern "C" {
 //#include "ln_msg_normalope.c"
 // #include "ln_msg_setupctl.c"
 #include "ln_anno.c"
+#undef LOG_TAG
+#include "ln_anno_ingest.c"
 #include "ln_node.c"
 // #include "ln_onion.c"
 // #include "ln_script.c"
@@ -77,6 +79,13 @@ FAKE_VALUE_FUNC(const char *, utl_time_fmt, char *, time_t );
 FAKE_VALUE_FUNC(bool, ln_msg_channel_update_read, ln_msg_channel_update_t *, const uint8_t *, uint16_t );
 FAKE_VALUE_FUNC(bool, ln_msg_channel_update_verify, const uint8_t *, const uint8_t *, uint16_t );
 FAKE_VALUE_FUNC(bool, ln_msg_channel_announcement_read, ln_msg_channel_announcement_t *, const uint8_t *, uint16_t );
+FAKE_VALUE_FUNC(bool, ln_msg_channel_announcement_verify, const ln_msg_channel_announcement_t *, const uint8_t *, uint16_t );
+FAKE_VALUE_FUNC(bool, ln_msg_node_announcement_read, ln_msg_node_announcement_t *, const uint8_t *, uint16_t );
+FAKE_VALUE_FUNC(bool, ln_msg_node_announcement_verify, const ln_msg_node_announcement_t *, const uint8_t *, uint16_t );
+FAKE_VALUE_FUNC(bool, ln_db_cnlanno_save, const utl_buf_t *, uint64_t, const uint8_t *, const uint8_t *, const uint8_t *);
+FAKE_VALUE_FUNC(bool, ln_db_nodeanno_save, const utl_buf_t *, const ln_msg_node_announcement_t *, const uint8_t *);
+FAKE_VALUE_FUNC(bool, ln_db_anno_batch_begin);
+FAKE_VALUE_FUNC(bool, ln_db_anno_batch_end, bool);
 
 
 ////////////////////////////////////////////////////////////////////////
@@ -406,7 +415,7 @@ TEST_F(ln, recv_updatechannel_ok)
     bool ret = ln_channel_update_recv(&channel, NULL, 0);
     ASSERT_TRUE(ret);
     ASSERT_EQ(1, ln_db_cnlupd_need_to_prune_fake.call_count);
-    //ASSERT_EQ(1, ln_msg_channel_update_verify_fake.call_count); //XXX: dissable to verify sigs
+    ASSERT_EQ(1, ln_msg_channel_update_verify_fake.call_count);
     ASSERT_EQ(1, ln_db_cnlupd_save_fake.call_count);
     ASSERT_EQ(1, callback_called);
 
@@ -468,7 +477,7 @@ TEST_F(ln, recv_updatechannel_timestamp_toofar_in)
     bool ret = ln_channel_update_recv(&channel, NULL, 0);
     ASSERT_TRUE(ret);
     ASSERT_EQ(1, ln_db_cnlupd_need_to_prune_fake.call_count);
-    //ASSERT_EQ(1, ln_msg_channel_update_verify_fake.call_count); //XXX: disable to verify sigs
+    ASSERT_EQ(1, ln_msg_channel_update_verify_fake.call_count);
     ASSERT_EQ(1, ln_db_cnlupd_save_fake.call_count);
     ASSERT_EQ(1, callback_called);
 
@@ -531,7 +540,7 @@ TEST_F(ln, recv_updatechannel_timestamp_toofar_out)
     bool ret = ln_channel_update_recv(&channel, NULL, 0);
     ASSERT_TRUE(ret);
     ASSERT_EQ(1, ln_db_cnlupd_need_to_prune_fake.call_count);
-    //ASSERT_EQ(1, ln_msg_channel_update_verify_fake.call_count); //XXX: disable to verify sigs
+    ASSERT_EQ(0, ln_msg_channel_update_verify_fake.call_count);
     ASSERT_EQ(0, ln_db_cnlupd_save_fake.call_count);
     ASSERT_EQ(0, callback_called);
 
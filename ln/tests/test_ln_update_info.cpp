@@ -0,0 +1,215 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+
+#undef LOG_TAG
+#include "ln_update.c"
+#include "ln_update_info.c"
+}
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+FAKE_VALUE_FUNC(bool, ln_db_preimage_used, const uint8_t *);
+
+////////////////////////////////////////////////////////////////////////
+
+class ln_update_info: public testing::Test {
+protected:
+    virtual void SetUp() {
+        utl_log_init_stderr();
+        utl_dbg_malloc_cnt_reset();
+        RESET_FAKE(ln_db_preimage_used)
+        ln_update_info_init(&mInfo);
+    }
+
+    virtual void TearDown() {
+        ln_update_info_free(&mInfo);
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    //bitmapとenabledが一致しているか
+    static bool index_match(const ln_update_info_t *pInfo) {
+        ln_update_info_t info;
+        memcpy(&info, pInfo, sizeof(info));
+        ln_update_info_rebuild_index(&info);
+        return !memcmp(info.used_updates, pInfo->used_updates, sizeof(info.used_updates)) &&
+            !memcmp(info.used_htlcs, pInfo->used_htlcs, sizeof(info.used_htlcs));
+    }
+
+    //旧実装と同じ全件走査
+    static bool commitment_signed_send_needs_scan(ln_update_info_t *pInfo) {
+        for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+            ln_update_t *p_update = &pInfo->updates[idx];
+            if (!LN_UPDATE_USED(p_update)) continue;
+            if (!LN_UPDATE_REMOTE_COMSIGING(p_update)) continue;
+            return false;
+        }
+        for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+            ln_update_t *p_update = &pInfo->updates[idx];
+            if (!LN_UPDATE_USED(p_update)) continue;
+            if (!LN_UPDATE_WAIT_SEND_CS(p_update)) continue;
+            return true;
+        }
+        return false;
+    }
+
+    static uint64_t get_htlc_value_in_flight_msat_scan(ln_update_info_t *pInfo, bool bLocal) {
+        uint64_t value = 0;
+        for (uint16_t idx = 0; idx < LN_UPDATE_MAX; idx++) {
+            ln_update_t *p_update = &pInfo->updates[idx];
+            if (!LN_UPDATE_USED(p_update)) continue;
+            if (LN_UPDATE_RECV_ENABLED(p_update, LN_UPDATE_TYPE_ADD_HTLC, bLocal)) {
+                value += pInfo->htlcs[p_update->type_specific_idx].amount_msat;
+            }
+            if (LN_UPDATE_SEND_ENABLED(p_update, LN_UPDATE_TYPE_MASK_DEL_HTLC, bLocal)) {
+                value -= pInfo->htlcs[p_update->type_specific_idx].amount_msat;
+            }
+        }
+        return value;
+    }
+
+public:
+    ln_update_info_t mInfo;
+};
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(ln_update_info, add_clear)
+{
+    uint16_t update_idx[LN_HTLC_MAX];
+
+    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+        if (lp & 1) {
+            ASSERT_TRUE(ln_update_info_set_add_htlc_recv(&mInfo, &update_idx[lp]));
+        } else {
+            ASSERT_TRUE(ln_update_info_set_add_htlc_send(&mInfo, &update_idx[lp]));
+        }
+        ASSERT_TRUE(mInfo.updates[update_idx[lp]].enabled);
+        ASSERT_TRUE(mInfo.htlcs[mInfo.updates[update_idx[lp]].type_specific_idx].enabled);
+        ASSERT_TRUE(index_match(&mInfo));
+    }
+    //htlcが一杯なら失敗し、updateも確保しない
+    uint16_t idx;
+    ASSERT_FALSE(ln_update_info_set_add_htlc_send(&mInfo, &idx));
+    ASSERT_TRUE(index_match(&mInfo));
+    ASSERT_FALSE(ln_update_info_is_channel_clean(&mInfo));
+
+    //空いたところを再利用する
+    ASSERT_TRUE(ln_update_info_clear_htlc(&mInfo, update_idx[3]));
+    ASSERT_FALSE(mInfo.updates[update_idx[3]].enabled);
+    ASSERT_TRUE(index_match(&mInfo));
+    ASSERT_TRUE(ln_update_info_set_add_htlc_send(&mInfo, &idx));
+    ASSERT_EQ(update_idx[3], idx);
+    ASSERT_TRUE(index_match(&mInfo));
+
+    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+        ASSERT_TRUE(ln_update_info_clear_htlc(&mInfo, update_idx[lp]));
+    }
+    ASSERT_TRUE(index_match(&mInfo));
+    ASSERT_TRUE(ln_update_info_is_channel_clean(&mInfo));
+}
+
+
+TEST_F(ln_update_info, del_htlc)
+{
+    uint16_t update_idx_add;
+    ASSERT_TRUE(ln_update_info_set_add_htlc_recv(&mInfo, &update_idx_add));
+    ln_update_t *p_update_add = &mInfo.updates[update_idx_add];
+    mInfo.htlcs[p_update_add->type_specific_idx].id = 5;
+    p_update_add->state = LN_UPDATE_STATE_RECEIVED_RA_RECV;
+
+    uint16_t update_idx_del;
+    ASSERT_TRUE(ln_update_info_set_del_htlc_pre_send(&mInfo, &update_idx_del, 5, LN_UPDATE_TYPE_FULFILL_HTLC));
+    ASSERT_NE(update_idx_add, update_idx_del);
+    ASSERT_TRUE(index_match(&mInfo));
+
+    uint16_t idx;
+    ASSERT_TRUE(ln_update_info_get_corresponding_update(&mInfo, &idx, update_idx_add));
+    ASSERT_EQ(update_idx_del, idx);
+
+    //del側を消すとadd側も消える
+    ASSERT_TRUE(ln_update_info_clear_htlc(&mInfo, update_idx_del));
+    ASSERT_TRUE(index_match(&mInfo));
+    ASSERT_TRUE(ln_update_info_is_channel_clean(&mInfo));
+}
+
+
+TEST_F(ln_update_info, next_used)
+{
+    uint16_t idx = 0;
+    ASSERT_FALSE(ln_update_info_next_used(&mInfo, &idx));
+    ASSERT_EQ(LN_UPDATE_MAX, idx);
+
+    //DBから読んだ状態(enabledのみ)から復元する
+    const uint16_t USED[] = { 0, 5, LN_UPDATE_MAX - 1 };
+    for (size_t lp = 0; lp < ARRAY_SIZE(USED); lp++) {
+        mInfo.updates[USED[lp]].enabled = true;
+        mInfo.updates[USED[lp]].type = LN_UPDATE_TYPE_FEE;
+    }
+    mInfo.htlcs[2].enabled = true;
+    ln_update_info_rebuild_index(&mInfo);
+    ASSERT_EQ((uint64_t)1 << 2, mInfo.used_htlcs[0]);
+
+    size_t cnt = 0;
+    for (idx = 0; ln_update_info_next_used(&mInfo, &idx); idx++) {
+        ASSERT_LT(cnt, ARRAY_SIZE(USED));
+        ASSERT_EQ(USED[cnt], idx);
+        cnt++;
+    }
+    ASSERT_EQ(ARRAY_SIZE(USED), cnt);
+
+    //htlc_allocは使用中を避ける
+    uint16_t update_idx;
+    ASSERT_TRUE(ln_update_info_set_add_htlc_send(&mInfo, &update_idx));
+    ASSERT_EQ(1, update_idx);
+    ASSERT_EQ(0, mInfo.updates[update_idx].type_specific_idx);
+    ASSERT_TRUE(ln_update_info_set_add_htlc_send(&mInfo, &update_idx));
+    ASSERT_EQ(2, update_idx);
+    ASSERT_EQ(1, mInfo.updates[update_idx].type_specific_idx);
+    ASSERT_TRUE(ln_update_info_set_add_htlc_send(&mInfo, &update_idx));
+    ASSERT_EQ(3, mInfo.updates[update_idx].type_specific_idx);
+    ASSERT_TRUE(index_match(&mInfo));
+}
+
+
+TEST_F(ln_update_info, same_as_scan)
+{
+    //状態をいろいろ変えて旧実装と結果が一致すること
+    const uint8_t STATES[] = {
+        LN_UPDATE_STATE_OFFERED_WAIT_SEND, LN_UPDATE_STATE_OFFERED_UP_SEND,
+        LN_UPDATE_STATE_OFFERED_CS_SEND, LN_UPDATE_STATE_OFFERED_RA_RECV,
+        LN_UPDATE_STATE_OFFERED_CS_RECV, LN_UPDATE_STATE_OFFERED_RA_SEND,
+        LN_UPDATE_STATE_RECEIVED_UP_RECV, LN_UPDATE_STATE_RECEIVED_CS_RECV,
+        LN_UPDATE_STATE_RECEIVED_RA_SEND, LN_UPDATE_STATE_RECEIVED_CS_SEND,
+        LN_UPDATE_STATE_RECEIVED_RA_RECV,
+    };
+    uint16_t update_idx[LN_HTLC_MAX];
+    for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+        ASSERT_TRUE(ln_update_info_set_add_htlc_send(&mInfo, &update_idx[lp]));
+        mInfo.htlcs[mInfo.updates[update_idx[lp]].type_specific_idx].amount_msat = 1000 * (lp + 1);
+    }
+    uint32_t seed = 1;
+    for (int loop = 0; loop < 1000; loop++) {
+        for (int lp = 0; lp < LN_HTLC_MAX; lp++) {
+            seed = seed * 1103515245 + 12345;
+            mInfo.updates[update_idx[lp]].state = STATES[(seed >> 16) % ARRAY_SIZE(STATES)];
+        }
+        ASSERT_EQ(commitment_signed_send_needs_scan(&mInfo), ln_update_info_commitment_signed_send_needs(&mInfo));
+        ASSERT_EQ(get_htlc_value_in_flight_msat_scan(&mInfo, true), ln_update_info_get_htlc_value_in_flight_msat(&mInfo, true));
+        ASSERT_EQ(get_htlc_value_in_flight_msat_scan(&mInfo, false), ln_update_info_get_htlc_value_in_flight_msat(&mInfo, false));
+    }
+}
+
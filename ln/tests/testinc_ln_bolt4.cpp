@@ -1658,3 +1658,34 @@ TEST_F(onion, test4)
     }
 }
 
+
+
+//20hopでのpacket作成
+//  shd_secretsは各hopの秘密鍵とeph_pubkeysから求めたものと一致すること
+TEST_F(onion, create_packet_max_hops)
+{
+    uint8_t session_key[BTC_SZ_PRIVKEY];
+    uint8_t onion_privkey[LN_HOP_MAX][BTC_SZ_PRIVKEY];
+    ln_hop_datain_t datain[LN_HOP_MAX];
+    uint8_t packet[LN_SZ_ONION_ROUTE];
+
+    memset(session_key, 'A', sizeof(session_key));
+    for (int lp = 0; lp < LN_HOP_MAX; lp++) {
+        datain[lp].short_channel_id = lp;
+        datain[lp].amt_to_forward = lp;
+        datain[lp].outgoing_cltv_value = lp;
+        memset(onion_privkey[lp], lp + 1, BTC_SZ_PRIVKEY);
+        btc_keys_priv2pub(datain[lp].pubkey, onion_privkey[lp]);
+    }
+
+    utl_buf_t secrets = UTL_BUF_INIT;
+    bool ret = ln_onion_create_packet(packet, &secrets, datain, LN_HOP_MAX, session_key, NULL, 0);
+    ASSERT_TRUE(ret);
+    ASSERT_EQ(M_SZ_SHARED_SECRET * LN_HOP_MAX, secrets.len);
+    for (int lp = 0; lp < LN_HOP_MAX; lp++) {
+        uint8_t shd[M_SZ_SHARED_SECRET];
+        btc_ecc_shared_secret_sha256(shd, spEphPubkey + BTC_SZ_PUBKEY * lp, onion_privkey[lp]);
+        ASSERT_EQ(0, memcmp(shd, secrets.buf + M_SZ_SHARED_SECRET * lp, sizeof(shd)));
+    }
+    utl_buf_free(&secrets);
+}
@@ -1661,3 +1661,151 @@ TEST_F(bolt8test, enc_dec)
 
     utl_buf_free(&bufin);
 }
+
+
+TEST_F(bolt8test, enc_dec_frame)
+{
+    bool ret;
+    ln_noise_t noise;
+    ln_noise_t noise_dec;
+
+    const uint8_t SK[] = {
+        0x96, 0x9a, 0xb3, 0x1b, 0x4d, 0x28, 0x8c, 0xed,
+        0xf6, 0x21, 0x88, 0x39, 0xb2, 0x7a, 0x3e, 0x21,
+        0x40, 0x82, 0x70, 0x47, 0xf2, 0xc0, 0xf0, 0x1b,
+        0xf5, 0xc0, 0x44, 0x35, 0xd4, 0x35, 0x11, 0xa9,
+    };
+    const uint8_t CK[] = {
+        0x91, 0x92, 0x19, 0xdb, 0xb2, 0x92, 0x0a, 0xfa,
+        0x8d, 0xb8, 0x0f, 0x9a, 0x51, 0x78, 0x7a, 0x84,
+        0x0b, 0xcf, 0x11, 0x1e, 0xd8, 0xd5, 0x88, 0xca,
+        0xf9, 0xab, 0x4b, 0xe7, 0x16, 0xe4, 0x2b, 0x01,
+    };
+    //#enc_dec の0, 1, 500, 501, 1000, 1001番目
+    const uint8_t OUTPUT0[] = {
+        0xcf, 0x2b, 0x30, 0xdd, 0xf0, 0xcf, 0x3f, 0x80,
+        0xe7, 0xc3, 0x5a, 0x6e, 0x67, 0x30, 0xb5, 0x9f,
+        0xe8, 0x02, 0x47, 0x31, 0x80, 0xf3, 0x96, 0xd8,
+        0x8a, 0x8f, 0xb0, 0xdb, 0x8c, 0xbc, 0xf2, 0x5d,
+        0x2f, 0x21, 0x4c, 0xf9, 0xea, 0x1d, 0x95,
+    };
+    const uint8_t OUTPUT1001[] = {
+        0x2e, 0xcd, 0x8c, 0x8a, 0x56, 0x29, 0xd0, 0xd0,
+        0x2a, 0xb4, 0x57, 0xa0, 0xfd, 0xd0, 0xf7, 0xb9,
+        0x0a, 0x19, 0x2c, 0xd4, 0x6b, 0xe5, 0xec, 0xb6,
+        0xca, 0x57, 0x0b, 0xfc, 0x5e, 0x26, 0x83, 0x38,
+        0xb1, 0xa1, 0x6c, 0xf4, 0xef, 0x2d, 0x36,
+    };
+
+    memset(&noise, 0, sizeof(noise));
+    memset(&noise_dec, 0, sizeof(noise_dec));
+    memcpy(noise.send_ctx.key, SK, sizeof(SK));
+    memcpy(noise.send_ctx.ck, CK, sizeof(CK));
+    memcpy(noise_dec.recv_ctx.key, SK, sizeof(SK));
+    memcpy(noise_dec.recv_ctx.ck, CK, sizeof(CK));
+
+    ASSERT_EQ(sizeof(OUTPUT0), LN_SZ_NOISE_FRAME(5));
+
+    //呼び出し元バッファに書き込み、同じ領域に復号する
+    uint8_t frame[LN_SZ_NOISE_FRAME(5)];
+    for (int lp = 0; lp <= 1001; lp++) {
+        uint32_t cnt = utl_dbg_malloc_cnt();
+        ret = ln_noise_enc_frame(&noise, frame, (const uint8_t *)"hello", 5);
+        ASSERT_TRUE(ret);
+        if (lp == 0) {
+            ASSERT_EQ(0, memcmp(OUTPUT0, frame, sizeof(OUTPUT0)));
+        } else if (lp == 1001) {
+            ASSERT_EQ(0, memcmp(OUTPUT1001, frame, sizeof(OUTPUT1001)));
+        }
+
+        uint16_t len = ln_noise_dec_len(&noise_dec, frame, LN_SZ_NOISE_HEADER);
+        ASSERT_EQ(5 + LN_SZ_NOISE_MAC, len);
+        ret = ln_noise_dec_frame(&noise_dec, frame + LN_SZ_NOISE_HEADER, len);
+        ASSERT_TRUE(ret);
+        ASSERT_EQ(0, memcmp(frame + LN_SZ_NOISE_HEADER, "hello", 5));
+        ASSERT_EQ(cnt, utl_dbg_malloc_cnt());
+    }
+
+    //改ざん
+    ret = ln_noise_enc_frame(&noise, frame, (const uint8_t *)"hello", 5);
+    ASSERT_TRUE(ret);
+    frame[LN_SZ_NOISE_HEADER] ^= 0x01;
+    ASSERT_EQ(5 + LN_SZ_NOISE_MAC, ln_noise_dec_len(&noise_dec, frame, LN_SZ_NOISE_HEADER));
+    ASSERT_FALSE(ln_noise_dec_frame(&noise_dec, frame + LN_SZ_NOISE_HEADER, 5 + LN_SZ_NOISE_MAC));
+}
+
+
+TEST_F(bolt8test, enc_batch)
+{
+    bool ret;
+    ln_noise_t noise;
+    ln_noise_t noise_batch;
+    ln_noise_t noise_dec;
+
+    const uint8_t SK[] = {
+        0x96, 0x9a, 0xb3, 0x1b, 0x4d, 0x28, 0x8c, 0xed,
+        0xf6, 0x21, 0x88, 0x39, 0xb2, 0x7a, 0x3e, 0x21,
+        0x40, 0x82, 0x70, 0x47, 0xf2, 0xc0, 0xf0, 0x1b,
+        0xf5, 0xc0, 0x44, 0x35, 0xd4, 0x35, 0x11, 0xa9,
+    };
+    const uint8_t CK[] = {
+        0x91, 0x92, 0x19, 0xdb, 0xb2, 0x92, 0x0a, 0xfa,
+        0x8d, 0xb8, 0x0f, 0x9a, 0x51, 0x78, 0x7a, 0x84,
+        0x0b, 0xcf, 0x11, 0x1e, 0xd8, 0xd5, 0x88, 0xca,
+        0xf9, 0xab, 0x4b, 0xe7, 0x16, 0xe4, 0x2b, 0x01,
+    };
+
+    memset(&noise, 0, sizeof(noise));
+    memset(&noise_batch, 0, sizeof(noise_batch));
+    memset(&noise_dec, 0, sizeof(noise_dec));
+    memcpy(noise.send_ctx.key, SK, sizeof(SK));
+    memcpy(noise.send_ctx.ck, CK, sizeof(CK));
+    memcpy(noise_batch.send_ctx.key, SK, sizeof(SK));
+    memcpy(noise_batch.send_ctx.ck, CK, sizeof(CK));
+    memcpy(noise_dec.recv_ctx.key, SK, sizeof(SK));
+    memcpy(noise_dec.recv_ctx.ck, CK, sizeof(CK));
+
+    //key rotationをまたぐ数
+    const int NUM = 600;
+    utl_buf_t bufin[NUM];
+    for (int lp = 0; lp < NUM; lp++) {
+        utl_buf_alloc(&bufin[lp], 1 + lp % 100);
+        memset(bufin[lp].buf, lp, bufin[lp].len);
+    }
+
+    utl_buf_t buf_batch = UTL_BUF_INIT;
+    ret = ln_noise_enc_batch(&noise_batch, &buf_batch, bufin, NUM);
+    ASSERT_TRUE(ret);
+
+    //1つずつ暗号化したものを連結したものと同じ
+    uint32_t pos = 0;
+    for (int lp = 0; lp < NUM; lp++) {
+        utl_buf_t buf = UTL_BUF_INIT;
+        ret = ln_noise_enc(&noise, &buf, &bufin[lp]);
+        ASSERT_TRUE(ret);
+        ASSERT_EQ(LN_SZ_NOISE_FRAME(bufin[lp].len), buf.len);
+        ASSERT_TRUE(pos + buf.len <= buf_batch.len);
+        ASSERT_EQ(0, memcmp(buf.buf, buf_batch.buf + pos, buf.len));
+        utl_buf_free(&buf);
+
+        uint16_t len = ln_noise_dec_len(&noise_dec, buf_batch.buf + pos, LN_SZ_NOISE_HEADER);
+        ASSERT_EQ(bufin[lp].len + LN_SZ_NOISE_MAC, len);
+        pos += LN_SZ_NOISE_HEADER;
+        utl_buf_t buf_dec = UTL_BUF_INIT;
+        utl_buf_alloccopy(&buf_dec, buf_batch.buf + pos, len);
+        ret = ln_noise_dec_msg(&noise_dec, &buf_dec);
+        ASSERT_TRUE(ret);
+        ASSERT_EQ(bufin[lp].len, buf_dec.len);
+        ASSERT_EQ(0, memcmp(bufin[lp].buf, buf_dec.buf, buf_dec.len));
+        utl_buf_free(&buf_dec);
+        pos += len;
+    }
+    ASSERT_EQ(buf_batch.len, pos);
+    ASSERT_EQ(noise.send_ctx.nonce, noise_batch.send_ctx.nonce);
+    ASSERT_EQ(0, memcmp(noise.send_ctx.key, noise_batch.send_ctx.key, sizeof(SK)));
+
+    utl_buf_free(&buf_batch);
+    for (int lp = 0; lp < NUM; lp++) {
+        utl_buf_free(&bufin[lp]);
+    }
+}
@@ -25,14 +25,14 @@
  *  @note   <pre>
  *                +-----------------------------------------------+
  *      p2p--->   | channel thread                                |
- *                |                                               |
- *                +--+-------+-------------------+----------------+
- *            create |       | create            | create
- *                   v       v                   v
- *      +-------------+     +-------------+     +-------------+
- *      | recv thread |     | poll thread |     | anno thread |
- *      |             |     |             |     |             |
- *      +-------------+     +-------------+     +-------------+
+ *                |   init/channel_reestablish/funding_locked交換  |
+ *                +--+--------------------------------------------+
+ *            attach |
+ *                   v
+ *      +------------------------------------------------------+
+ *      | event loop thread(lnapp_ev: 複数peerで共有)            |
+ *      |   peer受信, 送信キュー, ping/funding監視, announcement  |
+ *      +------------------------------------------------------+
  * </pre>
  */
 #include <stdio.h>
@@ -50,6 +50,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/queue.h>
+#include <sys/eventfd.h>
 #include <assert.h>
 
 #include "cJSON.h"
@@ -73,6 +74,7 @@
 #include "ln_normalope.h"
 #include "ln_anno.h"
 #include "ln_noise.h"
+#include "ln_forward.h"
 #include "ln_msg.h"
 
 #include "ptarmd.h"
@@ -96,15 +98,17 @@
 #define M_WAIT_ANNO_FIRST_SEC   (1)         //監視スレッドでのannounce処理間隔[sec] for first time
 #define M_WAIT_ANNO_SEC         (1)         //監視スレッドでのannounce処理間隔[sec]
 #define M_WAIT_ANNO_LONG_SEC    (30)        //監視スレッドでのannounce処理間隔(長めに空ける)[sec]
-#define M_WAIT_RECV_TO_MSEC     (50)        //socket受信待ちタイムアウト[msec]
+#define M_WAIT_RECV_TO_MSEC     (50)        //socket受信待ちタイムアウト[msec](handshake)
+#define M_WAIT_IDLE_MSEC        (500)       //受信や通知が無い場合の#ln_idle_proc()再処理周期[msec]
+#define M_WAIT_ORIGIN_TO_MSEC   (1000)      //origin nodeのHTLC転送通知待ちタイムアウト[msec]
 #define M_WAIT_RECV_MSG_MSEC    (500)       //message受信監視周期[msec]
-#define M_WAIT_RECV_THREAD_MSEC (100)       //recv_thread開始待ち[msec]
+#define M_WAIT_RECV_THREAD_MSEC (100)       //peer受信開始待ち[msec]
 #define M_WAIT_RESPONSE_MSEC    (10000)     //受信待ち[msec]
 #define M_WAIT_CHANREEST_MSEC   (3600000)   //channel_reestablish受信待ち[msec]
 
-//warkaround for write-timeout
-//#define M_ANNO_UNIT             (10)        ///< 1回のanno_proc()での処理単位
-#define M_ANNO_UNIT             (1)         ///< 1回のanno_proc()での処理単位
+#define M_ANNO_UNIT             (200)           ///< 1回のanno_proc()での最大channel数
+#define M_ANNO_BATCH_BYTES      (64 * 1024)     ///< 1回のanno_proc()での最大送信量[byte]
+#define M_ANNO_SNDQ_MAX         (32 * 1024)     ///< gossip送信キューがこれ以下になるまで次のanno_proc()を待つ[byte]
 
 #define M_RECVIDLE_RETRY_MAX    (5)         ///< 受信アイドル時キュー処理のリトライ最大
 
@@ -126,6 +130,28 @@
 #endif
 
 
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** @struct     anno_sent_t
+ *  @brief      #anno_proc()でのDB更新
+ *
+ * #anno_proc()はread-only transactionで検索し、DB更新は最後にまとめて行う。
+ */
+typedef struct {
+    utl_buf_t   cnl;            ///< 送信したchannel_announcement/channel_update: short_channel_id(8) + type(1)
+    utl_buf_t   node;           ///< 送信したnode_announcement: node_id
+    utl_buf_t   prune;          ///< 削除するchannel_update: short_channel_id(8) + type(1) + timestamp(4)
+    utl_push_t  push_cnl;
+    utl_push_t  push_node;
+    utl_push_t  push_prune;
+} anno_sent_t;
+
+#define M_SZ_ANNO_SENT_CNL      (sizeof(uint64_t) + 1)
+#define M_SZ_ANNO_SENT_PRUNE    (sizeof(uint64_t) + 1 + sizeof(uint32_t))
+
+
 /********************************************************************
  * static variables
  ********************************************************************/
@@ -147,28 +173,51 @@ static bool exchange_reestablish(lnapp_conf_t *p_conf);
 static bool exchange_funding_locked(lnapp_conf_t *p_conf);
 static bool send_open_channel(lnapp_conf_t *p_conf, const funding_conf_t *pFundingConf);
 
-static void *thread_recv_start(void *pArg);
+static void peer_ev_attach(lnapp_conf_t *p_conf);
+static void peer_ev_detach(lnapp_conf_t *p_conf);
+static void peer_ev_attach_cb(struct ev_loop *pLoop, void *pArg);
+static void peer_ev_detach_cb(struct ev_loop *pLoop, void *pArg);
+static void peer_ev_stop(struct ev_loop *pLoop, lnapp_conf_t *p_conf);
+static void peer_ev_update(struct ev_loop *pLoop, lnapp_conf_t *p_conf);
+static void cb_peer_start(struct ev_loop *pLoop, ev_timer *pTimer, int Revents);
+static void cb_peer_read(struct ev_loop *pLoop, ev_io *pWatcher, int Revents);
+static bool recv_message(struct ev_loop *pLoop, lnapp_conf_t *p_conf, uint8_t *pData, uint16_t Len);
+static void cb_peer_recv_timeout(struct ev_loop *pLoop, ev_timer *pTimer, int Revents);
+static void cb_peer_write(struct ev_loop *pLoop, ev_io *pWatcher, int Revents);
+static void cb_peer_wakeup(struct ev_loop *pLoop, ev_io *pWatcher, int Revents);
+static void cb_peer_idle(struct ev_loop *pLoop, ev_timer *pTimer, int Revents);
 static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uint32_t ToMsec);
+static void recv_idle_proc(lnapp_conf_t *p_conf);
+
+static void forward_register(lnapp_conf_t *p_conf);
+static void forward_wakeup(void *pParam);
+static void forward_wakeup_clear(lnapp_conf_t *p_conf);
 
-static void *thread_poll_start(void *pArg);
+static void cb_peer_poll(struct ev_loop *pLoop, ev_timer *pTimer, int Revents);
 static void poll_ping(lnapp_conf_t *p_conf);
 static void poll_funding_wait(lnapp_conf_t *p_conf);
 static void poll_normal_operating(lnapp_conf_t *p_conf);
 static void send_cnlupd_before_announce(lnapp_conf_t *p_conf);
 static bool send_announcement_signatures(lnapp_conf_t *p_conf);
 
-static void *thread_anno_start(void *pArg);
+static void cb_peer_anno(struct ev_loop *pLoop, ev_timer *pTimer, int Revents);
+static void anno_schedule(struct ev_loop *pLoop, lnapp_conf_t *p_conf, ev_tstamp Sec);
 #ifdef USE_GOSSIP_QUERY
 static void gossip_proc(lnapp_conf_t *p_conf);
 #endif
 static bool anno_proc(lnapp_conf_t *p_conf);
 static bool anno_senddata(
-    lnapp_conf_t *p_conf, utl_push_t *p_push,
+    lnapp_conf_t *p_conf, utl_push_t *p_push, anno_sent_t *p_sent,
     uint64_t short_channel_id, const utl_buf_t *p_buf_cnl,
     void *p_cur_cnl, void *p_cur_node, void *p_cur_infocnl, void *p_cur_infonode);
 static bool anno_prev_check(uint64_t short_channel_id, uint32_t timestamp);
-static bool anno_senddata_cnl(lnapp_conf_t *p_conf, utl_push_t *p_push, uint64_t short_channel_id, char type, void *p_cur_infocnl, const utl_buf_t *p_buf_cnl);
-static bool anno_senddata_node(lnapp_conf_t *p_conf, utl_push_t *p_push, void *p_cur_node, void *p_cur_infonode, const utl_buf_t *p_buf_cnl);
+static bool anno_senddata_cnl(lnapp_conf_t *p_conf, utl_push_t *p_push, anno_sent_t *p_sent, uint64_t short_channel_id, char type, void *p_cur_infocnl, const utl_buf_t *p_buf_cnl);
+static bool anno_senddata_node(lnapp_conf_t *p_conf, utl_push_t *p_push, anno_sent_t *p_sent, void *p_cur_node, void *p_cur_infonode, const utl_buf_t *p_buf_cnl);
+static void anno_sent_init(anno_sent_t *p_sent);
+static void anno_sent_free(anno_sent_t *p_sent);
+static void anno_sent_prune(anno_sent_t *p_sent, uint64_t short_channel_id, char type, uint32_t timestamp);
+static bool anno_sent_node_search(const anno_sent_t *p_sent, const uint8_t *p_node_id);
+static void anno_sent_save(lnapp_conf_t *p_conf, const anno_sent_t *p_sent);
 
 static void load_channel_settings(lnapp_conf_t *p_conf);
 static void load_announce_settings(void);
@@ -192,6 +241,128 @@ void lnapp_global_init(void)
 {
     //announcementデフォルト値
     load_announce_settings();
+
+    //peer I/O
+    long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    int thread_num = (cpu_num < 1) ? 1 : ((cpu_num > LNAPP_EV_THREAD_MAX) ? LNAPP_EV_THREAD_MAX : (int)cpu_num);
+    if (!lnapp_ev_start(thread_num)) {
+        LOGE("fail: lnapp_ev_start\n");
+    }
+}
+
+
+void lnapp_global_term(void)
+{
+    lnapp_ev_stop();
+}
+
+
+static void anno_sent_init(anno_sent_t *p_sent)
+{
+    utl_push_init(&p_sent->push_cnl, &p_sent->cnl, 0);
+    utl_push_init(&p_sent->push_node, &p_sent->node, 0);
+    utl_push_init(&p_sent->push_prune, &p_sent->prune, 0);
+}
+
+
+static void anno_sent_free(anno_sent_t *p_sent)
+{
+    utl_buf_free(&p_sent->cnl);
+    utl_buf_free(&p_sent->node);
+    utl_buf_free(&p_sent->prune);
+}
+
+
+static void anno_sent_prune(anno_sent_t *p_sent, uint64_t short_channel_id, char type, uint32_t timestamp)
+{
+    utl_push_u64be(&p_sent->push_prune, short_channel_id);
+    utl_push_byte(&p_sent->push_prune, (uint8_t)type);
+    utl_push_u32be(&p_sent->push_prune, timestamp);
+}
+
+
+static bool anno_sent_node_search(const anno_sent_t *p_sent, const uint8_t *p_node_id)
+{
+    for (uint32_t pos = 0; pos + BTC_SZ_PUBKEY <= p_sent->push_node.pos; pos += BTC_SZ_PUBKEY) {
+        if (memcmp(p_sent->node.buf + pos, p_node_id, BTC_SZ_PUBKEY) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+/** #anno_proc()のDB更新
+ *
+ * channel_updateの削除は、検索後に更新されていない(timestampが同じ)場合だけ行う。
+ *
+ * @param[in]   p_conf
+ * @param[in]   p_sent
+ */
+static void anno_sent_save(lnapp_conf_t *p_conf, const anno_sent_t *p_sent)
+{
+    void *p_cur_cnl = NULL;
+    void *p_cur_infocnl = NULL;
+    void *p_cur_infonode = NULL;
+
+    if ((p_sent->push_cnl.pos == 0) && (p_sent->push_node.pos == 0) && (p_sent->push_prune.pos == 0)) {
+        return;
+    }
+
+    if (!ln_db_anno_transaction()) {
+        LOGE("fail\n");
+        return;
+    }
+    if ( !ln_db_anno_cur_open(&p_cur_cnl, LN_DB_CUR_CNLANNO) ||
+         !ln_db_anno_cur_open(&p_cur_infocnl, LN_DB_CUR_CNLANNO_INFO) ||
+         !ln_db_anno_cur_open(&p_cur_infonode, LN_DB_CUR_NODEANNO_INFO) ) {
+        LOGE("fail\n");
+        goto LABEL_EXIT;
+    }
+
+    for (uint32_t pos = 0; pos + M_SZ_ANNO_SENT_PRUNE <= p_sent->push_prune.pos; pos += M_SZ_ANNO_SENT_PRUNE) {
+        const uint8_t *p = p_sent->prune.buf + pos;
+        uint64_t short_channel_id = utl_int_pack_u64be(p);
+        char type = (char)p[sizeof(uint64_t)];
+        uint32_t timestamp = utl_int_pack_u32be(p + sizeof(uint64_t) + 1);
+
+        uint64_t sci;
+        char type_db;
+        uint32_t timestamp_db;
+        bool ret = ln_db_cnlanno_cur_seek(p_cur_cnl, &sci, &type_db, &timestamp_db, NULL, short_channel_id);
+        while (ret && (sci == short_channel_id)) {
+            if (type_db == type) {
+                if (timestamp_db == timestamp) {
+                    ln_db_cnlanno_cur_del(p_cur_cnl);
+                }
+                break;
+            }
+            ret = ln_db_cnlanno_cur_get(p_cur_cnl, &sci, &type_db, &timestamp_db, NULL);
+        }
+    }
+    for (uint32_t pos = 0; pos + M_SZ_ANNO_SENT_CNL <= p_sent->push_cnl.pos; pos += M_SZ_ANNO_SENT_CNL) {
+        const uint8_t *p = p_sent->cnl.buf + pos;
+        ln_db_cnlanno_info_add_node_id(
+            p_cur_infocnl, utl_int_pack_u64be(p), (char)p[sizeof(uint64_t)], false, ln_remote_node_id(&p_conf->channel));
+    }
+    for (uint32_t pos = 0; pos + BTC_SZ_PUBKEY <= p_sent->push_node.pos; pos += BTC_SZ_PUBKEY) {
+        ln_db_nodeanno_info_add_node_id(
+            p_cur_infonode, p_sent->node.buf + pos, false, ln_remote_node_id(&p_conf->channel));
+    }
+
+LABEL_EXIT:
+    if (p_cur_infonode != NULL) {
+        ln_db_anno_cur_close(p_cur_infonode);
+    }
+    if (p_cur_infocnl != NULL) {
+        ln_db_anno_cur_close(p_cur_infocnl);
+    }
+    if (p_cur_cnl != NULL) {
+        ln_db_anno_cur_close(p_cur_cnl);
+    }
+    if (!ln_db_anno_commit(true)) {
+        LOGE("fail: commit\n");
+    }
 }
 
 
@@ -209,7 +380,11 @@ void lnapp_conf_init(
     pthread_mutex_init(&pAppConf->mux_th, NULL);
     pthread_mutex_t mux_conf = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
     memcpy(&pAppConf->mux_conf, &mux_conf, sizeof(mux_conf));
-    pthread_mutex_init(&pAppConf->mux_send, NULL);
+    lnapp_sendq_init(&pAppConf->sendq);
+    pAppConf->wakeup_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (pAppConf->wakeup_fd < 0) {
+        LOGE("fail: eventfd: %s\n", strerror(errno));
+    }
 
     load_channel_settings(pAppConf);
 
@@ -224,7 +399,10 @@ void lnapp_conf_term(lnapp_conf_t *pAppConf)
     pthread_cond_destroy(&pAppConf->cond);
     pthread_mutex_destroy(&pAppConf->mux_th);
     pthread_mutex_destroy(&pAppConf->mux_conf);
-    pthread_mutex_destroy(&pAppConf->mux_send);
+    lnapp_sendq_term(&pAppConf->sendq);
+    if (pAppConf->wakeup_fd >= 0) {
+        close(pAppConf->wakeup_fd);
+    }
 
     memset(pAppConf, 0x00, sizeof(lnapp_conf_t));
 }
@@ -240,12 +418,14 @@ void lnapp_conf_start(
     pAppConf->conn_port = ConnPort;
     pAppConf->noise = Noise;
     pAppConf->routesync = Routesync;
+    lnapp_sendq_clear(&pAppConf->sendq);
 
     pAppConf->active = true;
     pAppConf->flag_recv = 0;
     pAppConf->ping_counter = 1;   //send soon
 
     pAppConf->funding_waiting = false;
+    pAppConf->funding_check_req = false;
     pAppConf->funding_confirm = 0;
 
     pAppConf->last_anno_cnl = 0;
@@ -275,6 +455,7 @@ void lnapp_conf_stop(lnapp_conf_t *pAppConf)
         p = LIST_NEXT(p, list);
         UTL_DBG_FREE(p_bak);
     }
+    lnapp_sendq_clear(&pAppConf->sendq);
 
     UTL_DBG_FREE(pAppConf->p_errstr);
 }
@@ -352,6 +533,7 @@ void lnapp_stop(lnapp_conf_t *pAppConf)
         LOGD("stop lnapp: sock=%d\n", pAppConf->sock);
         pAppConf->active = false;
         pthread_cond_signal(&pAppConf->cond);
+        forward_wakeup(pAppConf);
         char str_sci[LN_SZ_SHORT_CHANNEL_ID_STR + 1];
         ln_short_channel_id_string(str_sci, ln_short_channel_id(&pAppConf->channel));
         LOGD("=========================================\n");
@@ -385,6 +567,12 @@ void lnapp_join(lnapp_conf_t *pAppConf)
 }
 
 
+void lnapp_wakeup(lnapp_conf_t *pAppConf)
+{
+    forward_wakeup(pAppConf);
+}
+
+
 bool lnapp_funding(lnapp_conf_t *pAppConf, const funding_conf_t *pFundingConf)
 {
     if ((!pAppConf->active) || !lnapp_is_inited(pAppConf)) {
@@ -453,6 +641,7 @@ bool lnapp_close_channel(lnapp_conf_t *pAppConf)
         p_str = "fail close: good way(local) start";
     }
     ptarmd_eventlog(ln_channel_id(p_channel), p_str);
+    lnapp_wakeup(pAppConf);     //shutdown送信
 
     ret = true;
 
@@ -498,6 +687,7 @@ void lnapp_set_feerate(lnapp_conf_t *pAppConf, uint32_t FeeratePerKw)
     if ((FeeratePerKw >= LN_FEERATE_PER_KW_MIN) && (pAppConf->feerate_per_kw != FeeratePerKw)) {
         pAppConf->feerate_per_kw = FeeratePerKw;    //use #recv_idle_proc()
         LOGD("feerate_per_kw=%" PRIu32 "\n", pAppConf->feerate_per_kw);
+        lnapp_wakeup(pAppConf);
     }
 }
 
@@ -633,22 +823,12 @@ void *lnapp_thread_channel_start(void *pArg)
 
     LOGD("[THREAD]ln_channel_t initialize\n");
 
-    pthread_t   th_recv;        //peer受信
-    pthread_t   th_poll;        //トランザクション監視
-    pthread_t   th_anno;        //announce
-
     p_conf->feerate_per_kw = ln_feerate_per_kw(p_channel);
 
     ln_status_t stat = ln_status_get(p_channel);
 
-    //peer受信スレッド
-    pthread_create(&th_recv, NULL, &thread_recv_start, p_conf);
-
-    //監視スレッド
-    pthread_create(&th_poll, NULL, &thread_poll_start, p_conf);
-
-    //announceスレッド
-    pthread_create(&th_anno, NULL, &thread_anno_start, p_conf);
+    //peer受信, 監視, announce
+    peer_ev_attach(p_conf);
 
     //BOLTメッセージ
     //  以下のパターンがあり得る
@@ -668,6 +848,7 @@ void *lnapp_thread_channel_start(void *pArg)
         goto LABEL_JOIN;
     }
     p_conf->flag_recv |= LNAPP_FLAGRECV_INIT_EXCHANGED;
+    forward_wakeup(p_conf);     //受信再開
 
     //送金先
     if (ln_shutdown_scriptpk_local(p_channel)->len == 0) {
@@ -776,6 +957,11 @@ void *lnapp_thread_channel_start(void *pArg)
     LOGD("*** message inited ***\n");
     p_conf->flag_recv |= LNAPP_FLAGRECV_END;
 
+    //HTLC転送の受付開始
+    if (ln_short_channel_id(p_channel)) {
+        forward_register(p_conf);
+    }
+
     // send `channel_update` for private/before publish channel
     send_cnlupd_before_announce(p_conf);
 
@@ -793,16 +979,32 @@ void *lnapp_thread_channel_start(void *pArg)
         LOGD("loop...\n");
 
         //mainloop待ち合わせ(*2)
-        pthread_cond_wait(&p_conf->cond, &p_conf->mux_conf);
+        if (!p_conf->funding_check_req) {
+            pthread_cond_wait(&p_conf->cond, &p_conf->mux_conf);
+        }
+
+        if (p_conf->active && p_conf->funding_check_req) {
+            //funding_locked受信を待つことがあるため、event loopでは行わない
+            p_conf->funding_check_req = false;
+            pthread_mutex_unlock(&p_conf->mux_conf);
+            poll_funding_wait(p_conf);
+            if (!send_announcement_signatures(p_conf)) {
+                LOGE("fail: send announcement_signatures\n");
+            }
+            pthread_mutex_lock(&p_conf->mux_conf);
+        }
     }
     pthread_mutex_unlock(&p_conf->mux_conf);
 
 LABEL_JOIN:
-    LOGD("stop threads...\n");
-    pthread_join(th_recv, NULL);
-    pthread_join(th_poll, NULL);
-    pthread_join(th_anno, NULL);
-    LOGD("join: recv, poll, anno\n");
+    LOGD("stop peer I/O...\n");
+    peer_ev_detach(p_conf);
+    LOGD("detach: peer I/O\n");
+
+    //以降はmonitoringの#ln_idle_proc_inactive()で処理する
+    if (ln_short_channel_id(p_channel)) {
+        ln_forward_unregister(ln_short_channel_id(p_channel));
+    }
 
     LOGD("close sock=%d...\n", p_conf->sock);
     retval = close(p_conf->sock);
@@ -852,12 +1054,25 @@ void *lnapp_thread_channel_origin_start(void *pArg)
 
     LOGD("\n");
 
+    forward_register(p_conf);
     while (p_conf->active) {
         pthread_mutex_lock(&p_conf->mux_conf);
         ln_idle_proc_origin(&p_conf->channel);
         pthread_mutex_unlock(&p_conf->mux_conf);
-        utl_thread_msleep(M_WAIT_RECV_TO_MSEC); //XXX: we should use `pthread_cond_wait`
+
+        //HTLC転送通知待ち(timeoutは再処理用)
+        struct pollfd fds;
+        fds.fd = p_conf->wakeup_fd;
+        fds.events = POLLIN;
+        int polr = poll(&fds, 1, M_WAIT_ORIGIN_TO_MSEC);
+        if (polr > 0) {
+            forward_wakeup_clear(p_conf);
+        } else if ((polr < 0) && (errno != EINTR)) {
+            LOGE("poll: %s\n", strerror(errno));
+            utl_thread_msleep(M_WAIT_RECV_TO_MSEC);
+        }
     }
+    ln_forward_unregister(0);
 
     lnapp_conf_stop(p_conf);
     lnapp_manager_free_node_ref(p_conf);
@@ -1040,6 +1255,10 @@ static bool set_short_channel_id(lnapp_conf_t *p_conf)
         ln_db_forward_add_htlc_create(ln_short_channel_id(&p_conf->channel));
         ln_db_forward_del_htlc_create(ln_short_channel_id(&p_conf->channel));
         ln_db_channel_owned_save(ln_short_channel_id(&p_conf->channel));
+        lnapp_manager_set_short_channel_id(p_conf->node_id, ln_short_channel_id(&p_conf->channel));
+        if (p_conf->flag_recv & LNAPP_FLAGRECV_END) {
+            forward_register(p_conf);
+        }
         LOGD("short_channel_id = %016" PRIx64 "(%d)\n", ln_short_channel_id(&p_conf->channel), ret);
     }
 
@@ -1210,103 +1429,348 @@ static bool send_open_channel(lnapp_conf_t *p_conf, const funding_conf_t *pFundi
 
 
 /********************************************************************
- * [THREAD]receive
+ * peer I/O(event loop)
  ********************************************************************/
 
-/** receive thread entry point
+/** peer I/Oのwatcher登録
  *
- * @param[in,out]   pArg    lnapp_conf_t*
+ * channel threadから呼び出す。
+ *
+ * @param[in,out]   p_conf
  */
-static void *thread_recv_start(void *pArg)
+static void peer_ev_attach(lnapp_conf_t *p_conf)
 {
-    utl_buf_t buf_recv = UTL_BUF_INIT;
-    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
+    p_conf->ev.idx = lnapp_ev_assign();
+    if (!lnapp_ev_call(p_conf->ev.idx, peer_ev_attach_cb, p_conf)) {
+        LOGE("fail: event loop\n");
+        lnapp_stop_threads(p_conf);
+    }
+}
+
 
-    LOGD("[THREAD]recv initialize: %d\n", p_conf->active);
+/** peer I/Oのwatcher削除
+ *
+ * channel threadから呼び出す。戻った後はloopからp_confを参照しない。
+ *
+ * @param[in,out]   p_conf
+ */
+static void peer_ev_detach(lnapp_conf_t *p_conf)
+{
+    if (p_conf->ev.attached) {
+        lnapp_ev_call(p_conf->ev.idx, peer_ev_detach_cb, p_conf);
+    }
+}
+
+
+static void peer_ev_attach_cb(struct ev_loop *pLoop, void *pArg)
+{
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
+    lnapp_peer_ev_t *p_ev = &p_conf->ev;
+
+    LOGD("[EV]attach: sock=%d, loop=%d\n", p_conf->sock, p_ev->idx);
+
+    //受信バッファは使い回し、同じ領域に復号する
+    //  ln_noise_dec_len()はuint16_tの長さを返す
+    p_ev->p_recv = (uint8_t *)UTL_DBG_MALLOC(UINT16_MAX);
+    p_ev->recv_need = LN_SZ_NOISE_HEADER;
+    p_ev->recv_len = 0;
+    p_ev->recv_body = false;
+    p_ev->recv_paused = false;
+    p_ev->anno_wait = false;
+
+    ev_io_init(&p_ev->io_read, cb_peer_read, p_conf->sock, EV_READ);
+    ev_io_init(&p_ev->io_write, cb_peer_write, p_conf->sock, EV_WRITE);
+    ev_timer_init(&p_ev->tm_recv, cb_peer_recv_timeout, 0., 0.);
+    ev_timer_init(&p_ev->tm_anno, cb_peer_anno, M_WAIT_ANNO_FIRST_SEC, 0.);
+    ev_timer_init(&p_ev->tm_poll, cb_peer_poll, M_WAIT_POLL_SEC, M_WAIT_POLL_SEC);
+    ev_timer_init(&p_ev->tm_idle, cb_peer_idle, M_WAIT_IDLE_MSEC / 1000., M_WAIT_IDLE_MSEC / 1000.);
+    p_ev->io_read.data = p_conf;
+    p_ev->io_write.data = p_conf;
+    p_ev->tm_recv.data = p_conf;
+    p_ev->tm_anno.data = p_conf;
+    p_ev->tm_poll.data = p_conf;
+    p_ev->tm_idle.data = p_conf;
 
     //init受信待ちの準備時間を設ける
-    utl_thread_msleep(M_WAIT_RECV_THREAD_MSEC);
+    ev_timer_init(&p_ev->tm_start, cb_peer_start, M_WAIT_RECV_THREAD_MSEC / 1000., 0.);
+    p_ev->tm_start.data = p_conf;
+    ev_timer_start(pLoop, &p_ev->tm_start);
+
+    if (p_conf->wakeup_fd >= 0) {
+        ev_io_init(&p_ev->io_wakeup, cb_peer_wakeup, p_conf->wakeup_fd, EV_READ);
+        p_ev->io_wakeup.data = p_conf;
+        ev_io_start(pLoop, &p_ev->io_wakeup);
+    }
+    ev_timer_start(pLoop, &p_ev->tm_anno);
+    ev_timer_start(pLoop, &p_ev->tm_poll);
+    ev_timer_start(pLoop, &p_ev->tm_idle);
+    p_ev->attached = true;
+}
 
-    while (p_conf->active) {
-        uint8_t head[LN_SZ_NOISE_HEADER];
-        uint16_t len = recv_peer(p_conf, head, LN_SZ_NOISE_HEADER, 0);
-        if (len == 0) {
-            //disconnected
-            LOGD("DISC: loop end\n");
-            break;
-        }
-        if (len != LN_SZ_NOISE_HEADER) {
-            LOGE("fail: ???\n");
-            break;
-        }
 
-        len = ln_noise_dec_len(&p_conf->noise, head, len);
+static void peer_ev_detach_cb(struct ev_loop *pLoop, void *pArg)
+{
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
+    lnapp_peer_ev_t *p_ev = &p_conf->ev;
 
-        utl_buf_free(&buf_recv);
-        utl_buf_alloc(&buf_recv, len);
-        uint16_t len_msg = recv_peer(p_conf, buf_recv.buf, len, M_WAIT_RESPONSE_MSEC);
-        if (len_msg == 0) {
-            //disconnected
-            LOGD("DISC: loop end\n");
-            break;
-        }
-        if (len_msg != len) {
-            LOGE("fail: ???\n");
-            break;
-        }
+    LOGD("[EV]detach: sock=%d, loop=%d\n", p_conf->sock, p_ev->idx);
+    peer_ev_stop(pLoop, p_conf);
+    UTL_DBG_FREE(p_ev->p_recv);
+    p_ev->attached = false;
+}
 
-        buf_recv.len = len;
-        if (!ln_noise_dec_msg(&p_conf->noise, &buf_recv)) {
-            LOGD("DECODE: loop end\n");
-            break;
+
+/** peer I/O停止
+ *
+ * watcherを全て止め、channel threadに終了を通知する。
+ *
+ * @param[in]       pLoop
+ * @param[in,out]   p_conf
+ */
+static void peer_ev_stop(struct ev_loop *pLoop, lnapp_conf_t *p_conf)
+{
+    lnapp_peer_ev_t *p_ev = &p_conf->ev;
+
+    ev_timer_stop(pLoop, &p_ev->tm_start);
+    ev_io_stop(pLoop, &p_ev->io_read);
+    ev_io_stop(pLoop, &p_ev->io_write);
+    ev_io_stop(pLoop, &p_ev->io_wakeup);
+    ev_timer_stop(pLoop, &p_ev->tm_recv);
+    ev_timer_stop(pLoop, &p_ev->tm_idle);
+    ev_timer_stop(pLoop, &p_ev->tm_poll);
+    ev_timer_stop(pLoop, &p_ev->tm_anno);
+    lnapp_stop_threads(p_conf);
+}
+
+
+/** 各処理の後始末
+ *
+ * 送信キューに未送信が残っていれば書き込み待ちを開始し、
+ * announcementが送信キュー待ちであれば再開する。
+ *
+ * @param[in]       pLoop
+ * @param[in,out]   p_conf
+ */
+static void peer_ev_update(struct ev_loop *pLoop, lnapp_conf_t *p_conf)
+{
+    lnapp_peer_ev_t *p_ev = &p_conf->ev;
+
+    if (!p_conf->active) {
+        peer_ev_stop(pLoop, p_conf);
+        return;
+    }
+    if (lnapp_sendq_pending(&p_conf->sendq)) {
+        if (!ev_is_active(&p_ev->io_write)) {
+            ev_io_start(pLoop, &p_ev->io_write);
         }
+    } else {
+        ev_io_stop(pLoop, &p_ev->io_write);
+    }
+    if (p_ev->anno_wait &&
+        (lnapp_sendq_bytes(&p_conf->sendq, LNAPP_SENDQ_LANE_BULK) <= M_ANNO_SNDQ_MAX)) {
+        //送信が進んだらすぐに続きを行う
+        p_ev->anno_wait = false;
+        anno_schedule(pLoop, p_conf, 0);
+    }
+}
 
-        uint16_t type = utl_int_pack_u16be(buf_recv.buf);
-        LOGD("[RECV]type=%04x(%s): sock=%d, Len=%d\n", type, ln_msg_name(type), p_conf->sock, buf_recv.len);
 
-        pthread_mutex_lock(&p_conf->mux_conf); //lock
+/** 受信開始
+ *
+ */
+static void cb_peer_start(struct ev_loop *pLoop, ev_timer *pTimer, int Revents)
+{
+    (void)Revents;
 
-        if (ln_status_is_closing(&p_conf->channel)) {
-            LOGD("???\n");
-            pthread_mutex_unlock(&p_conf->mux_conf); //unlock
-            break;
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pTimer->data;
+    LOGD("[EV]recv start: %d\n", p_conf->active);
+    ev_io_start(pLoop, &p_conf->ev.io_read);
+}
+
+
+/** peer受信
+ *
+ * headerとmessageを受信できた分だけ処理する。
+ */
+static void cb_peer_read(struct ev_loop *pLoop, ev_io *pWatcher, int Revents)
+{
+    (void)Revents;
+
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pWatcher->data;
+    lnapp_peer_ev_t *p_ev = &p_conf->ev;
+
+    while (p_conf->active && !p_ev->recv_paused) {
+        uint8_t *p_buf = (p_ev->recv_body) ? p_ev->p_recv : p_ev->head;
+        ssize_t n = read(p_conf->sock, p_buf + p_ev->recv_len, p_ev->recv_need - p_ev->recv_len);
+        if (n == 0) {
+            //disconnected
+            LOGD("DISC: loop end\n");
+            goto LABEL_STOP;
         }
-        if (!ln_recv(&p_conf->channel, buf_recv.buf, buf_recv.len)) {
-            LOGD("DISC: fail recv message\n");
-            if (strlen(p_conf->channel.err_msg) != 0) {
-                ptarmd_eventlog(ln_channel_id(&p_conf->channel), p_conf->channel.err_msg);
+        if (n < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+                break;
             }
-            lnapp_close_channel_force(p_conf);
-            pthread_mutex_unlock(&p_conf->mux_conf); //unlock
-            break;
+            if (errno == EINTR) {
+                continue;
+            }
+            LOGE("fail: %s(%016" PRIx64 ")\n", strerror(errno), ln_short_channel_id(&p_conf->channel));
+            goto LABEL_STOP;
+        }
+        p_ev->recv_len += (uint16_t)n;
+        if (p_ev->recv_len < p_ev->recv_need) {
+            continue;
         }
 
-        if (type == MSGTYPE_INIT) {
-            LOGD("$$$ init exchange...\n");
-            uint32_t count = M_WAIT_RESPONSE_MSEC / M_WAIT_RECV_MSG_MSEC;
-            uint32_t lp;
-            for (lp = 0; lp < count; lp++) {
-                if (!p_conf->active) break;
-                if (p_conf->flag_recv & LNAPP_FLAGRECV_INIT_EXCHANGED) {
-                    LOGD("$$$ init exchanged\n");
-                    break;
-                }
-                utl_thread_msleep(M_WAIT_RECV_MSG_MSEC);
+        p_ev->recv_len = 0;
+        if (!p_ev->recv_body) {
+            uint16_t len = ln_noise_dec_len(&p_conf->noise, p_ev->head, LN_SZ_NOISE_HEADER);
+            if (len == 0) {
+                LOGE("fail: ???\n");
+                goto LABEL_STOP;
             }
-            if (count == lp) {
-                LOGE("fail: init exchange timeout\n");
-                pthread_mutex_unlock(&p_conf->mux_conf); //unlock
-                break;
+            p_ev->recv_need = len;
+            p_ev->recv_body = true;
+            ev_timer_set(&p_ev->tm_recv, M_WAIT_RESPONSE_MSEC / 1000., 0.);
+            ev_timer_start(pLoop, &p_ev->tm_recv);
+        } else {
+            ev_timer_stop(pLoop, &p_ev->tm_recv);
+            uint16_t len = p_ev->recv_need;
+            p_ev->recv_need = LN_SZ_NOISE_HEADER;
+            p_ev->recv_body = false;
+            if (!recv_message(pLoop, p_conf, p_ev->p_recv, len)) {
+                goto LABEL_STOP;
             }
         }
+    }
+
+    recv_idle_proc(p_conf);
+    peer_ev_update(pLoop, p_conf);
+    return;
+
+LABEL_STOP:
+    peer_ev_stop(pLoop, p_conf);
+}
+
+
+/** peer受信message処理
+ *
+ * @param[in]       pLoop
+ * @param[in,out]   p_conf
+ * @param[in,out]   pData       暗号化したmessage + MAC(同じ領域に復号する)
+ * @param[in]       Len         pData長
+ * @retval  false   切断する
+ */
+static bool recv_message(struct ev_loop *pLoop, lnapp_conf_t *p_conf, uint8_t *pData, uint16_t Len)
+{
+    if (!ln_noise_dec_frame(&p_conf->noise, pData, Len)) {
+        LOGD("DECODE: loop end\n");
+        return false;
+    }
+    Len -= LN_SZ_NOISE_MAC;
+
+    uint16_t type = utl_int_pack_u16be(pData);
+    LOGD("[RECV]type=%04x(%s): sock=%d, Len=%d\n", type, ln_msg_name(type), p_conf->sock, Len);
 
+    pthread_mutex_lock(&p_conf->mux_conf); //lock
+
+    if (ln_status_is_closing(&p_conf->channel)) {
+        LOGD("???\n");
+        pthread_mutex_unlock(&p_conf->mux_conf); //unlock
+        return false;
+    }
+    if (!ln_recv(&p_conf->channel, pData, Len)) {
+        LOGD("DISC: fail recv message\n");
+        if (strlen(p_conf->channel.err_msg) != 0) {
+            ptarmd_eventlog(ln_channel_id(&p_conf->channel), p_conf->channel.err_msg);
+        }
+        lnapp_close_channel_force(p_conf);
         pthread_mutex_unlock(&p_conf->mux_conf); //unlock
+        return false;
     }
 
-    lnapp_stop_threads(p_conf);
-    utl_buf_free(&buf_recv);
-    LOGD("[exit]recv thread\n");
-    return NULL;
+    if ((type == MSGTYPE_INIT) && ((p_conf->flag_recv & LNAPP_FLAGRECV_INIT_EXCHANGED) == 0)) {
+        //channel threadのinit交換完了まで、次のmessageを処理しない
+        LOGD("$$$ init exchange...\n");
+        p_conf->ev.recv_paused = true;
+        ev_io_stop(pLoop, &p_conf->ev.io_read);
+        ev_timer_set(&p_conf->ev.tm_recv, M_WAIT_RESPONSE_MSEC / 1000., 0.);
+        ev_timer_start(pLoop, &p_conf->ev.tm_recv);
+    }
+
+    pthread_mutex_unlock(&p_conf->mux_conf); //unlock
+    return true;
+}
+
+
+/** message途中/init交換待ちのタイムアウト
+ *
+ */
+static void cb_peer_recv_timeout(struct ev_loop *pLoop, ev_timer *pTimer, int Revents)
+{
+    (void)Revents;
+
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pTimer->data;
+    if (p_conf->ev.recv_paused) {
+        LOGE("fail: init exchange timeout\n");
+    } else {
+        LOGE("fail: timeout(len=%d, reqLen=%d)\n", p_conf->ev.recv_len, p_conf->ev.recv_need);
+    }
+    peer_ev_stop(pLoop, p_conf);
+}
+
+
+/** 送信キュー送信
+ *
+ */
+static void cb_peer_write(struct ev_loop *pLoop, ev_io *pWatcher, int Revents)
+{
+    (void)Revents;
+
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pWatcher->data;
+    if (!lnapp_sendq_flush(&p_conf->sendq, p_conf->sock, &p_conf->noise)) {
+        LOGE("fail: send peer flush\n");
+        peer_ev_stop(pLoop, p_conf);
+        return;
+    }
+    peer_ev_update(pLoop, p_conf);
+}
+
+
+/** wakeup_fd通知
+ *
+ * HTLC転送通知, 停止要求, init交換完了, 他threadからの送信。
+ */
+static void cb_peer_wakeup(struct ev_loop *pLoop, ev_io *pWatcher, int Revents)
+{
+    (void)Revents;
+
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pWatcher->data;
+    lnapp_peer_ev_t *p_ev = &p_conf->ev;
+
+    forward_wakeup_clear(p_conf);
+    if (p_ev->recv_paused && (p_conf->flag_recv & LNAPP_FLAGRECV_INIT_EXCHANGED)) {
+        LOGD("$$$ init exchanged\n");
+        p_ev->recv_paused = false;
+        ev_timer_stop(pLoop, &p_ev->tm_recv);
+        ev_io_start(pLoop, &p_ev->io_read);
+    }
+    //HTLC転送通知: socket受信中でも転送を遅らせない
+    recv_idle_proc(p_conf);
+    peer_ev_update(pLoop, p_conf);
+}
+
+
+/** #ln_idle_proc()の再処理
+ *
+ */
+static void cb_peer_idle(struct ev_loop *pLoop, ev_timer *pTimer, int Revents)
+{
+    (void)Revents;
+
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pTimer->data;
+    recv_idle_proc(p_conf);
+    peer_ev_update(pLoop, p_conf);
 }
 
 
@@ -1314,7 +1778,7 @@ static void *thread_recv_start(void *pArg)
  *
  * @param[in]   ToMsec      受信タイムアウト(0の場合、タイムアウト無し)
  * @note
- *      - called by #thread_recv_start(), #noise_handshake()
+ *      - called by #noise_handshake()
  */
 static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uint32_t ToMsec)
 {
@@ -1327,6 +1791,7 @@ static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uin
     while (p_conf->active && (Len > 0)) {
         fds.fd = p_conf->sock;
         fds.events = POLLIN;
+        fds.revents = 0;
         int polr = poll(&fds, 1, M_WAIT_RECV_TO_MSEC);
         if (polr < 0) {
             LOGD("poll: %s\n", strerror(errno));
@@ -1335,14 +1800,6 @@ static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uin
             }
         } else if (polr == 0) {
             //timeout
-
-            pthread_mutex_lock(&p_conf->mux_conf);
-            if ((p_conf->flag_recv & LNAPP_FLAGRECV_END) == LNAPP_FLAGRECV_END &&
-                !ln_status_is_closing(&p_conf->channel)) {
-                ln_idle_proc(&p_conf->channel, p_conf->feerate_per_kw);
-            }
-            pthread_mutex_unlock(&p_conf->mux_conf);
-
             if (ToMsec > 0) {
                 ToMsec--;
                 if (ToMsec == 0) {
@@ -1350,21 +1807,19 @@ static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uin
                     break;
                 }
             }
-        } else {
-            if (fds.revents & POLLIN) {
-                ssize_t n = read(p_conf->sock, pBuf, Len);
-                if (n > 0) {
-                    Len -= n;
-                    len += n;
-                    pBuf += n;
-                } else if (n == 0) {
-                    LOGE("fail: timeout(len=%d, reqLen=%d)\n", len, Len);
-                    break;
-                } else {
-                    LOGE("fail: %s(%016" PRIx64 ")\n", strerror(errno), ln_short_channel_id(&p_conf->channel));
-                    len = 0;
-                    break;
-                }
+        } else if (fds.revents & POLLIN) {
+            ssize_t n = read(p_conf->sock, pBuf, Len);
+            if (n > 0) {
+                Len -= n;
+                len += n;
+                pBuf += n;
+            } else if (n == 0) {
+                LOGE("fail: timeout(len=%d, reqLen=%d)\n", len, Len);
+                break;
+            } else {
+                LOGE("fail: %s(%016" PRIx64 ")\n", strerror(errno), ln_short_channel_id(&p_conf->channel));
+                len = 0;
+                break;
             }
         }
     }
@@ -1373,58 +1828,114 @@ static uint16_t recv_peer(lnapp_conf_t *p_conf, uint8_t *pBuf, uint16_t Len, uin
 }
 
 
+/** 受信待ち中のidle処理
+ *
+ * @param[in,out]   p_conf
+ */
+static void recv_idle_proc(lnapp_conf_t *p_conf)
+{
+    pthread_mutex_lock(&p_conf->mux_conf);
+    if ((p_conf->flag_recv & LNAPP_FLAGRECV_END) == LNAPP_FLAGRECV_END &&
+        !ln_status_is_closing(&p_conf->channel)) {
+        ln_idle_proc(&p_conf->channel, p_conf->feerate_per_kw);
+    }
+    pthread_mutex_unlock(&p_conf->mux_conf);
+}
+
+
 /********************************************************************
- * [THREAD]polling
+ * HTLC転送通知
  ********************************************************************/
 
-/** polling thread entry point
+/** HTLC転送通知の受付開始
  *
- * @param[in,out]   pArg    lnapp_conf_t*
+ * @param[in,out]   p_conf
  */
-static void *thread_poll_start(void *pArg)
+static void forward_register(lnapp_conf_t *p_conf)
 {
-    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
+    ln_forward_register(ln_short_channel_id(&p_conf->channel), forward_wakeup, p_conf);
+}
 
-    LOGD("[THREAD]poll initialize: %d\n", p_conf->active);
 
-    while (p_conf->active) {
-        //ループ解除まで時間が長くなるので、短くチェックする
-        for (int lp = 0; lp < M_WAIT_POLL_SEC; lp++) {
-            sleep(1);
-            if (!p_conf->active) {
-                break;
-            }
+/** HTLC転送通知(#ln_forward_wakeup_t)
+ *
+ * 通知元channelのthreadから呼ばれるため、lockを取得しない。
+ *
+ * @param[in]   pParam      lnapp_conf_t*
+ */
+static void forward_wakeup(void *pParam)
+{
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pParam;
+    uint64_t val = 1;
+
+    if (p_conf->wakeup_fd < 0) return;
+    if (write(p_conf->wakeup_fd, &val, sizeof(val)) != sizeof(val)) {
+        //EAGAIN: 通知済み
+        if (errno != EAGAIN) {
+            LOGE("fail: write eventfd: %s\n", strerror(errno));
         }
+    }
+}
 
-        if ((p_conf->flag_recv & LNAPP_FLAGRECV_INIT) == 0) {
-            //まだ接続していない
-            continue;
-        }
 
-        poll_ping(p_conf);
+/** HTLC転送通知のクリア
+ *
+ * @param[in,out]   p_conf
+ */
+static void forward_wakeup_clear(lnapp_conf_t *p_conf)
+{
+    uint64_t val;
 
-        if (ln_status_get(&p_conf->channel) < LN_STATUS_ESTABLISH) {
-            //fundingしていない
-            continue;
-        }
+    ssize_t sz = read(p_conf->wakeup_fd, &val, sizeof(val));
+    (void)sz;   //EAGAIN: 通知なし
+}
 
-        //funding_tx
-        if (p_conf->funding_waiting) {
-            //funding_tx確定待ち(確定後はEstablishシーケンスの続きを行う)
-            poll_funding_wait(p_conf);
-        } else {
-            //Normal Operation中
-            poll_normal_operating(p_conf);
-        }
 
-        if (!send_announcement_signatures(p_conf)) {
-            break;
-        }
+/********************************************************************
+ * polling
+ ********************************************************************/
+
+/** polling(M_WAIT_POLL_SEC周期)
+ *
+ */
+static void cb_peer_poll(struct ev_loop *pLoop, ev_timer *pTimer, int Revents)
+{
+    (void)Revents;
+
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pTimer->data;
+
+    if ((p_conf->flag_recv & LNAPP_FLAGRECV_INIT) == 0) {
+        //まだ接続していない
+        goto LABEL_EXIT;
     }
 
-    LOGD("[exit]poll thread\n");
+    poll_ping(p_conf);
 
-    return NULL;
+    if (ln_status_get(&p_conf->channel) < LN_STATUS_ESTABLISH) {
+        //fundingしていない
+        goto LABEL_EXIT;
+    }
+
+    //funding_tx
+    if (p_conf->funding_waiting) {
+        //funding_tx確定待ち(確定後はEstablishシーケンスの続きを行う)
+        //  funding_locked受信を待つため、channel threadで行う
+        pthread_mutex_lock(&p_conf->mux_conf);
+        p_conf->funding_check_req = true;
+        pthread_cond_signal(&p_conf->cond);
+        pthread_mutex_unlock(&p_conf->mux_conf);
+        goto LABEL_EXIT;
+    }
+
+    //Normal Operation中
+    poll_normal_operating(p_conf);
+
+    if (!send_announcement_signatures(p_conf)) {
+        ev_timer_stop(pLoop, pTimer);
+    }
+
+LABEL_EXIT:
+    peer_ev_update(pLoop, p_conf);
 }
 
 
@@ -1594,71 +2105,77 @@ static void send_cnlupd_before_announce(lnapp_conf_t *p_conf)
 
 
 /********************************************************************
- * announceスレッド
+ * announcement送信
  ********************************************************************/
 
-/** announceスレッド開始
+/** announcement送信
  *
- * @param[in,out]   pArg    lnapp_conf_t*
  */
-static void *thread_anno_start(void *pArg)
+static void cb_peer_anno(struct ev_loop *pLoop, ev_timer *pTimer, int Revents)
 {
-    lnapp_conf_t *p_conf = (lnapp_conf_t *)pArg;
-    int slp = M_WAIT_ANNO_FIRST_SEC;
-    bool first = true;
+    (void)Revents;
 
-    LOGD("[THREAD]anno initialize: %d\n", p_conf->active);
-
-    while (p_conf->active) {
-        for (int lp = 0; lp < slp; lp++) {
-            sleep(1);
-            if (!p_conf->active) {
-                break;
-            }
-            // if (p_conf->annodb_updated) {
-            //     break;
-            // }
-        }
-        if (first) {
-            first = false;
-            slp = M_WAIT_ANNO_SEC;
-        }
+    lnapp_conf_t *p_conf = (lnapp_conf_t *)pTimer->data;
+    ev_tstamp slp = M_WAIT_ANNO_SEC;
+    time_t now;
+    bool skip;
+    bool retcnl;
 
-        if ((p_conf->flag_recv & LNAPP_FLAGRECV_END) == 0) {
-            //まだ接続完了していない
-            continue;
-        }
-        time_t now = utl_time_time();
-        if (p_conf->annodb_updated && p_conf->annodb_cont && (now - p_conf->annodb_stamp < LNAPP_WAIT_ANNO_HYSTER_SEC)) {
-            LOGD("skip\n");
-            continue;
-        }
+    if ((p_conf->flag_recv & LNAPP_FLAGRECV_END) == 0) {
+        //まだ接続完了していない
+        goto LABEL_EXIT;
+    }
+    now = utl_time_time();
+    pthread_mutex_lock(&p_conf->mux_conf);
+    skip = p_conf->annodb_updated && p_conf->annodb_cont && (now - p_conf->annodb_stamp < LNAPP_WAIT_ANNO_HYSTER_SEC);
+    pthread_mutex_unlock(&p_conf->mux_conf);
+    if (skip) {
+        LOGD("skip\n");
+        goto LABEL_EXIT;
+    }
 
 #ifdef USE_GOSSIP_QUERY
-        gossip_proc(p_conf);
+    gossip_proc(p_conf);
 #endif
 
-        bool retcnl = anno_proc(p_conf);
-        if (retcnl) {
-            //channel_listの最後まで見終わった
-            if (p_conf->annodb_updated) {
-                //annodb was updated, so anno_proc() will be done again.
-                // since updating annodb may have been in the middle of anno_proc().
-                p_conf->annodb_updated = false;
-                slp = M_WAIT_ANNO_SEC;
-            } else {
-                //次までを長くあける
-                slp = M_WAIT_ANNO_LONG_SEC;
-            }
-        } else {
-            //channel_listの途中-->すぐに続きを行う
+    retcnl = anno_proc(p_conf);
+    if (retcnl) {
+        //channel_listの最後まで見終わった
+        pthread_mutex_lock(&p_conf->mux_conf);
+        if (p_conf->annodb_updated) {
+            //annodb was updated, so anno_proc() will be done again.
+            // since updating annodb may have been in the middle of anno_proc().
+            p_conf->annodb_updated = false;
             slp = M_WAIT_ANNO_SEC;
+        } else {
+            //次までを長くあける
+            slp = M_WAIT_ANNO_LONG_SEC;
         }
+        pthread_mutex_unlock(&p_conf->mux_conf);
+    } else {
+        //channel_listの途中-->送信が進んだらすぐに続きを行う(#peer_ev_update())
+        //  送信が進まない場合はM_WAIT_ANNO_LONG_SEC後に続きを行う
+        p_conf->ev.anno_wait = true;
+        slp = M_WAIT_ANNO_LONG_SEC;
     }
 
-    LOGD("[exit]anno thread\n");
+LABEL_EXIT:
+    anno_schedule(pLoop, p_conf, slp);
+    peer_ev_update(pLoop, p_conf);
+}
 
-    return NULL;
+
+/** 次回announcement送信の設定
+ *
+ * @param[in]       pLoop
+ * @param[in,out]   p_conf
+ * @param[in]       Sec         次回までの時間[sec]
+ */
+static void anno_schedule(struct ev_loop *pLoop, lnapp_conf_t *p_conf, ev_tstamp Sec)
+{
+    ev_timer_stop(pLoop, &p_conf->ev.tm_anno);
+    ev_timer_set(&p_conf->ev.tm_anno, Sec, 0.);
+    ev_timer_start(pLoop, &p_conf->ev.tm_anno);
 }
 
 
@@ -1693,8 +2210,11 @@ static void gossip_proc(lnapp_conf_t *p_conf)
 /** channel_announcement/channel_update/node_announcement送信
  *
  * 接続先へ未送信のchannel_announcement/channel_updateを送信する。
- * 一度にすべて送信するとDBのロック期間が長くなるため、
- * 最大M_ANNO_UNITパケットまで送信を行い、残りは次回呼び出しに行う。
+ * 検索はread-only transactionで行うため、他のpeerやannouncementの保存を止めない。
+ * 送信済みDBの更新と古いchannel_updateの削除は、検索後に短いtransactionでまとめて行う。
+ * 最大M_ANNO_UNIT channel(M_ANNO_BATCH_BYTES)まで送信を行い、残りは次回呼び出しに行う。
+ * 次回はlast_anno_cnlの次のshort_channel_idから検索を再開する。
+ * 送信はDBのtransactionを終了してから行う。
  *
  * @param[in,out]   p_conf  lnapp情報
  * @retval  true    リストの最後まで終わった
@@ -1708,19 +2228,21 @@ static bool anno_proc(lnapp_conf_t *p_conf)
     void *p_cur_node = NULL;        //node_announcement
     void *p_cur_infocnl = NULL;     //channel送信済みDB
     void *p_cur_infonode = NULL;    //node_announcement送信済みDB
+    bool read_begin = false;
     utl_buf_t buf_annos = UTL_BUF_INIT;
     utl_push_t push_annos;
     utl_push_init(&push_annos, &buf_annos, 0);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
 
     LOGD("BEGIN: last=%" PRIx64 "\n", p_conf->last_anno_cnl);
 
-    ret = ln_db_anno_transaction();
+    ret = ln_db_anno_read_begin();
     if (!ret) {
         LOGE("fail\n");
         goto LABEL_EXIT;
     }
-
-    LOGD("BEGIN 2(locked): last=%" PRIx64 "\n", p_conf->last_anno_cnl);
+    read_begin = true;
 
     ret = ln_db_anno_cur_open(&p_cur_cnl, LN_DB_CUR_CNLANNO);
     if (!ret) {
@@ -1751,7 +2273,13 @@ static bool anno_proc(lnapp_conf_t *p_conf)
         uint32_t timestamp;
         utl_buf_t buf_cnl = UTL_BUF_INIT;
 
-        ret = ln_db_cnlanno_cur_get(p_cur_cnl, &short_channel_id, &type, &timestamp, &buf_cnl);
+        if (p_conf->last_anno_cnl != 0) {
+            //前回の続き
+            ret = ln_db_cnlanno_cur_seek(p_cur_cnl, &short_channel_id, &type, &timestamp, &buf_cnl, p_conf->last_anno_cnl + 1);
+            p_conf->last_anno_cnl = 0;
+        } else {
+            ret = ln_db_cnlanno_cur_get(p_cur_cnl, &short_channel_id, &type, &timestamp, &buf_cnl);
+        }
         if (!ret) {
             //次回は最初から検索する
             LOGD("annolist end\n");
@@ -1764,24 +2292,13 @@ static bool anno_proc(lnapp_conf_t *p_conf)
             if ((type == LN_DB_CNLANNO_UPD0) || (type == LN_DB_CNLANNO_UPD1)) {
                 uint64_t now = (uint64_t)utl_time_time();
                 if (ln_db_cnlupd_need_to_prune(now, timestamp)) {
-                    ln_db_cnlanno_cur_del(p_cur_cnl);
+                    anno_sent_prune(&sent, short_channel_id, type, timestamp);
                 }
             }
             //LOGD("continue1: %" PRIx64 ":%c\n", short_channel_id, type);
             utl_buf_free(&buf_cnl);
             continue;
         }
-        if (p_conf->last_anno_cnl != 0) {
-            //前回の続きであれば、次のshort_channel_idになるまで進める
-            if (p_conf->last_anno_cnl == short_channel_id) {
-                //1回だけ多く回すと、次回はここをスルーする
-                //LOGD("match\n");
-                p_conf->last_anno_cnl = 0;
-            }
-            utl_buf_free(&buf_cnl);
-            continue;
-        }
-
         //buf_cnlにはshort_channel_idのchannel_announcement packetが入っている
 
 #if 0 //XXX: takes a long time to complete?
@@ -1794,15 +2311,15 @@ static bool anno_proc(lnapp_conf_t *p_conf)
         }
 #endif
 
-        ret = anno_senddata(p_conf, &push_annos, short_channel_id, &buf_cnl, p_cur_cnl, p_cur_node, p_cur_infocnl, p_cur_infonode);
+        ret = anno_senddata(p_conf, &push_annos, &sent, short_channel_id, &buf_cnl, p_cur_cnl, p_cur_node, p_cur_infocnl, p_cur_infonode);
         utl_buf_free(&buf_cnl);
         if (ret) {
             anno_cnt++;
-            if (anno_cnt > M_ANNO_UNIT) {
-                LOGD("annolist next\n");
-                p_conf->last_anno_cnl = short_channel_id;
-                break;
-            }
+        }
+        if ((anno_cnt >= M_ANNO_UNIT) || (buf_annos.len >= M_ANNO_BATCH_BYTES)) {
+            LOGD("annolist next\n");
+            p_conf->last_anno_cnl = short_channel_id;
+            break;
         }
     }
     short_channel_id = 0;
@@ -1820,8 +2337,12 @@ LABEL_EXIT:
     if (p_cur_cnl != NULL) {
         ln_db_anno_cur_close(p_cur_cnl);
     }
+    if (read_begin) {
+        ln_db_anno_read_end();
+    }
 
-    ln_db_anno_commit(true);
+    anno_sent_save(p_conf, &sent);
+    anno_sent_free(&sent);
     if (short_channel_id != 0) {
         (void)ln_db_cnlanno_del(short_channel_id);
     }
@@ -1834,8 +2355,8 @@ LABEL_EXIT:
             p_data += sizeof(uint16_t);
             len -= sizeof(uint16_t);
             const utl_buf_t buf = { .buf=(CONST_CAST uint8_t *)p_data, .len=data_len };
-            if (!lnapp_send_peer_noise(p_conf, &buf)) {
-                LOGE("fail: send peer noise\n");
+            if (!lnapp_send_peer_queue(p_conf, &buf)) {
+                LOGE("fail: send peer queue\n");
                 lnapp_stop_threads(p_conf);
                 break;
             }
@@ -1843,6 +2364,11 @@ LABEL_EXIT:
             len -= data_len;
         }
         utl_buf_free(&buf_annos);
+        //まとめて送信し、残りはevent loopが送信可能になったときに送信する
+        if (p_conf->active && !lnapp_send_peer_flush(p_conf)) {
+            LOGE("fail: send peer flush\n");
+            lnapp_stop_threads(p_conf);
+        }
     }
 
     LOGD("END: %016" PRIx64 "\n", p_conf->last_anno_cnl);
@@ -1854,6 +2380,8 @@ LABEL_EXIT:
  *  channel_announcement, channel_update(dir=0,1), node_announcement(0,1)
  *
  * @param[in]   p_conf
+ * @param[out]  p_push                  送信データ
+ * @param[out]  p_sent                  DB更新
  * @param[in]   short_channel_id
  * @param[in]   p_buf_cnl               channel_announcement packet
  * @param[in]   p_cur_cnl               DB
@@ -1866,6 +2394,7 @@ LABEL_EXIT:
 static bool anno_senddata(
     lnapp_conf_t *p_conf,
     utl_push_t *p_push,
+    anno_sent_t *p_sent,
     uint64_t short_channel_id,
     const utl_buf_t *p_buf_cnl,
     void *p_cur_cnl,
@@ -1887,7 +2416,7 @@ static bool anno_senddata(
             } else {
                 LOGD("pre_upd: delete channel_update %016" PRIx64 " %c\n", short_channel_id, type);
                 //channel_updateをDBから削除
-                ln_db_cnlanno_cur_del(p_cur_cnl);
+                anno_sent_prune(p_sent, short_channel_id, type, timestamp);
                 utl_buf_free(&buf_upd[lp]);
             }
         } else if (!ret) {
@@ -1902,19 +2431,19 @@ static bool anno_senddata(
     }
     if (cnt_upd > 0) {
         //channel_announcement
-        anno_senddata_cnl(p_conf, p_push, short_channel_id, LN_DB_CNLANNO_ANNO, p_cur_infocnl, p_buf_cnl);
+        anno_senddata_cnl(p_conf, p_push, p_sent, short_channel_id, LN_DB_CNLANNO_ANNO, p_cur_infocnl, p_buf_cnl);
 
         //channel_update
         for (size_t lp = 0; lp < ARRAY_SIZE(buf_upd); lp++) {
             if (buf_upd[lp].len > 0) {
-                anno_senddata_cnl(p_conf, p_push, short_channel_id, LN_DB_CNLANNO_UPD0 + lp, p_cur_infocnl, &buf_upd[lp]);
+                anno_senddata_cnl(p_conf, p_push, p_sent, short_channel_id, LN_DB_CNLANNO_UPD0 + lp, p_cur_infocnl, &buf_upd[lp]);
             } else {
                 LOGD("skip: type=%c\n", LN_DB_CNLANNO_UPD0 + lp);
             }
         }
 
         //node_announcement
-        anno_senddata_node(p_conf, p_push, p_cur_node, p_cur_infonode, p_buf_cnl);
+        anno_senddata_node(p_conf, p_push, p_sent, p_cur_node, p_cur_infonode, p_buf_cnl);
     } else {
         LOGD("skip channel: %" PRIx64 "\n", short_channel_id);
     }
@@ -1958,14 +2487,15 @@ static bool anno_prev_check(uint64_t short_channel_id, uint32_t timestamp)
  *
  * @return  送信数
  */
-static bool anno_senddata_cnl(lnapp_conf_t *p_conf, utl_push_t *p_push, uint64_t short_channel_id, char type, void *p_cur_infocnl, const utl_buf_t *p_buf_cnl)
+static bool anno_senddata_cnl(lnapp_conf_t *p_conf, utl_push_t *p_push, anno_sent_t *p_sent, uint64_t short_channel_id, char type, void *p_cur_infocnl, const utl_buf_t *p_buf_cnl)
 {
     bool chk = ln_db_cnlanno_info_search_node_id(p_cur_infocnl, short_channel_id, type, ln_remote_node_id(&p_conf->channel));
     if (!chk) {
         LOGD("send channel_%c: %016" PRIx64 "\n", type, short_channel_id);
         utl_push_u16be(p_push, p_buf_cnl->len);
         utl_push_data(p_push, p_buf_cnl->buf, p_buf_cnl->len);
-        ln_db_cnlanno_info_add_node_id(p_cur_infocnl, short_channel_id, type, false, ln_remote_node_id(&p_conf->channel));
+        utl_push_u64be(&p_sent->push_cnl, short_channel_id);
+        utl_push_byte(&p_sent->push_cnl, (uint8_t)type);
         chk = true;
     } else {
         //LOGD("CHAN already sent: short_channel_id=%016" PRIx64 ", type:%c\n", short_channel_id, type);
@@ -1978,7 +2508,7 @@ static bool anno_senddata_cnl(lnapp_conf_t *p_conf, utl_push_t *p_push, uint64_t
  *
  * @return  送信数
  */
-static bool anno_senddata_node(lnapp_conf_t *p_conf, utl_push_t *p_push, void *p_cur_node, void *p_cur_infonode, const utl_buf_t *p_buf_cnl)
+static bool anno_senddata_node(lnapp_conf_t *p_conf, utl_push_t *p_push, anno_sent_t *p_sent, void *p_cur_node, void *p_cur_infonode, const utl_buf_t *p_buf_cnl)
 {
     uint64_t short_channel_id;
     uint8_t node[2][BTC_SZ_PUBKEY];
@@ -1990,7 +2520,9 @@ static bool anno_senddata_node(lnapp_conf_t *p_conf, utl_push_t *p_push, void *p
     utl_buf_t buf_node = UTL_BUF_INIT;
 
     for (int lp = 0; lp < 2; lp++) {
-        ret = ln_db_nodeanno_info_search_node_id(p_cur_infonode, node[lp], ln_remote_node_id(&p_conf->channel));
+        //送信済みDBへの登録は最後に行うため、今回送信した分も確認する
+        ret = ln_db_nodeanno_info_search_node_id(p_cur_infonode, node[lp], ln_remote_node_id(&p_conf->channel)) ||
+                anno_sent_node_search(p_sent, node[lp]);
         if (!ret) {
             ret = ln_db_nodeanno_cur_load(p_cur_node, &buf_node, NULL, node[lp]);
             if (ret) {
@@ -1999,7 +2531,7 @@ static bool anno_senddata_node(lnapp_conf_t *p_conf, utl_push_t *p_push, void *p
                 utl_push_u16be(p_push, buf_node.len);
                 utl_push_data(p_push, buf_node.buf, buf_node.len);
                 utl_buf_free(&buf_node);
-                ln_db_nodeanno_info_add_node_id(p_cur_infonode, node[lp], false, ln_remote_node_id(&p_conf->channel));
+                utl_push_data(&p_sent->push_node, node[lp], BTC_SZ_PUBKEY);
             }
         } else {
             //LOGD("NODE already sent: short_channel_id=%016" PRIx64 ", node%d\n", short_channel_id, lp);
@@ -30,6 +30,8 @@
 
 #include "ptarmd.h"
 #include "conf.h"
+#include "lnapp_sendq.h"
+#include "lnapp_ev.h"
 
 
 #ifdef __cplusplus
@@ -67,6 +69,32 @@ typedef struct ponglist_t {
 LIST_HEAD(ponglisthead_t, ponglist_t);
 
 
+/** @struct     lnapp_peer_ev_t
+ *  @brief      peer I/Oのwatcher(#lnapp_ev_assign()したloopで動く)
+ */
+typedef struct {
+    int                 idx;                    ///< loop番号
+    bool                attached;               ///< true:watcher登録済み
+
+    ev_io               io_read;                ///< peer受信
+    ev_io               io_write;               ///< 送信キュー送信(未送信がある間のみ)
+    ev_io               io_wakeup;              ///< wakeup_fd
+    ev_timer            tm_start;               ///< 受信開始待ち
+    ev_timer            tm_recv;                ///< message途中/init交換待ちのタイムアウト
+    ev_timer            tm_idle;                ///< #ln_idle_proc()の再処理
+    ev_timer            tm_poll;                ///< ping, funding_tx監視など
+    ev_timer            tm_anno;                ///< announcement送信
+
+    uint8_t             *p_recv;                ///< 受信バッファ(UTL_DBG_MALLOC)
+    uint8_t             head[LN_SZ_NOISE_HEADER];
+    uint16_t            recv_need;              ///< 受信するbyte数
+    uint16_t            recv_len;               ///< 受信済みbyte数
+    bool                recv_body;              ///< true:message受信中, false:header受信中
+    bool                recv_paused;            ///< true:init交換待ちで受信停止中
+    bool                anno_wait;              ///< true:送信キューが減るのを待っている
+} lnapp_peer_ev_t;
+
+
 /** @struct lnapp_conf_t
  *  @brief  アプリ側のチャネル管理情報
  */
@@ -82,7 +110,9 @@ typedef struct lnapp_conf_t {
     pthread_cond_t      cond;                   ///< threadの待ち合わせ
     pthread_mutex_t     mux_th;                 ///< thread
     pthread_mutex_t     mux_conf;               ///< conf
-    pthread_mutex_t     mux_send;               ///< socket送信中のmutex
+    lnapp_sendq_t       sendq;                  ///< peer送信キュー
+    lnapp_peer_ev_t     ev;                     ///< peer I/O
+    int                 wakeup_fd;              ///< HTLC転送通知(eventfd)
 
     //XXX: start param
     bool                initiator;                  ///< true:Noise Protocol handshakeのinitiator
@@ -98,6 +128,7 @@ typedef struct lnapp_conf_t {
     int                 ping_counter;           ///< 無送受信時にping送信するカウンタ(カウントアップ)
 
     bool                funding_waiting;        ///< true:funding_txの安定待ち
+    bool                funding_check_req;      ///< true:channel threadでfunding_txの安定を確認する
     uint32_t            funding_confirm;        ///< funding_txのconfirmation数
 
     uint64_t            last_anno_cnl;          ///< [#send_channel_anno()]最後にannouncementしたchannel
@@ -124,6 +155,7 @@ typedef struct lnapp_conf_t {
  ********************************************************************/
 
 void lnapp_global_init(void);
+void lnapp_global_term(void);
 
 
 bool lnapp_handshake(peer_conn_handshake_t *pConnHandshake, lnapp_conf_t *pConf);
@@ -164,6 +196,13 @@ void lnapp_stop(lnapp_conf_t *pAppConf);
 void lnapp_join(lnapp_conf_t *pAppConf);
 
 
+/** [lnapp]peer I/O処理の呼び出し要求
+ *
+ * 他threadでchannelを更新した場合や、送信キューに未送信が残った場合に呼び出す。
+ */
+void lnapp_wakeup(lnapp_conf_t *pAppConf);
+
+
 /** [lnapp]チャネル接続開始
  *
  */
@@ -173,6 +173,22 @@ void lnapp_notify_cb(ln_cb_type_t Type, void *pCommonParam, void *pTypeSpecificP
 }
 
 
+void lnapp_anno_ingest_notify(const uint8_t *pRemoteNodeId, ln_cb_anno_type_t Type)
+{
+    //announcement受信元のchannelに通知する(切断済みなら何もしない)
+    lnapp_conf_t *p_conf = lnapp_manager_get_node(pRemoteNodeId);
+    if (!p_conf) return;
+
+    //ingest commit threadから呼ばれるため、annodb_*はmux_confで保護する
+    ln_cb_param_notify_annodb_update_t param;
+    param.type = Type;
+    pthread_mutex_lock(&p_conf->mux_conf);
+    cb_update_anno_db(p_conf, &param);
+    pthread_mutex_unlock(&p_conf->mux_conf);
+    lnapp_manager_free_node_ref(p_conf);
+}
+
+
 static void cb_channel_quit(lnapp_conf_t *pConf, void *pParam)
 {
     (void)pParam;
@@ -372,7 +388,7 @@ static void cb_funding_tx_wait(lnapp_conf_t *pConf, void *pParam)
     }
 
     if (p_cb_param->ret) {
-        //fundingの監視は thread_poll_start()に任せる
+        //fundingの監視は cb_peer_poll()に任せる
         LOGD("$$$ watch funding_txid: ");
         TXIDD(ln_funding_info_txid(&pConf->channel.funding_info));
         pConf->funding_waiting = true;
@@ -43,6 +43,16 @@ extern "C" {
 void lnapp_notify_cb(ln_cb_type_t Type, void *pCommonParam, void *pTypeSpecificParam);
 
 
+/** announcement DB保存通知
+ *
+ * #ln_anno_ingest_start()に渡す。保存threadから呼ばれる。
+ *
+ * @param[in]   pRemoteNodeId   announcement受信元のnode_id
+ * @param[in]   Type            保存したannouncement
+ */
+void lnapp_anno_ingest_notify(const uint8_t *pRemoteNodeId, ln_cb_anno_type_t Type);
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,213 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   lnapp_ev.c
+ *  @brief  peer I/Oのevent loop
+ */
+#include <inttypes.h>
+#include <string.h>
+#include <pthread.h>
+
+#define LOG_TAG     "lnapp_ev"
+#include "utl_log.h"
+
+#include "lnapp_ev.h"
+
+
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** @struct ev_worker_t
+ *  @brief  event loop thread
+ */
+typedef struct {
+    struct ev_loop      *p_loop;
+    pthread_t           th;
+    ev_async            async;          ///< 関数呼び出し要求
+
+    pthread_mutex_t     mux_call;       ///< 呼び出し元の排他
+    pthread_mutex_t     mux;            ///< p_func, p_arg, done
+    pthread_cond_t      cond;           ///< 呼び出し完了通知
+    lnapp_ev_func_t     p_func;
+    void                *p_arg;
+    bool                done;
+} ev_worker_t;
+
+
+/********************************************************************
+ * static variables
+ ********************************************************************/
+
+static ev_worker_t      mWorkers[LNAPP_EV_THREAD_MAX];
+static int              mWorkerNum;
+static uint32_t         mAssign;
+static pthread_mutex_t  mMuxAssign = PTHREAD_MUTEX_INITIALIZER;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static void *thread_loop_start(void *pArg);
+static void cb_async(struct ev_loop *pLoop, ev_async *pWatcher, int Revents);
+static void cb_break(struct ev_loop *pLoop, void *pArg);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+bool lnapp_ev_start(int ThreadNum)
+{
+    if ((ThreadNum <= 0) || (LNAPP_EV_THREAD_MAX < ThreadNum) || (mWorkerNum != 0)) {
+        LOGE("fail: thread num=%d\n", ThreadNum);
+        return false;
+    }
+
+    for (int lp = 0; lp < ThreadNum; lp++) {
+        ev_worker_t *p_worker = &mWorkers[lp];
+
+        memset(p_worker, 0, sizeof(ev_worker_t));
+        p_worker->p_loop = ev_loop_new(EVFLAG_AUTO);
+        if (p_worker->p_loop == NULL) {
+            LOGE("fail: ev_loop_new\n");
+            lnapp_ev_stop();
+            return false;
+        }
+        pthread_mutex_init(&p_worker->mux_call, NULL);
+        pthread_mutex_init(&p_worker->mux, NULL);
+        pthread_cond_init(&p_worker->cond, NULL);
+        ev_async_init(&p_worker->async, cb_async);
+        p_worker->async.data = p_worker;
+        //async watcherがあるため、#cb_break()までloopは終了しない
+        ev_async_start(p_worker->p_loop, &p_worker->async);
+        pthread_create(&p_worker->th, NULL, &thread_loop_start, p_worker);
+        mWorkerNum++;
+    }
+    LOGD("event loop: %d threads\n", mWorkerNum);
+    return true;
+}
+
+
+void lnapp_ev_stop(void)
+{
+    for (int lp = 0; lp < mWorkerNum; lp++) {
+        ev_worker_t *p_worker = &mWorkers[lp];
+
+        lnapp_ev_call(lp, cb_break, NULL);
+        pthread_join(p_worker->th, NULL);
+        ev_async_stop(p_worker->p_loop, &p_worker->async);
+        ev_loop_destroy(p_worker->p_loop);
+        pthread_cond_destroy(&p_worker->cond);
+        pthread_mutex_destroy(&p_worker->mux);
+        pthread_mutex_destroy(&p_worker->mux_call);
+        p_worker->p_loop = NULL;
+    }
+    mWorkerNum = 0;
+}
+
+
+int lnapp_ev_assign(void)
+{
+    pthread_mutex_lock(&mMuxAssign);
+    int idx = (mWorkerNum > 0) ? (int)(mAssign++ % (uint32_t)mWorkerNum) : 0;
+    pthread_mutex_unlock(&mMuxAssign);
+    return idx;
+}
+
+
+bool lnapp_ev_call(int Idx, lnapp_ev_func_t pFunc, void *pArg)
+{
+    if ((Idx < 0) || (mWorkerNum <= Idx)) {
+        LOGE("fail: no loop[%d]\n", Idx);
+        return false;
+    }
+    ev_worker_t *p_worker = &mWorkers[Idx];
+
+    if (pthread_equal(pthread_self(), p_worker->th)) {
+        (*pFunc)(p_worker->p_loop, pArg);
+        return true;
+    }
+
+    pthread_mutex_lock(&p_worker->mux_call);
+    pthread_mutex_lock(&p_worker->mux);
+    p_worker->p_func = pFunc;
+    p_worker->p_arg = pArg;
+    p_worker->done = false;
+    ev_async_send(p_worker->p_loop, &p_worker->async);
+    while (!p_worker->done) {
+        pthread_cond_wait(&p_worker->cond, &p_worker->mux);
+    }
+    pthread_mutex_unlock(&p_worker->mux);
+    pthread_mutex_unlock(&p_worker->mux_call);
+    return true;
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+/** event loop thread entry point
+ *
+ * @param[in,out]   pArg    ev_worker_t*
+ */
+static void *thread_loop_start(void *pArg)
+{
+    ev_worker_t *p_worker = (ev_worker_t *)pArg;
+
+    LOGD("[THREAD]event loop initialize\n");
+    ev_run(p_worker->p_loop, 0);
+    LOGD("[exit]event loop thread\n");
+    return NULL;
+}
+
+
+/** #lnapp_ev_call()の要求受付
+ *
+ */
+static void cb_async(struct ev_loop *pLoop, ev_async *pWatcher, int Revents)
+{
+    (void)Revents;
+
+    ev_worker_t *p_worker = (ev_worker_t *)pWatcher->data;
+
+    pthread_mutex_lock(&p_worker->mux);
+    if ((p_worker->p_func != NULL) && !p_worker->done) {
+        (*p_worker->p_func)(pLoop, p_worker->p_arg);
+        p_worker->p_func = NULL;
+        p_worker->done = true;
+        pthread_cond_broadcast(&p_worker->cond);
+    }
+    pthread_mutex_unlock(&p_worker->mux);
+}
+
+
+/** event loop終了
+ *
+ */
+static void cb_break(struct ev_loop *pLoop, void *pArg)
+{
+    (void)pArg;
+
+    ev_break(pLoop, EVBREAK_ALL);
+}
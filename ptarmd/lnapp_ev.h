@@ -0,0 +1,106 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   lnapp_ev.h
+ *  @brief  peer I/Oのevent loop
+ *
+ * 固定数のthreadがそれぞれlibevのevent loopを持ち、peerはどれか1つのloopに割り当てる。
+ * 1つのpeerのwatcherは同じloop threadでしか呼ばれないため、peer単位の処理は直列になる。
+ * watcherの開始/停止はloop thread上で行う必要があるため、#lnapp_ev_call()を使う。
+ */
+#ifndef LNAPP_EV_H__
+#define LNAPP_EV_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <ev.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define LNAPP_EV_THREAD_MAX     (8)         ///< event loop thread数の上限
+
+
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** loop thread上で呼び出す関数
+ *
+ * @param[in]       pLoop       呼び出したloop
+ * @param[in,out]   pArg        #lnapp_ev_call()のpArg
+ */
+typedef void (*lnapp_ev_func_t)(struct ev_loop *pLoop, void *pArg);
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** event loop開始
+ *
+ * @param[in]       ThreadNum   thread数(1～#LNAPP_EV_THREAD_MAX)
+ * @retval  true    成功
+ */
+bool lnapp_ev_start(int ThreadNum);
+
+
+/** event loop停止
+ *
+ * 全threadの終了を待つ。watcherは呼び出し元で停止しておくこと。
+ */
+void lnapp_ev_stop(void);
+
+
+/** loop割当て
+ *
+ * 順番に割り当てる。
+ *
+ * @return  loop番号
+ */
+int lnapp_ev_assign(void);
+
+
+/** loop thread上での関数呼び出し
+ *
+ * pFuncの完了を待って戻る。loop thread上から呼んだ場合はそのまま呼び出す。
+ *
+ * @param[in]       Idx         #lnapp_ev_assign()の戻り値
+ * @param[in]       pFunc       呼び出す関数
+ * @param[in,out]   pArg        pFuncの引数
+ * @retval  true    呼び出した
+ * @retval  false   event loopが動いていない
+ */
+bool lnapp_ev_call(int Idx, lnapp_ev_func_t pFunc, void *pArg);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LNAPP_EV_H__ */
@@ -19,8 +19,20 @@
  *  specific language governing permissions and limitations
  *  under the License.
  */
+/** @file   lnapp_manager.c
+ *  @brief  peer(lnapp_conf_t)の管理
+ *
+ * node_idのhash表にpeerを登録する。表は複数のshardに分け、shardごとにlockする。
+ * channelが確定したpeerはshort_channel_idの表にも登録し、転送先の検索に使う。
+ */
+#include <inttypes.h>
+#include <string.h>
+#include <stddef.h>
+#include <pthread.h>
+
 #define LOG_TAG     "lnapp_manager"
 #include "utl_log.h"
+#include "utl_dbg.h"
 
 #include "ln_db.h"
 
@@ -28,14 +40,59 @@
 #include "lnapp_manager.h"
 
 
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define M_SHARD_NUM             (16)        ///< node_id表の分割数(2のべき乗)
+#define M_BUCKET_INIT           (16)        ///< shardあたりのbucket初期数(2のべき乗)
+#define M_SCID_BUCKET_INIT      (64)        ///< short_channel_id表のbucket初期数(2のべき乗)
+
+
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** @struct appconf_entry_t
+ *  @brief  登録済みnode
+ */
+typedef struct appconf_entry_t {
+    struct appconf_entry_t  *p_next;            ///< node_id表の次
+    struct appconf_entry_t  *p_next_scid;       ///< short_channel_id表の次
+    uint64_t                short_channel_id;   ///< short_channel_id表の登録値(0:未登録)
+    lnapp_conf_t            conf;
+} appconf_entry_t;
+
+
+/** @struct appconf_shard_t
+ *  @brief  node_id表(分割単位)
+ */
+typedef struct {
+    pthread_mutex_t         mux;                ///< bucket, ref_counter
+    appconf_entry_t         **pp_bucket;
+    uint32_t                bucket_num;
+    uint32_t                num;
+} appconf_shard_t;
+
+
+/** @struct appconf_scid_t
+ *  @brief  short_channel_id表
+ */
+typedef struct {
+    pthread_rwlock_t        lock;
+    appconf_entry_t         **pp_bucket;
+    uint32_t                bucket_num;
+    uint32_t                num;
+} appconf_scid_t;
+
+
 /********************************************************************
  * static variables
  ********************************************************************/
 
-static lnapp_conf_t     mAppConf[MAX_CHANNELS + 1];
-    //the additional one is for handling origin/final node itself.
-    //  treat as a dummy channel as node_id=0 and short_channel_id=0.
-pthread_mutex_t         mMuxAppconf = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+//node_id=0のentryはorigin/final node自身を扱うダミーのchannel(short_channel_id=0)
+static appconf_shard_t  mShard[M_SHARD_NUM];
+static appconf_scid_t   mScid;
 const uint8_t           mNodeIdOrigin[BTC_SZ_PUBKEY] = {0};
 
 
@@ -44,6 +101,19 @@ const uint8_t           mNodeIdOrigin[BTC_SZ_PUBKEY] = {0};
  ********************************************************************/
 
 static bool load_channel(ln_channel_t *pChannel, void *pDbParam, void *pParam);
+static appconf_entry_t *entry_new(const uint8_t *pNodeId, void *(*pThreadChannelStart)(void *pArg));
+static void entry_free(appconf_entry_t *pEntry);
+static bool entry_insert(appconf_entry_t *pEntry);
+static appconf_entry_t *entry_get(const uint8_t *pNodeId);
+static bool entry_release(appconf_entry_t *pEntry, bool bUnlink);
+static appconf_entry_t **entry_collect(bool bOrigin, int *pNum);
+static void scid_register(appconf_entry_t *pEntry, uint64_t ShortChannelId);
+static void scid_unregister(appconf_entry_t *pEntry);
+static appconf_entry_t **bucket_alloc(uint32_t Num);
+static uint32_t hash_node_id(const uint8_t *pNodeId);
+static uint32_t hash_short_channel_id(uint64_t ShortChannelId);
+static appconf_shard_t *shard_get(uint32_t Hash);
+static inline appconf_entry_t *conf2entry(lnapp_conf_t *pConf);
 
 
 /********************************************************************
@@ -52,19 +122,51 @@ static bool load_channel(ln_channel_t *pChannel, void *pDbParam, void *pParam);
 
 void lnapp_manager_init(void)
 {
-    memset(&mAppConf, 0x00, sizeof(mAppConf));
-    int idx = 1; //skip origin node
-    ln_db_channel_search_cont(load_channel, &idx); //XXX: error check
+    for (int lp = 0; lp < M_SHARD_NUM; lp++) {
+        pthread_mutex_init(&mShard[lp].mux, NULL);
+        mShard[lp].pp_bucket = bucket_alloc(M_BUCKET_INIT);
+        mShard[lp].bucket_num = M_BUCKET_INIT;
+        mShard[lp].num = 0;
+    }
+    pthread_rwlock_init(&mScid.lock, NULL);
+    mScid.pp_bucket = bucket_alloc(M_SCID_BUCKET_INIT);
+    mScid.bucket_num = M_SCID_BUCKET_INIT;
+    mScid.num = 0;
+
+    ln_db_channel_search_cont(load_channel, NULL); //XXX: error check
 }
 
 
 void lnapp_manager_term(void)
 {
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (!mAppConf[lp].enabled) continue;
-        lnapp_stop_and_join(&mAppConf[lp]);
-        lnapp_conf_term(&mAppConf[lp]);
+    int num;
+    appconf_entry_t **pp_entry = entry_collect(true, &num);
+    for (int lp = 0; lp < num; lp++) {
+        lnapp_stop_and_join(&pp_entry[lp]->conf);
+        entry_release(pp_entry[lp], false);
     }
+    UTL_DBG_FREE(pp_entry);
+
+    //終了時は参照が残っていても解放する
+    for (int lp = 0; lp < M_SHARD_NUM; lp++) {
+        appconf_shard_t *p_shard = &mShard[lp];
+        for (uint32_t idx = 0; idx < p_shard->bucket_num; idx++) {
+            appconf_entry_t *p = p_shard->pp_bucket[idx];
+            while (p) {
+                appconf_entry_t *p_next = p->p_next;
+                entry_free(p);
+                p = p_next;
+            }
+        }
+        UTL_DBG_FREE(p_shard->pp_bucket);
+        p_shard->bucket_num = 0;
+        p_shard->num = 0;
+        pthread_mutex_destroy(&p_shard->mux);
+    }
+    UTL_DBG_FREE(mScid.pp_bucket);
+    mScid.bucket_num = 0;
+    mScid.num = 0;
+    pthread_rwlock_destroy(&mScid.lock);
 }
 
 
@@ -89,73 +191,87 @@ bool lnapp_manager_start_origin_node(void *(*pThreadChannelStart)(void *pArg))
 
 lnapp_conf_t *lnapp_manager_get_node(const uint8_t *pNodeId)
 {
-    pthread_mutex_lock(&mMuxAppconf);
-    lnapp_conf_t *p_conf = NULL;
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (!mAppConf[lp].enabled) continue;
-        if (memcmp(mAppConf[lp].node_id, pNodeId, BTC_SZ_PUBKEY)) continue;
-        p_conf = &mAppConf[lp];
-        p_conf->ref_counter++;
-        LOGD("ref_counter++: [%p] %u -> %u\n", p_conf, p_conf->ref_counter - 1, p_conf->ref_counter);
+    appconf_entry_t *p_entry = entry_get(pNodeId);
+    return (p_entry) ? &p_entry->conf : NULL;
+}
+
+
+lnapp_conf_t *lnapp_manager_get_node_by_short_channel_id(uint64_t ShortChannelId)
+{
+    if (!ShortChannelId) return NULL;
+
+    uint8_t node_id[BTC_SZ_PUBKEY];
+    bool found = false;
+    pthread_rwlock_rdlock(&mScid.lock);
+    uint32_t idx = hash_short_channel_id(ShortChannelId) & (mScid.bucket_num - 1);
+    for (appconf_entry_t *p = mScid.pp_bucket[idx]; p != NULL; p = p->p_next_scid) {
+        if (p->short_channel_id != ShortChannelId) continue;
+        //entryはshort_channel_id表から外すまで解放しない
+        memcpy(node_id, p->conf.node_id, BTC_SZ_PUBKEY);
+        found = true;
         break;
     }
-    pthread_mutex_unlock(&mMuxAppconf);
-    return p_conf;
+    pthread_rwlock_unlock(&mScid.lock);
+    if (!found) return NULL;
+
+    //表を参照してからref_counterを増やすまでに入れ替わっていないか確認する
+    appconf_entry_t *p_entry = entry_get(node_id);
+    if (!p_entry) return NULL;
+    pthread_rwlock_rdlock(&mScid.lock);
+    found = (p_entry->short_channel_id == ShortChannelId);
+    pthread_rwlock_unlock(&mScid.lock);
+    if (!found) {
+        entry_release(p_entry, false);
+        return NULL;
+    }
+    return &p_entry->conf;
+}
+
+
+void lnapp_manager_set_short_channel_id(const uint8_t *pNodeId, uint64_t ShortChannelId)
+{
+    appconf_entry_t *p_entry = entry_get(pNodeId);
+    if (!p_entry) {
+        LOGE("fail: node not found\n");
+        return;
+    }
+    scid_register(p_entry, ShortChannelId);
+    entry_release(p_entry, false);
 }
 
 
 void lnapp_manager_each_node(void (*pCallback)(lnapp_conf_t *pConf, void *pParam), void *pParam)
 {
-    pthread_mutex_lock(&mMuxAppconf);
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        lnapp_conf_t *p_conf = &mAppConf[lp];
-        if (!memcmp(p_conf->node_id, mNodeIdOrigin, BTC_SZ_PUBKEY)) continue; //skip origin node
-        if (!p_conf->enabled) continue;
-        p_conf->ref_counter++;
-        LOGD("ref_counter++: [%p] %u -> %u\n", p_conf, p_conf->ref_counter - 1, p_conf->ref_counter);
-        pthread_mutex_unlock(&mMuxAppconf);
-        pCallback(p_conf, pParam);
-        pthread_mutex_lock(&mMuxAppconf);
-        p_conf->ref_counter--;
-        LOGD("ref_counter--: [%p] %u -> %u\n", p_conf, p_conf->ref_counter + 1, p_conf->ref_counter);
+    //参照を取ってからlockを外して呼び出すため、callback中に登録/削除があっても待たない
+    int num;
+    appconf_entry_t **pp_entry = entry_collect(false, &num);
+    for (int lp = 0; lp < num; lp++) {
+        pCallback(&pp_entry[lp]->conf, pParam);
+        entry_release(pp_entry[lp], false);
     }
-    pthread_mutex_unlock(&mMuxAppconf);
+    UTL_DBG_FREE(pp_entry);
 }
 
 
 lnapp_conf_t *lnapp_manager_get_new_node(
     const uint8_t *pNodeId, void *(*pThreadChannelStart)(void *pArg))
 {
-    pthread_mutex_lock(&mMuxAppconf);
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (!mAppConf[lp].enabled) continue;
-        if (memcmp(mAppConf[lp].node_id, pNodeId, BTC_SZ_PUBKEY)) continue;
+    appconf_entry_t *p_entry = entry_new(pNodeId, pThreadChannelStart);
+    if (!p_entry) return NULL;
+    p_entry->conf.ref_counter++;
+    if (!entry_insert(p_entry)) {
         LOGE("fail: always exists\n");
-        pthread_mutex_unlock(&mMuxAppconf);
+        entry_free(p_entry);
         return NULL;
     }
-    lnapp_conf_t *p_conf = NULL;
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (mAppConf[lp].enabled) continue;
-        p_conf = &mAppConf[lp];
-        lnapp_conf_init(p_conf, pNodeId, pThreadChannelStart);
-        p_conf->ref_counter++;
-        LOGD("ref_counter++: [%p] %u -> %u\n", p_conf, p_conf->ref_counter - 1, p_conf->ref_counter);
-        break;
-    }
-    pthread_mutex_unlock(&mMuxAppconf);
-    return p_conf;
+    return &p_entry->conf;
 }
 
 
 void lnapp_manager_free_node_ref(lnapp_conf_t *pConf)
 {
     if (!pConf) return;
-    pthread_mutex_lock(&mMuxAppconf);
-    assert(pConf->ref_counter);
-    pConf->ref_counter--;
-    LOGD("ref_counter--: [%p] %u -> %u\n", pConf, pConf->ref_counter + 1, pConf->ref_counter);
-    pthread_mutex_unlock(&mMuxAppconf);
+    entry_release(conf2entry(pConf), false);
 }
 
 
@@ -170,25 +286,28 @@ void lnapp_manager_term_node(const uint8_t *pNodeId)
 
 void lnapp_manager_prune_node(void)
 {
-    pthread_mutex_lock(&mMuxAppconf);
-    for (int lp = 0; lp < (int)ARRAY_SIZE(mAppConf); lp++) {
-        if (!memcmp(mAppConf[lp].node_id, mNodeIdOrigin, BTC_SZ_PUBKEY)) continue; //skip origin node
-        if (!mAppConf[lp].enabled) continue;
+    int num;
+    appconf_entry_t **pp_entry = entry_collect(false, &num);
+    for (int lp = 0; lp < num; lp++) {
+        lnapp_conf_t *p_conf = &pp_entry[lp]->conf;
+        bool prune;
         //no lock required
-        if (ln_status_get(&mAppConf[lp].channel) < LN_STATUS_ESTABLISH) {
-            ;
-        } else if (ln_status_get(&mAppConf[lp].channel) == LN_STATUS_CLOSED) {
-            lnapp_stop(&mAppConf[lp]);
+        if (ln_status_get(&p_conf->channel) < LN_STATUS_ESTABLISH) {
+            prune = true;
+        } else if (ln_status_get(&p_conf->channel) == LN_STATUS_CLOSED) {
+            lnapp_stop(p_conf);
+            prune = true;
         } else {
-            continue;
+            prune = false;
         }
-        if (mAppConf[lp].ref_counter) continue;
-        lnapp_join(&mAppConf[lp]);
+        //自分の参照を外した時点で誰も参照していなければ表から外す
+        if (!entry_release(pp_entry[lp], prune)) continue;
+        lnapp_join(p_conf);
         LOGD("prune node: ");
-        DUMPD(mAppConf[lp].node_id, BTC_SZ_PUBKEY);
-        lnapp_conf_term(&mAppConf[lp]);
+        DUMPD(p_conf->node_id, BTC_SZ_PUBKEY);
+        entry_free(pp_entry[lp]);
     }
-    pthread_mutex_unlock(&mMuxAppconf);
+    UTL_DBG_FREE(pp_entry);
 }
 
 
@@ -199,22 +318,322 @@ void lnapp_manager_prune_node(void)
 static bool load_channel(ln_channel_t *pChannel, void *pDbParam, void *pParam)
 {
     (void)pDbParam;
+    (void)pParam;
 
-    int *p_idx = (int *)pParam;
-
-    if (*p_idx >= (int)ARRAY_SIZE(mAppConf)) {
-        assert(0);
+    appconf_entry_t *p_entry = entry_new(pChannel->peer_node_id, lnapp_thread_channel_start);
+    if (!p_entry) {
         return false;
     }
-
-    ln_channel_t *p_channel = &mAppConf[*p_idx].channel;
-    lnapp_conf_init(&mAppConf[*p_idx], pChannel->peer_node_id, lnapp_thread_channel_start);
+    ln_channel_t *p_channel = &p_entry->conf.channel;
     ln_db_copy_channel(p_channel, pChannel);
     if (p_channel->short_channel_id) {
         ln_db_cnlanno_load(&p_channel->cnl_anno, p_channel->short_channel_id);
     }
     ln_print_keys(p_channel);
-    (*p_idx)++;
+    if (!entry_insert(p_entry)) {
+        LOGE("fail: duplicate node\n");
+        entry_free(p_entry);
+        return true;
+    }
+    if (p_channel->short_channel_id) {
+        scid_register(p_entry, p_channel->short_channel_id);
+    }
+    return true;
+}
+
+
+/** entry確保
+ *
+ * channel情報はpeerを登録するときにだけ確保する。
+ *
+ * @param[in]       pNodeId                 peer node_id
+ * @param[in]       pThreadChannelStart     channel thread
+ * @return  確保したentry(表には未登録)
+ */
+static appconf_entry_t *entry_new(const uint8_t *pNodeId, void *(*pThreadChannelStart)(void *pArg))
+{
+    appconf_entry_t *p_entry = (appconf_entry_t *)UTL_DBG_MALLOC(sizeof(appconf_entry_t));
+    if (!p_entry) {
+        LOGE("fail: malloc\n");
+        return NULL;
+    }
+    p_entry->p_next = NULL;
+    p_entry->p_next_scid = NULL;
+    p_entry->short_channel_id = 0;
+    lnapp_conf_init(&p_entry->conf, pNodeId, pThreadChannelStart);
+    return p_entry;
+}
+
+
+/** entry解放
+ *
+ * 表から外してから呼び出すこと。
+ *
+ * @param[in,out]   pEntry      解放するentry
+ */
+static void entry_free(appconf_entry_t *pEntry)
+{
+    lnapp_conf_term(&pEntry->conf);
+    UTL_DBG_FREE(pEntry);
+}
+
+
+/** node_id表への登録
+ *
+ * shardのentry数がbucket数を超えたらbucket数を2倍にする。
+ *
+ * @param[in,out]   pEntry      登録するentry
+ * @retval  false   同じnode_idが登録済み
+ */
+static bool entry_insert(appconf_entry_t *pEntry)
+{
+    uint32_t hash = hash_node_id(pEntry->conf.node_id);
+    appconf_shard_t *p_shard = shard_get(hash);
+
+    pthread_mutex_lock(&p_shard->mux);
+    uint32_t idx = (hash / M_SHARD_NUM) & (p_shard->bucket_num - 1);
+    for (appconf_entry_t *p = p_shard->pp_bucket[idx]; p != NULL; p = p->p_next) {
+        if (!memcmp(p->conf.node_id, pEntry->conf.node_id, BTC_SZ_PUBKEY)) {
+            pthread_mutex_unlock(&p_shard->mux);
+            return false;
+        }
+    }
+    pEntry->p_next = p_shard->pp_bucket[idx];
+    p_shard->pp_bucket[idx] = pEntry;
+    p_shard->num++;
+
+    if (p_shard->num > p_shard->bucket_num) {
+        uint32_t bucket_num = p_shard->bucket_num * 2;
+        appconf_entry_t **pp_bucket = bucket_alloc(bucket_num);
+        if (pp_bucket) {
+            for (uint32_t lp = 0; lp < p_shard->bucket_num; lp++) {
+                appconf_entry_t *p = p_shard->pp_bucket[lp];
+                while (p) {
+                    appconf_entry_t *p_next = p->p_next;
+                    uint32_t idx2 = (hash_node_id(p->conf.node_id) / M_SHARD_NUM) & (bucket_num - 1);
+                    p->p_next = pp_bucket[idx2];
+                    pp_bucket[idx2] = p;
+                    p = p_next;
+                }
+            }
+            UTL_DBG_FREE(p_shard->pp_bucket);
+            p_shard->pp_bucket = pp_bucket;
+            p_shard->bucket_num = bucket_num;
+        }
+        //確保できなければchainが伸びるだけなのでそのまま使う
+    }
+    pthread_mutex_unlock(&p_shard->mux);
     return true;
 }
 
+
+/** node_idによる検索
+ *
+ * @param[in]       pNodeId     検索するnode_id
+ * @return  見つかったentry(ref_counter++済み)。なければNULL
+ */
+static appconf_entry_t *entry_get(const uint8_t *pNodeId)
+{
+    uint32_t hash = hash_node_id(pNodeId);
+    appconf_shard_t *p_shard = shard_get(hash);
+
+    pthread_mutex_lock(&p_shard->mux);
+    uint32_t idx = (hash / M_SHARD_NUM) & (p_shard->bucket_num - 1);
+    appconf_entry_t *p_entry = p_shard->pp_bucket[idx];
+    for (; p_entry != NULL; p_entry = p_entry->p_next) {
+        if (memcmp(p_entry->conf.node_id, pNodeId, BTC_SZ_PUBKEY)) continue;
+        p_entry->conf.ref_counter++;
+        LOGD("ref_counter++: [%p] %u -> %u\n", &p_entry->conf, p_entry->conf.ref_counter - 1, p_entry->conf.ref_counter);
+        break;
+    }
+    pthread_mutex_unlock(&p_shard->mux);
+    return p_entry;
+}
+
+
+/** 参照解放
+ *
+ * @param[in,out]   pEntry      #entry_get()などで取得したentry
+ * @param[in]       bUnlink     true:参照がなくなったら表から外す
+ * @retval  true    表から外した(呼び出し元で#entry_free()する)
+ */
+static bool entry_release(appconf_entry_t *pEntry, bool bUnlink)
+{
+    uint32_t hash = hash_node_id(pEntry->conf.node_id);
+    appconf_shard_t *p_shard = shard_get(hash);
+    bool unlinked = false;
+
+    pthread_mutex_lock(&p_shard->mux);
+    assert(pEntry->conf.ref_counter);
+    pEntry->conf.ref_counter--;
+    LOGD("ref_counter--: [%p] %u -> %u\n", &pEntry->conf, pEntry->conf.ref_counter + 1, pEntry->conf.ref_counter);
+    if (bUnlink && (pEntry->conf.ref_counter == 0)) {
+        uint32_t idx = (hash / M_SHARD_NUM) & (p_shard->bucket_num - 1);
+        for (appconf_entry_t **pp = &p_shard->pp_bucket[idx]; *pp != NULL; pp = &(*pp)->p_next) {
+            if (*pp != pEntry) continue;
+            *pp = pEntry->p_next;
+            pEntry->p_next = NULL;
+            p_shard->num--;
+            unlinked = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&p_shard->mux);
+
+    if (unlinked) {
+        scid_unregister(pEntry);
+    }
+    return unlinked;
+}
+
+
+/** 登録済みentryの一覧
+ *
+ * shardごとにlockし、取得したentryはref_counter++する。
+ * 各entryは#entry_release()で参照を外し、配列は呼び出し元でUTL_DBG_FREE()する。
+ *
+ * @param[in]       bOrigin     true:origin nodeを含める
+ * @param[out]      pNum        entry数
+ * @return  entry配列(entry数が0の場合はNULLもありうる)
+ */
+static appconf_entry_t **entry_collect(bool bOrigin, int *pNum)
+{
+    appconf_entry_t **pp_entry = NULL;
+    uint32_t num = 0;
+    uint32_t cap = 0;
+
+    for (int lp = 0; lp < M_SHARD_NUM; lp++) {
+        appconf_shard_t *p_shard = &mShard[lp];
+
+        pthread_mutex_lock(&p_shard->mux);
+        if (num + p_shard->num > cap) {
+            uint32_t cap_new = num + p_shard->num + M_BUCKET_INIT;
+            appconf_entry_t **pp = (appconf_entry_t **)UTL_DBG_REALLOC(pp_entry, sizeof(appconf_entry_t *) * cap_new);
+            if (!pp) {
+                LOGE("fail: realloc\n");
+                pthread_mutex_unlock(&p_shard->mux);
+                break;
+            }
+            pp_entry = pp;
+            cap = cap_new;
+        }
+        for (uint32_t idx = 0; idx < p_shard->bucket_num; idx++) {
+            for (appconf_entry_t *p = p_shard->pp_bucket[idx]; p != NULL; p = p->p_next) {
+                if (!bOrigin && !memcmp(p->conf.node_id, mNodeIdOrigin, BTC_SZ_PUBKEY)) continue;
+                p->conf.ref_counter++;
+                LOGD("ref_counter++: [%p] %u -> %u\n", &p->conf, p->conf.ref_counter - 1, p->conf.ref_counter);
+                pp_entry[num++] = p;
+            }
+        }
+        pthread_mutex_unlock(&p_shard->mux);
+    }
+    *pNum = (int)num;
+    return pp_entry;
+}
+
+
+/** short_channel_id表への登録
+ *
+ * 登録済みであれば付け替える。
+ *
+ * @param[in,out]   pEntry          node_id表に登録済みのentry
+ * @param[in]       ShortChannelId  short_channel_id
+ */
+static void scid_register(appconf_entry_t *pEntry, uint64_t ShortChannelId)
+{
+    scid_unregister(pEntry);
+    if (!ShortChannelId) return;
+
+    pthread_rwlock_wrlock(&mScid.lock);
+    uint32_t idx = hash_short_channel_id(ShortChannelId) & (mScid.bucket_num - 1);
+    pEntry->short_channel_id = ShortChannelId;
+    pEntry->p_next_scid = mScid.pp_bucket[idx];
+    mScid.pp_bucket[idx] = pEntry;
+    mScid.num++;
+
+    if (mScid.num > mScid.bucket_num) {
+        uint32_t bucket_num = mScid.bucket_num * 2;
+        appconf_entry_t **pp_bucket = bucket_alloc(bucket_num);
+        if (pp_bucket) {
+            for (uint32_t lp = 0; lp < mScid.bucket_num; lp++) {
+                appconf_entry_t *p = mScid.pp_bucket[lp];
+                while (p) {
+                    appconf_entry_t *p_next = p->p_next_scid;
+                    uint32_t idx2 = hash_short_channel_id(p->short_channel_id) & (bucket_num - 1);
+                    p->p_next_scid = pp_bucket[idx2];
+                    pp_bucket[idx2] = p;
+                    p = p_next;
+                }
+            }
+            UTL_DBG_FREE(mScid.pp_bucket);
+            mScid.pp_bucket = pp_bucket;
+            mScid.bucket_num = bucket_num;
+        }
+    }
+    pthread_rwlock_unlock(&mScid.lock);
+    LOGD("short_channel_id: %016" PRIx64 "\n", ShortChannelId);
+}
+
+
+/** short_channel_id表からの削除
+ *
+ * @param[in,out]   pEntry      entry
+ */
+static void scid_unregister(appconf_entry_t *pEntry)
+{
+    pthread_rwlock_wrlock(&mScid.lock);
+    if (pEntry->short_channel_id) {
+        uint32_t idx = hash_short_channel_id(pEntry->short_channel_id) & (mScid.bucket_num - 1);
+        for (appconf_entry_t **pp = &mScid.pp_bucket[idx]; *pp != NULL; pp = &(*pp)->p_next_scid) {
+            if (*pp != pEntry) continue;
+            *pp = pEntry->p_next_scid;
+            mScid.num--;
+            break;
+        }
+        pEntry->short_channel_id = 0;
+        pEntry->p_next_scid = NULL;
+    }
+    pthread_rwlock_unlock(&mScid.lock);
+}
+
+
+static appconf_entry_t **bucket_alloc(uint32_t Num)
+{
+    return (appconf_entry_t **)UTL_DBG_CALLOC(Num, sizeof(appconf_entry_t *));
+}
+
+
+/** node_idのhash(FNV-1a)
+ *
+ */
+static uint32_t hash_node_id(const uint8_t *pNodeId)
+{
+    uint32_t hash = 2166136261U;
+    for (int lp = 0; lp < BTC_SZ_PUBKEY; lp++) {
+        hash ^= pNodeId[lp];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+
+/** short_channel_idのhash
+ *
+ * block heightが上位にあるため、掛け算で下位bitに混ぜる。
+ */
+static uint32_t hash_short_channel_id(uint64_t ShortChannelId)
+{
+    return (uint32_t)((ShortChannelId * 0x9e3779b97f4a7c15ULL) >> 32);
+}
+
+
+static appconf_shard_t *shard_get(uint32_t Hash)
+{
+    return &mShard[Hash & (M_SHARD_NUM - 1)];
+}
+
+
+static inline appconf_entry_t *conf2entry(lnapp_conf_t *pConf)
+{
+    return (appconf_entry_t *)((uint8_t *)pConf - offsetof(appconf_entry_t, conf));
+}
@@ -41,10 +41,34 @@ void lnapp_manager_init(void);
 void lnapp_manager_term(void);
 bool lnapp_manager_start_origin_node(void *(*pThreadChannelStart)(void *pArg));
 lnapp_conf_t *lnapp_manager_get_node(const uint8_t *pNodeId);
+
+
+/** short_channel_idによる検索
+ *
+ * #lnapp_manager_set_short_channel_id()で登録したpeerを返す。
+ * 見つかった場合は#lnapp_manager_free_node_ref()で参照を解放すること。
+ *
+ * @param[in]       ShortChannelId  short_channel_id
+ * @return  lnapp_conf_t。なければNULL
+ */
+lnapp_conf_t *lnapp_manager_get_node_by_short_channel_id(uint64_t ShortChannelId);
+
+
+/** short_channel_idの登録
+ *
+ * short_channel_idが決まったときに呼び出す。
+ *
+ * @param[in]       pNodeId         peer node_id
+ * @param[in]       ShortChannelId  short_channel_id
+ */
+void lnapp_manager_set_short_channel_id(const uint8_t *pNodeId, uint64_t ShortChannelId);
+
+
 void lnapp_manager_each_node(void (*pCallback)(lnapp_conf_t *pConf, void *pParam), void *pParam);
 lnapp_conf_t *lnapp_manager_get_new_node(
     const uint8_t *pNodeId, void *(*pThreadChannelStart)(void *pArg));
 void lnapp_manager_free_node_ref(lnapp_conf_t *pConf);
+void lnapp_manager_term_node(const uint8_t *pNodeId);
 void lnapp_manager_prune_node(void);
 
 
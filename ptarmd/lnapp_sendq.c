@@ -0,0 +1,361 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   lnapp_sendq.c
+ *  @brief  peer送信キュー
+ */
+#include <inttypes.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/uio.h>
+
+#define LOG_TAG     "lnapp_sendq"
+#include "utl_log.h"
+#include "utl_dbg.h"
+
+#include "lnapp_sendq.h"
+
+
+/********************************************************************
+ * macros
+ ********************************************************************/
+
+#define M_SZ_NOISE_HEADER       (sizeof(uint16_t) + LN_SZ_NOISE_MAC)    ///< 暗号化したlength + MAC
+
+#define M_RING_INIT             (16)                ///< ring初期要素数
+#define M_WIRE_MAX              (64 * 1024)         ///< 暗号化済み未送信の上限[byte](これ以上は先に暗号化しない)
+#define M_IOV_MAX               (64)                ///< 1回のwritev()で送るframe数
+
+/// laneごとの上限[byte](超える場合は相手が受信していないとみなす)
+static const size_t M_LANE_MAX[LNAPP_SENDQ_LANE_NUM] = {
+    1 * 1024 * 1024,        //HIGH
+    8 * 1024 * 1024,        //BULK
+};
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+static void ring_init(lnapp_sendq_ring_t *pRing);
+static void ring_free(lnapp_sendq_ring_t *pRing);
+static void ring_push(lnapp_sendq_ring_t *pRing, const utl_buf_t *pFrame);
+static utl_buf_t *ring_at(lnapp_sendq_ring_t *pRing, uint32_t Idx);
+static void ring_pop(lnapp_sendq_ring_t *pRing, utl_buf_t *pFrame);
+static bool sendq_encrypt(lnapp_sendq_t *pQ, ln_noise_t *pNoise);
+static bool sendq_write(lnapp_sendq_t *pQ, int Sock);
+
+
+/********************************************************************
+ * public functions
+ ********************************************************************/
+
+void lnapp_sendq_init(lnapp_sendq_t *pQ)
+{
+    pthread_mutex_init(&pQ->mux, NULL);
+    pthread_cond_init(&pQ->cond, NULL);
+    for (int lp = 0; lp < LNAPP_SENDQ_LANE_NUM; lp++) {
+        ring_init(&pQ->lane[lp]);
+    }
+    ring_init(&pQ->wire);
+    pQ->wire_offset = 0;
+    pQ->err = false;
+}
+
+
+void lnapp_sendq_term(lnapp_sendq_t *pQ)
+{
+    lnapp_sendq_clear(pQ);
+    pthread_cond_destroy(&pQ->cond);
+    pthread_mutex_destroy(&pQ->mux);
+}
+
+
+void lnapp_sendq_clear(lnapp_sendq_t *pQ)
+{
+    pthread_mutex_lock(&pQ->mux);
+    for (int lp = 0; lp < LNAPP_SENDQ_LANE_NUM; lp++) {
+        ring_free(&pQ->lane[lp]);
+    }
+    ring_free(&pQ->wire);
+    pQ->wire_offset = 0;
+    pQ->err = false;
+    pthread_cond_broadcast(&pQ->cond);
+    pthread_mutex_unlock(&pQ->mux);
+}
+
+
+bool lnapp_sendq_push(lnapp_sendq_t *pQ, lnapp_sendq_lane_t Lane, const uint8_t *pData, uint16_t Len)
+{
+    bool ret = false;
+    utl_buf_t frame = UTL_BUF_INIT;
+
+    pthread_mutex_lock(&pQ->mux);
+    if (pQ->err) {
+        LOGE("fail: send error\n");
+        goto LABEL_EXIT;
+    }
+    if (pQ->lane[Lane].bytes + LN_SZ_NOISE_FRAME(Len) > M_LANE_MAX[Lane]) {
+        LOGE("fail: lane[%d] full(%lu bytes)\n", (int)Lane, (unsigned long)pQ->lane[Lane].bytes);
+        goto LABEL_EXIT;
+    }
+
+    //暗号化するときに同じ領域を使う
+    utl_buf_alloc(&frame, LN_SZ_NOISE_FRAME(Len));
+    memcpy(frame.buf + M_SZ_NOISE_HEADER, pData, Len);
+    ring_push(&pQ->lane[Lane], &frame);
+    ret = true;
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&pQ->mux);
+    return ret;
+}
+
+
+bool lnapp_sendq_flush(lnapp_sendq_t *pQ, int Sock, ln_noise_t *pNoise)
+{
+    bool ret = true;
+
+    pthread_mutex_lock(&pQ->mux);
+    if (pQ->err) {
+        ret = false;
+        goto LABEL_EXIT;
+    }
+    for (;;) {
+        if (!sendq_encrypt(pQ, pNoise)) {
+            ret = false;
+            break;
+        }
+        if (pQ->wire.num == 0) {
+            break;
+        }
+        size_t bytes = pQ->wire.bytes;
+        if (!sendq_write(pQ, Sock)) {
+            ret = false;
+            break;
+        }
+        if (pQ->wire.bytes == bytes) {
+            //EAGAIN
+            break;
+        }
+    }
+    if (!ret) {
+        pQ->err = true;
+    }
+    pthread_cond_broadcast(&pQ->cond);
+
+LABEL_EXIT:
+    pthread_mutex_unlock(&pQ->mux);
+    return ret;
+}
+
+
+bool lnapp_sendq_pending(lnapp_sendq_t *pQ)
+{
+    pthread_mutex_lock(&pQ->mux);
+    bool ret = (pQ->wire.num > 0);
+    for (int lp = 0; lp < LNAPP_SENDQ_LANE_NUM; lp++) {
+        ret |= (pQ->lane[lp].num > 0);
+    }
+    pthread_mutex_unlock(&pQ->mux);
+    return ret;
+}
+
+
+size_t lnapp_sendq_bytes(lnapp_sendq_t *pQ, lnapp_sendq_lane_t Lane)
+{
+    pthread_mutex_lock(&pQ->mux);
+    size_t bytes = pQ->lane[Lane].bytes + pQ->wire.bytes - pQ->wire_offset;
+    pthread_mutex_unlock(&pQ->mux);
+    return bytes;
+}
+
+
+bool lnapp_sendq_wait(lnapp_sendq_t *pQ, lnapp_sendq_lane_t Lane, size_t Bytes, uint32_t ToMsec)
+{
+    bool ret = true;
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ToMsec / 1000;
+    ts.tv_nsec += (long)(ToMsec % 1000) * 1000000;
+    if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&pQ->mux);
+    while (pQ->lane[Lane].bytes + pQ->wire.bytes - pQ->wire_offset > Bytes) {
+        if (pQ->err) {
+            ret = false;
+            break;
+        }
+        if (pthread_cond_timedwait(&pQ->cond, &pQ->mux, &ts) == ETIMEDOUT) {
+            ret = false;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pQ->mux);
+    return ret;
+}
+
+
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+static void ring_init(lnapp_sendq_ring_t *pRing)
+{
+    memset(pRing, 0, sizeof(lnapp_sendq_ring_t));
+}
+
+
+static void ring_free(lnapp_sendq_ring_t *pRing)
+{
+    for (uint32_t lp = 0; lp < pRing->num; lp++) {
+        utl_buf_free(ring_at(pRing, lp));
+    }
+    UTL_DBG_FREE(pRing->p_frames);
+    ring_init(pRing);
+}
+
+
+/** ring末尾に追加
+ *
+ * @param[in,out]   pRing
+ * @param[in]       pFrame      追加する領域(所有権はringに移る)
+ */
+static void ring_push(lnapp_sendq_ring_t *pRing, const utl_buf_t *pFrame)
+{
+    if (pRing->num == pRing->size) {
+        //拡張: headから並べなおす
+        uint32_t size = (pRing->size == 0) ? M_RING_INIT : pRing->size * 2;
+        utl_buf_t *p_frames = (utl_buf_t *)UTL_DBG_MALLOC(sizeof(utl_buf_t) * size);
+        for (uint32_t lp = 0; lp < pRing->num; lp++) {
+            p_frames[lp] = *ring_at(pRing, lp);
+        }
+        UTL_DBG_FREE(pRing->p_frames);
+        pRing->p_frames = p_frames;
+        pRing->size = size;
+        pRing->head = 0;
+    }
+    pRing->p_frames[(pRing->head + pRing->num) % pRing->size] = *pFrame;
+    pRing->num++;
+    pRing->bytes += pFrame->len;
+}
+
+
+static utl_buf_t *ring_at(lnapp_sendq_ring_t *pRing, uint32_t Idx)
+{
+    return &pRing->p_frames[(pRing->head + Idx) % pRing->size];
+}
+
+
+/** ring先頭を取り出す
+ *
+ * @param[in,out]   pRing
+ * @param[out]      pFrame      取り出した領域(所有権は呼び出し元に移る)
+ */
+static void ring_pop(lnapp_sendq_ring_t *pRing, utl_buf_t *pFrame)
+{
+    *pFrame = pRing->p_frames[pRing->head];
+    pRing->head = (pRing->head + 1) % pRing->size;
+    pRing->num--;
+    pRing->bytes -= pFrame->len;
+}
+
+
+/** 暗号化してwireに移動
+ *
+ * 優先度の高いlaneから順に、wireがM_WIRE_MAXを超えるまで暗号化する。
+ * 先に暗号化したframeより後に暗号化したframeを先に送ることはできないため、
+ * wireに溜める量を制限して、優先度の高いメッセージが待たされる量を抑える。
+ *
+ * @param[in,out]   pQ
+ * @param[in,out]   pNoise      noise情報
+ * @retval  true    成功
+ */
+static bool sendq_encrypt(lnapp_sendq_t *pQ, ln_noise_t *pNoise)
+{
+    for (int lane = 0; lane < LNAPP_SENDQ_LANE_NUM; lane++) {
+        while ((pQ->lane[lane].num > 0) && (pQ->wire.bytes < M_WIRE_MAX)) {
+            utl_buf_t frame;
+            ring_pop(&pQ->lane[lane], &frame);
+            uint16_t len = (uint16_t)(frame.len - LN_SZ_NOISE_FRAME(0));
+            if (!ln_noise_enc_frame(pNoise, frame.buf, frame.buf + M_SZ_NOISE_HEADER, len)) {
+                LOGE("fail: noise encode\n");
+                utl_buf_free(&frame);
+                return false;
+            }
+            ring_push(&pQ->wire, &frame);
+        }
+    }
+    return true;
+}
+
+
+/** wireの送信
+ *
+ * 1回のwritev()で送信し、送信しきったframeを解放する。
+ *
+ * @param[in,out]   pQ
+ * @param[in]       Sock        送信先socket(non-blocking)
+ * @retval  true    成功(EAGAINを含む)
+ */
+static bool sendq_write(lnapp_sendq_t *pQ, int Sock)
+{
+    struct iovec iov[M_IOV_MAX];
+    int iovcnt = 0;
+
+    for (uint32_t lp = 0; (lp < pQ->wire.num) && (iovcnt < M_IOV_MAX); lp++) {
+        utl_buf_t *p_frame = ring_at(&pQ->wire, lp);
+        uint32_t offset = (lp == 0) ? pQ->wire_offset : 0;
+        iov[iovcnt].iov_base = p_frame->buf + offset;
+        iov[iovcnt].iov_len = p_frame->len - offset;
+        iovcnt++;
+    }
+    ssize_t sz = writev(Sock, iov, iovcnt);
+    if (sz < 0) {
+        if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+            return true;
+        }
+        LOGE("fail: writev %s\n", strerror(errno));
+        return false;
+    }
+
+    //送信済みを進める
+    size_t rest = (size_t)sz;
+    while (rest > 0) {
+        utl_buf_t *p_frame = ring_at(&pQ->wire, 0);
+        size_t remain = p_frame->len - pQ->wire_offset;
+        if (rest < remain) {
+            pQ->wire_offset += (uint32_t)rest;
+            break;
+        }
+        rest -= remain;
+        utl_buf_t frame;
+        ring_pop(&pQ->wire, &frame);
+        utl_buf_free(&frame);
+        pQ->wire_offset = 0;
+    }
+    return true;
+}
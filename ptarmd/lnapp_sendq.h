@@ -0,0 +1,176 @@
+/*
+ *  Copyright (C) 2017 Ptarmigan Project
+ *  SPDX-License-Identifier: Apache-2.0
+ *
+ *  Licensed to the Apache Software Foundation (ASF) under one
+ *  or more contributor license agreements.  See the NOTICE file
+ *  distributed with this work for additional information
+ *  regarding copyright ownership.  The ASF licenses this file
+ *  to you under the Apache License, Version 2.0 (the
+ *  "License"); you may not use this file except in compliance
+ *  with the License.  You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing,
+ *  software distributed under the License is distributed on an
+ *  "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *  KIND, either express or implied.  See the License for the
+ *  specific language governing permissions and limitations
+ *  under the License.
+ */
+/** @file   lnapp_sendq.h
+ *  @brief  peer送信キュー
+ *
+ * 送信メッセージはlaneごとのキューに入れ、socketに書き込めるときに
+ * 優先度の高いlaneから暗号化してwritev()でまとめて送信する。
+ * Noise Protocolのnonceは暗号化した順に進むため、暗号化は送信する直前に行う。
+ */
+#ifndef LNAPP_SENDQ_H__
+#define LNAPP_SENDQ_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "utl_buf.h"
+
+#include "ln_noise.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/********************************************************************
+ * typedefs
+ ********************************************************************/
+
+/** @enum   lnapp_sendq_lane_t
+ *  @brief  送信キューのlane(番号が小さいほど優先)
+ */
+typedef enum {
+    LNAPP_SENDQ_LANE_HIGH,          ///< channel状態に関わるメッセージ
+    LNAPP_SENDQ_LANE_BULK,          ///< gossip
+    LNAPP_SENDQ_LANE_NUM
+} lnapp_sendq_lane_t;
+
+
+/** @struct lnapp_sendq_ring_t
+ *  @brief  noise packet領域のring
+ *
+ * 各要素は#LN_SZ_NOISE_FRAME()のサイズで確保し、暗号化前は先頭のlength+MACの後ろにメッセージを置く。
+ */
+typedef struct {
+    utl_buf_t       *p_frames;      ///< ring(UTL_DBG_MALLOC)
+    uint32_t        size;           ///< p_frames要素数
+    uint32_t        head;           ///< 先頭index
+    uint32_t        num;            ///< 要素数
+    size_t          bytes;          ///< 全要素のbyte数
+} lnapp_sendq_ring_t;
+
+
+/** @struct lnapp_sendq_t
+ *  @brief  peer送信キュー
+ */
+typedef struct {
+    pthread_mutex_t     mux;                                ///< キュー操作と暗号化のmutex
+    pthread_cond_t      cond;                               ///< キューが減ったことの通知
+    lnapp_sendq_ring_t  lane[LNAPP_SENDQ_LANE_NUM];         ///< 暗号化前
+    lnapp_sendq_ring_t  wire;                               ///< 暗号化済み(この順で送信する)
+    uint32_t            wire_offset;                        ///< wire先頭の送信済みbyte数
+    bool                err;                                ///< true:送信エラー発生
+} lnapp_sendq_t;
+
+
+/********************************************************************
+ * prototypes
+ ********************************************************************/
+
+/** 初期化
+ *
+ * @param[out]      pQ
+ */
+void lnapp_sendq_init(lnapp_sendq_t *pQ);
+
+
+/** 終了
+ *
+ * @param[in,out]   pQ
+ */
+void lnapp_sendq_term(lnapp_sendq_t *pQ);
+
+
+/** 全メッセージ破棄
+ *
+ * 接続しなおす場合に呼び出す。
+ *
+ * @param[in,out]   pQ
+ */
+void lnapp_sendq_clear(lnapp_sendq_t *pQ);
+
+
+/** メッセージ追加
+ *
+ * メッセージはコピーする。
+ *
+ * @param[in,out]   pQ
+ * @param[in]       Lane        追加するlane
+ * @param[in]       pData       送信メッセージ
+ * @param[in]       Len         pData長
+ * @retval  true    成功
+ * @retval  false   送信エラー発生済み, もしくはlaneが上限を超えた(相手が受信していない)
+ */
+bool lnapp_sendq_push(lnapp_sendq_t *pQ, lnapp_sendq_lane_t Lane, const uint8_t *pData, uint16_t Len);
+
+
+/** 送信
+ *
+ * 優先度の高いlaneから暗号化し、socketに書き込めるだけ書き込む。
+ * 書き込めなくなった(EAGAIN)時点で戻り、残りは次の呼び出しで送信する。
+ *
+ * @param[in,out]   pQ
+ * @param[in]       Sock        送信先socket(non-blocking)
+ * @param[in,out]   pNoise      noise情報
+ * @retval  true    成功(送信しきれなかった場合も含む)
+ * @retval  false   送信エラー
+ */
+bool lnapp_sendq_flush(lnapp_sendq_t *pQ, int Sock, ln_noise_t *pNoise);
+
+
+/** 未送信データ有無
+ *
+ * @param[in,out]   pQ
+ * @retval  true    未送信データあり
+ */
+bool lnapp_sendq_pending(lnapp_sendq_t *pQ);
+
+
+/** 未送信byte数
+ *
+ * @param[in,out]   pQ
+ * @param[in]       Lane        対象lane
+ * @return  Laneの暗号化前byte数と、暗号化済み未送信byte数の合計
+ */
+size_t lnapp_sendq_bytes(lnapp_sendq_t *pQ, lnapp_sendq_lane_t Lane);
+
+
+/** 送信待ち(back-pressure)
+ *
+ * #lnapp_sendq_bytes()がBytes以下になるまで待つ。
+ *
+ * @param[in,out]   pQ
+ * @param[in]       Lane        対象lane
+ * @param[in]       Bytes       待ち合わせるbyte数
+ * @param[in]       ToMsec      タイムアウト[msec]
+ * @retval  true    Bytes以下になった
+ * @retval  false   タイムアウト, もしくは送信エラー
+ */
+bool lnapp_sendq_wait(lnapp_sendq_t *pQ, lnapp_sendq_lane_t Lane, size_t Bytes, uint32_t ToMsec);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LNAPP_SENDQ_H__ */
@@ -60,13 +60,14 @@
  ********************************************************************/
 
 #define M_WAIT_SEND_TO_MSEC     (500)       //socket送信待ちタイムアウト[msec]
-#define M_WAIT_SEND_WAIT_MSEC   (100)       //socket送信で一度に送信できなかった場合の待ち時間[msec]
 
 
 /********************************************************************
  * prototypes
  ********************************************************************/
 
+static lnapp_sendq_lane_t send_lane(uint16_t Type);
+
 #ifdef M_DEBUG_ANNO
 extern void ln_print_announce(const uint8_t *pData, uint16_t Len);
 #endif  //M_DEBUG_ANNO
@@ -103,6 +104,7 @@ void lnapp_stop_threads(lnapp_conf_t *p_conf)
 bool lnapp_send_peer_raw(lnapp_conf_t *p_conf, const utl_buf_t *pBuf)
 {
     struct pollfd fds;
+    const uint8_t *p = pBuf->buf;
     ssize_t len = pBuf->len;
     while ((p_conf->active) && (len > 0)) {
         fds.fd = p_conf->sock;
@@ -112,15 +114,16 @@ bool lnapp_send_peer_raw(lnapp_conf_t *p_conf, const utl_buf_t *pBuf)
             LOGE("fail poll: %s\n", strerror(errno));
             break;
         }
-        ssize_t sz = write(p_conf->sock, pBuf->buf, len);
+        ssize_t sz = write(p_conf->sock, p, len);
         if (sz < 0) {
+            if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) {
+                continue;
+            }
             LOGE("fail write: %s\n", strerror(errno));
             break;
         }
+        p += sz;
         len -= sz;
-        if (len > 0) {
-            utl_thread_msleep(M_WAIT_SEND_WAIT_MSEC);
-        }
     }
 
     return len == 0;
@@ -129,6 +132,16 @@ bool lnapp_send_peer_raw(lnapp_conf_t *p_conf, const utl_buf_t *pBuf)
 
 //peer送信(Noise Protocol送信)
 bool lnapp_send_peer_noise(lnapp_conf_t *p_conf, const utl_buf_t *pBuf)
+{
+    if (!lnapp_send_peer_queue(p_conf, pBuf)) {
+        return false;
+    }
+    return lnapp_send_peer_flush(p_conf);
+}
+
+
+//peer送信キューに追加(Noise Protocol送信)
+bool lnapp_send_peer_queue(lnapp_conf_t *p_conf, const utl_buf_t *pBuf)
 {
     uint16_t type = utl_int_pack_u16be(pBuf->buf);
     LOGD("[SEND]type=%04x(%s): sock=%d, Len=%d\n", type, ln_msg_name(type), p_conf->sock, pBuf->len);
@@ -139,46 +152,34 @@ bool lnapp_send_peer_noise(lnapp_conf_t *p_conf, const utl_buf_t *pBuf)
     }
 #endif  //M_DEBUG_ANNO
 
-    pthread_mutex_lock(&p_conf->mux_send); //lock mux_send
+    if (pBuf->len > UINT16_MAX) {
+        LOGE("fail: too large: %" PRIu32 "\n", pBuf->len);
+        return false;
+    }
+    if (!lnapp_sendq_push(&p_conf->sendq, send_lane(type), pBuf->buf, (uint16_t)pBuf->len)) {
+        LOGE("fail: sendq push\n");
+        return false;
+    }
+    return true;
+}
 
-    utl_buf_t buf_enc = UTL_BUF_INIT;
-    struct pollfd fds;
-    ssize_t len = -1;
 
-    bool ret = ln_noise_enc(&p_conf->noise, &buf_enc, pBuf);
-    if (!ret) {
-        LOGE("fail: noise encode\n");
-        goto LABEL_ERROR;
+//peer送信キュー送信
+bool lnapp_send_peer_flush(lnapp_conf_t *p_conf)
+{
+    if (!p_conf->active) {
+        return false;
     }
-
-    len = buf_enc.len;
-    while ((p_conf->active) && (len > 0)) {
-        fds.fd = p_conf->sock;
-        fds.events = POLLOUT;
-        int polr = poll(&fds, 1, M_WAIT_SEND_TO_MSEC);
-        if (polr <= 0) {
-            LOGE("fail: poll %s\n", strerror(errno));
-            goto LABEL_ERROR;
-        }
-        ssize_t sz = write(p_conf->sock, buf_enc.buf, len);
-        if (sz < 0) {
-            LOGE("fail: write %s\n", strerror(errno));
-            goto LABEL_ERROR;
-        }
-        len -= sz;
-        if (len > 0) {
-            utl_thread_msleep(M_WAIT_SEND_WAIT_MSEC);
-        }
+    if (!lnapp_sendq_flush(&p_conf->sendq, p_conf->sock, &p_conf->noise)) {
+        LOGE("fail: sendq flush\n");
+        return false;
+    }
+    if (lnapp_sendq_pending(&p_conf->sendq)) {
+        //残りはevent loopで書き込めるようになったら送信する
+        //  io_writeの開始/停止はloop threadだけが行う(#peer_ev_update())
+        lnapp_wakeup(p_conf);
     }
-
-    pthread_mutex_unlock(&p_conf->mux_send);
-    utl_buf_free(&buf_enc);
     return true;
-
-LABEL_ERROR:
-    pthread_mutex_unlock(&p_conf->mux_send); //unlock mux_send
-    utl_buf_free(&buf_enc);
-    return false;
 }
 
 
@@ -220,3 +221,30 @@ void lnapp_set_last_error(lnapp_conf_t *p_conf, int Err, const char *pErrStr, co
 }
 
 
+/********************************************************************
+ * private functions
+ ********************************************************************/
+
+/** 送信laneの選択
+ *
+ * gossipはchannel状態に関わるメッセージより後回しにする。
+ *
+ * @param[in]   Type    message type
+ * @return  送信lane
+ */
+static lnapp_sendq_lane_t send_lane(uint16_t Type)
+{
+    switch (Type) {
+    case MSGTYPE_CHANNEL_ANNOUNCEMENT:
+    case MSGTYPE_NODE_ANNOUNCEMENT:
+    case MSGTYPE_CHANNEL_UPDATE:
+    case MSGTYPE_QUERY_SHORT_CHANNEL_IDS:
+    case MSGTYPE_REPLY_SHORT_CHANNEL_IDS_END:
+    case MSGTYPE_QUERY_CHANNEL_RANGE:
+    case MSGTYPE_REPLY_CHANNEL_RANGE:
+    case MSGTYPE_GOSSIP_TIMESTAMP_FILTER:
+        return LNAPP_SENDQ_LANE_BULK;
+    default:
+        return LNAPP_SENDQ_LANE_HIGH;
+    }
+}
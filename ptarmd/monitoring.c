@@ -32,6 +32,7 @@
 
 #define LOG_TAG     "monitoring"
 #include "utl_log.h"
+#include "utl_time.h"
 
 #include "ln_msg_anno.h"
 #include "ln_wallet.h"
@@ -61,6 +62,8 @@
 #endif
 #define M_WAIT_MON_PRUNE_NODE_SEC           (5)         ///< monitoring cyclic[sec] (prune node)
 #define M_WAIT_MON_PROC_INACTIVE_NODE_SEC   (1)         ///< monitoring cyclic[sec] (proc inactive node)
+#define M_WAIT_MON_INVOICE_SEC              (3600)      ///< monitoring cyclic[sec] (remove expired invoice)
+#define M_INVOICE_EXPIRED_KEEP_SEC          (7 * 24 * 3600)     ///< 期限切れinvoiceを残しておく時間[sec]
 
 //offset for btcrpc_search_outpoint(), btcrpc_search_vout()
 #define M_SEARCH_OUTPOINT(conf)         ((conf) + 3)
@@ -179,6 +182,9 @@ void *monitor_start(void *pArg)
         if (!(lp % M_WAIT_MON_PROC_INACTIVE_NODE_SEC)) {
             lnapp_manager_each_node(proc_inactive_channel, NULL);
         }
+        if (!(lp % M_WAIT_MON_INVOICE_SEC)) {
+            /*ignore*/ln_db_preimage_del_expired((uint64_t)utl_time_time() - M_INVOICE_EXPIRED_KEEP_SEC, NULL);
+        }
         mActive = !btcrpc_exception_happen();
         sleep(1);
     }
@@ -445,9 +451,9 @@ static bool funding_unspent(lnapp_conf_t *pConf, monparam_t *pParam, void *pDbPa
     }
 
     //Offered HTLCのtimeoutチェック
-    for (int lp = 0; lp < LN_UPDATE_MAX; lp++) {
+    for (uint16_t lp = 0; ln_update_info_next_used(&p_channel->update_info, &lp); lp++) {
         if (ln_is_offered_htlc_timeout(p_channel, lp, pParam->height)) {
-            LOGD("detect: offered HTLC timeout[%d] --> close 0x%016" PRIx64 "\n", lp, ln_short_channel_id(p_channel));
+            LOGD("detect: offered HTLC timeout[%u] --> close 0x%016" PRIx64 "\n", lp, ln_short_channel_id(p_channel));
             bool ret = monitor_close_unilateral_local(p_channel);
             if (!ret) {
                 LOGE("fail: unilateral close\n");
@@ -474,6 +480,7 @@ static bool funding_unspent(lnapp_conf_t *pConf, monparam_t *pParam, void *pDbPa
             if (ret) {
                 LOGD("bindex=%d, bheight=%d\n", bindex, bheight);
                 ln_short_channel_id_set_param(p_channel, bheight, bindex);
+                lnapp_manager_set_short_channel_id(pConf->node_id, ln_short_channel_id(p_channel));
 
                 //mined block hash
                 ln_funding_blockhash_set(p_channel, mined_hash);
@@ -65,22 +65,10 @@
 volatile bool           mActive = true;
 
 
-/********************************************************************
- * typedefs
- ********************************************************************/
-
-typedef struct {
-    uint64_t short_channel_id;
-    uint8_t node_id[BTC_SZ_PUBKEY];
-    bool found;
-} param_search_node_t;
-
-
 /********************************************************************
  * prototypes
  ********************************************************************/
 
-static void search_node_by_short_channel_id(lnapp_conf_t *pConf, void *pParam);
 static void show_channel(lnapp_conf_t *pConf, void *pParam);
 static int connect_byname(int sock, const char *name, int port);
 
@@ -410,14 +398,16 @@ lnapp_conf_t *p2p_search_active_node(const uint8_t *pNodeId)
 
 lnapp_conf_t *p2p_search_active_channel(uint64_t short_channel_id)
 {
-    param_search_node_t param;
-    param.short_channel_id = short_channel_id;
-    param.found = false;
-
-    lnapp_manager_each_node(search_node_by_short_channel_id, &param);
-    if (!param.found) return NULL;
-
-    return p2p_search_active_node(param.node_id);
+    lnapp_conf_t *p_conf = lnapp_manager_get_node_by_short_channel_id(short_channel_id);
+    if (!p_conf) return NULL;
+    pthread_mutex_lock(&p_conf->mux_conf);
+    bool ret = lnapp_match_short_channel_id(p_conf, short_channel_id);
+    pthread_mutex_unlock(&p_conf->mux_conf);
+    if (!ret) {
+        lnapp_manager_free_node_ref(p_conf);
+        return NULL;
+    }
+    return p_conf;
 }
 
 void p2p_show_channel(cJSON *pResult)
@@ -430,21 +420,6 @@ void p2p_show_channel(cJSON *pResult)
  * private functions
  ********************************************************************/
 
-static void search_node_by_short_channel_id(lnapp_conf_t *pConf, void *pParam)
-{
-    param_search_node_t *p_param = (param_search_node_t *)pParam;
-    if (p_param->found) return;
-
-    pthread_mutex_lock(&pConf->mux_conf);
-    bool ret = lnapp_match_short_channel_id(pConf, p_param->short_channel_id);
-    pthread_mutex_unlock(&pConf->mux_conf);
-    if (ret) {
-        p_param->found = true;
-        memcpy(p_param->node_id, pConf->node_id, BTC_SZ_PUBKEY);
-    }
-}
-
-
 static void show_channel(lnapp_conf_t *pConf, void *pParam)
 {
     cJSON *pResult = (cJSON *)pParam;
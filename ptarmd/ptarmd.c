@@ -63,12 +63,15 @@
 #include "btc_crypto.h"
 
 #include "ln_setupctl.h"
+#include "ln_anno_ingest.h"
+#include "ln_crypto_pool.h"
 
 #include "ptarmd.h"
 #include "btcrpc.h"
 #include "p2p.h"
 #include "lnapp.h"
 #include "lnapp_manager.h"
+#include "lnapp_cb.h"
 #include "monitoring.h"
 #include "cmd_json.h"
 
@@ -198,6 +201,16 @@ int ptarmd_start(uint16_t RpcPort, const ln_node_t *pNode, btc_block_chain_t Gen
     }
     lnapp_global_init();
     lnapp_manager_init();
+
+    //announcement署名検証用
+    long cpu_num = sysconf(_SC_NPROCESSORS_ONLN);
+    if (!ln_anno_ingest_start((cpu_num > 0) ? (uint32_t)cpu_num : 1, lnapp_anno_ingest_notify)) {
+        LOGE("fail: ln_anno_ingest_start\n");
+    }
+    //commit_tx HTLC署名作成・検証用
+    if (!ln_crypto_pool_start((cpu_num > 0) ? (uint32_t)cpu_num : 1)) {
+        LOGE("fail: ln_crypto_pool_start\n");
+    }
     if (!lnapp_manager_start_origin_node(lnapp_thread_channel_origin_start)) {
         return -3;
     }
@@ -248,7 +261,10 @@ int ptarmd_start(uint16_t RpcPort, const ln_node_t *pNode, btc_block_chain_t Gen
     ptarmd_eventlog(NULL,
             "ptarmd end: total_msat=%" PRIu64 "\n", total_amount);
 
+    ln_anno_ingest_stop();
+    ln_crypto_pool_stop();
     lnapp_manager_term();
+    lnapp_global_term();
     ln_db_term();
 
     return 0;
@@ -21,6 +21,10 @@ extern "C" {
 #include "lnapp.c"
 #include "lnapp_cb.c"
 #include "lnapp_util.c"
+#undef LOG_TAG
+#include "lnapp_sendq.c"
+#undef LOG_TAG
+#include "lnapp_ev.c"
 }
 
 
@@ -32,6 +36,7 @@ FAKE_VALUE_FUNC(const uint8_t *,ln_remote_node_id, const ln_channel_t *);
 FAKE_VALUE_FUNC(uint64_t, ln_short_channel_id, const ln_channel_t *);
 FAKE_VALUE_FUNC(const char *, ln_msg_name, uint16_t );
 FAKE_VALUE_FUNC(bool, ln_noise_enc, ln_noise_t *, utl_buf_t *, const utl_buf_t *);
+FAKE_VALUE_FUNC(bool, ln_noise_enc_frame, ln_noise_t *, uint8_t *, const uint8_t *, uint16_t);
 FAKE_VALUE_FUNC(bool, ln_get_ids_cnl_anno, uint64_t *, uint8_t *, uint8_t *, const uint8_t *, uint16_t );
 FAKE_VOID_FUNC(ln_short_channel_id_get_param, uint32_t *, uint32_t *, uint32_t *, uint64_t );
 FAKE_VOID_FUNC(ln_short_channel_id_string, char *, uint64_t );
@@ -46,8 +51,11 @@ FAKE_VALUE_FUNC(bool, ln_db_nodeanno_info_add_node_id, void *, const uint8_t *,
 FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_get, void *, uint64_t *, char *, uint32_t *, utl_buf_t *);
 FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_back, void *);
 FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_del, void *);
+FAKE_VALUE_FUNC(bool, ln_db_cnlanno_cur_seek, void *, uint64_t *, char *, uint32_t *, utl_buf_t *, uint64_t );
 FAKE_VALUE_FUNC(bool, ln_db_anno_transaction);
-FAKE_VOID_FUNC(ln_db_anno_commit, bool);
+FAKE_VALUE_FUNC(bool, ln_db_anno_commit, bool);
+FAKE_VALUE_FUNC(bool, ln_db_anno_read_begin);
+FAKE_VOID_FUNC(ln_db_anno_read_end);
 FAKE_VALUE_FUNC(bool, ln_db_anno_cur_open, void **, ln_db_cur_t );
 FAKE_VOID_FUNC(ln_db_anno_cur_close, void *);
 FAKE_VALUE_FUNC(bool, ln_db_cnlanno_del, uint64_t );
@@ -94,6 +102,7 @@ protected:
         RESET_FAKE(ln_db_cnlanno_cur_get);
         RESET_FAKE(ln_db_cnlanno_cur_back);
         RESET_FAKE(ln_db_cnlanno_cur_del);
+        RESET_FAKE(ln_db_cnlanno_cur_seek);
         
         ln_msg_name_fake.custom_fake = dummy::ln_msg_name;
         ln_noise_enc_fake.return_val = false;
@@ -169,9 +178,12 @@ TEST_F(lnapp, send_cnl_ok1)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata_cnl(&conf, &push, 0, 0, NULL, NULL);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata_cnl(&conf, &push, &sent, 0, 0, NULL, NULL);
     ASSERT_TRUE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -187,9 +199,12 @@ TEST_F(lnapp, send_cnl_ok2)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata_cnl(&conf, &push, 0, 0, NULL, &buf);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata_cnl(&conf, &push, &sent, 0, 0, NULL, &buf);
     ASSERT_TRUE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -208,9 +223,12 @@ TEST_F(lnapp, send_node_ok1)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata_node(&conf, &push, 0, 0, &buf);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata_node(&conf, &push, &sent, 0, 0, &buf);
     ASSERT_TRUE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -229,9 +247,12 @@ TEST_F(lnapp, send_node_ok2)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata_node(&conf, &push, 0, 0, &buf);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata_node(&conf, &push, &sent, 0, 0, &buf);
     ASSERT_TRUE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -247,9 +268,12 @@ TEST_F(lnapp, send_node_ng)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata_node(&conf, &push, 0, 0, &buf);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata_node(&conf, &push, &sent, 0, 0, &buf);
     ASSERT_FALSE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -276,9 +300,12 @@ TEST_F(lnapp, send_ok1)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata(&conf, &push, 0, &buf, NULL, NULL, NULL, NULL);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata(&conf, &push, &sent, 0, &buf, NULL, NULL, NULL, NULL);
     ASSERT_TRUE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -310,9 +337,12 @@ TEST_F(lnapp, send_ok2)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata(&conf, &push, 0, &buf, NULL, NULL, NULL, NULL);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata(&conf, &push, &sent, 0, &buf, NULL, NULL, NULL, NULL);
     ASSERT_TRUE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -345,7 +375,7 @@ TEST_F(lnapp, send_ok2)
 //     utl_buf_t buf2 = UTL_BUF_INIT;
 //     utl_push_t push;
 //     utl_push_init(&push, &buf2, 0);
-//     bool ret = anno_senddata(&conf, &push, 0, &buf, NULL, NULL, NULL, NULL);
+//     bool ret = anno_senddata(&conf, &push, &sent, 0, &buf, NULL, NULL, NULL, NULL);
 //     ASSERT_TRUE(ret);
 //     utl_buf_free(&buf2);
 // }
@@ -370,9 +400,12 @@ TEST_F(lnapp, send_ng1)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata(&conf, &push, 0, &buf, NULL, NULL, NULL, NULL);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata(&conf, &push, &sent, 0, &buf, NULL, NULL, NULL, NULL);
     ASSERT_FALSE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -400,9 +433,12 @@ TEST_F(lnapp, send_ng2)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata(&conf, &push, 0, &buf, NULL, NULL, NULL, NULL);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata(&conf, &push, &sent, 0, &buf, NULL, NULL, NULL, NULL);
     ASSERT_FALSE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -430,9 +466,12 @@ TEST_F(lnapp, send_ng3)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata(&conf, &push, 0, &buf, NULL, NULL, NULL, NULL);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata(&conf, &push, &sent, 0, &buf, NULL, NULL, NULL, NULL);
     ASSERT_FALSE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -460,9 +499,12 @@ TEST_F(lnapp, send_ng4)
     utl_buf_t buf2 = UTL_BUF_INIT;
     utl_push_t push;
     utl_push_init(&push, &buf2, 0);
-    bool ret = anno_senddata(&conf, &push, 0, &buf, NULL, NULL, NULL, NULL);
+    anno_sent_t sent;
+    anno_sent_init(&sent);
+    bool ret = anno_senddata(&conf, &push, &sent, 0, &buf, NULL, NULL, NULL, NULL);
     ASSERT_TRUE(ret);
     utl_buf_free(&buf2);
+    anno_sent_free(&sent);
 }
 
 
@@ -471,8 +513,11 @@ TEST_F(lnapp, proc_ok1)
     lnapp_conf_t conf;
     memset(&conf, 0, sizeof(conf));
     conf.active = true;
+    lnapp_sendq_init(&conf.sendq);
 
+    ln_db_anno_read_begin_fake.return_val = true;
     ln_db_anno_transaction_fake.return_val = true;
+    ln_db_anno_commit_fake.return_val = true;
     ln_db_anno_cur_open_fake.return_val = true;
     ln_db_cnlanno_del_fake.return_val = true;
     btcrpc_gettxid_from_short_channel_fake.return_val = true;
@@ -507,5 +552,6 @@ TEST_F(lnapp, proc_ok1)
     ln_db_cnlanno_cur_get_fake.custom_fake = local::ln_db_cnlanno_cur_get;
 
     bool ret = anno_proc(&conf);
+    lnapp_sendq_term(&conf.sendq);
     ASSERT_TRUE(ret);
 }
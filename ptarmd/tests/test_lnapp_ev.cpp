@@ -0,0 +1,194 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+
+extern "C" {
+#undef LOG_TAG
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+//評価対象本体
+#undef LOG_TAG
+#include "lnapp_ev.c"
+}
+
+
+////////////////////////////////////////////////////////////////////////
+
+namespace {
+    struct call_t {
+        pthread_t   th;
+        int         cnt;
+    };
+
+    void cb_call(struct ev_loop *pLoop, void *pArg) {
+        call_t *p = (call_t *)pArg;
+        p->th = pthread_self();
+        p->cnt++;
+    }
+
+    //loop thread上から同じloopを呼んでも待たない
+    struct nest_t {
+        int         idx;
+        call_t      call;
+    };
+
+    void cb_nest(struct ev_loop *pLoop, void *pArg) {
+        nest_t *p = (nest_t *)pArg;
+        lnapp_ev_call(p->idx, cb_call, &p->call);
+    }
+
+    //watcher
+    struct watch_t {
+        ev_io       io;
+        ev_timer    tm;
+        int         fd;
+        int         io_cnt;
+        int         tm_cnt;
+        pthread_t   th_io;
+        pthread_t   th_tm;
+    };
+
+    void cb_io(struct ev_loop *pLoop, ev_io *pWatcher, int Revents) {
+        watch_t *p = (watch_t *)pWatcher->data;
+        uint64_t val;
+        if (read(p->fd, &val, sizeof(val)) == sizeof(val)) {
+            p->io_cnt++;
+            p->th_io = pthread_self();
+        }
+    }
+
+    void cb_tm(struct ev_loop *pLoop, ev_timer *pTimer, int Revents) {
+        watch_t *p = (watch_t *)pTimer->data;
+        p->tm_cnt++;
+        p->th_tm = pthread_self();
+    }
+
+    void cb_watch_start(struct ev_loop *pLoop, void *pArg) {
+        watch_t *p = (watch_t *)pArg;
+        ev_io_init(&p->io, cb_io, p->fd, EV_READ);
+        p->io.data = p;
+        ev_io_start(pLoop, &p->io);
+        ev_timer_init(&p->tm, cb_tm, 0.01, 0.);
+        p->tm.data = p;
+        ev_timer_start(pLoop, &p->tm);
+    }
+
+    void cb_watch_stop(struct ev_loop *pLoop, void *pArg) {
+        watch_t *p = (watch_t *)pArg;
+        ev_io_stop(pLoop, &p->io);
+        ev_timer_stop(pLoop, &p->tm);
+    }
+}
+
+
+class lnapp_ev: public testing::Test {
+protected:
+    virtual void SetUp() {
+        utl_log_init_stderr();
+    }
+
+    virtual void TearDown() {
+        lnapp_ev_stop();
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(lnapp_ev, start_stop)
+{
+    ASSERT_FALSE(lnapp_ev_start(0));
+    ASSERT_FALSE(lnapp_ev_start(LNAPP_EV_THREAD_MAX + 1));
+    ASSERT_TRUE(lnapp_ev_start(2));
+    ASSERT_FALSE(lnapp_ev_start(2));        //開始済み
+    lnapp_ev_stop();
+
+    call_t call = { 0, 0 };
+    ASSERT_FALSE(lnapp_ev_call(0, cb_call, &call));
+    ASSERT_EQ(0, call.cnt);
+}
+
+
+TEST_F(lnapp_ev, assign)
+{
+    ASSERT_TRUE(lnapp_ev_start(3));
+
+    int cnt[3] = { 0 };
+    for (int lp = 0; lp < 30; lp++) {
+        int idx = lnapp_ev_assign();
+        ASSERT_GE(idx, 0);
+        ASSERT_LT(idx, 3);
+        cnt[idx]++;
+    }
+    ASSERT_EQ(10, cnt[0]);
+    ASSERT_EQ(10, cnt[1]);
+    ASSERT_EQ(10, cnt[2]);
+}
+
+
+TEST_F(lnapp_ev, call)
+{
+    ASSERT_TRUE(lnapp_ev_start(2));
+
+    call_t call0 = { 0, 0 };
+    call_t call1 = { 0, 0 };
+    for (int lp = 0; lp < 100; lp++) {
+        ASSERT_TRUE(lnapp_ev_call(0, cb_call, &call0));
+        ASSERT_TRUE(lnapp_ev_call(1, cb_call, &call1));
+    }
+    //呼び出しは完了してから戻る
+    ASSERT_EQ(100, call0.cnt);
+    ASSERT_EQ(100, call1.cnt);
+    //それぞれのloop threadで呼ばれる
+    ASSERT_FALSE(pthread_equal(pthread_self(), call0.th));
+    ASSERT_FALSE(pthread_equal(call0.th, call1.th));
+
+    nest_t nest;
+    memset(&nest, 0, sizeof(nest));
+    nest.idx = 0;
+    ASSERT_TRUE(lnapp_ev_call(0, cb_nest, &nest));
+    ASSERT_EQ(1, nest.call.cnt);
+    ASSERT_TRUE(pthread_equal(call0.th, nest.call.th));
+
+    ASSERT_FALSE(lnapp_ev_call(2, cb_call, &call0));
+}
+
+
+TEST_F(lnapp_ev, watcher)
+{
+    ASSERT_TRUE(lnapp_ev_start(2));
+
+    watch_t watch;
+    memset(&watch, 0, sizeof(watch));
+    watch.fd = eventfd(0, EFD_NONBLOCK);
+    ASSERT_GE(watch.fd, 0);
+
+    call_t call = { 0, 0 };
+    ASSERT_TRUE(lnapp_ev_call(1, cb_call, &call));
+    ASSERT_TRUE(lnapp_ev_call(1, cb_watch_start, &watch));
+
+    uint64_t val = 1;
+    ASSERT_EQ(sizeof(val), write(watch.fd, &val, sizeof(val)));
+    for (int lp = 0; (lp < 100) && ((watch.io_cnt == 0) || (watch.tm_cnt == 0)); lp++) {
+        usleep(10000);
+    }
+    ASSERT_TRUE(lnapp_ev_call(1, cb_watch_stop, &watch));
+    ASSERT_EQ(1, watch.io_cnt);
+    ASSERT_EQ(1, watch.tm_cnt);
+    //watcherは登録したloopのthreadで呼ばれる
+    ASSERT_TRUE(pthread_equal(call.th, watch.th_io));
+    ASSERT_TRUE(pthread_equal(call.th, watch.th_tm));
+
+    //停止後は呼ばれない
+    ASSERT_EQ(sizeof(val), write(watch.fd, &val, sizeof(val)));
+    usleep(20000);
+    ASSERT_EQ(1, watch.io_cnt);
+    close(watch.fd);
+}
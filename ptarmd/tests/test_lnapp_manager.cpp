@@ -0,0 +1,290 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#undef LOG_TAG
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_str.c"
+//評価対象本体
+#undef LOG_TAG
+#include "lnapp_manager.c"
+}
+
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+typedef void *(*thread_start_t)(void *);
+
+FAKE_VOID_FUNC(lnapp_conf_init, lnapp_conf_t *, const uint8_t *, thread_start_t);
+FAKE_VOID_FUNC(lnapp_conf_term, lnapp_conf_t *);
+FAKE_VOID_FUNC(lnapp_start, lnapp_conf_t *);
+FAKE_VOID_FUNC(_lnapp_stop_and_join, lnapp_conf_t *);
+FAKE_VOID_FUNC(lnapp_stop, lnapp_conf_t *);
+FAKE_VOID_FUNC(lnapp_join, lnapp_conf_t *);
+FAKE_VALUE_FUNC(void *, lnapp_thread_channel_start, void *);
+FAKE_VALUE_FUNC(ln_status_t, ln_status_get, const ln_channel_t *);
+FAKE_VALUE_FUNC(bool, ln_db_channel_search_cont, ln_db_func_cmp_t, void *);
+FAKE_VOID_FUNC(ln_db_copy_channel, ln_channel_t *, const ln_channel_t *);
+FAKE_VALUE_FUNC(bool, ln_db_cnlanno_load, utl_buf_t *, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_forward_add_htlc_create, uint64_t);
+FAKE_VALUE_FUNC(bool, ln_db_forward_del_htlc_create, uint64_t);
+
+
+////////////////////////////////////////////////////////////////////////
+namespace dummy {
+    void lnapp_conf_init(lnapp_conf_t *pAppConf, const uint8_t *pPeerNodeId, thread_start_t pThreadChannelStart) {
+        memset(pAppConf, 0, sizeof(lnapp_conf_t));
+        memcpy(pAppConf->node_id, pPeerNodeId, BTC_SZ_PUBKEY);
+        pAppConf->enabled = true;
+        pAppConf->p_thread_channel_start = pThreadChannelStart;
+    }
+
+    ln_status_t ln_status_get(const ln_channel_t *pChannel) {
+        return pChannel->status;
+    }
+
+    void ln_db_copy_channel(ln_channel_t *pOutChannel, const ln_channel_t *pInChannel) {
+        pOutChannel->short_channel_id = pInChannel->short_channel_id;
+        pOutChannel->status = pInChannel->status;
+    }
+
+    //DBに3channelある
+    bool ln_db_channel_search_cont(ln_db_func_cmp_t pFunc, void *pFuncParam) {
+        for (int lp = 0; lp < 3; lp++) {
+            ln_channel_t channel;
+            memset(&channel, 0, sizeof(channel));
+            channel.peer_node_id[0] = 0x02;
+            channel.peer_node_id[1] = (uint8_t)(0xd0 + lp);
+            channel.short_channel_id = (lp != 2) ? 0x123456000001ULL + lp : 0;
+            channel.status = LN_STATUS_NORMAL_OPE;
+            if (!(*pFunc)(&channel, NULL, pFuncParam)) return false;
+        }
+        return true;
+    }
+}
+////////////////////////////////////////////////////////////////////////
+
+class lnapp_manager: public testing::Test {
+protected:
+    virtual void SetUp() {
+        utl_log_init_stderr();
+        RESET_FAKE(lnapp_conf_init)
+        RESET_FAKE(lnapp_conf_term)
+        RESET_FAKE(lnapp_start)
+        RESET_FAKE(_lnapp_stop_and_join)
+        RESET_FAKE(lnapp_stop)
+        RESET_FAKE(lnapp_join)
+        RESET_FAKE(ln_status_get)
+        RESET_FAKE(ln_db_channel_search_cont)
+        RESET_FAKE(ln_db_copy_channel)
+        RESET_FAKE(ln_db_cnlanno_load)
+        RESET_FAKE(ln_db_forward_add_htlc_create)
+        RESET_FAKE(ln_db_forward_del_htlc_create)
+        lnapp_conf_init_fake.custom_fake = dummy::lnapp_conf_init;
+        ln_status_get_fake.custom_fake = dummy::ln_status_get;
+        ln_db_copy_channel_fake.custom_fake = dummy::ln_db_copy_channel;
+        ln_db_channel_search_cont_fake.return_val = true;
+        ln_db_forward_add_htlc_create_fake.return_val = true;
+        ln_db_forward_del_htlc_create_fake.return_val = true;
+        lnapp_manager_init();
+    }
+
+    virtual void TearDown() {
+        lnapp_manager_term();
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    static void node_id(uint8_t *pNodeId, int Idx) {
+        memset(pNodeId, 0, BTC_SZ_PUBKEY);
+        pNodeId[0] = 0x03;
+        pNodeId[BTC_SZ_PUBKEY - 2] = (uint8_t)(Idx >> 8);
+        pNodeId[BTC_SZ_PUBKEY - 1] = (uint8_t)Idx;
+    }
+
+    static void cb_count(lnapp_conf_t *pConf, void *pParam) {
+        int *p_cnt = (int *)pParam;
+        (*p_cnt)++;
+        //callback中は参照されている
+        ASSERT_GT(pConf->ref_counter, 0);
+        //callback中に同じshardを検索できる
+        lnapp_conf_t *p_conf = lnapp_manager_get_node(pConf->node_id);
+        ASSERT_EQ(pConf, p_conf);
+        lnapp_manager_free_node_ref(p_conf);
+    }
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(lnapp_manager, get_node)
+{
+    //bucket数を超える数を登録しても検索できる
+    const int NUM = 600;
+    uint8_t id[BTC_SZ_PUBKEY];
+    lnapp_conf_t *p_conf[NUM];
+
+    for (int lp = 0; lp < NUM; lp++) {
+        node_id(id, lp);
+        p_conf[lp] = lnapp_manager_get_new_node(id, lnapp_thread_channel_start);
+        ASSERT_TRUE(p_conf[lp] != NULL);
+        ASSERT_EQ(1, p_conf[lp]->ref_counter);
+    }
+    ASSERT_EQ(NUM, lnapp_conf_init_fake.call_count);
+
+    //登録済み
+    node_id(id, 10);
+    ASSERT_TRUE(lnapp_manager_get_new_node(id, lnapp_thread_channel_start) == NULL);
+    ASSERT_EQ(1, lnapp_conf_term_fake.call_count);
+
+    for (int lp = 0; lp < NUM; lp++) {
+        node_id(id, lp);
+        lnapp_conf_t *p = lnapp_manager_get_node(id);
+        ASSERT_EQ(p_conf[lp], p);
+        ASSERT_EQ(2, p->ref_counter);
+        lnapp_manager_free_node_ref(p);
+        lnapp_manager_free_node_ref(p);
+        ASSERT_EQ(0, p->ref_counter);
+    }
+
+    //未登録
+    node_id(id, NUM);
+    ASSERT_TRUE(lnapp_manager_get_node(id) == NULL);
+}
+
+
+TEST_F(lnapp_manager, each_node)
+{
+    ASSERT_TRUE(lnapp_manager_start_origin_node(lnapp_thread_channel_start));
+    ASSERT_EQ(1, lnapp_start_fake.call_count);
+
+    const int NUM = 50;
+    uint8_t id[BTC_SZ_PUBKEY];
+    for (int lp = 0; lp < NUM; lp++) {
+        node_id(id, lp);
+        lnapp_conf_t *p_conf = lnapp_manager_get_new_node(id, lnapp_thread_channel_start);
+        lnapp_manager_free_node_ref(p_conf);
+    }
+
+    //origin nodeは含まない
+    int cnt = 0;
+    lnapp_manager_each_node(cb_count, &cnt);
+    ASSERT_EQ(NUM, cnt);
+
+    for (int lp = 0; lp < NUM; lp++) {
+        node_id(id, lp);
+        lnapp_conf_t *p_conf = lnapp_manager_get_node(id);
+        ASSERT_EQ(1, p_conf->ref_counter);
+        lnapp_manager_free_node_ref(p_conf);
+    }
+    lnapp_conf_t *p_origin = lnapp_manager_get_node(mNodeIdOrigin);
+    ASSERT_TRUE(p_origin != NULL);
+    lnapp_manager_free_node_ref(p_origin);
+}
+
+
+TEST_F(lnapp_manager, short_channel_id)
+{
+    const int NUM = 200;
+    uint8_t id[BTC_SZ_PUBKEY];
+    for (int lp = 0; lp < NUM; lp++) {
+        node_id(id, lp);
+        lnapp_conf_t *p_conf = lnapp_manager_get_new_node(id, lnapp_thread_channel_start);
+        lnapp_manager_free_node_ref(p_conf);
+        lnapp_manager_set_short_channel_id(id, 0x600000000000ULL + ((uint64_t)lp << 40));
+    }
+
+    for (int lp = 0; lp < NUM; lp++) {
+        lnapp_conf_t *p_conf = lnapp_manager_get_node_by_short_channel_id(0x600000000000ULL + ((uint64_t)lp << 40));
+        ASSERT_TRUE(p_conf != NULL);
+        node_id(id, lp);
+        ASSERT_EQ(0, memcmp(id, p_conf->node_id, BTC_SZ_PUBKEY));
+        lnapp_manager_free_node_ref(p_conf);
+    }
+    ASSERT_TRUE(lnapp_manager_get_node_by_short_channel_id(0) == NULL);
+    ASSERT_TRUE(lnapp_manager_get_node_by_short_channel_id(0x123) == NULL);
+
+    //付け替え
+    node_id(id, 5);
+    lnapp_manager_set_short_channel_id(id, 0x777);
+    ASSERT_TRUE(lnapp_manager_get_node_by_short_channel_id(0x600000000000ULL + (5ULL << 40)) == NULL);
+    lnapp_conf_t *p_conf = lnapp_manager_get_node_by_short_channel_id(0x777);
+    ASSERT_TRUE(p_conf != NULL);
+    ASSERT_EQ(0, memcmp(id, p_conf->node_id, BTC_SZ_PUBKEY));
+    lnapp_manager_free_node_ref(p_conf);
+    ASSERT_EQ(NUM, mScid.num);
+}
+
+
+TEST_F(lnapp_manager, prune)
+{
+    uint8_t id[BTC_SZ_PUBKEY];
+    lnapp_conf_t *p_conf[4];
+    for (int lp = 0; lp < 4; lp++) {
+        node_id(id, lp);
+        p_conf[lp] = lnapp_manager_get_new_node(id, lnapp_thread_channel_start);
+    }
+    p_conf[0]->channel.status = LN_STATUS_NONE;          //channelなし
+    p_conf[1]->channel.status = LN_STATUS_NORMAL_OPE;    //channel動作中
+    p_conf[2]->channel.status = LN_STATUS_CLOSED;
+    p_conf[3]->channel.status = LN_STATUS_NONE;          //参照中
+    node_id(id, 2);
+    lnapp_manager_set_short_channel_id(id, 0x1234);
+    for (int lp = 0; lp < 3; lp++) {
+        lnapp_manager_free_node_ref(p_conf[lp]);
+    }
+
+    lnapp_manager_prune_node();
+    ASSERT_EQ(1, lnapp_stop_fake.call_count);
+    ASSERT_EQ(2, lnapp_join_fake.call_count);
+    ASSERT_EQ(2, lnapp_conf_term_fake.call_count);
+
+    node_id(id, 0);
+    ASSERT_TRUE(lnapp_manager_get_node(id) == NULL);
+    node_id(id, 2);
+    ASSERT_TRUE(lnapp_manager_get_node(id) == NULL);
+    ASSERT_TRUE(lnapp_manager_get_node_by_short_channel_id(0x1234) == NULL);
+    ASSERT_EQ(0, mScid.num);
+    node_id(id, 1);
+    lnapp_conf_t *p = lnapp_manager_get_node(id);
+    ASSERT_EQ(p_conf[1], p);
+    lnapp_manager_free_node_ref(p);
+
+    //参照がなくなれば削除する
+    lnapp_manager_free_node_ref(p_conf[3]);
+    lnapp_manager_prune_node();
+    node_id(id, 3);
+    ASSERT_TRUE(lnapp_manager_get_node(id) == NULL);
+    ASSERT_EQ(3, lnapp_conf_term_fake.call_count);
+}
+
+
+TEST_F(lnapp_manager, load_channel)
+{
+    //SetUp()のinitでは読み込んでいない
+    lnapp_manager_term();
+    RESET_FAKE(lnapp_conf_term)
+    ln_db_channel_search_cont_fake.custom_fake = dummy::ln_db_channel_search_cont;
+    lnapp_manager_init();
+
+    ASSERT_EQ(2, ln_db_cnlanno_load_fake.call_count);
+    for (int lp = 0; lp < 2; lp++) {
+        lnapp_conf_t *p_conf = lnapp_manager_get_node_by_short_channel_id(0x123456000001ULL + lp);
+        ASSERT_TRUE(p_conf != NULL);
+        ASSERT_EQ(0xd0 + lp, p_conf->node_id[1]);
+        lnapp_manager_free_node_ref(p_conf);
+    }
+    uint8_t id[BTC_SZ_PUBKEY] = { 0x02, 0xd2 };
+    lnapp_conf_t *p_conf = lnapp_manager_get_node(id);
+    ASSERT_TRUE(p_conf != NULL);
+    ASSERT_EQ(0, p_conf->channel.short_channel_id);
+    lnapp_manager_free_node_ref(p_conf);
+}
@@ -0,0 +1,225 @@
+#include "gtest/gtest.h"
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include "tests/fff.h"
+DEFINE_FFF_GLOBALS;
+
+
+extern "C" {
+#undef LOG_TAG
+#include "../../utl/utl_log.c"
+#undef LOG_TAG
+#include "../../utl/utl_dbg.c"
+#include "../../utl/utl_buf.c"
+#include "../../utl/utl_int.c"
+#include "../../utl/utl_time.c"
+#include "../../utl/utl_str.c"
+//評価対象本体
+#undef LOG_TAG
+#include "lnapp_sendq.c"
+}
+
+
+////////////////////////////////////////////////////////////////////////
+//FAKE関数
+
+FAKE_VALUE_FUNC(bool, ln_noise_enc_frame, ln_noise_t *, uint8_t *, const uint8_t *, uint16_t);
+
+
+////////////////////////////////////////////////////////////////////////
+namespace dummy {
+    //暗号化の代わりにlengthをそのまま置き、MACを0xccで埋める
+    bool ln_noise_enc_frame(ln_noise_t *pCtx, uint8_t *pFrame, const uint8_t *pData, uint16_t Len) {
+        memmove(pFrame + sizeof(uint16_t) + LN_SZ_NOISE_MAC, pData, Len);
+        pFrame[0] = (uint8_t)(Len >> 8);
+        pFrame[1] = (uint8_t)Len;
+        memset(pFrame + sizeof(uint16_t), 0xcc, LN_SZ_NOISE_MAC);
+        memset(pFrame + sizeof(uint16_t) + LN_SZ_NOISE_MAC + Len, 0xcc, LN_SZ_NOISE_MAC);
+        return true;
+    }
+}
+////////////////////////////////////////////////////////////////////////
+
+class lnapp_sendq: public testing::Test {
+protected:
+    virtual void SetUp() {
+        utl_log_init_stderr();
+        RESET_FAKE(ln_noise_enc_frame)
+        ln_noise_enc_frame_fake.custom_fake = dummy::ln_noise_enc_frame;
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, mSock));
+        fcntl(mSock[0], F_SETFL, fcntl(mSock[0], F_GETFL) | O_NONBLOCK);
+        lnapp_sendq_init(&mQ);
+        memset(&mNoise, 0, sizeof(mNoise));
+    }
+
+    virtual void TearDown() {
+        lnapp_sendq_term(&mQ);
+        close(mSock[0]);
+        close(mSock[1]);
+        ASSERT_EQ(0, utl_dbg_malloc_cnt());
+    }
+
+public:
+    //1メッセージ受信(message長を返す)
+    static uint16_t recv_msg(int Sock, uint8_t *pBuf) {
+        uint8_t hdr[sizeof(uint16_t) + LN_SZ_NOISE_MAC];
+        if (!recv_all(Sock, hdr, sizeof(hdr))) return 0;
+        uint16_t len = ((uint16_t)hdr[0] << 8) | hdr[1];
+        if (!recv_all(Sock, pBuf, len + LN_SZ_NOISE_MAC)) return 0;
+        return len;
+    }
+    static bool recv_all(int Sock, uint8_t *pBuf, size_t Len) {
+        while (Len > 0) {
+            ssize_t sz = read(Sock, pBuf, Len);
+            if (sz <= 0) return false;
+            pBuf += sz;
+            Len -= sz;
+        }
+        return true;
+    }
+
+public:
+    int mSock[2];
+    lnapp_sendq_t mQ;
+    ln_noise_t mNoise;
+};
+
+
+////////////////////////////////////////////////////////////////////////
+
+TEST_F(lnapp_sendq, push_flush)
+{
+    const uint8_t MSG1[] = { 0x00, 0x12, 0x01, 0x02 };
+    const uint8_t MSG2[] = { 0x00, 0x13, 0x03 };
+
+    ASSERT_TRUE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_HIGH, MSG1, sizeof(MSG1)));
+    ASSERT_TRUE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_HIGH, MSG2, sizeof(MSG2)));
+    ASSERT_TRUE(lnapp_sendq_pending(&mQ));
+    ASSERT_EQ(0, ln_noise_enc_frame_fake.call_count);   //pushでは暗号化しない
+
+    ASSERT_TRUE(lnapp_sendq_flush(&mQ, mSock[0], &mNoise));
+    ASSERT_FALSE(lnapp_sendq_pending(&mQ));
+    ASSERT_EQ(2, ln_noise_enc_frame_fake.call_count);
+    ASSERT_EQ(0, lnapp_sendq_bytes(&mQ, LNAPP_SENDQ_LANE_HIGH));
+
+    uint8_t buf[100];
+    ASSERT_EQ(sizeof(MSG1), recv_msg(mSock[1], buf));
+    ASSERT_EQ(0, memcmp(MSG1, buf, sizeof(MSG1)));
+    ASSERT_EQ(sizeof(MSG2), recv_msg(mSock[1], buf));
+    ASSERT_EQ(0, memcmp(MSG2, buf, sizeof(MSG2)));
+}
+
+
+TEST_F(lnapp_sendq, priority)
+{
+    const uint8_t BULK[] = { 0x01, 0x02, 0xaa };
+    const uint8_t HIGH[] = { 0x00, 0x80, 0xbb };
+
+    //BULKを先に入れても、HIGHが先に送信される
+    for (int lp = 0; lp < 3; lp++) {
+        ASSERT_TRUE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_BULK, BULK, sizeof(BULK)));
+    }
+    ASSERT_TRUE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_HIGH, HIGH, sizeof(HIGH)));
+    ASSERT_TRUE(lnapp_sendq_flush(&mQ, mSock[0], &mNoise));
+
+    uint8_t buf[100];
+    ASSERT_EQ(sizeof(HIGH), recv_msg(mSock[1], buf));
+    ASSERT_EQ(0, memcmp(HIGH, buf, sizeof(HIGH)));
+    for (int lp = 0; lp < 3; lp++) {
+        ASSERT_EQ(sizeof(BULK), recv_msg(mSock[1], buf));
+        ASSERT_EQ(0, memcmp(BULK, buf, sizeof(BULK)));
+    }
+}
+
+
+TEST_F(lnapp_sendq, partial_write)
+{
+    //socketに書き込みきれない量を入れ、受信側が読むたびに続きを送信する
+    const int NUM = 200;
+    const uint16_t LEN = 4000;
+    uint8_t *p_msg = (uint8_t *)malloc(LEN);
+    for (int lp = 0; lp < NUM; lp++) {
+        memset(p_msg, (uint8_t)lp, LEN);
+        ASSERT_TRUE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_BULK, p_msg, LEN));
+    }
+    ASSERT_TRUE(lnapp_sendq_flush(&mQ, mSock[0], &mNoise));
+    ASSERT_TRUE(lnapp_sendq_pending(&mQ));
+    ASSERT_GT(lnapp_sendq_bytes(&mQ, LNAPP_SENDQ_LANE_BULK), 0);
+    //全部は暗号化しない
+    ASSERT_LT(ln_noise_enc_frame_fake.call_count, NUM);
+
+    //受信側を少しずつ読み、途中で書き込みが切れたframeの続きが正しく届くこと
+    uint8_t *p_recv = (uint8_t *)malloc(LEN + LN_SZ_NOISE_MAC);
+    for (int lp = 0; lp < NUM; lp++) {
+        ASSERT_EQ(LEN, recv_msg(mSock[1], p_recv));
+        for (int lp2 = 0; lp2 < LEN; lp2++) {
+            ASSERT_EQ((uint8_t)lp, p_recv[lp2]);
+        }
+        ASSERT_TRUE(lnapp_sendq_flush(&mQ, mSock[0], &mNoise));
+    }
+    ASSERT_FALSE(lnapp_sendq_pending(&mQ));
+    ASSERT_EQ(NUM, ln_noise_enc_frame_fake.call_count);
+    free(p_recv);
+    free(p_msg);
+}
+
+
+TEST_F(lnapp_sendq, wait)
+{
+    const uint16_t LEN = 60000;
+    uint8_t *p_msg = (uint8_t *)calloc(1, LEN);
+    for (int lp = 0; lp < 10; lp++) {
+        ASSERT_TRUE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_BULK, p_msg, LEN));
+    }
+    ASSERT_TRUE(lnapp_sendq_flush(&mQ, mSock[0], &mNoise));
+
+    //相手が受信しないのでタイムアウトする
+    ASSERT_FALSE(lnapp_sendq_wait(&mQ, LNAPP_SENDQ_LANE_BULK, 1024, 10));
+    //HIGHはBULKの未暗号化分を含まない
+    ASSERT_LT(lnapp_sendq_bytes(&mQ, LNAPP_SENDQ_LANE_HIGH), lnapp_sendq_bytes(&mQ, LNAPP_SENDQ_LANE_BULK));
+
+    uint8_t *p_recv = (uint8_t *)malloc(LEN + LN_SZ_NOISE_MAC);
+    for (int lp = 0; lp < 10; lp++) {
+        ASSERT_EQ(LEN, recv_msg(mSock[1], p_recv));
+        ASSERT_TRUE(lnapp_sendq_flush(&mQ, mSock[0], &mNoise));
+    }
+    ASSERT_TRUE(lnapp_sendq_wait(&mQ, LNAPP_SENDQ_LANE_BULK, 0, 10));
+    free(p_recv);
+    free(p_msg);
+}
+
+
+TEST_F(lnapp_sendq, lane_full)
+{
+    //相手が受信しない場合はlaneの上限で失敗する
+    const uint16_t LEN = 60000;
+    uint8_t *p_msg = (uint8_t *)calloc(1, LEN);
+    bool ret = true;
+    for (int lp = 0; ret && (lp < 1000); lp++) {
+        ret = lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_HIGH, p_msg, LEN);
+    }
+    ASSERT_FALSE(ret);
+    ASSERT_LE(lnapp_sendq_bytes(&mQ, LNAPP_SENDQ_LANE_HIGH), 1024 * 1024);
+
+    lnapp_sendq_clear(&mQ);
+    ASSERT_FALSE(lnapp_sendq_pending(&mQ));
+    ASSERT_TRUE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_HIGH, p_msg, LEN));
+    free(p_msg);
+}
+
+
+TEST_F(lnapp_sendq, write_error)
+{
+    const uint8_t MSG[] = { 0x00, 0x12, 0x01 };
+
+    close(mSock[1]);
+    mSock[1] = open("/dev/null", O_RDONLY);
+    signal(SIGPIPE, SIG_IGN);
+    ASSERT_TRUE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_HIGH, MSG, sizeof(MSG)));
+    ASSERT_FALSE(lnapp_sendq_flush(&mQ, mSock[0], &mNoise));
+    //エラー後は追加できない
+    ASSERT_FALSE(lnapp_sendq_push(&mQ, LNAPP_SENDQ_LANE_HIGH, MSG, sizeof(MSG)));
+    ASSERT_FALSE(lnapp_sendq_wait(&mQ, LNAPP_SENDQ_LANE_HIGH, 0, 10));
+}
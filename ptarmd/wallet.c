@@ -116,6 +116,9 @@ bool wallet_from_ptarm(void *pJson, bool bToSend, const char *pAddr, uint32_t Fe
     }
 
     //署名
+    //  hashPrevouts, hashSequence, hashOutputsは全vinで共通
+    btc_sw_sighash_ctx_t sighash_ctx;
+    btc_sw_sighash_ctx_init(&sighash_ctx);
     for (uint32_t lp = 0; lp < wallet.tx.vin_cnt; lp++) {
         btc_vin_t *p_vin = &wallet.tx.vin[lp];
         const uint8_t *p = p_vin->witness[0].buf;
@@ -138,11 +141,11 @@ bool wallet_from_ptarm(void *pJson, bool bToSend, const char *pAddr, uint32_t Fe
         switch (type) {
         case LN_DB_WALLET_TYPE_TO_REMOTE:
             btc_script_p2wpkh_create_scriptcode(&script_code, p_vin->witness[1].buf);
-            ret = btc_sw_sighash(&wallet.tx, txhash, lp, amount, &script_code);
+            ret = btc_sw_sighash_ctx(&sighash_ctx, &wallet.tx, txhash, lp, amount, &script_code);
             break;
         case LN_DB_WALLET_TYPE_TO_LOCAL:
         case LN_DB_WALLET_TYPE_HTLC_OUTPUT:
-            ret = btc_sw_sighash_p2wsh_wit(&wallet.tx, txhash, lp, amount,
+            ret = btc_sw_sighash_p2wsh_wit_ctx(&sighash_ctx, &wallet.tx, txhash, lp, amount,
                                                 &p_vin->witness[p_vin->wit_item_cnt-1]);
             break;
         default:
@@ -83,6 +83,8 @@
 
 #define M_SZ_CNLANNO_INFO       (sizeof(uint64_t) + 1)
 #define M_SZ_NODEANNO_INFO      (BTC_SZ_PUBKEY)
+#define M_ANNO_GEN_MASK         ((uint16_t)0x7fff)
+#define M_ANNO_GEN_UNSENT       ((uint16_t)0x8000)
 
 //BOLT message
 #define MSGTYPE_CHANNEL_ANNOUNCEMENT        ((uint16_t)0x0100)
@@ -871,17 +873,22 @@ static void dumpit_annoinfo(MDB_txn *txn, MDB_dbi dbi, ln_lmdb_db_type_t db_type
             continue;
         }
 
-        int nums = data.mv_size / BTC_SZ_PUBKEY;
+        //seq(4) + (slot(2) + gen(2)) * n
         const uint8_t *p_data = (const uint8_t *)data.mv_data;
+        uint32_t seq = 0;
+        if (data.mv_size >= sizeof(uint32_t)) {
+            memcpy(&seq, p_data, sizeof(uint32_t));
+        }
+        printf(INDENT2 M_QQ("seq") ": %" PRIu32 ",\n", seq);
         printf(INDENT2 M_QQ("sent") ": [\n");
-        for (int lp = 0; lp < nums; lp++) {
-            if (lp > 0) {
+        for (size_t pos = sizeof(uint32_t); pos + sizeof(uint16_t) * 2 <= data.mv_size; pos += sizeof(uint16_t) * 2) {
+            uint16_t entry[2];
+            memcpy(entry, p_data + pos, sizeof(entry));
+            if (pos > sizeof(uint32_t)) {
                 printf(",\n");
             }
-            printf(INDENT3 "\"");
-            utl_dbg_dump(stdout, p_data, BTC_SZ_PUBKEY, false);
-            printf("\"");
-            p_data += BTC_SZ_PUBKEY;
+            printf(INDENT3 "{ " M_QQ("slot") ": %u, " M_QQ("gen") ": %u, " M_QQ("unsent") ": %s }",
+                entry[0], entry[1] & M_ANNO_GEN_MASK, (entry[1] & M_ANNO_GEN_UNSENT) ? "true" : "false");
         }
         printf("\n" INDENT2 "]\n" INDENT1 "}");
         cnt_annoinfo++;
@@ -40,7 +40,7 @@
  **************************************************************************/
 
 #ifdef PTARM_DEBUG_MEM
-static int mcount = 0;
+static int mcount = 0;     //複数threadから更新するため、__sync_fetch_and_xxx()で増減する
 #endif  //PTARM_DEBUG_MEM
 
 
@@ -85,7 +85,7 @@ void HIDDEN *utl_dbg_malloc(size_t Size, const char* pFname, int Line, const cha
 {
     void *p = malloc(Size);
     if (p) {
-        mcount++;
+        __sync_fetch_and_add(&mcount, 1);
     }
     LOGD("UTL_DBG_MALLOC:%d -- %s[%d]\n", utl_dbg_malloc_cnt(), pFname, Line);
     return p;
@@ -96,7 +96,7 @@ void HIDDEN *utl_dbg_realloc(void *pBuf, size_t Size, const char* pFname, int Li
 {
     void *p = realloc(pBuf, Size);
     if ((pBuf == NULL) && p) {
-        mcount++;
+        __sync_fetch_and_add(&mcount, 1);
     }
     LOGD("UTL_DBG_REALLOC:%d -- %s[%d]\n", utl_dbg_malloc_cnt(), pFname, Line);
     return p;
@@ -107,7 +107,7 @@ void HIDDEN *utl_dbg_calloc(size_t Block, size_t Size, const char* pFname, int L
 {
     void *p = calloc(Block, Size);
     if (p) {
-        mcount++;
+        __sync_fetch_and_add(&mcount, 1);
     }
     LOGD("UTL_DBG_CALLOC:%d -- %s[%d]\n", utl_dbg_malloc_cnt(), pFname, Line);
     return p;
@@ -117,7 +117,7 @@ char HIDDEN *utl_dbg_strdup(const char *pStr, const char* pFname, int Line, cons
 {
     char *p = strdup(pStr);
     if (p) {
-        mcount++;
+        __sync_fetch_and_add(&mcount, 1);
     }
     LOGD("UTL_DBG_STRDUP:%d -- %s[%d]\n", utl_dbg_malloc_cnt(), pFname, Line);
     return p;
@@ -127,7 +127,7 @@ void HIDDEN utl_dbg_free(void *pBuf, const char* pFname, int Line, const char *p
 {
     //NULL代入してfree()だけするパターンもあるため、NULLチェックする
     if (pBuf) {
-        mcount--;
+        __sync_fetch_and_sub(&mcount, 1);
     }
     free(pBuf);
     LOGD("UTL_DBG_FREE:%d -- %s[%d]\n", utl_dbg_malloc_cnt(), pFname, Line);
@@ -152,7 +152,7 @@ void HIDDEN *utl_dbg_malloc(size_t Size, const char* pFname, int Line, const cha
                 break;
             }
         }
-        mcount++;
+        __sync_fetch_and_add(&mcount, 1);
     } else {
         printf("0 malloc\n");
     }
@@ -173,7 +173,7 @@ void HIDDEN *utl_dbg_realloc(void *pBuf, size_t Size, const char* pFname, int Li
             }
         }
     } else if ((pBuf == NULL) && p) {
-        mcount++;
+        __sync_fetch_and_add(&mcount, 1);
         for (int lp = 0; lp < 100; lp++) {
             if (mem[lp].p == 0) {
                 mem[lp].allocs++;
@@ -192,7 +192,7 @@ void HIDDEN *utl_dbg_calloc(size_t Block, size_t Size, const char* pFname, int L
 {
     void *p = calloc(Block, Size);
     if (p) {
-        mcount++;
+        __sync_fetch_and_add(&mcount, 1);
         for (int lp = 0; lp < 100; lp++) {
             if (mem[lp].p == 0) {
                 mem[lp].allocs++;
@@ -216,7 +216,7 @@ char HIDDEN *utl_dbg_strdup(const char *pStr, const char* pFname, int Line, cons
                 break;
             }
         }
-        mcount++;
+        __sync_fetch_and_add(&mcount, 1);
     } else {
         printf("0 strdup\n");
     }
@@ -228,7 +228,7 @@ void HIDDEN utl_dbg_free(void *pBuf, const char* pFname, int Line, const char *p
 {
     //NULL代入してfree()だけするパターンもあるため、NULLチェックする
     if (pBuf) {
-        mcount--;
+        __sync_fetch_and_sub(&mcount, 1);
         for (int lp = 0; lp < 100; lp++) {
             if (mem[lp].p == pBuf) {
                 mem[lp].allocs--;